@@ -23,6 +23,8 @@
  */
 
 #include "context.hpp"
+#include "value.hpp"
+#include "hash.hpp"
 #include <stdlib.h>
 
 namespace LLVMBC
@@ -34,11 +36,110 @@ LLVMContext::LLVMContext()
 LLVMContext::~LLVMContext()
 {
 	for (size_t i = typed_allocations.size(); i; i--)
-		typed_allocations[i - 1]->run();
+		typed_allocations[i - 1].run(typed_allocations[i - 1].ptr);
 	for (size_t i = raw_allocations.size(); i; i--)
 		dxil_spv::free_in_thread(raw_allocations[i - 1]);
 }
 
+void LLVMContext::set_value_id(Value *value, uint32_t id)
+{
+	value->set_value_id(id);
+}
+
+Type *LLVMContext::find_type(uint64_t hash, TypeMatchFunc match, const void *key) const
+{
+	if (type_table.empty())
+		return nullptr;
+
+	size_t mask = type_table.size() - 1;
+	for (size_t i = size_t(hash) & mask;; i = (i + 1) & mask)
+	{
+		auto &entry = type_table[i];
+		if (!entry.type)
+			return nullptr;
+		if (entry.hash == hash && match(entry.type, key))
+			return entry.type;
+	}
+}
+
+void LLVMContext::insert_type(uint64_t hash, Type *type)
+{
+	// Keep the load factor at or below 3/4.
+	if ((type_count + 1) * 4 > type_table.size() * 3)
+	{
+		Vector<TypeEntry> old_table(type_table.empty() ? 64 : type_table.size() * 2);
+		std::swap(old_table, type_table);
+		type_count = 0;
+		for (auto &entry : old_table)
+			if (entry.type)
+				insert_type(entry.hash, entry.type);
+	}
+
+	size_t mask = type_table.size() - 1;
+	size_t i = size_t(hash) & mask;
+	while (type_table[i].type)
+		i = (i + 1) & mask;
+	type_table[i] = { hash, type };
+	type_count++;
+}
+
+uint64_t LLVMContext::hash_string(const String &str)
+{
+	return dxil_spv::hash_fast(str.data(), str.size());
+}
+
+size_t LLVMContext::find_interned_slot(const String &str, uint64_t hash) const
+{
+	size_t mask = interned_strings.size() - 1;
+	for (size_t i = size_t(hash) & mask;; i = (i + 1) & mask)
+	{
+		auto *entry = interned_strings[i];
+		if (!entry || (entry->hash == hash && entry->str == str))
+			return i;
+	}
+}
+
+const String *LLVMContext::find_interned_string(const String &str) const
+{
+	if (interned_strings.empty())
+		return nullptr;
+
+	auto *entry = interned_strings[find_interned_slot(str, hash_string(str))];
+	return entry ? &entry->str : nullptr;
+}
+
+const String *LLVMContext::intern_string(const String &str)
+{
+	uint64_t hash = hash_string(str);
+
+	if (!interned_strings.empty())
+		if (auto *entry = interned_strings[find_interned_slot(str, hash)])
+			return &entry->str;
+
+	// Keep the load factor at or below 3/4.
+	if ((interned_string_count + 1) * 4 > interned_strings.size() * 3)
+	{
+		Vector<InternedString *> old_strings(interned_strings.empty() ? 64 : interned_strings.size() * 2);
+		std::swap(old_strings, interned_strings);
+		size_t mask = interned_strings.size() - 1;
+
+		for (auto *entry : old_strings)
+		{
+			if (!entry)
+				continue;
+			size_t i = size_t(entry->hash) & mask;
+			while (interned_strings[i])
+				i = (i + 1) & mask;
+			interned_strings[i] = entry;
+		}
+	}
+
+	auto *entry = construct<InternedString>(InternedString{ str, hash });
+	interned_strings[find_interned_slot(str, hash)] = entry;
+	interned_string_count++;
+	return &entry->str;
+}
+
 void *LLVMContext::allocate_from_chain(uintptr_t size, uintptr_t align)
 {
 	current_block = (current_block + align - 1) & ~(align - 1);
@@ -28,10 +28,12 @@
 #include <exception>
 #include <stdint.h>
 #include <stddef.h>
+#include <type_traits>
 
 namespace LLVMBC
 {
 class Type;
+class Value;
 
 class LLVMContext
 {
@@ -48,6 +50,7 @@ public:
 		if (!mem)
 			std::terminate();
 		T *t = new (mem) T(std::forward<U>(u)...);
+		assign_value_id(t, std::is_base_of<Value, T>());
 
 		if (!std::is_trivially_destructible<T>::value)
 			append_typed_destructor(t);
@@ -64,39 +67,62 @@ public:
 		for (size_t i = 0; i < n; i++)
 		{
 			T *tmp = new (&mem[i]) T(u...);
+			assign_value_id(tmp, std::is_base_of<Value, T>());
 			if (!std::is_trivially_destructible<T>::value)
 				append_typed_destructor(tmp);
 		}
 		return mem;
 	}
 
-	Vector<Type *> &get_type_cache()
+	// Uniquing table for types. The context does not know how types are laid out,
+	// so the caller supplies a structural hash and a predicate which compares a candidate against its key.
+	using TypeMatchFunc = bool (*)(const Type *type, const void *key);
+	Type *find_type(uint64_t hash, TypeMatchFunc match, const void *key) const;
+	// The type must not already be in the table.
+	void insert_type(uint64_t hash, Type *type);
+
+	// Upper bound of Value::get_value_id() for every value constructed so far.
+	uint32_t get_value_id_bound() const
 	{
-		return type_cache;
+		return next_value_id;
 	}
 
+	// Interned strings live as long as the context and are unique,
+	// so two interned strings are equal if and only if the pointers are equal.
+	const String *intern_string(const String &str);
+	// Returns nullptr if str was never interned, which means nothing in the context can refer to it.
+	const String *find_interned_string(const String &str) const;
+
 private:
 	void *allocate(size_t size, size_t align);
 
-	struct Deleter
+	// Plain function pointers, so registering a destructor does not need an allocation of its own.
+	struct Destructor
 	{
-		virtual ~Deleter() = default;
-		virtual void run() = 0;
+		void (*run)(void *ptr);
+		void *ptr;
 	};
 
 	template <typename T>
-	struct TypedDeleter : Deleter
+	static void run_destructor(void *ptr)
 	{
-		explicit TypedDeleter(T *ptr_)
-		    : ptr(ptr_)
-		{
-		}
-		void run() override
-		{
-			ptr->~T();
-		}
-		T *ptr;
-	};
+		static_cast<T *>(ptr)->~T();
+	}
+
+	uint32_t next_value_id = 0;
+
+	template <typename T>
+	void assign_value_id(T *value, std::true_type)
+	{
+		set_value_id(value, next_value_id++);
+	}
+
+	template <typename T>
+	void assign_value_id(T *, std::false_type)
+	{
+	}
+
+	static void set_value_id(Value *value, uint32_t id);
 
 	uintptr_t current_block = 0;
 	uintptr_t current_block_end = 0;
@@ -105,23 +131,33 @@ private:
 	void allocate_new_chain(size_t size, size_t align);
 
 	Vector<void *> raw_allocations;
-	Vector<Deleter *> typed_allocations;
-	Vector<Type *> type_cache;
+	Vector<Destructor> typed_allocations;
 
-	template <typename T, typename... U>
-	T *construct_trivial(U &&... u)
+	struct TypeEntry
 	{
-		T *mem = static_cast<T *>(allocate(sizeof(T), alignof(T)));
-		if (!mem)
-			std::terminate();
-		T *t = new (mem) T(std::forward<U>(u)...);
-		return t;
-	}
+		uint64_t hash;
+		Type *type;
+	};
+	// Open addressing with linear probing, the size is always a power of two.
+	Vector<TypeEntry> type_table;
+	size_t type_count = 0;
+
+	struct InternedString
+	{
+		String str;
+		uint64_t hash;
+	};
+	// Open addressing with linear probing, the size is always a power of two.
+	Vector<InternedString *> interned_strings;
+	size_t interned_string_count = 0;
+	static uint64_t hash_string(const String &str);
+	// Index of the slot holding str, or the empty slot where it would be inserted.
+	size_t find_interned_slot(const String &str, uint64_t hash) const;
 
 	template <typename T>
 	void append_typed_destructor(T *ptr)
 	{
-		typed_allocations.push_back(construct_trivial<TypedDeleter<T>>(ptr));
+		typed_allocations.push_back({ &run_destructor<T>, ptr });
 	}
 };
 
@@ -31,16 +31,36 @@
 #include "type.hpp"
 #include "value.hpp"
 #include <assert.h>
-#include <sstream>
+#include <stdio.h>
 #include <type_traits>
 
 namespace LLVMBC
 {
 struct StreamState
 {
-	StringStream stream;
+	// Everything is formatted straight into buffer.
+	// With a sink, the buffer is handed off in chunks so memory use stays bounded for large modules.
+	explicit StreamState(String &buffer_)
+	    : buffer(buffer_)
+	{
+	}
+
+	StreamState(String &buffer_, DisassemblySink sink_, void *userdata_)
+	    : buffer(buffer_), sink(sink_), userdata(userdata_)
+	{
+		buffer.reserve(FlushSize + FlushSize / 4);
+	}
+
+	enum { FlushSize = 64 * 1024 };
+	String &buffer;
+	DisassemblySink sink = nullptr;
+	void *userdata = nullptr;
 	unsigned indent = 0;
 
+	void maybe_flush();
+	void flush();
+	void append_uint(uint64_t value);
+
 	void append(Type *type);
 	void append(IntegerType *type);
 	void append(PointerType *type);
@@ -110,7 +130,14 @@ struct StreamState
 	template <typename T>
 	typename std::enable_if<std::is_integral<T>::value, void>::type append(T value)
 	{
-		stream << value;
+		if (std::is_signed<T>::value && value < 0)
+		{
+			buffer.push_back('-');
+			// Negate in unsigned space so the most negative value does not overflow.
+			append_uint(uint64_t(0) - uint64_t(int64_t(value)));
+		}
+		else
+			append_uint(uint64_t(value));
 	}
 
 	// Need this to avoid the generic template to be deduced.
@@ -121,6 +148,34 @@ struct StreamState
 	}
 };
 
+void StreamState::append_uint(uint64_t value)
+{
+	char buf[20];
+	char *end = buf + sizeof(buf);
+	char *ptr = end;
+	do
+	{
+		*--ptr = char('0' + value % 10);
+		value /= 10;
+	} while (value);
+	buffer.append(ptr, end);
+}
+
+void StreamState::flush()
+{
+	if (sink && !buffer.empty())
+	{
+		sink(userdata, buffer.data(), buffer.size());
+		buffer.clear();
+	}
+}
+
+void StreamState::maybe_flush()
+{
+	if (sink && buffer.size() >= FlushSize)
+		flush();
+}
+
 void StreamState::append(IntegerType *type)
 {
 	append("i", type->getBitWidth());
@@ -170,43 +225,44 @@ void StreamState::append(VectorType *type)
 
 void StreamState::append(bool v)
 {
-	stream << (v ? "true" : "false");
+	append(v ? "true" : "false");
 }
 
 void StreamState::append(float v)
 {
-	char buf[1024];
-	sprintf(buf, "%e", v);
-	append(buf);
+	append(double(v));
 }
 
 void StreamState::append(double v)
 {
-	char buf[1024];
-	sprintf(buf, "%e", v);
-	append(buf);
+	char buf[64];
+	int len = snprintf(buf, sizeof(buf), "%e", v);
+	if (len > 0)
+		buffer.append(buf, size_t(len) < sizeof(buf) ? size_t(len) : sizeof(buf) - 1);
 }
 
+// Lines are the natural place to hand off data to the sink.
 void StreamState::newline()
 {
-	stream << "\n";
-	for (unsigned i = 0; i < indent; i++)
-		stream << "  ";
+	maybe_flush();
+	buffer.push_back('\n');
+	buffer.append(2 * indent, ' ');
 }
 
 void StreamState::newline_noindent()
 {
-	stream << "\n";
+	maybe_flush();
+	buffer.push_back('\n');
 }
 
 void StreamState::append(const char *str)
 {
-	stream << str;
+	buffer.append(str);
 }
 
 void StreamState::append(const String &str)
 {
-	stream << str;
+	buffer.append(str);
 }
 
 void StreamState::begin_scope()
@@ -596,7 +652,7 @@ void StreamState::append(CallInst *call, bool decl)
 
 		for (auto itr = call->metadata_begin(); itr != call->metadata_end(); ++itr)
 		{
-			append(" !", itr->first, " ", itr->second);
+			append(" !", itr->kind, " ", itr->node);
 		}
 	}
 	else
@@ -936,10 +992,8 @@ void StreamState::append(Value *value, bool decl)
 		append("%", value->get_tween_id());
 }
 
-bool disassemble(Module &module, String &str)
+static void disassemble(Module &module, StreamState &state)
 {
-	StreamState state;
-
 	for (auto itr = module.global_begin(); itr != module.global_end(); ++itr)
 		state.append(&*itr, true);
 
@@ -955,7 +1009,7 @@ bool disassemble(Module &module, String &str)
 	for (auto itr = module.named_metadata_begin(); itr != module.named_metadata_end(); ++itr)
 	{
 		state.newline();
-		state.append(itr->second);
+		state.append(*itr);
 	}
 
 	state.newline();
@@ -965,8 +1019,24 @@ bool disassemble(Module &module, String &str)
 		state.newline();
 		state.append(*itr, true);
 	}
+}
 
-	str = state.stream.str();
+bool disassemble(Module &module, String &str)
+{
+	str.clear();
+	// Rough guess of the output size so the buffer rarely needs to grow.
+	str.reserve(size_t(module.get_value_id_bound()) * 32);
+	StreamState state(str);
+	disassemble(module, state);
+	return true;
+}
+
+bool disassemble(Module &module, DisassemblySink sink, void *userdata)
+{
+	String buffer;
+	StreamState state(buffer, sink, userdata);
+	disassemble(module, state);
+	state.flush();
 	return true;
 }
 } // namespace LLVMBC
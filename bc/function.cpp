@@ -45,6 +45,16 @@ const String &Function::getName() const
 	return module.get_value_name(value_id);
 }
 
+Function::CalleeKind Function::get_callee_kind() const
+{
+	return callee_kind;
+}
+
+void Function::set_callee_kind(CalleeKind kind)
+{
+	callee_kind = kind;
+}
+
 void Function::set_basic_blocks(Vector<BasicBlock *> basic_blocks_)
 {
 	basic_blocks = std::move(basic_blocks_);
@@ -91,6 +91,17 @@ public:
 	explicit Function(FunctionType *function_type, uint64_t value_id, Module &module);
 	const String &getName() const;
 
+	// Not part of the LLVM API. Classified once when the module symbol table assigns the name,
+	// so call sites can branch on an integer instead of looking up and comparing names.
+	enum class CalleeKind : uint8_t
+	{
+		Function,
+		DXILOp,
+		LLVMIntrinsic
+	};
+	CalleeKind get_callee_kind() const;
+	void set_callee_kind(CalleeKind kind);
+
 	void set_basic_blocks(Vector<BasicBlock *> basic_blocks);
 	IteratorAdaptor<BasicBlock, Vector<BasicBlock *>::const_iterator> begin() const;
 	IteratorAdaptor<BasicBlock, Vector<BasicBlock *>::const_iterator> end() const;
@@ -116,5 +127,6 @@ private:
 	Vector<BasicBlock *> basic_blocks;
 	Vector<Argument *> arguments;
 	Vector<std::pair<String, String>> attributes;
+	CalleeKind callee_kind = CalleeKind::Function;
 };
 } // namespace LLVMBC
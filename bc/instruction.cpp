@@ -24,6 +24,8 @@
 
 #include "instruction.hpp"
 #include "cast.hpp"
+#include "context.hpp"
+#include <algorithm>
 #include <assert.h>
 
 namespace LLVMBC
@@ -33,19 +35,32 @@ Instruction::Instruction(Type *type, ValueKind kind)
 {
 }
 
-void Instruction::set_operands(Vector<Value *> op)
+void Instruction::set_operands(std::initializer_list<Value *> ops)
 {
-	operands = std::move(op);
+	assert(ops.size() <= InlineOperands);
+	operands = inline_operands;
+	num_operands = unsigned(ops.size());
+	std::copy(ops.begin(), ops.end(), inline_operands);
+}
+
+void Instruction::set_operands(LLVMContext &context, const Vector<Value *> &ops)
+{
+	num_operands = unsigned(ops.size());
+	if (num_operands <= InlineOperands)
+		operands = inline_operands;
+	else
+		operands = context.construct_n<Value *>(num_operands);
+	std::copy(ops.begin(), ops.end(), operands);
 }
 
 unsigned Instruction::getNumOperands() const
 {
-	return operands.size();
+	return num_operands;
 }
 
 Value *Instruction::getOperand(unsigned index) const
 {
-	if (index >= operands.size())
+	if (index >= num_operands)
 	{
 		LOGE("Operand index is out of range.\n");
 		return nullptr;
@@ -66,9 +81,12 @@ void Instruction::set_terminator()
 
 bool Instruction::resolve_proxy_values()
 {
-	for (auto &op : operands)
+	for (unsigned i = 0; i < num_operands; i++)
+	{
+		auto &op = operands[i];
 		while (op && op->get_value_kind() == ValueKind::Proxy)
 			op = cast<ValueProxy>(op)->get_proxy_value();
+	}
 
 	if (get_value_kind() == ValueKind::PHI)
 	{
@@ -79,33 +97,39 @@ bool Instruction::resolve_proxy_values()
 	return true;
 }
 
-void Instruction::setMetadata(const String &str, MDNode *node)
+void Instruction::set_metadata_attachments(MetadataAttachment *attachments_, unsigned count)
 {
-	attachments[str] = node;
+	attachments = attachments_;
+	num_attachments = count;
 }
 
-UnorderedMap<String, MDNode *>::const_iterator Instruction::metadata_begin() const
+const MetadataAttachment *Instruction::metadata_begin() const
 {
-	return attachments.begin();
+	return attachments;
 }
 
-UnorderedMap<String, MDNode *>::const_iterator Instruction::metadata_end() const
+const MetadataAttachment *Instruction::metadata_end() const
 {
-	return attachments.end();
+	return attachments + num_attachments;
+}
+
+unsigned Instruction::get_num_metadata_attachments() const
+{
+	return num_attachments;
 }
 
 bool Instruction::hasMetadata(const String &str) const
 {
-	return attachments.find(str) != attachments.end();
+	return getMetadata(str) != nullptr;
 }
 
 MDNode *Instruction::getMetadata(const String &str) const
 {
-	auto itr = attachments.find(str);
-	if (itr != attachments.end())
-		return itr->second;
-	else
-		return nullptr;
+	// Very few instructions have more than one or two attachments, a linear scan is fine.
+	for (unsigned i = 0; i < num_attachments; i++)
+		if (str == attachments[i].kind)
+			return attachments[i].node;
+	return nullptr;
 }
 
 bool Instruction::is_base_of_value_kind(ValueKind kind)
@@ -190,11 +214,21 @@ UnreachableInst::UnreachableInst()
 	set_terminator();
 }
 
-CallInst::CallInst(FunctionType *function_type_, Function *callee_, Vector<Value *> params)
+CallInst::CallInst(FunctionType *function_type_, Function *callee_, const Vector<Value *> &params)
     : Instruction(function_type_->getReturnType(), ValueKind::Call)
     , callee(callee_)
 {
-	set_operands(std::move(params));
+	set_operands(function_type_->getContext(), params);
+
+	// Constants are parsed before the instructions using them. Anything else is left to getOperand().
+	if (!params.empty())
+	{
+		if (auto *constant = dyn_cast<ConstantInt>(params.front()))
+		{
+			constant_opcode = uint32_t(constant->getUniqueInteger().getZExtValue());
+			has_constant_opcode = true;
+		}
+	}
 }
 
 Function *CallInst::getCalledFunction() const
@@ -202,6 +236,14 @@ Function *CallInst::getCalledFunction() const
 	return callee;
 }
 
+bool CallInst::get_constant_opcode(uint32_t *opcode) const
+{
+	if (!has_constant_opcode)
+		return false;
+	*opcode = constant_opcode;
+	return true;
+}
+
 Value *ReturnInst::getReturnValue() const
 {
 	return Internal::resolve_proxy(value);
@@ -386,11 +428,11 @@ Value *AllocaInst::getArraySize() const
 	return Internal::resolve_proxy(array_size);
 }
 
-GetElementPtrInst::GetElementPtrInst(Type *pointer_type, Vector<Value *> indices, bool inbounds_)
+GetElementPtrInst::GetElementPtrInst(Type *pointer_type, const Vector<Value *> &indices, bool inbounds_)
     : Instruction(pointer_type, ValueKind::GetElementPtr)
     , inbounds(inbounds_)
 {
-	set_operands(std::move(indices));
+	set_operands(pointer_type->getContext(), indices);
 }
 
 bool GetElementPtrInst::isInBounds() const
@@ -25,6 +25,7 @@
 #pragma once
 
 #include "value.hpp"
+#include <initializer_list>
 
 namespace LLVMBC
 {
@@ -32,6 +33,14 @@ class FunctionType;
 class Function;
 class BasicBlock;
 class MDNode;
+class LLVMContext;
+
+struct MetadataAttachment
+{
+	// Interned in the LLVMContext, so kinds can be compared by pointer within one module.
+	const char *kind;
+	MDNode *node;
+};
 
 class Instruction : public Value
 {
@@ -124,10 +133,12 @@ public:
 
 	MDNode *getMetadata(const String &str) const;
 	bool hasMetadata(const String &str) const;
-	void setMetadata(const String &str, MDNode *node);
+	// attachments must be allocated from the LLVMContext and outlive the instruction.
+	void set_metadata_attachments(MetadataAttachment *attachments, unsigned count);
 
-	UnorderedMap<String, MDNode *>::const_iterator metadata_begin() const;
-	UnorderedMap<String, MDNode *>::const_iterator metadata_end() const;
+	const MetadataAttachment *metadata_begin() const;
+	const MetadataAttachment *metadata_end() const;
+	unsigned get_num_metadata_attachments() const;
 
 	static bool is_base_of_value_kind(ValueKind kind);
 	static constexpr ValueKind get_value_kind()
@@ -138,9 +149,17 @@ public:
 protected:
 	void set_terminator();
 	bool is_terminator = false;
-	void set_operands(Vector<Value *> op);
-	Vector<Value *> operands;
-	UnorderedMap<String, MDNode *> attachments;
+
+	// Almost every instruction has a handful of operands, so keep those inline.
+	// Anything larger lives in the LLVMContext arena.
+	enum { InlineOperands = 3 };
+	void set_operands(std::initializer_list<Value *> ops);
+	void set_operands(LLVMContext &context, const Vector<Value *> &ops);
+	Value **operands = inline_operands;
+	unsigned num_operands = 0;
+	unsigned num_attachments = 0;
+	MetadataAttachment *attachments = nullptr;
+	Value *inline_operands[InlineOperands] = {};
 };
 
 class ReturnInst : public Instruction
@@ -178,13 +197,19 @@ public:
 	{
 		return ValueKind::Call;
 	}
-	CallInst(FunctionType *function_type, Function *callee, Vector<Value *> params);
+	CallInst(FunctionType *function_type, Function *callee, const Vector<Value *> &params);
 	Function *getCalledFunction() const;
 
+	// Not part of the LLVM API. dx.op intrinsics encode their opcode as constant operand 0,
+	// which is decoded once here rather than on every query.
+	bool get_constant_opcode(uint32_t *opcode) const;
+
 	LLVMBC_DEFAULT_VALUE_KIND_IMPL
 
 private:
 	Function *callee;
+	uint32_t constant_opcode = 0;
+	bool has_constant_opcode = false;
 };
 
 class UnaryOperator : public Instruction
@@ -298,7 +323,7 @@ public:
 	{
 		return ValueKind::GetElementPtr;
 	}
-	GetElementPtrInst(Type *pointer_type, Vector<Value *> arguments, bool inbounds);
+	GetElementPtrInst(Type *pointer_type, const Vector<Value *> &arguments, bool inbounds);
 	bool isInBounds() const;
 
 	LLVMBC_DEFAULT_VALUE_KIND_IMPL
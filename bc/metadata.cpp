@@ -78,9 +78,9 @@ void MDNode::set_tween_id(uint64_t id)
 	tween = id;
 }
 
-NamedMDNode::NamedMDNode(Module *module, String name_, Vector<MDNode *> operands_)
+NamedMDNode::NamedMDNode(Module *module, const String *name_, Vector<MDNode *> operands_)
     : MDOperand(module, MetadataKind::NamedNode)
-    , name(std::move(name_))
+    , name(name_)
     , operands(std::move(operands_))
 {
 }
@@ -98,7 +98,7 @@ MDNode *NamedMDNode::getOperand(unsigned index) const
 
 const String &NamedMDNode::getName() const
 {
-	return name;
+	return *name;
 }
 
 ConstantAsMetadata::ConstantAsMetadata(Module *module, Constant *value_)
@@ -112,15 +112,15 @@ Constant *ConstantAsMetadata::getValue() const
 	return value;
 }
 
-MDString::MDString(LLVMBC::Module *module, String str_)
+MDString::MDString(LLVMBC::Module *module, const String *str_)
     : MDOperand(module, MetadataKind::String)
-    , str(std::move(str_))
+    , str(str_)
 {
 }
 
 const String &MDString::getString() const
 {
-	return str;
+	return *str;
 }
 
 } // namespace LLVMBC
@@ -87,14 +87,15 @@ public:
 	{
 		return MetadataKind::NamedNode;
 	}
-	NamedMDNode(Module *module, String name, Vector<MDNode *> operands);
+	// name is interned in the module's LLVMContext.
+	NamedMDNode(Module *module, const String *name, Vector<MDNode *> operands);
 	const String &getName() const;
 
 	MDNode *getOperand(unsigned index) const;
 	unsigned getNumOperands() const;
 
 private:
-	String name;
+	const String *name;
 	Vector<MDNode *> operands;
 };
 
@@ -119,11 +120,12 @@ public:
 	{
 		return MetadataKind::String;
 	}
-	MDString(Module *module, String str);
+	// str is interned in the module's LLVMContext.
+	MDString(Module *module, const String *str);
 	const String &getString() const;
 
 private:
-	String str;
+	const String *str;
 };
 
 } // namespace LLVMBC
@@ -31,7 +31,14 @@
 #include "metadata.hpp"
 #include "type.hpp"
 #include "value.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 #include "llvm_decoder.h"
 
@@ -308,7 +315,7 @@ static int64_t decode_sign_rotated_value(uint64_t v)
 	return int64_t(v);
 }
 
-struct ModuleParseContext
+struct ModuleParseContext : BitcodeVisitor
 {
 	Function *function = nullptr;
 	Module *module = nullptr;
@@ -321,25 +328,46 @@ struct ModuleParseContext
 	Vector<Type *> types;
 	Vector<Function *> functions_with_bodies;
 	UnorderedMap<uint64_t, MDOperand *> metadata;
-	UnorderedMap<uint64_t, String> metadata_kind_map;
+	// Kind names are interned in the LLVMContext since instructions point to them directly.
+	UnorderedMap<uint64_t, const char *> metadata_kind_map;
+	// Reused between records so building call and GEP operand lists does not allocate.
+	Vector<Value *> scratch_operands;
+	Vector<MetadataAttachment> scratch_attachments;
 	Vector<Vector<std::pair<String, String>>> attribute_lists;
 	UnorderedMap<uint64_t, Vector<std::pair<String, String>>> attribute_groups;
 	Type *constant_type = nullptr;
-	String current_metadata_name;
-
-	bool parse_function_child_block(const BlockOrRecord &entry);
+	const String *current_metadata_name = nullptr;
+
+	// The decoder streams every block and record through these, there is no intermediate tree.
+	bool EnterBlock(const BlockOrRecord &block) override;
+	bool LeaveBlock(const BlockOrRecord &block) override;
+	bool VisitRecord(const BlockOrRecord &record) override;
+	bool VisitDeferredBlock(const BlockOrRecord &block) override;
+
+	Vector<KnownBlocks> block_stack;
+	bool is_module_child_block() const;
+	bool check_allocation_limit() const;
+	unsigned metadata_index = 0;
+	// Set by Module::materialize() so the next top-level FUNCTION_BLOCK is parsed as this function's body.
+	Function *deferred_function = nullptr;
+	LazyModuleState *lazy = nullptr;
+	// Function bodies are skipped without being recorded, see parseIRMetadataOnly().
+	bool skip_function_bodies = false;
+
+	bool parse_module_record(const BlockOrRecord &entry);
 	bool parse_record(const BlockOrRecord &entry);
 	bool parse_constants_record(const BlockOrRecord &entry);
-	bool parse_constants_block(const BlockOrRecord &entry);
-	bool parse_metadata_block(const BlockOrRecord &entry);
-	bool parse_paramattr_block(const BlockOrRecord &entry);
-	bool parse_paramattr_group_block(const BlockOrRecord &entry);
+	bool parse_paramattr_record(const BlockOrRecord &entry);
+	bool parse_paramattr_group_record(const BlockOrRecord &entry);
 	bool parse_metadata_attachment_record(const BlockOrRecord &entry);
 	bool parse_metadata_record(const BlockOrRecord &entry, unsigned index);
 	Type *get_constant_type();
-	bool parse_function_body(const BlockOrRecord &entry);
-	bool parse_types(const BlockOrRecord &entry);
-	bool parse_value_symtab(const BlockOrRecord &entry);
+	bool begin_function_body(Function *func);
+	bool end_function_body();
+	Vector<Value *> global_values;
+	bool in_function_body = false;
+	Function *take_next_function_with_body();
+	bool parse_value_symtab_record(const BlockOrRecord &entry);
 	bool parse_function_record(const BlockOrRecord &entry);
 	bool parse_global_variable_record(const BlockOrRecord &entry);
 	bool parse_version_record(const BlockOrRecord &entry);
@@ -545,7 +573,7 @@ const char *ModuleParseContext::get_metadata_kind(uint64_t index) const
 {
 	auto itr = metadata_kind_map.find(index);
 	if (itr != metadata_kind_map.end())
-		return itr->second.c_str();
+		return itr->second;
 	else
 		return nullptr;
 }
@@ -942,19 +970,25 @@ bool ModuleParseContext::parse_constants_record(const BlockOrRecord &entry)
 		{
 			auto *type = get_type(entry.ops[index++]);
 			auto *value = get_value(entry.ops[index++], type, true);
+			if (!type || !value)
+				return false;
 			elements.push_back(value);
 		}
 
 		if (elements.size() < 2)
 			return false;
 
+		auto *base_type = dyn_cast<PointerType>(elements[0]->getType());
+		if (!base_type)
+			return false;
+
 		if (!pointee_type)
-			pointee_type = elements[0]->getType()->getPointerElementType();
+			pointee_type = base_type->getElementType();
 
 		pointee_type = resolve_gep_element_type(pointee_type, elements);
 		if (!pointee_type)
 			return false;
-		pointee_type = PointerType::get(pointee_type, cast<PointerType>(elements[0]->getType())->getAddressSpace());
+		pointee_type = PointerType::get(pointee_type, base_type->getAddressSpace());
 
 		auto *value = context->construct<ConstantExpr>(Instruction::GetElementPtr, pointee_type, std::move(elements));
 		values.push_back(value);
@@ -969,15 +1003,6 @@ bool ModuleParseContext::parse_constants_record(const BlockOrRecord &entry)
 	return true;
 }
 
-bool ModuleParseContext::parse_constants_block(const BlockOrRecord &entry)
-{
-	constant_type = nullptr;
-	for (auto &child : entry.children)
-		if (!parse_constants_record(child))
-			return false;
-	return true;
-}
-
 bool ModuleParseContext::parse_metadata_attachment_record(const BlockOrRecord &entry)
 {
 	if (MetaDataRecord(entry.id) != MetaDataRecord::ATTACHMENT)
@@ -996,6 +1021,11 @@ bool ModuleParseContext::parse_metadata_attachment_record(const BlockOrRecord &e
 		return false;
 	}
 
+	auto &attachments = scratch_attachments;
+	attachments.clear();
+	attachments.reserve(num_nodes + inst->get_num_metadata_attachments());
+	attachments.insert(attachments.end(), inst->metadata_begin(), inst->metadata_end());
+
 	for (size_t i = 0; i < num_nodes; i++)
 	{
 		auto *kind = get_metadata_kind(entry.ops[2 * i + 1]);
@@ -1014,8 +1044,18 @@ bool ModuleParseContext::parse_metadata_attachment_record(const BlockOrRecord &e
 			return false;
 		}
 
-		inst->setMetadata(kind, node);
+		// Later attachments of the same kind replace earlier ones.
+		auto itr = std::find_if(attachments.begin(), attachments.end(),
+		                        [kind](const MetadataAttachment &a) { return a.kind == kind; });
+		if (itr != attachments.end())
+			itr->node = node;
+		else
+			attachments.push_back({ kind, node });
 	}
+
+	auto *inst_attachments = context->construct_n<MetadataAttachment>(attachments.size());
+	std::copy(attachments.begin(), attachments.end(), inst_attachments);
+	inst->set_metadata_attachments(inst_attachments, unsigned(attachments.size()));
 	return true;
 }
 
@@ -1025,7 +1065,7 @@ bool ModuleParseContext::parse_metadata_record(const BlockOrRecord &entry, unsig
 	{
 	case MetaDataRecord::NAME:
 	{
-		current_metadata_name = entry.getString();
+		current_metadata_name = context->intern_string(entry.getString());
 		break;
 	}
 
@@ -1040,8 +1080,10 @@ bool ModuleParseContext::parse_metadata_record(const BlockOrRecord &entry, unsig
 			ops.push_back(node);
 		}
 
+		if (!current_metadata_name)
+			current_metadata_name = context->intern_string(String());
 		auto *node = context->construct<NamedMDNode>(module, current_metadata_name, std::move(ops));
-		module->add_named_metadata(current_metadata_name, node);
+		module->add_named_metadata(node);
 		metadata[index] = node;
 		break;
 	}
@@ -1067,7 +1109,7 @@ bool ModuleParseContext::parse_metadata_record(const BlockOrRecord &entry, unsig
 
 	case MetaDataRecord::STRING_OLD:
 	{
-		auto *node = context->construct<MDString>(module, entry.getString());
+		auto *node = context->construct<MDString>(module, context->intern_string(entry.getString()));
 		metadata[index] = node;
 		break;
 	}
@@ -1101,7 +1143,7 @@ bool ModuleParseContext::parse_metadata_record(const BlockOrRecord &entry, unsig
 		if (entry.ops.size() < 1)
 			return false;
 
-		metadata_kind_map[entry.ops[0]] = entry.getString(1);
+		metadata_kind_map[entry.ops[0]] = context->intern_string(entry.getString(1))->c_str();
 		break;
 	}
 
@@ -1112,156 +1154,103 @@ bool ModuleParseContext::parse_metadata_record(const BlockOrRecord &entry, unsig
 	return true;
 }
 
-bool ModuleParseContext::parse_metadata_block(const BlockOrRecord &entry)
+bool ModuleParseContext::parse_paramattr_record(const BlockOrRecord &child)
 {
-	unsigned index = 0;
-	for (auto &child : entry.children)
-		if (!parse_metadata_record(child, index++))
-			return false;
-	return true;
-}
+	// Don't support the OLD variant unless we observe it in the wild.
+	// DXC doesn't generate it.
+	if (AttributeCodes(child.id) != AttributeCodes::CodeEntry)
+		return false;
 
-bool ModuleParseContext::parse_paramattr_block(const BlockOrRecord &entry)
-{
-	for (auto &child : entry.children)
+	Vector<std::pair<String, String>> pairs;
+	for (auto op : child.ops)
 	{
-		if (!child.IsRecord())
-			continue;
-
-		// Don't support the OLD variant unless we observe it in the wild.
-		// DXC doesn't generate it.
-		if (AttributeCodes(child.id) != AttributeCodes::CodeEntry)
-			return false;
-
-		Vector<std::pair<String, String>> pairs;
-		for (auto op : child.ops)
-		{
-			auto &grp = attribute_groups[op];
-			for (auto &elem : grp)
-				pairs.push_back(elem);
-		}
-		attribute_lists.push_back(std::move(pairs));
+		auto &grp = attribute_groups[op];
+		for (auto &elem : grp)
+			pairs.push_back(elem);
 	}
+	attribute_lists.push_back(std::move(pairs));
 	return true;
 }
 
-bool ModuleParseContext::parse_paramattr_group_block(const BlockOrRecord &entry)
+bool ModuleParseContext::parse_paramattr_group_record(const BlockOrRecord &child)
 {
-	if (!attribute_groups.empty())
-	{
-		LOGE("Cannot use multiple group blocks.\n");
-		return false;
-	}
-
-	for (auto &child : entry.children)
-	{
-		if (!child.IsRecord())
-			continue;
-		if (AttributeCodes(child.id) != AttributeCodes::GroupCodeEntry)
-			continue;
+	if (AttributeCodes(child.id) != AttributeCodes::GroupCodeEntry)
+		return true;
 
-		if (child.ops.size() < 3)
-			return false;
+	if (child.ops.size() < 3)
+		return false;
 
-		uint64_t group_id = child.ops[0];
-		uint64_t index = child.ops[1];
+	uint64_t group_id = child.ops[0];
+	uint64_t index = child.ops[1];
 
-		if (index != ~0u) // Only care about attributes on function scope
-			continue;
+	if (index != ~0u) // Only care about attributes on function scope
+		return true;
 
-		auto &attr_group = attribute_groups[group_id];
+	auto &attr_group = attribute_groups[group_id];
 
-		size_t i = 2;
-		size_t count = child.ops.size();
-		while (i < count)
+	size_t i = 2;
+	size_t count = child.ops.size();
+	while (i < count)
+	{
+		if (child.ops[i] == 0) // Enum attribute, skip 2 values
 		{
-			if (child.ops[i] == 0) // Enum attribute, skip 2 values
-			{
-				i += 2;
-			}
-			else if (child.ops[i] == 1) // Integer attribute, skip 2 or 3 values
+			i += 2;
+		}
+		else if (child.ops[i] == 1) // Integer attribute, skip 2 or 3 values
+		{
+			i++;
+			if (i >= count)
+				return false;
+
+			switch (AttributeRecord(child.ops[i++]))
 			{
+			case AttributeRecord::ALIGNMENT:
+			case AttributeRecord::STACK_ALIGNMENT:
+			case AttributeRecord::ALLOC_SIZE:
+			case AttributeRecord::DEREFERENCEABLE:
+			case AttributeRecord::DEREFERENCEABLE_OR_NULL:
 				i++;
-				if (i >= count)
-					return false;
+				break;
 
-				switch (AttributeRecord(child.ops[i++]))
-				{
-				case AttributeRecord::ALIGNMENT:
-				case AttributeRecord::STACK_ALIGNMENT:
-				case AttributeRecord::ALLOC_SIZE:
-				case AttributeRecord::DEREFERENCEABLE:
-				case AttributeRecord::DEREFERENCEABLE_OR_NULL:
-					i++;
-					break;
-
-				default:
-					break;
-				}
+			default:
+				break;
 			}
-			else if (child.ops[i] == 3 || child.ops[i] == 4) // String attribute
-			{
-				bool has_value = child.ops[i++] == 4;
-				String kind, value;
+		}
+		else if (child.ops[i] == 3 || child.ops[i] == 4) // String attribute
+		{
+			bool has_value = child.ops[i++] == 4;
+			String kind, value;
+
+			while (child.ops[i] != 0 && i < count)
+				kind.push_back(char(child.ops[i++]));
+			if (child.ops[i] != 0)
+				return false;
+			i++;
 
+			if (has_value)
+			{
 				while (child.ops[i] != 0 && i < count)
-					kind.push_back(char(child.ops[i++]));
+					value.push_back(char(child.ops[i++]));
 				if (child.ops[i] != 0)
 					return false;
 				i++;
-
-				if (has_value)
-				{
-					while (child.ops[i] != 0 && i < count)
-						value.push_back(char(child.ops[i++]));
-					if (child.ops[i] != 0)
-						return false;
-					i++;
-				}
-				attr_group.emplace_back(std::move(kind), std::move(value));
 			}
-			else if (child.ops[i] == 5 || child.ops[i] == 6) // Value attribute
-			{
-				bool has_type = child.ops[i++] == 6;
-				if (i >= count)
-					return false;
-				if (AttributeRecord(child.ops[i++]) == AttributeRecord::BY_VAL && has_type)
-					i++;
-			}
-			else
+			attr_group.emplace_back(std::move(kind), std::move(value));
+		}
+		else if (child.ops[i] == 5 || child.ops[i] == 6) // Value attribute
+		{
+			bool has_type = child.ops[i++] == 6;
+			if (i >= count)
 				return false;
+			if (AttributeRecord(child.ops[i++]) == AttributeRecord::BY_VAL && has_type)
+				i++;
 		}
-
-		if (i > count)
+		else
 			return false;
 	}
 
-	return true;
-}
-
-bool ModuleParseContext::parse_function_child_block(const BlockOrRecord &entry)
-{
-	switch (KnownBlocks(entry.id))
-	{
-	case KnownBlocks::CONSTANTS_BLOCK:
-	{
-		for (auto &child : entry.children)
-			if (!parse_constants_record(child))
-				return false;
-		break;
-	}
-
-	case KnownBlocks::METADATA_ATTACHMENT:
-	{
-		for (auto &child : entry.children)
-			if (!parse_metadata_attachment_record(child))
-				return false;
-		break;
-	}
-
-	default:
-		break;
-	}
+	if (i > count)
+		return false;
 
 	return true;
 }
@@ -1347,7 +1336,9 @@ bool ModuleParseContext::parse_record(const BlockOrRecord &entry)
 		{
 			if (index >= entry.ops.size())
 				return false;
-			function_type = cast<FunctionType>(get_type(entry.ops[index++]));
+			function_type = dyn_cast<FunctionType>(get_type(entry.ops[index++]));
+			if (!function_type)
+				return false;
 		}
 
 		if (index >= entry.ops.size())
@@ -1370,7 +1361,8 @@ bool ModuleParseContext::parse_record(const BlockOrRecord &entry)
 			return false;
 		}
 
-		Vector<Value *> params;
+		auto &params = scratch_operands;
+		params.clear();
 		params.reserve(num_params);
 
 		for (unsigned i = 0; i < num_params; i++)
@@ -1381,7 +1373,7 @@ bool ModuleParseContext::parse_record(const BlockOrRecord &entry)
 			params.push_back(arg);
 		}
 
-		auto *value = context->construct<CallInst>(function_type, callee, std::move(params));
+		auto *value = context->construct<CallInst>(function_type, callee, params);
 		if (!add_instruction(value))
 			return false;
 		break;
@@ -1449,6 +1441,8 @@ bool ModuleParseContext::parse_record(const BlockOrRecord &entry)
 			return false;
 
 		auto *type = get_type(entry.ops[0]);
+		if (!type)
+			return false;
 		size_t num_args = (entry.ops.size() - 1) / 2;
 
 		auto *phi_node = context->construct<PHINode>(type, num_args);
@@ -1501,7 +1495,7 @@ bool ModuleParseContext::parse_record(const BlockOrRecord &entry)
 	{
 		unsigned index = 0;
 		auto ptr = get_value_and_type(entry.ops, index);
-		if (!ptr.first || !isa<PointerType>(ptr.second))
+		if (!ptr.first || !ptr.second || !isa<PointerType>(ptr.second))
 			return false;
 		auto *val = get_value(entry.ops, index, ptr.second->getPointerElementType());
 		if (!val)
@@ -1520,7 +1514,7 @@ bool ModuleParseContext::parse_record(const BlockOrRecord &entry)
 		unsigned index = 0;
 		auto ptr = get_value_and_type(entry.ops, index);
 		auto cmp = get_value_and_type(entry.ops, index);
-		if (!ptr.first || !cmp.first || !isa<PointerType>(ptr.second))
+		if (!ptr.first || !cmp.first || !ptr.second || !isa<PointerType>(ptr.second))
 			return false;
 		auto *new_value = get_value(entry.ops, index, cmp.second);
 		auto *value = context->construct<AtomicCmpXchgInst>(ptr.first, cmp.first, new_value);
@@ -1566,7 +1560,7 @@ bool ModuleParseContext::parse_record(const BlockOrRecord &entry)
 	{
 		unsigned index = 0;
 		auto aggregate = get_value_and_type(entry.ops, index);
-		if (!aggregate.first)
+		if (!aggregate.first || !aggregate.second)
 			return false;
 
 		if (index == entry.ops.size())
@@ -1707,7 +1701,8 @@ bool ModuleParseContext::parse_record(const BlockOrRecord &entry)
 		bool inbounds = entry.ops[0] != 0;
 		auto *type = get_type(entry.ops[1]);
 		unsigned count = entry.ops.size();
-		Vector<Value *> args;
+		auto &args = scratch_operands;
+		args.clear();
 		args.reserve(count);
 		for (unsigned i = 2; i < count;)
 		{
@@ -1717,12 +1712,19 @@ bool ModuleParseContext::parse_record(const BlockOrRecord &entry)
 			args.push_back(value.first);
 		}
 
+		if (!type || args.empty())
+			return false;
+
+		auto *base_type = dyn_cast<PointerType>(args[0]->getType());
+		if (!base_type)
+			return false;
+
 		type = resolve_gep_element_type(type, args);
 		if (!type)
 			return false;
-		type = PointerType::get(type, cast<PointerType>(args[0]->getType())->getAddressSpace());
+		type = PointerType::get(type, base_type->getAddressSpace());
 
-		auto *value = context->construct<GetElementPtrInst>(type, std::move(args), inbounds);
+		auto *value = context->construct<GetElementPtrInst>(type, args, inbounds);
 		if (!add_instruction(value))
 			return false;
 		break;
@@ -1735,7 +1737,7 @@ bool ModuleParseContext::parse_record(const BlockOrRecord &entry)
 		if (index + 2 != entry.ops.size() && index + 3 != entry.ops.size())
 			return false;
 
-		if (!ptr.first || !isa<PointerType>(ptr.second))
+		if (!ptr.first || !ptr.second || !isa<PointerType>(ptr.second))
 		{
 			LOGE("Loading from something that is not a pointer.\n");
 			return false;
@@ -1747,6 +1749,9 @@ bool ModuleParseContext::parse_record(const BlockOrRecord &entry)
 		else
 			loaded_type = cast<PointerType>(ptr.second)->getElementType();
 
+		if (!loaded_type)
+			return false;
+
 		auto *value = context->construct<LoadInst>(loaded_type, ptr.first);
 		add_instruction(value);
 		break;
@@ -1771,11 +1776,14 @@ bool ModuleParseContext::parse_record(const BlockOrRecord &entry)
 		auto a = get_value_and_type(entry.ops, index);
 		auto *b = get_value(entry.ops, index, a.second);
 		auto shuf = get_value_and_type(entry.ops, index);
-		if (!a.first || !b || !shuf.first || !isa<VectorType>(a.second))
+		if (!a.first || !b || !shuf.first || !a.second || !isa<VectorType>(a.second))
+			return false;
+
+		auto *mask = dyn_cast<ConstantDataVector>(shuf.first);
+		if (!mask)
 			return false;
 
-		auto *vec_type = VectorType::get(cast<ConstantDataVector>(shuf.first)->getNumElements(),
-		                                 cast<VectorType>(a.second)->getElementType());
+		auto *vec_type = VectorType::get(mask->getNumElements(), cast<VectorType>(a.second)->getElementType());
 		auto *value = context->construct<ShuffleVectorInst>(vec_type, a.first, b, shuf.first);
 		if (!add_instruction(value))
 			return false;
@@ -1786,7 +1794,7 @@ bool ModuleParseContext::parse_record(const BlockOrRecord &entry)
 	{
 		unsigned index = 0;
 		auto vec = get_value_and_type(entry.ops, index);
-		if (!vec.first || !isa<VectorType>(vec.second))
+		if (!vec.first || !vec.second || !isa<VectorType>(vec.second))
 			return false;
 		auto element_index = get_value_and_type(entry.ops, index);
 		if (!element_index.first)
@@ -1802,7 +1810,7 @@ bool ModuleParseContext::parse_record(const BlockOrRecord &entry)
 	{
 		unsigned index = 0;
 		auto vec = get_value_and_type(entry.ops, index);
-		if (!vec.first || !isa<VectorType>(vec.second))
+		if (!vec.first || !vec.second || !isa<VectorType>(vec.second))
 			return false;
 		auto *value = get_value(entry.ops, index, cast<VectorType>(vec.second)->getElementType());
 		auto element_index = get_value_and_type(entry.ops, index);
@@ -1856,10 +1864,8 @@ bool ModuleParseContext::resolve_global_initializations()
 	return true;
 }
 
-bool ModuleParseContext::parse_function_body(const BlockOrRecord &entry)
+Function *ModuleParseContext::take_next_function_with_body()
 {
-	auto global_values = values;
-
 	// I think we are supposed to process functions in same order as the module declared them?
 	if (!seen_first_function_body)
 	{
@@ -1870,11 +1876,22 @@ bool ModuleParseContext::parse_function_body(const BlockOrRecord &entry)
 	if (functions_with_bodies.empty())
 	{
 		LOGE("No more functions to process?\n");
-		return false;
+		return nullptr;
 	}
 
-	function = functions_with_bodies.back();
+	auto *func = functions_with_bodies.back();
 	functions_with_bodies.pop_back();
+	return func;
+}
+
+bool ModuleParseContext::begin_function_body(Function *func)
+{
+	if (!func)
+		return false;
+
+	global_values = values;
+	function = func;
+	in_function_body = true;
 
 	auto *func_type = function->getFunctionType();
 	for (unsigned i = 0; i < func_type->getNumParams(); i++)
@@ -1885,19 +1902,12 @@ bool ModuleParseContext::parse_function_body(const BlockOrRecord &entry)
 		add_value(arg);
 	}
 
-	for (auto &child : entry.children)
-	{
-		if (child.IsBlock())
-		{
-			if (!parse_function_child_block(child))
-				return false;
-		}
-		else
-		{
-			if (!parse_record(child))
-				return false;
-		}
-	}
+	return true;
+}
+
+bool ModuleParseContext::end_function_body()
+{
+	in_function_body = false;
 
 	if (!resolve_forward_references())
 		return false;
@@ -1909,7 +1919,8 @@ bool ModuleParseContext::parse_function_body(const BlockOrRecord &entry)
 	basic_block_index = 0;
 	module->add_function_implementation(function);
 
-	values = global_values;
+	values = std::move(global_values);
+	global_values = {};
 	instructions.clear();
 	return true;
 }
@@ -2041,33 +2052,35 @@ bool ModuleParseContext::parse_type(const BlockOrRecord &child)
 	return true;
 }
 
-bool ModuleParseContext::parse_types(const BlockOrRecord &entry)
+bool ModuleParseContext::parse_value_symtab_record(const BlockOrRecord &symtab)
 {
-	for (auto &child : entry.children)
-		if (!parse_type(child))
+	switch (ValueSymtabRecord(symtab.id))
+	{
+	case ValueSymtabRecord::ENTRY:
+	{
+		if (symtab.ops.size() < 1)
 			return false;
-	return true;
-}
 
-bool ModuleParseContext::parse_value_symtab(const BlockOrRecord &entry)
-{
-	for (auto &symtab : entry.children)
-	{
-		switch (ValueSymtabRecord(symtab.id))
-		{
-		case ValueSymtabRecord::ENTRY:
-		{
-			if (symtab.ops.size() < 1)
-				return false;
+		auto name = symtab.getString(1);
+		module->add_value_name(symtab.ops[0], name);
 
-			auto name = symtab.getString(1);
-			module->add_value_name(symtab.ops[0], name);
-			break;
+		if (symtab.ops[0] < values.size())
+		{
+			if (auto *func = dyn_cast<Function>(values[symtab.ops[0]]))
+			{
+				if (name.compare(0, 5, "dx.op") == 0)
+					func->set_callee_kind(Function::CalleeKind::DXILOp);
+				else if (name.compare(0, 5, "llvm.") == 0)
+					func->set_callee_kind(Function::CalleeKind::LLVMIntrinsic);
+				else
+					func->set_callee_kind(Function::CalleeKind::Function);
+			}
 		}
+		break;
+	}
 
-		default:
-			break;
-		}
+	default:
+		break;
 	}
 	return true;
 }
@@ -2109,8 +2122,11 @@ bool ModuleParseContext::parse_global_variable_record(const BlockOrRecord &entry
 		address_space = entry.ops[1] >> 2;
 	else
 	{
-		address_space = cast<PointerType>(type)->getAddressSpace();
-		type = cast<PointerType>(type)->getElementType();
+		auto *pointer_type = dyn_cast<PointerType>(type);
+		if (!pointer_type)
+			return false;
+		address_space = pointer_type->getAddressSpace();
+		type = pointer_type->getElementType();
 	}
 
 	if (!type)
@@ -2150,7 +2166,11 @@ bool ModuleParseContext::parse_function_record(const BlockOrRecord &entry)
 
 	auto *func_type = dyn_cast<FunctionType>(type);
 	if (!func_type)
-		func_type = cast<FunctionType>(cast<PointerType>(type)->getElementType());
+	{
+		auto *pointer_type = dyn_cast<PointerType>(type);
+		if (pointer_type)
+			func_type = dyn_cast<FunctionType>(pointer_type->getElementType());
+	}
 
 	if (!func_type)
 		return false;
@@ -2192,14 +2212,121 @@ bool ModuleParseContext::add_type(Type *type)
 	return true;
 }
 
+struct LazyModuleState
+{
+	LazyModuleState(const void *data, size_t size)
+	    : reader(static_cast<const uint8_t *>(data), size)
+	{
+	}
+
+	BitcodeReader reader;
+	ModuleParseContext parse_context;
+	UnorderedMap<Function *, BlockOrRecord> deferred_bodies;
+	Vector<Function *> deferred_order;
+	bool failed = false;
+};
+
+void Module::set_lazy_state(LazyModuleState *state)
+{
+	lazy = state;
+}
+
+void Module::set_metadata_only()
+{
+	metadata_only = true;
+}
+
+bool Module::is_metadata_only() const
+{
+	return metadata_only;
+}
+
+bool Module::materialize(Function *func)
+{
+	if (metadata_only)
+	{
+		LOGE("Cannot materialize function bodies of a metadata-only module.\n");
+		return false;
+	}
+
+	if (!lazy || !func)
+		return true;
+	if (lazy->failed)
+		return false;
+
+	auto itr = lazy->deferred_bodies.find(func);
+	if (itr == lazy->deferred_bodies.end())
+		return true;
+
+	// Remove the entry before parsing so that recursive calls terminate.
+	auto block = itr->second;
+	lazy->deferred_bodies.erase(itr);
+
+	lazy->parse_context.deferred_function = func;
+	if (!lazy->reader.ReadDeferredBlock(block, lazy->parse_context))
+	{
+		// The parse context is left in an undefined state.
+		lazy->failed = true;
+		return false;
+	}
+
+	for (auto &bb : *func)
+	{
+		for (auto &inst : bb)
+		{
+			if (auto *call_inst = dyn_cast<CallInst>(&inst))
+				if (!materialize(call_inst->getCalledFunction()))
+					return false;
+		}
+	}
+
+	update_function_lookup();
+	return true;
+}
+
+bool Module::materialize_all()
+{
+	if (metadata_only)
+	{
+		LOGE("Cannot materialize function bodies of a metadata-only module.\n");
+		return false;
+	}
+
+	if (!lazy)
+		return true;
+
+	for (auto *func : lazy->deferred_order)
+		if (!materialize(func))
+			return false;
+	return true;
+}
+
 void Module::add_value_name(uint64_t id, const String &name)
 {
-	value_symtab[id] = name;
+	value_symtab[id] = context.intern_string(name);
+	function_lookup_dirty = true;
 }
 
 void Module::add_function_implementation(Function *func)
 {
 	functions.push_back(func);
+	function_lookup_dirty = true;
+}
+
+void Module::update_function_lookup()
+{
+	if (!function_lookup_dirty)
+		return;
+
+	function_lookup.clear();
+	for (auto *func : functions)
+	{
+		// Keep the first function if names collide, like a linear search would.
+		auto &func_name = func->getName();
+		if (!func_name.empty())
+			function_lookup.insert({ &func_name, func });
+	}
+	function_lookup_dirty = false;
 }
 
 void Module::add_global_variable(GlobalVariable *variable)
@@ -2207,9 +2334,20 @@ void Module::add_global_variable(GlobalVariable *variable)
 	globals.push_back(variable);
 }
 
-void Module::add_named_metadata(const String &name, NamedMDNode *node)
+void Module::add_named_metadata(NamedMDNode *node)
 {
-	named_metadata[name] = node;
+	auto *name = &node->getName();
+	auto itr = named_metadata.find(name);
+	if (itr != named_metadata.end())
+	{
+		std::replace(named_metadata_order.begin(), named_metadata_order.end(), itr->second, node);
+		itr->second = node;
+	}
+	else
+	{
+		named_metadata[name] = node;
+		named_metadata_order.push_back(node);
+	}
 }
 
 void Module::add_unnamed_metadata(MDNode *node)
@@ -2219,18 +2357,24 @@ void Module::add_unnamed_metadata(MDNode *node)
 
 Function *Module::getFunction(const String &name) const
 {
-	auto itr =
-	    std::find_if(functions.begin(), functions.end(), [&](const Function *func) { return func->getName() == name; });
+	auto *interned = context.find_interned_string(name);
+	if (!interned)
+		return nullptr;
 
-	if (itr != functions.end())
-		return *itr;
+	auto itr = function_lookup.find(interned);
+	if (itr != function_lookup.end())
+		return itr->second;
 	else
 		return nullptr;
 }
 
 NamedMDNode *Module::getNamedMetadata(const String &name) const
 {
-	auto itr = named_metadata.find(name);
+	auto *interned = context.find_interned_string(name);
+	if (!interned)
+		return nullptr;
+
+	auto itr = named_metadata.find(interned);
 	if (itr != named_metadata.end())
 		return itr->second;
 	else
@@ -2242,7 +2386,7 @@ const String &Module::get_value_name(uint64_t id) const
 {
 	auto itr = value_symtab.find(id);
 	if (itr != value_symtab.end())
-		return itr->second;
+		return *itr->second;
 	else
 		return empty_string;
 }
@@ -2252,6 +2396,11 @@ LLVMContext &Module::getContext()
 	return context;
 }
 
+uint32_t Module::get_value_id_bound() const
+{
+	return context.get_value_id_bound();
+}
+
 Module::Module(LLVMContext &context_)
     : context(context_)
 {
@@ -2277,14 +2426,14 @@ IteratorAdaptor<GlobalVariable, Vector<GlobalVariable *>::const_iterator> Module
 	return globals.end();
 }
 
-UnorderedMap<String, NamedMDNode *>::const_iterator Module::named_metadata_begin() const
+Vector<NamedMDNode *>::const_iterator Module::named_metadata_begin() const
 {
-	return named_metadata.begin();
+	return named_metadata_order.begin();
 }
 
-UnorderedMap<String, NamedMDNode *>::const_iterator Module::named_metadata_end() const
+Vector<NamedMDNode *>::const_iterator Module::named_metadata_end() const
 {
-	return named_metadata.end();
+	return named_metadata_order.end();
 }
 
 Vector<MDNode *>::const_iterator Module::unnamed_metadata_begin() const
@@ -2297,95 +2446,342 @@ Vector<MDNode *>::const_iterator Module::unnamed_metadata_end() const
 	return unnamed_metadata.end();
 }
 
-Module *parseIR(LLVMContext &context, const void *data, size_t size)
+bool ModuleParseContext::check_allocation_limit() const
 {
-	LLVMBC::BitcodeReader reader(static_cast<const uint8_t *>(data), size);
-	auto toplevel = reader.ReadToplevelBlock();
+	if (dxil_spv::thread_allocator_limit_exceeded())
+	{
+		LOGE("Thread allocator limit exceeded while parsing %s.\n", in_function_body ? "function body" : "module");
+		return false;
+	}
+	return true;
+}
 
-	// The top-level block must be MODULE_BLOCK.
-	if (KnownBlocks(toplevel.id) != KnownBlocks::MODULE_BLOCK)
-		return nullptr;
+bool ModuleParseContext::is_module_child_block() const
+{
+	return block_stack.size() == 2 && block_stack.front() == KnownBlocks::MODULE_BLOCK;
+}
+
+bool ModuleParseContext::EnterBlock(const BlockOrRecord &block)
+{
+	if (!check_allocation_limit())
+		return false;
+
+	auto id = KnownBlocks(block.id);
+
+	if (block_stack.empty())
+	{
+		// The top-level block must be MODULE_BLOCK, unless we're reading back a deferred function body.
+		if (deferred_function)
+		{
+			if (id != KnownBlocks::FUNCTION_BLOCK)
+				return false;
+			auto *func = deferred_function;
+			deferred_function = nullptr;
+			if (!begin_function_body(func))
+				return false;
+		}
+		else if (id != KnownBlocks::MODULE_BLOCK)
+			return false;
+	}
+	else if (block_stack.back() == KnownBlocks::MODULE_BLOCK)
+	{
+		switch (id)
+		{
+		case KnownBlocks::FUNCTION_BLOCK:
+			if (!begin_function_body(take_next_function_with_body()))
+				return false;
+			break;
+
+		case KnownBlocks::CONSTANTS_BLOCK:
+			constant_type = nullptr;
+			break;
+
+		case KnownBlocks::METADATA_BLOCK:
+			metadata_index = 0;
+			break;
+
+		case KnownBlocks::PARAMATTR_GROUP_BLOCK:
+			if (!attribute_groups.empty())
+			{
+				LOGE("Cannot use multiple group blocks.\n");
+				return false;
+			}
+			break;
+
+		default:
+			break;
+		}
+	}
+	else if (is_module_child_block() && block_stack.back() == KnownBlocks::METADATA_BLOCK)
+	{
+		// Sub-blocks occupy a metadata index as well.
+		metadata_index++;
+	}
+
+	block_stack.push_back(id);
+	return true;
+}
+
+bool ModuleParseContext::LeaveBlock(const BlockOrRecord &)
+{
+	auto id = block_stack.back();
+	block_stack.pop_back();
+
+	if (id == KnownBlocks::FUNCTION_BLOCK && (block_stack.empty() || block_stack.back() == KnownBlocks::MODULE_BLOCK))
+		return end_function_body();
+
+	return true;
+}
+
+bool ModuleParseContext::VisitRecord(const BlockOrRecord &record)
+{
+	if (block_stack.empty() || !check_allocation_limit())
+		return false;
+
+	switch (block_stack.back())
+	{
+	case KnownBlocks::MODULE_BLOCK:
+		return parse_module_record(record);
+
+	case KnownBlocks::FUNCTION_BLOCK:
+		return parse_record(record);
+
+	case KnownBlocks::CONSTANTS_BLOCK:
+		return parse_constants_record(record);
+
+	case KnownBlocks::METADATA_ATTACHMENT:
+		return parse_metadata_attachment_record(record);
+
+	default:
+		break;
+	}
+
+	// Function-local symbol tables and metadata blocks are ignored.
+	if (!is_module_child_block())
+		return true;
+
+	switch (block_stack.back())
+	{
+	case KnownBlocks::VALUE_SYMTAB_BLOCK:
+		return parse_value_symtab_record(record);
+
+	case KnownBlocks::TYPE_BLOCK:
+		return parse_type(record);
+
+	case KnownBlocks::METADATA_BLOCK:
+		return parse_metadata_record(record, metadata_index++);
+
+	case KnownBlocks::PARAMATTR_BLOCK:
+		return parse_paramattr_record(record);
+
+	case KnownBlocks::PARAMATTR_GROUP_BLOCK:
+		return parse_paramattr_group_record(record);
+
+	default:
+		return true;
+	}
+}
+
+bool ModuleParseContext::VisitDeferredBlock(const BlockOrRecord &block)
+{
+	// Only function bodies are ever deferred.
+	if (KnownBlocks(block.id) != KnownBlocks::FUNCTION_BLOCK || (!lazy && !skip_function_bodies))
+		return false;
+
+	auto *func = take_next_function_with_body();
+	if (!func)
+		return false;
+
+	if (skip_function_bodies)
+		return true;
+
+	lazy->deferred_bodies[func] = block;
+	lazy->deferred_order.push_back(func);
+	return true;
+}
+
+bool ModuleParseContext::parse_module_record(const BlockOrRecord &entry)
+{
+	switch (ModuleRecord(entry.id))
+	{
+	case ModuleRecord::VERSION:
+		return parse_version_record(entry);
+
+	case ModuleRecord::FUNCTION:
+		return parse_function_record(entry);
+
+	case ModuleRecord::GLOBAL_VARIABLE:
+		return parse_global_variable_record(entry);
+
+	default:
+		return true;
+	}
+}
+
+static bool parse_module(BitcodeReader &reader, ModuleParseContext &parse_context)
+{
+	if (!reader.ReadToplevelBlock(parse_context))
+		return false;
 
 	// We should have consumed all bits, only one top-level block.
 	if (!reader.AtEndOfStream())
+		return false;
+
+	// Normally resolved by the first function body, but with lazy parsing we might not have seen any.
+	if (!parse_context.resolve_forward_references())
+		return false;
+	if (!parse_context.resolve_global_initializations())
+		return false;
+
+	parse_context.module->update_function_lookup();
+	return true;
+}
+
+Module *parseIR(LLVMContext &context, const void *data, size_t size)
+{
+	DXIL_SPV_TRACE_ZONE("LLVMBC::parseIR");
+	LLVMBC::BitcodeReader reader(static_cast<const uint8_t *>(data), size);
+	auto *module = context.construct<Module>(context);
+
+	ModuleParseContext parse_context;
+	parse_context.module = module;
+	parse_context.context = &module->getContext();
+
+	if (!parse_module(reader, parse_context))
 		return nullptr;
 
+	return module;
+}
+
+Module *parseIRMetadataOnly(LLVMContext &context, const void *data, size_t size)
+{
+	DXIL_SPV_TRACE_ZONE("LLVMBC::parseIRMetadataOnly");
+	LLVMBC::BitcodeReader reader(static_cast<const uint8_t *>(data), size);
+	reader.SetDeferredBlockId(uint32_t(KnownBlocks::FUNCTION_BLOCK));
 	auto *module = context.construct<Module>(context);
 
 	ModuleParseContext parse_context;
 	parse_context.module = module;
 	parse_context.context = &module->getContext();
+	parse_context.skip_function_bodies = true;
+
+	if (!parse_module(reader, parse_context))
+		return nullptr;
+
+	module->set_metadata_only();
+	return module;
+}
+
+static LazyModuleState *parse_module_deferred(LLVMContext &context, const void *data, size_t size)
+{
+	// The reader must stay alive since it holds the BLOCKINFO abbreviations needed to decode function bodies.
+	auto *lazy = context.construct<LazyModuleState>(data, size);
+	lazy->reader.SetDeferredBlockId(uint32_t(KnownBlocks::FUNCTION_BLOCK));
 
-	for (auto &child : toplevel.children)
+	auto *module = context.construct<Module>(context);
+	lazy->parse_context.module = module;
+	lazy->parse_context.context = &module->getContext();
+	lazy->parse_context.lazy = lazy;
+
+	if (!parse_module(lazy->reader, lazy->parse_context))
+		return nullptr;
+
+	return lazy;
+}
+
+Module *parseIRLazy(LLVMContext &context, const void *data, size_t size)
+{
+	DXIL_SPV_TRACE_ZONE("LLVMBC::parseIRLazy");
+	auto *lazy = parse_module_deferred(context, data, size);
+	if (!lazy)
+		return nullptr;
+
+	auto *module = lazy->parse_context.module;
+	module->set_lazy_state(lazy);
+	return module;
+}
+
+namespace
+{
+// Shared with pool tasks which may only get to run after parseIRParallel() returned,
+// so it is reference counted and only holds default allocated memory.
+struct ParallelDecodeState
+{
+	const BitcodeReader *reader = nullptr;
+	std::vector<const BlockOrRecord *> blocks;
+	std::vector<DecodedBlock> decoded;
+	std::vector<uint8_t> success;
+
+	std::atomic<size_t> next_job{ 0 };
+	std::mutex lock;
+	std::condition_variable cond;
+	size_t completed_jobs = 0;
+
+	void run()
 	{
-		if (child.IsBlock())
+		for (;;)
 		{
-			switch (KnownBlocks(child.id))
-			{
-			case KnownBlocks::VALUE_SYMTAB_BLOCK:
-				if (!parse_context.parse_value_symtab(child))
-					return nullptr;
+			size_t job = next_job.fetch_add(1, std::memory_order_relaxed);
+			if (job >= blocks.size())
 				break;
 
-			case KnownBlocks::FUNCTION_BLOCK:
-				if (!parse_context.parse_function_body(child))
-					return nullptr;
-				break;
+			success[job] = reader->DecodeDeferredBlock(*blocks[job], decoded[job]);
 
-			case KnownBlocks::TYPE_BLOCK:
-				if (!parse_context.parse_types(child))
-					return nullptr;
-				break;
+			std::lock_guard<std::mutex> holder{ lock };
+			if (++completed_jobs == blocks.size())
+				cond.notify_all();
+		}
+	}
 
-			case KnownBlocks::CONSTANTS_BLOCK:
-				if (!parse_context.parse_constants_block(child))
-					return nullptr;
-				break;
+	void wait()
+	{
+		std::unique_lock<std::mutex> holder{ lock };
+		cond.wait(holder, [this]() { return completed_jobs == blocks.size(); });
+	}
+};
+} // namespace
 
-			case KnownBlocks::METADATA_BLOCK:
-				if (!parse_context.parse_metadata_block(child))
-					return nullptr;
-				break;
+Module *parseIRParallel(LLVMContext &context, const void *data, size_t size, dxil_spv::ThreadPool &pool)
+{
+	DXIL_SPV_TRACE_ZONE("LLVMBC::parseIRParallel");
+	auto *lazy = parse_module_deferred(context, data, size);
+	if (!lazy)
+		return nullptr;
 
-			case KnownBlocks::PARAMATTR_BLOCK:
-				if (!parse_context.parse_paramattr_block(child))
-					return nullptr;
-				break;
+	auto state = std::make_shared<ParallelDecodeState>();
+	state->reader = &lazy->reader;
+	for (auto *func : lazy->deferred_order)
+		state->blocks.push_back(&lazy->deferred_bodies[func]);
 
-			case KnownBlocks::PARAMATTR_GROUP_BLOCK:
-				if (!parse_context.parse_paramattr_group_block(child))
-					return nullptr;
-				break;
+	size_t count = state->blocks.size();
+	state->decoded.resize(count);
+	state->success.resize(count);
 
-			default:
-				break;
-			}
-		}
-		else
-		{
-			switch (ModuleRecord(child.id))
-			{
-			case ModuleRecord::VERSION:
-				if (!parse_context.parse_version_record(child))
-					return nullptr;
-				break;
+	// The calling thread decodes as well, so we only need helpers for the remaining bodies.
+	size_t num_tasks = std::min<size_t>(pool.get_num_threads(), count ? count - 1 : 0);
+	for (size_t i = 0; i < num_tasks; i++)
+		pool.submit([state]() { state->run(); });
+	state->run();
+	state->wait();
 
-			case ModuleRecord::FUNCTION:
-				if (!parse_context.parse_function_record(child))
-					return nullptr;
-				break;
+	// Values are numbered in module order, so the IR must be built in declaration order.
+	auto &parse_context = lazy->parse_context;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (!state->success[i])
+			return nullptr;
 
-			case ModuleRecord::GLOBAL_VARIABLE:
-				if (!parse_context.parse_global_variable_record(child))
-					return nullptr;
-				break;
+		parse_context.deferred_function = lazy->deferred_order[i];
+		if (!state->decoded[i].Replay(parse_context))
+			return nullptr;
 
-			default:
-				break;
-			}
-		}
+		// Free the decoded records as we go.
+		state->decoded[i] = {};
 	}
 
-	return module;
+	lazy->deferred_bodies.clear();
+	lazy->deferred_order.clear();
+	parse_context.module->update_function_lookup();
+	return parse_context.module;
 }
 } // namespace LLVMBC
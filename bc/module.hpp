@@ -33,6 +33,11 @@
 
 // A reasonably small LLVM C++ API lookalike.
 
+namespace dxil_spv
+{
+class ThreadPool;
+}
+
 #define llvm LLVMBC
 
 namespace LLVMBC
@@ -46,21 +51,24 @@ class BasicBlock;
 class GlobalVariable;
 class NamedMDNode;
 class MDNode;
+struct LazyModuleState;
 
 class Module
 {
 public:
 	explicit Module(LLVMContext &context);
 	LLVMContext &getContext();
+	// Upper bound of Value::get_value_id() for all values in the module's context.
+	uint32_t get_value_id_bound() const;
 
+	// Names are interned in the LLVMContext, so these are a string hash plus a pointer lookup.
 	NamedMDNode *getNamedMetadata(const String &name) const;
-
 	Function *getFunction(const String &name) const;
 
 	void add_value_name(uint64_t id, const String &name);
 	void add_function_implementation(Function *func);
 	void add_global_variable(GlobalVariable *variable);
-	void add_named_metadata(const String &name, NamedMDNode *node);
+	void add_named_metadata(NamedMDNode *node);
 	void add_unnamed_metadata(MDNode *node);
 	const String &get_value_name(uint64_t id) const;
 
@@ -70,21 +78,57 @@ public:
 	IteratorAdaptor<GlobalVariable, Vector<GlobalVariable *>::const_iterator> global_begin() const;
 	IteratorAdaptor<GlobalVariable, Vector<GlobalVariable *>::const_iterator> global_end() const;
 
-	UnorderedMap<String, NamedMDNode *>::const_iterator named_metadata_begin() const;
-	UnorderedMap<String, NamedMDNode *>::const_iterator named_metadata_end() const;
+	// In declaration order.
+	Vector<NamedMDNode *>::const_iterator named_metadata_begin() const;
+	Vector<NamedMDNode *>::const_iterator named_metadata_end() const;
 
 	Vector<MDNode *>::const_iterator unnamed_metadata_begin() const;
 	Vector<MDNode *>::const_iterator unnamed_metadata_end() const;
 
+	// For modules returned by parseIRLazy(), function bodies are only decoded when materialized.
+	// Materializing a function also materializes every function it calls.
+	// Non-lazy modules are always fully materialized.
+	bool materialize(Function *func);
+	bool materialize_all();
+	void set_lazy_state(LazyModuleState *state);
+
+	// Modules returned by parseIRMetadataOnly() have no function bodies and can never be materialized.
+	void set_metadata_only();
+	bool is_metadata_only() const;
+
+	// Value names can show up after the function bodies, so the name lookup is rebuilt once parsing
+	// or materialization is done. Lookups are then read-only, so concurrent readers are safe.
+	void update_function_lookup();
+
 private:
 	LLVMContext &context;
 	Vector<Function *> functions;
 	Vector<GlobalVariable *> globals;
-	UnorderedMap<uint64_t, String> value_symtab;
-	UnorderedMap<String, NamedMDNode *> named_metadata;
+	UnorderedMap<uint64_t, const String *> value_symtab;
+	UnorderedMap<const String *, NamedMDNode *> named_metadata;
+	Vector<NamedMDNode *> named_metadata_order;
+
+	UnorderedMap<const String *, Function *> function_lookup;
+	bool function_lookup_dirty = true;
 	Vector<MDNode *> unnamed_metadata;
+	LazyModuleState *lazy = nullptr;
+	bool metadata_only = false;
 };
 
 Module *parseIR(LLVMContext &context, const void *data, size_t size);
+// Only decodes module-level state. data must remain valid until the module is fully materialized.
+Module *parseIRLazy(LLVMContext &context, const void *data, size_t size);
+// Only decodes module-level state such as metadata, globals and function declarations.
+// Function bodies are skipped and are never decoded, so data does not need to outlive the call.
+Module *parseIRMetadataOnly(LLVMContext &context, const void *data, size_t size);
+// Fully parses the module like parseIR(), but decodes the bitstream of every function body concurrently on pool.
+// Building the IR is still serial since LLVMContext is not thread-safe.
+// pool may be busy or even be the pool the caller runs on, the calling thread helps out with decoding.
+Module *parseIRParallel(LLVMContext &context, const void *data, size_t size, dxil_spv::ThreadPool &pool);
+
 bool disassemble(Module &module, String &str);
+// Streams the disassembly to sink in chunks instead of building the full string.
+// The data passed to sink is not NUL-terminated and is only valid during the call.
+using DisassemblySink = void (*)(void *userdata, const char *data, size_t size);
+bool disassemble(Module &module, DisassemblySink sink, void *userdata);
 } // namespace LLVMBC
@@ -25,10 +25,85 @@
 #include "type.hpp"
 #include "cast.hpp"
 #include "context.hpp"
+#include "hash.hpp"
 #include <assert.h>
 
 namespace LLVMBC
 {
+namespace
+{
+// Everything which makes a derived type unique.
+// scalar is the integer width, address space or element count depending on the type.
+struct TypeKey
+{
+	Type::TypeID type_id;
+	uint64_t scalar;
+	const Type *element;
+	const Type *const *members;
+	size_t num_members;
+};
+} // namespace
+
+static uint64_t hash_type_key(const TypeKey &key)
+{
+	dxil_spv::Hasher h;
+	h.u32(uint32_t(key.type_id));
+	h.u64(key.scalar);
+	h.u64(uint64_t(reinterpret_cast<uintptr_t>(key.element)));
+	h.u32(uint32_t(key.num_members));
+	for (size_t i = 0; i < key.num_members; i++)
+		h.u64(uint64_t(reinterpret_cast<uintptr_t>(key.members[i])));
+	return h.get();
+}
+
+static bool type_matches_key(const Type *type, const void *key_)
+{
+	auto &key = *static_cast<const TypeKey *>(key_);
+	if (type->getTypeID() != key.type_id)
+		return false;
+
+	switch (key.type_id)
+	{
+	case Type::TypeID::IntegerTyID:
+		return type->getIntegerBitWidth() == key.scalar;
+
+	case Type::TypeID::PointerTyID:
+		return type->getAddressSpace() == key.scalar && type->getPointerElementType() == key.element;
+
+	case Type::TypeID::ArrayTyID:
+		return type->getArrayNumElements() == key.scalar && type->getArrayElementType() == key.element;
+
+	case Type::TypeID::VectorTyID:
+		return type->getVectorNumElements() == key.scalar &&
+		       cast<VectorType>(type)->getElementType() == key.element;
+
+	case Type::TypeID::StructTyID:
+	{
+		if (type->getStructNumElements() != key.num_members)
+			return false;
+		for (size_t i = 0; i < key.num_members; i++)
+			if (type->getStructElementType(unsigned(i)) != key.members[i])
+				return false;
+		return true;
+	}
+
+	default:
+		return true;
+	}
+}
+
+template <typename T, typename... Args>
+static T *get_unique_type(LLVMContext &context, const TypeKey &key, Args &&... args)
+{
+	uint64_t hash = hash_type_key(key);
+	if (auto *type = context.find_type(hash, type_matches_key, &key))
+		return static_cast<T *>(type);
+
+	auto *type = context.construct<T>(std::forward<Args>(args)...);
+	context.insert_type(hash, type);
+	return type;
+}
+
 PointerType::PointerType(Type *type, uint32_t addr_space)
     : Type(type->getContext(), TypeID::PointerTyID)
     , contained_type(type)
@@ -38,21 +113,8 @@ PointerType::PointerType(Type *type, uint32_t addr_space)
 
 PointerType *PointerType::get(Type *pointee, unsigned addr_space)
 {
-	auto &context = pointee->getContext();
-	auto &cache = context.get_type_cache();
-	for (auto *type : cache)
-	{
-		if (type->getTypeID() == TypeID::PointerTyID)
-		{
-			auto *pointer_type = cast<PointerType>(type);
-			if (pointer_type->getAddressSpace() == addr_space && pointer_type->getElementType() == pointee)
-				return pointer_type;
-		}
-	}
-
-	auto *type = context.construct<PointerType>(pointee, addr_space);
-	cache.push_back(type);
-	return type;
+	TypeKey key = { TypeID::PointerTyID, addr_space, pointee, nullptr, 0 };
+	return get_unique_type<PointerType>(pointee->getContext(), key, pointee, addr_space);
 }
 
 unsigned Type::getAddressSpace() const
@@ -74,21 +136,8 @@ ArrayType::ArrayType(Type *type, uint64_t elements_)
 
 ArrayType *ArrayType::get(Type *element, uint64_t size)
 {
-	auto &context = element->getContext();
-	auto &cache = context.get_type_cache();
-	for (auto *type : cache)
-	{
-		if (type->getTypeID() == TypeID::ArrayTyID)
-		{
-			auto *array_type = cast<ArrayType>(type);
-			if (array_type->getArrayNumElements() == size && array_type->getArrayElementType() == element)
-				return array_type;
-		}
-	}
-
-	auto *type = context.construct<ArrayType>(element, size);
-	cache.push_back(type);
-	return type;
+	TypeKey key = { TypeID::ArrayTyID, size, element, nullptr, 0 };
+	return get_unique_type<ArrayType>(element->getContext(), key, element, size);
 }
 
 VectorType::VectorType(LLVMBC::LLVMContext &context, unsigned vector_size_, LLVMBC::Type *type)
@@ -111,20 +160,8 @@ Type *VectorType::getElementType() const
 VectorType *VectorType::get(unsigned vector_size, Type *element)
 {
 	auto &context = element->getContext();
-	auto &cache = context.get_type_cache();
-	for (auto *type : cache)
-	{
-		if (type->getTypeID() == TypeID::VectorTyID)
-		{
-			auto *vector_type = cast<VectorType>(type);
-			if (vector_type->getVectorSize() == vector_size && vector_type->getElementType() == element)
-				return vector_type;
-		}
-	}
-
-	auto *type = context.construct<VectorType>(context, vector_size, element);
-	cache.push_back(type);
-	return type;
+	TypeKey key = { TypeID::VectorTyID, vector_size, element, nullptr, 0 };
+	return get_unique_type<VectorType>(context, key, context, vector_size, element);
 }
 
 uint64_t Type::getArrayNumElements() const
@@ -188,33 +225,14 @@ Type *StructType::getElementType(unsigned N) const
 
 StructType *StructType::get(LLVMContext &context, Vector<Type *> member_types)
 {
-	auto &cache = context.get_type_cache();
-	for (auto *type : cache)
-	{
-		if (type->getTypeID() == TypeID::StructTyID)
-		{
-			auto *struct_type = cast<StructType>(type);
-			if (struct_type->getNumElements() == member_types.size())
-			{
-				bool equal = true;
-				unsigned count = member_types.size();
-				for (unsigned i = 0; i < count; i++)
-				{
-					if (member_types[i] != struct_type->getElementType(i))
-					{
-						equal = false;
-						break;
-					}
-				}
-
-				if (equal)
-					return struct_type;
-			}
-		}
-	}
+	TypeKey key = { TypeID::StructTyID, 0, nullptr, member_types.data(), member_types.size() };
+	uint64_t hash = hash_type_key(key);
+	if (auto *type = context.find_type(hash, type_matches_key, &key))
+		return cast<StructType>(type);
 
+	// Can't use get_unique_type() since the key refers to the member types we move from.
 	auto *type = context.construct<StructType>(context, std::move(member_types));
-	cache.push_back(type);
+	context.insert_type(hash, type);
 	return type;
 }
 
@@ -265,26 +283,14 @@ Type::TypeID Type::getTypeID() const
 
 Type *Type::getIntTy(LLVMContext &context, uint32_t width)
 {
-	auto &cache = context.get_type_cache();
-	for (auto *type : cache)
-		if (type->getTypeID() == TypeID::IntegerTyID && cast<IntegerType>(type)->getBitWidth() == width)
-			return type;
-
-	auto *type = context.construct<IntegerType>(context, width);
-	cache.push_back(type);
-	return type;
+	TypeKey key = { TypeID::IntegerTyID, width, nullptr, nullptr, 0 };
+	return get_unique_type<IntegerType>(context, key, context, width);
 }
 
 Type *Type::getTy(LLVMContext &context, TypeID id)
 {
-	auto &cache = context.get_type_cache();
-	for (auto *type : cache)
-		if (type->getTypeID() == id)
-			return type;
-
-	auto *type = context.construct<Type>(context, id);
-	cache.push_back(type);
-	return type;
+	TypeKey key = { id, 0, nullptr, nullptr, 0 };
+	return get_unique_type<Type>(context, key, context, id);
 }
 
 Type *Type::getVoidTy(LLVMContext &context)
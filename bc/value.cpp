@@ -38,6 +38,16 @@ Value::Value(Type *type_, ValueKind kind_)
 {
 }
 
+uint32_t Value::get_value_id() const
+{
+	return value_id;
+}
+
+void Value::set_value_id(uint32_t id)
+{
+	value_id = id;
+}
+
 void Value::set_tween_id(uint64_t id)
 {
 	tween_id = id;
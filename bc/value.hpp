@@ -90,9 +90,15 @@ public:
 	void set_tween_id(uint64_t id);
 	uint64_t get_tween_id() const;
 
+	// Dense, sequential ID which is unique among all values in the same LLVMContext.
+	// All IDs are below LLVMContext::get_value_id_bound(), so side tables can be flat arrays.
+	uint32_t get_value_id() const;
+	void set_value_id(uint32_t id);
+
 protected:
 	Type *type;
 	ValueKind kind;
+	uint32_t value_id = 0;
 	uint64_t tween_id = 0;
 };
 
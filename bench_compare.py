@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+
+#
+# Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+#
+# SPDX-License-Identifier: MIT
+#
+# Permission is hereby granted, free of charge, to any person obtaining
+# a copy of this software and associated documentation files (the
+# "Software"), to deal in the Software without restriction, including
+# without limitation the rights to use, copy, modify, merge, publish,
+# distribute, sublicense, and/or sell copies of the Software, and to
+# permit persons to whom the Software is furnished to do so, subject to
+# the following conditions:
+# 
+# The above copyright notice and this permission notice shall be
+# included in all copies or substantial portions of the Software.
+# 
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+# MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+# IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+# CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+# TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+# SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+import sys
+import json
+import argparse
+
+def load_results(path):
+    with open(path, 'r') as f:
+        data = json.load(f)
+    return { shader['path']: shader for shader in data['shaders'] }
+
+def main():
+    parser = argparse.ArgumentParser(description = 'Compares two dxil-spirv-bench result files.')
+    parser.add_argument('baseline',
+            help = 'Results of the known good build.')
+    parser.add_argument('current',
+            help = 'Results of the build under test.')
+    parser.add_argument('--threshold',
+            type = float,
+            default = 0.10,
+            help = 'Maximum allowed relative increase of the metric per shader.')
+    parser.add_argument('--metric',
+            default = 'p50_ns',
+            help = 'Per-shader metric to compare, e.g. p50_ns, p99_ns, peak_arena_bytes.')
+
+    args = parser.parse_args()
+    baseline = load_results(args.baseline)
+    current = load_results(args.current)
+
+    regressions = 0
+    for path, shader in sorted(current.items()):
+        base = baseline.get(path)
+        if base is None or not base['ok']:
+            continue
+
+        if not shader['ok']:
+            print('FAIL: {} no longer converts.'.format(path))
+            regressions += 1
+            continue
+
+        old = base[args.metric]
+        new = shader[args.metric]
+        if old == 0:
+            continue
+
+        ratio = float(new) / float(old)
+        if ratio > 1.0 + args.threshold:
+            print('SLOWER: {} {} {} -> {} ({:+.1f}%)'.format(path, args.metric, old, new, (ratio - 1.0) * 100.0))
+            regressions += 1
+
+    if regressions:
+        print('{} shader(s) regressed beyond {:.0f}%.'.format(regressions, args.threshold * 100.0))
+        sys.exit(1)
+
+    print('No regressions.')
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,206 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "cfg_snapshot.hpp"
+#include "logging.hpp"
+#include <string.h>
+
+namespace dxil_spv
+{
+void encode_cfg_snapshot(const CFGSnapshot &snapshot, Vector<uint32_t> &words)
+{
+	words.clear();
+	words.push_back(CFGSnapshot::Magic);
+	words.push_back(CFGSnapshot::Version);
+	words.push_back(uint32_t(snapshot.blocks.size()));
+
+	for (auto &block : snapshot.blocks)
+	{
+		words.push_back(uint32_t(block.name.size()));
+		size_t offset = words.size();
+		words.resize(offset + (block.name.size() + 3) / 4);
+		if (!block.name.empty())
+			memcpy(words.data() + offset, block.name.data(), block.name.size());
+
+		words.push_back(uint32_t(block.terminator));
+		words.push_back(uint32_t(block.merge));
+		words.push_back(block.merge_block);
+		words.push_back(block.continue_block);
+		words.push_back(block.num_operations);
+
+		if (block.terminator == Terminator::Type::Switch)
+		{
+			words.push_back(uint32_t(block.cases.size()));
+			for (auto &c : block.cases)
+			{
+				words.push_back(c.block);
+				words.push_back(c.value);
+				words.push_back(uint32_t(c.is_default));
+			}
+		}
+		else
+		{
+			words.push_back(uint32_t(block.targets.size()));
+			words.insert(words.end(), block.targets.begin(), block.targets.end());
+		}
+
+		words.push_back(uint32_t(block.phi_incoming_blocks.size()));
+		for (auto &phi : block.phi_incoming_blocks)
+		{
+			words.push_back(uint32_t(phi.size()));
+			words.insert(words.end(), phi.begin(), phi.end());
+		}
+	}
+}
+
+namespace
+{
+struct WordReader
+{
+	const uint32_t *words;
+	size_t num_words;
+	size_t offset;
+
+	bool read(uint32_t &value)
+	{
+		if (offset >= num_words)
+			return false;
+		value = words[offset++];
+		return true;
+	}
+
+	bool read_block(uint32_t &value, uint32_t num_blocks)
+	{
+		return read(value) && (value < num_blocks || value == CFGSnapshot::InvalidBlock);
+	}
+
+	bool read_string(String &str)
+	{
+		uint32_t len;
+		if (!read(len))
+			return false;
+
+		size_t padded_words = (size_t(len) + 3) / 4;
+		if (padded_words > num_words - offset)
+			return false;
+
+		str.assign(reinterpret_cast<const char *>(words + offset), len);
+		offset += padded_words;
+		return true;
+	}
+
+	// Guards against absurd counts before anything is allocated for them.
+	bool read_count(uint32_t &count, size_t words_per_element)
+	{
+		return read(count) && size_t(count) * words_per_element <= num_words - offset;
+	}
+};
+} // namespace
+
+bool decode_cfg_snapshot(const uint32_t *words, size_t num_words, CFGSnapshot &snapshot)
+{
+	WordReader reader = { words, num_words, 0 };
+	snapshot.blocks.clear();
+
+	uint32_t magic, version, num_blocks;
+	if (!reader.read(magic) || magic != CFGSnapshot::Magic)
+	{
+		LOGE("Not a CFG snapshot.\n");
+		return false;
+	}
+
+	if (!reader.read(version) || version != CFGSnapshot::Version)
+	{
+		LOGE("Unsupported CFG snapshot version %u.\n", version);
+		return false;
+	}
+
+	// Every block takes at least 9 words.
+	if (!reader.read_count(num_blocks, 9) || num_blocks == 0)
+		return false;
+
+	snapshot.blocks.resize(num_blocks);
+	for (auto &block : snapshot.blocks)
+	{
+		uint32_t terminator, merge, count;
+		if (!reader.read_string(block.name) ||
+		    !reader.read(terminator) || terminator > uint32_t(Terminator::Type::Kill) ||
+		    !reader.read(merge) || merge > uint32_t(MergeType::Selection) ||
+		    !reader.read_block(block.merge_block, num_blocks) ||
+		    !reader.read_block(block.continue_block, num_blocks) ||
+		    !reader.read(block.num_operations))
+		{
+			return false;
+		}
+
+		block.terminator = Terminator::Type(terminator);
+		block.merge = MergeType(merge);
+
+		if (block.terminator == Terminator::Type::Switch)
+		{
+			if (!reader.read_count(count, 3))
+				return false;
+
+			block.cases.resize(count);
+			for (auto &c : block.cases)
+			{
+				uint32_t is_default;
+				if (!reader.read_block(c.block, num_blocks) || c.block == CFGSnapshot::InvalidBlock ||
+				    !reader.read(c.value) || !reader.read(is_default))
+				{
+					return false;
+				}
+				c.is_default = is_default != 0;
+			}
+		}
+		else
+		{
+			if (!reader.read_count(count, 1))
+				return false;
+
+			block.targets.resize(count);
+			for (auto &target : block.targets)
+				if (!reader.read_block(target, num_blocks) || target == CFGSnapshot::InvalidBlock)
+					return false;
+		}
+
+		if (!reader.read_count(count, 1))
+			return false;
+
+		block.phi_incoming_blocks.resize(count);
+		for (auto &phi : block.phi_incoming_blocks)
+		{
+			if (!reader.read_count(count, 1))
+				return false;
+
+			phi.resize(count);
+			for (auto &incoming : phi)
+				if (!reader.read_block(incoming, num_blocks) || incoming == CFGSnapshot::InvalidBlock)
+					return false;
+		}
+	}
+
+	return reader.offset == num_words;
+}
+} // namespace dxil_spv
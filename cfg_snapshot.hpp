@@ -0,0 +1,80 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "thread_local_allocator.hpp"
+#include "ir.hpp"
+#include <stdint.h>
+
+namespace dxil_spv
+{
+// A compact capture of a CFG as the structurizer sees it, so slow cases from the field can be replayed
+// without the DXIL which produced them. Only the shape is captured: blocks, edges, merge information,
+// which blocks PHIs take incoming values from and how many operations each block has.
+// Values and instructions are not part of it.
+//
+// The encoding is a stream of little-endian 32-bit words:
+// - Magic, version, block count.
+// - Per block: name (byte length, then bytes padded to a word), terminator type, merge type,
+//   merge block, continue block, operation count, target count, targets,
+//   PHI count, and per PHI its incoming count and incoming blocks.
+//   Switch targets are (block, value, is_default) triples, other targets are plain blocks.
+// Blocks are referred to by index, block 0 is the entry, and CFGSnapshot::InvalidBlock means none.
+struct CFGSnapshot
+{
+	enum : uint32_t
+	{
+		Magic = 0x46434458, // "XDCF"
+		Version = 1,
+		InvalidBlock = 0xffffffffu
+	};
+
+	struct Case
+	{
+		uint32_t block;
+		uint32_t value;
+		bool is_default;
+	};
+
+	struct Block
+	{
+		String name;
+		Terminator::Type terminator = Terminator::Type::Unreachable;
+		MergeType merge = MergeType::None;
+		uint32_t merge_block = InvalidBlock;
+		uint32_t continue_block = InvalidBlock;
+		uint32_t num_operations = 0;
+		// Branch target, or true and false targets for conditions.
+		Vector<uint32_t> targets;
+		Vector<Case> cases;
+		Vector<Vector<uint32_t>> phi_incoming_blocks;
+	};
+
+	Vector<Block> blocks;
+};
+
+void encode_cfg_snapshot(const CFGSnapshot &snapshot, Vector<uint32_t> &words);
+bool decode_cfg_snapshot(const uint32_t *words, size_t num_words, CFGSnapshot &snapshot);
+} // namespace dxil_spv
@@ -24,10 +24,13 @@
 
 #include "cfg_structurizer.hpp"
 #include "SpvBuilder.h"
+#include "cfg_snapshot.hpp"
+#include "hash.hpp"
 #include "logging.hpp"
 #include "node.hpp"
 #include "node_pool.hpp"
 #include "spirv_module.hpp"
+#include "trace.hpp"
 #include <algorithm>
 #include <assert.h>
 
@@ -463,22 +466,24 @@ bool CFGStructurizer::rewrite_rov_lock_region()
 	// Usually ROV access is constrained to a single BB as a simple case.
 	// Simple BB case fails with control flow. E.g. a loop or conditional. In this case we must widen the range
 	// of the lock such that: end post-dominates begin. Begin post-dominates entry.
+	// Neither can be part of a loop, so if ROV is accessed in a loop, the lock is widened to cover the outermost loop.
+	// Within that, begin is placed as late and end as early as possible, to keep the critical section small.
 	// If we cannot make this work, flag as non-trivial and wrap the entire shader in a big lock.
 
 	auto *idom = rov_blocks.front();
 	for (size_t i = 1; i < rov_blocks.size() && idom; i++)
 		idom = CFGNode::find_common_dominator(idom, rov_blocks[i]);
 
-	// Stretch scope as long as we don't post-dominate entry.
-	while (idom && idom != entry_block && !idom->post_dominates(entry_block))
-		idom = idom->immediate_dominator;
-
-	// If the lock region has multiple instances, i.e. a loop, give up right away.
-	if (idom && get_innermost_loop_header_for(entry_block, idom) != entry_block)
+	// Stretch scope as long as we don't post-dominate entry or we're inside a loop.
+	while (idom && idom != entry_block)
 	{
-		for (auto *node : rov_blocks)
-			scrub_rov_lock_regions(node, false, false);
-		return false;
+		auto *loop_header = get_innermost_loop_header_for(entry_block, idom);
+		if (loop_header != entry_block)
+			idom = loop_header->immediate_dominator;
+		else if (!idom->post_dominates(entry_block))
+			idom = idom->immediate_dominator;
+		else
+			break;
 	}
 
 	auto *pdom = find_common_post_dominator(rov_blocks);
@@ -487,10 +492,18 @@ bool CFGStructurizer::rewrite_rov_lock_region()
 	if (pdom)
 		pdom = CFGNode::find_common_post_dominator(pdom, idom);
 
+	// Move the end out of any loop the ROV accesses are part of.
+	while (pdom && pdom->immediate_post_dominator != pdom &&
+	       get_innermost_loop_header_for(entry_block, pdom) != entry_block)
+	{
+		pdom = pdom->immediate_post_dominator;
+	}
+
 	bool internal_early_return = pdom && pdom->immediate_post_dominator == pdom;
+	bool end_in_loop = pdom && get_innermost_loop_header_for(entry_block, pdom) != entry_block;
 
 	// Non trivial case.
-	if (!idom || !pdom || internal_early_return)
+	if (!idom || !pdom || internal_early_return || end_in_loop)
 	{
 		for (auto *node : rov_blocks)
 			scrub_rov_lock_regions(node, false, false);
@@ -610,12 +623,236 @@ bool CFGStructurizer::rewrite_impossible_back_edges()
 	return did_rewrite;
 }
 
+void CFGStructurizer::set_cancel_flag(const std::atomic_bool *flag)
+{
+	cancel_flag = flag;
+}
+
+bool CFGStructurizer::is_cancelled() const
+{
+	return cancel_flag && cancel_flag->load(std::memory_order_relaxed);
+}
+
+bool CFGStructurizer::exceeded_complexity_budget() const
+{
+	return complexity_budget_exceeded;
+}
+
+void CFGStructurizer::set_pass_statistics(Vector<PassStatistics> *stats)
+{
+	pass_statistics = stats;
+}
+
+void CFGStructurizer::begin_pass()
+{
+	if (!pass_statistics)
+		return;
+
+	pass_start_allocated = get_thread_allocated_bytes();
+	pass_start = std::chrono::steady_clock::now();
+}
+
+void CFGStructurizer::end_pass(const char *name)
+{
+	if (!pass_statistics)
+		return;
+
+	auto end = std::chrono::steady_clock::now();
+	PassStatistics stats = {};
+	stats.name = name;
+	stats.time_ns = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(end - pass_start).count());
+	stats.allocated_bytes = get_thread_allocated_bytes() - pass_start_allocated;
+	stats.node_count = pool.get_node_count();
+	pass_statistics->push_back(stats);
+
+	// Don't count the bookkeeping against the next pass.
+	begin_pass();
+}
+
+void CFGStructurizer::begin_complexity_budget()
+{
+	// Well-behaved rewrites add a handful of ladder and duplicated blocks per construct,
+	// and resolve at least one construct per iteration. Stay far away from that.
+	complexity_budget_exceeded = false;
+	unsigned growth_factor = module.get_structurizer_node_growth_factor();
+	if (!growth_factor)
+	{
+		node_budget = SIZE_MAX;
+		rewrite_iteration_budget = UINT32_MAX;
+		return;
+	}
+
+	size_t input_nodes = pool.get_node_count();
+	node_budget = std::max<size_t>(4096, input_nodes * growth_factor);
+	rewrite_iteration_budget = uint32_t(std::min<size_t>(std::max<size_t>(1024, input_nodes * 2), UINT32_MAX));
+}
+
+bool CFGStructurizer::check_complexity_budget(const char *pass, uint32_t iterations)
+{
+	if (complexity_budget_exceeded)
+		return false;
+
+	size_t node_count = pool.get_node_count();
+	if (node_count <= node_budget && iterations <= rewrite_iteration_budget)
+		return true;
+
+	LOGE("Structurizer complexity budget exceeded in %s for function %s: "
+	     "%zu nodes (budget %zu), %u iterations (budget %u). Giving up.\n",
+	     pass, entry_block->name.c_str(), node_count, node_budget, iterations, rewrite_iteration_budget);
+	complexity_budget_exceeded = true;
+	return false;
+}
+
 bool CFGStructurizer::run()
+{
+	DXIL_SPV_TRACE_ZONE("CFGStructurizer::run");
+
+	// Snapshots are meant to be cheap enough for production use. The input CFG is always captured,
+	// since run() rewrites it in place, but only written out if structurization was slow or gave up.
+	const char *snapshot_path = getenv("DXIL_SPIRV_CFG_SNAPSHOT_PATH");
+	if (!snapshot_path)
+		return run_passes();
+
+	double min_ms = 0.0;
+	if (const char *env = getenv("DXIL_SPIRV_CFG_SNAPSHOT_MIN_MS"))
+		min_ms = strtod(env, nullptr);
+
+	capture_input_snapshot = true;
+	auto start = std::chrono::steady_clock::now();
+	bool ret = run_passes();
+	auto end = std::chrono::steady_clock::now();
+	capture_input_snapshot = false;
+
+	double elapsed_ms = std::chrono::duration<double, std::milli>(end - start).count();
+	if (elapsed_ms >= min_ms || complexity_budget_exceeded)
+		write_input_snapshot(snapshot_path);
+
+	return ret;
+}
+
+void CFGStructurizer::write_input_snapshot(const char *path_prefix) const
+{
+	if (input_snapshot.empty())
+		return;
+
+	// Name by content, so the same CFG seen from many conversions ends up in one file.
+	Hasher h;
+	h.data(input_snapshot.data(), input_snapshot.size() * sizeof(uint32_t));
+	char hash_str[17];
+	snprintf(hash_str, sizeof(hash_str), "%016llx", static_cast<unsigned long long>(h.get()));
+	auto path = String(path_prefix) + hash_str + ".cfg";
+
+	FILE *file = fopen(path.c_str(), "wb");
+	if (!file)
+	{
+		LOGE("Failed to open CFG snapshot path: %s\n", path.c_str());
+		return;
+	}
+
+	if (fwrite(input_snapshot.data(), sizeof(uint32_t), input_snapshot.size(), file) != input_snapshot.size())
+		LOGE("Failed to write CFG snapshot: %s\n", path.c_str());
+	fclose(file);
+}
+
+void CFGStructurizer::capture_cfg_snapshot(CFGSnapshot &snapshot) const
+{
+	// Blocks are stored in reverse post-order, so the entry is block 0.
+	auto count = forward_post_visit_order.size();
+	UnorderedMap<const CFGNode *, uint32_t> block_index;
+	for (size_t i = 0; i < count; i++)
+		block_index[forward_post_visit_order[count - 1 - i]] = uint32_t(i);
+
+	const auto get_index = [&](const CFGNode *node) -> uint32_t {
+		auto itr = block_index.find(node);
+		return itr != block_index.end() ? itr->second : uint32_t(CFGSnapshot::InvalidBlock);
+	};
+
+	snapshot.blocks.clear();
+	snapshot.blocks.resize(count);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		auto *node = forward_post_visit_order[count - 1 - i];
+		auto &block = snapshot.blocks[i];
+		auto &terminator = node->ir.terminator;
+
+		block.name = node->name;
+		block.terminator = terminator.type;
+		block.merge = node->merge;
+		block.num_operations = uint32_t(node->ir.operations.size());
+
+		if (node->merge == MergeType::Loop)
+		{
+			block.merge_block = get_index(node->loop_merge_block);
+			block.continue_block = get_index(node->pred_back_edge);
+		}
+		else if (node->merge == MergeType::Selection)
+			block.merge_block = get_index(node->selection_merge_block);
+
+		// Only keep edges to blocks which are part of the snapshot.
+		const auto add_target = [&](const CFGNode *target) {
+			uint32_t index = get_index(target);
+			if (index != CFGSnapshot::InvalidBlock)
+				block.targets.push_back(index);
+		};
+
+		switch (terminator.type)
+		{
+		case Terminator::Type::Branch:
+			add_target(terminator.direct_block);
+			if (block.targets.empty())
+				block.terminator = Terminator::Type::Unreachable;
+			break;
+
+		case Terminator::Type::Condition:
+			add_target(terminator.true_block);
+			add_target(terminator.false_block);
+			if (block.targets.size() == 1)
+				block.terminator = Terminator::Type::Branch;
+			else if (block.targets.empty())
+				block.terminator = Terminator::Type::Unreachable;
+			break;
+
+		case Terminator::Type::Switch:
+			for (auto &c : terminator.cases)
+			{
+				uint32_t index = get_index(c.node);
+				if (index != CFGSnapshot::InvalidBlock)
+					block.cases.push_back({ index, c.value, c.is_default });
+			}
+			break;
+
+		default:
+			break;
+		}
+
+		for (auto &phi : node->ir.phi)
+		{
+			Vector<uint32_t> incoming_blocks;
+			for (auto &incoming : phi.incoming)
+			{
+				uint32_t index = get_index(incoming.block);
+				if (index != CFGSnapshot::InvalidBlock)
+					incoming_blocks.push_back(index);
+			}
+			block.phi_incoming_blocks.push_back(std::move(incoming_blocks));
+		}
+	}
+}
+
+bool CFGStructurizer::run_passes()
 {
 	String graphviz_path;
 	if (const char *env = getenv("DXIL_SPIRV_GRAPHVIZ_PATH"))
 		graphviz_path = env;
 
+	// Cross-check semi-NCA dominator trees against the reference per-node computation.
+	if (const char *env = getenv("DXIL_SPIRV_VALIDATE_DOMINANCE"))
+		validate_dominance = strtol(env, nullptr, 0) != 0;
+
+	begin_complexity_budget();
+	begin_pass();
+
 	// We make the assumption during traversal that there is only one back edge.
 	// Fix this up here.
 	rewrite_multiple_back_edges();
@@ -631,8 +868,39 @@ bool CFGStructurizer::run()
 
 	recompute_cfg();
 	propagate_branch_control_hints();
+	end_pass("analyze_cfg");
+
+	if (capture_input_snapshot)
+	{
+		CFGSnapshot snapshot;
+		capture_cfg_snapshot(snapshot);
+		encode_cfg_snapshot(snapshot, input_snapshot);
+		begin_pass();
+	}
+
+	// Most functions come out of DXC with control flow that is structured already.
+	// There is nothing to rewrite in that case, only merge information to assign.
+	if (module.get_structured_cfg_fast_path() && assign_merges_for_structured_cfg())
+	{
+		end_pass("structured_cfg_fast_path");
+
+		if (!graphviz_path.empty())
+		{
+			auto graphviz_final = graphviz_path + ".final";
+			log_cfg_graphviz(graphviz_final.c_str());
+		}
+
+		if (is_cancelled())
+			return false;
+
+		begin_pass();
+		insert_phi();
+		end_pass("insert_phi");
+		return true;
+	}
 
 	cleanup_breaking_phi_constructs();
+	end_pass("cleanup_breaking_phi_constructs");
 
 	if (!graphviz_path.empty())
 	{
@@ -640,28 +908,43 @@ bool CFGStructurizer::run()
 		log_cfg_graphviz(graphviz_split.c_str());
 	}
 
+	uint32_t iterations = 0;
 	while (cleanup_breaking_return_constructs())
 	{
+		if (!check_complexity_budget("cleanup_breaking_return_constructs", ++iterations))
+			return false;
+
 		if (!graphviz_path.empty())
 		{
 			auto graphviz_split = graphviz_path + ".break-return";
 			log_cfg_graphviz(graphviz_split.c_str());
 		}
 	}
+	end_pass("cleanup_breaking_return_constructs");
 
 	create_continue_block_ladders();
+	end_pass("create_continue_block_ladders");
+
+	if (is_cancelled())
+		return false;
 
+	iterations = 0;
 	while (serialize_interleaved_merge_scopes())
 	{
+		if (!check_complexity_budget("serialize_interleaved_merge_scopes", ++iterations))
+			return false;
+
 		if (!graphviz_path.empty())
 		{
 			auto graphviz_split = graphviz_path + ".serialize";
 			log_cfg_graphviz(graphviz_split.c_str());
 		}
 	}
+	end_pass("serialize_interleaved_merge_scopes");
 
 	split_merge_scopes();
 	recompute_cfg();
+	end_pass("split_merge_scopes");
 
 	//log_cfg("Split merge scopes");
 	if (!graphviz_path.empty())
@@ -674,6 +957,7 @@ bool CFGStructurizer::run()
 	// which might cause issues with further analysis, so
 	// nuke them as required.
 	eliminate_degenerate_blocks();
+	end_pass("eliminate_degenerate_blocks");
 
 	if (!graphviz_path.empty())
 	{
@@ -684,6 +968,9 @@ bool CFGStructurizer::run()
 	// Similar to cleanup_breaking_phi_constructs() in spirit,
 	// but here we are forced to duplicate code blocks to make it work.
 	duplicate_impossible_merge_constructs();
+	if (!check_complexity_budget("duplicate_impossible_merge_constructs", 0))
+		return false;
+	end_pass("duplicate_impossible_merge_constructs");
 
 	//log_cfg("Split impossible merges");
 	if (!graphviz_path.empty())
@@ -692,28 +979,42 @@ bool CFGStructurizer::run()
 		log_cfg_graphviz(graphviz_split.c_str());
 	}
 
+	iterations = 0;
 	while (rewrite_transposed_loops())
 	{
+		if (!check_complexity_budget("rewrite_transposed_loops", ++iterations))
+			return false;
+
 		if (!graphviz_path.empty())
 		{
 			auto graphviz_split = graphviz_path + ".transpose-loop-rewrite";
 			log_cfg_graphviz(graphviz_split.c_str());
 		}
 	}
+	end_pass("rewrite_transposed_loops");
 
 	// If there are back-edges that punch through multiple loop headers, fix this up.
+	iterations = 0;
 	while (rewrite_impossible_back_edges())
 	{
+		if (!check_complexity_budget("rewrite_impossible_back_edges", ++iterations))
+			return false;
+
 		if (!graphviz_path.empty())
 		{
 			auto graphviz_split = graphviz_path + ".impossible-continue";
 			log_cfg_graphviz(graphviz_split.c_str());
 		}
 	}
+	end_pass("rewrite_impossible_back_edges");
+
+	if (is_cancelled())
+		return false;
 
 	//LOGI("=== Structurize pass ===\n");
 	structurize(0);
 	update_structured_loop_merge_targets();
+	end_pass("structurize0");
 
 	//log_cfg("Structurize pass 0");
 	if (!graphviz_path.empty())
@@ -726,6 +1027,7 @@ bool CFGStructurizer::run()
 	// which might cause issues with further analysis, so
 	// nuke them as required.
 	eliminate_degenerate_blocks();
+	end_pass("eliminate_degenerate_blocks");
 
 	//log_cfg("Split merge scopes");
 	if (!graphviz_path.empty())
@@ -734,8 +1036,12 @@ bool CFGStructurizer::run()
 		log_cfg_graphviz(graphviz_split.c_str());
 	}
 
+	if (is_cancelled())
+		return false;
+
 	//LOGI("=== Structurize pass ===\n");
 	structurize(1);
+	end_pass("structurize1");
 
 	if (!graphviz_path.empty())
 	{
@@ -743,9 +1049,16 @@ bool CFGStructurizer::run()
 		log_cfg_graphviz(graphviz_final.c_str());
 	}
 
+	if (!check_complexity_budget("structurize", 0))
+		return false;
+
 	bool need_restructure = false;
+	iterations = 0;
 	while (rewrite_invalid_loop_breaks())
 	{
+		if (!check_complexity_budget("rewrite_invalid_loop_breaks", ++iterations))
+			return false;
+
 		if (!graphviz_path.empty())
 		{
 			auto graphviz_final = graphviz_path + ".loop-break-rewrite";
@@ -760,6 +1073,7 @@ bool CFGStructurizer::run()
 		// Need to redo the final structurization pass if we end up here.
 		structurize(1);
 	}
+	end_pass("rewrite_invalid_loop_breaks");
 
 	//log_cfg("Final");
 	if (!graphviz_path.empty())
@@ -768,7 +1082,149 @@ bool CFGStructurizer::run()
 		log_cfg_graphviz(graphviz_final.c_str());
 	}
 
+	if (is_cancelled())
+		return false;
+
+	begin_pass();
 	insert_phi();
+	end_pass("insert_phi");
+
+	return true;
+}
+
+bool CFGStructurizer::assign_merges_for_structured_cfg()
+{
+	// Every block is assigned the header of its innermost construct.
+	// A branch may only stay inside that construct, enter a construct headed by the branching block,
+	// or leave the innermost construct through its merge block. Selection merges are immediate post-dominators,
+	// and a merge block can only belong to one header. Anything else is left to the full structurizer.
+	// Blocks are processed in reverse post-order, so every forward pred is resolved before its succs.
+	struct StructuredBlock
+	{
+		CFGNode *header = nullptr;
+		CFGNode *merge = nullptr;
+		bool resolved = false;
+	};
+
+	if (entry_block->pred_back_edge)
+		return false;
+
+	Vector<StructuredBlock> blocks(forward_post_visit_order.size());
+	auto get = [&](const CFGNode *node) -> StructuredBlock & {
+		return blocks[node->forward_post_visit_order];
+	};
+
+	get(entry_block).resolved = true;
+
+	for (auto index = forward_post_visit_order.size(); index; index--)
+	{
+		auto *node = forward_post_visit_order[index - 1];
+		auto &block = get(node);
+
+		if (!block.resolved || !node->fake_succ.empty() || !node->fake_pred.empty())
+			return false;
+
+		auto type = node->ir.terminator.type;
+		if (type == Terminator::Type::Switch)
+			return false;
+
+		if (node->pred_back_edge)
+		{
+			// Only plain loops: a single continue block which is also the back-edge block,
+			// and which either falls back to the header or conditionally exits to the merge.
+			auto *continue_block = node->pred_back_edge;
+			if (continue_block == node || continue_block->pred_back_edge || continue_block->succ.size() > 1 ||
+			    !node->dominates(continue_block))
+			{
+				return false;
+			}
+
+			CFGNode *merge = nullptr;
+			if (!continue_block->succ.empty())
+				merge = continue_block->succ.front();
+
+			if (type == Terminator::Type::Condition)
+			{
+				// A loop header cannot be a selection header at the same time, so one path must exit the loop.
+				for (auto *succ : node->succ)
+				{
+					if (!query_reachability(*succ, *continue_block))
+					{
+						if (merge && merge != succ)
+							return false;
+						merge = succ;
+					}
+				}
+
+				if (std::find(node->succ.begin(), node->succ.end(), merge) == node->succ.end())
+					return false;
+			}
+
+			block.merge = merge;
+		}
+		else if (type == Terminator::Type::Condition && !node->succ_back_edge)
+		{
+			block.merge = node->immediate_post_dominator;
+			if (block.merge == exit_block)
+				return false;
+		}
+
+		if (block.merge)
+		{
+			auto &merge = get(block.merge);
+			if (merge.resolved || block.merge->succ_back_edge || !node->dominates(block.merge))
+				return false;
+
+			merge.header = block.header;
+			merge.resolved = true;
+		}
+		else if (node->pred_back_edge || (type == Terminator::Type::Condition && !node->succ_back_edge))
+			return false;
+
+		for (auto *succ : node->succ)
+		{
+			CFGNode *expected_header;
+			if (block.merge)
+				expected_header = succ == block.merge ? block.header : node;
+			else if (block.header && succ == get(block.header).merge)
+				expected_header = get(block.header).header;
+			else
+				expected_header = block.header;
+
+			auto &succ_block = get(succ);
+			if (!succ_block.resolved)
+			{
+				succ_block.header = expected_header;
+				succ_block.resolved = true;
+			}
+			else if (succ_block.header != expected_header)
+				return false;
+		}
+
+		// The continue block must belong directly to the loop it continues.
+		if (node->succ_back_edge && block.header != node->succ_back_edge)
+			return false;
+	}
+
+	for (auto *node : forward_post_visit_order)
+	{
+		auto &block = get(node);
+		if (!block.merge)
+			continue;
+
+		if (node->pred_back_edge)
+		{
+			node->merge = MergeType::Loop;
+			node->loop_merge_block = block.merge;
+		}
+		else
+		{
+			node->merge = MergeType::Selection;
+			node->selection_merge_block = block.merge;
+		}
+
+		block.merge->add_unique_header(node);
+	}
 
 	return true;
 }
@@ -932,9 +1388,10 @@ Operation *CFGStructurizer::duplicate_op(Operation *op, UnorderedMap<spv::Id, sp
 	else
 		duplicated_op = module.allocate_op(op->op);
 
+	duplicated_op->reserve_arguments(op->num_arguments);
 	for (unsigned i = 0; i < op->num_arguments; i++)
 	{
-		if (op->literal_mask & (1u << i))
+		if (op->is_literal_argument(i))
 			duplicated_op->add_literal(op->arguments[i]);
 		else
 			duplicated_op->add_id(get_remapped_id_for_duplicated_block(op->arguments[i], id_remap));
@@ -1115,6 +1572,10 @@ void CFGStructurizer::duplicate_impossible_merge_constructs()
 			continue;
 		}
 
+		// Every duplication adds a node per predecessor, so this can blow up on its own.
+		if (!check_complexity_budget("duplicate_impossible_merge_constructs", 0))
+			return;
+
 		duplicate_node(node);
 	}
 	recompute_cfg();
@@ -1223,7 +1684,11 @@ void CFGStructurizer::prune_dead_preds()
 	{
 		auto itr = std::remove_if(node->pred.begin(), node->pred.end(),
 		                          [&](const CFGNode *node) { return reachable_nodes.count(node) == 0; });
-		node->pred.erase(itr, node->pred.end());
+		if (itr != node->pred.end())
+		{
+			node->pred.erase(itr, node->pred.end());
+			pool.mark_cfg_edited();
+		}
 	}
 }
 
@@ -1233,7 +1698,7 @@ static void rewrite_consumed_ids(IRBlock &ir, spv::Id from, spv::Id to)
 	{
 		for (unsigned i = 0; i < op->num_arguments; i++)
 		{
-			if ((op->literal_mask & (1u << i)) == 0)
+			if (!op->is_literal_argument(i))
 				if (op->arguments[i] == from)
 					op->arguments[i] = to;
 		}
@@ -1292,9 +1757,8 @@ void CFGStructurizer::fixup_broken_value_dominance()
 	{
 		for (auto *op : node->ir.operations)
 		{
-			auto literal_mask = op->literal_mask;
 			for (unsigned i = 0; i < op->num_arguments; i++)
-				if (((1u << i) & literal_mask) == 0)
+				if (!op->is_literal_argument(i))
 					mark_node_value_access(node, op->arguments[i]);
 		}
 
@@ -1369,6 +1833,7 @@ void CFGStructurizer::insert_phi()
 			auto itr = std::find(succ->pred.begin(), succ->pred.end(), back_edge);
 			assert(itr != succ->pred.end());
 			succ->pred.erase(itr);
+			pool.mark_cfg_edited();
 			succ->recompute_immediate_dominator();
 		}
 	}
@@ -1430,6 +1895,33 @@ Vector<IncomingValue>::const_iterator CFGStructurizer::find_incoming_value(
 	return candidate;
 }
 
+void CFGStructurizer::build_incoming_value_index(IncomingValueIndex &index, const Vector<IncomingValue> &incoming)
+{
+	index.clear();
+	// emplace() keeps the first occurrence, which is what the linear search would find as well.
+	for (size_t i = 0; i < incoming.size(); i++)
+		index.emplace(incoming[i].block, i);
+}
+
+Vector<IncomingValue>::const_iterator CFGStructurizer::find_incoming_value(
+    const CFGNode *frontier_pred, const Vector<IncomingValue> &incoming, const IncomingValueIndex &index)
+{
+	// Every incoming block which dominates frontier_pred is on its dominator chain,
+	// and the first one we hit walking upwards is the most immediate dominator.
+	for (;;)
+	{
+		auto itr = index.find(frontier_pred);
+		if (itr != index.end())
+			return incoming.begin() + itr->second;
+
+		if (!frontier_pred->immediate_dominator || frontier_pred == frontier_pred->immediate_dominator)
+			break;
+		frontier_pred = frontier_pred->immediate_dominator;
+	}
+
+	return incoming.end();
+}
+
 static IncomingValue *phi_incoming_blocks_find_block(Vector<IncomingValue> &incomings, const CFGNode *block)
 {
 	for (auto &incoming : incomings)
@@ -1464,6 +1956,11 @@ void CFGStructurizer::fixup_phi(PHINode &node)
 	// This avoids some problematic cases of crossing edges when using ladders.
 	auto &incomings = node.block->ir.phi[node.phi_index].incoming;
 
+	// Number of incoming values per block, so we don't need to rescan the list for every input.
+	UnorderedMap<const CFGNode *, uint32_t> incoming_block_count;
+	for (auto &incoming : incomings)
+		incoming_block_count[incoming.block]++;
+
 	for (auto &incoming : incomings)
 	{
 		auto itr = value_id_to_block.find(incoming.id);
@@ -1479,7 +1976,8 @@ void CFGStructurizer::fixup_phi(PHINode &node)
 		// but there no longer is.
 		if (!source_block->dominates(incoming.block))
 		{
-			if (phi_incoming_blocks_find_block(incomings, source_block) != nullptr)
+			auto count_itr = incoming_block_count.find(source_block);
+			if (count_itr != incoming_block_count.end() && count_itr->second != 0)
 			{
 				// Sanity check. This would create ambiguity.
 				continue;
@@ -1499,7 +1997,9 @@ void CFGStructurizer::fixup_phi(PHINode &node)
 			LOGI("For node %s, move incoming node %s to %s.\n", node.block->name.c_str(), incoming.block->name.c_str(),
 			     itr->second->name.c_str());
 #endif
-			incoming.block = itr->second;
+			incoming_block_count[incoming.block]--;
+			incoming_block_count[source_block]++;
+			incoming.block = source_block;
 			validate_phi(node.block->ir.phi[node.phi_index]);
 		}
 	}
@@ -1508,20 +2008,29 @@ void CFGStructurizer::fixup_phi(PHINode &node)
 bool CFGStructurizer::can_complete_phi_insertion(const PHI &phi, const CFGNode *block)
 {
 	// If all incoming values have at least one pred block they dominate, we can merge the final PHI.
-	auto &incoming_values = phi.incoming;
-	for (auto &incoming : incoming_values)
-	{
-		auto itr = std::find_if(block->pred.begin(), block->pred.end(),
-		                        [&](const CFGNode *n) { return incoming.block->dominates(n); });
+	// Instead of testing every incoming block against every pred, walk the dominator chain of every pred once,
+	// and tick off the incoming blocks we pass. Chains are shared, so stop at nodes we have seen already.
+	UnorderedSet<const CFGNode *> pending;
+	for (auto &incoming : phi.incoming)
+		pending.insert(incoming.block);
 
-		if (itr == block->pred.end() &&
-		    (!block->pred_back_edge || !incoming.block->dominates(block->pred_back_edge)))
+	UnorderedSet<const CFGNode *> visited;
+	auto walk_dominators = [&](const CFGNode *n) {
+		while (!pending.empty() && visited.insert(n).second)
 		{
-			return false;
+			pending.erase(n);
+			if (!n->immediate_dominator || n == n->immediate_dominator)
+				break;
+			n = n->immediate_dominator;
 		}
-	}
+	};
 
-	return true;
+	for (auto *pred : block->pred)
+		walk_dominators(pred);
+	if (block->pred_back_edge)
+		walk_dominators(block->pred_back_edge);
+
+	return pending.empty();
 }
 
 bool CFGStructurizer::query_reachability_through_back_edges(const CFGNode &from, const CFGNode &to) const
@@ -1597,6 +2106,8 @@ void CFGStructurizer::insert_phi(PHINode &node)
 	auto &incoming_values = phi.incoming;
 
 	UnorderedSet<const CFGNode *> placed_frontiers;
+	// Rebuilt whenever incoming_values changes, before looking up values for the preds of a frontier.
+	IncomingValueIndex incoming_index;
 
 	for (;;)
 	{
@@ -1668,11 +2179,12 @@ void CFGStructurizer::insert_phi(PHINode &node)
 			else
 			{
 				Vector<IncomingValue> final_incoming;
+				build_incoming_value_index(incoming_index, incoming_values);
 
 				// Final merge.
 				for (auto *input : frontier->pred)
 				{
-					auto itr = find_incoming_value(input, incoming_values);
+					auto itr = find_incoming_value(input, incoming_values, incoming_index);
 
 					IncomingValue value = {};
 					if (itr != incoming_values.end())
@@ -1686,7 +2198,7 @@ void CFGStructurizer::insert_phi(PHINode &node)
 
 				if (frontier->pred_back_edge)
 				{
-					auto itr = find_incoming_value(frontier->pred_back_edge, incoming_values);
+					auto itr = find_incoming_value(frontier->pred_back_edge, incoming_values, incoming_index);
 
 					IncomingValue value = {};
 					if (itr != incoming_values.end())
@@ -1718,9 +2230,10 @@ void CFGStructurizer::insert_phi(PHINode &node)
 		module.get_builder().addName(frontier_phi.id, (String("frontier_phi_") + frontier->name).c_str());
 
 		assert(!frontier->pred_back_edge);
+		build_incoming_value_index(incoming_index, incoming_values);
 		for (auto *input : frontier->pred)
 		{
-			auto itr = find_incoming_value(input, incoming_values);
+			auto itr = find_incoming_value(input, incoming_values, incoming_index);
 			if (itr != incoming_values.end())
 			{
 #ifdef PHI_DEBUG
@@ -1815,10 +2328,11 @@ void CFGStructurizer::insert_phi(PHINode &node)
 			// we created along this path turned out to be irrelevant after all.
 
 			unsigned normal_branch_count = 0;
+			build_incoming_value_index(incoming_index, incoming_values);
 			for (auto *input : frontier->pred)
 			{
 				IncomingValue value = {};
-				auto itr = find_incoming_value(input, incoming_values);
+				auto itr = find_incoming_value(input, incoming_values, incoming_index);
 				if (itr != incoming_values.end())
 				{
 					// If the input does not dominate the frontier, this might be a case of cross-edge PHI merge.
@@ -1904,28 +2418,286 @@ void CFGStructurizer::compute_post_dominance_frontier()
 		recompute_post_dominance_frontier(node);
 }
 
+template <typename SuccOp, typename PredOp>
+void CFGStructurizer::build_semi_nca_dominators(uint32_t count, uint32_t root, const SuccOp &for_each_succ,
+                                                const PredOp &for_each_pred)
+{
+	// Semi-NCA (Georgiadis, Tarjan and Werneck) on dense node indices in [0, count).
+	// The graph is only seen through callbacks, so the same code serves the forward CFG and
+	// the flipped CFG with fake edges used for post-dominance.
+	auto &s = semi_nca;
+
+	// DFS preorder numbering. Number 0 is reserved to mean unvisited, and as the parent of the root.
+	s.dfs_num.assign(count, 0);
+	s.vertex.clear();
+	s.parent.clear();
+	s.vertex.push_back(UINT32_MAX);
+	s.parent.push_back(0);
+
+	s.work.clear();
+	s.work.push_back({ root, 0 });
+	while (!s.work.empty())
+	{
+		auto item = s.work.back();
+		s.work.pop_back();
+		if (s.dfs_num[item.index])
+			continue;
+
+		auto num = uint32_t(s.vertex.size());
+		s.dfs_num[item.index] = num;
+		s.vertex.push_back(item.index);
+		s.parent.push_back(item.parent);
+
+		for_each_succ(item.index, [&](uint32_t succ) {
+			if (!s.dfs_num[succ])
+				s.work.push_back({ succ, num });
+		});
+	}
+
+	auto num_vertices = uint32_t(s.vertex.size());
+	s.semi.resize(num_vertices);
+	s.label.resize(num_vertices);
+	s.ancestor = s.parent;
+	s.idom = s.parent;
+	for (uint32_t i = 0; i < num_vertices; i++)
+	{
+		s.semi[i] = i;
+		s.label[i] = i;
+	}
+
+	// Semi-dominators, in reverse preorder. Vertices numbered above i are linked into the forest.
+	for (uint32_t i = num_vertices - 1; i >= 2; i--)
+	{
+		s.semi[i] = s.parent[i];
+		for_each_pred(s.vertex[i], [&](uint32_t pred) {
+			uint32_t v = s.dfs_num[pred];
+			if (!v)
+				return;
+
+			uint32_t u = semi_nca_eval(v, i + 1);
+			if (s.semi[u] < s.semi[i])
+				s.semi[i] = s.semi[u];
+		});
+	}
+
+	// idom is the nearest common ancestor of the semi-dominator and the DFS parent.
+	for (uint32_t i = 2; i < num_vertices; i++)
+	{
+		uint32_t candidate = s.idom[i];
+		while (candidate > s.semi[i])
+			candidate = s.idom[candidate];
+		s.idom[i] = candidate;
+	}
+
+	// The root dominates itself.
+	if (num_vertices > 1)
+		s.idom[1] = 1;
+}
+
+uint32_t CFGStructurizer::semi_nca_eval(uint32_t v, uint32_t last_linked)
+{
+	auto &s = semi_nca;
+	if (s.ancestor[v] < last_linked)
+		return s.label[v];
+
+	// Collect ancestors up to, but not including, the root of the linked tree.
+	s.eval_stack.clear();
+	uint32_t x = v;
+	do
+	{
+		s.eval_stack.push_back(x);
+		x = s.ancestor[x];
+	} while (s.ancestor[x] >= last_linked);
+
+	// Path compression. Point every vertex on the path at the root of the tree,
+	// and propagate the label with the smallest semi-dominator downwards.
+	uint32_t p = x;
+	uint32_t p_label = s.label[p];
+	do
+	{
+		x = s.eval_stack.back();
+		s.eval_stack.pop_back();
+		s.ancestor[x] = s.ancestor[p];
+
+		if (s.semi[p_label] < s.semi[s.label[x]])
+			s.label[x] = p_label;
+		else
+			p_label = s.label[x];
+
+		p = x;
+	} while (!s.eval_stack.empty());
+
+	return s.label[x];
+}
+
+uint32_t CFGStructurizer::get_semi_nca_immediate_dominator(uint32_t index) const
+{
+	auto &s = semi_nca;
+	uint32_t num = s.dfs_num[index];
+	return num ? s.vertex[s.idom[num]] : UINT32_MAX;
+}
+
 void CFGStructurizer::build_immediate_dominators()
 {
-	for (auto i = forward_post_visit_order.size(); i; i--)
+	// Back edges are not part of succ/pred, so the dominator tree is built over the forward CFG.
+	auto count = uint32_t(forward_post_visit_order.size());
+	auto is_member = [&](const CFGNode *node) {
+		return node->forward_post_visit_order < count && forward_post_visit_order[node->forward_post_visit_order] == node;
+	};
+
+	build_semi_nca_dominators(
+	    count, entry_block->forward_post_visit_order,
+	    [&](uint32_t index, const auto &op) {
+		    for (auto *succ : forward_post_visit_order[index]->succ)
+			    if (is_member(succ))
+				    op(succ->forward_post_visit_order);
+	    },
+	    [&](uint32_t index, const auto &op) {
+		    for (auto *pred : forward_post_visit_order[index]->pred)
+			    if (is_member(pred))
+				    op(pred->forward_post_visit_order);
+	    });
+
+	for (uint32_t i = 0; i < count; i++)
 	{
-		auto *block = forward_post_visit_order[i - 1];
-		block->recompute_immediate_dominator();
+		uint32_t idom = get_semi_nca_immediate_dominator(i);
+		forward_post_visit_order[i]->immediate_dominator = idom != UINT32_MAX ? forward_post_visit_order[idom] : nullptr;
 	}
+
+	if (validate_dominance)
+		validate_dominators();
 }
 
 void CFGStructurizer::build_immediate_post_dominators()
 {
+	// Same as build_immediate_dominators(), but for the flipped CFG, including fake successors.
+	// The exit node is the root, and gets the index past all backwards visited nodes.
+	// Leaf blocks are its only successors in the flipped CFG.
+	auto count = uint32_t(backward_post_visit_order.size());
+	auto is_member = [&](const CFGNode *node) {
+		return node->backward_post_visit_order < count && backward_post_visit_order[node->backward_post_visit_order] == node;
+	};
+	auto is_leaf = [](const CFGNode *node) {
+		return node->succ.empty() && node->fake_succ.empty();
+	};
+
+	build_semi_nca_dominators(
+	    count + 1, count,
+	    [&](uint32_t index, const auto &op) {
+		    if (index == count)
+		    {
+			    for (uint32_t i = 0; i < count; i++)
+				    if (is_leaf(backward_post_visit_order[i]))
+					    op(i);
+		    }
+		    else
+		    {
+			    auto *node = backward_post_visit_order[index];
+			    for (auto *pred : node->pred)
+				    if (is_member(pred))
+					    op(pred->backward_post_visit_order);
+			    for (auto *pred : node->fake_pred)
+				    if (is_member(pred))
+					    op(pred->backward_post_visit_order);
+		    }
+	    },
+	    [&](uint32_t index, const auto &op) {
+		    auto *node = backward_post_visit_order[index];
+		    if (is_leaf(node))
+		    {
+			    op(count);
+			    return;
+		    }
+
+		    for (auto *succ : node->succ)
+			    if (is_member(succ))
+				    op(succ->backward_post_visit_order);
+		    for (auto *succ : node->fake_succ)
+			    if (is_member(succ))
+				    op(succ->backward_post_visit_order);
+	    });
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		auto *block = backward_post_visit_order[i];
+		uint32_t ipdom = get_semi_nca_immediate_dominator(i);
+		if (ipdom == UINT32_MAX)
+			block->immediate_post_dominator = nullptr;
+		else if (ipdom == count)
+			block->immediate_post_dominator = exit_block;
+		else
+			block->immediate_post_dominator = backward_post_visit_order[ipdom];
+	}
+
+	if (validate_dominance)
+		validate_post_dominators();
+}
+
+void CFGStructurizer::validate_dominators()
+{
+	Vector<CFGNode *> semi_nca_result;
+	semi_nca_result.reserve(forward_post_visit_order.size());
+	for (auto *block : forward_post_visit_order)
+		semi_nca_result.push_back(block->immediate_dominator);
+
+	for (auto i = forward_post_visit_order.size(); i; i--)
+		forward_post_visit_order[i - 1]->recompute_immediate_dominator();
+
+	// Keep the reference result, so a mismatch does not affect codegen.
+	for (size_t i = 0; i < forward_post_visit_order.size(); i++)
+	{
+		auto *block = forward_post_visit_order[i];
+		if (semi_nca_result[i] != block->immediate_dominator)
+		{
+			LOGE("Semi-NCA idom mismatch for %s: got %s, expected %s.\n", block->name.c_str(),
+			     semi_nca_result[i] ? semi_nca_result[i]->name.c_str() : "null",
+			     block->immediate_dominator ? block->immediate_dominator->name.c_str() : "null");
+		}
+	}
+}
+
+void CFGStructurizer::validate_post_dominators()
+{
+	Vector<CFGNode *> semi_nca_result;
+	semi_nca_result.reserve(backward_post_visit_order.size());
+	for (auto *block : backward_post_visit_order)
+		semi_nca_result.push_back(block->immediate_post_dominator);
+
 	for (auto i = backward_post_visit_order.size(); i; i--)
+		backward_post_visit_order[i - 1]->recompute_immediate_post_dominator();
+
+	for (size_t i = 0; i < backward_post_visit_order.size(); i++)
 	{
-		auto *block = backward_post_visit_order[i - 1];
-		block->recompute_immediate_post_dominator();
+		auto *block = backward_post_visit_order[i];
+		if (semi_nca_result[i] != block->immediate_post_dominator)
+		{
+			LOGE("Semi-NCA post-idom mismatch for %s: got %s, expected %s.\n", block->name.c_str(),
+			     semi_nca_result[i] ? semi_nca_result[i]->name.c_str() : "null",
+			     block->immediate_post_dominator ? block->immediate_post_dominator->name.c_str() : "null");
+		}
+	}
+}
+
+void CFGStructurizer::reset_structured_analysis(CFGNode &node)
+{
+	node.split_merge_block_candidate = nullptr;
+
+	if (!node.freeze_structured_analysis)
+	{
+		node.headers.clear();
+		node.merge = MergeType::None;
+		node.loop_merge_block = nullptr;
+		node.loop_ladder_block = nullptr;
+		node.selection_merge_block = nullptr;
 	}
 }
 
 void CFGStructurizer::reset_traversal()
 {
+	cfg_analysis_valid = false;
 	reachable_nodes.clear();
 	forward_post_visit_order.clear();
+	forward_post_visit_first.clear();
 	backward_post_visit_order.clear();
 	pool.for_each_node([](CFGNode &node) {
 		node.visited = false;
@@ -1933,18 +2705,9 @@ void CFGStructurizer::reset_traversal()
 		node.traversing = false;
 		node.immediate_dominator = nullptr;
 		node.immediate_post_dominator = nullptr;
-		node.split_merge_block_candidate = nullptr;
 		node.fake_pred.clear();
 		node.fake_succ.clear();
-
-		if (!node.freeze_structured_analysis)
-		{
-			node.headers.clear();
-			node.merge = MergeType::None;
-			node.loop_merge_block = nullptr;
-			node.loop_ladder_block = nullptr;
-			node.selection_merge_block = nullptr;
-		}
+		reset_structured_analysis(node);
 
 		if (node.succ_back_edge)
 			node.succ.push_back(node.succ_back_edge);
@@ -2139,95 +2902,145 @@ void CFGStructurizer::backwards_visit()
 
 void CFGStructurizer::backwards_visit(CFGNode &entry)
 {
+	assert(traversal_stack.empty());
 	entry.backward_visited = true;
+	traversal_stack.push_back({ &entry, 0, 0 });
+
+	while (!traversal_stack.empty())
+	{
+		auto &frame = traversal_stack.back();
+		auto &node = *frame.node;
+		size_t num_preds = node.pred.size();
 
-	for (auto *pred : entry.pred)
-		if (!pred->backward_visited)
-			backwards_visit(*pred);
+		if (frame.index < num_preds + node.fake_pred.size())
+		{
+			auto *pred = frame.index < num_preds ? node.pred[frame.index] : node.fake_pred[frame.index - num_preds];
+			frame.index++;
 
-	for (auto *pred : entry.fake_pred)
-		if (!pred->backward_visited)
-			backwards_visit(*pred);
+			if (!pred->backward_visited)
+			{
+				pred->backward_visited = true;
+				traversal_stack.push_back({ pred, 0, 0 });
+			}
+			continue;
+		}
 
-	entry.backward_post_visit_order = backward_post_visit_order.size();
-	backward_post_visit_order.push_back(&entry);
+		traversal_stack.pop_back();
+		node.backward_post_visit_order = backward_post_visit_order.size();
+		backward_post_visit_order.push_back(&node);
+	}
 }
 
 void CFGStructurizer::visit_for_back_edge_analysis(CFGNode &entry)
 {
-	entry.visited = true;
-	entry.traversing = true;
-	reachable_nodes.insert(&entry);
+	assert(traversal_stack.empty());
+	auto begin_visit = [&](CFGNode &node) {
+		node.visited = true;
+		node.traversing = true;
+		reachable_nodes.insert(&node);
+		traversal_stack.push_back({ &node, 0, 0 });
+	};
+
+	begin_visit(entry);
 
-	for (auto *succ : entry.succ)
+	while (!traversal_stack.empty())
 	{
-		// Reuse the existing vector to keep track of back edges.
-		if (succ->traversing)
-			succ->fake_pred.push_back(&entry);
-		else if (!succ->visited)
-			visit_for_back_edge_analysis(*succ);
-	}
+		auto &frame = traversal_stack.back();
+		auto &node = *frame.node;
 
-	entry.traversing = false;
+		if (frame.index < node.succ.size())
+		{
+			auto *succ = node.succ[frame.index++];
 
-	// After we get here, we must have observed all back edges.
-	// If there is more than one back edge, merge them.
-	if (entry.fake_pred.size() >= 2)
-	{
-		auto *new_back_edge = pool.create_node();
-		new_back_edge->name = entry.name + ".back-edge-merge";
-		for (auto *n : entry.fake_pred)
-			n->retarget_branch_pre_traversal(&entry, new_back_edge);
-		new_back_edge->succ.push_back(&entry);
-		new_back_edge->ir.terminator.type = Terminator::Type::Branch;
-		new_back_edge->ir.terminator.direct_block = &entry;
-		new_back_edge->add_branch(&entry);
+			// Reuse the existing vector to keep track of back edges.
+			if (succ->traversing)
+				succ->fake_pred.push_back(&node);
+			else if (!succ->visited)
+				begin_visit(*succ);
+			continue;
+		}
+
+		traversal_stack.pop_back();
+		node.traversing = false;
+
+		// After we get here, we must have observed all back edges.
+		// If there is more than one back edge, merge them.
+		if (node.fake_pred.size() >= 2)
+		{
+			auto *new_back_edge = pool.create_node();
+			new_back_edge->name = node.name + ".back-edge-merge";
+			for (auto *n : node.fake_pred)
+				n->retarget_branch_pre_traversal(&node, new_back_edge);
+			new_back_edge->succ.push_back(&node);
+			new_back_edge->ir.terminator.type = Terminator::Type::Branch;
+			new_back_edge->ir.terminator.direct_block = &node;
+			new_back_edge->add_branch(&node);
+		}
 	}
 }
 
 void CFGStructurizer::visit(CFGNode &entry)
 {
-	entry.visited = true;
-	entry.traversing = true;
-	reachable_nodes.insert(&entry);
+	assert(traversal_stack.empty());
+	auto begin_visit = [&](CFGNode &node) {
+		node.visited = true;
+		node.traversing = true;
+		reachable_nodes.insert(&node);
+		traversal_stack.push_back({ &node, 0, uint32_t(forward_post_visit_order.size()) });
+	};
 
-	for (auto *succ : entry.succ)
+	begin_visit(entry);
+
+	while (!traversal_stack.empty())
 	{
-		if (succ->traversing)
+		auto &frame = traversal_stack.back();
+		auto &node = *frame.node;
+
+		if (frame.index < node.succ.size())
 		{
-			// For now, only support one back edge.
-			// DXIL seems to obey this.
-			assert(!entry.succ_back_edge || entry.succ_back_edge == succ);
-			entry.succ_back_edge = succ;
+			auto *succ = node.succ[frame.index++];
 
-			// For now, only support one back edge.
-			// DXIL seems to obey this.
-			assert(!succ->pred_back_edge || succ->pred_back_edge == &entry);
-			succ->pred_back_edge = &entry;
+			if (succ->traversing)
+			{
+				// For now, only support one back edge.
+				// DXIL seems to obey this.
+				assert(!node.succ_back_edge || node.succ_back_edge == succ);
+				node.succ_back_edge = succ;
+
+				// For now, only support one back edge.
+				// DXIL seems to obey this.
+				assert(!succ->pred_back_edge || succ->pred_back_edge == &node);
+				succ->pred_back_edge = &node;
+			}
+			else if (!succ->visited)
+				begin_visit(*succ);
+			continue;
 		}
-		else if (!succ->visited)
-			visit(*succ);
-	}
 
-	// Any back edges need to be handled specifically, only keep forward edges in succ/pred lists.
-	// This avoids any infinite loop scenarios and needing to special case a lot of checks.
-	if (entry.succ_back_edge)
-	{
-		auto itr = std::find(entry.succ.begin(), entry.succ.end(), entry.succ_back_edge);
-		if (itr != entry.succ.end())
-			entry.succ.erase(itr);
-	}
+		auto subtree_first = frame.subtree_first;
+		traversal_stack.pop_back();
 
-	if (entry.pred_back_edge)
-	{
-		auto itr = std::find(entry.pred.begin(), entry.pred.end(), entry.pred_back_edge);
-		if (itr != entry.pred.end())
-			entry.pred.erase(itr);
-	}
+		// Any back edges need to be handled specifically, only keep forward edges in succ/pred lists.
+		// This avoids any infinite loop scenarios and needing to special case a lot of checks.
+		if (node.succ_back_edge)
+		{
+			auto itr = std::find(node.succ.begin(), node.succ.end(), node.succ_back_edge);
+			if (itr != node.succ.end())
+				node.succ.erase(itr);
+		}
+
+		if (node.pred_back_edge)
+		{
+			auto itr = std::find(node.pred.begin(), node.pred.end(), node.pred_back_edge);
+			if (itr != node.pred.end())
+				node.pred.erase(itr);
+		}
 
-	entry.traversing = false;
-	entry.forward_post_visit_order = forward_post_visit_order.size();
-	forward_post_visit_order.push_back(&entry);
+		node.traversing = false;
+		node.forward_post_visit_order = forward_post_visit_order.size();
+		forward_post_visit_order.push_back(&node);
+		forward_post_visit_first.push_back(subtree_first);
+	}
 }
 
 void CFGStructurizer::merge_to_succ(CFGNode *node, unsigned index)
@@ -3207,6 +4020,9 @@ bool CFGStructurizer::query_reachability(const CFGNode &from, const CFGNode &to)
 	if (&from == &to)
 		return true;
 
+	if (use_sparse_reachability)
+		return query_sparse_reachability(from.forward_post_visit_order, to.forward_post_visit_order);
+
 	const uint32_t *src_reachability = &reachability_bitset[from.forward_post_visit_order * reachability_stride];
 	return (src_reachability[to.forward_post_visit_order / 32] & (1u << (to.forward_post_visit_order & 31u))) != 0;
 }
@@ -3227,8 +4043,91 @@ void CFGStructurizer::visit_reachability(const CFGNode &node)
 	dst_reachability[node.forward_post_visit_order / 32] |= 1u << (node.forward_post_visit_order & 31u);
 }
 
+bool CFGStructurizer::query_sparse_reachability(uint32_t from, uint32_t to) const
+{
+	// Forward edges form a DAG, so anything reachable must have been post-visited first.
+	if (to > from || to < reachability_low[from])
+		return false;
+	if (to >= forward_post_visit_first[from])
+		return true;
+
+	if (++reachability_stamp == 0)
+	{
+		std::fill(reachability_visit_stamps.begin(), reachability_visit_stamps.end(), 0);
+		reachability_stamp = 1;
+	}
+
+	reachability_stack.clear();
+	reachability_stack.push_back(from);
+	reachability_visit_stamps[from] = reachability_stamp;
+
+	while (!reachability_stack.empty())
+	{
+		uint32_t index = reachability_stack.back();
+		reachability_stack.pop_back();
+
+		for (uint32_t i = reachability_succ_offsets[index]; i < reachability_succ_offsets[index + 1]; i++)
+		{
+			uint32_t succ = reachability_succs[i];
+			if (reachability_visit_stamps[succ] == reachability_stamp)
+				continue;
+			reachability_visit_stamps[succ] = reachability_stamp;
+
+			if (to > succ || to < reachability_low[succ])
+				continue;
+			if (to >= forward_post_visit_first[succ])
+				return true;
+
+			reachability_stack.push_back(succ);
+		}
+	}
+
+	return false;
+}
+
+void CFGStructurizer::build_sparse_reachability()
+{
+	size_t count = forward_post_visit_order.size();
+	reachability_low.resize(count);
+	reachability_succ_offsets.resize(count + 1);
+	reachability_succs.clear();
+
+	// Snapshot the forward edges. Nodes which are added later inherit the post-order index
+	// of an existing node, same as the dense matrix.
+	for (size_t i = 0; i < count; i++)
+	{
+		auto *node = forward_post_visit_order[i];
+		uint32_t low = forward_post_visit_first[i];
+
+		reachability_succ_offsets[i] = uint32_t(reachability_succs.size());
+		for (auto *succ : node->succ)
+		{
+			reachability_succs.push_back(uint32_t(succ->forward_post_visit_order));
+			low = std::min(low, reachability_low[succ->forward_post_visit_order]);
+		}
+		reachability_low[i] = low;
+	}
+	reachability_succ_offsets[count] = uint32_t(reachability_succs.size());
+
+	reachability_visit_stamps.clear();
+	reachability_visit_stamps.resize(count);
+	reachability_stamp = 0;
+}
+
 void CFGStructurizer::build_reachability()
 {
+	// Beyond this the dense matrix gets too large (N^2 bits) and too slow to build.
+	constexpr size_t SparseReachabilityThreshold = 4096;
+	use_sparse_reachability = forward_post_visit_order.size() > SparseReachabilityThreshold;
+
+	if (use_sparse_reachability)
+	{
+		reachability_stride = 0;
+		reachability_bitset.clear();
+		build_sparse_reachability();
+		return;
+	}
+
 	reachability_stride = (forward_post_visit_order.size() + 31) / 32;
 	reachability_bitset.clear();
 	reachability_bitset.resize(reachability_stride * forward_post_visit_order.size());
@@ -3238,7 +4137,20 @@ void CFGStructurizer::build_reachability()
 
 void CFGStructurizer::recompute_cfg()
 {
+	// Many passes end up not rewriting anything. If no node was created and no edge was edited
+	// since the last analysis, it is still valid, and only the structured analysis has to be forgotten.
+	if (cfg_analysis_valid && analyzed_cfg_revision == pool.get_cfg_revision())
+	{
+		pool.for_each_node(reset_structured_analysis);
+		return;
+	}
+
 	reset_traversal();
+
+	// Analysis itself can edit the CFG, e.g. by pruning dead preds or adding branches out of infinite loops.
+	// Record the revision before analysis starts so that such edits are analyzed again next time.
+	analyzed_cfg_revision = pool.get_cfg_revision();
+
 	visit(*entry_block);
 	// Need to prune dead preds before computing dominance.
 	prune_dead_preds();
@@ -3250,6 +4162,8 @@ void CFGStructurizer::recompute_cfg()
 
 	compute_dominance_frontier();
 	compute_post_dominance_frontier();
+
+	cfg_analysis_valid = true;
 }
 
 CFGNode *CFGStructurizer::find_natural_switch_merge_block(CFGNode *node, CFGNode *post_dominator) const
@@ -3492,6 +4406,7 @@ void CFGStructurizer::hoist_switch_branches_to_frontier(CFGNode *node, CFGNode *
 				c.node = merge;
 
 		node->succ.erase(std::find(node->succ.begin(), node->succ.end(), succ));
+		pool.mark_cfg_edited();
 		node->add_branch(merge);
 		pred->add_branch(succ);
 
@@ -5363,6 +6278,7 @@ void CFGStructurizer::split_merge_blocks()
 
 void CFGStructurizer::structurize(unsigned pass)
 {
+	DXIL_SPV_TRACE_ZONE(pass == 0 ? "CFGStructurizer::structurize pass 0" : "CFGStructurizer::structurize pass 1");
 	if (find_switch_blocks(pass))
 	{
 		recompute_cfg();
@@ -5646,6 +6562,7 @@ bool CFGStructurizer::rewrite_invalid_loop_breaks()
 
 void CFGStructurizer::traverse(BlockEmissionInterface &iface)
 {
+	DXIL_SPV_TRACE_ZONE("CFGStructurizer::traverse");
 	// Make sure all blocks are known to the backend before we emit code.
 	// Prefer that IDs grow the further down the function we go.
 	for (auto itr = forward_post_visit_order.rbegin(); itr != forward_post_visit_order.rend(); ++itr)
@@ -5654,6 +6571,8 @@ void CFGStructurizer::traverse(BlockEmissionInterface &iface)
 		iface.register_block(*itr);
 	}
 
+	iface.prepare_blocks(forward_post_visit_order);
+
 	// Need to emit blocks such that dominating blocks come before dominated blocks.
 	for (auto index = forward_post_visit_order.size(); index; index--)
 	{
@@ -26,6 +26,8 @@
 
 #include "thread_local_allocator.hpp"
 #include "ir.hpp"
+#include <atomic>
+#include <chrono>
 #include <memory>
 #include <stdint.h>
 
@@ -35,6 +37,7 @@ class BlockEmissionInterface;
 class SPIRVModule;
 struct CFGNode;
 class CFGNodePool;
+struct CFGSnapshot;
 
 class BlockEmissionInterface
 {
@@ -42,14 +45,38 @@ public:
 	virtual ~BlockEmissionInterface() = default;
 	virtual void emit_basic_block(CFGNode *node) = 0;
 	virtual void register_block(CFGNode *node) = 0;
+	// Called with every block in post-order before any block is emitted.
+	virtual void prepare_blocks(const Vector<CFGNode *> &)
+	{
+	}
 };
 
 class CFGStructurizer
 {
 public:
+	struct PassStatistics
+	{
+		const char *name;
+		uint64_t time_ns;
+		// Bytes requested from the thread allocator while in the pass.
+		uint64_t allocated_bytes;
+		// Nodes in the pool when the pass completed.
+		size_t node_count;
+	};
+
 	CFGStructurizer(CFGNode *entry, CFGNodePool &pool, SPIRVModule &module);
+	// Returns false if cancelled, or if the function exceeded the complexity budget.
 	bool run();
 	void traverse(BlockEmissionInterface &iface);
+	// Polled between passes of run(). The CFG is left in an unusable state when run() is cancelled.
+	void set_cancel_flag(const std::atomic_bool *flag);
+	// True if run() gave up because rewrites grew the CFG or iterated beyond what is reasonable
+	// for the size of the input function. Like cancellation, the CFG is left in an unusable state.
+	bool exceeded_complexity_budget() const;
+	// If set, run() appends an entry for every pass it completes. nullptr disables collection.
+	void set_pass_statistics(Vector<PassStatistics> *stats);
+	// Captures the reachable CFG as of the last CFG analysis.
+	void capture_cfg_snapshot(CFGSnapshot &snapshot) const;
 	CFGNode *get_entry_block() const;
 
 	bool rewrite_rov_lock_region();
@@ -65,9 +92,84 @@ private:
 	// For post-dominance analysis.
 	Vector<CFGNode *> backward_post_visit_order;
 
+	// For every node in forward post-order, the lowest post-order index in its DFS subtree.
+	// The subtree of node N spans [forward_post_visit_first[N], N].
+	Vector<uint32_t> forward_post_visit_first;
+
+	// Dense reachability matrix. Quadratic in memory, so only used for reasonably sized CFGs.
 	Vector<uint32_t> reachability_bitset;
 	unsigned reachability_stride = 0;
 
+	// Sparse reachability index for huge CFGs (e.g. fully unrolled loops).
+	// Every node gets the lowest post-order index reachable from it, which together with the DFS
+	// subtree interval answers most queries directly. Remaining queries fall back to a search over
+	// a snapshot of the forward edges which is pruned by the same labels.
+	bool use_sparse_reachability = false;
+	Vector<uint32_t> reachability_low;
+	Vector<uint32_t> reachability_succ_offsets;
+	Vector<uint32_t> reachability_succs;
+	mutable Vector<uint32_t> reachability_visit_stamps;
+	mutable Vector<uint32_t> reachability_stack;
+	mutable uint32_t reachability_stamp = 0;
+
+	// Scratch space for semi-NCA dominator tree construction on dense node indices.
+	// Per-vertex arrays other than dfs_num are indexed by DFS preorder number, starting at 1.
+	struct SemiNCAState
+	{
+		struct WorkItem
+		{
+			uint32_t index;
+			uint32_t parent;
+		};
+		Vector<WorkItem> work;
+		Vector<uint32_t> dfs_num;
+		Vector<uint32_t> vertex;
+		Vector<uint32_t> parent;
+		Vector<uint32_t> ancestor;
+		Vector<uint32_t> semi;
+		Vector<uint32_t> label;
+		Vector<uint32_t> idom;
+		Vector<uint32_t> eval_stack;
+	};
+	SemiNCAState semi_nca;
+	bool validate_dominance = false;
+
+	// Pool revision which the current CFG analysis was computed from.
+	uint64_t analyzed_cfg_revision = 0;
+	bool cfg_analysis_valid = false;
+
+	const std::atomic_bool *cancel_flag = nullptr;
+	bool is_cancelled() const;
+
+	// Per-function limits, scaled by the input node count, so pathological CFGs fail in bounded time.
+	size_t node_budget = 0;
+	uint32_t rewrite_iteration_budget = 0;
+	bool complexity_budget_exceeded = false;
+	void begin_complexity_budget();
+	bool check_complexity_budget(const char *pass, uint32_t iterations);
+
+	Vector<PassStatistics> *pass_statistics = nullptr;
+	std::chrono::steady_clock::time_point pass_start;
+	uint64_t pass_start_allocated = 0;
+	void begin_pass();
+	void end_pass(const char *name);
+
+	// Encoded snapshot of the input CFG, if DXIL_SPIRV_CFG_SNAPSHOT_PATH is set.
+	Vector<uint32_t> input_snapshot;
+	bool capture_input_snapshot = false;
+	bool run_passes();
+	void write_input_snapshot(const char *path_prefix) const;
+
+	// Explicit stack for the CFG traversals, so deep CFGs cannot overflow small thread stacks.
+	// Kept around so that repeated traversals do not need to reallocate it.
+	struct TraversalFrame
+	{
+		CFGNode *node;
+		size_t index;
+		uint32_t subtree_first;
+	};
+	Vector<TraversalFrame> traversal_stack;
+
 	UnorderedSet<const CFGNode *> reachable_nodes;
 	UnorderedSet<const CFGNode *> structured_loop_merge_targets;
 	void visit(CFGNode &entry);
@@ -76,10 +178,20 @@ private:
 	void backwards_visit(CFGNode &entry);
 	void build_immediate_dominators();
 	void build_immediate_post_dominators();
+	template <typename SuccOp, typename PredOp>
+	void build_semi_nca_dominators(uint32_t count, uint32_t root, const SuccOp &for_each_succ,
+	                               const PredOp &for_each_pred);
+	uint32_t semi_nca_eval(uint32_t v, uint32_t last_linked);
+	uint32_t get_semi_nca_immediate_dominator(uint32_t index) const;
+	void validate_dominators();
+	void validate_post_dominators();
 	void build_reachability();
 	void visit_reachability(const CFGNode &node);
+	void build_sparse_reachability();
 	bool query_reachability(const CFGNode &from, const CFGNode &to) const;
+	bool query_sparse_reachability(uint32_t from, uint32_t to) const;
 	void structurize(unsigned pass);
+	bool assign_merges_for_structured_cfg();
 	void find_loops();
 	bool rewrite_transposed_loops();
 
@@ -162,6 +274,13 @@ private:
 	static Vector<IncomingValue>::const_iterator find_incoming_value(const CFGNode *frontier_pred,
 	                                                                 const Vector<IncomingValue> &incoming);
 
+	// Incoming block -> first index in an incoming list, for repeated lookups against the same list.
+	using IncomingValueIndex = UnorderedMap<const CFGNode *, size_t>;
+	static void build_incoming_value_index(IncomingValueIndex &index, const Vector<IncomingValue> &incoming);
+	static Vector<IncomingValue>::const_iterator find_incoming_value(const CFGNode *frontier_pred,
+	                                                                 const Vector<IncomingValue> &incoming,
+	                                                                 const IncomingValueIndex &index);
+
 	void rewrite_selection_breaks(CFGNode *header, CFGNode *ladder_to);
 
 	enum class LoopExitType
@@ -178,6 +297,7 @@ private:
 	CFGNode *create_helper_pred_block(CFGNode *node);
 	CFGNode *create_helper_succ_block(CFGNode *node);
 	void reset_traversal();
+	static void reset_structured_analysis(CFGNode &node);
 	bool rewrite_invalid_loop_breaks();
 	void recompute_cfg();
 	void rewrite_multiple_back_edges();
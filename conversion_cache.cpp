@@ -0,0 +1,1046 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "conversion_cache.hpp"
+#include "logging.hpp"
+#include <atomic>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <process.h>
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+namespace dxil_spv
+{
+// On-disk layout. A pack of records, each a RecordHeaderWords header followed by the payload,
+// and an index of IndexHeaderWords followed by buckets of (key, pack offset + 1), 0 meaning empty.
+enum
+{
+	PackMagic = 0x52435844, // DXCR
+	IndexMagic = 0x49435844, // DXCI
+	DiskVersion = 6,
+	RecordHeaderWords = 6,
+	IndexHeaderWords = 4,
+	IndexBucketWords = 4,
+	EntryHeaderWords = 14
+};
+
+// The version is part of the file names, so records written by an older version are never appended to.
+static std::string get_disk_path(const std::string &disk_path, uint32_t version, const char *ext)
+{
+	return disk_path + "/conversion_cache.v" + std::to_string(version) + "." + ext;
+}
+
+static std::string get_pack_path(const std::string &disk_path)
+{
+	return get_disk_path(disk_path, DiskVersion, "dxcp");
+}
+
+static std::string get_index_path(const std::string &disk_path)
+{
+	return get_disk_path(disk_path, DiskVersion, "dxci");
+}
+
+static std::string get_lock_path(const std::string &disk_path)
+{
+	return get_disk_path(disk_path, DiskVersion, "lock");
+}
+
+static void remove_stale_disk_files(const std::string &disk_path)
+{
+	// Versions before 6 did not version their file names.
+	remove((disk_path + "/conversion_cache.dxcp").c_str());
+	remove((disk_path + "/conversion_cache.dxci").c_str());
+}
+
+// Exclusive lock on a file, shared between processes. The OS drops it when the handle is closed,
+// so a process which dies while holding it does not block others.
+class DiskLock
+{
+public:
+	explicit DiskLock(const std::string &path)
+	{
+#ifdef _WIN32
+		handle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+		                     FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_ALWAYS,
+		                     FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (handle == INVALID_HANDLE_VALUE)
+			return;
+
+		OVERLAPPED overlapped = {};
+		if (!LockFileEx(handle, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &overlapped))
+		{
+			CloseHandle(handle);
+			handle = INVALID_HANDLE_VALUE;
+		}
+#else
+		fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+		if (fd < 0)
+			return;
+
+		int ret;
+		while ((ret = flock(fd, LOCK_EX)) < 0 && errno == EINTR)
+			;
+
+		if (ret < 0)
+		{
+			close(fd);
+			fd = -1;
+		}
+#endif
+	}
+
+	~DiskLock()
+	{
+#ifdef _WIN32
+		if (handle != INVALID_HANDLE_VALUE)
+			CloseHandle(handle);
+#else
+		if (fd >= 0)
+			close(fd);
+#endif
+	}
+
+	DiskLock(const DiskLock &) = delete;
+	void operator=(const DiskLock &) = delete;
+
+	bool is_locked() const
+	{
+#ifdef _WIN32
+		return handle != INVALID_HANDLE_VALUE;
+#else
+		return fd >= 0;
+#endif
+	}
+
+private:
+#ifdef _WIN32
+	HANDLE handle = INVALID_HANDLE_VALUE;
+#else
+	int fd = -1;
+#endif
+};
+
+static std::string get_temporary_path(const std::string &path)
+{
+	static std::atomic<uint32_t> counter;
+#ifdef _WIN32
+	unsigned pid = unsigned(_getpid());
+#else
+	unsigned pid = unsigned(getpid());
+#endif
+	return path + ".tmp." + std::to_string(pid) + "." + std::to_string(counter.fetch_add(1, std::memory_order_relaxed));
+}
+
+static bool replace_file(const std::string &from, const std::string &to)
+{
+#ifdef _WIN32
+	// rename() fails on Windows if the destination exists.
+	return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+static bool seek_file(FILE *file, uint64_t offset, int whence)
+{
+#ifdef _WIN32
+	return _fseeki64(file, int64_t(offset), whence) == 0;
+#else
+	return fseeko(file, off_t(offset), whence) == 0;
+#endif
+}
+
+static uint64_t tell_file(FILE *file)
+{
+#ifdef _WIN32
+	return uint64_t(_ftelli64(file));
+#else
+	return uint64_t(ftello(file));
+#endif
+}
+
+static void encode_varint(std::vector<uint8_t> &out, uint32_t value)
+{
+	while (value >= 0x80)
+	{
+		out.push_back(uint8_t(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back(uint8_t(value));
+}
+
+static bool decode_varint(const uint8_t *&data, const uint8_t *end, uint32_t &value)
+{
+	value = 0;
+	for (unsigned shift = 0; shift < 35 && data != end; shift += 7)
+	{
+		uint8_t byte = *data++;
+		value |= uint32_t(byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0)
+			return true;
+	}
+	return false;
+}
+
+// Nearly every SPIR-V word is an id, enum or small literal, so varint coding roughly halves a module.
+// Instruction headers are split into word count and opcode, which makes them one or two bytes as well.
+// A word count of 0 escapes to plain words, in case the module does not parse.
+static void encode_spirv(std::vector<uint8_t> &out, const std::vector<uint32_t> &spirv)
+{
+	size_t count = spirv.size();
+	size_t i = 0;
+
+	for (; i < count && i < 5; i++)
+		encode_varint(out, spirv[i]);
+
+	while (i < count)
+	{
+		uint32_t word_count = spirv[i] >> 16;
+		if (word_count == 0 || word_count > count - i)
+		{
+			encode_varint(out, 0);
+			for (; i < count; i++)
+				encode_varint(out, spirv[i]);
+			break;
+		}
+
+		encode_varint(out, word_count);
+		encode_varint(out, spirv[i] & 0xffff);
+		for (uint32_t j = 1; j < word_count; j++)
+			encode_varint(out, spirv[i + j]);
+		i += word_count;
+	}
+}
+
+static bool decode_spirv(const uint8_t *data, const uint8_t *end, size_t count, std::vector<uint32_t> &spirv)
+{
+	spirv.clear();
+	spirv.reserve(count);
+	uint32_t word;
+
+	while (spirv.size() < count && spirv.size() < 5)
+	{
+		if (!decode_varint(data, end, word))
+			return false;
+		spirv.push_back(word);
+	}
+
+	while (spirv.size() < count)
+	{
+		uint32_t word_count, opcode;
+		if (!decode_varint(data, end, word_count))
+			return false;
+
+		if (word_count == 0)
+		{
+			while (spirv.size() < count)
+			{
+				if (!decode_varint(data, end, word))
+					return false;
+				spirv.push_back(word);
+			}
+			break;
+		}
+
+		if (word_count > count - spirv.size() || !decode_varint(data, end, opcode))
+			return false;
+
+		spirv.push_back((word_count << 16) | opcode);
+		for (uint32_t j = 1; j < word_count; j++)
+		{
+			if (!decode_varint(data, end, word))
+				return false;
+			spirv.push_back(word);
+		}
+	}
+
+	return data == end;
+}
+
+static void append_words(std::vector<uint8_t> &out, const uint32_t *words, size_t count)
+{
+	size_t offset = out.size();
+	out.resize(offset + count * sizeof(uint32_t));
+	if (count)
+		memcpy(out.data() + offset, words, count * sizeof(uint32_t));
+}
+
+static bool validate_index(const MappedFile &index)
+{
+	if (index.get_size() < IndexHeaderWords * sizeof(uint32_t))
+		return false;
+
+	uint32_t header[IndexHeaderWords];
+	memcpy(header, index.get_data(), sizeof(header));
+	uint32_t bucket_count = header[2];
+	return header[0] == IndexMagic && header[1] == DiskVersion && bucket_count != 0 &&
+	       (bucket_count & (bucket_count - 1)) == 0 &&
+	       index.get_size() == (IndexHeaderWords + size_t(bucket_count) * IndexBucketWords) * sizeof(uint32_t);
+}
+
+static void read_index_bucket(const MappedFile &index, uint32_t bucket, uint64_t &key, uint64_t &stored_offset)
+{
+	uint32_t words[IndexBucketWords];
+	memcpy(words, index.get_data() + (IndexHeaderWords + size_t(bucket) * IndexBucketWords) * sizeof(uint32_t),
+	       sizeof(words));
+	key = words[0] | (uint64_t(words[1]) << 32);
+	stored_offset = words[2] | (uint64_t(words[3]) << 32);
+}
+
+static void read_index_offsets(const MappedFile &index, std::unordered_map<uint64_t, uint64_t> &offsets)
+{
+	uint32_t bucket_count;
+	memcpy(&bucket_count, index.get_data() + 2 * sizeof(uint32_t), sizeof(bucket_count));
+	for (uint32_t i = 0; i < bucket_count; i++)
+	{
+		uint64_t key, stored_offset;
+		read_index_bucket(index, i, key, stored_offset);
+		if (stored_offset != 0)
+			offsets[key] = stored_offset - 1;
+	}
+}
+
+size_t ConversionCacheEntry::get_memory_size() const
+{
+	return sizeof(*this) + spirv.size() * sizeof(uint32_t) + remap_transcript.size() * sizeof(uint32_t) +
+	       cbv_promotion_candidates.size() * sizeof(uint32_t) + resource_usage.size() * sizeof(uint32_t) +
+	       compiled_entry_point.size();
+}
+
+ConversionCache::ConversionCache(size_t max_memory_size_, std::string disk_path_)
+    : max_memory_size(max_memory_size_), disk_path(std::move(disk_path_))
+{
+	if (disk_path.empty())
+		return;
+
+	remove_stale_disk_files(disk_path);
+
+	// Both files are missing until the first cache using the directory has been destroyed.
+	if (index_view.open(get_index_path(disk_path).c_str()) && !validate_index(index_view))
+		index_view.close();
+	pack_view.open(get_pack_path(disk_path).c_str());
+
+	pack_file = fopen(get_pack_path(disk_path).c_str(), "ab");
+	if (!pack_file)
+		LOGE("Failed to open conversion cache pack in %s.\n", disk_path.c_str());
+	else
+	{
+		// Other processes append to the same pack. Unbuffered, each record goes out in one append,
+		// so records can't interleave and the offset of a record is known right after writing it.
+		setvbuf(pack_file, nullptr, _IONBF, 0);
+	}
+}
+
+ConversionCache::~ConversionCache()
+{
+	if (pack_file)
+	{
+		fclose(pack_file);
+		write_disk_index();
+	}
+}
+
+std::shared_ptr<const ConversionCacheEntry> ConversionCache::find(uint64_t key)
+{
+	{
+		std::lock_guard<std::mutex> holder{ lock };
+		auto itr = entries.find(key);
+		if (itr != entries.end())
+		{
+			lru.splice(lru.begin(), lru, itr->second.lru);
+			return itr->second.entry;
+		}
+	}
+
+	if (disk_path.empty())
+		return {};
+
+	auto entry = read_disk_entry(key);
+	if (entry)
+	{
+		std::lock_guard<std::mutex> holder{ lock };
+		insert_memory(key, entry);
+	}
+	return entry;
+}
+
+void ConversionCache::insert(uint64_t key, std::shared_ptr<const ConversionCacheEntry> entry)
+{
+	// The pack is append only, so only write a record if the key is new, or if the stored record
+	// was made with different remapping results, in which case the new record supersedes it.
+	if (!disk_path.empty())
+	{
+		auto stored = read_disk_entry(key);
+		if (!stored || stored->remap_transcript != entry->remap_transcript)
+			write_disk_entry(key, *entry);
+	}
+
+	std::lock_guard<std::mutex> holder{ lock };
+	insert_memory(key, std::move(entry));
+}
+
+void ConversionCache::insert_memory(uint64_t key, std::shared_ptr<const ConversionCacheEntry> entry)
+{
+	size_t size = entry->get_memory_size();
+	if (size > max_memory_size)
+		return;
+
+	auto itr = entries.find(key);
+	if (itr != entries.end())
+	{
+		memory_size -= itr->second.entry->get_memory_size();
+		lru.erase(itr->second.lru);
+		entries.erase(itr);
+	}
+
+	while (memory_size + size > max_memory_size && !lru.empty())
+	{
+		auto evict = entries.find(lru.back());
+		memory_size -= evict->second.entry->get_memory_size();
+		entries.erase(evict);
+		lru.pop_back();
+	}
+
+	lru.push_front(key);
+	entries[key] = { std::move(entry), lru.begin() };
+	memory_size += size;
+}
+
+bool ConversionCache::find_disk_offset(uint64_t key, uint64_t *offset)
+{
+	{
+		std::lock_guard<std::mutex> holder{ disk_lock };
+		auto itr = written_offsets.find(key);
+		if (itr != written_offsets.end())
+		{
+			*offset = itr->second;
+			return true;
+		}
+	}
+
+	if (!index_view.get_data())
+		return false;
+
+	uint32_t bucket_count;
+	memcpy(&bucket_count, index_view.get_data() + 2 * sizeof(uint32_t), sizeof(bucket_count));
+	uint32_t mask = bucket_count - 1;
+
+	// Keys are hashes already, so the low bits are a fine bucket index.
+	for (uint32_t i = 0; i < bucket_count; i++)
+	{
+		uint64_t bucket_key, stored_offset;
+		read_index_bucket(index_view, (uint32_t(key) + i) & mask, bucket_key, stored_offset);
+		if (stored_offset == 0)
+			return false;
+
+		if (bucket_key == key)
+		{
+			*offset = stored_offset - 1;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+std::shared_ptr<const ConversionCacheEntry> ConversionCache::read_disk_entry(uint64_t key)
+{
+	uint64_t offset;
+	if (!find_disk_offset(key, &offset))
+		return {};
+
+	const size_t record_header_size = RecordHeaderWords * sizeof(uint32_t);
+	uint32_t record_header[RecordHeaderWords];
+	const uint8_t *payload = nullptr;
+	std::vector<uint8_t> buffer;
+
+	if (offset <= pack_view.get_size() && pack_view.get_size() - offset >= record_header_size)
+	{
+		memcpy(record_header, pack_view.get_data() + offset, record_header_size);
+		if (pack_view.get_size() - offset - record_header_size < record_header[4])
+			return {};
+		payload = pack_view.get_data() + offset + record_header_size;
+	}
+	else
+	{
+		// Written after the pack was mapped.
+		{
+			std::lock_guard<std::mutex> holder{ disk_lock };
+			if (pack_file)
+				fflush(pack_file);
+		}
+
+		FILE *file = fopen(get_pack_path(disk_path).c_str(), "rb");
+		if (!file)
+			return {};
+
+		bool ok = seek_file(file, offset, SEEK_SET) &&
+		          fread(record_header, sizeof(uint32_t), RecordHeaderWords, file) == RecordHeaderWords;
+		if (ok)
+		{
+			buffer.resize(record_header[4]);
+			ok = fread(buffer.data(), 1, buffer.size(), file) == buffer.size();
+		}
+		fclose(file);
+
+		if (!ok)
+			return {};
+		payload = buffer.data();
+	}
+
+	// Other processes may have appended to the pack concurrently, so never trust an offset blindly.
+	size_t payload_size = record_header[4];
+	if (record_header[0] != PackMagic || record_header[1] != DiskVersion ||
+	    record_header[2] != uint32_t(key) || record_header[3] != uint32_t(key >> 32) ||
+	    payload_size < EntryHeaderWords * sizeof(uint32_t) ||
+	    record_header[5] != uint32_t(hash_fast(payload, payload_size)))
+	{
+		return {};
+	}
+
+	uint32_t words[EntryHeaderWords];
+	memcpy(words, payload, sizeof(words));
+
+	size_t entry_point_words = (size_t(words[9]) + 3) / 4;
+	size_t transcript_words = words[10];
+	size_t spirv_words = words[11];
+	size_t candidate_words = words[8];
+	size_t usage_words = words[12];
+	size_t spirv_bytes = words[13];
+	size_t raw_words = EntryHeaderWords + entry_point_words + transcript_words + candidate_words + usage_words;
+	if (raw_words * sizeof(uint32_t) + spirv_bytes != payload_size)
+		return {};
+
+	auto entry = std::make_shared<ConversionCacheEntry>();
+	entry->uses_subgroup_size = words[0] != 0;
+	memcpy(entry->workgroup_size, &words[1], sizeof(entry->workgroup_size));
+	entry->patch_vertex_count = words[4];
+	entry->wave_size = words[5];
+	entry->heuristic_wave_size = words[6];
+	entry->shader_feature_mask = words[7];
+
+	auto read_words = [&](std::vector<uint32_t> &out, size_t count) {
+		out.resize(count);
+		if (count)
+			memcpy(out.data(), payload, count * sizeof(uint32_t));
+		payload += count * sizeof(uint32_t);
+	};
+
+	payload += EntryHeaderWords * sizeof(uint32_t);
+	entry->compiled_entry_point.assign(reinterpret_cast<const char *>(payload), words[9]);
+	payload += entry_point_words * sizeof(uint32_t);
+	read_words(entry->remap_transcript, transcript_words);
+	read_words(entry->cbv_promotion_candidates, candidate_words);
+	read_words(entry->resource_usage, usage_words);
+
+	if (!decode_spirv(payload, payload + spirv_bytes, spirv_words, entry->spirv))
+		return {};
+
+	return entry;
+}
+
+void ConversionCache::write_disk_entry(uint64_t key, const ConversionCacheEntry &entry)
+{
+	std::vector<uint8_t> spirv;
+	encode_spirv(spirv, entry.spirv);
+
+	uint32_t words[EntryHeaderWords];
+	words[0] = uint32_t(entry.uses_subgroup_size);
+	memcpy(&words[1], entry.workgroup_size, sizeof(entry.workgroup_size));
+	words[4] = entry.patch_vertex_count;
+	words[5] = entry.wave_size;
+	words[6] = entry.heuristic_wave_size;
+	words[7] = entry.shader_feature_mask;
+	words[8] = uint32_t(entry.cbv_promotion_candidates.size());
+	words[9] = uint32_t(entry.compiled_entry_point.size());
+	words[10] = uint32_t(entry.remap_transcript.size());
+	words[11] = uint32_t(entry.spirv.size());
+	words[12] = uint32_t(entry.resource_usage.size());
+	words[13] = uint32_t(spirv.size());
+
+	// The record header goes first, it's filled in once the payload is complete.
+	std::vector<uint8_t> record(RecordHeaderWords * sizeof(uint32_t));
+	append_words(record, words, EntryHeaderWords);
+	size_t entry_point_offset = record.size();
+	record.resize(entry_point_offset + (entry.compiled_entry_point.size() + 3) / 4 * sizeof(uint32_t));
+	if (!entry.compiled_entry_point.empty())
+		memcpy(record.data() + entry_point_offset, entry.compiled_entry_point.data(), entry.compiled_entry_point.size());
+	append_words(record, entry.remap_transcript.data(), entry.remap_transcript.size());
+	append_words(record, entry.cbv_promotion_candidates.data(), entry.cbv_promotion_candidates.size());
+	append_words(record, entry.resource_usage.data(), entry.resource_usage.size());
+	record.insert(record.end(), spirv.begin(), spirv.end());
+
+	const size_t record_header_size = RecordHeaderWords * sizeof(uint32_t);
+	size_t payload_size = record.size() - record_header_size;
+	const uint32_t record_header[RecordHeaderWords] = {
+		PackMagic, DiskVersion, uint32_t(key), uint32_t(key >> 32),
+		uint32_t(payload_size), uint32_t(hash_fast(record.data() + record_header_size, payload_size)),
+	};
+	memcpy(record.data(), record_header, record_header_size);
+
+	std::lock_guard<std::mutex> holder{ disk_lock };
+	if (!pack_file)
+		return;
+
+	// In append mode the write lands at the end of the file, wherever other processes left it.
+	bool ok = fwrite(record.data(), 1, record.size(), pack_file) == record.size();
+	uint64_t end = ok ? tell_file(pack_file) : uint64_t(-1);
+	ok = ok && end != uint64_t(-1) && end >= record.size();
+
+	if (ok)
+		written_offsets[key] = end - record.size();
+	else
+		LOGE("Failed to append conversion cache entry %016llx.\n", static_cast<unsigned long long>(key));
+}
+
+void ConversionCache::write_disk_index()
+{
+	if (written_offsets.empty())
+		return;
+
+	index_view.close();
+	pack_view.close();
+
+	auto path = get_index_path(disk_path);
+
+	// Other processes may have rewritten the index since this cache mapped it. Re-read and merge under
+	// the lock, or the last writer would drop their entries.
+	DiskLock disk_lock_file(get_lock_path(disk_path));
+	if (!disk_lock_file.is_locked())
+		LOGW("Failed to lock conversion cache in %s, entries of concurrent writers may be lost.\n", disk_path.c_str());
+
+	std::unordered_map<uint64_t, uint64_t> offsets;
+	{
+		MappedFile current_index;
+		if (current_index.open(path.c_str()) && validate_index(current_index))
+			read_index_offsets(current_index, offsets);
+	}
+
+	for (auto &written : written_offsets)
+		offsets[written.first] = written.second;
+
+	// Keep the load factor at or below 1/2 so probe sequences stay short.
+	uint32_t bucket_count = 64;
+	while (bucket_count < offsets.size() * 2)
+		bucket_count *= 2;
+	uint32_t mask = bucket_count - 1;
+
+	std::vector<uint32_t> words(IndexHeaderWords + size_t(bucket_count) * IndexBucketWords);
+	words[0] = IndexMagic;
+	words[1] = DiskVersion;
+	words[2] = bucket_count;
+	words[3] = uint32_t(offsets.size());
+
+	for (auto &entry : offsets)
+	{
+		uint32_t bucket = uint32_t(entry.first) & mask;
+		while (words[IndexHeaderWords + size_t(bucket) * IndexBucketWords + 2] != 0 ||
+		       words[IndexHeaderWords + size_t(bucket) * IndexBucketWords + 3] != 0)
+		{
+			bucket = (bucket + 1) & mask;
+		}
+
+		uint32_t *bucket_words = &words[IndexHeaderWords + size_t(bucket) * IndexBucketWords];
+		uint64_t stored_offset = entry.second + 1;
+		bucket_words[0] = uint32_t(entry.first);
+		bucket_words[1] = uint32_t(entry.first >> 32);
+		bucket_words[2] = uint32_t(stored_offset);
+		bucket_words[3] = uint32_t(stored_offset >> 32);
+	}
+
+	// Write to a unique temporary and rename it into place so that concurrent readers never observe
+	// a partially written index.
+	auto tmp_path = get_temporary_path(path);
+
+	FILE *file = fopen(tmp_path.c_str(), "wb");
+	if (!file)
+	{
+		LOGE("Failed to open conversion cache index %s for writing.\n", tmp_path.c_str());
+		return;
+	}
+
+	bool ok = fwrite(words.data(), sizeof(uint32_t), words.size(), file) == words.size();
+	ok = fclose(file) == 0 && ok;
+
+	if (!ok || !replace_file(tmp_path, path))
+	{
+		LOGE("Failed to write conversion cache index %s.\n", path.c_str());
+		remove(tmp_path.c_str());
+	}
+}
+
+void ConversionCache::hash_option(Hasher &h, const OptionBase &cap)
+{
+	h.u32(uint32_t(cap.type));
+
+	switch (cap.type)
+	{
+	case Option::ShaderDemoteToHelper:
+		h.u32(static_cast<const OptionShaderDemoteToHelper &>(cap).supported);
+		break;
+
+	case Option::DualSourceBlending:
+		h.u32(static_cast<const OptionDualSourceBlending &>(cap).enabled);
+		break;
+
+	case Option::OutputSwizzle:
+	{
+		auto &swiz = static_cast<const OptionOutputSwizzle &>(cap);
+		h.u32(swiz.swizzle_count);
+		for (unsigned i = 0; i < swiz.swizzle_count; i++)
+			h.u32(swiz.swizzles[i]);
+		break;
+	}
+
+	case Option::RasterizerSampleCount:
+	{
+		auto &count = static_cast<const OptionRasterizerSampleCount &>(cap);
+		h.u32(count.count);
+		h.u32(count.spec_constant);
+		break;
+	}
+
+	case Option::RootConstantInlineUniformBlock:
+	{
+		auto &ubo = static_cast<const OptionRootConstantInlineUniformBlock &>(cap);
+		h.u32(ubo.desc_set);
+		h.u32(ubo.binding);
+		h.u32(ubo.enable);
+		break;
+	}
+
+	case Option::BindlessCBVSSBOEmulation:
+		h.u32(static_cast<const OptionBindlessCBVSSBOEmulation &>(cap).enable);
+		break;
+
+	case Option::PhysicalStorageBuffer:
+		h.u32(static_cast<const OptionPhysicalStorageBuffer &>(cap).enable);
+		break;
+
+	case Option::SBTDescriptorSizeLog2:
+	{
+		auto &sbt = static_cast<const OptionSBTDescriptorSizeLog2 &>(cap);
+		h.u32(sbt.size_log2_srv_uav_cbv);
+		h.u32(sbt.size_log2_sampler);
+		break;
+	}
+
+	case Option::SSBOAlignment:
+		h.u32(static_cast<const OptionSSBOAlignment &>(cap).alignment);
+		break;
+
+	case Option::TypedUAVReadWithoutFormat:
+		h.u32(static_cast<const OptionTypedUAVReadWithoutFormat &>(cap).supported);
+		break;
+
+	case Option::ShaderSourceFile:
+		h.string(static_cast<const OptionShaderSourceFile &>(cap).name.c_str());
+		break;
+
+	case Option::BindlessTypedBufferOffsets:
+		h.u32(static_cast<const OptionBindlessTypedBufferOffsets &>(cap).enable);
+		break;
+
+	case Option::BindlessOffsetBufferLayout:
+	{
+		auto &off = static_cast<const OptionBindlessOffsetBufferLayout &>(cap);
+		h.u32(off.untyped_offset);
+		h.u32(off.typed_offset);
+		h.u32(off.stride);
+		break;
+	}
+
+	case Option::StorageInputOutput16:
+		h.u32(static_cast<const OptionStorageInputOutput16 &>(cap).supported);
+		break;
+
+	case Option::DescriptorQA:
+	{
+		auto &qa = static_cast<const OptionDescriptorQA &>(cap);
+		h.u32(qa.enabled);
+		h.u32(qa.version);
+		h.u32(qa.global_desc_set);
+		h.u32(qa.global_binding);
+		h.u32(qa.heap_desc_set);
+		h.u32(qa.heap_binding);
+		h.u64(qa.shader_hash);
+		break;
+	}
+
+	case Option::MinPrecisionNative16Bit:
+		h.u32(static_cast<const OptionMinPrecisionNative16Bit &>(cap).enabled);
+		break;
+
+	case Option::ShaderI8Dot:
+		h.u32(static_cast<const OptionShaderI8Dot &>(cap).supported);
+		break;
+
+	case Option::ShaderRayTracingPrimitiveCulling:
+		h.u32(static_cast<const OptionShaderRayTracingPrimitiveCulling &>(cap).supported);
+		break;
+
+	case Option::InvariantPosition:
+		h.u32(static_cast<const OptionInvariantPosition &>(cap).enabled);
+		break;
+
+	case Option::ScalarBlockLayout:
+	{
+		auto &layout = static_cast<const OptionScalarBlockLayout &>(cap);
+		h.u32(layout.supported);
+		h.u32(layout.supports_per_component_robustness);
+		break;
+	}
+
+	case Option::BarycentricKHR:
+		h.u32(static_cast<const OptionBarycentricKHR &>(cap).supported);
+		break;
+
+	case Option::RobustPhysicalCBVLoad:
+		h.u32(static_cast<const OptionRobustPhysicalCBVLoad &>(cap).enabled);
+		break;
+
+	case Option::ArithmeticRelaxedPrecision:
+		h.u32(static_cast<const OptionArithmeticRelaxedPrecision &>(cap).enabled);
+		break;
+
+	case Option::PhysicalAddressDescriptorIndexing:
+	{
+		auto &indexing = static_cast<const OptionPhysicalAddressDescriptorIndexing &>(cap);
+		h.u32(indexing.element_stride);
+		h.u32(indexing.element_offset);
+		break;
+	}
+
+	case Option::ForceSubgroupSize:
+	{
+		auto &force = static_cast<const OptionForceSubgroupSize &>(cap);
+		h.u32(force.forced_value);
+		h.u32(force.wave_size_enable);
+		break;
+	}
+
+	case Option::DenormPreserveSupport:
+	{
+		auto &denorm = static_cast<const OptionDenormPreserveSupport &>(cap);
+		h.u32(denorm.support_float16_denorm_preserve);
+		h.u32(denorm.support_float64_denorm_preserve);
+		break;
+	}
+
+	case Option::StrictHelperLaneWaveOps:
+		h.u32(static_cast<const OptionStrictHelperLaneWaveOps &>(cap).enable);
+		break;
+
+	case Option::SubgroupPartitionedNV:
+		h.u32(static_cast<const OptionSubgroupPartitionedNV &>(cap).supported);
+		break;
+
+	case Option::DeadCodeEliminate:
+		h.u32(static_cast<const OptionDeadCodeEliminate &>(cap).enabled);
+		break;
+
+	case Option::PreciseControl:
+	{
+		auto &precise = static_cast<const OptionPreciseControl &>(cap);
+		h.u32(precise.force_precise);
+		h.u32(precise.propagate_precise);
+		break;
+	}
+
+	case Option::SampleGradOptimizationControl:
+	{
+		auto &grad = static_cast<const OptionSampleGradOptimizationControl &>(cap);
+		h.u32(grad.enabled);
+		h.u32(grad.assume_uniform_scale);
+		break;
+	}
+
+	case Option::OpacityMicromap:
+		h.u32(static_cast<const OptionOpacityMicromap &>(cap).enabled);
+		break;
+
+	case Option::BranchControl:
+	{
+		auto &c = static_cast<const OptionBranchControl &>(cap);
+		h.u32(c.use_shader_metadata);
+		h.u32(c.force_unroll);
+		h.u32(c.force_loop);
+		h.u32(c.force_flatten);
+		h.u32(c.force_branch);
+		break;
+	}
+
+	case Option::SubgroupProperties:
+	{
+		auto &c = static_cast<const OptionSubgroupProperties &>(cap);
+		h.u32(c.minimum_size);
+		h.u32(c.maximum_size);
+		break;
+	}
+
+	case Option::DescriptorHeapRobustness:
+		h.u32(static_cast<const OptionDescriptorHeapRobustness &>(cap).enabled);
+		break;
+
+	case Option::SpirvOptimization:
+		h.u32(static_cast<const OptionSpirvOptimization &>(cap).enabled);
+		break;
+
+	case Option::PeepholeOptimization:
+		h.u32(static_cast<const OptionPeepholeOptimization &>(cap).enabled);
+		break;
+
+	case Option::BufferLoadCoalescing:
+		h.u32(static_cast<const OptionBufferLoadCoalescing &>(cap).enabled);
+		break;
+
+	case Option::UniformityAnalysis:
+		h.u32(static_cast<const OptionUniformityAnalysis &>(cap).enabled);
+		break;
+
+	case Option::RayPayloadLiveness:
+		h.u32(static_cast<const OptionRayPayloadLiveness &>(cap).enabled);
+		break;
+
+	case Option::LoopInvariantCodeMotion:
+		h.u32(static_cast<const OptionLoopInvariantCodeMotion &>(cap).enabled);
+		break;
+
+	case Option::SparseFeedbackForwarding:
+		h.u32(static_cast<const OptionSparseFeedbackForwarding &>(cap).enabled);
+		break;
+
+	case Option::StructuredCFGFastPath:
+		h.u32(static_cast<const OptionStructuredCFGFastPath &>(cap).enabled);
+		break;
+
+	case Option::KnownRootConstants:
+	{
+		auto &known = static_cast<const OptionKnownRootConstants &>(cap);
+		h.u32(known.count);
+		for (unsigned i = 0; i < known.count; i++)
+		{
+			h.u32(known.word_indices[i]);
+			h.u32(known.values[i]);
+		}
+		break;
+	}
+
+	case Option::SBTDescriptorSizeSpecConstants:
+	{
+		auto &spec = static_cast<const OptionSBTDescriptorSizeSpecConstants &>(cap);
+		h.u32(spec.enabled);
+		h.u32(spec.spec_id_srv_uav_cbv);
+		h.u32(spec.spec_id_sampler);
+		break;
+	}
+
+	case Option::ConsumerStageInputs:
+	{
+		auto &inputs = static_cast<const OptionConsumerStageInputs &>(cap);
+		h.u32(inputs.enabled);
+		h.u32(inputs.count);
+		for (unsigned i = 0; i < inputs.count; i++)
+		{
+			h.string(inputs.semantic_names[i]);
+			h.u32(inputs.semantic_indices[i]);
+		}
+		break;
+	}
+
+	case Option::HullBarrierElision:
+		h.u32(static_cast<const OptionHullBarrierElision &>(cap).enabled);
+		break;
+
+	case Option::GeometryOutputVertexAnalysis:
+		h.u32(static_cast<const OptionGeometryOutputVertexAnalysis &>(cap).enabled);
+		break;
+
+	case Option::MinPrecisionNarrowing:
+		h.u32(static_cast<const OptionMinPrecisionNarrowing &>(cap).enabled);
+		break;
+
+	case Option::DescriptorQASampling:
+	{
+		auto &sampling = static_cast<const OptionDescriptorQASampling &>(cap);
+		h.u32(sampling.deduplicate_per_block);
+		h.u32(sampling.kill_switch);
+		h.u32(sampling.kill_switch_spec_id);
+		break;
+	}
+
+	case Option::WaveAggregatedAtomics:
+		h.u32(static_cast<const OptionWaveAggregatedAtomics &>(cap).enabled);
+		break;
+
+	case Option::UAVCoherenceAnalysis:
+		h.u32(static_cast<const OptionUAVCoherenceAnalysis &>(cap).enabled);
+		break;
+
+	case Option::PhysicalAddressAlignment:
+		h.u32(static_cast<const OptionPhysicalAddressAlignment &>(cap).alignment);
+		break;
+
+	case Option::AllocaScalarization:
+		h.u32(static_cast<const OptionAllocaScalarization &>(cap).enabled);
+		break;
+
+	case Option::SamplerFeedbackLODMerging:
+		h.u32(static_cast<const OptionSamplerFeedbackLODMerging &>(cap).enabled);
+		break;
+
+	case Option::SPIRVCanonicalization:
+		h.u32(static_cast<const OptionSPIRVCanonicalization &>(cap).enabled);
+		break;
+
+	case Option::MeshOutputStoreCoalescing:
+		h.u32(static_cast<const OptionMeshOutputStoreCoalescing &>(cap).enabled);
+		break;
+
+	case Option::StructurizerComplexityBudget:
+		h.u32(static_cast<const OptionStructurizerComplexityBudget &>(cap).node_growth_factor);
+		break;
+
+	case Option::ConstantFolding:
+		h.u32(static_cast<const OptionConstantFolding &>(cap).enabled);
+		break;
+
+	default:
+		break;
+	}
+}
+} // namespace dxil_spv
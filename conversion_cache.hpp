@@ -0,0 +1,118 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include "dxil_converter.hpp"
+#include "hash.hpp"
+#include "mapped_file.hpp"
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace dxil_spv
+{
+// Everything a cache hit needs to reproduce the result of a conversion.
+// Entries are shared between threads, so the default allocator is used throughout.
+struct ConversionCacheEntry
+{
+	std::vector<uint32_t> spirv;
+	// Every remapping query made during conversion, see remap_transcript.hpp.
+	// A cached entry is only valid if the current remapper answers every query the same way.
+	std::vector<uint32_t> remap_transcript;
+	std::string compiled_entry_point;
+	uint32_t workgroup_size[3] = {};
+	uint32_t patch_vertex_count = 0;
+	uint32_t wave_size = 0;
+	uint32_t heuristic_wave_size = 0;
+	uint32_t shader_feature_mask = 0;
+	bool uses_subgroup_size = false;
+	// (register_space, register_index, num_words) for every CBVPromotionCandidate.
+	std::vector<uint32_t> cbv_promotion_candidates;
+	// (resource_class, register_space, register_index, range_size, flags, cbv_used_bytes) for every ResourceUsage.
+	std::vector<uint32_t> resource_usage;
+
+	size_t get_memory_size() const;
+};
+
+// Content-addressed cache of finished conversions.
+// The key is computed by the caller from everything which affects a conversion
+// except for the remapping results, which are validated against the transcript instead.
+// Entries live in an in-memory LRU bounded by max_memory_size, and are optionally persisted in a directory.
+// On disk, entries are appended to a pack file, and an open addressing hash table of key -> pack offset
+// is memory mapped, so a lookup usually touches one index page and the record itself.
+// The index is rewritten when the cache is destroyed, merging with entries other processes have written since.
+// All methods are thread-safe.
+class ConversionCache
+{
+public:
+	// If max_memory_size is 0, entries are not kept in memory. If disk_path is empty, entries are not persisted.
+	ConversionCache(size_t max_memory_size, std::string disk_path);
+	~ConversionCache();
+
+	ConversionCache(const ConversionCache &) = delete;
+	void operator=(const ConversionCache &) = delete;
+
+	std::shared_ptr<const ConversionCacheEntry> find(uint64_t key);
+	void insert(uint64_t key, std::shared_ptr<const ConversionCacheEntry> entry);
+
+	// Hashes the state of an option as it affects conversion.
+	static void hash_option(Hasher &h, const OptionBase &option);
+
+private:
+	struct MemoryEntry
+	{
+		std::shared_ptr<const ConversionCacheEntry> entry;
+		std::list<uint64_t>::iterator lru;
+	};
+
+	std::mutex lock;
+	std::unordered_map<uint64_t, MemoryEntry> entries;
+	// Most recently used is at the front.
+	std::list<uint64_t> lru;
+	size_t memory_size = 0;
+	size_t max_memory_size;
+	std::string disk_path;
+
+	// Index and pack as they were when the cache was created.
+	MappedFile index_view;
+	MappedFile pack_view;
+	// Appends to the pack. Offsets of records written since then are kept here until the index is rewritten.
+	std::mutex disk_lock;
+	FILE *pack_file = nullptr;
+	std::unordered_map<uint64_t, uint64_t> written_offsets;
+
+	void insert_memory(uint64_t key, std::shared_ptr<const ConversionCacheEntry> entry);
+	bool find_disk_offset(uint64_t key, uint64_t *offset);
+	std::shared_ptr<const ConversionCacheEntry> read_disk_entry(uint64_t key);
+	void write_disk_entry(uint64_t key, const ConversionCacheEntry &entry);
+	void write_disk_index();
+};
+} // namespace dxil_spv
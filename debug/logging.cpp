@@ -27,11 +27,21 @@
 namespace dxil_spv
 {
 static thread_local LoggingCallback log_callback;
+static thread_local LoggingFormatCallback log_format_callback;
 static thread_local void *log_userdata;
+static thread_local LogLevel log_level = LogLevel::Debug;
 
 void set_thread_log_callback(LoggingCallback callback, void *userdata)
 {
 	log_callback = callback;
+	log_format_callback = nullptr;
+	log_userdata = userdata;
+}
+
+void set_thread_log_format_callback(LoggingFormatCallback callback, void *userdata)
+{
+	log_callback = nullptr;
+	log_format_callback = callback;
 	log_userdata = userdata;
 }
 
@@ -44,4 +54,38 @@ void *get_thread_log_callback_userdata()
 {
 	return log_userdata;
 }
+
+bool has_thread_log_callback()
+{
+	return log_callback || log_format_callback;
+}
+
+void set_thread_log_level(LogLevel level)
+{
+	log_level = level;
+}
+
+LogLevel get_thread_log_level()
+{
+	return log_level;
+}
+
+void thread_log(LogLevel level, const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+
+	if (log_format_callback)
+	{
+		log_format_callback(log_userdata, level, fmt, args);
+	}
+	else if (log_callback)
+	{
+		char buffer[4096];
+		vsnprintf(buffer, sizeof(buffer), fmt, args);
+		log_callback(log_userdata, level, buffer);
+	}
+
+	va_end(args);
+}
 }
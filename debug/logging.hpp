@@ -24,6 +24,7 @@
 
 #pragma once
 
+#include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 
@@ -93,52 +94,42 @@ enum class LogLevel : uint32_t
 {
 	Debug = 0,
 	Warn = 1,
-	Error = 2
+	Error = 2,
+	// Only meaningful as a threshold. Drops everything.
+	Silent = 3
 };
 using LoggingCallback = void (*)(void *, LogLevel, const char *);
+// Receives the unformatted message. The format string is a stable key per call site,
+// so callers can dedupe or drop messages without formatting or parsing them.
+using LoggingFormatCallback = void (*)(void *, LogLevel, const char *, va_list);
 
+// Setting either callback replaces the other. With a callback installed, stderr is not touched.
 void set_thread_log_callback(LoggingCallback callback, void *userdata);
+void set_thread_log_format_callback(LoggingFormatCallback callback, void *userdata);
 LoggingCallback get_thread_log_callback();
 void *get_thread_log_callback_userdata();
-}
+bool has_thread_log_callback();
 
-#define LOGI(...) do {                                                                           \
-	if (auto *cb = ::dxil_spv::get_thread_log_callback())                                        \
-	{                                                                                            \
-		char buffer[4096];                                                                       \
-		snprintf(buffer, sizeof(buffer), __VA_ARGS__);                                           \
-		cb(::dxil_spv::get_thread_log_callback_userdata(), ::dxil_spv::LogLevel::Debug, buffer); \
-	}                                                                                            \
-	else                                                                                         \
-	{                                                                                            \
-        LOGI_INNER(__VA_ARGS__);                                                                 \
-	}                                                                                            \
-} while(0)
+// Messages below the threshold are dropped before any formatting.
+void set_thread_log_level(LogLevel level);
+LogLevel get_thread_log_level();
 
-#define LOGW(...) do {                                                                           \
-	if (auto *cb = ::dxil_spv::get_thread_log_callback())                                        \
-	{                                                                                            \
-		char buffer[4096];                                                                       \
-		snprintf(buffer, sizeof(buffer), __VA_ARGS__);                                           \
-		cb(::dxil_spv::get_thread_log_callback_userdata(), ::dxil_spv::LogLevel::Warn, buffer);  \
-	}                                                                                            \
-	else                                                                                         \
-	{                                                                                            \
-        LOGW_INNER(__VA_ARGS__);                                                                 \
-	}                                                                                            \
-} while(0)
+#if defined(__GNUC__)
+__attribute__((format(printf, 2, 3)))
+#endif
+void thread_log(LogLevel level, const char *fmt, ...);
+}
 
-#define LOGE(...) do {                                                                           \
-	if (auto *cb = ::dxil_spv::get_thread_log_callback())                                        \
-	{                                                                                            \
-		char buffer[4096];                                                                       \
-		snprintf(buffer, sizeof(buffer), __VA_ARGS__);                                           \
-		cb(::dxil_spv::get_thread_log_callback_userdata(), ::dxil_spv::LogLevel::Error, buffer); \
-	}                                                                                            \
-	else                                                                                         \
-	{                                                                                            \
-        LOGE_INNER(__VA_ARGS__);                                                                 \
-	}                                                                                            \
+#define DXIL_SPV_LOG(level, inner, ...) do {                 \
+	if (level >= ::dxil_spv::get_thread_log_level())         \
+	{                                                        \
+		if (::dxil_spv::has_thread_log_callback())           \
+			::dxil_spv::thread_log(level, __VA_ARGS__);      \
+		else                                                 \
+			inner(__VA_ARGS__);                              \
+	}                                                        \
 } while(0)
 
-
+#define LOGI(...) DXIL_SPV_LOG(::dxil_spv::LogLevel::Debug, LOGI_INNER, __VA_ARGS__)
+#define LOGW(...) DXIL_SPV_LOG(::dxil_spv::LogLevel::Warn, LOGW_INNER, __VA_ARGS__)
+#define LOGE(...) DXIL_SPV_LOG(::dxil_spv::LogLevel::Error, LOGE_INNER, __VA_ARGS__)
@@ -0,0 +1,69 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "trace.hpp"
+#include <atomic>
+
+namespace dxil_spv
+{
+#ifdef DXIL_SPV_ENABLE_TRACING
+static std::atomic<TraceBeginCallback> trace_begin;
+static std::atomic<TraceEndCallback> trace_end;
+static std::atomic<void *> trace_userdata;
+
+bool set_trace_callbacks(TraceBeginCallback begin, TraceEndCallback end, void *userdata)
+{
+	// Only enable zones once both callbacks and userdata are visible.
+	trace_begin.store(nullptr, std::memory_order_relaxed);
+	trace_userdata.store(userdata, std::memory_order_relaxed);
+	trace_end.store(end, std::memory_order_relaxed);
+	if (begin && end)
+		trace_begin.store(begin, std::memory_order_release);
+	return true;
+}
+
+ScopedTraceZone::ScopedTraceZone(const char *name_)
+	: name(name_), end(nullptr), userdata(nullptr)
+{
+	auto begin = trace_begin.load(std::memory_order_acquire);
+	if (begin)
+	{
+		end = trace_end.load(std::memory_order_relaxed);
+		userdata = trace_userdata.load(std::memory_order_relaxed);
+		begin(userdata, name);
+	}
+}
+
+ScopedTraceZone::~ScopedTraceZone()
+{
+	if (end)
+		end(userdata, name);
+}
+#else
+bool set_trace_callbacks(TraceBeginCallback, TraceEndCallback, void *)
+{
+	return false;
+}
+#endif
+} // namespace dxil_spv
@@ -0,0 +1,63 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+namespace dxil_spv
+{
+// Hooks for external profilers such as Tracy, Perfetto or ETW.
+// name is always a string literal, so its address can be used as a stable key for the zone.
+// Zones are properly nested on every thread, and end is called from the thread which called begin.
+using TraceBeginCallback = void (*)(void *userdata, const char *name);
+using TraceEndCallback = void (*)(void *userdata, const char *name);
+
+// Process-wide. Callbacks should be installed before any conversion starts.
+// Returns false if tracing was not compiled in (DXIL_SPV_ENABLE_TRACING), in which case nothing is ever called.
+bool set_trace_callbacks(TraceBeginCallback begin, TraceEndCallback end, void *userdata);
+
+#ifdef DXIL_SPV_ENABLE_TRACING
+class ScopedTraceZone
+{
+public:
+	explicit ScopedTraceZone(const char *name);
+	~ScopedTraceZone();
+
+	ScopedTraceZone(const ScopedTraceZone &) = delete;
+	void operator=(const ScopedTraceZone &) = delete;
+
+private:
+	const char *name;
+	// Captured on entry so a zone is always closed by the callback which opened it.
+	TraceEndCallback end;
+	void *userdata;
+};
+
+#define DXIL_SPV_TRACE_CONCAT_INNER(a, b) a##b
+#define DXIL_SPV_TRACE_CONCAT(a, b) DXIL_SPV_TRACE_CONCAT_INNER(a, b)
+#define DXIL_SPV_TRACE_ZONE(name) \
+	::dxil_spv::ScopedTraceZone DXIL_SPV_TRACE_CONCAT(dxil_spv_trace_zone_, __LINE__)(name)
+#else
+#define DXIL_SPV_TRACE_ZONE(name) ((void)0)
+#endif
+} // namespace dxil_spv
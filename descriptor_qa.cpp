@@ -377,6 +377,23 @@ spv::Id build_descriptor_qa_check_function(SPIRVModule &module)
 	builder.addName(descriptor_type_id, "descriptor_type_mask");
 	builder.addName(instruction_id, "instruction");
 
+	if (module.get_descriptor_qa_info().kill_switch)
+	{
+		// Once specialized to false, the whole check folds away after inlining.
+		spv::Id enabled_id = builder.makeBoolConstant(true, true);
+		builder.addDecoration(enabled_id, spv::DecorationSpecId,
+		                      int(module.get_descriptor_qa_info().kill_switch_spec_id));
+		builder.addName(enabled_id, "DescriptorQAEnabled");
+
+		auto *check_block = new spv::Block(builder.getUniqueId(), *func);
+		auto *skip_block = new spv::Block(builder.getUniqueId(), *func);
+		builder.createSelectionMerge(check_block, 0);
+		builder.createConditionalBranch(enabled_id, check_block, skip_block);
+		builder.setBuildPoint(skip_block);
+		builder.makeReturn(false, offset_id);
+		builder.setBuildPoint(check_block);
+	}
+
 	spv::Id descriptor_count_id = build_ssbo_load(builder, builder.makeUintType(32), heap_buffer_id,
 	                                              uint32_t(DescriptorQAHeapMembers::DescriptorCount));
 
@@ -39,6 +39,8 @@ struct DescriptorQAInfo
 	uint32_t heap_desc_set = 0;
 	uint32_t heap_binding = 0;
 	uint64_t shader_hash = 0;
+	bool kill_switch = false;
+	uint32_t kill_switch_spec_id = 0;
 };
 
 enum DescriptorQATypeFlagBits
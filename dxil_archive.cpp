@@ -0,0 +1,199 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "cli_parser.hpp"
+#include "dxil_spirv_c.h"
+#include "logging.hpp"
+#include "mapped_file.hpp"
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+using namespace dxil_spv;
+
+static void print_help()
+{
+	LOGE("dxil-archive <archive> [--list] [--output-dir <dir>] [--threads N]\n"
+	     "\tConverts every unique shader in a Fossilize archive (.foz) or a concatenation of DXBC containers.\n"
+	     "\t--list only prints the hash, size and kind of every unique shader.\n"
+	     "\t--output-dir writes SPIR-V for every shader as <dir>/<hash>.spv.\n"
+	     "\t--threads sets the number of worker threads, 0 (default) uses all hardware threads.\n");
+}
+
+struct ArchiveJob
+{
+	const std::string *output_dir;
+	uint64_t hash;
+	dxil_spv_result result;
+	bool write_failed;
+};
+
+static bool write_file(const char *path, const void *data, size_t size)
+{
+	FILE *file = fopen(path, "wb");
+	if (!file)
+		return false;
+
+	bool ret = fwrite(data, 1, size, file) == size;
+	fclose(file);
+	return ret;
+}
+
+static void complete_job(void *userdata, dxil_spv_result result, dxil_spv_converter converter)
+{
+	auto *job = static_cast<ArchiveJob *>(userdata);
+	job->result = result;
+	if (result != DXIL_SPV_SUCCESS || job->output_dir->empty())
+		return;
+
+	dxil_spv_compiled_spirv compiled;
+	if (dxil_spv_converter_get_compiled_spirv(converter, &compiled) != DXIL_SPV_SUCCESS)
+	{
+		job->result = DXIL_SPV_ERROR_GENERIC;
+		return;
+	}
+
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.spv", static_cast<unsigned long long>(job->hash));
+	std::string path = *job->output_dir + name;
+	if (!write_file(path.c_str(), compiled.data, compiled.size))
+		job->write_failed = true;
+}
+
+int main(int argc, char **argv)
+{
+	std::string input, output_dir;
+	unsigned num_threads = 0;
+	bool list = false;
+
+	CLICallbacks cbs;
+	cbs.add("--help", [](CLIParser &parser) {
+		print_help();
+		parser.end();
+	});
+	cbs.add("--list", [&](CLIParser &) { list = true; });
+	cbs.add("--output-dir", [&](CLIParser &parser) { output_dir = parser.next_string(); });
+	cbs.add("--threads", [&](CLIParser &parser) { num_threads = parser.next_uint(); });
+	cbs.default_handler = [&](const char *arg) { input = arg; };
+	CLIParser parser(std::move(cbs), argc - 1, argv + 1);
+
+	if (!parser.parse())
+		return EXIT_FAILURE;
+	else if (parser.is_ended_state())
+		return EXIT_SUCCESS;
+
+	if (input.empty())
+	{
+		LOGE("Need input file.\n");
+		print_help();
+		return EXIT_FAILURE;
+	}
+
+	// Blobs point into the mapping, so nothing is copied out of the archive.
+	MappedFile file;
+	if (!file.open(input.c_str()) || file.get_size() == 0)
+	{
+		LOGE("Failed to read file %s.\n", input.c_str());
+		return EXIT_FAILURE;
+	}
+
+	dxil_spv_archive archive;
+	if (dxil_spv_parse_archive(file.get_data(), file.get_size(), &archive) != DXIL_SPV_SUCCESS)
+	{
+		LOGE("Failed to parse archive %s.\n", input.c_str());
+		return EXIT_FAILURE;
+	}
+
+	unsigned num_blobs = dxil_spv_archive_get_num_blobs(archive);
+	LOGI("%u unique shaders, %u duplicates, %u entries skipped.\n", num_blobs,
+	     dxil_spv_archive_get_num_duplicate_blobs(archive), dxil_spv_archive_get_num_skipped_entries(archive));
+
+	if (list)
+	{
+		for (unsigned i = 0; i < num_blobs; i++)
+		{
+			dxil_spv_archive_blob blob;
+			dxil_spv_archive_get_blob(archive, i, &blob);
+			printf("%016llx %zu %s\n", blob.hash, blob.size, blob.raw_dxil ? "dxil" : "dxbc");
+		}
+
+		dxil_spv_archive_free(archive);
+		return EXIT_SUCCESS;
+	}
+
+	dxil_spv_batch batch;
+	if (dxil_spv_batch_create(num_threads, &batch) != DXIL_SPV_SUCCESS)
+	{
+		dxil_spv_archive_free(archive);
+		return EXIT_FAILURE;
+	}
+
+	std::vector<ArchiveJob> jobs(num_blobs);
+	auto start = std::chrono::steady_clock::now();
+
+	for (unsigned i = 0; i < num_blobs; i++)
+	{
+		dxil_spv_archive_blob blob;
+		dxil_spv_archive_get_blob(archive, i, &blob);
+		jobs[i] = { &output_dir, blob.hash, DXIL_SPV_ERROR_GENERIC, false };
+
+		dxil_spv_batch_job job = {};
+		job.data = blob.data;
+		job.size = blob.size;
+		job.raw_dxil = blob.raw_dxil;
+		job.complete = complete_job;
+		job.userdata = &jobs[i];
+		if (dxil_spv_batch_submit(batch, &job) != DXIL_SPV_SUCCESS)
+			jobs[i].result = DXIL_SPV_ERROR_INVALID_ARGUMENT;
+	}
+
+	dxil_spv_batch_wait(batch);
+	auto end = std::chrono::steady_clock::now();
+	dxil_spv_batch_free(batch);
+
+	unsigned failed = 0;
+	for (auto &job : jobs)
+	{
+		if (job.result != DXIL_SPV_SUCCESS)
+		{
+			LOGE("Failed to convert shader %016llx (error %d).\n", static_cast<unsigned long long>(job.hash),
+			     int(job.result));
+			failed++;
+		}
+		else if (job.write_failed)
+		{
+			LOGE("Failed to write SPIR-V for shader %016llx.\n", static_cast<unsigned long long>(job.hash));
+			failed++;
+		}
+	}
+
+	LOGI("Converted %u of %u shaders in %.3f ms.\n", num_blobs - failed, num_blobs,
+	     std::chrono::duration<double, std::milli>(end - start).count());
+
+	dxil_spv_archive_free(archive);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -30,15 +30,18 @@
 
 #include "dxil_converter.hpp"
 #include "logging.hpp"
+#include "hash.hpp"
+#include "trace.hpp"
 #include "node.hpp"
 #include "node_pool.hpp"
 #include "spirv_module.hpp"
 
 #include <utility>
+#include <ctype.h>
 
 namespace dxil_spv
 {
-Converter::Converter(LLVMBCParser &bitcode_parser_, LLVMBCParser *bitcode_reflection_parser_, SPIRVModule &module_)
+Converter::Converter(const LLVMBCParser &bitcode_parser_, const LLVMBCParser *bitcode_reflection_parser_, SPIRVModule &module_)
 {
 	impl = std::make_unique<Impl>(bitcode_parser_, bitcode_reflection_parser_, module_);
 }
@@ -105,6 +108,16 @@ uint32_t Converter::get_compute_heuristic_max_wave_size() const
 	return impl->execution_mode_meta.heuristic_max_wave_size;
 }
 
+const Vector<CBVPromotionCandidate> &Converter::get_cbv_promotion_candidates() const
+{
+	return impl->cbv_promotion_candidates;
+}
+
+const Vector<ResourceUsage> &Converter::get_resource_usage() const
+{
+	return impl->resource_usage;
+}
+
 bool Converter::shader_requires_feature(ShaderFeature feature) const
 {
 	switch (feature)
@@ -920,6 +933,51 @@ bool Converter::Impl::analyze_aliased_access(const AccessTracking &tracking,
 	return true;
 }
 
+void Converter::Impl::record_resource_usage(DXIL::ResourceType type, unsigned index, unsigned bind_space,
+                                            unsigned bind_register, unsigned range_size, unsigned cbv_size)
+{
+	// Declared resources which never have a handle created for them can be skipped by the host entirely.
+	if (!llvm_referenced_resource_indices[int(type)].count(index))
+		return;
+
+	ResourceUsage usage = {};
+	usage.resource_class = ResourceClass(type);
+	usage.register_space = bind_space;
+	usage.register_index = bind_register;
+	usage.range_size = range_size;
+
+	if (type == DXIL::ResourceType::UAV)
+	{
+		auto &access_meta = uav_access_tracking[index];
+		if (access_meta.has_read)
+			usage.flags |= RESOURCE_USAGE_READ_BIT;
+		if (access_meta.has_written)
+			usage.flags |= RESOURCE_USAGE_WRITE_BIT;
+		if (access_meta.has_atomic)
+			usage.flags |= RESOURCE_USAGE_ATOMIC_BIT;
+
+		for (auto *value : llvm_values_using_update_counter)
+		{
+			auto itr = llvm_value_to_uav_resource_index_map.find(value);
+			if (itr != llvm_value_to_uav_resource_index_map.end() && itr->second == index)
+			{
+				usage.flags |= RESOURCE_USAGE_COUNTER_BIT;
+				break;
+			}
+		}
+	}
+	else if (type == DXIL::ResourceType::CBV)
+	{
+		auto &access_meta = cbv_access_tracking[index];
+		if (access_meta.has_dynamic_cbv_offset)
+			usage.cbv_used_bytes = cbv_size;
+		else
+			usage.cbv_used_bytes = std::min<uint32_t>(access_meta.cbv_static_rows * 16, cbv_size);
+	}
+
+	resource_usage.push_back(usage);
+}
+
 bool Converter::Impl::emit_srvs(const llvm::MDNode *srvs, const llvm::MDNode *refl)
 {
 	auto &builder = spirv_module.get_builder();
@@ -939,6 +997,8 @@ bool Converter::Impl::emit_srvs(const llvm::MDNode *srvs, const llvm::MDNode *re
 		unsigned bind_register = get_constant_metadata(srv, 4);
 		unsigned range_size = get_constant_metadata(srv, 5);
 
+		record_resource_usage(DXIL::ResourceType::SRV, index, bind_space, bind_register, range_size, 0);
+
 		auto resource_kind = static_cast<DXIL::ResourceKind>(get_constant_metadata(srv, 6));
 
 		llvm::MDNode *tags = nullptr;
@@ -1406,6 +1466,8 @@ bool Converter::Impl::emit_uavs(const llvm::MDNode *uavs, const llvm::MDNode *re
 		if (index == ags.uav_magic_resource_type_index)
 			continue;
 
+		record_resource_usage(DXIL::ResourceType::UAV, index, bind_space, bind_register, range_size, 0);
+
 		bool has_counter = get_constant_metadata(uav, 8) != 0;
 		bool is_rov = get_constant_metadata(uav, 9) != 0;
 
@@ -1441,7 +1503,7 @@ bool Converter::Impl::emit_uavs(const llvm::MDNode *uavs, const llvm::MDNode *re
 		// If no UAV actually needs globallycoherent we can demote any barriers to workgroup barriers,
 		// which is hopefully more optimal if the compiler understands the intent ...
 		// Only promote resources which actually need some kind of coherence.
-		if (shader_analysis.require_uav_thread_group_coherence && access_meta.has_written && access_meta.has_read)
+		if (shader_analysis.require_uav_thread_group_coherence && uav_requires_coherence(access_meta))
 			globally_coherent = true;
 
 		if (resource_kind == DXIL::ResourceKind::FeedbackTexture2D ||
@@ -1940,6 +2002,8 @@ bool Converter::Impl::emit_cbvs(const llvm::MDNode *cbvs, const llvm::MDNode *re
 		unsigned range_size = get_constant_metadata(cbv, 5);
 		unsigned cbv_size = get_constant_metadata(cbv, 6);
 
+		record_resource_usage(DXIL::ResourceType::CBV, index, bind_space, bind_register, range_size, cbv_size);
+
 		DescriptorTableEntry local_table_entry = {};
 		int local_root_signature_entry = get_local_root_signature_entry(
 		    ResourceClass::CBV, bind_space, bind_register, local_table_entry);
@@ -1962,6 +2026,12 @@ bool Converter::Impl::emit_cbvs(const llvm::MDNode *cbvs, const llvm::MDNode *re
 		if (!analyze_aliased_access(access_meta, VulkanDescriptorType::UBO, aliased_access))
 			return false;
 
+		if (local_root_signature_entry < 0 && !vulkan_binding.push_constant && range_size == 1 &&
+		    access_meta.cbv_static_rows != 0 && !access_meta.has_dynamic_cbv_offset)
+		{
+			cbv_promotion_candidates.push_back({ bind_space, bind_register, access_meta.cbv_static_rows * 4 });
+		}
+
 		cbv_index_to_reference.resize(std::max(cbv_index_to_reference.size(), size_t(index + 1)));
 
 		if (range_size != 1)
@@ -2160,6 +2230,8 @@ bool Converter::Impl::emit_samplers(const llvm::MDNode *samplers, const llvm::MD
 		unsigned bind_register = get_constant_metadata(sampler, 4);
 		unsigned range_size = get_constant_metadata(sampler, 5);
 
+		record_resource_usage(DXIL::ResourceType::Sampler, index, bind_space, bind_register, range_size, 0);
+
 		if (range_size != 1)
 		{
 			if (range_size == ~0u)
@@ -2708,6 +2780,38 @@ bool Converter::Impl::emit_descriptor_heap_dummy_ssbo()
 	return true;
 }
 
+bool Converter::Impl::uav_requires_coherence(const AccessTracking &tracking) const
+{
+	if (!tracking.has_read || !tracking.has_written)
+		return false;
+
+	// Atomics are performed coherently regardless of decoration.
+	if (options.uav_coherence_analysis)
+		return tracking.has_non_atomic_read || tracking.has_non_atomic_write;
+	else
+		return true;
+}
+
+bool Converter::Impl::any_uav_requires_coherence() const
+{
+	AccessTracking combined;
+
+	auto accumulate = [&](const AccessTracking &tracking) {
+		combined.has_read = combined.has_read || tracking.has_read;
+		combined.has_written = combined.has_written || tracking.has_written;
+		combined.has_non_atomic_read = combined.has_non_atomic_read || tracking.has_non_atomic_read;
+		combined.has_non_atomic_write = combined.has_non_atomic_write || tracking.has_non_atomic_write;
+	};
+
+	for (auto &tracking : uav_access_tracking)
+		accumulate(tracking.second);
+	for (auto &use : llvm_annotate_handle_uses)
+		if (use.second.resource_type == DXIL::ResourceType::UAV)
+			accumulate(use.second.tracking);
+
+	return uav_requires_coherence(combined);
+}
+
 bool Converter::Impl::emit_global_heaps()
 {
 	Vector<AnnotateHandleReference *> annotations;
@@ -2720,6 +2824,11 @@ bool Converter::Impl::emit_global_heaps()
 	              return a->ordinal < b->ordinal;
 	          });
 
+	// Heap UAVs may alias each other, so only the shader as a whole can prove coherence is not needed.
+	bool heap_uavs_require_coherence = shader_analysis.require_uav_thread_group_coherence;
+	if (heap_uavs_require_coherence && options.uav_coherence_analysis)
+		heap_uavs_require_coherence = any_uav_requires_coherence();
+
 	for (auto *annotation : annotations)
 	{
 		BindlessInfo info = {};
@@ -2762,7 +2871,7 @@ bool Converter::Impl::emit_global_heaps()
 			// Do not attempt to track read and write here to figure out if this resource in particular needs to be coherent.
 			// It's plausible that the write and read can happen across
 			// two different accesses to ResourceDescriptorHeap[]. Don't take any chances here ...
-			if (shader_analysis.require_uav_thread_group_coherence)
+			if (heap_uavs_require_coherence)
 				annotation->coherent = true;
 
 			if (annotation->resource_kind == DXIL::ResourceKind::StructuredBuffer ||
@@ -2933,6 +3042,7 @@ bool Converter::Impl::emit_global_heaps()
 
 bool Converter::Impl::emit_resources()
 {
+	ScopedPhaseTimer timer(statistics, StatisticsPhase::EmitResources);
 	unsigned num_root_descriptors = 0;
 	unsigned num_root_constant_words = 0;
 
@@ -3059,57 +3169,6 @@ ShaderStage Converter::Impl::get_remapping_stage(spv::ExecutionModel execution_m
 	}
 }
 
-static inline float half_to_float(uint16_t u16_value)
-{
-	// Based on the GLM implementation.
-	int s = (u16_value >> 15) & 0x1;
-	int e = (u16_value >> 10) & 0x1f;
-	int m = (u16_value >> 0) & 0x3ff;
-
-	union {
-		float f32;
-		uint32_t u32;
-	} u;
-
-	if (e == 0)
-	{
-		if (m == 0)
-		{
-			u.u32 = uint32_t(s) << 31;
-			return u.f32;
-		}
-		else
-		{
-			while ((m & 0x400) == 0)
-			{
-				m <<= 1;
-				e--;
-			}
-
-			e++;
-			m &= ~0x400;
-		}
-	}
-	else if (e == 31)
-	{
-		if (m == 0)
-		{
-			u.u32 = (uint32_t(s) << 31) | 0x7f800000u;
-			return u.f32;
-		}
-		else
-		{
-			u.u32 = (uint32_t(s) << 31) | 0x7f800000u | (m << 13);
-			return u.f32;
-		}
-	}
-
-	e += 127 - 15;
-	m <<= 13;
-	u.u32 = (uint32_t(s) << 31) | (e << 23) | m;
-	return u.f32;
-}
-
 spv::Id Converter::Impl::get_id_for_constant(const llvm::Constant *constant, unsigned forced_width)
 {
 	auto &builder = spirv_module.get_builder();
@@ -3256,9 +3315,8 @@ spv::Id Converter::Impl::get_id_for_value(const llvm::Value *value, unsigned for
 	if (auto *cexpr = llvm::dyn_cast<llvm::ConstantExpr>(value))
 		return build_constant_expression(*this, cexpr);
 
-	auto itr = value_map.find(value);
-	if (itr != value_map.end())
-		return itr->second;
+	if (auto *id = value_map.find(value))
+		return *id;
 
 	spv::Id ret;
 	if (auto *undef = llvm::dyn_cast<llvm::UndefValue>(value))
@@ -3385,6 +3443,210 @@ static const llvm::MDOperand *get_shader_property_tag(const llvm::MDNode *func_m
 	return nullptr;
 }
 
+bool Converter::materialize_entry_point(LLVMBCParser &parser, const char *entry)
+{
+	auto *entry_point_meta = get_entry_point_meta(parser.get_module(), entry);
+	if (!entry_point_meta)
+		return true;
+
+	if (!parser.materialize(get_entry_point_function(entry_point_meta)))
+		return false;
+
+	// The patch constant function is only referenced through metadata.
+	auto *hs_state_node = get_shader_property_tag(entry_point_meta, DXIL::ShaderPropertyTag::HSState);
+	if (hs_state_node)
+	{
+		auto *arguments = llvm::cast<llvm::MDNode>(*hs_state_node);
+		auto *patch_constant = llvm::cast<llvm::ConstantAsMetadata>(arguments->getOperand(0));
+		if (!parser.materialize(llvm::dyn_cast<llvm::Function>(patch_constant->getValue())))
+			return false;
+	}
+
+	return true;
+}
+
+static bool dxil_op_is_wave_op(DXIL::Op op)
+{
+	switch (op)
+	{
+	case DXIL::Op::WaveIsFirstLane:
+	case DXIL::Op::WaveGetLaneIndex:
+	case DXIL::Op::WaveGetLaneCount:
+	case DXIL::Op::WaveAnyTrue:
+	case DXIL::Op::WaveAllTrue:
+	case DXIL::Op::WaveActiveAllEqual:
+	case DXIL::Op::WaveActiveBallot:
+	case DXIL::Op::WaveReadLaneAt:
+	case DXIL::Op::WaveReadLaneFirst:
+	case DXIL::Op::WaveActiveOp:
+	case DXIL::Op::WaveActiveBit:
+	case DXIL::Op::WavePrefixOp:
+	case DXIL::Op::QuadReadLaneAt:
+	case DXIL::Op::QuadOp:
+	case DXIL::Op::WaveAllBitCount:
+	case DXIL::Op::WavePrefixBitCount:
+	case DXIL::Op::WaveMatch:
+	case DXIL::Op::WaveMultiPrefixOp:
+	case DXIL::Op::WaveMultiPrefixBitCount:
+	case DXIL::Op::QuadVote:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+static bool dxil_op_is_ray_tracing_op(DXIL::Op op)
+{
+	switch (op)
+	{
+	case DXIL::Op::IgnoreHit:
+	case DXIL::Op::AcceptHitAndEndSearch:
+	case DXIL::Op::TraceRay:
+	case DXIL::Op::ReportHit:
+	case DXIL::Op::CallShader:
+	case DXIL::Op::AllocateRayQuery:
+	case DXIL::Op::RayQuery_TraceRayInline:
+	case DXIL::Op::RayQuery_Proceed:
+	case DXIL::Op::RayQuery_Abort:
+	case DXIL::Op::RayQuery_CommitNonOpaqueTriangleHit:
+	case DXIL::Op::RayQuery_CommitProceduralPrimitiveHit:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+// Every block which is on the DFS stack when a back edge to a header is found is inside that header's loop.
+// Blocks of a loop which were already finished are missed, so this can only underestimate.
+static uint32_t estimate_max_loop_depth(const llvm::Function &func)
+{
+	UnorderedMap<const llvm::BasicBlock *, uint32_t> block_indices;
+	uint32_t num_blocks = 0;
+	for (auto &bb : func)
+		block_indices[&bb] = num_blocks++;
+
+	enum { Unvisited = 0, OnStack, Done };
+	Vector<uint8_t> state(num_blocks);
+	Vector<uint32_t> depth(num_blocks);
+	UnorderedSet<uint64_t> counted_headers;
+	uint32_t max_depth = 0;
+
+	struct Frame
+	{
+		const llvm::BasicBlock *block;
+		uint32_t index;
+		uint32_t next_succ;
+	};
+	Vector<Frame> stack;
+
+	auto *entry = &func.getEntryBlock();
+	state[block_indices[entry]] = OnStack;
+	stack.push_back({ entry, block_indices[entry], 0 });
+
+	while (!stack.empty())
+	{
+		auto &frame = stack.back();
+		if (frame.next_succ == uint32_t(llvm::succ_end(frame.block) - llvm::succ_begin(frame.block)))
+		{
+			state[frame.index] = Done;
+			stack.pop_back();
+			continue;
+		}
+
+		auto *succ = llvm::succ_begin(frame.block)[frame.next_succ++];
+		uint32_t succ_index = block_indices[succ];
+
+		if (state[succ_index] == Unvisited)
+		{
+			state[succ_index] = OnStack;
+			stack.push_back({ succ, succ_index, 0 });
+		}
+		else if (state[succ_index] == OnStack)
+		{
+			for (size_t i = stack.size(); i; i--)
+			{
+				uint32_t index = stack[i - 1].index;
+				if (counted_headers.insert((uint64_t(index) << 32) | succ_index).second)
+					max_depth = std::max<uint32_t>(max_depth, ++depth[index]);
+				if (index == succ_index)
+					break;
+			}
+		}
+	}
+
+	return max_depth;
+}
+
+bool Converter::estimate_cost(const LLVMBCParser &parser, const char *entry, CostEstimate &estimate)
+{
+	estimate = {};
+
+	auto *entry_point_meta = get_entry_point_meta(parser.get_module(), entry);
+	if (!entry_point_meta)
+		return false;
+
+	Vector<const llvm::Function *> worklist;
+	UnorderedSet<const llvm::Function *> visited;
+	auto add_function = [&](const llvm::Function *func) {
+		if (func && visited.insert(func).second)
+			worklist.push_back(func);
+	};
+
+	add_function(get_entry_point_function(entry_point_meta));
+
+	auto *hs_state_node = get_shader_property_tag(entry_point_meta, DXIL::ShaderPropertyTag::HSState);
+	if (hs_state_node)
+	{
+		auto *arguments = llvm::cast<llvm::MDNode>(*hs_state_node);
+		auto *patch_constant = llvm::cast<llvm::ConstantAsMetadata>(arguments->getOperand(0));
+		add_function(llvm::dyn_cast<llvm::Function>(patch_constant->getValue()));
+	}
+
+	while (!worklist.empty())
+	{
+		auto *func = worklist.back();
+		worklist.pop_back();
+		if (func->begin() == func->end())
+			continue;
+
+		estimate.num_functions++;
+		estimate.max_loop_depth = std::max<uint32_t>(estimate.max_loop_depth, estimate_max_loop_depth(*func));
+
+		for (auto &bb : *func)
+		{
+			estimate.num_blocks++;
+			for (auto &inst : bb)
+			{
+				estimate.num_instructions++;
+
+				auto *call = llvm::dyn_cast<llvm::CallInst>(&inst);
+				if (!call)
+					continue;
+
+				uint32_t opcode;
+				if (!is_dxil_op_callee(call->getCalledFunction()))
+					add_function(call->getCalledFunction());
+				else if (get_dxil_opcode(call, &opcode))
+				{
+					if (dxil_op_is_wave_op(DXIL::Op(opcode)))
+						estimate.num_wave_ops++;
+					else if (dxil_op_is_ray_tracing_op(DXIL::Op(opcode)))
+						estimate.num_ray_tracing_ops++;
+				}
+			}
+		}
+	}
+
+	// Structurization and its fixups scale with the CFG rather than the instruction count,
+	// and nested loops make them considerably worse. Wave and ray tracing ops expand into helper code.
+	estimate.cost = uint64_t(estimate.num_instructions) +
+	                16ull * estimate.num_blocks * (1 + estimate.max_loop_depth) +
+	                32ull * estimate.num_wave_ops + 64ull * estimate.num_ray_tracing_ops;
+	return true;
+}
+
 static spv::ExecutionModel get_execution_model(const llvm::Module &module, llvm::MDNode *entry_point_meta)
 {
 	if (auto *tag = get_shader_property_tag(entry_point_meta, DXIL::ShaderPropertyTag::ShaderKind))
@@ -3518,10 +3780,13 @@ spv::Id Converter::Impl::get_type_id(const llvm::Type *type)
 
 spv::Id Converter::Impl::get_struct_type(const Vector<spv::Id> &type_ids, const char *name)
 {
-	auto itr = std::find_if(cached_struct_types.begin(), cached_struct_types.end(), [&](const StructTypeEntry &entry) -> bool {
+	if (!name)
+		name = "";
+
+	auto match = [&](const StructTypeEntry &entry) -> bool {
 		if (type_ids.size() != entry.subtypes.size())
 			return false;
-		if ((!name && !entry.name.empty()) || (entry.name != name))
+		if (entry.name != name)
 			return false;
 
 		for (unsigned i = 0; i < type_ids.size(); i++)
@@ -3529,20 +3794,36 @@ spv::Id Converter::Impl::get_struct_type(const Vector<spv::Id> &type_ids, const
 				return false;
 
 		return true;
-	});
+	};
 
-	if (itr == cached_struct_types.end())
+	Hasher h;
+	h.string(name);
+	h.u32(uint32_t(type_ids.size()));
+	for (auto &id : type_ids)
+		h.u32(id);
+
+	auto index_itr = cached_struct_type_index.find(h.get());
+	if (index_itr != cached_struct_type_index.end())
 	{
-		StructTypeEntry entry;
-		entry.subtypes = type_ids;
-		entry.name = name ? name : "";
-		entry.id = builder().makeStructType(type_ids, entry.name.c_str());
-		spv::Id id = entry.id;
-		cached_struct_types.push_back(std::move(entry));
-		return id;
+		auto &entry = cached_struct_types[index_itr->second];
+		if (match(entry))
+			return entry.id;
+
+		// Hash collision, only the first entry is indexed.
+		auto itr = std::find_if(cached_struct_types.begin(), cached_struct_types.end(), match);
+		if (itr != cached_struct_types.end())
+			return itr->id;
 	}
 	else
-		return itr->id;
+		cached_struct_type_index[h.get()] = uint32_t(cached_struct_types.size());
+
+	StructTypeEntry entry;
+	entry.subtypes = type_ids;
+	entry.name = name;
+	entry.id = builder().makeStructType(type_ids, entry.name.c_str());
+	spv::Id id = entry.id;
+	cached_struct_types.push_back(std::move(entry));
+	return id;
 }
 
 spv::Id Converter::Impl::get_type_id(DXIL::ComponentType element_type, unsigned rows, unsigned cols, bool force_array)
@@ -3835,6 +4116,9 @@ bool Converter::Impl::emit_stage_output_variables()
 			continue;
 		}
 
+		if (stripped_output_elements.count(element_id))
+			continue;
+
 		if (execution_model == spv::ExecutionModelTessellationControl || execution_model == spv::ExecutionModelMeshEXT)
 			patch_location_offset = std::max(patch_location_offset, start_row + rows);
 
@@ -4746,6 +5030,17 @@ spv::Id Converter::Impl::build_offset(spv::Id value, unsigned offset)
 void Converter::Impl::repack_sparse_feedback(DXIL::ComponentType component_type, unsigned num_components, const llvm::Value *value,
                                              const llvm::Type *target_type, spv::Id override_value)
 {
+	if (options.sparse_feedback_forwarding)
+	{
+		auto itr = llvm_composite_meta.find(value);
+		if (itr != llvm_composite_meta.end() && !itr->second.forced_struct)
+		{
+			forward_sparse_feedback(component_type, num_components, value, target_type, override_value,
+			                        itr->second.access_mask);
+			return;
+		}
+	}
+
 	auto *code_id = allocate(spv::OpCompositeExtract, builder().makeUintType(32));
 	code_id->add_id(get_id_for_value(value));
 	code_id->add_literal(0);
@@ -4798,6 +5093,64 @@ void Converter::Impl::repack_sparse_feedback(DXIL::ComponentType component_type,
 	rewrite_value(value, repack_op->id);
 }
 
+void Converter::Impl::forward_sparse_feedback(DXIL::ComponentType component_type, unsigned num_components,
+                                              const llvm::Value *value, const llvm::Type *target_type,
+                                              spv::Id override_value, unsigned access_mask)
+{
+	// Only extractvalue consumes the result, so skip the repack and only unpack what is read.
+	SparseFeedbackComponents feedback = {};
+	spv::Id sparse_id = get_id_for_value(value);
+
+	if (access_mask & (1u << 4))
+	{
+		auto *code_id = allocate(spv::OpCompositeExtract, builder().makeUintType(32));
+		code_id->add_id(sparse_id);
+		code_id->add_literal(0);
+		add(code_id);
+		feedback.ids[4] = code_id->id;
+	}
+
+	if (access_mask & 0xfu)
+	{
+		auto effective_component_type = get_effective_typed_resource_type(component_type);
+		spv::Id texel_id;
+
+		if (override_value)
+		{
+			texel_id = override_value;
+		}
+		else
+		{
+			auto *texel = allocate(spv::OpCompositeExtract, get_type_id(effective_component_type, 1, num_components));
+			texel->add_id(sparse_id);
+			texel->add_literal(1);
+			add(texel);
+			texel_id = texel->id;
+		}
+
+		fixup_load_type_typed(component_type, num_components, texel_id, target_type);
+
+		for (unsigned i = 0; i < 4; i++)
+		{
+			if ((access_mask & (1u << i)) == 0)
+				continue;
+
+			if (num_components > 1)
+			{
+				auto *extract_op = allocate(spv::OpCompositeExtract, get_type_id(component_type, 1, 1));
+				extract_op->add_id(texel_id);
+				extract_op->add_literal(i);
+				add(extract_op);
+				feedback.ids[i] = extract_op->id;
+			}
+			else
+				feedback.ids[i] = texel_id;
+		}
+	}
+
+	sparse_feedback_components[value] = feedback;
+}
+
 bool Converter::Impl::support_16bit_operations() const
 {
 	return execution_mode_meta.native_16bit_operations || options.min_precision_prefer_native_16bit;
@@ -5082,7 +5435,13 @@ bool Converter::Impl::emit_phi_instruction(CFGNode *block, const llvm::PHINode &
 		for (unsigned i = 0; i < count; i++)
 		{
 			IncomingValue incoming = {};
-			auto bb_itr = bb_map.find(instruction.getIncomingBlock(i));
+			auto *incoming_bb = instruction.getIncomingBlock(i);
+			auto bb_itr = bb_map.find(incoming_bb);
+
+			// If the edge was folded away, the incoming block may still exist, but it no longer branches to us.
+			auto static_itr = bb_static_succ.find(incoming_bb);
+			if (static_itr != bb_static_succ.end() && bb_map[static_itr->second]->node != block)
+				continue;
 
 			// If the block was statically eliminated, it might not exist.
 			if (bb_itr != bb_map.end())
@@ -5121,7 +5480,7 @@ static bool instruction_has_side_effects(const llvm::Instruction &instruction)
 	if (auto *call_inst = llvm::dyn_cast<llvm::CallInst>(&instruction))
 	{
 		auto *called_function = call_inst->getCalledFunction();
-		if (strncmp(called_function->getName().data(), "dx.op", 5) == 0)
+		if (is_dxil_op_callee(called_function))
 			return dxil_instruction_has_side_effects(call_inst);
 		else
 			return true;
@@ -5149,11 +5508,11 @@ bool Converter::Impl::emit_instruction(CFGNode *block, const llvm::Instruction &
 	if (auto *call_inst = llvm::dyn_cast<llvm::CallInst>(&instruction))
 	{
 		auto *called_function = call_inst->getCalledFunction();
-		if (strncmp(called_function->getName().data(), "dx.op", 5) == 0)
+		if (is_dxil_op_callee(called_function))
 		{
 			return emit_dxil_instruction(*this, call_inst);
 		}
-		else if (strncmp(called_function->getName().data(), "llvm.", 5) == 0)
+		else if (is_llvm_intrinsic_callee(called_function))
 		{
 			// lib_6_6 sometimes emits llvm.lifetime.begin/end for some bizarre reason.
 			// Just ignore ...
@@ -5421,6 +5780,73 @@ bool Converter::Impl::emit_execution_modes_hull()
 		return false;
 }
 
+static unsigned compute_geometry_max_emitted_vertices(const llvm::Function *func, unsigned max_vertex_count)
+{
+	// Longest path through the CFG, where each block is weighted by the number of vertices it emits.
+	// Counts only ever grow, so any cycle which emits will push a count past max_vertex_count.
+	// At that point there is nothing to gain and we keep the declared count.
+	UnorderedMap<const llvm::BasicBlock *, unsigned> block_emits;
+	for (auto &bb : *func)
+	{
+		unsigned emits = 0;
+		for (auto &inst : bb)
+		{
+			uint32_t opcode;
+			auto *call_inst = llvm::dyn_cast<llvm::CallInst>(&inst);
+			if (!call_inst)
+				continue;
+
+			// Vertices may be emitted inside a called function, which we do not analyze.
+			auto *callee = call_inst->getCalledFunction();
+			if (callee && callee->begin() != callee->end())
+				return max_vertex_count;
+
+			if (!is_dxil_op_callee(callee) || !get_dxil_opcode(call_inst, &opcode))
+				continue;
+
+			if (DXIL::Op(opcode) == DXIL::Op::EmitStream || DXIL::Op(opcode) == DXIL::Op::EmitThenCutStream)
+				emits++;
+		}
+		block_emits[&bb] = emits;
+	}
+
+	UnorderedMap<const llvm::BasicBlock *, unsigned> max_emits;
+	Vector<const llvm::BasicBlock *> work_list;
+
+	auto *entry = &func->getEntryBlock();
+	max_emits[entry] = block_emits[entry];
+	work_list.push_back(entry);
+
+	unsigned result = 0;
+
+	while (!work_list.empty())
+	{
+		auto *bb = work_list.back();
+		work_list.pop_back();
+		unsigned count = max_emits[bb];
+
+		if (count > max_vertex_count)
+			return max_vertex_count;
+
+		if (llvm::isa<llvm::ReturnInst>(bb->getTerminator()))
+			result = std::max<unsigned>(result, count);
+
+		for (auto itr = llvm::succ_begin(bb); itr != llvm::succ_end(bb); ++itr)
+		{
+			unsigned succ_count = count + block_emits[*itr];
+			auto succ_itr = max_emits.find(*itr);
+			if (succ_itr == max_emits.end() || succ_itr->second < succ_count)
+			{
+				max_emits[*itr] = succ_count;
+				work_list.push_back(*itr);
+			}
+		}
+	}
+
+	// OutputVertices must be non-zero.
+	return std::max<unsigned>(result, 1);
+}
+
 bool Converter::Impl::emit_execution_modes_geometry()
 {
 	auto &builder = spirv_module.get_builder();
@@ -5434,6 +5860,12 @@ bool Converter::Impl::emit_execution_modes_geometry()
 		auto input_primitive = static_cast<DXIL::InputPrimitive>(get_constant_metadata(arguments, 0));
 		unsigned max_vertex_count = get_constant_metadata(arguments, 1);
 
+		if (options.geometry_output_vertex_analysis)
+		{
+			max_vertex_count = compute_geometry_max_emitted_vertices(
+			    get_entry_point_function(entry_point_meta), max_vertex_count);
+		}
+
 		auto *func = spirv_module.get_entry_function();
 
 		auto topology = static_cast<DXIL::PrimitiveTopology>(get_constant_metadata(arguments, 3));
@@ -5693,21 +6125,102 @@ bool Converter::Impl::emit_execution_modes_fp_denorm()
 	return true;
 }
 
-bool Converter::Impl::analyze_execution_modes_meta()
+static bool semantic_names_match(const char *a, const char *b)
 {
-	auto *meta = entry_point_meta;
+	// D3D matches semantics case-insensitively.
+	for (; *a && *b; a++, b++)
+		if (tolower(static_cast<unsigned char>(*a)) != tolower(static_cast<unsigned char>(*b)))
+			return false;
+	return *a == *b;
+}
 
-	switch (execution_model)
+bool Converter::Impl::analyze_linked_stage_outputs()
+{
+	// Only stages whose outputs are consumed by the rasterizer or a following shader stage.
+	// HS outputs are read by index, and mesh outputs are addressed per vertex or primitive, so leave those alone.
+	if (!options.link_stage_outputs ||
+	    (execution_model != spv::ExecutionModelVertex &&
+	     execution_model != spv::ExecutionModelTessellationEvaluation &&
+	     execution_model != spv::ExecutionModelGeometry))
 	{
-	case spv::ExecutionModelRayGenerationKHR:
-	case spv::ExecutionModelMissKHR:
-	case spv::ExecutionModelIntersectionKHR:
-	case spv::ExecutionModelAnyHitKHR:
-	case spv::ExecutionModelCallableKHR:
-	case spv::ExecutionModelClosestHitKHR:
-		if (auto *null_meta = get_null_entry_point_meta(bitcode_parser.get_module()))
-			meta = null_meta;
-		break;
+		return true;
+	}
+
+	auto *node = entry_point_meta;
+	if (!node->getOperand(2))
+		return true;
+
+	auto *signature_node = llvm::cast<llvm::MDNode>(node->getOperand(2));
+	auto &outputs = signature_node->getOperand(1);
+	if (!outputs)
+		return true;
+
+	auto *outputs_node = llvm::dyn_cast<llvm::MDNode>(outputs);
+
+	for (unsigned i = 0; i < outputs_node->getNumOperands(); i++)
+	{
+		auto *output = llvm::cast<llvm::MDNode>(outputs_node->getOperand(i));
+		auto system_value = static_cast<DXIL::Semantic>(get_constant_metadata(output, 3));
+
+		// System values are consumed by fixed function, never strip those.
+		if (system_value != DXIL::Semantic::User)
+			continue;
+
+		auto element_id = get_constant_metadata(output, 0);
+		auto semantic_name = get_string_metadata(output, 1);
+		unsigned semantic_index = 0;
+		if (output->getOperand(4))
+			semantic_index = get_constant_metadata(llvm::cast<llvm::MDNode>(output->getOperand(4)), 0);
+
+		bool consumed = std::find_if(options.consumer_stage_inputs.begin(), options.consumer_stage_inputs.end(),
+		                             [&](const std::pair<String, uint32_t> &input) {
+			                             return input.second == semantic_index &&
+			                                    semantic_names_match(input.first.c_str(), semantic_name.c_str());
+		                             }) != options.consumer_stage_inputs.end();
+		if (consumed)
+			continue;
+
+		// Stream output still observes the element.
+		if (resource_mapping_iface)
+		{
+			VulkanStreamOutput vk_output = {};
+			if (!resource_mapping_iface->remap_stream_output({ semantic_name.c_str(), semantic_index }, vk_output))
+				return false;
+			if (vk_output.enable)
+				continue;
+		}
+
+		stripped_output_elements.insert(element_id);
+	}
+
+	return true;
+}
+
+bool Converter::Impl::is_stripped_output_store(const llvm::Instruction &instruction) const
+{
+	if (stripped_output_elements.empty() || !value_is_dx_op_instrinsic(&instruction, DXIL::Op::StoreOutput))
+		return false;
+
+	uint32_t element_id;
+	return get_constant_operand(llvm::cast<llvm::CallInst>(&instruction), 1, &element_id) &&
+	       stripped_output_elements.count(element_id) != 0;
+}
+
+bool Converter::Impl::analyze_execution_modes_meta()
+{
+	auto *meta = entry_point_meta;
+
+	switch (execution_model)
+	{
+	case spv::ExecutionModelRayGenerationKHR:
+	case spv::ExecutionModelMissKHR:
+	case spv::ExecutionModelIntersectionKHR:
+	case spv::ExecutionModelAnyHitKHR:
+	case spv::ExecutionModelCallableKHR:
+	case spv::ExecutionModelClosestHitKHR:
+		if (auto *null_meta = get_null_entry_point_meta(bitcode_parser.get_module()))
+			meta = null_meta;
+		break;
 
 	default:
 		break;
@@ -5807,6 +6320,14 @@ bool Converter::Impl::emit_execution_modes()
 		break;
 	}
 
+	// Wave helpers only need to consider the part of a ballot which can be populated.
+	unsigned maximum_wave_size = options.subgroup_size.implementation_maximum;
+	if (options.force_subgroup_size)
+		maximum_wave_size = options.force_subgroup_size;
+	else if (execution_mode_meta.required_wave_size)
+		maximum_wave_size = std::min<unsigned>(maximum_wave_size, execution_mode_meta.required_wave_size);
+	spirv_module.set_maximum_subgroup_size(maximum_wave_size);
+
 	if (!emit_execution_modes_fp_denorm())
 		return false;
 
@@ -5817,6 +6338,8 @@ CFGNode *Converter::Impl::build_rov_main(llvm::Function *func, CFGNodePool &pool
                                          Vector<ConvertedFunction::LeafFunction> &leaves)
 {
 	auto *code_main = convert_function(func, pool);
+	if (is_cancelled())
+		return nullptr;
 
 	// Need to figure out if our ROV use is trivial. If not, we will wrap the entire function in ROV pairs.
 	CFGStructurizer cfg{code_main, pool, spirv_module};
@@ -5844,6 +6367,28 @@ CFGNode *Converter::Impl::build_rov_main(llvm::Function *func, CFGNodePool &pool
 	return entry;
 }
 
+static bool patch_constant_function_reads_output_control_points(const llvm::Function *func)
+{
+	for (auto &bb : *func)
+	{
+		for (auto &inst : bb)
+		{
+			auto *call_inst = llvm::dyn_cast<llvm::CallInst>(&inst);
+			if (!call_inst || is_llvm_intrinsic_callee(call_inst->getCalledFunction()))
+				continue;
+
+			// Be conservative with anything we cannot see through.
+			uint32_t opcode;
+			if (!is_dxil_op_callee(call_inst->getCalledFunction()) || !get_dxil_opcode(call_inst, &opcode))
+				return true;
+			if (DXIL::Op(opcode) == DXIL::Op::LoadOutputControlPoint)
+				return true;
+		}
+	}
+
+	return false;
+}
+
 CFGNode *Converter::Impl::build_hull_main(llvm::Function *func, CFGNodePool &pool,
                                           Vector<ConvertedFunction::LeafFunction> &leaves)
 {
@@ -5857,6 +6402,8 @@ CFGNode *Converter::Impl::build_hull_main(llvm::Function *func, CFGNodePool &poo
 	// Set build point so alloca() functions can create variables correctly.
 	builder().setBuildPoint(hull_entry);
 	auto *hull_main = convert_function(func, pool);
+	if (is_cancelled())
+		return nullptr;
 	builder().setBuildPoint(patch_entry);
 	auto *patch_main = convert_function(execution_mode_meta.patch_constant_function, pool);
 	builder().setBuildPoint(spirv_module.get_entry_function()->getEntryBlock());
@@ -5880,12 +6427,20 @@ CFGNode *Converter::Impl::build_hull_main(llvm::Function *func, CFGNodePool &poo
 		cmp_op->add_ids({ load_op->id, builder().makeUintConstant(0) });
 		entry->ir.operations.push_back(cmp_op);
 
-		auto *barrier_op = allocate(spv::OpControlBarrier);
-		// Not 100% sure what to emit here. Just do what glslang does.
-		barrier_op->add_id(builder().makeUintConstant(spv::ScopeWorkgroup));
-		barrier_op->add_id(builder().makeUintConstant(spv::ScopeInvocation));
-		barrier_op->add_id(builder().makeUintConstant(0));
-		entry->ir.operations.push_back(barrier_op);
+		// Outputs of other invocations are only observed through LoadOutputControlPoint.
+		// Without it, invocation 0 may run the patch constant phase as soon as it is done with its own control point.
+		bool needs_barrier = !options.hull_barrier_elision ||
+		                     patch_constant_function_reads_output_control_points(execution_mode_meta.patch_constant_function);
+
+		if (needs_barrier)
+		{
+			auto *barrier_op = allocate(spv::OpControlBarrier);
+			// Not 100% sure what to emit here. Just do what glslang does.
+			barrier_op->add_id(builder().makeUintConstant(spv::ScopeWorkgroup));
+			barrier_op->add_id(builder().makeUintConstant(spv::ScopeInvocation));
+			barrier_op->add_id(builder().makeUintConstant(0));
+			entry->ir.operations.push_back(barrier_op);
+		}
 
 		auto *patch_block = pool.create_node();
 		auto *merge_block = pool.create_node();
@@ -5919,8 +6474,80 @@ CFGNode *Converter::Impl::build_hull_main(llvm::Function *func, CFGNodePool &poo
 	return entry;
 }
 
+llvm::BasicBlock *Converter::Impl::get_static_branch_target(const llvm::Instruction *terminator)
+{
+	if (auto *inst = llvm::dyn_cast<llvm::BranchInst>(terminator))
+	{
+		if (!inst->isConditional())
+			return nullptr;
+
+		// Works around some pathological unrolling scenarios where games may unroll based on WaveGetLaneCount().
+		bool cond_value;
+		if (can_optimize_conditional_branch_to_static(*this, inst->getCondition(), cond_value))
+			return inst->getSuccessor(cond_value ? 0 : 1);
+
+		if (options.eliminate_dead_code)
+		{
+			if (auto *cond = llvm::dyn_cast<llvm::ConstantInt>(inst->getCondition()))
+				return inst->getSuccessor(cond->getUniqueInteger().getZExtValue() != 0 ? 0 : 1);
+		}
+	}
+	else if (auto *inst = llvm::dyn_cast<llvm::SwitchInst>(terminator))
+	{
+		uint64_t value;
+		auto *cond = llvm::dyn_cast<llvm::ConstantInt>(inst->getCondition());
+		if (cond && options.eliminate_dead_code)
+			value = cond->getUniqueInteger().getZExtValue();
+		else if (!evaluate_specialized_integer_value(*this, inst->getCondition(), value))
+			return nullptr;
+
+		for (auto itr = inst->case_begin(); itr != inst->case_end(); ++itr)
+			if (itr->getCaseValue()->getUniqueInteger().getZExtValue() == value)
+				return itr->getCaseSuccessor();
+		return inst->getDefaultDest();
+	}
+
+	return nullptr;
+}
+
+llvm::BasicBlock *Converter::Impl::resolve_forwarding_block(
+    llvm::BasicBlock *bb, const UnorderedMap<const llvm::BasicBlock *, unsigned> &pred_counts)
+{
+	// Skip over blocks which do nothing but branch somewhere else.
+	// Only consider blocks with one predecessor, so we never merge edges or introduce new back edges,
+	// and targets without PHIs, since PHI incoming blocks would have to be rewritten.
+	// Bound the walk in case of degenerate infinite loops.
+	for (unsigned hops = 0; hops < 16; hops++)
+	{
+		auto *inst = llvm::dyn_cast<llvm::BranchInst>(bb->getTerminator());
+		if (!inst || inst->isConditional() || &*bb->begin() != inst)
+			break;
+
+		// Loop metadata lives on the back edge, don't lose it.
+		if (inst->getMetadata("llvm.loop"))
+			break;
+
+		// Descriptor handles may be sunk into this block.
+		if (bb_to_sinks.count(bb))
+			break;
+
+		auto pred_itr = pred_counts.find(bb);
+		if (pred_itr == pred_counts.end() || pred_itr->second != 1)
+			break;
+
+		auto *target = inst->getSuccessor(0);
+		if (target == bb || llvm::isa<llvm::PHINode>(&*target->begin()))
+			break;
+
+		bb = target;
+	}
+
+	return bb;
+}
+
 CFGNode *Converter::Impl::convert_function(llvm::Function *func, CFGNodePool &pool)
 {
+	ScopedPhaseTimer timer(statistics, StatisticsPhase::ConvertFunction);
 	auto *entry = &func->getEntryBlock();
 	auto entry_meta = std::make_unique<BlockMeta>(entry);
 	bb_map[entry] = entry_meta.get();
@@ -5936,7 +6563,26 @@ CFGNode *Converter::Impl::convert_function(llvm::Function *func, CFGNodePool &po
 
 	unsigned fake_label_id = 0;
 
+	// With dead code elimination, empty forwarding blocks are skipped entirely.
+	UnorderedMap<const llvm::BasicBlock *, unsigned> pred_counts;
+	if (options.eliminate_dead_code)
+		for (auto &bb : *func)
+			for (auto itr = llvm::succ_begin(&bb); itr != llvm::succ_end(&bb); ++itr)
+				pred_counts[*itr]++;
+
+	const auto resolve_succ = [&](llvm::BasicBlock *succ) -> llvm::BasicBlock * {
+		if (options.eliminate_dead_code)
+			return resolve_forwarding_block(succ, pred_counts);
+		else
+			return succ;
+	};
+
+	const auto get_succ_node = [&](llvm::BasicBlock *succ) {
+		return bb_map[resolve_succ(succ)]->node;
+	};
+
 	const auto queue_visit_succ = [&](llvm::BasicBlock *block, llvm::BasicBlock *succ) {
+		succ = resolve_succ(succ);
 		if (!bb_map.count(succ))
 		{
 			to_process.push_back(succ);
@@ -5959,19 +6605,14 @@ CFGNode *Converter::Impl::convert_function(llvm::Function *func, CFGNodePool &po
 		{
 			visit_order.push_back(block);
 
-			auto *term = block->getTerminator();
-			if (auto *inst = llvm::dyn_cast<llvm::BranchInst>(term))
+			// Only the taken edge of a statically known branch is visited,
+			// so blocks which are only reachable through the other edges never enter the CFG.
+			if (auto *succ = get_static_branch_target(block->getTerminator()))
 			{
-				if (inst->isConditional())
-				{
-					bool cond_value;
-					if (can_optimize_conditional_branch_to_static(*this, inst->getCondition(), cond_value))
-					{
-						auto *succ = inst->getSuccessor(cond_value ? 0 : 1);
-						queue_visit_succ(block, succ);
-						continue;
-					}
-				}
+				if (options.eliminate_dead_code)
+					bb_static_succ[block] = resolve_succ(succ);
+				queue_visit_succ(block, succ);
+				continue;
 			}
 
 			for (auto itr = llvm::succ_begin(block); itr != llvm::succ_end(block); ++itr)
@@ -5993,9 +6634,7 @@ CFGNode *Converter::Impl::convert_function(llvm::Function *func, CFGNodePool &po
 		{
 			for (auto *instruction : sink_itr->second)
 			{
-				auto itr = value_map.find(instruction);
-				if (itr != value_map.end())
-					value_map.erase(itr);
+				value_map.erase(instruction);
 
 				if (!emit_instruction(node, *instruction))
 				{
@@ -6005,6 +6644,12 @@ CFGNode *Converter::Impl::convert_function(llvm::Function *func, CFGNodePool &po
 			}
 		}
 
+		if (thread_allocator_limit_exceeded())
+		{
+			LOGE("Thread allocator limit exceeded while converting function.\n");
+			return {};
+		}
+
 		// Scan opcodes.
 		for (auto &instruction : *bb)
 		{
@@ -6062,20 +6707,25 @@ CFGNode *Converter::Impl::convert_function(llvm::Function *func, CFGNodePool &po
 
 			if (inst->isConditional())
 			{
-				// Works around some pathological unrolling scenarios where games may unroll based on WaveGetLaneCount().
-				bool cond_value;
-				if (can_optimize_conditional_branch_to_static(*this, inst->getCondition(), cond_value))
+				assert(inst->getNumSuccessors() == 2);
+				auto *static_succ = get_static_branch_target(inst);
+
+				// Forwarding blocks may have been skipped so that both sides end up in the same place.
+				if (!static_succ && options.eliminate_dead_code &&
+				    get_succ_node(inst->getSuccessor(0)) == get_succ_node(inst->getSuccessor(1)))
+					static_succ = inst->getSuccessor(0);
+
+				if (static_succ)
 				{
 					node->ir.terminator.type = Terminator::Type::Branch;
-					node->ir.terminator.direct_block = bb_map[inst->getSuccessor(cond_value ? 0 : 1)]->node;
+					node->ir.terminator.direct_block = get_succ_node(static_succ);
 				}
 				else
 				{
 					node->ir.terminator.type = Terminator::Type::Condition;
 					node->ir.terminator.conditional_id = get_id_for_value(inst->getCondition());
-					assert(inst->getNumSuccessors() == 2);
-					node->ir.terminator.true_block = bb_map[inst->getSuccessor(0)]->node;
-					node->ir.terminator.false_block = bb_map[inst->getSuccessor(1)]->node;
+					node->ir.terminator.true_block = get_succ_node(inst->getSuccessor(0));
+					node->ir.terminator.false_block = get_succ_node(inst->getSuccessor(1));
 
 					if (options.branch_control.use_shader_metadata)
 					{
@@ -6100,7 +6750,7 @@ CFGNode *Converter::Impl::convert_function(llvm::Function *func, CFGNodePool &po
 			{
 				node->ir.terminator.type = Terminator::Type::Branch;
 				assert(inst->getNumSuccessors() == 1);
-				node->ir.terminator.direct_block = bb_map[inst->getSuccessor(0)]->node;
+				node->ir.terminator.direct_block = get_succ_node(inst->getSuccessor(0));
 
 				// If the shader uses partial unrolling, but we see loops anyway,
 				// it's very likely we really want this to be a loop.
@@ -6110,20 +6760,26 @@ CFGNode *Converter::Impl::convert_function(llvm::Function *func, CFGNodePool &po
 					node->ir.terminator.force_loop = true;
 			}
 		}
+		else if (auto *static_succ = get_static_branch_target(instruction))
+		{
+			// Switch on a known constant.
+			node->ir.terminator.type = Terminator::Type::Branch;
+			node->ir.terminator.direct_block = get_succ_node(static_succ);
+		}
 		else if (auto *inst = llvm::dyn_cast<llvm::SwitchInst>(instruction))
 		{
 			node->ir.terminator.type = Terminator::Type::Switch;
 
 			Terminator::Case default_case = {};
 			default_case.is_default = true;
-			default_case.node = bb_map[inst->getDefaultDest()]->node;
+			default_case.node = get_succ_node(inst->getDefaultDest());
 			node->ir.terminator.cases.push_back(default_case);
 
 			node->ir.terminator.conditional_id = get_id_for_value(inst->getCondition());
 			for (auto itr = inst->case_begin(); itr != inst->case_end(); ++itr)
 			{
 				Terminator::Case switch_case = {};
-				switch_case.node = bb_map[itr->getCaseSuccessor()]->node;
+				switch_case.node = get_succ_node(itr->getCaseSuccessor());
 				switch_case.value = uint32_t(itr->getCaseValue()->getUniqueInteger().getZExtValue());
 				node->ir.terminator.cases.push_back(switch_case);
 			}
@@ -6211,6 +6867,69 @@ void Converter::Impl::mark_used_values(const llvm::Instruction *instruction)
 	}
 }
 
+void Converter::Impl::propagate_used_values(const llvm::Function *function)
+{
+	// mark_used_values() only removes leaf instructions. When stores are dropped,
+	// whole expression trees die, so recompute liveness transitively for this function.
+	UnorderedSet<const llvm::Value *> live;
+	Vector<const llvm::Instruction *> worklist;
+
+	auto mark_live = [&](const llvm::Value *value) {
+		if (auto *inst = llvm::dyn_cast<llvm::Instruction>(value))
+			if (live.insert(inst).second)
+				worklist.push_back(inst);
+	};
+
+	for (auto &bb : *function)
+	{
+		auto *terminator = bb.getTerminator();
+		if (auto *branch = llvm::dyn_cast<llvm::BranchInst>(terminator))
+		{
+			if (branch->isConditional())
+				mark_live(branch->getCondition());
+		}
+		else if (auto *switch_inst = llvm::dyn_cast<llvm::SwitchInst>(terminator))
+			mark_live(switch_inst->getCondition());
+		else if (auto *ret = llvm::dyn_cast<llvm::ReturnInst>(terminator))
+		{
+			if (ret->getReturnValue())
+				mark_live(ret->getReturnValue());
+		}
+
+		for (auto &inst : bb)
+			if (!inst.isTerminator() && instruction_has_side_effects(inst) && !is_stripped_output_store(inst))
+				mark_live(&inst);
+	}
+
+	while (!worklist.empty())
+	{
+		auto *inst = worklist.back();
+		worklist.pop_back();
+
+		// PHI incoming values are not regular operands.
+		if (auto *phi_inst = llvm::dyn_cast<llvm::PHINode>(inst))
+		{
+			for (unsigned i = 0, n = phi_inst->getNumIncomingValues(); i < n; i++)
+				mark_live(phi_inst->getIncomingValue(i));
+		}
+		else
+		{
+			for (unsigned i = 0, n = inst->getNumOperands(); i < n; i++)
+				mark_live(inst->getOperand(i));
+		}
+
+		// A coalesced load reads its result from the leader load.
+		auto itr = llvm_composite_meta.find(inst);
+		if (itr != llvm_composite_meta.end() && itr->second.coalesced_load)
+			mark_live(itr->second.coalesced_load);
+	}
+
+	for (auto &bb : *function)
+		for (auto &inst : bb)
+			if (!live.count(&inst))
+				llvm_used_ssa_values.erase(&inst);
+}
+
 static bool instruction_is_precise_sensitive(const llvm::Instruction *value)
 {
 	if (auto *binary_op = llvm::dyn_cast<llvm::BinaryOperator>(value))
@@ -6251,146 +6970,907 @@ static bool instruction_requires_no_contraction(const llvm::Instruction *value)
 			return llvm::cast<llvm::CallInst>(value)->hasMetadata("dx.precise");
 	}
 
-	return false;
-}
+	return false;
+}
+
+static void propagate_precise(UnorderedSet<const llvm::Instruction *> &cache,
+                              UnorderedSet<const llvm::Instruction *> &marked,
+                              const llvm::Instruction *value);
+
+static void mark_precise(UnorderedSet<const llvm::Instruction *> &cache,
+                         UnorderedSet<const llvm::Instruction *> &marked,
+                         const llvm::Value *value)
+{
+	// Stop propagating when we hit something not an instruction, i.e. a constant or variable (alloca is very rare).
+	if (auto *inst = llvm::dyn_cast<llvm::Instruction>(value))
+	{
+		if (instruction_is_precise_sensitive(inst) && !instruction_requires_no_contraction(inst))
+			marked.insert(inst);
+
+		propagate_precise(cache, marked, inst);
+	}
+}
+
+static void propagate_precise(UnorderedSet<const llvm::Instruction *> &cache,
+                              UnorderedSet<const llvm::Instruction *> &marked,
+                              const llvm::Instruction *value)
+{
+	if (cache.count(value) != 0)
+		return;
+	cache.insert(value);
+
+	if (const auto *phi = llvm::dyn_cast<llvm::PHINode>(value))
+	{
+		for (unsigned i = 0, n = phi->getNumIncomingValues(); i < n; i++)
+			mark_precise(cache, marked, phi->getIncomingValue(i));
+	}
+	else
+	{
+		for (unsigned i = 0, n = value->getNumOperands(); i < n; i++)
+			mark_precise(cache, marked, value->getOperand(i));
+	}
+}
+
+static void propagate_precise(const llvm::Function *function, UnorderedSet<const llvm::Instruction *> &marked)
+{
+	Vector<const llvm::Instruction *> precise_instructions;
+	for (auto &bb : *function)
+		for (auto &inst : bb)
+			if (instruction_requires_no_contraction(&inst))
+				precise_instructions.push_back(&inst);
+
+	UnorderedSet<const llvm::Instruction *> visitation_cache;
+	for (auto *inst : precise_instructions)
+		propagate_precise(visitation_cache, marked, inst);
+}
+
+bool Converter::Impl::instruction_is_precise(const llvm::CallInst *instruction) const
+{
+	return options.force_precise || instruction->hasMetadata("dx.precise") ||
+	       propagated_precise_instructions.count(instruction) != 0;
+}
+
+bool Converter::Impl::instruction_is_fast_math(const llvm::BinaryOperator *instruction) const
+{
+	return instruction->isFast() && propagated_precise_instructions.count(instruction) == 0;
+}
+
+static bool collect_fp16_narrowable_chain(const Converter::Impl &impl, const llvm::Value *value,
+                                          const UnorderedMap<const llvm::Value *, unsigned> &use_counts,
+                                          Vector<const llvm::Value *> &chain, unsigned depth)
+{
+	if (value->getType()->getTypeID() != llvm::Type::TypeID::FloatTyID)
+		return false;
+
+	if (auto *constant = llvm::dyn_cast<llvm::ConstantFP>(value))
+	{
+		uint16_t bits;
+		return float_to_exact_fp16(constant->getValueAPF().convertToFloat(), &bits);
+	}
+
+	if (auto *cast_inst = llvm::dyn_cast<llvm::CastInst>(value))
+	{
+		return cast_inst->getOpcode() == llvm::Instruction::CastOps::FPExt &&
+		       cast_inst->getOperand(0)->getType()->getTypeID() == llvm::Type::TypeID::HalfTyID;
+	}
+
+	auto *binop = llvm::dyn_cast<llvm::BinaryOperator>(value);
+	if (!binop || depth >= 8)
+		return false;
+
+	auto opcode = binop->getOpcode();
+	if (opcode != llvm::BinaryOperator::BinaryOps::FAdd &&
+	    opcode != llvm::BinaryOperator::BinaryOps::FSub &&
+	    opcode != llvm::BinaryOperator::BinaryOps::FMul)
+	{
+		return false;
+	}
+
+	// The FP32 result must not be observable anywhere else.
+	auto itr = use_counts.find(binop);
+	if (itr == use_counts.end() || itr->second != 1)
+		return false;
+
+	if (impl.options.force_precise || !impl.instruction_is_fast_math(binop))
+		return false;
+
+	size_t chain_size = chain.size();
+	if (!collect_fp16_narrowable_chain(impl, binop->getOperand(0), use_counts, chain, depth + 1) ||
+	    !collect_fp16_narrowable_chain(impl, binop->getOperand(1), use_counts, chain, depth + 1))
+	{
+		chain.resize(chain_size);
+		return false;
+	}
+
+	chain.push_back(binop);
+	return true;
+}
+
+void Converter::Impl::analyze_min_precision_narrowing(const llvm::Function *function)
+{
+	// DXC computes min precision expressions which involve FP32 intermediates as
+	// FPTrunc(op(FPExt(a), FPExt(b))). Min precision allows any precision of at least FP16,
+	// so evaluate such trees in FP16 directly, leaving only conversions at real boundaries.
+	UnorderedMap<const llvm::Value *, unsigned> use_counts;
+	for (auto &bb : *function)
+	{
+		for (auto &inst : bb)
+		{
+			if (auto *phi = llvm::dyn_cast<llvm::PHINode>(&inst))
+			{
+				for (unsigned i = 0; i < phi->getNumIncomingValues(); i++)
+					use_counts[phi->getIncomingValue(i)]++;
+			}
+			else
+			{
+				for (unsigned i = 0; i < inst.getNumOperands(); i++)
+					use_counts[inst.getOperand(i)]++;
+			}
+		}
+	}
+
+	Vector<const llvm::Value *> chain;
+	UnorderedMap<const llvm::Value *, unsigned> narrowed_uses;
+
+	for (auto &bb : *function)
+	{
+		for (auto &inst : bb)
+		{
+			auto *cast_inst = llvm::dyn_cast<llvm::CastInst>(&inst);
+			if (!cast_inst || cast_inst->getOpcode() != llvm::Instruction::CastOps::FPTrunc ||
+			    cast_inst->getType()->getTypeID() != llvm::Type::TypeID::HalfTyID ||
+			    !llvm::isa<llvm::BinaryOperator>(cast_inst->getOperand(0)))
+			{
+				continue;
+			}
+
+			chain.clear();
+			if (collect_fp16_narrowable_chain(*this, cast_inst->getOperand(0), use_counts, chain, 0))
+			{
+				fp16_narrowed_values.insert(chain.begin(), chain.end());
+				fp16_narrowed_values.insert(cast_inst);
+
+				for (auto *value : chain)
+				{
+					auto *binop = llvm::cast<llvm::BinaryOperator>(value);
+					for (unsigned i = 0; i < 2; i++)
+						if (llvm::isa<llvm::CastInst>(binop->getOperand(i)))
+							narrowed_uses[binop->getOperand(i)]++;
+				}
+			}
+		}
+	}
+
+	// FPExt which only feeds narrowed arithmetic is not needed at all.
+	for (auto &ext : narrowed_uses)
+		if (use_counts[ext.first] == ext.second)
+			fp16_narrowed_values.insert(ext.first);
+}
+
+struct CoalescableRawLoad
+{
+	const llvm::CallInst *instruction;
+	const llvm::Value *handle;
+	const llvm::Value *index;
+	uint32_t offset;
+	bool byte_address;
+};
+
+static bool get_coalescable_raw_load(const Converter::Impl &impl, const llvm::CallInst *instruction,
+                                     CoalescableRawLoad &load)
+{
+	uint32_t opcode, mask;
+	if (!get_dxil_opcode(instruction, &opcode) || DXIL::Op(opcode) != DXIL::Op::RawBufferLoad)
+		return false;
+	if (!get_constant_operand(instruction, 4, &mask) || mask != 1)
+		return false;
+
+	auto *element_type = instruction->getType()->getStructElementType(0);
+	if (element_type->getTypeID() != llvm::Type::TypeID::FloatTyID &&
+	    !(element_type->getTypeID() == llvm::Type::TypeID::IntegerTyID &&
+	      element_type->getIntegerBitWidth() == 32))
+	{
+		return false;
+	}
+
+	// Only plain scalar reads which are consumed by ExtractValue.
+	// Anything else (sparse feedback, PHI of the struct) needs the real composite.
+	auto itr = impl.llvm_composite_meta.find(instruction);
+	if (itr == impl.llvm_composite_meta.end() || itr->second.access_mask != 1 || itr->second.forced_struct)
+		return false;
+
+	load.instruction = instruction;
+	load.handle = instruction->getOperand(1);
+	load.byte_address = llvm::isa<llvm::UndefValue>(instruction->getOperand(3));
+
+	if (load.byte_address)
+	{
+		// Peel off a constant byte offset, i.e. (base + C).
+		auto *address = instruction->getOperand(2);
+		load.index = address;
+		load.offset = 0;
+
+		if (auto *const_address = llvm::dyn_cast<llvm::ConstantInt>(address))
+		{
+			load.index = nullptr;
+			load.offset = uint32_t(const_address->getUniqueInteger().getZExtValue());
+		}
+		else if (auto *binop = llvm::dyn_cast<llvm::BinaryOperator>(address))
+		{
+			if (binop->getOpcode() == llvm::BinaryOperator::BinaryOps::Add)
+			{
+				if (auto *const_rhs = llvm::dyn_cast<llvm::ConstantInt>(binop->getOperand(1)))
+				{
+					load.index = binop->getOperand(0);
+					load.offset = uint32_t(const_rhs->getUniqueInteger().getZExtValue());
+				}
+				else if (auto *const_lhs = llvm::dyn_cast<llvm::ConstantInt>(binop->getOperand(0)))
+				{
+					load.index = binop->getOperand(1);
+					load.offset = uint32_t(const_lhs->getUniqueInteger().getZExtValue());
+				}
+			}
+		}
+	}
+	else
+	{
+		auto *const_offset = llvm::dyn_cast<llvm::ConstantInt>(instruction->getOperand(3));
+		if (!const_offset)
+			return false;
+		load.index = instruction->getOperand(2);
+		load.offset = uint32_t(const_offset->getUniqueInteger().getZExtValue());
+	}
+
+	return (load.offset & 3) == 0;
+}
+
+void Converter::Impl::coalesce_raw_buffer_loads(const llvm::BasicBlock *bb)
+{
+	// DXC tends to split struct member reads into one scalar RawBufferLoad per member.
+	// Fold runs of such loads at consecutive offsets from the same handle into the first load of the run.
+	// Followers are only folded forward, and we never fold across anything that may write memory,
+	// so the wider load observes the same values as the individual loads would have.
+	Vector<CoalescableRawLoad> leaders;
+
+	for (auto &inst : *bb)
+	{
+		auto *call_inst = llvm::dyn_cast<llvm::CallInst>(&inst);
+		bool is_dxil_call = call_inst && is_dxil_op_callee(call_inst->getCalledFunction());
+
+		CoalescableRawLoad load;
+		if (is_dxil_call && get_coalescable_raw_load(*this, call_inst, load))
+		{
+			auto leader_itr = std::find_if(leaders.begin(), leaders.end(), [&](const CoalescableRawLoad &leader) {
+				return leader.handle == load.handle && leader.index == load.index &&
+				       leader.byte_address == load.byte_address &&
+				       leader.instruction->getType() == load.instruction->getType() &&
+				       load.offset >= leader.offset && load.offset - leader.offset < 16;
+			});
+
+			if (leader_itr != leaders.end())
+			{
+				unsigned component = (load.offset - leader_itr->offset) / 4;
+
+				auto &follower_meta = llvm_composite_meta[load.instruction];
+				follower_meta.coalesced_load = leader_itr->instruction;
+				follower_meta.coalesced_component = component;
+
+				auto &leader_meta = llvm_composite_meta[leader_itr->instruction];
+				leader_meta.access_mask |= 1u << component;
+				leader_meta.components = std::max<unsigned>(leader_meta.components, component + 1);
+				leader_meta.coalesced_width = leader_meta.components;
+			}
+			else
+				leaders.push_back(load);
+		}
+		else if (instruction_has_side_effects(inst))
+			leaders.clear();
+	}
+}
+
+static bool mesh_output_operands_match(const llvm::Value *a, const llvm::Value *b)
+{
+	if (a == b)
+		return true;
+
+	auto *const_a = llvm::dyn_cast<llvm::ConstantInt>(a);
+	auto *const_b = llvm::dyn_cast<llvm::ConstantInt>(b);
+	return const_a && const_b &&
+	       const_a->getUniqueInteger().getZExtValue() == const_b->getUniqueInteger().getZExtValue();
+}
+
+void Converter::Impl::coalesce_mesh_output_stores(const llvm::BasicBlock *bb)
+{
+	// Mesh shaders write outputs one scalar at a time. When a run of stores covers a full row,
+	// defer the run to its last store and write the row as one vector.
+	// Nothing in a mesh shader can observe outputs between the individual stores,
+	// but stay conservative and never group across other side effects.
+	struct Run
+	{
+		Vector<const llvm::CallInst *> stores;
+		const llvm::Value *values[4];
+		uint32_t opcode;
+		uint32_t element;
+		uint32_t column_mask;
+	} run = {};
+
+	auto flush_run = [&]() {
+		unsigned count = unsigned(run.stores.size());
+		if (count >= 2 && run.column_mask == (1u << count) - 1u)
+		{
+			MeshOutputStoreGroup group = {};
+			group.last_store = run.stores.back();
+			group.count = count;
+			std::copy(run.values, run.values + count, group.values);
+
+			auto group_index = uint32_t(mesh_output_store_groups.size());
+			mesh_output_store_groups.push_back(group);
+			for (auto *store : run.stores)
+				mesh_output_store_to_group[store] = group_index;
+		}
+
+		run.stores.clear();
+		run.column_mask = 0;
+	};
+
+	for (auto &inst : *bb)
+	{
+		auto *call_inst = llvm::dyn_cast<llvm::CallInst>(&inst);
+		uint32_t opcode = 0, element = 0, column = 0;
+
+		bool is_output_store =
+		    call_inst && get_dxil_opcode(call_inst, &opcode) &&
+		    (DXIL::Op(opcode) == DXIL::Op::StoreVertexOutput || DXIL::Op(opcode) == DXIL::Op::StorePrimitiveOutput) &&
+		    get_constant_operand(call_inst, 1, &element) &&
+		    get_constant_operand(call_inst, 3, &column) && column < 4;
+
+		if (is_output_store)
+		{
+			bool extends_run = !run.stores.empty() && run.opcode == opcode && run.element == element &&
+			                   (run.column_mask & (1u << column)) == 0 &&
+			                   mesh_output_operands_match(run.stores.front()->getOperand(2), call_inst->getOperand(2)) &&
+			                   mesh_output_operands_match(run.stores.front()->getOperand(5), call_inst->getOperand(5)) &&
+			                   run.stores.front()->getOperand(4)->getType() == call_inst->getOperand(4)->getType();
+
+			if (!extends_run)
+			{
+				flush_run();
+				run.opcode = opcode;
+				run.element = element;
+			}
+
+			run.stores.push_back(call_inst);
+			run.values[column] = call_inst->getOperand(4);
+			run.column_mask |= 1u << column;
+		}
+		else if (instruction_has_side_effects(inst))
+			flush_run();
+	}
+
+	flush_run();
+}
+
+bool Converter::Impl::analyze_instructions(const llvm::Function *function)
+{
+	ScopedPhaseTimer timer(statistics, StatisticsPhase::AnalyzeInstructions);
+
+	// Need to analyze this in two stages.
+	// In the first stage, we need to analyze:
+	// - Load/GetElementPtr to handle lib global variables
+	// - CreateHandle family to build LLVM access handles
+	// - ExtractValue to track which components are used for BufferLoad.
+	// In the second phase we analyze the buffer loads and stores and figure out
+	// alignments of the loads and stores. This lets us build up a list of SSBO declarations we need to
+	// optimally implement the loads and stores. We need to do this late, because we depend on results
+	// of ExtractValue analysis.
+
+	if (options.propagate_precise && !options.force_precise)
+		propagate_precise(function, propagated_precise_instructions);
+
+	// Needs precise propagation to be done.
+	if (options.min_precision_narrowing && support_16bit_operations() && !execution_mode_meta.native_16bit_operations)
+		analyze_min_precision_narrowing(function);
+
+	// The second stage only cares about a handful of opcodes, so remember them here rather than
+	// walking every instruction again. nullptr marks the end of a block's calls.
+	Vector<const llvm::CallInst *> buffer_access_calls;
+
+	for (auto &bb : *function)
+	{
+		size_t num_buffer_access_calls = buffer_access_calls.size();
+
+		if (options.eliminate_dead_code)
+			mark_used_values(bb.getTerminator());
+
+		for (auto &inst : bb)
+		{
+			if (options.eliminate_dead_code)
+				mark_used_values(&inst);
+
+			if (auto *load_inst = llvm::dyn_cast<llvm::LoadInst>(&inst))
+			{
+				if (!analyze_load_instruction(*this, load_inst))
+					return false;
+			}
+			else if (auto *phi_inst = llvm::dyn_cast<llvm::PHINode>(&inst))
+			{
+				if (!analyze_phi_instruction(*this, phi_inst))
+					return false;
+			}
+			else if (auto *store_inst = llvm::dyn_cast<llvm::StoreInst>(&inst))
+			{
+				if (!analyze_store_instruction(*this, store_inst))
+					return false;
+			}
+			else if (auto *getelementptr_inst = llvm::dyn_cast<llvm::GetElementPtrInst>(&inst))
+			{
+				if (!analyze_getelementptr_instruction(*this, getelementptr_inst))
+					return false;
+			}
+			else if (auto *extractvalue_inst = llvm::dyn_cast<llvm::ExtractValueInst>(&inst))
+			{
+				if (!analyze_extractvalue_instruction(*this, extractvalue_inst))
+					return false;
+			}
+			else if (auto *cmp_inst = llvm::dyn_cast<llvm::CmpInst>(&inst))
+			{
+				if (!analyze_compare_instruction(*this, cmp_inst))
+					return false;
+			}
+			else if (auto *call_inst = llvm::dyn_cast<llvm::CallInst>(&inst))
+			{
+				auto *called_function = call_inst->getCalledFunction();
+				if (is_dxil_op_callee(called_function))
+				{
+					if (!analyze_dxil_instruction(*this, call_inst, &bb))
+						return false;
+					if (dxil_instruction_needs_buffer_access_analysis(call_inst))
+						buffer_access_calls.push_back(call_inst);
+				}
+			}
+		}
+
+		// The first marker also clears AGS state left over from the first stage.
+		if (buffer_access_calls.size() != num_buffer_access_calls || &bb == &function->getEntryBlock())
+			buffer_access_calls.push_back(nullptr);
+	}
+
+	if (options.ray_payload_liveness && !needs_temp_storage_copy.empty())
+		analyze_ray_payload_liveness(function);
+
+	// Must happen after opcode analysis, which moves payload allocas out of Function storage.
+	if (options.alloca_scalarization)
+		analyze_alloca_scalarization(function);
+
+	// Must happen before buffer access analysis, since widened loads affect alignment and vectorization.
+	if (options.buffer_load_coalescing)
+		for (auto &bb : *function)
+			coalesce_raw_buffer_loads(&bb);
+
+	if (execution_model == spv::ExecutionModelMeshEXT && options.mesh_output_store_coalescing)
+		for (auto &bb : *function)
+			coalesce_mesh_output_stores(&bb);
+
+	if (options.eliminate_dead_code && !stripped_output_elements.empty())
+		propagate_used_values(function);
+
+	for (auto *call_inst : buffer_access_calls)
+	{
+		if (call_inst)
+		{
+			if (!analyze_dxil_buffer_access_instruction(*this, call_inst))
+				return false;
+		}
+		else
+		{
+			// Reset AGS tracking for every BB.
+			ags.phases = 0;
+		}
+	}
+
+	return true;
+}
+
+void Converter::Impl::analyze_ray_payload_liveness(const llvm::Function *function)
+{
+	// Payload allocas which are used with both TraceRay and CallShader live in Function storage
+	// and are copied to a temporary around every call. Figure out which struct members are actually
+	// defined before each call and read after it. Any use we cannot reason about falls back to a full copy.
+	struct PayloadAccess
+	{
+		const llvm::BasicBlock *bb;
+		unsigned position;
+		uint64_t read_mask;
+		uint64_t write_mask;
+		const llvm::CallInst *call;
+	};
+
+	struct PayloadInfo
+	{
+		uint64_t all_members;
+		bool escapes;
+		Vector<PayloadAccess> accesses;
+	};
+
+	UnorderedMap<const llvm::Value *, PayloadInfo> payloads;
+	// Maps member pointers (and lifetime marker casts, with member ~0u) to their payload.
+	UnorderedMap<const llvm::Value *, std::pair<const llvm::Value *, unsigned>> member_pointers;
+
+	for (auto &bb : *function)
+	{
+		for (auto &inst : bb)
+		{
+			auto *alloca_inst = llvm::dyn_cast<llvm::AllocaInst>(&inst);
+			if (!alloca_inst || !needs_temp_storage_copy.count(alloca_inst))
+				continue;
+
+			auto *type = alloca_inst->getType()->getPointerElementType();
+			if (type->getTypeID() != llvm::Type::TypeID::StructTyID || type->getStructNumElements() > 64)
+				continue;
+
+			unsigned num_members = type->getStructNumElements();
+			payloads[alloca_inst] = { num_members == 64 ? ~0ull : ((1ull << num_members) - 1ull), false, {} };
+		}
+	}
+
+	if (payloads.empty())
+		return;
+
+	const auto lookup = [&](const llvm::Value *value, uint64_t &mask) -> PayloadInfo * {
+		auto itr = payloads.find(value);
+		if (itr != payloads.end())
+		{
+			mask = itr->second.all_members;
+			return &itr->second;
+		}
+
+		auto member_itr = member_pointers.find(value);
+		if (member_itr != member_pointers.end())
+		{
+			auto &info = payloads[member_itr->second.first];
+			mask = member_itr->second.second == ~0u ? 0 : (1ull << member_itr->second.second);
+			return &info;
+		}
+
+		return nullptr;
+	};
+
+	for (auto &bb : *function)
+	{
+		unsigned position = 0;
+		for (auto &inst : bb)
+		{
+			position++;
+			uint64_t mask = 0;
+
+			if (auto *gep = llvm::dyn_cast<llvm::GetElementPtrInst>(&inst))
+			{
+				if (auto *info = lookup(gep->getOperand(0), mask))
+				{
+					auto *base = gep->getOperand(0);
+					auto *index = gep->getNumOperands() >= 3 ? llvm::dyn_cast<llvm::ConstantInt>(gep->getOperand(2)) : nullptr;
+
+					if (payloads.count(base))
+					{
+						if (index && index->getUniqueInteger().getZExtValue() < 64 &&
+						    ((1ull << index->getUniqueInteger().getZExtValue()) & info->all_members) != 0)
+						{
+							member_pointers[gep] = { base, unsigned(index->getUniqueInteger().getZExtValue()) };
+						}
+						else
+							info->escapes = true;
+					}
+					else if (mask != 0)
+					{
+						auto member = member_pointers[base];
+						member_pointers[gep] = member;
+					}
+					else
+						info->escapes = true;
+				}
+				continue;
+			}
+			else if (auto *load_inst = llvm::dyn_cast<llvm::LoadInst>(&inst))
+			{
+				if (auto *info = lookup(load_inst->getPointerOperand(), mask))
+				{
+					if (mask != 0)
+						info->accesses.push_back({ &bb, position, mask, 0, nullptr });
+					else
+						info->escapes = true;
+				}
+				continue;
+			}
+			else if (auto *store_inst = llvm::dyn_cast<llvm::StoreInst>(&inst))
+			{
+				if (auto *info = lookup(store_inst->getOperand(0), mask))
+					info->escapes = true;
+				if (auto *info = lookup(store_inst->getOperand(1), mask))
+				{
+					if (mask != 0)
+						info->accesses.push_back({ &bb, position, 0, mask, nullptr });
+					else
+						info->escapes = true;
+				}
+				continue;
+			}
+			else if (auto *cast_inst = llvm::dyn_cast<llvm::CastInst>(&inst))
+			{
+				// Only tolerated as an argument to lifetime markers.
+				auto *base = cast_inst->getOperand(0);
+				if (payloads.count(base))
+					member_pointers[cast_inst] = { base, ~0u };
+				else if (auto *info = lookup(base, mask))
+					info->escapes = true;
+				continue;
+			}
+			else if (auto *call_inst = llvm::dyn_cast<llvm::CallInst>(&inst))
+			{
+				auto *called_function = call_inst->getCalledFunction();
+				unsigned payload_operand = 0;
+
+				uint32_t opcode;
+				if (is_dxil_op_callee(called_function) && get_dxil_opcode(call_inst, &opcode))
+				{
+					if (DXIL::Op(opcode) == DXIL::Op::TraceRay)
+						payload_operand = 15;
+					else if (DXIL::Op(opcode) == DXIL::Op::CallShader)
+						payload_operand = 2;
+				}
+
+				bool is_lifetime = is_llvm_intrinsic_callee(called_function) &&
+				                   strncmp(called_function->getName().data(), "llvm.lifetime", 13) == 0;
+
+				for (unsigned i = 0; i < call_inst->getNumOperands(); i++)
+				{
+					auto *info = lookup(call_inst->getOperand(i), mask);
+					if (!info)
+						continue;
+
+					if (i == payload_operand && payloads.count(call_inst->getOperand(i)))
+						info->accesses.push_back({ &bb, position, 0, 0, call_inst });
+					else if (!is_lifetime || mask != 0)
+						info->escapes = true;
+				}
+				continue;
+			}
+
+			for (unsigned i = 0; i < inst.getNumOperands(); i++)
+				if (auto *info = lookup(inst.getOperand(i), mask))
+					info->escapes = true;
+		}
+	}
+
+	// Blocks reachable through at least one edge from a given block.
+	UnorderedMap<const llvm::BasicBlock *, UnorderedSet<const llvm::BasicBlock *>> reachable;
+	const auto get_reachable = [&](const llvm::BasicBlock *bb) -> const UnorderedSet<const llvm::BasicBlock *> & {
+		auto itr = reachable.find(bb);
+		if (itr != reachable.end())
+			return itr->second;
+
+		auto &result = reachable[bb];
+		Vector<const llvm::BasicBlock *> stack;
+		for (auto succ_itr = llvm::succ_begin(bb); succ_itr != llvm::succ_end(bb); ++succ_itr)
+			stack.push_back(*succ_itr);
 
-static void propagate_precise(UnorderedSet<const llvm::Instruction *> &cache, const llvm::Instruction *value);
+		while (!stack.empty())
+		{
+			auto *next = stack.back();
+			stack.pop_back();
+			if (!result.insert(next).second)
+				continue;
+			for (auto succ_itr = llvm::succ_begin(next); succ_itr != llvm::succ_end(next); ++succ_itr)
+				stack.push_back(*succ_itr);
+		}
 
-static void mark_precise(UnorderedSet<const llvm::Instruction *> &cache, const llvm::Value *value)
-{
-	// Stop propagating when we hit something not an instruction, i.e. a constant or variable (alloca is very rare).
-	if (auto *inst = llvm::dyn_cast<llvm::Instruction>(value))
+		return result;
+	};
+
+	// Whether "from" may execute before "to" in the same invocation of the function.
+	const auto may_precede = [&](const PayloadAccess &from, const PayloadAccess &to) -> bool {
+		if (from.bb == to.bb && from.position < to.position)
+			return true;
+		return get_reachable(from.bb).count(to.bb) != 0;
+	};
+
+	for (auto &payload : payloads)
 	{
-		if (instruction_is_precise_sensitive(inst) && !instruction_requires_no_contraction(inst))
+		auto &info = payload.second;
+		if (info.escapes)
+			continue;
+
+		for (auto &call : info.accesses)
 		{
-			if (auto *call_inst = llvm::dyn_cast<llvm::CallInst>(inst))
-				const_cast<llvm::CallInst *>(call_inst)->setMetadata("dx.precise", nullptr);
-			else if (auto *binary_op = llvm::dyn_cast<llvm::BinaryOperator>(inst))
-				const_cast<llvm::BinaryOperator *>(binary_op)->setFast(false);
-		}
+			if (!call.call)
+				continue;
+
+			PayloadCopyMasks masks = {};
+			for (auto &access : info.accesses)
+			{
+				// Any call can write or read any member, so another call on either side keeps everything live.
+				if (may_precede(access, call))
+					masks.copy_in |= access.call ? info.all_members : access.write_mask;
+				if (may_precede(call, access))
+					masks.copy_out |= access.call ? info.all_members : access.read_mask;
+			}
 
-		propagate_precise(cache, inst);
+			if (masks.copy_in != info.all_members || masks.copy_out != info.all_members)
+				payload_copy_masks[call.call] = masks;
+		}
 	}
 }
 
-static void propagate_precise(UnorderedSet<const llvm::Instruction *> &cache, const llvm::Instruction *value)
+void Converter::Impl::analyze_alloca_scalarization(const llvm::Function *function)
 {
-	if (cache.count(value) != 0)
-		return;
-	cache.insert(value);
+	// Local arrays end up in scratch memory on many drivers, even when every access uses a constant index.
+	// If an array of scalars is only ever accessed through element pointers, split it into one variable
+	// per element, which drivers trivially promote to SSA. Small arrays with dynamic indices are
+	// accessed through select chains instead.
+	constexpr unsigned MaxScalarizedElements = 64;
+	constexpr unsigned MaxDynamicallyIndexedElements = 8;
 
-	if (const auto *phi = llvm::dyn_cast<llvm::PHINode>(value))
-	{
-		for (unsigned i = 0, n = phi->getNumIncomingValues(); i < n; i++)
-			mark_precise(cache, phi->getIncomingValue(i));
-	}
-	else
+	struct AllocaInfo
 	{
-		for (unsigned i = 0, n = value->getNumOperands(); i < n; i++)
-			mark_precise(cache, value->getOperand(i));
-	}
-}
+		unsigned num_elements;
+		bool dynamic_index;
+		bool escapes;
+	};
+
+	UnorderedMap<const llvm::Value *, AllocaInfo> candidates;
+	// Element pointers and lifetime marker casts, mapped to their alloca.
+	UnorderedMap<const llvm::Value *, const llvm::Value *> element_pointers;
+	UnorderedMap<const llvm::Value *, const llvm::Value *> marker_casts;
 
-static void propagate_precise(const llvm::Function *function)
-{
-	Vector<const llvm::Instruction *> precise_instructions;
 	for (auto &bb : *function)
+	{
 		for (auto &inst : bb)
-			if (instruction_requires_no_contraction(&inst))
-				precise_instructions.push_back(&inst);
+		{
+			auto *alloca_inst = llvm::dyn_cast<llvm::AllocaInst>(&inst);
+			if (!alloca_inst || handle_to_storage_class.count(alloca_inst))
+				continue;
 
-	UnorderedSet<const llvm::Instruction *> visitation_cache;
-	for (auto *inst : precise_instructions)
-		propagate_precise(visitation_cache, inst);
-}
+			auto address_space = static_cast<DXIL::AddressSpace>(alloca_inst->getType()->getAddressSpace());
+			if (address_space != DXIL::AddressSpace::Thread)
+				continue;
 
-bool Converter::Impl::analyze_instructions(const llvm::Function *function)
-{
-	// Need to analyze this in two stages.
-	// In the first stage, we need to analyze:
-	// - Load/GetElementPtr to handle lib global variables
-	// - CreateHandle family to build LLVM access handles
-	// - ExtractValue to track which components are used for BufferLoad.
-	// In the second phase we analyze the buffer loads and stores and figure out
-	// alignments of the loads and stores. This lets us build up a list of SSBO declarations we need to
-	// optimally implement the loads and stores. We need to do this late, because we depend on results
-	// of ExtractValue analysis.
+			auto *type = alloca_inst->getType()->getPointerElementType();
+			if (type->getTypeID() != llvm::Type::TypeID::ArrayTyID ||
+			    type->getArrayNumElements() == 0 || type->getArrayNumElements() > MaxScalarizedElements)
+				continue;
 
-	if (options.propagate_precise && !options.force_precise)
-		propagate_precise(function);
+			auto element_type_id = type->getArrayElementType()->getTypeID();
+			if (element_type_id != llvm::Type::TypeID::IntegerTyID &&
+			    element_type_id != llvm::Type::TypeID::HalfTyID &&
+			    element_type_id != llvm::Type::TypeID::FloatTyID &&
+			    element_type_id != llvm::Type::TypeID::DoubleTyID)
+				continue;
+
+			candidates[alloca_inst] = { unsigned(type->getArrayNumElements()), false, false };
+		}
+	}
+
+	if (candidates.empty())
+		return;
+
+	const auto lookup = [&](const llvm::Value *value) -> AllocaInfo * {
+		auto itr = candidates.find(value);
+		if (itr != candidates.end())
+			return &itr->second;
+
+		auto element_itr = element_pointers.find(value);
+		if (element_itr != element_pointers.end())
+			return &candidates[element_itr->second];
+
+		auto cast_itr = marker_casts.find(value);
+		if (cast_itr != marker_casts.end())
+			return &candidates[cast_itr->second];
+
+		return nullptr;
+	};
 
 	for (auto &bb : *function)
 	{
-		if (options.eliminate_dead_code)
-			mark_used_values(bb.getTerminator());
-
 		for (auto &inst : bb)
 		{
-			if (options.eliminate_dead_code)
-				mark_used_values(&inst);
-
-			if (auto *load_inst = llvm::dyn_cast<llvm::LoadInst>(&inst))
+			if (auto *gep = llvm::dyn_cast<llvm::GetElementPtrInst>(&inst))
 			{
-				if (!analyze_load_instruction(*this, load_inst))
-					return false;
+				auto *base = gep->getOperand(0);
+				auto *info = lookup(base);
+				if (!info)
+					continue;
+
+				const llvm::ConstantInt *first_index = nullptr;
+				if (gep->getNumOperands() == 3)
+					first_index = llvm::dyn_cast<llvm::ConstantInt>(gep->getOperand(1));
+
+				if (!candidates.count(base) || !first_index || first_index->getUniqueInteger().getZExtValue() != 0)
+				{
+					info->escapes = true;
+					continue;
+				}
+
+				auto *index = gep->getOperand(2);
+				if (const auto *const_index = llvm::dyn_cast<llvm::ConstantInt>(index))
+				{
+					if (const_index->getUniqueInteger().getZExtValue() < info->num_elements)
+						element_pointers[gep] = base;
+					else
+						info->escapes = true;
+				}
+				else if (index->getType()->getTypeID() == llvm::Type::TypeID::IntegerTyID &&
+				         index->getType()->getIntegerBitWidth() == 32)
+				{
+					info->dynamic_index = true;
+					element_pointers[gep] = base;
+				}
+				else
+					info->escapes = true;
+				continue;
 			}
-			else if (auto *phi_inst = llvm::dyn_cast<llvm::PHINode>(&inst))
+			else if (auto *load_inst = llvm::dyn_cast<llvm::LoadInst>(&inst))
 			{
-				if (!analyze_phi_instruction(*this, phi_inst))
-					return false;
+				if (auto *info = lookup(load_inst->getPointerOperand()))
+					if (!element_pointers.count(load_inst->getPointerOperand()))
+						info->escapes = true;
+				continue;
 			}
 			else if (auto *store_inst = llvm::dyn_cast<llvm::StoreInst>(&inst))
 			{
-				if (!analyze_store_instruction(*this, store_inst))
-					return false;
-			}
-			else if (auto *getelementptr_inst = llvm::dyn_cast<llvm::GetElementPtrInst>(&inst))
-			{
-				if (!analyze_getelementptr_instruction(*this, getelementptr_inst))
-					return false;
+				if (auto *info = lookup(store_inst->getOperand(0)))
+					info->escapes = true;
+				if (auto *info = lookup(store_inst->getOperand(1)))
+					if (!element_pointers.count(store_inst->getOperand(1)))
+						info->escapes = true;
+				continue;
 			}
-			else if (auto *extractvalue_inst = llvm::dyn_cast<llvm::ExtractValueInst>(&inst))
+			else if (auto *cast_inst = llvm::dyn_cast<llvm::CastInst>(&inst))
 			{
-				if (!analyze_extractvalue_instruction(*this, extractvalue_inst))
-					return false;
+				// Casts to i8* are ignored when emitting and only exist to feed lifetime markers.
+				auto *base = cast_inst->getOperand(0);
+				if (auto *info = lookup(base))
+				{
+					auto *result_type = cast_inst->getType();
+					if (candidates.count(base) && result_type->getTypeID() == llvm::Type::TypeID::PointerTyID &&
+					    result_type->getPointerElementType()->getTypeID() == llvm::Type::TypeID::IntegerTyID &&
+					    result_type->getPointerElementType()->getIntegerBitWidth() == 8)
+						marker_casts[cast_inst] = base;
+					else
+						info->escapes = true;
+				}
+				continue;
 			}
-			else if (auto *cmp_inst = llvm::dyn_cast<llvm::CmpInst>(&inst))
+			else if (auto *call_inst = llvm::dyn_cast<llvm::CallInst>(&inst))
 			{
-				if (!analyze_compare_instruction(*this, cmp_inst))
-					return false;
+				bool is_lifetime = is_llvm_intrinsic_callee(call_inst->getCalledFunction()) &&
+				                   strncmp(call_inst->getCalledFunction()->getName().data(), "llvm.lifetime", 13) == 0;
+
+				for (unsigned i = 0; i < call_inst->getNumOperands(); i++)
+					if (auto *info = lookup(call_inst->getOperand(i)))
+						if (!is_lifetime || !marker_casts.count(call_inst->getOperand(i)))
+							info->escapes = true;
+				continue;
 			}
-			else if (auto *call_inst = llvm::dyn_cast<llvm::CallInst>(&inst))
+			else if (auto *phi = llvm::dyn_cast<llvm::PHINode>(&inst))
 			{
-				auto *called_function = call_inst->getCalledFunction();
-				if (strncmp(called_function->getName().data(), "dx.op", 5) == 0)
-				{
-					if (!analyze_dxil_instruction(*this, call_inst, &bb))
-						return false;
-				}
+				for (unsigned i = 0; i < phi->getNumIncomingValues(); i++)
+					if (auto *info = lookup(phi->getIncomingValue(i)))
+						info->escapes = true;
+				continue;
 			}
+
+			for (unsigned i = 0; i < inst.getNumOperands(); i++)
+				if (auto *info = lookup(inst.getOperand(i)))
+					info->escapes = true;
 		}
 	}
 
-	for (auto &bb : *function)
+	for (auto &candidate : candidates)
 	{
-		for (auto &inst : bb)
-		{
-			if (auto *call_inst = llvm::dyn_cast<llvm::CallInst>(&inst))
-			{
-				auto *called_function = call_inst->getCalledFunction();
-				if (strncmp(called_function->getName().data(), "dx.op", 5) == 0)
-				{
-					if (!analyze_dxil_buffer_access_instruction(*this, call_inst))
-						return false;
-				}
-			}
-		}
-
-		// Reset AGS tracking for every BB.
-		ags.phases = 0;
+		auto &info = candidate.second;
+		if (info.escapes || (info.dynamic_index && info.num_elements > MaxDynamicallyIndexedElements))
+			continue;
+		scalarized_allocas[candidate.first] = {};
 	}
-
-	return true;
 }
 
 bool Converter::Impl::composite_is_accessed(const llvm::Value *composite) const
@@ -6405,12 +7885,18 @@ bool Converter::Impl::analyze_instructions()
 
 ConvertedFunction Converter::Impl::convert_entry_point()
 {
+	DXIL_SPV_TRACE_ZONE("Converter::convert_entry_point");
 	ConvertedFunction result = {};
 
 	auto &module = bitcode_parser.get_module();
 	entry_point_meta = get_entry_point_meta(module, options.entry_point.empty() ? nullptr : options.entry_point.c_str());
 	execution_model = get_execution_model(module, entry_point_meta);
 
+#ifdef HAVE_LLVMBC
+	// Values materialized later will grow the map on demand.
+	value_map.reserve(module.get_value_id_bound());
+#endif
+
 	if (execution_model == spv::ExecutionModelFragment &&
 	    resource_mapping_iface && resource_mapping_iface->has_nontrivial_stage_input_remapping())
 	{
@@ -6419,6 +7905,13 @@ ConvertedFunction Converter::Impl::convert_entry_point()
 		spirv_module.set_override_spirv_version(0x10400);
 	}
 
+	spirv_module.set_spirv_optimization(options.spirv_optimization);
+	spirv_module.set_spirv_canonicalization(options.spirv_canonicalization);
+	spirv_module.set_peephole_optimization(options.peephole_optimization);
+	spirv_module.set_loop_invariant_code_motion(options.loop_invariant_code_motion);
+	spirv_module.set_structured_cfg_fast_path(options.structured_cfg_fast_path);
+	spirv_module.set_structurizer_node_growth_factor(options.structurizer_node_growth_factor);
+
 	if (!entry_point_meta)
 	{
 		if (!options.entry_point.empty())
@@ -6446,10 +7939,14 @@ ConvertedFunction Converter::Impl::convert_entry_point()
 	// Need to analyze some execution modes early which affect opcode analysis later.
 	if (!analyze_execution_modes_meta())
 		return result;
+	if (!analyze_linked_stage_outputs())
+		return result;
 	if (!emit_resources_global_mapping())
 		return result;
 	if (!analyze_instructions())
 		return result;
+	if (is_cancelled())
+		return result;
 	if (!emit_execution_modes())
 		return result;
 
@@ -6482,6 +7979,12 @@ ConvertedFunction Converter::Impl::convert_entry_point()
 	else
 		result.entry = convert_function(func, pool);
 
+	if (is_cancelled())
+	{
+		result.entry = nullptr;
+		return result;
+	}
+
 	// Some execution modes depend on code generation, handle that here.
 	emit_execution_modes_post_code_generation();
 
@@ -6519,15 +8022,14 @@ Operation *Converter::Impl::allocate(spv::Op op, const llvm::Value *value, spv::
 
 void Converter::Impl::rewrite_value(const llvm::Value *value, spv::Id id)
 {
-	auto value_itr = value_map.find(value);
-	if (value_itr != value_map.end())
+	if (auto *value_id = value_map.find(value))
 	{
-		if (value_itr->second != id)
+		if (*value_id != id)
 		{
 			// If a PHI node previously accessed the value ID map, it will now refer to a dead
 			// ID. Remember to rewrite PHI incoming nodes as necessary.
-			phi_incoming_rewrite[value_itr->second] = id;
-			value_itr->second = id;
+			phi_incoming_rewrite[*value_id] = id;
+			*value_id = id;
 		}
 	}
 	else
@@ -6892,6 +8394,183 @@ void Converter::Impl::set_option(const OptionBase &cap)
 		break;
 	}
 
+	case Option::SpirvOptimization:
+	{
+		auto &c = static_cast<const OptionSpirvOptimization &>(cap);
+		options.spirv_optimization = c.enabled;
+		break;
+	}
+
+	case Option::PeepholeOptimization:
+	{
+		auto &c = static_cast<const OptionPeepholeOptimization &>(cap);
+		options.peephole_optimization = c.enabled;
+		break;
+	}
+
+	case Option::BufferLoadCoalescing:
+	{
+		auto &c = static_cast<const OptionBufferLoadCoalescing &>(cap);
+		options.buffer_load_coalescing = c.enabled;
+		break;
+	}
+
+	case Option::UniformityAnalysis:
+	{
+		auto &c = static_cast<const OptionUniformityAnalysis &>(cap);
+		options.uniformity_analysis = c.enabled;
+		break;
+	}
+
+	case Option::RayPayloadLiveness:
+	{
+		auto &c = static_cast<const OptionRayPayloadLiveness &>(cap);
+		options.ray_payload_liveness = c.enabled;
+		break;
+	}
+
+	case Option::LoopInvariantCodeMotion:
+	{
+		auto &c = static_cast<const OptionLoopInvariantCodeMotion &>(cap);
+		options.loop_invariant_code_motion = c.enabled;
+		break;
+	}
+
+	case Option::SparseFeedbackForwarding:
+	{
+		auto &c = static_cast<const OptionSparseFeedbackForwarding &>(cap);
+		options.sparse_feedback_forwarding = c.enabled;
+		break;
+	}
+
+	case Option::StructuredCFGFastPath:
+	{
+		auto &c = static_cast<const OptionStructuredCFGFastPath &>(cap);
+		options.structured_cfg_fast_path = c.enabled;
+		break;
+	}
+
+	case Option::KnownRootConstants:
+	{
+		auto &c = static_cast<const OptionKnownRootConstants &>(cap);
+		options.known_root_constants.clear();
+		for (unsigned i = 0; i < c.count; i++)
+			options.known_root_constants[c.word_indices[i]] = c.values[i];
+		break;
+	}
+
+	case Option::SBTDescriptorSizeSpecConstants:
+	{
+		auto &c = static_cast<const OptionSBTDescriptorSizeSpecConstants &>(cap);
+		options.sbt_descriptor_size_spec_constants = c.enabled;
+		options.sbt_descriptor_size_srv_uav_cbv_spec_id = c.spec_id_srv_uav_cbv;
+		options.sbt_descriptor_size_sampler_spec_id = c.spec_id_sampler;
+		break;
+	}
+
+	case Option::ConsumerStageInputs:
+	{
+		auto &c = static_cast<const OptionConsumerStageInputs &>(cap);
+		options.link_stage_outputs = c.enabled;
+		options.consumer_stage_inputs.clear();
+		for (unsigned i = 0; i < c.count; i++)
+			options.consumer_stage_inputs.emplace_back(c.semantic_names[i], c.semantic_indices[i]);
+		break;
+	}
+
+	case Option::HullBarrierElision:
+	{
+		auto &c = static_cast<const OptionHullBarrierElision &>(cap);
+		options.hull_barrier_elision = c.enabled;
+		break;
+	}
+
+	case Option::GeometryOutputVertexAnalysis:
+	{
+		auto &c = static_cast<const OptionGeometryOutputVertexAnalysis &>(cap);
+		options.geometry_output_vertex_analysis = c.enabled;
+		break;
+	}
+
+	case Option::MinPrecisionNarrowing:
+	{
+		auto &c = static_cast<const OptionMinPrecisionNarrowing &>(cap);
+		options.min_precision_narrowing = c.enabled;
+		break;
+	}
+
+	case Option::DescriptorQASampling:
+	{
+		auto &c = static_cast<const OptionDescriptorQASampling &>(cap);
+		options.descriptor_qa_deduplicate = c.deduplicate_per_block;
+		options.descriptor_qa.kill_switch = c.kill_switch;
+		options.descriptor_qa.kill_switch_spec_id = c.kill_switch_spec_id;
+		break;
+	}
+
+	case Option::WaveAggregatedAtomics:
+	{
+		auto &c = static_cast<const OptionWaveAggregatedAtomics &>(cap);
+		options.wave_aggregated_atomics = c.enabled;
+		break;
+	}
+
+	case Option::UAVCoherenceAnalysis:
+	{
+		auto &c = static_cast<const OptionUAVCoherenceAnalysis &>(cap);
+		options.uav_coherence_analysis = c.enabled;
+		break;
+	}
+
+	case Option::PhysicalAddressAlignment:
+	{
+		auto &c = static_cast<const OptionPhysicalAddressAlignment &>(cap);
+		options.physical_address_alignment = c.alignment;
+		break;
+	}
+
+	case Option::AllocaScalarization:
+	{
+		auto &c = static_cast<const OptionAllocaScalarization &>(cap);
+		options.alloca_scalarization = c.enabled;
+		break;
+	}
+
+	case Option::SamplerFeedbackLODMerging:
+	{
+		auto &c = static_cast<const OptionSamplerFeedbackLODMerging &>(cap);
+		options.sampler_feedback_lod_merging = c.enabled;
+		break;
+	}
+
+	case Option::SPIRVCanonicalization:
+	{
+		auto &c = static_cast<const OptionSPIRVCanonicalization &>(cap);
+		options.spirv_canonicalization = c.enabled;
+		break;
+	}
+
+	case Option::MeshOutputStoreCoalescing:
+	{
+		auto &c = static_cast<const OptionMeshOutputStoreCoalescing &>(cap);
+		options.mesh_output_store_coalescing = c.enabled;
+		break;
+	}
+
+	case Option::StructurizerComplexityBudget:
+	{
+		auto &c = static_cast<const OptionStructurizerComplexityBudget &>(cap);
+		options.structurizer_node_growth_factor = c.node_growth_factor;
+		break;
+	}
+
+	case Option::ConstantFolding:
+	{
+		auto &c = static_cast<const OptionConstantFolding &>(cap);
+		options.constant_folding = c.enabled;
+		break;
+	}
+
 	default:
 		break;
 	}
@@ -6939,6 +8618,21 @@ void Converter::set_resource_remapping_interface(ResourceRemappingInterface *ifa
 	impl->resource_mapping_iface = iface;
 }
 
+void Converter::set_statistics(ConversionStatistics *stats)
+{
+	impl->statistics = stats;
+}
+
+void Converter::set_cancel_flag(const std::atomic_bool *flag)
+{
+	impl->cancel_flag = flag;
+}
+
+bool Converter::Impl::is_cancelled() const
+{
+	return cancel_flag && cancel_flag->load(std::memory_order_relaxed);
+}
+
 ShaderStage Converter::get_shader_stage(const LLVMBCParser &bitcode_parser, const char *entry)
 {
 	auto &module = bitcode_parser.get_module();
@@ -28,6 +28,7 @@
 #include "dxil_parser.hpp"
 #include "llvm_bitcode_parser.hpp"
 #include "node_pool.hpp"
+#include <atomic>
 #include <memory>
 
 namespace spv
@@ -37,6 +38,8 @@ class Function;
 
 namespace dxil_spv
 {
+struct ConversionStatistics;
+
 struct ConvertedFunction
 {
 	CFGNode *entry;
@@ -250,6 +253,30 @@ enum class Option : uint32_t
 	BranchControl = 33,
 	SubgroupProperties = 34,
 	DescriptorHeapRobustness = 35,
+	SpirvOptimization = 36,
+	PeepholeOptimization = 37,
+	BufferLoadCoalescing = 38,
+	UniformityAnalysis = 39,
+	RayPayloadLiveness = 40,
+	LoopInvariantCodeMotion = 41,
+	SparseFeedbackForwarding = 42,
+	StructuredCFGFastPath = 43,
+	KnownRootConstants = 44,
+	SBTDescriptorSizeSpecConstants = 45,
+	ConsumerStageInputs = 46,
+	HullBarrierElision = 47,
+	GeometryOutputVertexAnalysis = 48,
+	MinPrecisionNarrowing = 49,
+	DescriptorQASampling = 50,
+	WaveAggregatedAtomics = 51,
+	UAVCoherenceAnalysis = 52,
+	PhysicalAddressAlignment = 53,
+	AllocaScalarization = 54,
+	SamplerFeedbackLODMerging = 55,
+	SPIRVCanonicalization = 56,
+	MeshOutputStoreCoalescing = 57,
+	StructurizerComplexityBudget = 58,
+	ConstantFolding = 59,
 	Count
 };
 
@@ -650,6 +677,302 @@ struct OptionDescriptorHeapRobustness : OptionBase
 	bool enabled = false;
 };
 
+// Runs a small set of SPIRV-Tools optimizer passes on the finalized module.
+// Only has an effect if the library was built with DXIL_SPIRV_OPTIMIZER.
+struct OptionSpirvOptimization : OptionBase
+{
+	OptionSpirvOptimization()
+		: OptionBase(Option::SpirvOptimization)
+	{
+	}
+
+	bool enabled = false;
+};
+
+// Removes redundant bitcasts and duplicate pure operations within blocks before emission.
+struct OptionPeepholeOptimization : OptionBase
+{
+	OptionPeepholeOptimization()
+		: OptionBase(Option::PeepholeOptimization)
+	{
+	}
+
+	bool enabled = false;
+};
+
+// Merges adjacent scalar RawBufferLoads from the same handle within a block into one wider load.
+struct OptionBufferLoadCoalescing : OptionBase
+{
+	OptionBufferLoadCoalescing()
+		: OptionBase(Option::BufferLoadCoalescing)
+	{
+	}
+
+	bool enabled = false;
+};
+
+// Drops NonUniform from heap indices which are provably dynamically uniform,
+// and reuses descriptor QA / robustness checks for the same uniform index within a block.
+struct OptionUniformityAnalysis : OptionBase
+{
+	OptionUniformityAnalysis()
+		: OptionBase(Option::UniformityAnalysis)
+	{
+	}
+
+	bool enabled = false;
+};
+
+// When a payload or callable data alloca has to be copied to a temporary around TraceRay / CallShader,
+// only copy the members which may be defined before the call, and back only the members which may be read after it.
+struct OptionRayPayloadLiveness : OptionBase
+{
+	OptionRayPayloadLiveness()
+		: OptionBase(Option::RayPayloadLiveness)
+	{
+	}
+
+	bool enabled = false;
+};
+
+// After structurization, hoists pure address and descriptor offset arithmetic out of loops.
+struct OptionLoopInvariantCodeMotion : OptionBase
+{
+	OptionLoopInvariantCodeMotion()
+		: OptionBase(Option::LoopInvariantCodeMotion)
+	{
+	}
+
+	bool enabled = false;
+};
+
+// Forwards sparse texel and residency components directly to their users
+// instead of repacking them into the DXIL result struct.
+struct OptionSparseFeedbackForwarding : OptionBase
+{
+	OptionSparseFeedbackForwarding()
+		: OptionBase(Option::SparseFeedbackForwarding)
+	{
+	}
+
+	bool enabled = false;
+};
+
+// Functions whose CFG already maps directly onto structured constructs skip the structurizer rewrites.
+struct OptionStructuredCFGFastPath : OptionBase
+{
+	OptionStructuredCFGFastPath()
+		: OptionBase(Option::StructuredCFGFastPath)
+	{
+	}
+
+	bool enabled = false;
+};
+
+// Root constant words whose values are known for this pipeline.
+// Loads of these words become constants, and branches which only depend on them,
+// or on a non-specialized rasterizer sample count, are folded while building the CFG.
+struct OptionKnownRootConstants : OptionBase
+{
+	OptionKnownRootConstants()
+		: OptionBase(Option::KnownRootConstants)
+	{
+	}
+
+	const uint32_t *word_indices = nullptr;
+	const uint32_t *values = nullptr;
+	unsigned count = 0;
+};
+
+// Emits the SBT descriptor size shifts as specialization constants,
+// defaulting to the values of OptionSBTDescriptorSizeLog2.
+struct OptionSBTDescriptorSizeSpecConstants : OptionBase
+{
+	OptionSBTDescriptorSizeSpecConstants()
+		: OptionBase(Option::SBTDescriptorSizeSpecConstants)
+	{
+	}
+
+	bool enabled = false;
+	uint32_t spec_id_srv_uav_cbv = 0;
+	uint32_t spec_id_sampler = 0;
+};
+
+// User semantics read by the next stage. Other user outputs of VS, DS and GS are not declared,
+// their stores are dropped, and with dead code elimination, so is the code feeding them.
+struct OptionConsumerStageInputs : OptionBase
+{
+	OptionConsumerStageInputs()
+		: OptionBase(Option::ConsumerStageInputs)
+	{
+	}
+
+	bool enabled = false;
+	const char *const *semantic_names = nullptr;
+	const uint32_t *semantic_indices = nullptr;
+	unsigned count = 0;
+};
+
+// Skips the barrier between the control point and patch constant phases of a hull shader
+// when the patch constant function never reads output control points.
+struct OptionHullBarrierElision : OptionBase
+{
+	OptionHullBarrierElision()
+		: OptionBase(Option::HullBarrierElision)
+	{
+	}
+
+	bool enabled = false;
+};
+
+// Declares OutputVertices for geometry shaders as the largest number of vertices any path
+// through the shader can emit, if that is provably lower than maxvertexcount.
+struct OptionGeometryOutputVertexAnalysis : OptionBase
+{
+	OptionGeometryOutputVertexAnalysis()
+		: OptionBase(Option::GeometryOutputVertexAnalysis)
+	{
+	}
+
+	bool enabled = false;
+};
+
+// With native 16-bit min precision, FP32 arithmetic which only exists between FPExt from and FPTrunc to
+// min precision is evaluated in FP16, which removes the conversions around it.
+struct OptionMinPrecisionNarrowing : OptionBase
+{
+	OptionMinPrecisionNarrowing()
+		: OptionBase(Option::MinPrecisionNarrowing)
+	{
+	}
+
+	bool enabled = false;
+};
+
+// Lowers the cost of OptionDescriptorQA.
+struct OptionDescriptorQASampling : OptionBase
+{
+	OptionDescriptorQASampling()
+		: OptionBase(Option::DescriptorQASampling)
+	{
+	}
+
+	// Only the first access to a heap offset within a block is checked.
+	bool deduplicate_per_block = false;
+	// Every check is skipped unless the boolean spec constant with kill_switch_spec_id is true (the default).
+	bool kill_switch = false;
+	uint32_t kill_switch_spec_id = 0;
+};
+
+// UAV counter updates and InterlockedAdd on a dynamically uniform address are performed
+// once per subgroup by an elected lane, and each lane derives its return value from a prefix sum.
+struct OptionWaveAggregatedAtomics : OptionBase
+{
+	OptionWaveAggregatedAtomics()
+		: OptionBase(Option::WaveAggregatedAtomics)
+	{
+	}
+
+	bool enabled = false;
+};
+
+// When UAV barriers force Coherent, only UAVs whose non-atomic accesses can observe writes
+// from other invocations are promoted. Atomic-only, read-only and write-only UAVs stay cached.
+struct OptionUAVCoherenceAnalysis : OptionBase
+{
+	OptionUAVCoherenceAnalysis()
+		: OptionBase(Option::UAVCoherenceAnalysis)
+	{
+	}
+
+	bool enabled = false;
+};
+
+// Minimum alignment the application guarantees for root descriptor and BDA base addresses.
+// Combined with the offset arithmetic to prove stronger alignment for physical loads and stores.
+struct OptionPhysicalAddressAlignment : OptionBase
+{
+	OptionPhysicalAddressAlignment()
+		: OptionBase(Option::PhysicalAddressAlignment)
+	{
+	}
+
+	unsigned alignment = 4;
+};
+
+// Splits small local arrays which are only accessed per element into one variable per element.
+// Small dynamically indexed arrays are accessed through select chains.
+struct OptionAllocaScalarization : OptionBase
+{
+	OptionAllocaScalarization()
+		: OptionBase(Option::AllocaScalarization)
+	{
+	}
+
+	bool enabled = false;
+};
+
+// Emulated WriteSamplerFeedback folds the coarse trilinear LOD into the fine LOD write
+// when both hit the same feedback texel, so only one subgroup-deduplicated atomic is needed.
+struct OptionSamplerFeedbackLODMerging : OptionBase
+{
+	OptionSamplerFeedbackLODMerging()
+		: OptionBase(Option::SamplerFeedbackLODMerging)
+	{
+	}
+
+	bool enabled = false;
+};
+
+// Renumbers IDs and sorts order-independent sections of the final module,
+// so that equivalent modules serialize identically and hit the same driver pipeline cache entries.
+struct OptionSPIRVCanonicalization : OptionBase
+{
+	OptionSPIRVCanonicalization()
+		: OptionBase(Option::SPIRVCanonicalization)
+	{
+	}
+
+	bool enabled = false;
+};
+
+// Mesh shader output stores which together write a full row are emitted as one vector store.
+struct OptionMeshOutputStoreCoalescing : OptionBase
+{
+	OptionMeshOutputStoreCoalescing()
+		: OptionBase(Option::MeshOutputStoreCoalescing)
+	{
+	}
+
+	bool enabled = false;
+};
+
+// Limits how far the structurizer may grow a function's CFG, as a multiple of its input node count,
+// before conversion fails. Rewrite loops are bounded as well. 0 removes the limits.
+// Without this option there is no limit.
+struct OptionStructurizerComplexityBudget : OptionBase
+{
+	OptionStructurizerComplexityBudget()
+		: OptionBase(Option::StructurizerComplexityBudget)
+	{
+	}
+
+	unsigned node_growth_factor = 32;
+};
+
+// DXIL arithmetic opcodes whose operands are all constant are evaluated on the host and emitted as constants.
+// The host may round differently than the device, e.g. for FMad and Dot, so this is opt-in.
+// Precise instructions are never folded.
+struct OptionConstantFolding : OptionBase
+{
+	OptionConstantFolding()
+		: OptionBase(Option::ConstantFolding)
+	{
+	}
+
+	bool enabled = false;
+};
+
 struct DescriptorTableEntry
 {
 	ResourceClass type;
@@ -665,18 +988,80 @@ enum class ShaderFeature
 	Count
 };
 
+// A non-arrayed CBV which is only read at constant offsets. The host may remap it to
+// root constants (push constants or the root constant inline uniform block) on a later compile.
+struct CBVPromotionCandidate
+{
+	uint32_t register_space;
+	uint32_t register_index;
+	// Number of 32-bit words from the start of the CBV which are read.
+	uint32_t num_words;
+};
+
+enum ResourceUsageFlagBits
+{
+	RESOURCE_USAGE_READ_BIT = 1 << 0,
+	RESOURCE_USAGE_WRITE_BIT = 1 << 1,
+	RESOURCE_USAGE_ATOMIC_BIT = 1 << 2,
+	RESOURCE_USAGE_COUNTER_BIT = 1 << 3
+};
+using ResourceUsageFlags = uint32_t;
+
+// A declared resource binding which the entry point actually creates a handle for.
+// Resources accessed through the descriptor heap directly (SM 6.6) are not listed.
+struct ResourceUsage
+{
+	ResourceClass resource_class;
+	uint32_t register_space;
+	uint32_t register_index;
+	// ~0u for unsized arrays.
+	uint32_t range_size;
+	// Only meaningful for UAVs. A UAV without WRITE or ATOMIC is read-only in practice.
+	ResourceUsageFlags flags;
+	// CBV only. Bytes from the start of the CBV which may be read.
+	// Equals the declared CBV size if any load uses a dynamic offset.
+	uint32_t cbv_used_bytes;
+};
+
+// Rough size of an entry point and every function it calls, gathered from the parsed module without converting it.
+struct CostEstimate
+{
+	uint32_t num_functions = 0;
+	uint32_t num_blocks = 0;
+	uint32_t num_instructions = 0;
+	// Approximated from back edges found in a depth-first walk of each function.
+	uint32_t max_loop_depth = 0;
+	uint32_t num_wave_ops = 0;
+	// Only ops which dispatch or traverse, not the ray query accessors.
+	uint32_t num_ray_tracing_ops = 0;
+	// Weighted sum of the above. Has no unit, and is only meaningful relative to other estimates.
+	uint64_t cost = 0;
+};
+
+// The parsed module is never modified by conversion. Any number of Converters may convert
+// entry points of the same LLVMBCParser concurrently from different threads, as long as the parser
+// (and the thread allocator context it was parsed in) outlives them.
 class Converter
 {
 public:
-	Converter(LLVMBCParser &bitcode_parser, LLVMBCParser *bitcode_reflection_parser, SPIRVModule &module);
+	Converter(const LLVMBCParser &bitcode_parser, const LLVMBCParser *bitcode_reflection_parser, SPIRVModule &module);
 	~Converter();
 	ConvertedFunction convert_entry_point();
 	void set_resource_remapping_interface(ResourceRemappingInterface *iface);
+	// If set, phase timings of convert_entry_point() are accumulated into stats.
+	void set_statistics(ConversionStatistics *stats);
+	// Polled between conversion phases. Once it is true, convert_entry_point() gives up and returns no entry.
+	void set_cancel_flag(const std::atomic_bool *flag);
 
 	static ShaderStage get_shader_stage(const LLVMBCParser &bitcode_parser, const char *entry = nullptr);
 	static void scan_resources(ResourceRemappingInterface *iface, const LLVMBCParser &bitcode_parser);
 
 	static Vector<String> get_entry_points(const LLVMBCParser &parser);
+	// For parsers created with LLVMBCParser::parse_lazy(), decodes every function body
+	// needed to convert entry (or the default entry point if nullptr).
+	static bool materialize_entry_point(LLVMBCParser &parser, const char *entry = nullptr);
+	// The entry point must be materialized. Returns false if the entry point does not exist.
+	static bool estimate_cost(const LLVMBCParser &parser, const char *entry, CostEstimate &estimate);
 	static bool entry_point_matches(const String &mangled, const char *user);
 	void set_entry_point(const char *entry);
 	const String &get_compiled_entry_point() const;
@@ -708,6 +1093,11 @@ public:
 
 	bool shader_requires_feature(ShaderFeature feature) const;
 
+	// After compilation, query CBVs which could be promoted to root constants.
+	const Vector<CBVPromotionCandidate> &get_cbv_promotion_candidates() const;
+	// After compilation, query which declared resource bindings are used by the entry point.
+	const Vector<ResourceUsage> &get_resource_usage() const;
+
 	struct Impl;
 
 private:
@@ -25,6 +25,7 @@
 #include "cli_parser.hpp"
 #include "dxil_spirv_c.h"
 #include "logging.hpp"
+#include "mapped_file.hpp"
 #include <stdint.h>
 #include <stdio.h>
 #include <vector>
@@ -36,26 +37,6 @@ static void print_help()
 	LOGE("dxil-extract <DXIL blob> [--output file.bc] [--reflection] [--verbose]\n");
 }
 
-static std::vector<uint8_t> read_file(const char *path)
-{
-	FILE *file = fopen(path, "rb");
-	if (!file)
-		return {};
-
-	fseek(file, 0, SEEK_END);
-	auto len = ftell(file);
-	rewind(file);
-	std::vector<uint8_t> result(len);
-	if (fread(result.data(), 1, len, file) != size_t(len))
-	{
-		fclose(file);
-		return {};
-	}
-
-	fclose(file);
-	return result;
-}
-
 static bool write_file(const char *path, const void *data, size_t size)
 {
 	bool ret = true;
@@ -112,8 +93,9 @@ int main(int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 
-	auto input_file = read_file(input.c_str());
-	if (input_file.empty())
+	// The mapping outlives the blob, so the container can be parsed without copying the DXIL part out.
+	dxil_spv::MappedFile input_file;
+	if (!input_file.open(input.c_str()) || input_file.get_size() == 0)
 	{
 		LOGE("Failed to read file %s.\n", input.c_str());
 		return EXIT_FAILURE;
@@ -123,13 +105,14 @@ int main(int argc, char **argv)
 	if (reflection)
 	{
 		dxil_spv_result result;
-		if ((result = dxil_spv_parse_reflection_dxil_blob(input_file.data(), input_file.size(), &blob)) != DXIL_SPV_SUCCESS)
+		if ((result = dxil_spv_parse_reflection_dxil_blob(input_file.get_data(), input_file.get_size(), &blob)) != DXIL_SPV_SUCCESS)
 		{
 			// Fallback in case there is no STAT block.
 			if (result == DXIL_SPV_ERROR_NO_DATA)
 			{
 				LOGW("There is no STAT block, falling back to normal DXIL block.\n");
-				result = dxil_spv_parse_dxil_blob(input_file.data(), input_file.size(), &blob);
+				result = dxil_spv_parse_dxil_blob_with_flags(input_file.get_data(), input_file.get_size(),
+				                                             DXIL_SPV_PARSE_BORROW_INPUT_BIT, &blob);
 			}
 
 			if (result != DXIL_SPV_SUCCESS)
@@ -141,7 +124,8 @@ int main(int argc, char **argv)
 	}
 	else
 	{
-		if (dxil_spv_parse_dxil_blob(input_file.data(), input_file.size(), &blob) != DXIL_SPV_SUCCESS)
+		if (dxil_spv_parse_dxil_blob_with_flags(input_file.get_data(), input_file.get_size(),
+		                                        DXIL_SPV_PARSE_BORROW_INPUT_BIT, &blob) != DXIL_SPV_SUCCESS)
 		{
 			LOGE("Failed to parse blob.\n");
 			return EXIT_FAILURE;
@@ -160,7 +144,7 @@ int main(int argc, char **argv)
 			printf("  %s\n", demangled);
 		}
 		printf("vkd3d-proton hash: %016llx\n",
-		       static_cast<unsigned long long>(vkd3d_proton_hash_fnv1(input_file.data(), input_file.size())));
+		       static_cast<unsigned long long>(vkd3d_proton_hash_fnv1(input_file.get_data(), input_file.get_size())));
 		printf("==================\n");
 	}
 
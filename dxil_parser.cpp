@@ -26,6 +26,7 @@
 #include "dxil.hpp"
 #include "memory_stream.hpp"
 #include "logging.hpp"
+#include "hash.hpp"
 #include <stdio.h>
 #include <string.h>
 #include <vector>
@@ -68,9 +69,19 @@ Vector<uint8_t> &DXILContainerParser::get_blob()
 	return dxil_blob;
 }
 
-Vector<RDATSubobject> &DXILContainerParser::get_rdat_subobjects()
+RDATView &DXILContainerParser::get_rdat_view()
 {
-	return rdat_subobjects;
+	return rdat_view;
+}
+
+void DXILContainerParser::set_borrow_blob(bool enable)
+{
+	borrow_blob = enable;
+}
+
+const MemoryStream &DXILContainerParser::get_blob_stream() const
+{
+	return dxil_stream;
 }
 
 bool DXILContainerParser::parse_dxil(MemoryStream &stream)
@@ -87,10 +98,17 @@ bool DXILContainerParser::parse_dxil(MemoryStream &stream)
 
 	auto substream = stream.create_substream(stream.get_offset() + program_header.bitcode_offset - 16);
 
+	if (borrow_blob)
+	{
+		dxil_stream = substream;
+		return true;
+	}
+
 	dxil_blob.resize(substream.get_size());
 	if (!substream.read(dxil_blob.data(), substream.get_size()))
 		return false;
 
+	dxil_stream = MemoryStream(dxil_blob.data(), dxil_blob.size());
 	return true;
 }
 
@@ -141,6 +159,306 @@ bool DXILContainerParser::parse_iosg1(MemoryStream &stream, Vector<DXIL::IOEleme
 	return true;
 }
 
+bool RDATView::decode_subobject(uint32_t record, RDATSubobject &elem) const
+{
+	auto record_stream = subobject_table.create_substream(size_t(record) * record_stride, record_stride);
+
+	DXIL::SubobjectKind kind;
+	if (!record_stream.read(kind))
+		return false;
+
+	switch (kind)
+	{
+	case DXIL::SubobjectKind::StateObjectConfig:
+	{
+		uint32_t name_offset;
+		if (!record_stream.read(name_offset))
+			return false;
+
+		const char *str = nullptr;
+		if (!string_buffer.map_string_absolute(str, name_offset))
+			return false;
+
+		uint32_t flag;
+		if (!record_stream.read(flag))
+			return false;
+
+		elem = {};
+		elem.kind = kind;
+		elem.subobject_name = str;
+		elem.args[0] = flag;
+		return true;
+	}
+
+	case DXIL::SubobjectKind::RaytracingShaderConfig:
+	{
+		uint32_t name_offset;
+		if (!record_stream.read(name_offset))
+			return false;
+
+		const char *str;
+		if (!string_buffer.map_string_absolute(str, name_offset))
+			return false;
+
+		uint32_t max_payload_size, max_attribute_size;
+		if (!record_stream.read(max_payload_size))
+			return false;
+		if (!record_stream.read(max_attribute_size))
+			return false;
+
+		elem = {};
+		elem.kind = kind;
+		elem.subobject_name = str;
+		elem.args[0] = max_payload_size;
+		elem.args[1] = max_attribute_size;
+		return true;
+	}
+
+	case DXIL::SubobjectKind::RaytracingPipelineConfig:
+	case DXIL::SubobjectKind::RaytracingPipelineConfig1:
+	{
+		uint32_t name_offset;
+		if (!record_stream.read(name_offset))
+			return false;
+
+		const char *str;
+		if (!string_buffer.map_string_absolute(str, name_offset))
+			return false;
+
+		uint32_t max_recursion_depth;
+		uint32_t flags = 0;
+
+		if (!record_stream.read(max_recursion_depth))
+			return false;
+
+		if (kind == DXIL::SubobjectKind::RaytracingPipelineConfig1)
+			if (!record_stream.read(flags))
+				return false;
+
+		elem = {};
+		elem.kind = kind;
+		elem.subobject_name = str;
+		elem.args[0] = max_recursion_depth;
+		elem.args[1] = flags;
+		return true;
+	}
+
+	case DXIL::SubobjectKind::HitGroup:
+	{
+		uint32_t name_offset;
+		if (!record_stream.read(name_offset))
+			return false;
+
+		const char *hg_name;
+		if (!string_buffer.map_string_absolute(hg_name, name_offset))
+			return false;
+
+		DXIL::HitGroupType hit_group_type;
+		if (!record_stream.read(hit_group_type))
+			return false;
+
+		uint32_t ahit_name_offset, chit_name_offset, intersection_name_offset;
+		if (!record_stream.read(ahit_name_offset))
+			return false;
+		if (!record_stream.read(chit_name_offset))
+			return false;
+		if (!record_stream.read(intersection_name_offset))
+			return false;
+
+		const char *ahit, *chit, *intersection;
+		if (!string_buffer.map_string_absolute(ahit, ahit_name_offset))
+			return false;
+		if (!string_buffer.map_string_absolute(chit, chit_name_offset))
+			return false;
+		if (!string_buffer.map_string_absolute(intersection, intersection_name_offset))
+			return false;
+
+		elem = {};
+		elem.kind = kind;
+		elem.subobject_name = hg_name;
+		elem.hit_group_type = hit_group_type;
+		elem.exports = { ahit, chit, intersection };
+		return true;
+	}
+
+	case DXIL::SubobjectKind::SubobjectToExportsAssociation:
+	{
+		elem = {};
+		elem.kind = kind;
+		uint32_t name_offset;
+
+		if (!record_stream.read(name_offset))
+			return false;
+
+		const char *name;
+		if (!string_buffer.map_string_absolute(name, name_offset))
+			return false;
+
+		elem.subobject_name = name;
+
+		if (!record_stream.read(name_offset))
+			return false;
+		const char *object_name;
+		if (!string_buffer.map_string_absolute(object_name, name_offset))
+			return false;
+
+		elem.exports.push_back(object_name);
+
+		uint32_t index_offset;
+		if (!record_stream.read(index_offset))
+			return false;
+
+		auto index_substream = index_buffer.create_substream(sizeof(uint32_t) * index_offset);
+		uint32_t count;
+		if (!index_substream.read(count))
+			return false;
+
+		for (uint32_t export_index = 0; export_index < count; export_index++)
+		{
+			if (!index_substream.read(name_offset))
+				return false;
+			if (!string_buffer.map_string_absolute(object_name, name_offset))
+				return false;
+			elem.exports.push_back(object_name);
+		}
+
+		return true;
+	}
+
+	case DXIL::SubobjectKind::GlobalRootSignature:
+	case DXIL::SubobjectKind::LocalRootSignature:
+	{
+		uint32_t name_offset;
+
+		if (!record_stream.read(name_offset))
+			return false;
+
+		const char *name;
+		if (!string_buffer.map_string_absolute(name, name_offset))
+			return false;
+
+		uint32_t byte_offset;
+		uint32_t byte_size;
+		if (!record_stream.read(byte_offset))
+			return false;
+		if (!record_stream.read(byte_size))
+			return false;
+
+		auto name_substream = raw_bytes.create_substream(byte_offset, byte_size);
+		auto *data = name_substream.map_read<uint8_t>(byte_size);
+
+		elem = {};
+		elem.kind = kind;
+		elem.subobject_name = name;
+		elem.payload = data;
+		elem.payload_size = byte_size;
+		return true;
+	}
+
+	default:
+		return false;
+	}
+}
+
+uint32_t RDATView::get_num_subobjects() const
+{
+	return uint32_t(records.size());
+}
+
+const RDATSubobject *RDATView::get_subobject(uint32_t index)
+{
+	if (index >= records.size())
+		return nullptr;
+
+	enum { Undecoded = 0, Decoded, Failed };
+
+	if (subobject_state[index] == Undecoded)
+	{
+		if (decode_subobject(records[index], subobjects[index]))
+		{
+			subobject_state[index] = Decoded;
+		}
+		else
+		{
+			LOGE("Failed to decode RDAT subobject %u.\n", index);
+			subobject_state[index] = Failed;
+		}
+	}
+
+	return subobject_state[index] == Decoded ? &subobjects[index] : nullptr;
+}
+
+bool RDATView::decode_subobject_name(uint32_t index, const char *&name) const
+{
+	// All subobject records start with kind and name.
+	auto record_stream = subobject_table.create_substream(size_t(records[index]) * record_stride, record_stride);
+	uint32_t name_offset;
+	if (!record_stream.skip(sizeof(DXIL::SubobjectKind)) || !record_stream.read(name_offset))
+		return false;
+	return string_buffer.map_string_absolute(name, name_offset);
+}
+
+size_t RDATView::StringHash::operator()(const String &str) const
+{
+	return size_t(hash_fast(str.data(), str.size()));
+}
+
+void RDATView::build_export_associations()
+{
+	export_associations_built = true;
+
+	UnorderedMap<String, uint32_t, StringHash> subobject_names;
+	for (uint32_t i = 0; i < get_num_subobjects(); i++)
+	{
+		const char *name;
+		if (decode_subobject_name(i, name))
+			subobject_names.insert({ name, i });
+	}
+
+	for (uint32_t i = 0; i < get_num_subobjects(); i++)
+	{
+		DXIL::SubobjectKind kind;
+		auto record_stream = subobject_table.create_substream(size_t(records[i]) * record_stride, record_stride);
+		if (!record_stream.read(kind))
+			continue;
+
+		if (kind != DXIL::SubobjectKind::HitGroup && kind != DXIL::SubobjectKind::SubobjectToExportsAssociation)
+			continue;
+
+		auto *sub = get_subobject(i);
+		if (!sub)
+			continue;
+
+		if (kind == DXIL::SubobjectKind::HitGroup)
+		{
+			for (auto *export_name : sub->exports)
+				if (*export_name != '\0')
+					export_associations[export_name].push_back(i);
+		}
+		else if (!sub->exports.empty())
+		{
+			// The subobject may live in a different collection, in which case there is nothing to point to.
+			auto itr = subobject_names.find(sub->exports.front());
+			if (itr == subobject_names.end())
+				continue;
+
+			if (sub->exports.size() == 1)
+				export_associations[""].push_back(itr->second);
+			for (size_t j = 1; j < sub->exports.size(); j++)
+				export_associations[sub->exports[j]].push_back(itr->second);
+		}
+	}
+}
+
+const Vector<uint32_t> *RDATView::find_export_associations(const char *export_name)
+{
+	if (!export_associations_built)
+		build_export_associations();
+
+	auto itr = export_associations.find(export_name);
+	return itr != export_associations.end() ? &itr->second : nullptr;
+}
+
 bool DXILContainerParser::parse_rdat(MemoryStream &stream)
 {
 	uint32_t version, part_count;
@@ -158,10 +476,6 @@ bool DXILContainerParser::parse_rdat(MemoryStream &stream)
 		if (!stream.read(offsets[i]))
 			return false;
 
-	MemoryStream string_buffer;
-	MemoryStream index_buffer;
-	MemoryStream raw_bytes;
-
 	for (uint32_t i = 0; i < part_count; i++)
 	{
 		if (offsets[i] + 2 * sizeof(uint32_t) > stream.get_size())
@@ -185,19 +499,19 @@ bool DXILContainerParser::parse_rdat(MemoryStream &stream)
 		{
 		case DXIL::RuntimeDataPartType::StringBuffer:
 		{
-			string_buffer = substream.create_substream(substream.get_offset(), subpart_length);
+			rdat_view.string_buffer = substream.create_substream(substream.get_offset(), subpart_length);
 			break;
 		}
 
 		case DXIL::RuntimeDataPartType::IndexArrays:
 		{
-			index_buffer = substream.create_substream(substream.get_offset(), subpart_length);
+			rdat_view.index_buffer = substream.create_substream(substream.get_offset(), subpart_length);
 			break;
 		}
 
 		case DXIL::RuntimeDataPartType::RawBytes:
 		{
-			raw_bytes = substream.create_substream(substream.get_offset(), subpart_length);
+			rdat_view.raw_bytes = substream.create_substream(substream.get_offset(), subpart_length);
 			break;
 		}
 
@@ -210,11 +524,17 @@ bool DXILContainerParser::parse_rdat(MemoryStream &stream)
 			if (!substream.read(record_stride))
 				return false;
 
-			for (unsigned record = 0; record < record_count; record++)
+			rdat_view.subobject_table =
+					substream.create_substream(substream.get_offset(), size_t(record_count) * record_stride);
+			rdat_view.record_stride = record_stride;
+			if (record_count && !rdat_view.subobject_table.get_data())
+				return false;
+
+			// Only peek at the kind here, everything else is decoded on demand.
+			for (uint32_t record = 0; record < record_count; record++)
 			{
 				auto record_stream =
-						substream.create_substream(substream.get_offset() + record * record_stride, record_stride);
-
+						rdat_view.subobject_table.create_substream(size_t(record) * record_stride, record_stride);
 				DXIL::SubobjectKind kind;
 				if (!record_stream.read(kind))
 					return false;
@@ -222,196 +542,15 @@ bool DXILContainerParser::parse_rdat(MemoryStream &stream)
 				switch (kind)
 				{
 				case DXIL::SubobjectKind::StateObjectConfig:
-				{
-					uint32_t name_offset;
-					if (!record_stream.read(name_offset))
-						return false;
-
-					const char *str = nullptr;
-					if (!string_buffer.map_string_absolute(str, name_offset))
-						return false;
-
-					uint32_t flag;
-					if (!record_stream.read(flag))
-						return false;
-
-					RDATSubobject elem = {};
-					elem.kind = kind;
-					elem.subobject_name = str;
-					elem.args[0] = flag;
-					rdat_subobjects.push_back(std::move(elem));
-					break;
-				}
-
 				case DXIL::SubobjectKind::RaytracingShaderConfig:
-				{
-					uint32_t name_offset;
-					if (!record_stream.read(name_offset))
-						return false;
-
-					const char *str;
-					if (!string_buffer.map_string_absolute(str, name_offset))
-						return false;
-
-					uint32_t max_payload_size, max_attribute_size;
-					if (!record_stream.read(max_payload_size))
-						return false;
-					if (!record_stream.read(max_attribute_size))
-						return false;
-
-					RDATSubobject elem = {};
-					elem.kind = kind;
-					elem.subobject_name = str;
-					elem.args[0] = max_payload_size;
-					elem.args[1] = max_attribute_size;
-					rdat_subobjects.push_back(std::move(elem));
-					break;
-				}
-
 				case DXIL::SubobjectKind::RaytracingPipelineConfig:
 				case DXIL::SubobjectKind::RaytracingPipelineConfig1:
-				{
-					uint32_t name_offset;
-					if (!record_stream.read(name_offset))
-						return false;
-
-					const char *str;
-					if (!string_buffer.map_string_absolute(str, name_offset))
-						return false;
-
-					uint32_t max_recursion_depth;
-					uint32_t flags = 0;
-
-					if (!record_stream.read(max_recursion_depth))
-						return false;
-
-					if (kind == DXIL::SubobjectKind::RaytracingPipelineConfig1)
-						if (!record_stream.read(flags))
-							return false;
-
-					RDATSubobject elem = {};
-					elem.kind = kind;
-					elem.subobject_name = str;
-					elem.args[0] = max_recursion_depth;
-					elem.args[1] = flags;
-					rdat_subobjects.push_back(std::move(elem));
-					break;
-				}
-
 				case DXIL::SubobjectKind::HitGroup:
-				{
-					uint32_t name_offset;
-					if (!record_stream.read(name_offset))
-						return false;
-
-					const char *hg_name;
-					if (!string_buffer.map_string_absolute(hg_name, name_offset))
-						return false;
-
-					DXIL::HitGroupType hit_group_type;
-					if (!record_stream.read(hit_group_type))
-						return false;
-
-					uint32_t ahit_name_offset, chit_name_offset, intersection_name_offset;
-					if (!record_stream.read(ahit_name_offset))
-						return false;
-					if (!record_stream.read(chit_name_offset))
-						return false;
-					if (!record_stream.read(intersection_name_offset))
-						return false;
-
-					const char *ahit, *chit, *intersection;
-					if (!string_buffer.map_string_absolute(ahit, ahit_name_offset))
-						return false;
-					if (!string_buffer.map_string_absolute(chit, chit_name_offset))
-						return false;
-					if (!string_buffer.map_string_absolute(intersection, intersection_name_offset))
-						return false;
-
-					RDATSubobject elem = {};
-					elem.kind = kind;
-					elem.subobject_name = hg_name;
-					elem.hit_group_type = hit_group_type;
-					elem.exports = { ahit, chit, intersection };
-					rdat_subobjects.push_back(std::move(elem));
-					break;
-				}
-
 				case DXIL::SubobjectKind::SubobjectToExportsAssociation:
-				{
-					RDATSubobject elem = {};
-					elem.kind = kind;
-					uint32_t name_offset;
-
-					if (!record_stream.read(name_offset))
-						return false;
-
-					const char *name;
-					if (!string_buffer.map_string_absolute(name, name_offset))
-						return false;
-
-					elem.subobject_name = name;
-
-					if (!record_stream.read(name_offset))
-						return false;
-					const char *object_name;
-					if (!string_buffer.map_string_absolute(object_name, name_offset))
-						return false;
-
-					elem.exports.push_back(object_name);
-
-					uint32_t index_offset;
-					if (!record_stream.read(index_offset))
-						return false;
-
-					auto index_substream = index_buffer.create_substream(sizeof(uint32_t) * index_offset);
-					uint32_t count;
-					if (!index_substream.read(count))
-						return false;
-
-					for (uint32_t export_index = 0; export_index < count; export_index++)
-					{
-						if (!index_substream.read(name_offset))
-							return false;
-						if (!string_buffer.map_string_absolute(object_name, name_offset))
-							return false;
-						elem.exports.push_back(object_name);
-					}
-
-					rdat_subobjects.push_back(std::move(elem));
-					break;
-				}
-
 				case DXIL::SubobjectKind::GlobalRootSignature:
 				case DXIL::SubobjectKind::LocalRootSignature:
-				{
-					uint32_t name_offset;
-
-					if (!record_stream.read(name_offset))
-						return false;
-
-					const char *name;
-					if (!string_buffer.map_string_absolute(name, name_offset))
-						return false;
-
-					uint32_t byte_offset;
-					uint32_t byte_size;
-					if (!record_stream.read(byte_offset))
-						return false;
-					if (!record_stream.read(byte_size))
-						return false;
-
-					auto name_substream = raw_bytes.create_substream(byte_offset, byte_size);
-					auto *data = name_substream.map_read<uint8_t>(byte_size);
-
-					RDATSubobject elem = {};
-					elem.kind = kind;
-					elem.subobject_name = name;
-					elem.payload = data;
-					elem.payload_size = byte_size;
-					rdat_subobjects.push_back(std::move(elem));
+					rdat_view.records.push_back(record);
 					break;
-				}
 
 				default:
 					break;
@@ -425,6 +564,8 @@ bool DXILContainerParser::parse_rdat(MemoryStream &stream)
 		}
 	}
 
+	rdat_view.subobjects.resize(rdat_view.records.size());
+	rdat_view.subobject_state.resize(rdat_view.records.size());
 	return true;
 }
 
@@ -26,13 +26,12 @@
 
 #include "thread_local_allocator.hpp"
 #include "dxil.hpp"
+#include "memory_stream.hpp"
 #include <stddef.h>
 #include <stdint.h>
 
 namespace dxil_spv
 {
-class MemoryStream;
-
 struct RDATSubobject
 {
 	// All strings point directly to the DXBC blob and the pointers are not owned.
@@ -56,18 +55,69 @@ struct RDATSubobject
 	size_t payload_size;
 };
 
+// Lazily decoded view of the RDAT subobject table.
+// Parsing the container only locates the tables and records which entries are of a known kind,
+// subobjects are decoded on first access. Not thread-safe, callers must serialize access.
+class RDATView
+{
+public:
+	uint32_t get_num_subobjects() const;
+
+	// Returned pointer is stable for the lifetime of the view. nullptr if the record is malformed.
+	const RDATSubobject *get_subobject(uint32_t index);
+
+	// Indices of subobjects associated with an export name, either through
+	// SubobjectToExportsAssociation or by being a member shader of a hit group.
+	// Associations which do not list any exports are default associations, and are found under "".
+	// The index is built on first query. Returns nullptr if there are no associations.
+	const Vector<uint32_t> *find_export_associations(const char *export_name);
+
+private:
+	friend class DXILContainerParser;
+	MemoryStream string_buffer;
+	MemoryStream index_buffer;
+	MemoryStream raw_bytes;
+	MemoryStream subobject_table;
+	uint32_t record_stride = 0;
+
+	// Record index in the subobject table for every subobject of a known kind.
+	Vector<uint32_t> records;
+	Vector<RDATSubobject> subobjects;
+	Vector<uint8_t> subobject_state;
+
+	struct StringHash
+	{
+		size_t operator()(const String &str) const;
+	};
+	UnorderedMap<String, Vector<uint32_t>, StringHash> export_associations;
+	bool export_associations_built = false;
+
+	bool decode_subobject(uint32_t record, RDATSubobject &elem) const;
+	bool decode_subobject_name(uint32_t index, const char *&name) const;
+	void build_export_associations();
+};
+
 class DXILContainerParser
 {
 public:
 	bool parse_container(const void *data, size_t size, bool reflection);
 	Vector<uint8_t> &get_blob();
-	Vector<RDATSubobject> &get_rdat_subobjects();
+	RDATView &get_rdat_view();
+
+	// If enabled, the DXIL part is not copied into get_blob(), and get_blob_stream()
+	// points directly into the container, like the RDAT subobject strings.
+	void set_borrow_blob(bool enable);
+
+	// Always valid after a successful parse. Points into get_blob() unless the blob is borrowed.
+	const MemoryStream &get_blob_stream() const;
 
 private:
 	Vector<uint8_t> dxil_blob;
+	MemoryStream dxil_stream;
+	bool borrow_blob = false;
 	Vector<DXIL::IOElement> input_elements;
 	Vector<DXIL::IOElement> output_elements;
-	Vector<RDATSubobject> rdat_subobjects;
+	RDATView rdat_view;
 
 	bool parse_dxil(MemoryStream &stream);
 	bool parse_iosg1(MemoryStream &stream, Vector<DXIL::IOElement> &elements);
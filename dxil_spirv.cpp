@@ -28,12 +28,26 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <unordered_set>
 #include <vector>
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
 #include "dxil_spirv_c.h"
 
 #include "cli_parser.hpp"
 #include "logging.hpp"
+#include "mapped_file.hpp"
 #include "spirv-tools/libspirv.hpp"
 #include "spirv_cross_c.h"
 
@@ -101,26 +115,6 @@ cleanup:
 	return ret;
 }
 
-static std::vector<uint8_t> read_file(const char *path)
-{
-	FILE *file = fopen(path, "rb");
-	if (!file)
-		return {};
-
-	fseek(file, 0, SEEK_END);
-	auto len = ftell(file);
-	rewind(file);
-	std::vector<uint8_t> result(len);
-	if (fread(result.data(), 1, len, file) != size_t(len))
-	{
-		fclose(file);
-		return {};
-	}
-
-	fclose(file);
-	return result;
-}
-
 static void print_help()
 {
 	LOGE("Usage: dxil-spirv <input path>\n"
@@ -153,8 +147,11 @@ static void print_help()
 	     "\t[--storage-input-output-16bit]\n"
 	     "\t[--root-descriptor <cbv/uav/srv> <space> <register>]\n"
 	     "\t[--descriptor-qa <set> <binding base> <shader hash>]\n"
+	     "\t[--descriptor-qa-deduplicate]\n"
+	     "\t[--descriptor-qa-kill-switch <spec id>]\n"
 	     "\t[--min-precision-native-16bit]\n"
 	     "\t[--raw-llvm]\n"
+	     "\t[--parse-threads <count>]\n"
 	     "\t[--use-reflection-names]\n"
 	     "\t[--invariant-position]\n"
 	     "\t[--robust-physical-cbv-load]\n"
@@ -169,11 +166,57 @@ static void print_help()
 	     "\t[--force-branch]\n"
 	     "\t[--force-unroll]\n"
 	     "\t[--subgroup-size minimum maximum]\n"
-	     "\t[--descriptor-heap-robustness]\n");
+	     "\t[--descriptor-heap-robustness]\n"
+	     "\t[--spirv-optimize]\n"
+	     "\t[--peephole-optimize]\n"
+	     "\t[--coalesce-buffer-loads]\n"
+	     "\t[--uniformity-analysis]\n"
+	     "\t[--ray-payload-liveness]\n"
+	     "\t[--loop-invariant-code-motion]\n"
+	     "\t[--sparse-feedback-forwarding]\n"
+	     "\t[--structured-cfg-fast-path]\n"
+	     "\t[--known-root-constant <word> <value>]\n"
+	     "\t[--sbt-descriptor-size-spec-ids <srv-uav-cbv-spec-id> <sampler-spec-id>]\n"
+	     "\t[--link-stage-outputs]\n"
+	     "\t[--consumer-input <semantic> <index>]\n"
+	     "\t[--hull-barrier-elision]\n"
+	     "\t[--geometry-output-vertex-analysis]\n"
+	     "\t[--min-precision-narrowing]\n"
+	     "\t[--wave-aggregated-atomics]\n"
+	     "\t[--uav-coherence-analysis]\n"
+	     "\t[--physical-address-alignment <align>]\n"
+	     "\t[--alloca-scalarization]\n"
+	     "\t[--sampler-feedback-lod-merging]\n"
+	     "\t[--canonicalize-spirv]\n"
+	     "\t[--mesh-output-store-coalescing]\n"
+	     "\t[--structurizer-complexity-budget <node growth factor, 0 disables>]\n"
+	     "\t[--constant-folding]\n"
+	     "\t[--sample-grad-optimization]\n"
+	     "\t[--sample-grad-assume-uniform-scale]\n"
+	     "\t[--batch-manifest <file>]\n"
+	     "\t[--batch-directory <dir>]\n"
+	     "\t[--batch-output-dir <dir>]\n"
+	     "\t[--batch-threads <count>]\n"
+	     "\t[--batch-summary <file.json>]\n"
+	     "\tBatch mode converts many inputs in one process on a thread pool.\n"
+	     "\tEvery manifest line is an input followed by per-file options, which apply on top of the command line.\n"
+	     "\tOutputs default to <batch-output-dir>/<input name>.spv, .asm or .glsl.\n"
+	     "\tIf several inputs share a name, later ones are written to <input name>.<n>.spv and so on.\n");
 }
 
 struct Arguments
 {
+	Arguments()
+	{
+		offset_buffer_layout.base.type = DXIL_SPV_OPTION_BINDLESS_OFFSET_BUFFER_LAYOUT;
+		offset_buffer_layout.untyped_offset = 0;
+		offset_buffer_layout.typed_offset = 0;
+		offset_buffer_layout.stride = 1;
+
+		// Begin with identity swizzles.
+		swizzles.resize(8, 0 | (1 << 2) | (2 << 4) | (3 << 6));
+	}
+
 	std::string input_path;
 	std::string output_path;
 	std::string entry_point;
@@ -196,6 +239,8 @@ struct Arguments
 	bool bindless_typed_buffer_offsets = false;
 	bool min_precision_native_16bit = false;
 	bool raw_llvm = false;
+	// If not 0, function bodies of a DXBC container are decoded on this many threads.
+	unsigned parse_threads = 0;
 	bool use_reflection_names = false;
 	bool invariant_position = false;
 	bool robust_physical_cbv_load = false;
@@ -210,6 +255,38 @@ struct Arguments
 	bool force_branch = false;
 	bool force_unroll = false;
 	bool descriptor_heap_robustness = false;
+	bool spirv_optimize = false;
+	bool peephole_optimize = false;
+	bool coalesce_buffer_loads = false;
+	bool uniformity_analysis = false;
+	bool ray_payload_liveness = false;
+	bool loop_invariant_code_motion = false;
+	bool sparse_feedback_forwarding = false;
+	bool structured_cfg_fast_path = false;
+	bool local_root_signature = false;
+	std::vector<unsigned> known_root_constant_words;
+	std::vector<unsigned> known_root_constant_values;
+	bool sbt_descriptor_size_spec_constants = false;
+	unsigned sbt_descriptor_size_srv_uav_cbv_spec_id = 0;
+	unsigned sbt_descriptor_size_sampler_spec_id = 0;
+	bool link_stage_outputs = false;
+	std::vector<std::string> consumer_input_semantics;
+	std::vector<unsigned> consumer_input_indices;
+	bool hull_barrier_elision = false;
+	bool geometry_output_vertex_analysis = false;
+	bool min_precision_narrowing = false;
+	bool wave_aggregated_atomics = false;
+	bool uav_coherence_analysis = false;
+	unsigned physical_address_alignment = 0;
+	bool alloca_scalarization = false;
+	bool sampler_feedback_lod_merging = false;
+	bool canonicalize_spirv = false;
+	bool mesh_output_store_coalescing = false;
+	bool structurizer_complexity_budget = false;
+	unsigned structurizer_node_growth_factor = 0;
+	bool constant_folding = false;
+	bool sample_grad_optimization = false;
+	bool sample_grad_assume_uniform_scale = false;
 
 	unsigned ssbo_alignment = 1;
 	unsigned physical_address_indexing_stride = 1;
@@ -220,6 +297,9 @@ struct Arguments
 	bool descriptor_qa = false;
 	uint32_t descriptor_qa_set = 0;
 	uint32_t descriptor_qa_binding = 0;
+	bool descriptor_qa_deduplicate = false;
+	bool descriptor_qa_kill_switch = false;
+	uint32_t descriptor_qa_kill_switch_spec_id = 0;
 	uint64_t shader_hash = 0;
 
 	dxil_spv_option_bindless_offset_buffer_layout offset_buffer_layout;
@@ -564,26 +644,9 @@ static dxil_spv_bool remap_stream_output(void *userdata, const dxil_spv_d3d_stre
 	return DXIL_SPV_TRUE;
 }
 
-int main(int argc, char **argv)
+// Everything which can be set per input, both on the command line and per file in a batch manifest.
+static void add_conversion_callbacks(CLICallbacks &cbs, Arguments &args, Remapper &remapper)
 {
-	Arguments args;
-	Remapper remapper;
-	bool local_root_signature = false;
-	dxil_spv_begin_thread_allocator_context();
-
-	args.offset_buffer_layout.base.type = DXIL_SPV_OPTION_BINDLESS_OFFSET_BUFFER_LAYOUT;
-	args.offset_buffer_layout.untyped_offset = 0;
-	args.offset_buffer_layout.typed_offset = 0;
-	args.offset_buffer_layout.stride = 1;
-
-	// Begin with identity swizzles.
-	args.swizzles.resize(8, 0 | (1 << 2) | (2 << 4) | (3 << 6));
-
-	CLICallbacks cbs;
-	cbs.add("--help", [](CLIParser &parser) {
-		print_help();
-		parser.end();
-	});
 	cbs.add("--dump-module", [&](CLIParser &) { args.dump_module = true; });
 	cbs.add("--glsl", [&](CLIParser &) { args.glsl = true; });
 	cbs.add("--asm", [&](CLIParser &) { args.emit_asm = true; });
@@ -626,7 +689,7 @@ int main(int argc, char **argv)
 		remapper.uav_counter_force_texel_buffer = true;
 	});
 	cbs.add("--local-root-signature", [&](CLIParser &) {
-		local_root_signature = true;
+		args.local_root_signature = true;
 	});
 	cbs.add("--root-descriptor", [&](CLIParser &parser) {
 		const char *tag = parser.next_string();
@@ -735,8 +798,14 @@ int main(int argc, char **argv)
 		args.descriptor_qa_binding = parser.next_uint();
 		args.shader_hash = uint64_t(strtoull(parser.next_string(), nullptr, 16));
 	});
+	cbs.add("--descriptor-qa-deduplicate", [&](CLIParser &) { args.descriptor_qa_deduplicate = true; });
+	cbs.add("--descriptor-qa-kill-switch", [&](CLIParser &parser) {
+		args.descriptor_qa_kill_switch = true;
+		args.descriptor_qa_kill_switch_spec_id = parser.next_uint();
+	});
 	cbs.add("--min-precision-native-16bit", [&](CLIParser &) { args.min_precision_native_16bit = true; });
 	cbs.add("--raw-llvm", [&](CLIParser &) { args.raw_llvm = true; });
+	cbs.add("--parse-threads", [&](CLIParser &parser) { args.parse_threads = parser.next_uint(); });
 	cbs.add("--use-reflection-names", [&](CLIParser &) { args.use_reflection_names = true; });
 	cbs.add("--invariant-position", [&](CLIParser &) { args.invariant_position = true; });
 	cbs.add("--robust-physical-cbv-load", [&](CLIParser &) { args.robust_physical_cbv_load = true; });
@@ -779,55 +848,146 @@ int main(int argc, char **argv)
 	cbs.add("--descriptor-heap-robustness", [&](CLIParser &parser) {
 		args.descriptor_heap_robustness = true;
 	});
-	cbs.error_handler = [] { print_help(); };
-	cbs.default_handler = [&](const char *arg) { args.input_path = arg; };
-	CLIParser cli_parser(std::move(cbs), argc - 1, argv + 1);
-	if (!cli_parser.parse())
-		return EXIT_FAILURE;
-	else if (cli_parser.is_ended_state())
-		return EXIT_SUCCESS;
+	cbs.add("--spirv-optimize", [&](CLIParser &parser) {
+		args.spirv_optimize = true;
+	});
+	cbs.add("--peephole-optimize", [&](CLIParser &parser) {
+		args.peephole_optimize = true;
+	});
+	cbs.add("--coalesce-buffer-loads", [&](CLIParser &parser) {
+		args.coalesce_buffer_loads = true;
+	});
+	cbs.add("--uniformity-analysis", [&](CLIParser &parser) {
+		args.uniformity_analysis = true;
+	});
+	cbs.add("--ray-payload-liveness", [&](CLIParser &parser) {
+		args.ray_payload_liveness = true;
+	});
+	cbs.add("--loop-invariant-code-motion", [&](CLIParser &parser) {
+		args.loop_invariant_code_motion = true;
+	});
+	cbs.add("--sparse-feedback-forwarding", [&](CLIParser &parser) {
+		args.sparse_feedback_forwarding = true;
+	});
+	cbs.add("--structured-cfg-fast-path", [&](CLIParser &parser) {
+		args.structured_cfg_fast_path = true;
+	});
+	cbs.add("--known-root-constant", [&](CLIParser &parser) {
+		args.known_root_constant_words.push_back(parser.next_uint());
+		args.known_root_constant_values.push_back(parser.next_uint());
+	});
+	cbs.add("--sbt-descriptor-size-spec-ids", [&](CLIParser &parser) {
+		args.sbt_descriptor_size_spec_constants = true;
+		args.sbt_descriptor_size_srv_uav_cbv_spec_id = parser.next_uint();
+		args.sbt_descriptor_size_sampler_spec_id = parser.next_uint();
+	});
+	cbs.add("--link-stage-outputs", [&](CLIParser &) { args.link_stage_outputs = true; });
+	cbs.add("--consumer-input", [&](CLIParser &parser) {
+		args.link_stage_outputs = true;
+		args.consumer_input_semantics.push_back(parser.next_string());
+		args.consumer_input_indices.push_back(parser.next_uint());
+	});
+	cbs.add("--hull-barrier-elision", [&](CLIParser &) { args.hull_barrier_elision = true; });
+	cbs.add("--geometry-output-vertex-analysis", [&](CLIParser &) { args.geometry_output_vertex_analysis = true; });
+	cbs.add("--min-precision-narrowing", [&](CLIParser &) { args.min_precision_narrowing = true; });
+	cbs.add("--wave-aggregated-atomics", [&](CLIParser &) { args.wave_aggregated_atomics = true; });
+	cbs.add("--uav-coherence-analysis", [&](CLIParser &) { args.uav_coherence_analysis = true; });
+	cbs.add("--physical-address-alignment", [&](CLIParser &parser) {
+		args.physical_address_alignment = parser.next_uint();
+	});
+	cbs.add("--alloca-scalarization", [&](CLIParser &) { args.alloca_scalarization = true; });
+	cbs.add("--sampler-feedback-lod-merging", [&](CLIParser &) { args.sampler_feedback_lod_merging = true; });
+	cbs.add("--canonicalize-spirv", [&](CLIParser &) { args.canonicalize_spirv = true; });
+	cbs.add("--mesh-output-store-coalescing", [&](CLIParser &) { args.mesh_output_store_coalescing = true; });
+	cbs.add("--structurizer-complexity-budget", [&](CLIParser &parser) {
+		args.structurizer_complexity_budget = true;
+		args.structurizer_node_growth_factor = parser.next_uint();
+	});
+	cbs.add("--constant-folding", [&](CLIParser &) { args.constant_folding = true; });
+	cbs.add("--sample-grad-optimization", [&](CLIParser &) { args.sample_grad_optimization = true; });
+	cbs.add("--sample-grad-assume-uniform-scale", [&](CLIParser &) { args.sample_grad_assume_uniform_scale = true; });
+}
 
-	if (args.input_path.empty())
+namespace
+{
+// Frees everything on any exit path, which matters when converting many files in one process.
+struct ConversionObjects
+{
+	dxil_spv_parsed_blob blob = nullptr;
+	dxil_spv_parsed_blob reflection_blob = nullptr;
+	dxil_spv_converter converter = nullptr;
+
+	ConversionObjects() = default;
+	ConversionObjects(const ConversionObjects &) = delete;
+	void operator=(const ConversionObjects &) = delete;
+
+	~ConversionObjects()
 	{
-		LOGE("No input file.\n");
-		print_help();
-		return EXIT_FAILURE;
+		if (converter)
+			dxil_spv_converter_free(converter);
+		if (blob)
+			dxil_spv_parsed_blob_free(blob);
+		if (reflection_blob)
+			dxil_spv_parsed_blob_free(reflection_blob);
 	}
+};
+} // namespace
 
-	auto binary = read_file(args.input_path.c_str());
-	if (binary.empty())
+// Converts args.input_path and writes the result to args.output_path, or stdout if there is no output path.
+static bool run_conversion(const Arguments &args, Remapper &remapper)
+{
+	// The mapping outlives every blob, so the container can be parsed without copying the DXIL part out.
+	dxil_spv::MappedFile binary;
+	if (!binary.open(args.input_path.c_str()) || binary.get_size() == 0)
 	{
 		LOGE("Failed to load file: %s\n", args.input_path.c_str());
-		return EXIT_FAILURE;
+		return false;
 	}
 
-	dxil_spv_parsed_blob reflection_blob = nullptr;
-	dxil_spv_parsed_blob blob;
+	ConversionObjects objects;
+	auto &blob = objects.blob;
+	auto &reflection_blob = objects.reflection_blob;
 
 	if (args.raw_llvm)
 	{
-		if (dxil_spv_parse_dxil(binary.data(), binary.size(), &blob) != DXIL_SPV_SUCCESS)
+		if (dxil_spv_parse_dxil(binary.get_data(), binary.get_size(), &blob) != DXIL_SPV_SUCCESS)
 		{
 			LOGE("Failed to parse raw LLVM blob.\n");
-			return EXIT_FAILURE;
+			return false;
+		}
+	}
+	else if (args.parse_threads)
+	{
+		dxil_spv_batch batch;
+		if (dxil_spv_batch_create(args.parse_threads, &batch) != DXIL_SPV_SUCCESS)
+			return false;
+		auto result = dxil_spv_batch_parse_dxil_blob(batch, binary.get_data(), binary.get_size(),
+		                                             DXIL_SPV_PARSE_BORROW_INPUT_BIT, &blob);
+		dxil_spv_batch_free(batch);
+
+		if (result != DXIL_SPV_SUCCESS)
+		{
+			LOGE("Failed to parse blob.\n");
+			return false;
 		}
 	}
 	else
 	{
-		if (dxil_spv_parse_dxil_blob(binary.data(), binary.size(), &blob) != DXIL_SPV_SUCCESS)
+		if (dxil_spv_parse_dxil_blob_with_flags(binary.get_data(), binary.get_size(),
+		                                        DXIL_SPV_PARSE_BORROW_INPUT_BIT, &blob) != DXIL_SPV_SUCCESS)
 		{
 			LOGE("Failed to parse blob.\n");
-			return EXIT_FAILURE;
+			return false;
 		}
 	}
 
 	if (args.use_reflection_names)
 	{
-		auto result = dxil_spv_parse_reflection_dxil_blob(binary.data(), binary.size(), &reflection_blob);
+		auto result = dxil_spv_parse_reflection_dxil_blob(binary.get_data(), binary.get_size(), &reflection_blob);
 		if (result != DXIL_SPV_SUCCESS && result != DXIL_SPV_ERROR_NO_DATA)
 		{
 			LOGE("Failed to parse blob.\n");
-			return EXIT_FAILURE;
+			return false;
 		}
 		else if (result == DXIL_SPV_ERROR_NO_DATA)
 		{
@@ -839,9 +999,9 @@ int main(int argc, char **argv)
 	if (args.dump_module)
 		dxil_spv_parsed_blob_dump_llvm_ir(blob);
 
-	dxil_spv_converter converter;
+	auto &converter = objects.converter;
 	if (dxil_spv_create_converter_with_reflection(blob, reflection_blob, &converter) != DXIL_SPV_SUCCESS)
-		return EXIT_FAILURE;
+		return false;
 
 	dxil_spv_converter_set_srv_remapper(converter, remap_srv, &remapper);
 	dxil_spv_converter_set_sampler_remapper(converter, remap_sampler, &remapper);
@@ -853,7 +1013,7 @@ int main(int argc, char **argv)
 	dxil_spv_converter_set_root_constant_word_count(converter, remapper.root_constant_word_count);
 	dxil_spv_converter_set_root_descriptor_count(converter, remapper.root_descriptors.size());
 
-	if (local_root_signature)
+	if (args.local_root_signature)
 	{
 		dxil_spv_converter_add_local_root_constants(converter, 15, 0, 5);
 		dxil_spv_converter_add_local_root_constants(converter, 15, 1, 6);
@@ -962,6 +1122,17 @@ int main(int argc, char **argv)
 		dxil_spv_converter_add_option(converter, &qa.base);
 	}
 
+	if (args.descriptor_qa_deduplicate || args.descriptor_qa_kill_switch)
+	{
+		const dxil_spv_option_descriptor_qa_sampling sampling = {
+			{ DXIL_SPV_OPTION_DESCRIPTOR_QA_SAMPLING },
+			args.descriptor_qa_deduplicate ? DXIL_SPV_TRUE : DXIL_SPV_FALSE,
+			args.descriptor_qa_kill_switch ? DXIL_SPV_TRUE : DXIL_SPV_FALSE,
+			args.descriptor_qa_kill_switch_spec_id
+		};
+		dxil_spv_converter_add_option(converter, &sampling.base);
+	}
+
 	{
 		const dxil_spv_option_min_precision_native_16bit minprec = { { DXIL_SPV_OPTION_MIN_PRECISION_NATIVE_16BIT },
 		                                                             args.min_precision_native_16bit ? DXIL_SPV_TRUE : DXIL_SPV_FALSE };
@@ -1060,6 +1231,189 @@ int main(int argc, char **argv)
 		dxil_spv_converter_add_option(converter, &robustness.base);
 	}
 
+	if (args.spirv_optimize)
+	{
+		const dxil_spv_option_spirv_optimization opt = { { DXIL_SPV_OPTION_SPIRV_OPTIMIZATION }, DXIL_SPV_TRUE };
+		dxil_spv_converter_add_option(converter, &opt.base);
+	}
+
+	if (args.peephole_optimize)
+	{
+		const dxil_spv_option_peephole_optimization opt = { { DXIL_SPV_OPTION_PEEPHOLE_OPTIMIZATION }, DXIL_SPV_TRUE };
+		dxil_spv_converter_add_option(converter, &opt.base);
+	}
+
+	if (args.coalesce_buffer_loads)
+	{
+		const dxil_spv_option_buffer_load_coalescing opt = { { DXIL_SPV_OPTION_BUFFER_LOAD_COALESCING }, DXIL_SPV_TRUE };
+		dxil_spv_converter_add_option(converter, &opt.base);
+	}
+
+	if (args.uniformity_analysis)
+	{
+		const dxil_spv_option_uniformity_analysis opt = { { DXIL_SPV_OPTION_UNIFORMITY_ANALYSIS }, DXIL_SPV_TRUE };
+		dxil_spv_converter_add_option(converter, &opt.base);
+	}
+
+	if (args.ray_payload_liveness)
+	{
+		const dxil_spv_option_ray_payload_liveness opt = { { DXIL_SPV_OPTION_RAY_PAYLOAD_LIVENESS }, DXIL_SPV_TRUE };
+		dxil_spv_converter_add_option(converter, &opt.base);
+	}
+
+	if (args.loop_invariant_code_motion)
+	{
+		const dxil_spv_option_loop_invariant_code_motion opt = {
+			{ DXIL_SPV_OPTION_LOOP_INVARIANT_CODE_MOTION }, DXIL_SPV_TRUE
+		};
+		dxil_spv_converter_add_option(converter, &opt.base);
+	}
+
+	if (args.sparse_feedback_forwarding)
+	{
+		const dxil_spv_option_sparse_feedback_forwarding opt = {
+			{ DXIL_SPV_OPTION_SPARSE_FEEDBACK_FORWARDING }, DXIL_SPV_TRUE
+		};
+		dxil_spv_converter_add_option(converter, &opt.base);
+	}
+
+	if (args.structured_cfg_fast_path)
+	{
+		const dxil_spv_option_structured_cfg_fast_path opt = {
+			{ DXIL_SPV_OPTION_STRUCTURED_CFG_FAST_PATH }, DXIL_SPV_TRUE
+		};
+		dxil_spv_converter_add_option(converter, &opt.base);
+	}
+
+	if (!args.known_root_constant_words.empty())
+	{
+		const dxil_spv_option_known_root_constants opt = {
+			{ DXIL_SPV_OPTION_KNOWN_ROOT_CONSTANTS },
+			args.known_root_constant_words.data(),
+			args.known_root_constant_values.data(),
+			unsigned(args.known_root_constant_words.size())
+		};
+		dxil_spv_converter_add_option(converter, &opt.base);
+	}
+
+	if (args.sbt_descriptor_size_spec_constants)
+	{
+		const dxil_spv_option_sbt_descriptor_size_spec_constants opt = {
+			{ DXIL_SPV_OPTION_SBT_DESCRIPTOR_SIZE_SPEC_CONSTANTS },
+			DXIL_SPV_TRUE,
+			args.sbt_descriptor_size_srv_uav_cbv_spec_id,
+			args.sbt_descriptor_size_sampler_spec_id
+		};
+		dxil_spv_converter_add_option(converter, &opt.base);
+	}
+
+	// Must outlive the conversion.
+	std::vector<const char *> semantic_names;
+	if (args.link_stage_outputs)
+	{
+		for (auto &semantic : args.consumer_input_semantics)
+			semantic_names.push_back(semantic.c_str());
+
+		const dxil_spv_option_consumer_stage_inputs opt = {
+			{ DXIL_SPV_OPTION_CONSUMER_STAGE_INPUTS },
+			DXIL_SPV_TRUE,
+			semantic_names.data(),
+			args.consumer_input_indices.data(),
+			unsigned(semantic_names.size())
+		};
+		dxil_spv_converter_add_option(converter, &opt.base);
+	}
+
+	if (args.hull_barrier_elision)
+	{
+		const dxil_spv_option_hull_barrier_elision opt = { { DXIL_SPV_OPTION_HULL_BARRIER_ELISION }, DXIL_SPV_TRUE };
+		dxil_spv_converter_add_option(converter, &opt.base);
+	}
+
+	if (args.geometry_output_vertex_analysis)
+	{
+		const dxil_spv_option_geometry_output_vertex_analysis opt = {
+			{ DXIL_SPV_OPTION_GEOMETRY_OUTPUT_VERTEX_ANALYSIS }, DXIL_SPV_TRUE
+		};
+		dxil_spv_converter_add_option(converter, &opt.base);
+	}
+
+	if (args.min_precision_narrowing)
+	{
+		const dxil_spv_option_min_precision_narrowing opt = { { DXIL_SPV_OPTION_MIN_PRECISION_NARROWING }, DXIL_SPV_TRUE };
+		dxil_spv_converter_add_option(converter, &opt.base);
+	}
+
+	if (args.wave_aggregated_atomics)
+	{
+		const dxil_spv_option_wave_aggregated_atomics opt = { { DXIL_SPV_OPTION_WAVE_AGGREGATED_ATOMICS }, DXIL_SPV_TRUE };
+		dxil_spv_converter_add_option(converter, &opt.base);
+	}
+
+	if (args.uav_coherence_analysis)
+	{
+		const dxil_spv_option_uav_coherence_analysis opt = { { DXIL_SPV_OPTION_UAV_COHERENCE_ANALYSIS }, DXIL_SPV_TRUE };
+		dxil_spv_converter_add_option(converter, &opt.base);
+	}
+
+	if (args.physical_address_alignment)
+	{
+		const dxil_spv_option_physical_address_alignment opt = { { DXIL_SPV_OPTION_PHYSICAL_ADDRESS_ALIGNMENT },
+			                                                     args.physical_address_alignment };
+		dxil_spv_converter_add_option(converter, &opt.base);
+	}
+
+	if (args.alloca_scalarization)
+	{
+		const dxil_spv_option_alloca_scalarization opt = { { DXIL_SPV_OPTION_ALLOCA_SCALARIZATION }, DXIL_SPV_TRUE };
+		dxil_spv_converter_add_option(converter, &opt.base);
+	}
+
+	if (args.sampler_feedback_lod_merging)
+	{
+		const dxil_spv_option_sampler_feedback_lod_merging opt = { { DXIL_SPV_OPTION_SAMPLER_FEEDBACK_LOD_MERGING },
+			                                                       DXIL_SPV_TRUE };
+		dxil_spv_converter_add_option(converter, &opt.base);
+	}
+
+	if (args.canonicalize_spirv)
+	{
+		const dxil_spv_option_spirv_canonicalization opt = { { DXIL_SPV_OPTION_SPIRV_CANONICALIZATION },
+			                                                 DXIL_SPV_TRUE };
+		dxil_spv_converter_add_option(converter, &opt.base);
+	}
+
+	if (args.mesh_output_store_coalescing)
+	{
+		const dxil_spv_option_mesh_output_store_coalescing opt = {
+			{ DXIL_SPV_OPTION_MESH_OUTPUT_STORE_COALESCING }, DXIL_SPV_TRUE
+		};
+		dxil_spv_converter_add_option(converter, &opt.base);
+	}
+
+	if (args.structurizer_complexity_budget)
+	{
+		const dxil_spv_option_structurizer_complexity_budget opt = {
+			{ DXIL_SPV_OPTION_STRUCTURIZER_COMPLEXITY_BUDGET }, args.structurizer_node_growth_factor
+		};
+		dxil_spv_converter_add_option(converter, &opt.base);
+	}
+
+	if (args.constant_folding)
+	{
+		const dxil_spv_option_constant_folding opt = { { DXIL_SPV_OPTION_CONSTANT_FOLDING }, DXIL_SPV_TRUE };
+		dxil_spv_converter_add_option(converter, &opt.base);
+	}
+
+	if (args.sample_grad_optimization)
+	{
+		const dxil_spv_option_sample_grad_optimization_control opt = {
+			{ DXIL_SPV_OPTION_SAMPLE_GRAD_OPTIMIZATION_CONTROL }, DXIL_SPV_TRUE,
+			args.sample_grad_assume_uniform_scale ? DXIL_SPV_TRUE : DXIL_SPV_FALSE
+		};
+		dxil_spv_converter_add_option(converter, &opt.base);
+	}
+
 	dxil_spv_converter_add_option(converter, &args.offset_buffer_layout.base);
 
 	unsigned num_entry_points = 1;
@@ -1082,12 +1436,12 @@ int main(int argc, char **argv)
 		if (dxil_spv_converter_run(converter) != DXIL_SPV_SUCCESS)
 		{
 			LOGE("Failed to convert DXIL to SPIR-V.\n");
-			return EXIT_FAILURE;
+			return false;
 		}
 
 		dxil_spv_compiled_spirv compiled;
 		if (dxil_spv_converter_get_compiled_spirv(converter, &compiled) != DXIL_SPV_SUCCESS)
-			return EXIT_FAILURE;
+			return false;
 
 		unsigned heuristic_wave_size = 0;
 		unsigned wave_size = 0;
@@ -1099,7 +1453,7 @@ int main(int argc, char **argv)
 			if (!validate_spirv(compiled.data, compiled.size))
 			{
 				LOGE("Failed to validate SPIR-V.\n");
-				return EXIT_FAILURE;
+				return false;
 			}
 		}
 
@@ -1139,7 +1493,7 @@ int main(int argc, char **argv)
 			if (compiled_glsl.empty())
 			{
 				LOGE("Failed to convert to GLSL.\n");
-				return EXIT_FAILURE;
+				return false;
 			}
 
 			if (!spirv_asm_string.empty())
@@ -1173,7 +1527,7 @@ int main(int argc, char **argv)
 			if (demangled_entry)
 			{
 				LOGE("Cannot emit binary output when using debug-all-entry-points.\n");
-				return EXIT_FAILURE;
+				return false;
 			}
 
 			FILE *file = fopen(args.output_path.c_str(), "wb");
@@ -1182,12 +1536,16 @@ int main(int argc, char **argv)
 				if (fwrite(compiled.data, 1, compiled.size, file) != compiled.size)
 				{
 					LOGE("Failed to write SPIR-V.\n");
-					return EXIT_FAILURE;
+					fclose(file);
+					return false;
 				}
 				fclose(file);
 			}
 			else
+			{
 				LOGE("Failed to open %s.\n", args.output_path.c_str());
+				return false;
+			}
 		}
 	}
 
@@ -1202,6 +1560,8 @@ int main(int argc, char **argv)
 			{
 				dxil_spv_rdat_subobject obj;
 				dxil_spv_parsed_blob_get_rdat_subobject(blob, i, &obj);
+				if (!obj.subobject_name)
+					continue;
 				switch (obj.kind)
 				{
 				case DXIL_SPV_RDAT_SUBOBJECT_KIND_STATE_OBJECT_CONFIG:
@@ -1291,16 +1651,380 @@ int main(int argc, char **argv)
 		if (!file)
 		{
 			LOGE("Failed to open %s for writing.\n", args.output_path.c_str());
-			return EXIT_FAILURE;
+			return false;
 		}
 		fprintf(file, "%s\n", final_output.c_str());
 		fclose(file);
 	}
 
-	dxil_spv_converter_free(converter);
-	dxil_spv_parsed_blob_free(blob);
-	if (reflection_blob)
-		dxil_spv_parsed_blob_free(reflection_blob);
+	return true;
+}
+
+struct BatchOptions
+{
+	std::string manifest;
+	std::string directory;
+	std::string output_dir;
+	std::string summary;
+	unsigned num_threads = 0;
+};
+
+struct BatchJob
+{
+	Arguments args;
+	Remapper remapper;
+	uint64_t time_ns = 0;
+	bool ok = false;
+};
+
+static std::string get_basename(const std::string &path)
+{
+	auto pos = path.find_last_of("/\\");
+	return pos == std::string::npos ? path : path.substr(pos + 1);
+}
+
+// Inputs from different directories, or the same input listed twice in a manifest, can share a name.
+// Later ones get a numbered suffix rather than overwriting an earlier output.
+static std::string get_batch_output_path(const Arguments &args, const BatchOptions &options,
+                                         std::unordered_set<std::string> &used_paths)
+{
+	const char *ext = args.glsl ? ".glsl" : (args.emit_asm ? ".asm" : ".spv");
+	std::string base = options.output_dir + "/" + get_basename(args.input_path);
+	std::string path = base + ext;
+
+	for (unsigned index = 1; used_paths.count(path); index++)
+		path = base + "." + std::to_string(index) + ext;
+
+	used_paths.insert(path);
+	return path;
+}
+
+// Splits on whitespace, double quotes group an argument with spaces.
+static std::vector<std::string> split_manifest_line(const std::string &line)
+{
+	std::vector<std::string> tokens;
+	std::string token;
+	bool in_quote = false;
+	bool has_token = false;
+
+	for (char c : line)
+	{
+		if (c == '"')
+		{
+			in_quote = !in_quote;
+			has_token = true;
+		}
+		else if (!in_quote && (c == ' ' || c == '\t'))
+		{
+			if (has_token)
+				tokens.push_back(std::move(token));
+			token.clear();
+			has_token = false;
+		}
+		else
+		{
+			token += c;
+			has_token = true;
+		}
+	}
+
+	if (has_token)
+		tokens.push_back(std::move(token));
+	return tokens;
+}
+
+// Every line is an input path followed by options which apply on top of the command line options.
+// Empty lines and lines starting with # are ignored.
+static bool read_batch_manifest(const std::string &path, const Arguments &base_args, const Remapper &base_remapper,
+                                std::vector<BatchJob> &jobs)
+{
+	FILE *file = fopen(path.c_str(), "r");
+	if (!file)
+	{
+		LOGE("Failed to open manifest %s.\n", path.c_str());
+		return false;
+	}
+
+	bool ret = true;
+	unsigned line_index = 0;
+	char line[4096];
+	while (ret && fgets(line, sizeof(line), file))
+	{
+		line_index++;
+		std::string str = line;
+		while (!str.empty() && (str.back() == '\n' || str.back() == '\r'))
+			str.pop_back();
+
+		auto tokens = split_manifest_line(str);
+		if (tokens.empty() || tokens.front()[0] == '#')
+			continue;
+
+		BatchJob job;
+		job.args = base_args;
+		job.remapper = base_remapper;
+		job.args.input_path.clear();
+		job.args.output_path.clear();
+
+		std::vector<char *> argv;
+		argv.reserve(tokens.size());
+		for (auto &token : tokens)
+			argv.push_back(&token[0]);
+
+		unsigned num_inputs = 0;
+		CLICallbacks cbs;
+		add_conversion_callbacks(cbs, job.args, job.remapper);
+		cbs.default_handler = [&](const char *arg) {
+			job.args.input_path = arg;
+			num_inputs++;
+		};
+		CLIParser parser(std::move(cbs), int(argv.size()), argv.data());
+
+		if (!parser.parse() || parser.is_ended_state() || num_inputs != 1)
+		{
+			LOGE("%s:%u: Expected one input file followed by valid options.\n", path.c_str(), line_index);
+			ret = false;
+		}
+		else
+			jobs.push_back(std::move(job));
+	}
+
+	fclose(file);
+	return ret;
+}
+
+// Non-recursive, hidden files are skipped. Sorted so the order does not depend on the file system.
+static bool list_directory(const std::string &path, std::vector<std::string> &files)
+{
+#ifdef _WIN32
+	WIN32_FIND_DATAA data;
+	HANDLE handle = FindFirstFileA((path + "\\*").c_str(), &data);
+	if (handle == INVALID_HANDLE_VALUE)
+		return false;
+
+	do
+	{
+		if ((data.dwFileAttributes & (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_HIDDEN)) == 0 &&
+		    data.cFileName[0] != '.')
+		{
+			files.push_back(path + "/" + data.cFileName);
+		}
+	} while (FindNextFileA(handle, &data));
+	FindClose(handle);
+#else
+	DIR *dir = opendir(path.c_str());
+	if (!dir)
+		return false;
+
+	while (auto *entry = readdir(dir))
+	{
+		if (entry->d_name[0] == '.')
+			continue;
+
+		std::string file_path = path + "/" + entry->d_name;
+		struct stat s;
+		if (stat(file_path.c_str(), &s) == 0 && S_ISREG(s.st_mode))
+			files.push_back(std::move(file_path));
+	}
+	closedir(dir);
+#endif
+
+	std::sort(files.begin(), files.end());
+	return true;
+}
+
+static void write_json_string(FILE *file, const std::string &str)
+{
+	fputc('"', file);
+	for (char c : str)
+	{
+		if (c == '"' || c == '\\')
+			fprintf(file, "\\%c", c);
+		else if (uint8_t(c) < 0x20)
+			fprintf(file, "\\u%04x", unsigned(uint8_t(c)));
+		else
+			fputc(c, file);
+	}
+	fputc('"', file);
+}
+
+static void write_batch_summary(FILE *file, const std::vector<BatchJob> &jobs, unsigned num_threads, uint64_t wall_ns)
+{
+	uint64_t total_ns = 0;
+	unsigned failed = 0;
+
+	fprintf(file, "{\n\t\"threads\": %u,\n\t\"files\": [\n", num_threads);
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		auto &job = jobs[i];
+		fprintf(file, "\t\t{ \"input\": ");
+		write_json_string(file, job.args.input_path);
+		fprintf(file, ", \"output\": ");
+		write_json_string(file, job.args.output_path);
+		fprintf(file, ", \"ok\": %s, \"time_ns\": %llu }%s\n", job.ok ? "true" : "false",
+		        static_cast<unsigned long long>(job.time_ns), i + 1 < jobs.size() ? "," : "");
+
+		total_ns += job.time_ns;
+		if (!job.ok)
+			failed++;
+	}
+
+	fprintf(file, "\t],\n\t\"aggregate\": {\n");
+	fprintf(file, "\t\t\"files\": %zu,\n\t\t\"failed\": %u,\n", jobs.size(), failed);
+	fprintf(file, "\t\t\"total_ns\": %llu,\n", static_cast<unsigned long long>(total_ns));
+	fprintf(file, "\t\t\"wall_ns\": %llu\n", static_cast<unsigned long long>(wall_ns));
+	fprintf(file, "\t}\n}\n");
+}
+
+static int run_batch(const BatchOptions &options, const Arguments &base_args, const Remapper &base_remapper)
+{
+	std::vector<BatchJob> jobs;
+
+	if (!options.manifest.empty() && !read_batch_manifest(options.manifest, base_args, base_remapper, jobs))
+		return EXIT_FAILURE;
+
+	if (!options.directory.empty())
+	{
+		std::vector<std::string> files;
+		if (!list_directory(options.directory, files))
+		{
+			LOGE("Failed to list directory %s.\n", options.directory.c_str());
+			return EXIT_FAILURE;
+		}
+
+		for (auto &file : files)
+		{
+			BatchJob job;
+			job.args = base_args;
+			job.remapper = base_remapper;
+			job.args.input_path = file;
+			job.args.output_path.clear();
+			jobs.push_back(std::move(job));
+		}
+	}
+
+	// Explicit outputs win, generated names avoid them.
+	std::unordered_set<std::string> used_paths;
+	for (auto &job : jobs)
+		if (!job.args.output_path.empty())
+			used_paths.insert(job.args.output_path);
+
+	for (auto &job : jobs)
+	{
+		if (job.args.output_path.empty())
+		{
+			if (options.output_dir.empty())
+			{
+				LOGE("No output for %s, use --batch-output-dir or --output in the manifest.\n",
+				     job.args.input_path.c_str());
+				return EXIT_FAILURE;
+			}
+			job.args.output_path = get_batch_output_path(job.args, options, used_paths);
+		}
+	}
+
+	unsigned num_threads = options.num_threads ? options.num_threads : std::thread::hardware_concurrency();
+	num_threads = std::max(1u, std::min(num_threads, unsigned(std::max<size_t>(jobs.size(), 1))));
+
+	// Jobs are picked in order as threads become available, so one slow shader only holds up one thread.
+	std::atomic<size_t> next_job{ 0 };
+	auto worker = [&]() {
+		dxil_spv_begin_thread_allocator_context();
+		for (size_t index = next_job.fetch_add(1, std::memory_order_relaxed); index < jobs.size();
+		     index = next_job.fetch_add(1, std::memory_order_relaxed))
+		{
+			auto &job = jobs[index];
+			auto start = std::chrono::steady_clock::now();
+			job.ok = run_conversion(job.args, job.remapper);
+			auto end = std::chrono::steady_clock::now();
+			job.time_ns = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+
+			if (!job.ok)
+				LOGE("Failed to convert %s.\n", job.args.input_path.c_str());
+			dxil_spv_reset_thread_allocator_context();
+		}
+		dxil_spv_end_thread_allocator_context();
+	};
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+	threads.reserve(num_threads);
+	for (unsigned i = 0; i < num_threads; i++)
+		threads.emplace_back(worker);
+	for (auto &thread : threads)
+		thread.join();
+	auto end = std::chrono::steady_clock::now();
+	auto wall_ns = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+
+	unsigned failed = 0;
+	for (auto &job : jobs)
+		if (!job.ok)
+			failed++;
+
+	LOGI("Converted %zu of %zu files in %.3f ms on %u threads.\n", jobs.size() - failed, jobs.size(),
+	     double(wall_ns) * 1e-6, num_threads);
+	for (auto &job : jobs)
+		if (!job.ok)
+			LOGE("  Failed: %s\n", job.args.input_path.c_str());
+
+	if (!options.summary.empty())
+	{
+		FILE *file = fopen(options.summary.c_str(), "w");
+		if (!file)
+		{
+			LOGE("Failed to open %s for writing.\n", options.summary.c_str());
+			return EXIT_FAILURE;
+		}
+		write_batch_summary(file, jobs, num_threads, wall_ns);
+		fclose(file);
+	}
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+	Arguments args;
+	Remapper remapper;
+	BatchOptions batch;
+
+	CLICallbacks cbs;
+	cbs.add("--help", [](CLIParser &parser) {
+		print_help();
+		parser.end();
+	});
+	add_conversion_callbacks(cbs, args, remapper);
+	cbs.add("--batch-manifest", [&](CLIParser &parser) { batch.manifest = parser.next_string(); });
+	cbs.add("--batch-directory", [&](CLIParser &parser) { batch.directory = parser.next_string(); });
+	cbs.add("--batch-output-dir", [&](CLIParser &parser) { batch.output_dir = parser.next_string(); });
+	cbs.add("--batch-threads", [&](CLIParser &parser) { batch.num_threads = parser.next_uint(); });
+	cbs.add("--batch-summary", [&](CLIParser &parser) { batch.summary = parser.next_string(); });
+	cbs.error_handler = [] { print_help(); };
+	cbs.default_handler = [&](const char *arg) { args.input_path = arg; };
+	CLIParser cli_parser(std::move(cbs), argc - 1, argv + 1);
+	if (!cli_parser.parse())
+		return EXIT_FAILURE;
+	else if (cli_parser.is_ended_state())
+		return EXIT_SUCCESS;
+
+	if (!batch.manifest.empty() || !batch.directory.empty())
+	{
+		if (!args.input_path.empty() || !args.output_path.empty())
+		{
+			LOGE("Batch mode does not take an input or --output on the command line.\n");
+			return EXIT_FAILURE;
+		}
+		return run_batch(batch, args, remapper);
+	}
+
+	if (args.input_path.empty())
+	{
+		LOGE("No input file.\n");
+		print_help();
+		return EXIT_FAILURE;
+	}
+
+	dxil_spv_begin_thread_allocator_context();
+	bool ret = run_conversion(args, remapper);
 	dxil_spv_end_thread_allocator_context();
-	return EXIT_SUCCESS;
+	return ret ? EXIT_SUCCESS : EXIT_FAILURE;
 }
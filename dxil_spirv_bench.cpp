@@ -0,0 +1,366 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "cli_parser.hpp"
+#include "dxil_spirv_c.h"
+#include "logging.hpp"
+#include <algorithm>
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+using namespace dxil_spv;
+
+static void print_help()
+{
+	LOGE("dxil-spirv-bench <DXIL blob>... [--list file] [--iterations N] [--warmup N] [--output file.json] [--bump-allocator]\n"
+	     "\tEach input is a DXBC container or raw LLVM bitcode, detected by its magic.\n"
+	     "\t--list reads one input path per line.\n"
+	     "\t--bump-allocator disables recycling of freed memory in the thread allocator.\n"
+	     "\tResults are written as JSON to stdout unless --output is used.\n"
+	     "\tUse bench_compare.py to compare two result files.\n");
+}
+
+static std::vector<uint8_t> read_file(const char *path)
+{
+	FILE *file = fopen(path, "rb");
+	if (!file)
+		return {};
+
+	fseek(file, 0, SEEK_END);
+	auto len = ftell(file);
+	rewind(file);
+	std::vector<uint8_t> result(len);
+	if (fread(result.data(), 1, len, file) != size_t(len))
+	{
+		fclose(file);
+		return {};
+	}
+
+	fclose(file);
+	return result;
+}
+
+static bool read_list(const char *path, std::vector<std::string> &inputs)
+{
+	FILE *file = fopen(path, "r");
+	if (!file)
+		return false;
+
+	char line[4096];
+	while (fgets(line, sizeof(line), file))
+	{
+		std::string str = line;
+		while (!str.empty() && (str.back() == '\n' || str.back() == '\r'))
+			str.pop_back();
+		if (!str.empty())
+			inputs.push_back(std::move(str));
+	}
+
+	fclose(file);
+	return true;
+}
+
+struct Shader
+{
+	std::string path;
+	std::vector<uint8_t> data;
+	bool raw_llvm = false;
+};
+
+struct ShaderResult
+{
+	std::vector<uint64_t> samples_ns;
+	size_t peak_arena_bytes = 0;
+	size_t spirv_size = 0;
+	unsigned entry_points = 0;
+	bool ok = false;
+};
+
+static bool convert_entry_point(dxil_spv_parsed_blob blob, const char *entry, size_t &spirv_size)
+{
+	dxil_spv_converter converter;
+	if (dxil_spv_create_converter(blob, &converter) != DXIL_SPV_SUCCESS)
+		return false;
+
+	if (entry)
+		dxil_spv_converter_set_entry_point(converter, entry);
+
+	bool ret = dxil_spv_converter_run(converter) == DXIL_SPV_SUCCESS;
+	if (ret)
+	{
+		dxil_spv_compiled_spirv compiled;
+		ret = dxil_spv_converter_get_compiled_spirv(converter, &compiled) == DXIL_SPV_SUCCESS;
+		if (ret)
+			spirv_size += compiled.size;
+	}
+
+	dxil_spv_converter_free(converter);
+	return ret;
+}
+
+// Parses and converts every entry point, like --debug-all-entry-points does for libraries.
+static bool run_iteration(const Shader &shader, ShaderResult &result)
+{
+	dxil_spv_parsed_blob blob;
+	dxil_spv_result parse_result;
+	if (shader.raw_llvm)
+		parse_result = dxil_spv_parse_dxil(shader.data.data(), shader.data.size(), &blob);
+	else
+		parse_result = dxil_spv_parse_dxil_blob(shader.data.data(), shader.data.size(), &blob);
+
+	if (parse_result != DXIL_SPV_SUCCESS)
+		return false;
+
+	unsigned count = 0;
+	bool ret = dxil_spv_parsed_blob_get_num_entry_points(blob, &count) == DXIL_SPV_SUCCESS;
+	size_t spirv_size = 0;
+
+	if (ret && count > 1)
+	{
+		for (unsigned i = 0; i < count && ret; i++)
+		{
+			const char *entry = nullptr;
+			ret = dxil_spv_parsed_blob_get_entry_point_name(blob, i, &entry) == DXIL_SPV_SUCCESS &&
+			      convert_entry_point(blob, entry, spirv_size);
+		}
+	}
+	else if (ret)
+		ret = convert_entry_point(blob, nullptr, spirv_size);
+
+	dxil_spv_parsed_blob_free(blob);
+
+	result.spirv_size = spirv_size;
+	result.entry_points = std::max(count, 1u);
+	return ret;
+}
+
+static void bench_shader(const Shader &shader, unsigned warmup, unsigned iterations, ShaderResult &result)
+{
+	// Stop at the first failure rather than timing a broken conversion.
+	for (unsigned i = 0; i < warmup + iterations; i++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		bool ok = run_iteration(shader, result);
+		auto end = std::chrono::steady_clock::now();
+
+		result.peak_arena_bytes = std::max(result.peak_arena_bytes, dxil_spv_get_thread_allocator_usage());
+		dxil_spv_reset_thread_allocator_context();
+
+		if (!ok)
+		{
+			result.ok = false;
+			return;
+		}
+
+		if (i >= warmup)
+			result.samples_ns.push_back(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()));
+	}
+
+	result.ok = true;
+}
+
+// Nearest-rank percentile.
+static uint64_t percentile(const std::vector<uint64_t> &sorted, double p)
+{
+	if (sorted.empty())
+		return 0;
+	size_t rank = size_t(p * double(sorted.size()) + 0.999999);
+	rank = std::max<size_t>(rank, 1);
+	return sorted[std::min(rank, sorted.size()) - 1];
+}
+
+static void write_json_string(FILE *file, const std::string &str)
+{
+	fputc('"', file);
+	for (char c : str)
+	{
+		if (c == '"' || c == '\\')
+			fprintf(file, "\\%c", c);
+		else if (uint8_t(c) < 0x20)
+			fprintf(file, "\\u%04x", unsigned(uint8_t(c)));
+		else
+			fputc(c, file);
+	}
+	fputc('"', file);
+}
+
+static void write_results(FILE *file, const std::vector<Shader> &shaders, const std::vector<ShaderResult> &results,
+                          unsigned iterations)
+{
+	std::vector<uint64_t> all_samples;
+	uint64_t total_ns = 0;
+	uint64_t total_input_bytes = 0;
+	size_t peak_arena_bytes = 0;
+	unsigned failed = 0;
+
+	fprintf(file, "{\n\t\"iterations\": %u,\n\t\"shaders\": [\n", iterations);
+
+	for (size_t i = 0; i < shaders.size(); i++)
+	{
+		auto &result = results[i];
+		auto sorted = result.samples_ns;
+		std::sort(sorted.begin(), sorted.end());
+
+		uint64_t shader_ns = 0;
+		for (auto ns : sorted)
+			shader_ns += ns;
+
+		fprintf(file, "\t\t{ \"path\": ");
+		write_json_string(file, shaders[i].path);
+		fprintf(file, ", \"ok\": %s", result.ok ? "true" : "false");
+
+		if (result.ok)
+		{
+			fprintf(file, ", \"entry_points\": %u, \"input_bytes\": %zu, \"spirv_bytes\": %zu, \"peak_arena_bytes\": %zu",
+			        result.entry_points, shaders[i].data.size(), result.spirv_size, result.peak_arena_bytes);
+			fprintf(file, ", \"mean_ns\": %llu, \"min_ns\": %llu, \"p50_ns\": %llu, \"p99_ns\": %llu",
+			        static_cast<unsigned long long>(sorted.empty() ? 0 : shader_ns / sorted.size()),
+			        static_cast<unsigned long long>(sorted.empty() ? 0 : sorted.front()),
+			        static_cast<unsigned long long>(percentile(sorted, 0.50)),
+			        static_cast<unsigned long long>(percentile(sorted, 0.99)));
+
+			all_samples.insert(all_samples.end(), sorted.begin(), sorted.end());
+			total_ns += shader_ns;
+			total_input_bytes += uint64_t(shaders[i].data.size()) * sorted.size();
+			peak_arena_bytes = std::max(peak_arena_bytes, result.peak_arena_bytes);
+		}
+		else
+			failed++;
+
+		fprintf(file, " }%s\n", i + 1 < shaders.size() ? "," : "");
+	}
+
+	std::sort(all_samples.begin(), all_samples.end());
+	double seconds = double(total_ns) * 1e-9;
+
+	fprintf(file, "\t],\n\t\"aggregate\": {\n");
+	fprintf(file, "\t\t\"shaders\": %zu,\n\t\t\"failed\": %u,\n", shaders.size(), failed);
+	fprintf(file, "\t\t\"total_ns\": %llu,\n", static_cast<unsigned long long>(total_ns));
+	fprintf(file, "\t\t\"shaders_per_second\": %.3f,\n", seconds > 0.0 ? double(all_samples.size()) / seconds : 0.0);
+	fprintf(file, "\t\t\"input_bytes_per_second\": %.3f,\n", seconds > 0.0 ? double(total_input_bytes) / seconds : 0.0);
+	fprintf(file, "\t\t\"p50_ns\": %llu,\n", static_cast<unsigned long long>(percentile(all_samples, 0.50)));
+	fprintf(file, "\t\t\"p99_ns\": %llu,\n", static_cast<unsigned long long>(percentile(all_samples, 0.99)));
+	fprintf(file, "\t\t\"peak_arena_bytes\": %zu\n", peak_arena_bytes);
+	fprintf(file, "\t}\n}\n");
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<std::string> inputs;
+	std::string output;
+	unsigned iterations = 10;
+	unsigned warmup = 1;
+	bool bump_allocator = false;
+	bool list_error = false;
+
+	CLICallbacks cbs;
+	cbs.add("--help", [](CLIParser &parser) {
+		print_help();
+		parser.end();
+	});
+	cbs.add("--list", [&](CLIParser &parser) {
+		const char *path = parser.next_string();
+		if (!read_list(path, inputs))
+		{
+			LOGE("Failed to read list %s.\n", path);
+			list_error = true;
+		}
+	});
+	cbs.add("--iterations", [&](CLIParser &parser) { iterations = parser.next_uint(); });
+	cbs.add("--warmup", [&](CLIParser &parser) { warmup = parser.next_uint(); });
+	cbs.add("--output", [&](CLIParser &parser) { output = parser.next_string(); });
+	cbs.add("--bump-allocator", [&](CLIParser &) { bump_allocator = true; });
+	cbs.default_handler = [&](const char *arg) { inputs.push_back(arg); };
+	CLIParser parser(std::move(cbs), argc - 1, argv + 1);
+
+	if (!parser.parse() || list_error)
+		return EXIT_FAILURE;
+	else if (parser.is_ended_state())
+		return EXIT_SUCCESS;
+
+	if (inputs.empty())
+	{
+		LOGE("Need input files.\n");
+		print_help();
+		return EXIT_FAILURE;
+	}
+
+	if (iterations == 0)
+	{
+		LOGE("Need at least one iteration.\n");
+		return EXIT_FAILURE;
+	}
+
+	// Load everything up front so that file I/O is never part of the measurement.
+	std::vector<Shader> shaders;
+	shaders.reserve(inputs.size());
+	for (auto &input : inputs)
+	{
+		Shader shader;
+		shader.path = input;
+		shader.data = read_file(input.c_str());
+		if (shader.data.empty())
+		{
+			LOGE("Failed to read file %s.\n", input.c_str());
+			return EXIT_FAILURE;
+		}
+
+		shader.raw_llvm = shader.data.size() >= 4 && shader.data[0] == 'B' && shader.data[1] == 'C' &&
+		                  shader.data[2] == 0xc0 && shader.data[3] == 0xde;
+		shaders.push_back(std::move(shader));
+	}
+
+	std::vector<ShaderResult> results(shaders.size());
+
+	dxil_spv_begin_thread_allocator_context_with_flags(bump_allocator ? DXIL_SPV_THREAD_ALLOCATOR_BUMP_ONLY_BIT : 0);
+	for (size_t i = 0; i < shaders.size(); i++)
+	{
+		bench_shader(shaders[i], warmup, iterations, results[i]);
+		if (!results[i].ok)
+			LOGW("Failed to convert %s.\n", shaders[i].path.c_str());
+	}
+	dxil_spv_end_thread_allocator_context();
+
+	FILE *file = stdout;
+	if (!output.empty())
+	{
+		file = fopen(output.c_str(), "w");
+		if (!file)
+		{
+			LOGE("Failed to open %s for writing.\n", output.c_str());
+			return EXIT_FAILURE;
+		}
+	}
+
+	write_results(file, shaders, results, iterations);
+
+	if (file != stdout)
+		fclose(file);
+
+	return EXIT_SUCCESS;
+}
@@ -24,12 +24,23 @@
 
 #include "thread_local_allocator.hpp"
 #include "dxil_spirv_c.h"
+#include "conversion_cache.hpp"
 #include "dxil_converter.hpp"
 #include "dxil_parser.hpp"
 #include "llvm_bitcode_parser.hpp"
 #include "logging.hpp"
+#include "phase_statistics.hpp"
+#include "remap_transcript.hpp"
+#include "shader_archive.hpp"
 #include "spirv_module.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <shared_mutex>
 #include <string.h>
+#include <string>
 #include <new>
 
 using namespace dxil_spv;
@@ -50,12 +61,122 @@ struct dxil_spv_parsed_blob_s
 	std::string disasm;
 #endif
 	Vector<uint8_t> dxil_blob;
-	Vector<RDATSubobject> rdat_subobjects;
+	RDATView rdat;
+	// The RDAT view decodes lazily, and the blob may be shared between threads.
+	std::mutex rdat_lock;
+
+	// Points to dxil_blob, or directly into the application's container if it was borrowed.
+	const uint8_t *bc_data = nullptr;
+	size_t bc_size = 0;
 
 	struct Names { String mangled, demangled; };
 	Vector<Names> entry_points;
+
+	// hash_fast() of the blob as passed in by the application.
+	uint64_t hash = 0;
+
+	// Blobs parsed with dxil_spv_parse_dxil_blob_deferred() only parse the bitcode on first use.
+	// Concurrent converters may race to parse it.
+	std::mutex bc_parse_lock;
+	bool bc_parsed = true;
+	bool bc_parse_failed = false;
+
+	// Deferred blobs also parse function bodies lazily, since bc_data outlives the module.
+	// Whichever thread first needs a function body decodes it.
+	bool bc_lazy = false;
+	// Materializing modifies the module, which converters read without bc_parse_lock.
+	// Readers hold this shared, materialization holds it exclusively. Taken before bc_parse_lock.
+	std::shared_timed_mutex materialize_lock;
+
+	// Function bodies are skipped entirely, only metadata queries work.
+	bool bc_metadata_only = false;
+
+	// Only the container and bitcode phases are used. Bitcode statistics are protected by bc_parse_lock.
+	ConversionStatistics statistics;
+
+	bool ensure_parsed(ThreadPool *pool = nullptr);
+	bool ensure_materialized(const char *entry);
+	bool ensure_fully_materialized();
+	std::shared_lock<std::shared_timed_mutex> lock_for_reading();
 };
 
+bool dxil_spv_parsed_blob_s::ensure_parsed(ThreadPool *pool)
+{
+	std::lock_guard<std::mutex> holder{ bc_parse_lock };
+	if (bc_parsed)
+		return true;
+	if (bc_parse_failed)
+		return false;
+
+	ScopedPhaseTimer timer(&statistics, StatisticsPhase::BitcodeParse);
+	bool ret;
+	if (bc_metadata_only)
+		ret = bc.parse_metadata_only(bc_data, bc_size);
+	else if (bc_lazy)
+		ret = bc.parse_lazy(bc_data, bc_size);
+	else if (pool)
+		ret = bc.parse_parallel(bc_data, bc_size, *pool);
+	else
+		ret = bc.parse(bc_data, bc_size);
+
+	if (!ret)
+	{
+		bc_parse_failed = true;
+		return false;
+	}
+
+	auto names = Converter::get_entry_points(bc);
+	for (auto &name : names)
+		entry_points.push_back({ name, demangle_entry_point(name) });
+
+	bc_parsed = true;
+	return true;
+}
+
+bool dxil_spv_parsed_blob_s::ensure_materialized(const char *entry)
+{
+	if (!ensure_parsed())
+		return false;
+	if (bc_metadata_only)
+	{
+		LOGE("Blob was parsed with metadata only, function bodies are not available.\n");
+		return false;
+	}
+	if (!bc_lazy)
+		return true;
+
+	std::unique_lock<std::shared_timed_mutex> writer{ materialize_lock };
+	std::lock_guard<std::mutex> holder{ bc_parse_lock };
+	ScopedPhaseTimer timer(&statistics, StatisticsPhase::BitcodeParse);
+	return Converter::materialize_entry_point(bc, entry);
+}
+
+bool dxil_spv_parsed_blob_s::ensure_fully_materialized()
+{
+	if (!ensure_parsed())
+		return false;
+	if (bc_metadata_only)
+	{
+		LOGE("Blob was parsed with metadata only, function bodies are not available.\n");
+		return false;
+	}
+	if (!bc_lazy)
+		return true;
+
+	std::unique_lock<std::shared_timed_mutex> writer{ materialize_lock };
+	std::lock_guard<std::mutex> holder{ bc_parse_lock };
+	ScopedPhaseTimer timer(&statistics, StatisticsPhase::BitcodeParse);
+	return bc.materialize_all();
+}
+
+std::shared_lock<std::shared_timed_mutex> dxil_spv_parsed_blob_s::lock_for_reading()
+{
+	// Fully parsed modules are never modified after parsing.
+	if (!bc_lazy)
+		return {};
+	return std::shared_lock<std::shared_timed_mutex>{ materialize_lock };
+}
+
 struct Remapper : ResourceRemappingInterface
 {
 	static void copy_buffer_binding(VulkanBinding &vk_binding, const dxil_spv_vulkan_binding &c_vk_binding)
@@ -371,15 +492,46 @@ struct LocalRootParameter
 	Vector<DescriptorTableEntry> table_entries;
 };
 
+struct dxil_spv_cancel_token_s
+{
+	std::atomic_bool cancelled{false};
+};
+
+// Immutable once created, so it can be shared between converters on any thread.
+// std::vector rather than Vector, as the last reference may be dropped outside the creating allocator context.
+struct dxil_spv_option_set_s
+{
+	std::atomic_uint ref_count{1};
+	std::vector<std::unique_ptr<OptionBase>> options;
+	uint64_t hash = 0;
+};
+
+static void release_option_set(dxil_spv_option_set set)
+{
+	if (set && set->ref_count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		delete set;
+}
+
 struct dxil_spv_converter_s
 {
-	dxil_spv_converter_s(LLVMBCParser &bc_parser_, LLVMBCParser *bc_reflection_parser_)
-		: bc_parser(bc_parser_), bc_reflection_parser(bc_reflection_parser_)
+	dxil_spv_converter_s(dxil_spv_parsed_blob blob_, dxil_spv_parsed_blob reflection_blob_)
+		: blob(blob_), reflection_blob(reflection_blob_)
+	{
+	}
+
+	~dxil_spv_converter_s()
 	{
+		release_option_set(option_set);
 	}
 
-	LLVMBCParser &bc_parser;
-	LLVMBCParser *bc_reflection_parser;
+	dxil_spv_parsed_blob blob;
+	dxil_spv_parsed_blob reflection_blob;
+	ConversionCache *cache = nullptr;
+	dxil_spv_cancel_token cancel_token = nullptr;
+
+	bool record_remap_transcript = false;
+	std::vector<uint32_t> remap_transcript;
+	std::unique_ptr<RemapTranscriptReplayer> remap_replayer;
 	Vector<uint32_t> spirv;
 	String entry_point;
 	String compiled_entry_point;
@@ -387,6 +539,8 @@ struct dxil_spv_converter_s
 
 	Vector<LocalRootParameter> local_root_parameters;
 
+	// Applied before options, so options added directly to the converter take precedence.
+	dxil_spv_option_set option_set = nullptr;
 	Vector<std::unique_ptr<OptionBase>> options;
 
 	Vector<DescriptorTableEntry> local_entries;
@@ -397,38 +551,107 @@ struct dxil_spv_converter_s
 	uint32_t wave_size = 0;
 	uint32_t heuristic_wave_size = 0;
 	bool shader_feature_used[unsigned(ShaderFeature::Count)] = {};
+	Vector<CBVPromotionCandidate> cbv_promotion_candidates;
+	Vector<ResourceUsage> resource_usage;
+
+	// Phases of the last run. Container and bitcode phases come from the blob.
+	ConversionStatistics statistics;
+
+	void reset_results();
 };
 
-dxil_spv_result dxil_spv_parse_dxil_blob(const void *data, size_t size, dxil_spv_parsed_blob *blob)
+void dxil_spv_converter_s::reset_results()
 {
+	// clear() keeps capacity, so back-to-back conversions do not reallocate the output.
+	spirv.clear();
+	compiled_entry_point.clear();
+	remap_transcript.clear();
+	uses_subgroup_size = false;
+	memset(workgroup_size, 0, sizeof(workgroup_size));
+	patch_vertex_count = 0;
+	wave_size = 0;
+	heuristic_wave_size = 0;
+	memset(shader_feature_used, 0, sizeof(shader_feature_used));
+	cbv_promotion_candidates.clear();
+	resource_usage.clear();
+	statistics.reset();
+}
+
+static dxil_spv_result parse_dxil_blob(const void *data, size_t size, dxil_spv_parse_flags flags,
+                                      ThreadPool *pool, dxil_spv_parsed_blob *blob)
+{
+	bool deferred = (flags & DXIL_SPV_PARSE_DEFERRED_BIT) != 0;
+	bool borrow = (flags & DXIL_SPV_PARSE_BORROW_INPUT_BIT) != 0;
+	bool metadata_only = (flags & DXIL_SPV_PARSE_METADATA_ONLY_BIT) != 0;
+
 	auto *parsed = new (std::nothrow) dxil_spv_parsed_blob_s;
 	if (!parsed)
 		return DXIL_SPV_ERROR_OUT_OF_MEMORY;
 
 	DXILContainerParser parser;
-	if (!parser.parse_container(data, size, false))
+	parser.set_borrow_blob(borrow);
+	bool ret;
+	{
+		ScopedPhaseTimer timer(&parsed->statistics, StatisticsPhase::ContainerParse);
+		ret = parser.parse_container(data, size, false);
+	}
+
+	if (!ret)
 	{
 		delete parsed;
 		return DXIL_SPV_ERROR_PARSER;
 	}
 
-	parsed->dxil_blob = std::move(parser.get_blob());
-	parsed->rdat_subobjects = std::move(parser.get_rdat_subobjects());
+	if (borrow)
+	{
+		auto &stream = parser.get_blob_stream();
+		parsed->bc_data = static_cast<const uint8_t *>(stream.get_data());
+		parsed->bc_size = stream.get_size();
+	}
+	else
+	{
+		parsed->dxil_blob = std::move(parser.get_blob());
+		parsed->bc_data = parsed->dxil_blob.data();
+		parsed->bc_size = parsed->dxil_blob.size();
+	}
+
+	parsed->rdat = std::move(parser.get_rdat_view());
+	parsed->hash = hash_fast(data, size);
+	parsed->bc_parsed = false;
+	parsed->bc_lazy = deferred;
+	parsed->bc_metadata_only = metadata_only;
 
-	if (!parsed->bc.parse(parsed->dxil_blob.data(), parsed->dxil_blob.size()))
+	if (!deferred && !parsed->ensure_parsed(pool))
 	{
 		delete parsed;
-		return DXIL_SPV_ERROR_PARSER;
+		return thread_allocator_limit_exceeded() ? DXIL_SPV_ERROR_OUT_OF_MEMORY : DXIL_SPV_ERROR_PARSER;
 	}
 
-	auto names = Converter::get_entry_points(parsed->bc);
-	for (auto &name : names)
-		parsed->entry_points.push_back({ name, demangle_entry_point(name) });
-
 	*blob = parsed;
 	return DXIL_SPV_SUCCESS;
 }
 
+dxil_spv_result dxil_spv_parse_dxil_blob_with_flags(const void *data, size_t size, dxil_spv_parse_flags flags,
+                                                    dxil_spv_parsed_blob *blob)
+{
+	return parse_dxil_blob(data, size, flags, nullptr, blob);
+}
+
+dxil_spv_result dxil_spv_parse_dxil_blob(const void *data, size_t size, dxil_spv_parsed_blob *blob)
+{
+	return dxil_spv_parse_dxil_blob_with_flags(data, size, 0, blob);
+}
+
+dxil_spv_result dxil_spv_parse_dxil_blob_deferred(const void *data, size_t size, dxil_spv_parsed_blob *blob)
+{
+	return dxil_spv_parse_dxil_blob_with_flags(data, size, DXIL_SPV_PARSE_DEFERRED_BIT, blob);
+}
+
+dxil_spv_result dxil_spv_parse_dxil_blob_metadata_only(const void *data, size_t size, dxil_spv_parsed_blob *blob)
+{
+	return dxil_spv_parse_dxil_blob_with_flags(data, size, DXIL_SPV_PARSE_METADATA_ONLY_BIT, blob);
+}
+
 dxil_spv_result dxil_spv_parse_reflection_dxil_blob(const void *data, size_t size, dxil_spv_parsed_blob *blob)
 {
 	auto *parsed = new (std::nothrow) dxil_spv_parsed_blob_s;
@@ -436,7 +659,13 @@ dxil_spv_result dxil_spv_parse_reflection_dxil_blob(const void *data, size_t siz
 		return DXIL_SPV_ERROR_OUT_OF_MEMORY;
 
 	DXILContainerParser parser;
-	if (!parser.parse_container(data, size, true))
+	bool ret;
+	{
+		ScopedPhaseTimer timer(&parsed->statistics, StatisticsPhase::ContainerParse);
+		ret = parser.parse_container(data, size, true);
+	}
+
+	if (!ret)
 	{
 		delete parsed;
 		return DXIL_SPV_ERROR_PARSER;
@@ -449,8 +678,16 @@ dxil_spv_result dxil_spv_parse_reflection_dxil_blob(const void *data, size_t siz
 	}
 
 	parsed->dxil_blob = std::move(parser.get_blob());
+	parsed->bc_data = parsed->dxil_blob.data();
+	parsed->bc_size = parsed->dxil_blob.size();
+	parsed->hash = hash_fast(data, size);
+
+	{
+		ScopedPhaseTimer timer(&parsed->statistics, StatisticsPhase::BitcodeParse);
+		ret = parsed->bc.parse(parsed->bc_data, parsed->bc_size);
+	}
 
-	if (!parsed->bc.parse(parsed->dxil_blob.data(), parsed->dxil_blob.size()))
+	if (!ret)
 	{
 		delete parsed;
 		return DXIL_SPV_ERROR_PARSER;
@@ -466,12 +703,20 @@ dxil_spv_result dxil_spv_parse_dxil(const void *data, size_t size, dxil_spv_pars
 	if (!parsed)
 		return DXIL_SPV_ERROR_OUT_OF_MEMORY;
 
-	if (!parsed->bc.parse(data, size))
+	bool ret;
+	{
+		ScopedPhaseTimer timer(&parsed->statistics, StatisticsPhase::BitcodeParse);
+		ret = parsed->bc.parse(data, size);
+	}
+
+	if (!ret)
 	{
 		delete parsed;
 		return DXIL_SPV_ERROR_PARSER;
 	}
 
+	parsed->hash = hash_fast(data, size);
+
 	auto names = Converter::get_entry_points(parsed->bc);
 	for (auto &name : names)
 		parsed->entry_points.push_back({ name, demangle_entry_point(name) });
@@ -482,11 +727,17 @@ dxil_spv_result dxil_spv_parse_dxil(const void *data, size_t size, dxil_spv_pars
 
 void dxil_spv_parsed_blob_dump_llvm_ir(dxil_spv_parsed_blob blob)
 {
+	if (!blob->ensure_fully_materialized())
+	{
+		fprintf(stderr, "Failed to parse LLVM IR!\n");
+		return;
+	}
+
 	auto &module = blob->bc.get_module();
 #ifdef HAVE_LLVMBC
-	String str;
-	if (llvm::disassemble(module, str))
-		fprintf(stderr, "%s\n", str.c_str());
+	auto sink = [](void *, const char *data, size_t size) { fwrite(data, 1, size, stderr); };
+	if (llvm::disassemble(module, sink, nullptr))
+		fprintf(stderr, "\n");
 	else
 		fprintf(stderr, "Failed to disassemble LLVM IR!\n");
 #else
@@ -497,6 +748,8 @@ void dxil_spv_parsed_blob_dump_llvm_ir(dxil_spv_parsed_blob blob)
 dxil_spv_result dxil_spv_parsed_blob_get_disassembled_ir(dxil_spv_parsed_blob blob, const char **str)
 {
 	blob->disasm.clear();
+	if (!blob->ensure_fully_materialized())
+		return DXIL_SPV_ERROR_PARSER;
 
 	auto *module = &blob->bc.get_module();
 #ifdef HAVE_LLVMBC
@@ -510,28 +763,57 @@ dxil_spv_result dxil_spv_parsed_blob_get_disassembled_ir(dxil_spv_parsed_blob bl
 	return DXIL_SPV_SUCCESS;
 }
 
+dxil_spv_result dxil_spv_parsed_blob_stream_disassembled_ir(dxil_spv_parsed_blob blob,
+                                                            dxil_spv_disassembly_sink_cb sink,
+                                                            void *userdata)
+{
+	if (!sink)
+		return DXIL_SPV_ERROR_INVALID_ARGUMENT;
+	if (!blob->ensure_fully_materialized())
+		return DXIL_SPV_ERROR_PARSER;
+
+	auto *module = &blob->bc.get_module();
+#ifdef HAVE_LLVMBC
+	if (!llvm::disassemble(*module, sink, userdata))
+		return DXIL_SPV_ERROR_GENERIC;
+#else
+	std::string str;
+	llvm::raw_string_ostream ostr(str);
+	module->print(ostr, nullptr);
+	ostr.flush();
+	sink(userdata, str.data(), str.size());
+#endif
+	return DXIL_SPV_SUCCESS;
+}
+
 dxil_spv_result dxil_spv_parsed_blob_get_raw_ir(dxil_spv_parsed_blob blob, const void **data, size_t *size)
 {
-	if (blob->dxil_blob.empty())
+	if (!blob->bc_data || !blob->bc_size)
 		return DXIL_SPV_ERROR_GENERIC;
 
-	*data = blob->dxil_blob.data();
-	*size = blob->dxil_blob.size();
+	*data = blob->bc_data;
+	*size = blob->bc_size;
 	return DXIL_SPV_SUCCESS;
 }
 
 dxil_spv_shader_stage dxil_spv_parsed_blob_get_shader_stage(dxil_spv_parsed_blob blob)
 {
+	if (!blob->ensure_parsed())
+		return DXIL_SPV_STAGE_UNKNOWN;
 	return static_cast<dxil_spv_shader_stage>(Converter::get_shader_stage(blob->bc));
 }
 
 dxil_spv_shader_stage dxil_spv_parsed_blob_get_shader_stage_for_entry(dxil_spv_parsed_blob blob, const char *entry)
 {
+	if (!blob->ensure_parsed())
+		return DXIL_SPV_STAGE_UNKNOWN;
 	return static_cast<dxil_spv_shader_stage>(Converter::get_shader_stage(blob->bc, entry));
 }
 
 dxil_spv_result dxil_spv_parsed_blob_get_num_entry_points(dxil_spv_parsed_blob blob, unsigned *count)
 {
+	if (!blob->ensure_parsed())
+		return DXIL_SPV_ERROR_PARSER;
 	*count = unsigned(blob->entry_points.size());
 	return DXIL_SPV_SUCCESS;
 }
@@ -540,6 +822,8 @@ dxil_spv_result dxil_spv_parsed_blob_get_entry_point_name(dxil_spv_parsed_blob b
                                                           unsigned index,
                                                           const char **mangled_entry)
 {
+	if (!blob->ensure_parsed())
+		return DXIL_SPV_ERROR_PARSER;
 	if (index >= blob->entry_points.size())
 		return DXIL_SPV_ERROR_INVALID_ARGUMENT;
 	*mangled_entry = blob->entry_points[index].mangled.c_str();
@@ -550,6 +834,8 @@ dxil_spv_result dxil_spv_parsed_blob_get_entry_point_demangled_name(dxil_spv_par
                                                                     unsigned index,
                                                                     const char **demangled_entry)
 {
+	if (!blob->ensure_parsed())
+		return DXIL_SPV_ERROR_PARSER;
 	if (index >= blob->entry_points.size())
 		return DXIL_SPV_ERROR_INVALID_ARGUMENT;
 	*demangled_entry = blob->entry_points[index].demangled.c_str();
@@ -562,6 +848,9 @@ dxil_spv_result dxil_spv_parsed_blob_scan_resources(dxil_spv_parsed_blob blob,
                                                     dxil_spv_cbv_remapper_cb cbv_remapper,
                                                     dxil_spv_uav_remapper_cb uav_remapper, void *userdata)
 {
+	if (!blob->ensure_parsed())
+		return DXIL_SPV_ERROR_PARSER;
+
 	Remapper remapper;
 	remapper.srv_remapper = srv_remapper;
 	remapper.srv_userdata = userdata;
@@ -576,6 +865,27 @@ dxil_spv_result dxil_spv_parsed_blob_scan_resources(dxil_spv_parsed_blob blob,
 	return DXIL_SPV_SUCCESS;
 }
 
+dxil_spv_result dxil_spv_parsed_blob_estimate_cost(dxil_spv_parsed_blob blob, const char *entry,
+                                                   dxil_spv_cost_estimate *estimate)
+{
+	if (!blob->ensure_materialized(entry))
+		return DXIL_SPV_ERROR_PARSER;
+
+	auto reader = blob->lock_for_reading();
+	CostEstimate cost;
+	if (!Converter::estimate_cost(blob->bc, entry, cost))
+		return DXIL_SPV_ERROR_INVALID_ARGUMENT;
+
+	estimate->num_functions = cost.num_functions;
+	estimate->num_blocks = cost.num_blocks;
+	estimate->num_instructions = cost.num_instructions;
+	estimate->max_loop_depth = cost.max_loop_depth;
+	estimate->num_wave_ops = cost.num_wave_ops;
+	estimate->num_ray_tracing_ops = cost.num_ray_tracing_ops;
+	estimate->cost = cost.cost;
+	return DXIL_SPV_SUCCESS;
+}
+
 void dxil_spv_parsed_blob_free(dxil_spv_parsed_blob blob)
 {
 	delete blob;
@@ -585,7 +895,7 @@ dxil_spv_result dxil_spv_create_converter_with_reflection(dxil_spv_parsed_blob b
                                                           dxil_spv_parsed_blob reflection_blob,
                                                           dxil_spv_converter *converter)
 {
-	auto *conv = new (std::nothrow) dxil_spv_converter_s(blob->bc, reflection_blob ? &reflection_blob->bc : nullptr);
+	auto *conv = new (std::nothrow) dxil_spv_converter_s(blob, reflection_blob);
 	if (!conv)
 		return DXIL_SPV_ERROR_OUT_OF_MEMORY;
 
@@ -603,6 +913,18 @@ void dxil_spv_converter_free(dxil_spv_converter converter)
 	delete converter;
 }
 
+void dxil_spv_converter_reset(dxil_spv_converter converter, dxil_spv_parsed_blob blob,
+                              dxil_spv_parsed_blob reflection_blob)
+{
+	converter->blob = blob;
+	converter->reflection_blob = reflection_blob;
+
+	// Anything tied to the previous shader goes away. Configuration is kept.
+	converter->entry_point.clear();
+	converter->remap_replayer.reset();
+	converter->reset_results();
+}
+
 void dxil_spv_converter_set_entry_point(dxil_spv_converter converter, const char *entry_point)
 {
 	if (entry_point)
@@ -611,14 +933,180 @@ void dxil_spv_converter_set_entry_point(dxil_spv_converter converter, const char
 		converter->entry_point.clear();
 }
 
+static uint64_t compute_conversion_cache_key(dxil_spv_converter converter)
+{
+	Hasher h;
+	h.u32(DXIL_SPV_API_VERSION_MAJOR);
+	h.u32(DXIL_SPV_API_VERSION_MINOR);
+	h.u32(DXIL_SPV_API_VERSION_PATCH);
+	h.u64(converter->blob->hash);
+	h.u64(converter->reflection_blob ? converter->reflection_blob->hash : 0);
+	h.string(converter->entry_point.c_str());
+
+	h.u64(converter->option_set ? converter->option_set->hash : 0);
+	h.u32(uint32_t(converter->options.size()));
+	for (auto &opt : converter->options)
+		ConversionCache::hash_option(h, *opt);
+
+	h.u32(uint32_t(converter->local_root_parameters.size()));
+	for (auto &local_param : converter->local_root_parameters)
+	{
+		h.u32(uint32_t(local_param.type));
+		switch (local_param.type)
+		{
+		case LocalRootParameterType::Constants:
+			h.u32(local_param.local_constants.register_space);
+			h.u32(local_param.local_constants.register_index);
+			h.u32(local_param.local_constants.num_words);
+			break;
+
+		case LocalRootParameterType::Descriptor:
+			h.u32(uint32_t(local_param.local_descriptor.resource_class));
+			h.u32(local_param.local_descriptor.register_space);
+			h.u32(local_param.local_descriptor.register_index);
+			break;
+
+		case LocalRootParameterType::Table:
+			h.u32(uint32_t(local_param.table_entries.size()));
+			for (auto &entry : local_param.table_entries)
+			{
+				h.u32(uint32_t(entry.type));
+				h.u32(entry.register_space);
+				h.u32(entry.register_index);
+				h.u32(entry.num_descriptors_in_range);
+				h.u32(entry.offset_in_heap);
+			}
+			break;
+		}
+	}
+
+	return h.get();
+}
+
+static void apply_conversion_cache_entry(dxil_spv_converter converter, const ConversionCacheEntry &entry)
+{
+	converter->spirv = Vector<uint32_t>(entry.spirv.begin(), entry.spirv.end());
+	converter->compiled_entry_point = String(entry.compiled_entry_point.begin(), entry.compiled_entry_point.end());
+	converter->uses_subgroup_size = entry.uses_subgroup_size;
+	memcpy(converter->workgroup_size, entry.workgroup_size, sizeof(converter->workgroup_size));
+	converter->wave_size = entry.wave_size;
+	converter->heuristic_wave_size = entry.heuristic_wave_size;
+	converter->patch_vertex_count = entry.patch_vertex_count;
+	for (int i = 0; i < int(ShaderFeature::Count); i++)
+		converter->shader_feature_used[i] = (entry.shader_feature_mask & (1u << i)) != 0;
+
+	converter->cbv_promotion_candidates.clear();
+	for (size_t i = 0; i + 3 <= entry.cbv_promotion_candidates.size(); i += 3)
+	{
+		converter->cbv_promotion_candidates.push_back({ entry.cbv_promotion_candidates[i + 0],
+		                                                entry.cbv_promotion_candidates[i + 1],
+		                                                entry.cbv_promotion_candidates[i + 2] });
+	}
+
+	converter->resource_usage.clear();
+	for (size_t i = 0; i + 6 <= entry.resource_usage.size(); i += 6)
+	{
+		converter->resource_usage.push_back({ ResourceClass(entry.resource_usage[i + 0]),
+		                                      entry.resource_usage[i + 1],
+		                                      entry.resource_usage[i + 2],
+		                                      entry.resource_usage[i + 3],
+		                                      entry.resource_usage[i + 4],
+		                                      entry.resource_usage[i + 5] });
+	}
+}
+
+static void insert_conversion_cache_entry(dxil_spv_converter converter, uint64_t key)
+{
+	auto entry = std::make_shared<ConversionCacheEntry>();
+	entry->spirv.assign(converter->spirv.begin(), converter->spirv.end());
+	entry->remap_transcript = converter->remap_transcript;
+	entry->compiled_entry_point.assign(converter->compiled_entry_point.begin(), converter->compiled_entry_point.end());
+	entry->uses_subgroup_size = converter->uses_subgroup_size;
+	memcpy(entry->workgroup_size, converter->workgroup_size, sizeof(entry->workgroup_size));
+	entry->wave_size = converter->wave_size;
+	entry->heuristic_wave_size = converter->heuristic_wave_size;
+	entry->patch_vertex_count = converter->patch_vertex_count;
+	for (int i = 0; i < int(ShaderFeature::Count); i++)
+		if (converter->shader_feature_used[i])
+			entry->shader_feature_mask |= 1u << i;
+	for (auto &candidate : converter->cbv_promotion_candidates)
+		entry->cbv_promotion_candidates.insert(entry->cbv_promotion_candidates.end(),
+		                                       { candidate.register_space, candidate.register_index,
+		                                         candidate.num_words });
+	for (auto &usage : converter->resource_usage)
+		entry->resource_usage.insert(entry->resource_usage.end(),
+		                             { uint32_t(usage.resource_class), usage.register_space, usage.register_index,
+		                               usage.range_size, usage.flags, usage.cbv_used_bytes });
+
+	converter->cache->insert(key, std::move(entry));
+}
+
+static bool converter_is_cancelled(dxil_spv_converter converter)
+{
+	return converter->cancel_token && converter->cancel_token->cancelled.load(std::memory_order_relaxed);
+}
+
 dxil_spv_result dxil_spv_converter_run(dxil_spv_converter converter)
 {
+	converter->statistics.reset();
+
+	if (converter_is_cancelled(converter))
+		return DXIL_SPV_ERROR_CANCELLED;
+
+	ResourceRemappingInterface *remapper = &converter->remapper;
+	if (converter->remap_replayer)
+		remapper = converter->remap_replayer.get();
+
+	uint64_t cache_key = 0;
+	if (converter->cache)
+	{
+		cache_key = compute_conversion_cache_key(converter);
+		auto entry = converter->cache->find(cache_key);
+
+		// The remapper is opaque, so replay every query the cached conversion made.
+		// Only if the answers are identical can the result be reused.
+		if (entry && verify_remap_transcript(entry->remap_transcript.data(), entry->remap_transcript.size(),
+		                                     *remapper))
+		{
+			apply_conversion_cache_entry(converter, *entry);
+			if (converter->record_remap_transcript)
+				converter->remap_transcript = entry->remap_transcript;
+			return DXIL_SPV_SUCCESS;
+		}
+	}
+
+	if (!converter->blob->ensure_materialized(converter->entry_point.empty() ? nullptr : converter->entry_point.c_str()))
+		return thread_allocator_limit_exceeded() ? DXIL_SPV_ERROR_OUT_OF_MEMORY : DXIL_SPV_ERROR_PARSER;
+	if (converter->reflection_blob && !converter->reflection_blob->ensure_parsed())
+		return thread_allocator_limit_exceeded() ? DXIL_SPV_ERROR_OUT_OF_MEMORY : DXIL_SPV_ERROR_PARSER;
+
+	// Other converters sharing a deferred blob may materialize their entry points into the module.
+	auto reader = converter->blob->lock_for_reading();
+
+	if (converter_is_cancelled(converter))
+		return DXIL_SPV_ERROR_CANCELLED;
+
+	converter->remap_transcript.clear();
+	RemapTranscriptRecorder recorder(*remapper, converter->remap_transcript);
+
 	SPIRVModule module;
-	Converter dxil_converter(converter->bc_parser, converter->bc_reflection_parser, module);
+	Converter dxil_converter(converter->blob->bc,
+	                         converter->reflection_blob ? &converter->reflection_blob->bc : nullptr,
+	                         module);
+	dxil_converter.set_statistics(&converter->statistics);
+	if (converter->cancel_token)
+		dxil_converter.set_cancel_flag(&converter->cancel_token->cancelled);
 
 	if (!converter->entry_point.empty())
 		dxil_converter.set_entry_point(converter->entry_point.c_str());
-	dxil_converter.set_resource_remapping_interface(&converter->remapper);
+
+	if (converter->cache || converter->record_remap_transcript)
+		dxil_converter.set_resource_remapping_interface(&recorder);
+	else
+		dxil_converter.set_resource_remapping_interface(remapper);
+	if (converter->option_set)
+		for (auto &opt : converter->option_set->options)
+			dxil_converter.add_option(*opt);
 	for (auto &opt : converter->options)
 		dxil_converter.add_option(*opt);
 
@@ -648,15 +1136,47 @@ dxil_spv_result dxil_spv_converter_run(dxil_spv_converter converter)
 
 	if (entry_point.entry == nullptr)
 	{
+		if (converter_is_cancelled(converter))
+			return DXIL_SPV_ERROR_CANCELLED;
 		LOGE("Failed to convert function.\n");
-		return DXIL_SPV_ERROR_GENERIC;
+		return thread_allocator_limit_exceeded() ? DXIL_SPV_ERROR_OUT_OF_MEMORY : DXIL_SPV_ERROR_GENERIC;
 	}
 
-	{
-		dxil_spv::CFGStructurizer structurizer(entry_point.entry, *entry_point.node_pool, module);
-		structurizer.run();
-		module.emit_entry_point_function_body(structurizer);
-	}
+	// Functions are structurized and emitted one at a time, even though leaf functions are independent.
+	// The structurizer allocates IDs, constants and names from the shared module, so the order is part
+	// of the output, and the conversion cache and reference shaders rely on stable output.
+	// IDs and deduplicated constants are owned by spv::Builder, which is not thread-safe either.
+	// The CFG and IR also live in this thread's allocator context, so they can't be handed to
+	// ThreadPool workers, which reset their own context after every task.
+	auto structurize_and_emit = [&](CFGNode *entry, spv::Function *func) -> dxil_spv_result {
+		dxil_spv::CFGStructurizer structurizer(entry, *entry_point.node_pool, module);
+		if (converter->cancel_token)
+			structurizer.set_cancel_flag(&converter->cancel_token->cancelled);
+		{
+			ScopedPhaseTimer timer(&converter->statistics, StatisticsPhase::StructurizeCFG);
+			if (!structurizer.run())
+			{
+				if (!structurizer.exceeded_complexity_budget())
+					return DXIL_SPV_ERROR_CANCELLED;
+
+				LOGE("Control flow of %s in entry point \"%s\" is too complex to structurize.\n",
+				     func ? "a leaf function" : "the entry function", dxil_converter.get_compiled_entry_point().c_str());
+				return DXIL_SPV_ERROR_UNSUPPORTED_FEATURE;
+			}
+		}
+		if (thread_allocator_limit_exceeded())
+			return DXIL_SPV_ERROR_OUT_OF_MEMORY;
+		ScopedPhaseTimer timer(&converter->statistics, StatisticsPhase::EmitFunctionBody);
+		if (func)
+			module.emit_leaf_function_body(func, structurizer);
+		else
+			module.emit_entry_point_function_body(structurizer);
+		return DXIL_SPV_SUCCESS;
+	};
+
+	dxil_spv_result result = structurize_and_emit(entry_point.entry, nullptr);
+	if (result != DXIL_SPV_SUCCESS)
+		return result;
 
 	for (auto &leaf : entry_point.leaf_functions)
 	{
@@ -665,12 +1185,29 @@ dxil_spv_result dxil_spv_converter_run(dxil_spv_converter converter)
 			LOGE("Leaf function is nullptr!\n");
 			return DXIL_SPV_ERROR_GENERIC;
 		}
-		dxil_spv::CFGStructurizer structurizer(leaf.entry, *entry_point.node_pool, module);
-		structurizer.run();
-		module.emit_leaf_function_body(leaf.func, structurizer);
+
+		result = structurize_and_emit(leaf.entry, leaf.func);
+		if (result != DXIL_SPV_SUCCESS)
+			return result;
+	}
+
+	if (converter_is_cancelled(converter))
+		return DXIL_SPV_ERROR_CANCELLED;
+
+	bool finalized;
+	{
+		ScopedPhaseTimer timer(&converter->statistics, StatisticsPhase::FinalizeSPIRV);
+		finalized = module.finalize_spirv(converter->spirv);
+	}
+
+	if (thread_allocator_limit_exceeded())
+	{
+		LOGE("Thread allocator limit exceeded during conversion.\n");
+		converter->spirv.clear();
+		return DXIL_SPV_ERROR_OUT_OF_MEMORY;
 	}
 
-	if (!module.finalize_spirv(converter->spirv))
+	if (!finalized)
 	{
 		LOGE("Failed to finalize SPIR-V.\n");
 		return DXIL_SPV_ERROR_GENERIC;
@@ -686,6 +1223,11 @@ dxil_spv_result dxil_spv_converter_run(dxil_spv_converter converter)
 	converter->patch_vertex_count = dxil_converter.get_patch_vertex_count();
 	for (int i = 0; i < int(ShaderFeature::Count); i++)
 		converter->shader_feature_used[i] = dxil_converter.shader_requires_feature(ShaderFeature(i));
+	converter->cbv_promotion_candidates = dxil_converter.get_cbv_promotion_candidates();
+	converter->resource_usage = dxil_converter.get_resource_usage();
+
+	if (converter->cache)
+		insert_conversion_cache_entry(converter, cache_key);
 
 	return DXIL_SPV_SUCCESS;
 }
@@ -700,6 +1242,26 @@ dxil_spv_result dxil_spv_converter_get_compiled_spirv(dxil_spv_converter convert
 	return DXIL_SPV_SUCCESS;
 }
 
+dxil_spv_result dxil_spv_converter_copy_compiled_spirv(dxil_spv_converter converter, void *data, size_t *size)
+{
+	if (converter->spirv.empty())
+		return DXIL_SPV_ERROR_GENERIC;
+
+	size_t required_size = converter->spirv.size() * sizeof(uint32_t);
+	if (!data)
+	{
+		*size = required_size;
+		return DXIL_SPV_SUCCESS;
+	}
+
+	if (*size < required_size)
+		return DXIL_SPV_ERROR_INVALID_ARGUMENT;
+
+	memcpy(data, converter->spirv.data(), required_size);
+	*size = required_size;
+	return DXIL_SPV_SUCCESS;
+}
+
 dxil_spv_result dxil_spv_converter_get_compiled_entry_point(dxil_spv_converter converter,
                                                             const char **entry_point)
 {
@@ -710,6 +1272,42 @@ dxil_spv_result dxil_spv_converter_get_compiled_entry_point(dxil_spv_converter c
 	return DXIL_SPV_SUCCESS;
 }
 
+dxil_spv_result dxil_spv_patch_specialization_constants(void *spirv, size_t size, const unsigned *spec_ids,
+                                                        const unsigned *values, unsigned count)
+{
+	auto *words = static_cast<uint32_t *>(spirv);
+	size_t word_count = size / sizeof(uint32_t);
+	if ((size % sizeof(uint32_t)) != 0 || word_count < 5 || words[0] != spv::MagicNumber)
+		return DXIL_SPV_ERROR_INVALID_ARGUMENT;
+
+	// Decorations always come before the constants they decorate, so a single pass is enough.
+	UnorderedMap<uint32_t, uint32_t> id_to_value;
+	for (size_t offset = 5; offset < word_count;)
+	{
+		auto op = spv::Op(words[offset] & 0xffff);
+		uint32_t len = words[offset] >> 16;
+		if (len == 0 || offset + len > word_count)
+			return DXIL_SPV_ERROR_INVALID_ARGUMENT;
+
+		if (op == spv::OpDecorate && len == 4 && words[offset + 2] == spv::DecorationSpecId)
+		{
+			for (unsigned i = 0; i < count; i++)
+				if (spec_ids[i] == words[offset + 3])
+					id_to_value[words[offset + 1]] = values[i];
+		}
+		else if (op == spv::OpSpecConstant && len == 4)
+		{
+			auto itr = id_to_value.find(words[offset + 2]);
+			if (itr != id_to_value.end())
+				words[offset + 3] = itr->second;
+		}
+
+		offset += len;
+	}
+
+	return DXIL_SPV_SUCCESS;
+}
+
 void dxil_spv_converter_set_srv_remapper(dxil_spv_converter converter, dxil_spv_srv_remapper_cb remapper,
                                          void *userdata)
 {
@@ -788,7 +1386,8 @@ static std::unique_ptr<T> duplicate(const T &value)
 	return std::unique_ptr<T>(new T(value));
 }
 
-dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, const dxil_spv_option_base *option)
+template <typename OptionVector>
+static dxil_spv_result append_option(OptionVector &options, const dxil_spv_option_base *option)
 {
 	if (!dxil_spv_converter_supports_option(option->type))
 		return DXIL_SPV_ERROR_UNSUPPORTED_FEATURE;
@@ -800,7 +1399,7 @@ dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, cons
 		OptionShaderDemoteToHelper helper;
 		helper.supported = bool(reinterpret_cast<const dxil_spv_option_shader_demote_to_helper *>(option)->supported);
 
-		converter->options.emplace_back(duplicate(helper));
+		options.emplace_back(duplicate(helper));
 		break;
 	}
 
@@ -808,7 +1407,7 @@ dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, cons
 	{
 		OptionDualSourceBlending helper;
 		helper.enabled = bool(reinterpret_cast<const dxil_spv_option_dual_source_blending *>(option)->enabled);
-		converter->options.emplace_back(duplicate(helper));
+		options.emplace_back(duplicate(helper));
 		break;
 	}
 
@@ -818,7 +1417,7 @@ dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, cons
 		const auto *input = reinterpret_cast<const dxil_spv_option_output_swizzle *>(option);
 		helper.swizzles = input->swizzles;
 		helper.swizzle_count = input->swizzle_count;
-		converter->options.emplace_back(duplicate(helper));
+		options.emplace_back(duplicate(helper));
 		break;
 	}
 
@@ -828,7 +1427,7 @@ dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, cons
 		const auto *count = reinterpret_cast<const dxil_spv_option_rasterizer_sample_count *>(option);
 		helper.count = count->sample_count;
 		helper.spec_constant = bool(count->spec_constant);
-		converter->options.emplace_back(duplicate(helper));
+		options.emplace_back(duplicate(helper));
 		break;
 	}
 
@@ -839,7 +1438,7 @@ dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, cons
 		helper.desc_set = ubo->desc_set;
 		helper.binding = ubo->binding;
 		helper.enable = ubo->enable == DXIL_SPV_TRUE;
-		converter->options.emplace_back(duplicate(helper));
+		options.emplace_back(duplicate(helper));
 		break;
 	}
 
@@ -848,7 +1447,7 @@ dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, cons
 		OptionBindlessCBVSSBOEmulation helper;
 		helper.enable =
 		    reinterpret_cast<const dxil_spv_option_bindless_cbv_ssbo_emulation *>(option)->enable == DXIL_SPV_TRUE;
-		converter->options.emplace_back(duplicate(helper));
+		options.emplace_back(duplicate(helper));
 		break;
 	}
 
@@ -857,7 +1456,7 @@ dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, cons
 		OptionPhysicalStorageBuffer helper;
 		helper.enable =
 		    reinterpret_cast<const dxil_spv_option_physical_storage_buffer *>(option)->enable == DXIL_SPV_TRUE;
-		converter->options.emplace_back(duplicate(helper));
+		options.emplace_back(duplicate(helper));
 		break;
 	}
 
@@ -866,7 +1465,7 @@ dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, cons
 		OptionSBTDescriptorSizeLog2 helper;
 		helper.size_log2_srv_uav_cbv = reinterpret_cast<const dxil_spv_option_sbt_descriptor_size_log2 *>(option)->size_log2_srv_uav_cbv;
 		helper.size_log2_sampler = reinterpret_cast<const dxil_spv_option_sbt_descriptor_size_log2 *>(option)->size_log2_sampler;
-		converter->options.emplace_back(duplicate(helper));
+		options.emplace_back(duplicate(helper));
 		break;
 	}
 
@@ -874,7 +1473,7 @@ dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, cons
 	{
 		OptionSSBOAlignment helper;
 		helper.alignment = reinterpret_cast<const dxil_spv_option_ssbo_alignment *>(option)->alignment;
-		converter->options.emplace_back(duplicate(helper));
+		options.emplace_back(duplicate(helper));
 		break;
 	}
 
@@ -882,7 +1481,7 @@ dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, cons
 	{
 		OptionTypedUAVReadWithoutFormat helper;
 		helper.supported = reinterpret_cast<const dxil_spv_option_typed_uav_read_without_format *>(option)->supported == DXIL_SPV_TRUE;
-		converter->options.emplace_back(duplicate(helper));
+		options.emplace_back(duplicate(helper));
 		break;
 	}
 
@@ -892,7 +1491,7 @@ dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, cons
 		const char *name = reinterpret_cast<const dxil_spv_option_shader_source_file *>(option)->name;
 		if (name)
 			helper.name = name;
-		converter->options.emplace_back(duplicate(helper));
+		options.emplace_back(duplicate(helper));
 		break;
 	}
 
@@ -900,7 +1499,7 @@ dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, cons
 	{
 		OptionBindlessTypedBufferOffsets helper;
 		helper.enable = reinterpret_cast<const dxil_spv_option_bindless_typed_buffer_offsets *>(option)->enable;
-		converter->options.emplace_back(duplicate(helper));
+		options.emplace_back(duplicate(helper));
 		break;
 	}
 
@@ -911,7 +1510,7 @@ dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, cons
 		helper.untyped_offset = opt->untyped_offset;
 		helper.typed_offset = opt->typed_offset;
 		helper.stride = opt->stride;
-		converter->options.emplace_back(duplicate(helper));
+		options.emplace_back(duplicate(helper));
 		break;
 	}
 
@@ -920,7 +1519,7 @@ dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, cons
 		OptionStorageInputOutput16 helper;
 		helper.supported =
 		    reinterpret_cast<const dxil_spv_option_storage_input_output_16bit *>(option)->supported == DXIL_SPV_TRUE;
-		converter->options.emplace_back(duplicate(helper));
+		options.emplace_back(duplicate(helper));
 		break;
 	}
 
@@ -935,7 +1534,7 @@ dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, cons
 		helper.heap_desc_set = qa->heap_desc_set;
 		helper.heap_binding = qa->heap_binding;
 		helper.version = qa->version;
-		converter->options.emplace_back(duplicate(helper));
+		options.emplace_back(duplicate(helper));
 		break;
 	}
 
@@ -944,7 +1543,7 @@ dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, cons
 		OptionMinPrecisionNative16Bit helper;
 		auto *minprec = reinterpret_cast<const dxil_spv_option_min_precision_native_16bit *>(option);
 		helper.enabled = minprec->enabled == DXIL_SPV_TRUE;
-		converter->options.emplace_back(duplicate(helper));
+		options.emplace_back(duplicate(helper));
 		break;
 	}
 
@@ -953,7 +1552,7 @@ dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, cons
 		OptionShaderI8Dot helper;
 		helper.supported = bool(reinterpret_cast<const dxil_spv_option_shader_i8_dot *>(option)->supported);
 
-		converter->options.emplace_back(duplicate(helper));
+		options.emplace_back(duplicate(helper));
 		break;
 	}
 
@@ -962,7 +1561,7 @@ dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, cons
 		OptionShaderRayTracingPrimitiveCulling helper;
 		helper.supported = bool(reinterpret_cast<const dxil_spv_option_shader_ray_tracing_primitive_culling *>(option)->supported);
 
-		converter->options.emplace_back(duplicate(helper));
+		options.emplace_back(duplicate(helper));
 		break;
 	}
 
@@ -971,7 +1570,7 @@ dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, cons
 		OptionInvariantPosition helper;
 		helper.enabled = bool(reinterpret_cast<const dxil_spv_option_invariant_position *>(option)->enabled);
 
-		converter->options.emplace_back(duplicate(helper));
+		options.emplace_back(duplicate(helper));
 		break;
 	}
 
@@ -982,7 +1581,7 @@ dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, cons
 		helper.supported = bool(opt->supported);
 		helper.supports_per_component_robustness = bool(opt->supports_per_component_robustness);
 
-		converter->options.emplace_back(duplicate(helper));
+		options.emplace_back(duplicate(helper));
 		break;
 	}
 
@@ -992,7 +1591,7 @@ dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, cons
 		auto *opt = reinterpret_cast<const dxil_spv_option_barycentric_khr *>(option);
 		helper.supported = bool(opt->supported);
 
-		converter->options.emplace_back(duplicate(helper));
+		options.emplace_back(duplicate(helper));
 		break;
 	}
 
@@ -1002,7 +1601,7 @@ dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, cons
 		auto *robust = reinterpret_cast<const dxil_spv_option_robust_physical_cbv_load *>(option);
 		helper.enabled = bool(robust->enabled);
 
-		converter->options.emplace_back(duplicate(helper));
+		options.emplace_back(duplicate(helper));
 		break;
 	}
 
@@ -1012,7 +1611,7 @@ dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, cons
 		auto *robust = reinterpret_cast<const dxil_spv_option_arithmetic_relaxed_precision *>(option);
 		helper.enabled = bool(robust->enabled);
 
-		converter->options.emplace_back(duplicate(helper));
+		options.emplace_back(duplicate(helper));
 		break;
 	}
 
@@ -1023,7 +1622,7 @@ dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, cons
 		helper.element_stride = indexing->element_stride;
 		helper.element_offset = indexing->element_offset;
 
-		converter->options.emplace_back(duplicate(helper));
+		options.emplace_back(duplicate(helper));
 		break;
 	}
 
@@ -1034,7 +1633,7 @@ dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, cons
 		helper.forced_value = subgroup->forced_value;
 		helper.wave_size_enable = subgroup->wave_size_enable;
 
-		converter->options.emplace_back(duplicate(helper));
+		options.emplace_back(duplicate(helper));
 		break;
 	}
 
@@ -1045,7 +1644,7 @@ dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, cons
 		helper.support_float16_denorm_preserve = bool(denorm->supports_float16_denorm_preserve);
 		helper.support_float64_denorm_preserve = bool(denorm->supports_float64_denorm_preserve);
 
-		converter->options.emplace_back(duplicate(helper));
+		options.emplace_back(duplicate(helper));
 		break;
 	}
 
@@ -1055,7 +1654,7 @@ dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, cons
 		auto *strict = reinterpret_cast<const dxil_spv_option_strict_helper_lane_wave_ops *>(option);
 		helper.enable = strict->enable;
 
-		converter->options.emplace_back(duplicate(helper));
+		options.emplace_back(duplicate(helper));
 		break;
 	}
 
@@ -1065,7 +1664,7 @@ dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, cons
 		auto *partitioned = reinterpret_cast<const dxil_spv_option_subgroup_partitioned_nv *>(option);
 		helper.supported = partitioned->supported;
 
-		converter->options.emplace_back(duplicate(helper));
+		options.emplace_back(duplicate(helper));
 		break;
 	}
 
@@ -1075,7 +1674,7 @@ dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, cons
 		auto *eliminate = reinterpret_cast<const dxil_spv_option_dead_code_eliminate *>(option);
 		helper.enabled = eliminate->enabled;
 
-		converter->options.emplace_back(duplicate(helper));
+		options.emplace_back(duplicate(helper));
 		break;
 	}
 
@@ -1086,7 +1685,7 @@ dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, cons
 		helper.force_precise = precise->force_precise;
 		helper.propagate_precise = precise->propagate_precise;
 
-		converter->options.emplace_back(duplicate(helper));
+		options.emplace_back(duplicate(helper));
 		break;
 	}
 
@@ -1097,7 +1696,7 @@ dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, cons
 		helper.enabled = precise->enabled;
 		helper.assume_uniform_scale = precise->assume_uniform_scale;
 
-		converter->options.emplace_back(duplicate(helper));
+		options.emplace_back(duplicate(helper));
 		break;
 	}
 
@@ -1107,7 +1706,7 @@ dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, cons
 		auto *omm = reinterpret_cast<const dxil_spv_option_opacity_micromap *>(option);
 		helper.enabled = omm->enabled;
 
-		converter->options.emplace_back(duplicate(helper));
+		options.emplace_back(duplicate(helper));
 		break;
 	}
 
@@ -1121,7 +1720,7 @@ dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, cons
 		helper.force_unroll = branch->force_unroll;
 		helper.force_flatten = branch->force_flatten;
 
-		converter->options.emplace_back(duplicate(helper));
+		options.emplace_back(duplicate(helper));
 		break;
 	}
 
@@ -1132,7 +1731,7 @@ dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, cons
 		helper.minimum_size = sub->minimum_size;
 		helper.maximum_size = sub->maximum_size;
 
-		converter->options.emplace_back(duplicate(helper));
+		options.emplace_back(duplicate(helper));
 		break;
 	}
 
@@ -1142,38 +1741,337 @@ dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, cons
 		auto *rob = reinterpret_cast<const dxil_spv_option_descriptor_heap_robustness *>(option);
 		helper.enabled = rob->enabled;
 
-		converter->options.emplace_back(duplicate(helper));
+		options.emplace_back(duplicate(helper));
 		break;
 	}
 
-	default:
-		return DXIL_SPV_ERROR_UNSUPPORTED_FEATURE;
+	case DXIL_SPV_OPTION_SPIRV_OPTIMIZATION:
+	{
+		OptionSpirvOptimization helper;
+		auto *opt = reinterpret_cast<const dxil_spv_option_spirv_optimization *>(option);
+		helper.enabled = opt->enabled;
+
+		options.emplace_back(duplicate(helper));
+		break;
 	}
 
-	return DXIL_SPV_SUCCESS;
-}
+	case DXIL_SPV_OPTION_PEEPHOLE_OPTIMIZATION:
+	{
+		OptionPeepholeOptimization helper;
+		auto *opt = reinterpret_cast<const dxil_spv_option_peephole_optimization *>(option);
+		helper.enabled = opt->enabled;
 
-void dxil_spv_converter_add_local_root_constants(dxil_spv_converter converter,
-                                                 unsigned register_space,
-                                                 unsigned register_index,
-                                                 unsigned num_words)
-{
-	LocalRootParameter param = {};
-	param.type = LocalRootParameterType::Constants;
-	param.local_constants = { register_space, register_index, num_words };
-	converter->local_root_parameters.push_back(std::move(param));
-}
+		options.emplace_back(duplicate(helper));
+		break;
+	}
 
-void dxil_spv_converter_add_local_root_descriptor(dxil_spv_converter converter,
-                                                  dxil_spv_resource_class resource_class,
-                                                  unsigned register_space,
-                                                  unsigned register_index)
-{
-	LocalRootParameter param = {};
-	param.type = LocalRootParameterType::Descriptor;
-	param.local_descriptor = { ResourceClass(resource_class), register_space, register_index };
-	converter->local_root_parameters.push_back(std::move(param));
-}
+	case DXIL_SPV_OPTION_BUFFER_LOAD_COALESCING:
+	{
+		OptionBufferLoadCoalescing helper;
+		auto *opt = reinterpret_cast<const dxil_spv_option_buffer_load_coalescing *>(option);
+		helper.enabled = opt->enabled;
+
+		options.emplace_back(duplicate(helper));
+		break;
+	}
+
+	case DXIL_SPV_OPTION_UNIFORMITY_ANALYSIS:
+	{
+		OptionUniformityAnalysis helper;
+		auto *opt = reinterpret_cast<const dxil_spv_option_uniformity_analysis *>(option);
+		helper.enabled = opt->enabled;
+
+		options.emplace_back(duplicate(helper));
+		break;
+	}
+
+	case DXIL_SPV_OPTION_RAY_PAYLOAD_LIVENESS:
+	{
+		OptionRayPayloadLiveness helper;
+		auto *opt = reinterpret_cast<const dxil_spv_option_ray_payload_liveness *>(option);
+		helper.enabled = opt->enabled;
+
+		options.emplace_back(duplicate(helper));
+		break;
+	}
+
+	case DXIL_SPV_OPTION_LOOP_INVARIANT_CODE_MOTION:
+	{
+		OptionLoopInvariantCodeMotion helper;
+		auto *opt = reinterpret_cast<const dxil_spv_option_loop_invariant_code_motion *>(option);
+		helper.enabled = opt->enabled;
+
+		options.emplace_back(duplicate(helper));
+		break;
+	}
+
+	case DXIL_SPV_OPTION_SPARSE_FEEDBACK_FORWARDING:
+	{
+		OptionSparseFeedbackForwarding helper;
+		auto *opt = reinterpret_cast<const dxil_spv_option_sparse_feedback_forwarding *>(option);
+		helper.enabled = opt->enabled;
+
+		options.emplace_back(duplicate(helper));
+		break;
+	}
+
+	case DXIL_SPV_OPTION_STRUCTURED_CFG_FAST_PATH:
+	{
+		OptionStructuredCFGFastPath helper;
+		auto *opt = reinterpret_cast<const dxil_spv_option_structured_cfg_fast_path *>(option);
+		helper.enabled = opt->enabled;
+
+		options.emplace_back(duplicate(helper));
+		break;
+	}
+
+	case DXIL_SPV_OPTION_KNOWN_ROOT_CONSTANTS:
+	{
+		OptionKnownRootConstants helper;
+		auto *opt = reinterpret_cast<const dxil_spv_option_known_root_constants *>(option);
+		helper.word_indices = opt->word_indices;
+		helper.values = opt->values;
+		helper.count = opt->count;
+
+		options.emplace_back(duplicate(helper));
+		break;
+	}
+
+	case DXIL_SPV_OPTION_HULL_BARRIER_ELISION:
+	{
+		OptionHullBarrierElision helper;
+		auto *opt = reinterpret_cast<const dxil_spv_option_hull_barrier_elision *>(option);
+		helper.enabled = opt->enabled == DXIL_SPV_TRUE;
+
+		options.emplace_back(duplicate(helper));
+		break;
+	}
+
+	case DXIL_SPV_OPTION_GEOMETRY_OUTPUT_VERTEX_ANALYSIS:
+	{
+		OptionGeometryOutputVertexAnalysis helper;
+		auto *opt = reinterpret_cast<const dxil_spv_option_geometry_output_vertex_analysis *>(option);
+		helper.enabled = opt->enabled == DXIL_SPV_TRUE;
+
+		options.emplace_back(duplicate(helper));
+		break;
+	}
+
+	case DXIL_SPV_OPTION_MIN_PRECISION_NARROWING:
+	{
+		OptionMinPrecisionNarrowing helper;
+		auto *opt = reinterpret_cast<const dxil_spv_option_min_precision_narrowing *>(option);
+		helper.enabled = opt->enabled == DXIL_SPV_TRUE;
+
+		options.emplace_back(duplicate(helper));
+		break;
+	}
+
+	case DXIL_SPV_OPTION_DESCRIPTOR_QA_SAMPLING:
+	{
+		OptionDescriptorQASampling helper;
+		auto *opt = reinterpret_cast<const dxil_spv_option_descriptor_qa_sampling *>(option);
+		helper.deduplicate_per_block = opt->deduplicate_per_block == DXIL_SPV_TRUE;
+		helper.kill_switch = opt->kill_switch == DXIL_SPV_TRUE;
+		helper.kill_switch_spec_id = opt->kill_switch_spec_id;
+
+		options.emplace_back(duplicate(helper));
+		break;
+	}
+
+	case DXIL_SPV_OPTION_WAVE_AGGREGATED_ATOMICS:
+	{
+		OptionWaveAggregatedAtomics helper;
+		auto *opt = reinterpret_cast<const dxil_spv_option_wave_aggregated_atomics *>(option);
+		helper.enabled = opt->enabled == DXIL_SPV_TRUE;
+
+		options.emplace_back(duplicate(helper));
+		break;
+	}
+
+	case DXIL_SPV_OPTION_UAV_COHERENCE_ANALYSIS:
+	{
+		OptionUAVCoherenceAnalysis helper;
+		auto *opt = reinterpret_cast<const dxil_spv_option_uav_coherence_analysis *>(option);
+		helper.enabled = opt->enabled == DXIL_SPV_TRUE;
+
+		options.emplace_back(duplicate(helper));
+		break;
+	}
+
+	case DXIL_SPV_OPTION_PHYSICAL_ADDRESS_ALIGNMENT:
+	{
+		OptionPhysicalAddressAlignment helper;
+		helper.alignment = reinterpret_cast<const dxil_spv_option_physical_address_alignment *>(option)->alignment;
+
+		options.emplace_back(duplicate(helper));
+		break;
+	}
+
+	case DXIL_SPV_OPTION_ALLOCA_SCALARIZATION:
+	{
+		OptionAllocaScalarization helper;
+		auto *opt = reinterpret_cast<const dxil_spv_option_alloca_scalarization *>(option);
+		helper.enabled = opt->enabled == DXIL_SPV_TRUE;
+
+		options.emplace_back(duplicate(helper));
+		break;
+	}
+
+	case DXIL_SPV_OPTION_SAMPLER_FEEDBACK_LOD_MERGING:
+	{
+		OptionSamplerFeedbackLODMerging helper;
+		auto *opt = reinterpret_cast<const dxil_spv_option_sampler_feedback_lod_merging *>(option);
+		helper.enabled = opt->enabled == DXIL_SPV_TRUE;
+
+		options.emplace_back(duplicate(helper));
+		break;
+	}
+
+	case DXIL_SPV_OPTION_SPIRV_CANONICALIZATION:
+	{
+		OptionSPIRVCanonicalization helper;
+		auto *opt = reinterpret_cast<const dxil_spv_option_spirv_canonicalization *>(option);
+		helper.enabled = opt->enabled == DXIL_SPV_TRUE;
+
+		options.emplace_back(duplicate(helper));
+		break;
+	}
+
+	case DXIL_SPV_OPTION_MESH_OUTPUT_STORE_COALESCING:
+	{
+		OptionMeshOutputStoreCoalescing helper;
+		auto *opt = reinterpret_cast<const dxil_spv_option_mesh_output_store_coalescing *>(option);
+		helper.enabled = opt->enabled == DXIL_SPV_TRUE;
+
+		options.emplace_back(duplicate(helper));
+		break;
+	}
+
+	case DXIL_SPV_OPTION_STRUCTURIZER_COMPLEXITY_BUDGET:
+	{
+		OptionStructurizerComplexityBudget helper;
+		auto *opt = reinterpret_cast<const dxil_spv_option_structurizer_complexity_budget *>(option);
+		helper.node_growth_factor = opt->node_growth_factor;
+
+		options.emplace_back(duplicate(helper));
+		break;
+	}
+
+	case DXIL_SPV_OPTION_CONSTANT_FOLDING:
+	{
+		OptionConstantFolding helper;
+		auto *opt = reinterpret_cast<const dxil_spv_option_constant_folding *>(option);
+		helper.enabled = opt->enabled == DXIL_SPV_TRUE;
+
+		options.emplace_back(duplicate(helper));
+		break;
+	}
+
+	case DXIL_SPV_OPTION_SBT_DESCRIPTOR_SIZE_SPEC_CONSTANTS:
+	{
+		OptionSBTDescriptorSizeSpecConstants helper;
+		auto *opt = reinterpret_cast<const dxil_spv_option_sbt_descriptor_size_spec_constants *>(option);
+		helper.enabled = opt->enabled == DXIL_SPV_TRUE;
+		helper.spec_id_srv_uav_cbv = opt->spec_id_srv_uav_cbv;
+		helper.spec_id_sampler = opt->spec_id_sampler;
+
+		options.emplace_back(duplicate(helper));
+		break;
+	}
+
+	case DXIL_SPV_OPTION_CONSUMER_STAGE_INPUTS:
+	{
+		OptionConsumerStageInputs helper;
+		auto *opt = reinterpret_cast<const dxil_spv_option_consumer_stage_inputs *>(option);
+		helper.enabled = opt->enabled == DXIL_SPV_TRUE;
+		helper.semantic_names = opt->semantic_names;
+		helper.semantic_indices = opt->semantic_indices;
+		helper.count = opt->count;
+
+		options.emplace_back(duplicate(helper));
+		break;
+	}
+
+	default:
+		return DXIL_SPV_ERROR_UNSUPPORTED_FEATURE;
+	}
+
+	return DXIL_SPV_SUCCESS;
+}
+
+dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter, const dxil_spv_option_base *option)
+{
+	return append_option(converter->options, option);
+}
+
+dxil_spv_result dxil_spv_create_option_set(const dxil_spv_option_base *const *options, unsigned count,
+                                           dxil_spv_option_set *option_set)
+{
+	auto *set = new (std::nothrow) dxil_spv_option_set_s;
+	if (!set)
+		return DXIL_SPV_ERROR_OUT_OF_MEMORY;
+
+	set->options.reserve(count);
+	for (unsigned i = 0; i < count; i++)
+	{
+		dxil_spv_result result = append_option(set->options, options[i]);
+		if (result != DXIL_SPV_SUCCESS)
+		{
+			delete set;
+			return result;
+		}
+	}
+
+	Hasher h;
+	h.u32(uint32_t(set->options.size()));
+	for (auto &opt : set->options)
+		ConversionCache::hash_option(h, *opt);
+	set->hash = h.get();
+
+	*option_set = set;
+	return DXIL_SPV_SUCCESS;
+}
+
+unsigned long long dxil_spv_option_set_get_hash(dxil_spv_option_set option_set)
+{
+	return option_set->hash;
+}
+
+void dxil_spv_option_set_free(dxil_spv_option_set option_set)
+{
+	release_option_set(option_set);
+}
+
+void dxil_spv_converter_set_option_set(dxil_spv_converter converter, dxil_spv_option_set option_set)
+{
+	if (option_set)
+		option_set->ref_count.fetch_add(1, std::memory_order_relaxed);
+	release_option_set(converter->option_set);
+	converter->option_set = option_set;
+}
+
+void dxil_spv_converter_add_local_root_constants(dxil_spv_converter converter,
+                                                 unsigned register_space,
+                                                 unsigned register_index,
+                                                 unsigned num_words)
+{
+	LocalRootParameter param = {};
+	param.type = LocalRootParameterType::Constants;
+	param.local_constants = { register_space, register_index, num_words };
+	converter->local_root_parameters.push_back(std::move(param));
+}
+
+void dxil_spv_converter_add_local_root_descriptor(dxil_spv_converter converter,
+                                                  dxil_spv_resource_class resource_class,
+                                                  unsigned register_space,
+                                                  unsigned register_index)
+{
+	LocalRootParameter param = {};
+	param.type = LocalRootParameterType::Descriptor;
+	param.local_descriptor = { ResourceClass(resource_class), register_space, register_index };
+	converter->local_root_parameters.push_back(std::move(param));
+}
 
 void dxil_spv_converter_add_local_root_descriptor_table(dxil_spv_converter converter,
                                                         dxil_spv_resource_class resource_class,
@@ -1228,22 +2126,52 @@ dxil_spv_result dxil_spv_converter_end_local_root_descriptor_table(
 
 unsigned dxil_spv_parsed_blob_get_num_rdat_subobjects(dxil_spv_parsed_blob blob)
 {
-	return unsigned(blob->rdat_subobjects.size());
+	return blob->rdat.get_num_subobjects();
 }
 
 void dxil_spv_parsed_blob_get_rdat_subobject(
 		dxil_spv_parsed_blob blob, unsigned index, dxil_spv_rdat_subobject *subobject)
 {
-	auto &sub = blob->rdat_subobjects[index];
-	subobject->kind = static_cast<dxil_spv_rdat_subobject_kind>(sub.kind);
-	subobject->subobject_name = sub.subobject_name;
-	subobject->exports = sub.exports.data();
-	subobject->num_exports = unsigned(sub.exports.size());
-	subobject->payload = sub.payload;
-	subobject->payload_size = sub.payload_size;
-	subobject->hit_group_type = static_cast<dxil_spv_hit_group_type>(sub.hit_group_type);
-	static_assert(sizeof(subobject->args) == sizeof(sub.args), "Mismatch is args size.");
-	memcpy(subobject->args, sub.args, sizeof(sub.args));
+	std::lock_guard<std::mutex> holder{blob->rdat_lock};
+	*subobject = {};
+
+	auto *sub = blob->rdat.get_subobject(index);
+	if (!sub)
+	{
+		subobject->kind = DXIL_SPV_RDAT_SUBOBJECT_KIND_INVALID;
+		return;
+	}
+
+	subobject->kind = static_cast<dxil_spv_rdat_subobject_kind>(sub->kind);
+	subobject->subobject_name = sub->subobject_name;
+	subobject->exports = sub->exports.data();
+	subobject->num_exports = unsigned(sub->exports.size());
+	subobject->payload = sub->payload;
+	subobject->payload_size = sub->payload_size;
+	subobject->hit_group_type = static_cast<dxil_spv_hit_group_type>(sub->hit_group_type);
+	static_assert(sizeof(subobject->args) == sizeof(sub->args), "Mismatch is args size.");
+	memcpy(subobject->args, sub->args, sizeof(sub->args));
+}
+
+dxil_spv_result dxil_spv_parsed_blob_get_rdat_export_associations(
+		dxil_spv_parsed_blob blob, const char *export_name, const unsigned **indices, unsigned *count)
+{
+	static_assert(sizeof(unsigned) == sizeof(uint32_t), "Unexpected size of unsigned.");
+	std::lock_guard<std::mutex> holder{blob->rdat_lock};
+
+	auto *associations = blob->rdat.find_export_associations(export_name);
+	if (associations)
+	{
+		*indices = associations->data();
+		*count = unsigned(associations->size());
+	}
+	else
+	{
+		*indices = nullptr;
+		*count = 0;
+	}
+
+	return DXIL_SPV_SUCCESS;
 }
 
 dxil_spv_bool dxil_spv_converter_uses_subgroup_size(dxil_spv_converter converter)
@@ -1291,11 +2219,385 @@ dxil_spv_bool dxil_spv_converter_uses_shader_feature(
 		return DXIL_SPV_FALSE;
 }
 
+unsigned dxil_spv_converter_get_num_cbv_promotion_candidates(dxil_spv_converter converter)
+{
+	return unsigned(converter->cbv_promotion_candidates.size());
+}
+
+dxil_spv_result dxil_spv_converter_get_cbv_promotion_candidate(
+		dxil_spv_converter converter, unsigned index, dxil_spv_cbv_promotion_candidate *candidate)
+{
+	if (index >= converter->cbv_promotion_candidates.size())
+		return DXIL_SPV_ERROR_INVALID_ARGUMENT;
+
+	auto &c = converter->cbv_promotion_candidates[index];
+	candidate->register_space = c.register_space;
+	candidate->register_index = c.register_index;
+	candidate->num_words = c.num_words;
+	return DXIL_SPV_SUCCESS;
+}
+
+unsigned dxil_spv_converter_get_num_used_resources(dxil_spv_converter converter)
+{
+	return unsigned(converter->resource_usage.size());
+}
+
+dxil_spv_result dxil_spv_converter_get_used_resource(
+		dxil_spv_converter converter, unsigned index, dxil_spv_resource_usage *usage)
+{
+	if (index >= converter->resource_usage.size())
+		return DXIL_SPV_ERROR_INVALID_ARGUMENT;
+
+	auto &u = converter->resource_usage[index];
+	usage->resource_class = static_cast<dxil_spv_resource_class>(u.resource_class);
+	usage->register_space = u.register_space;
+	usage->register_index = u.register_index;
+	usage->range_size = u.range_size;
+	usage->flags = u.flags;
+	usage->cbv_used_bytes = u.cbv_used_bytes;
+	return DXIL_SPV_SUCCESS;
+}
+
+dxil_spv_result dxil_spv_converter_get_statistics(dxil_spv_converter converter,
+                                                  dxil_spv_statistics_phase phase,
+                                                  dxil_spv_phase_statistics *stats)
+{
+	if (phase < 0 || phase >= DXIL_SPV_STATISTICS_PHASE_COUNT)
+		return DXIL_SPV_ERROR_INVALID_ARGUMENT;
+
+	auto internal_phase = StatisticsPhase(phase);
+	PhaseStatistics phase_stats;
+
+	if (internal_phase == StatisticsPhase::ContainerParse || internal_phase == StatisticsPhase::BitcodeParse)
+	{
+		auto *blob = converter->blob;
+		std::lock_guard<std::mutex> holder{ blob->bc_parse_lock };
+		phase_stats = blob->statistics.get(internal_phase);
+	}
+	else
+		phase_stats = converter->statistics.get(internal_phase);
+
+	stats->time_ns = phase_stats.time_ns;
+	stats->allocated_bytes = phase_stats.allocated_bytes;
+	stats->invocations = phase_stats.invocations;
+	return DXIL_SPV_SUCCESS;
+}
+
+struct dxil_spv_conversion_cache_s
+{
+	dxil_spv_conversion_cache_s(size_t max_memory_size, std::string disk_path)
+		: cache(max_memory_size, std::move(disk_path))
+	{
+	}
+
+	ConversionCache cache;
+};
+
+dxil_spv_result dxil_spv_conversion_cache_create(size_t max_memory_size, const char *disk_path,
+                                                 dxil_spv_conversion_cache *cache)
+{
+	auto *c = new (std::nothrow) dxil_spv_conversion_cache_s(max_memory_size, disk_path ? disk_path : "");
+	if (!c)
+		return DXIL_SPV_ERROR_OUT_OF_MEMORY;
+
+	*cache = c;
+	return DXIL_SPV_SUCCESS;
+}
+
+void dxil_spv_conversion_cache_free(dxil_spv_conversion_cache cache)
+{
+	delete cache;
+}
+
+void dxil_spv_converter_set_conversion_cache(dxil_spv_converter converter, dxil_spv_conversion_cache cache)
+{
+	converter->cache = cache ? &cache->cache : nullptr;
+}
+
+void dxil_spv_converter_set_remap_transcript_recording(dxil_spv_converter converter, dxil_spv_bool enable)
+{
+	converter->record_remap_transcript = bool(enable);
+}
+
+dxil_spv_result dxil_spv_converter_get_remap_transcript(dxil_spv_converter converter,
+                                                        const void **data, size_t *size)
+{
+	if (!converter->record_remap_transcript || converter->remap_transcript.empty())
+		return DXIL_SPV_ERROR_GENERIC;
+
+	*data = converter->remap_transcript.data();
+	*size = converter->remap_transcript.size() * sizeof(uint32_t);
+	return DXIL_SPV_SUCCESS;
+}
+
+dxil_spv_result dxil_spv_converter_set_remap_transcript_replay(dxil_spv_converter converter,
+                                                               const void *data, size_t size)
+{
+	if (!data)
+	{
+		converter->remap_replayer.reset();
+		return DXIL_SPV_SUCCESS;
+	}
+
+	if (size % sizeof(uint32_t))
+		return DXIL_SPV_ERROR_INVALID_ARGUMENT;
+
+	// Copy the words out since data need not be aligned.
+	std::vector<uint32_t> words(size / sizeof(uint32_t));
+	memcpy(words.data(), data, size);
+
+	std::unique_ptr<RemapTranscriptReplayer> replayer(
+	    new RemapTranscriptReplayer(words.data(), words.size(), &converter->remapper));
+	if (!replayer->is_valid())
+		return DXIL_SPV_ERROR_INVALID_ARGUMENT;
+
+	converter->remap_replayer = std::move(replayer);
+	return DXIL_SPV_SUCCESS;
+}
+
+dxil_spv_result dxil_spv_cancel_token_create(dxil_spv_cancel_token *token)
+{
+	auto *t = new (std::nothrow) dxil_spv_cancel_token_s;
+	if (!t)
+		return DXIL_SPV_ERROR_OUT_OF_MEMORY;
+
+	*token = t;
+	return DXIL_SPV_SUCCESS;
+}
+
+void dxil_spv_cancel_token_cancel(dxil_spv_cancel_token token)
+{
+	token->cancelled.store(true, std::memory_order_relaxed);
+}
+
+dxil_spv_bool dxil_spv_cancel_token_is_cancelled(dxil_spv_cancel_token token)
+{
+	return token->cancelled.load(std::memory_order_relaxed) ? DXIL_SPV_TRUE : DXIL_SPV_FALSE;
+}
+
+void dxil_spv_cancel_token_free(dxil_spv_cancel_token token)
+{
+	delete token;
+}
+
+void dxil_spv_converter_set_cancel_token(dxil_spv_converter converter, dxil_spv_cancel_token token)
+{
+	converter->cancel_token = token;
+}
+
+struct dxil_spv_batch_s
+{
+	dxil_spv_batch_s(unsigned num_threads, unsigned max_jobs_in_flight_)
+		: max_jobs_in_flight(max_jobs_in_flight_), pool(num_threads)
+	{
+	}
+
+	void begin_job()
+	{
+		if (!max_jobs_in_flight)
+			return;
+		std::unique_lock<std::mutex> holder{lock};
+		cond.wait(holder, [this]() { return jobs_in_flight < max_jobs_in_flight; });
+		jobs_in_flight++;
+	}
+
+	void end_job()
+	{
+		if (!max_jobs_in_flight)
+			return;
+		std::lock_guard<std::mutex> holder{lock};
+		jobs_in_flight--;
+		cond.notify_one();
+	}
+
+	std::mutex lock;
+	std::condition_variable cond;
+	unsigned max_jobs_in_flight;
+	unsigned jobs_in_flight = 0;
+
+	// Declared last, so that outstanding jobs are drained before the members above go away.
+	ThreadPool pool;
+};
+
+static void run_batch_job(const dxil_spv_batch_job &job, const std::string &entry_point,
+                          dxil_spv_cancel_token token)
+{
+	dxil_spv_parsed_blob blob = nullptr;
+	dxil_spv_converter converter = nullptr;
+	dxil_spv_result result;
+
+	if (token && token->cancelled.load(std::memory_order_relaxed))
+		result = DXIL_SPV_ERROR_CANCELLED;
+	else if (job.raw_dxil)
+		result = dxil_spv_parse_dxil(job.data, job.size, &blob);
+	else
+		result = dxil_spv_parse_dxil_blob_with_flags(job.data, job.size,
+		                                             DXIL_SPV_PARSE_DEFERRED_BIT | DXIL_SPV_PARSE_BORROW_INPUT_BIT,
+		                                             &blob);
+
+	if (result == DXIL_SPV_SUCCESS)
+		result = dxil_spv_create_converter(blob, &converter);
+
+	if (result == DXIL_SPV_SUCCESS)
+	{
+		if (!entry_point.empty())
+			dxil_spv_converter_set_entry_point(converter, entry_point.c_str());
+		dxil_spv_converter_set_cancel_token(converter, token);
+		if (job.setup)
+			result = job.setup(job.userdata, blob, converter);
+	}
+
+	if (result == DXIL_SPV_SUCCESS)
+		result = dxil_spv_converter_run(converter);
+
+	if (job.complete)
+		job.complete(job.userdata, result, converter);
+
+	// Must be destroyed before the worker resets its allocator context.
+	if (converter)
+		dxil_spv_converter_free(converter);
+	if (blob)
+		dxil_spv_parsed_blob_free(blob);
+}
+
+dxil_spv_result dxil_spv_batch_create(unsigned num_threads, dxil_spv_batch *batch)
+{
+	return dxil_spv_batch_create_bounded(num_threads, 0, batch);
+}
+
+dxil_spv_result dxil_spv_batch_create_bounded(unsigned num_threads, unsigned max_jobs_in_flight,
+                                              dxil_spv_batch *batch)
+{
+	auto *b = new (std::nothrow) dxil_spv_batch_s(num_threads, max_jobs_in_flight);
+	if (!b)
+		return DXIL_SPV_ERROR_OUT_OF_MEMORY;
+
+	*batch = b;
+	return DXIL_SPV_SUCCESS;
+}
+
+dxil_spv_result dxil_spv_batch_submit(dxil_spv_batch batch, const dxil_spv_batch_job *job)
+{
+	return dxil_spv_batch_submit_cancellable(batch, job, nullptr);
+}
+
+dxil_spv_result dxil_spv_batch_submit_cancellable(dxil_spv_batch batch, const dxil_spv_batch_job *job,
+                                                  dxil_spv_cancel_token token)
+{
+	// Without an estimate, larger inputs are assumed to be more expensive.
+	return dxil_spv_batch_submit_with_cost(batch, job, token, job->size);
+}
+
+dxil_spv_result dxil_spv_batch_submit_with_cost(dxil_spv_batch batch, const dxil_spv_batch_job *job,
+                                                dxil_spv_cancel_token token, unsigned long long cost)
+{
+	if (!job->data || !job->size)
+		return DXIL_SPV_ERROR_INVALID_ARGUMENT;
+
+	dxil_spv_batch_job copy = *job;
+	std::string entry_point;
+	if (job->entry_point)
+		entry_point = job->entry_point;
+	copy.entry_point = nullptr;
+
+	batch->begin_job();
+	batch->pool.submit([batch, copy, entry_point, token]() {
+		run_batch_job(copy, entry_point, token);
+		batch->end_job();
+	}, cost);
+	return DXIL_SPV_SUCCESS;
+}
+
+dxil_spv_result dxil_spv_batch_parse_dxil_blob(dxil_spv_batch batch, const void *data, size_t size,
+                                               dxil_spv_parse_flags flags, dxil_spv_parsed_blob *blob)
+{
+	if ((flags & (DXIL_SPV_PARSE_DEFERRED_BIT | DXIL_SPV_PARSE_METADATA_ONLY_BIT)) != 0)
+		return DXIL_SPV_ERROR_INVALID_ARGUMENT;
+	return parse_dxil_blob(data, size, flags, &batch->pool, blob);
+}
+
+void dxil_spv_batch_wait(dxil_spv_batch batch)
+{
+	batch->pool.wait_idle();
+}
+
+void dxil_spv_batch_free(dxil_spv_batch batch)
+{
+	delete batch;
+}
+
+struct dxil_spv_archive_s
+{
+	ShaderArchiveParser parser;
+};
+
+dxil_spv_result dxil_spv_parse_archive(const void *data, size_t size, dxil_spv_archive *archive)
+{
+	auto *a = new (std::nothrow) dxil_spv_archive_s;
+	if (!a)
+		return DXIL_SPV_ERROR_OUT_OF_MEMORY;
+
+	if (!a->parser.parse(data, size))
+	{
+		delete a;
+		return DXIL_SPV_ERROR_PARSER;
+	}
+
+	*archive = a;
+	return DXIL_SPV_SUCCESS;
+}
+
+unsigned dxil_spv_archive_get_num_blobs(dxil_spv_archive archive)
+{
+	return unsigned(archive->parser.get_blobs().size());
+}
+
+dxil_spv_result dxil_spv_archive_get_blob(dxil_spv_archive archive, unsigned index, dxil_spv_archive_blob *blob)
+{
+	auto &blobs = archive->parser.get_blobs();
+	if (index >= blobs.size())
+		return DXIL_SPV_ERROR_INVALID_ARGUMENT;
+
+	auto &b = blobs[index];
+	blob->data = b.stream.get_data();
+	blob->size = b.stream.get_size();
+	blob->hash = b.hash;
+	blob->raw_dxil = b.raw_llvm ? DXIL_SPV_TRUE : DXIL_SPV_FALSE;
+	return DXIL_SPV_SUCCESS;
+}
+
+unsigned dxil_spv_archive_get_num_skipped_entries(dxil_spv_archive archive)
+{
+	return archive->parser.get_num_skipped_entries();
+}
+
+unsigned dxil_spv_archive_get_num_duplicate_blobs(dxil_spv_archive archive)
+{
+	return archive->parser.get_num_duplicate_blobs();
+}
+
+void dxil_spv_archive_free(dxil_spv_archive archive)
+{
+	delete archive;
+}
+
 void dxil_spv_begin_thread_allocator_context(void)
 {
 	begin_thread_allocator_context();
 }
 
+void dxil_spv_begin_thread_allocator_context_with_flags(dxil_spv_thread_allocator_flags flags)
+{
+	dxil_spv_begin_thread_allocator_context_with_limit(flags, 0);
+}
+
+void dxil_spv_begin_thread_allocator_context_with_limit(dxil_spv_thread_allocator_flags flags, size_t byte_limit)
+{
+	begin_thread_allocator_context((flags & DXIL_SPV_THREAD_ALLOCATOR_BUMP_ONLY_BIT) != 0 ?
+	                               ThreadAllocatorMode::BumpOnly : ThreadAllocatorMode::Recycle,
+	                               byte_limit);
+}
+
 void dxil_spv_end_thread_allocator_context(void)
 {
 	end_thread_allocator_context();
@@ -1306,6 +2608,30 @@ void dxil_spv_reset_thread_allocator_context(void)
 	reset_thread_allocator_context();
 }
 
+void dxil_spv_trim_thread_allocator_context(size_t max_bytes)
+{
+	trim_thread_allocator_context(max_bytes);
+}
+
+void dxil_spv_set_allocation_callbacks(const dxil_spv_allocation_callbacks *callbacks)
+{
+	if (callbacks)
+	{
+		AllocationCallbacks cbs = {};
+		cbs.userdata = callbacks->userdata;
+		cbs.allocate = callbacks->allocate;
+		cbs.free = callbacks->free;
+		set_allocation_callbacks(&cbs);
+	}
+	else
+		set_allocation_callbacks(nullptr);
+}
+
+size_t dxil_spv_get_thread_allocator_usage(void)
+{
+	return get_thread_allocator_usage();
+}
+
 static thread_local dxil_spv_log_cb c_callback_wrapper;
 static void c_callback_wrapper_trampoline(void *userdata, dxil_spv::LogLevel level, const char *msg)
 {
@@ -1318,3 +2644,30 @@ void dxil_spv_set_thread_log_callback(dxil_spv_log_cb callback, void *userdata)
 	c_callback_wrapper = callback;
 	dxil_spv::set_thread_log_callback(c_callback_wrapper_trampoline, userdata);
 }
+
+static thread_local dxil_spv_log_format_cb c_format_callback_wrapper;
+static void c_format_callback_wrapper_trampoline(void *userdata, dxil_spv::LogLevel level, const char *format,
+                                                 va_list args)
+{
+	if (c_format_callback_wrapper)
+		c_format_callback_wrapper(userdata, dxil_spv_log_level(level), format, args);
+}
+
+void dxil_spv_set_thread_log_format_callback(dxil_spv_log_format_cb callback, void *userdata)
+{
+	c_format_callback_wrapper = callback;
+	dxil_spv::set_thread_log_format_callback(c_format_callback_wrapper_trampoline, userdata);
+}
+
+void dxil_spv_set_thread_log_level(dxil_spv_log_level level)
+{
+	dxil_spv::set_thread_log_level(dxil_spv::LogLevel(level));
+}
+
+dxil_spv_result dxil_spv_set_trace_callbacks(dxil_spv_trace_begin_cb begin_cb, dxil_spv_trace_end_cb end_cb,
+                                             void *userdata)
+{
+	if (!dxil_spv::set_trace_callbacks(begin_cb, end_cb, userdata))
+		return DXIL_SPV_ERROR_UNSUPPORTED_FEATURE;
+	return DXIL_SPV_SUCCESS;
+}
@@ -25,6 +25,7 @@
 #ifndef DXIL_SPV_C_API_H
 #define DXIL_SPV_C_API_H
 
+#include <stdarg.h>
 #include <stddef.h>
 
 /* C89-compatible wrapper for dxil_spv. */
@@ -34,7 +35,7 @@ extern "C" {
 #endif
 
 #define DXIL_SPV_API_VERSION_MAJOR 2
-#define DXIL_SPV_API_VERSION_MINOR 35
+#define DXIL_SPV_API_VERSION_MINOR 86
 #define DXIL_SPV_API_VERSION_PATCH 0
 
 #define DXIL_SPV_DESCRIPTOR_QA_INTERFACE_VERSION 1
@@ -70,6 +71,7 @@ typedef enum dxil_spv_result
 	DXIL_SPV_ERROR_FAILED_VALIDATION = -5,
 	DXIL_SPV_ERROR_INVALID_ARGUMENT = -6,
 	DXIL_SPV_ERROR_NO_DATA = -7,
+	DXIL_SPV_ERROR_CANCELLED = -8,
 	DXIL_SPV_RESULT_INT_MAX = 0x7fffffff
 } dxil_spv_result;
 
@@ -206,6 +208,8 @@ typedef enum dxil_spv_rdat_subobject_kind
 	DXIL_SPV_RDAT_SUBOBJECT_KIND_RAYTRACING_PIPELINE_CONFIG = 10,
 	DXIL_SPV_RDAT_SUBOBJECT_KIND_HIT_GROUP = 11,
 	DXIL_SPV_RDAT_SUBOBJECT_KIND_RAYTRACING_PIPELINE_CONFIG1 = 12,
+	/* Returned for subobjects which are out of range or malformed. Everything else is zero-initialized. */
+	DXIL_SPV_RDAT_SUBOBJECT_KIND_INVALID = -1,
 	DXIL_SPV_RDAT_SUBOBJECT_TYPE_INT_MAX = 0x7fffffff
 } dxil_spv_rdat_subobject_kind;
 
@@ -319,10 +323,16 @@ typedef enum dxil_spv_log_level
 	DXIL_SPV_LOG_LEVEL_DEBUG,
 	DXIL_SPV_LOG_LEVEL_WARN,
 	DXIL_SPV_LOG_LEVEL_ERROR,
+	/* Only meaningful for dxil_spv_set_thread_log_level(). Drops all messages. */
+	DXIL_SPV_LOG_LEVEL_SILENT,
 	DXIL_SPV_LOG_LEVEL_INT_MAX = 0x7fffffff
 } dxil_spv_log_level;
 
 typedef void (*dxil_spv_log_cb)(void *userdata, dxil_spv_log_level, const char *);
+/* Receives the printf-style format string and its arguments instead of a formatted message.
+ * The format string is a stable key for the call site, so messages can be deduplicated or dropped
+ * without formatting them. args is only valid during the callback. */
+typedef void (*dxil_spv_log_format_cb)(void *userdata, dxil_spv_log_level, const char *format, va_list args);
 
 typedef enum dxil_spv_option
 {
@@ -362,6 +372,30 @@ typedef enum dxil_spv_option
 	DXIL_SPV_OPTION_BRANCH_CONTROL = 33,
 	DXIL_SPV_OPTION_SUBGROUP_PROPERTIES = 34,
 	DXIL_SPV_OPTION_DESCRIPTOR_HEAP_ROBUSTNESS = 35,
+	DXIL_SPV_OPTION_SPIRV_OPTIMIZATION = 36,
+	DXIL_SPV_OPTION_PEEPHOLE_OPTIMIZATION = 37,
+	DXIL_SPV_OPTION_BUFFER_LOAD_COALESCING = 38,
+	DXIL_SPV_OPTION_UNIFORMITY_ANALYSIS = 39,
+	DXIL_SPV_OPTION_RAY_PAYLOAD_LIVENESS = 40,
+	DXIL_SPV_OPTION_LOOP_INVARIANT_CODE_MOTION = 41,
+	DXIL_SPV_OPTION_SPARSE_FEEDBACK_FORWARDING = 42,
+	DXIL_SPV_OPTION_STRUCTURED_CFG_FAST_PATH = 43,
+	DXIL_SPV_OPTION_KNOWN_ROOT_CONSTANTS = 44,
+	DXIL_SPV_OPTION_SBT_DESCRIPTOR_SIZE_SPEC_CONSTANTS = 45,
+	DXIL_SPV_OPTION_CONSUMER_STAGE_INPUTS = 46,
+	DXIL_SPV_OPTION_HULL_BARRIER_ELISION = 47,
+	DXIL_SPV_OPTION_GEOMETRY_OUTPUT_VERTEX_ANALYSIS = 48,
+	DXIL_SPV_OPTION_MIN_PRECISION_NARROWING = 49,
+	DXIL_SPV_OPTION_DESCRIPTOR_QA_SAMPLING = 50,
+	DXIL_SPV_OPTION_WAVE_AGGREGATED_ATOMICS = 51,
+	DXIL_SPV_OPTION_UAV_COHERENCE_ANALYSIS = 52,
+	DXIL_SPV_OPTION_PHYSICAL_ADDRESS_ALIGNMENT = 53,
+	DXIL_SPV_OPTION_ALLOCA_SCALARIZATION = 54,
+	DXIL_SPV_OPTION_SAMPLER_FEEDBACK_LOD_MERGING = 55,
+	DXIL_SPV_OPTION_SPIRV_CANONICALIZATION = 56,
+	DXIL_SPV_OPTION_MESH_OUTPUT_STORE_COALESCING = 57,
+	DXIL_SPV_OPTION_STRUCTURIZER_COMPLEXITY_BUDGET = 58,
+	DXIL_SPV_OPTION_CONSTANT_FOLDING = 59,
 	DXIL_SPV_OPTION_INT_MAX = 0x7fffffff
 } dxil_spv_option;
 
@@ -618,6 +652,242 @@ typedef struct dxil_spv_option_descriptor_heap_robustness
 	dxil_spv_bool enabled;
 } dxil_spv_option_descriptor_heap_robustness;
 
+/* Runs a fast SPIRV-Tools optimization pipeline on the final module.
+ * Ignored if the library was not built with optimizer support. */
+typedef struct dxil_spv_option_spirv_optimization
+{
+	dxil_spv_option_base base;
+	dxil_spv_bool enabled;
+} dxil_spv_option_spirv_optimization;
+
+/* Cheap local cleanup of redundant bitcasts, access chains, extracts and builtin loads. */
+typedef struct dxil_spv_option_peephole_optimization
+{
+	dxil_spv_option_base base;
+	dxil_spv_bool enabled;
+} dxil_spv_option_peephole_optimization;
+
+/* Merges adjacent single component raw/structured buffer loads from the same handle
+ * within a basic block into one wider vector load. */
+typedef struct dxil_spv_option_buffer_load_coalescing
+{
+	dxil_spv_option_base base;
+	dxil_spv_bool enabled;
+} dxil_spv_option_buffer_load_coalescing;
+
+/* Heap indices which are provably uniform, e.g. derived from root constants or CBV loads,
+ * do not get NonUniform, and descriptor QA / robustness checks on them are emitted once per block. */
+typedef struct dxil_spv_option_uniformity_analysis
+{
+	dxil_spv_option_base base;
+	dxil_spv_bool enabled;
+} dxil_spv_option_uniformity_analysis;
+
+/* If a ray payload or callable data has to be copied to a temporary around TraceRay() or CallShader(),
+ * only members which may be defined before the call are copied in,
+ * and only members which may be read after the call are copied back. */
+typedef struct dxil_spv_option_ray_payload_liveness
+{
+	dxil_spv_option_base base;
+	dxil_spv_bool enabled;
+} dxil_spv_option_ray_payload_liveness;
+
+/* Hoists pure integer arithmetic, access chains and root constant loads which do not change
+ * within a loop to the block before the loop header. */
+typedef struct dxil_spv_option_loop_invariant_code_motion
+{
+	dxil_spv_option_base base;
+	dxil_spv_bool enabled;
+} dxil_spv_option_loop_invariant_code_motion;
+
+/* Sparse sample and load results are consumed per component rather than through a repacked struct.
+ * Unused texel components are not extracted, and CheckAccessFullyMapped on the same status code
+ * within a block is only evaluated once. */
+typedef struct dxil_spv_option_sparse_feedback_forwarding
+{
+	dxil_spv_option_base base;
+	dxil_spv_bool enabled;
+} dxil_spv_option_sparse_feedback_forwarding;
+
+/* If a function's CFG is already structured, i.e. every selection and loop has a unique merge block
+ * and no branch escapes its construct, merge information is assigned directly and the CFG is
+ * not rewritten. Other functions go through the full structurizer. */
+typedef struct dxil_spv_option_structured_cfg_fast_path
+{
+	dxil_spv_option_base base;
+	dxil_spv_bool enabled;
+} dxil_spv_option_structured_cfg_fast_path;
+
+/* Specializes the shader on root constant words which are constant for the pipeline.
+ * word_indices are in units of 32-bit root constant words, as in dxil_spv_cbv_vulkan_binding push offsets.
+ * Loads of these words are replaced with constants, and branches which only depend on known root constants
+ * or a non-specialization-constant rasterizer sample count are folded, so the untaken paths are not emitted.
+ * The arrays must remain valid until dxil_spv_converter_run() returns. */
+typedef struct dxil_spv_option_known_root_constants
+{
+	dxil_spv_option_base base;
+	const unsigned *word_indices;
+	const unsigned *values;
+	unsigned count;
+} dxil_spv_option_known_root_constants;
+
+/* Emits the SBT descriptor size shifts of dxil_spv_option_sbt_descriptor_size_log2 as 32-bit specialization
+ * constants with the given SpecIds. Their default values are the sizes from that option.
+ * This way, one conversion of a DXR export can serve pipelines with different SBT descriptor sizes.
+ * Supply the sizes through VkSpecializationInfo, or bake them in with dxil_spv_patch_specialization_constants().
+ * The local root signature layout is still part of the conversion. */
+typedef struct dxil_spv_option_sbt_descriptor_size_spec_constants
+{
+	dxil_spv_option_base base;
+	dxil_spv_bool enabled;
+	unsigned spec_id_srv_uav_cbv;
+	unsigned spec_id_sampler;
+} dxil_spv_option_sbt_descriptor_size_spec_constants;
+
+/* Link-aware conversion of a VS, DS or GS for a known next stage.
+ * semantic_names/semantic_indices list the user (non system-value) semantics the next stage reads.
+ * Semantics are matched case-insensitively, as in D3D. Any other user output is not declared and
+ * its stores are dropped. With dead code elimination, so is the code only feeding those stores.
+ * Outputs captured by stream output are always kept. count may be 0 if no user input is read.
+ * The arrays must remain valid until dxil_spv_converter_run() returns. */
+typedef struct dxil_spv_option_consumer_stage_inputs
+{
+	dxil_spv_option_base base;
+	dxil_spv_bool enabled;
+	const char * const *semantic_names;
+	const unsigned *semantic_indices;
+	unsigned count;
+} dxil_spv_option_consumer_stage_inputs;
+
+/* Hull shaders are emitted as the control point function followed by a barrier and the patch constant
+ * function on invocation 0. If the patch constant function never reads output control points,
+ * no invocation observes another invocation's outputs and the barrier is omitted. */
+typedef struct dxil_spv_option_hull_barrier_elision
+{
+	dxil_spv_option_base base;
+	dxil_spv_bool enabled;
+} dxil_spv_option_hull_barrier_elision;
+
+/* Geometry shaders declare OutputVertices as the maximum number of vertices emitted along any path
+ * through the shader, if that is lower than maxvertexcount. Drivers size GS output storage from it.
+ * Shaders which emit inside loops that cannot be bounded keep maxvertexcount. */
+typedef struct dxil_spv_option_geometry_output_vertex_analysis
+{
+	dxil_spv_option_base base;
+	dxil_spv_bool enabled;
+} dxil_spv_option_geometry_output_vertex_analysis;
+
+/* Only has an effect together with DXIL_SPV_OPTION_MIN_PRECISION_NATIVE_16BIT on shaders using min precision,
+ * where lower precision is allowed. Chains of FP32 add, sub and mul whose inputs are min precision values
+ * (or constants exact in FP16) and whose only result is truncated back to min precision are evaluated in FP16,
+ * instead of converting every input to FP32 and the result back. Precise arithmetic is never narrowed. */
+typedef struct dxil_spv_option_min_precision_narrowing
+{
+	dxil_spv_option_base base;
+	dxil_spv_bool enabled;
+} dxil_spv_option_min_precision_narrowing;
+
+/* Reduces the overhead of DXIL_SPV_OPTION_DESCRIPTOR_QA so it can stay compiled into production shaders.
+ * If deduplicate_per_block is set, repeated accesses to the same heap offset within a basic block
+ * reuse the first check. If kill_switch is set, checks only run if the boolean specialization constant
+ * kill_switch_spec_id is true, which is the default. Specializing it to false makes the checks free. */
+typedef struct dxil_spv_option_descriptor_qa_sampling
+{
+	dxil_spv_option_base base;
+	dxil_spv_bool deduplicate_per_block;
+	dxil_spv_bool kill_switch;
+	unsigned kill_switch_spec_id;
+} dxil_spv_option_descriptor_qa_sampling;
+
+/* Append/consume counters and InterlockedAdd on a dynamically uniform address are aggregated within a subgroup.
+ * One elected lane performs a single atomic add of the subgroup total, and every lane gets its return value
+ * from the broadcast result and an exclusive prefix sum. Requires subgroup arithmetic and ballot support.
+ * Only applies outside pixel shaders, since an elected helper lane would drop the atomic for the whole subgroup.
+ * InterlockedAdd is only aggregated for 32-bit atomics on physical storage buffers. */
+typedef struct dxil_spv_option_wave_aggregated_atomics
+{
+	dxil_spv_option_base base;
+	dxil_spv_bool enabled;
+} dxil_spv_option_wave_aggregated_atomics;
+
+/* With UAV barriers in the shader, every UAV which is both read and written is declared Coherent.
+ * With this option, a UAV is only made Coherent if a non-atomic access may observe another invocation's write,
+ * i.e. it is read and written, and not exclusively through atomics. For descriptor heap UAVs, which may alias,
+ * the same test is applied to all UAV accesses in the shader combined. Explicitly globallycoherent UAVs
+ * and ROVs are always Coherent. */
+typedef struct dxil_spv_option_uav_coherence_analysis
+{
+	dxil_spv_option_base base;
+	dxil_spv_bool enabled;
+} dxil_spv_option_uav_coherence_analysis;
+
+/* Minimum alignment of root descriptor and physical buffer base addresses. Defaults to 4.
+ * Together with the offset arithmetic (constant offsets, shifts, structured strides), this lets
+ * PhysicalStorageBuffer loads and stores be emitted with a larger Aligned memory operand, up to 16. */
+typedef struct dxil_spv_option_physical_address_alignment
+{
+	dxil_spv_option_base base;
+	unsigned alignment;
+} dxil_spv_option_physical_address_alignment;
+
+/* Local arrays of scalars which are only accessed through element pointers are split into one
+ * Function variable per element, which avoids scratch memory on drivers that do not promote arrays.
+ * Arrays with dynamic indices are only split if they have at most 8 elements,
+ * and are then accessed through select chains. */
+typedef struct dxil_spv_option_alloca_scalarization
+{
+	dxil_spv_option_base base;
+	dxil_spv_bool enabled;
+} dxil_spv_option_alloca_scalarization;
+
+/* Emulated WriteSamplerFeedback already deduplicates feedback texels within the subgroup,
+ * so only one lane per unique texel performs the atomic. With this option, the coarse LOD of a trilinear
+ * access is folded into the fine LOD write when both address the same feedback texel,
+ * which is the common case since the feedback map is addressed in mip region space. */
+typedef struct dxil_spv_option_sampler_feedback_lod_merging
+{
+	dxil_spv_option_base base;
+	dxil_spv_bool enabled;
+} dxil_spv_option_sampler_feedback_lod_merging;
+
+/* Rewrites the final module into a canonical form. IDs are renumbered in order of first use,
+ * and capabilities, extensions, execution modes, names, decorations and the entry point interface are sorted.
+ * Modules which only differ in ID allocation then produce identical SPIR-V,
+ * which helps drivers which key their pipeline caches on the SPIR-V words. */
+typedef struct dxil_spv_option_spirv_canonicalization
+{
+	dxil_spv_option_base base;
+	dxil_spv_bool enabled;
+} dxil_spv_option_spirv_canonicalization;
+
+/* Mesh shaders write outputs one column at a time. When consecutive stores in a block write every column of
+ * the same row, they are emitted as a single vector store instead. */
+typedef struct dxil_spv_option_mesh_output_store_coalescing
+{
+	dxil_spv_option_base base;
+	dxil_spv_bool enabled;
+} dxil_spv_option_mesh_output_store_coalescing;
+
+/* The structurizer gives up on a function once rewrites grow its CFG beyond node_growth_factor times
+ * the input node count (at least 4096 nodes), or a rewrite loop iterates far more often than the input size
+ * warrants. dxil_spv_converter_run() then returns DXIL_SPV_ERROR_UNSUPPORTED_FEATURE.
+ * The budget is opt-in. Without this option, or with a factor of 0, structurization always runs to completion.
+ * 32 leaves plenty of headroom for well-behaved shaders. */
+typedef struct dxil_spv_option_structurizer_complexity_budget
+{
+	dxil_spv_option_base base;
+	unsigned node_growth_factor;
+} dxil_spv_option_structurizer_complexity_budget;
+
+/* DXIL arithmetic opcodes such as Mad, Dot and the bitfield operations are evaluated on the host
+ * when all operands are constant. Host rounding may differ from the device for floating-point opcodes,
+ * so this is disabled by default. Precise instructions are never folded. */
+typedef struct dxil_spv_option_constant_folding
+{
+	dxil_spv_option_base base;
+	dxil_spv_bool enabled;
+} dxil_spv_option_constant_folding;
+
 /* Gets the ABI version used to build this library. Used to detect API/ABI mismatches. */
 DXIL_SPV_PUBLIC_API void dxil_spv_get_version(unsigned *major, unsigned *minor, unsigned *patch);
 
@@ -633,10 +903,51 @@ DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_parse_reflection_dxil_blob(const vo
 /* Parses raw DXIL (LLVM BC). */
 DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_parse_dxil(const void *data, size_t size, dxil_spv_parsed_blob *blob);
 
+/* Like dxil_spv_parse_dxil_blob(), but only parses the container up front.
+ * The LLVM bitcode is parsed when first needed, which will never happen if a conversion
+ * is satisfied by a conversion cache. Bitcode parse errors are reported by the first call which needs it.
+ * Function bodies are parsed lazily as well. A conversion only decodes its entry point and the functions it calls,
+ * which saves a lot of work for DXR libraries with many exports.
+ * Bitcode is parsed in the thread allocator context of whichever thread needs it first. */
+DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_parse_dxil_blob_deferred(const void *data, size_t size,
+                                                                      dxil_spv_parsed_blob *blob);
+
+typedef enum dxil_spv_parse_flag_bits
+{
+	/* Same as dxil_spv_parse_dxil_blob_deferred(). */
+	DXIL_SPV_PARSE_DEFERRED_BIT = 0x1,
+	/* The DXIL part is not copied out of the container. The application promises that
+	 * data remains valid and unmodified until dxil_spv_parsed_blob_free() is called. */
+	DXIL_SPV_PARSE_BORROW_INPUT_BIT = 0x2,
+	/* Same as dxil_spv_parse_dxil_blob_metadata_only(). */
+	DXIL_SPV_PARSE_METADATA_ONLY_BIT = 0x4,
+	DXIL_SPV_PARSE_FLAG_INT_MAX = 0x7fffffff
+} dxil_spv_parse_flag_bits;
+typedef unsigned dxil_spv_parse_flags;
+
+DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_parse_dxil_blob_with_flags(const void *data, size_t size,
+                                                                        dxil_spv_parse_flags flags,
+                                                                        dxil_spv_parsed_blob *blob);
+
+/* Only parses the container and module-level metadata of the bitcode. Function bodies are skipped entirely.
+ * Meant for cheap pre-flight queries, i.e. shader stage, entry points and resource scanning.
+ * Blobs parsed this way cannot be converted or disassembled, and those calls fail with DXIL_SPV_ERROR_PARSER.
+ * Can be combined with DXIL_SPV_PARSE_DEFERRED_BIT. */
+DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_parse_dxil_blob_metadata_only(const void *data, size_t size,
+                                                                           dxil_spv_parsed_blob *blob);
+
 /* Dumps the LLVM IR representation to console. For debugging. */
 DXIL_SPV_PUBLIC_API void dxil_spv_parsed_blob_dump_llvm_ir(dxil_spv_parsed_blob blob);
 
 DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_parsed_blob_get_disassembled_ir(dxil_spv_parsed_blob blob, const char **str);
+
+/* Same output as dxil_spv_parsed_blob_get_disassembled_ir(), but handed to sink in chunks as it is produced,
+ * so callers do not need to hold the full disassembly of large modules.
+ * data is not NUL-terminated and is only valid for the duration of the callback. */
+typedef void (*dxil_spv_disassembly_sink_cb)(void *userdata, const char *data, size_t size);
+DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_parsed_blob_stream_disassembled_ir(dxil_spv_parsed_blob blob,
+                                                                                dxil_spv_disassembly_sink_cb sink,
+                                                                                void *userdata);
 DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_parsed_blob_get_raw_ir(dxil_spv_parsed_blob blob, const void **data, size_t *size);
 
 DXIL_SPV_PUBLIC_API dxil_spv_shader_stage dxil_spv_parsed_blob_get_shader_stage(dxil_spv_parsed_blob blob);
@@ -664,14 +975,69 @@ DXIL_SPV_PUBLIC_API unsigned dxil_spv_parsed_blob_get_num_rdat_subobjects(
 DXIL_SPV_PUBLIC_API void dxil_spv_parsed_blob_get_rdat_subobject(
 		dxil_spv_parsed_blob blob, unsigned index, dxil_spv_rdat_subobject *subobject);
 
+/* Subobjects are decoded on first access.
+ * If a subobject is malformed, its kind is DXIL_SPV_RDAT_SUBOBJECT_KIND_INVALID.
+ * Returns indices for dxil_spv_parsed_blob_get_rdat_subobject() which are associated with an export,
+ * through SubobjectToExportsAssociation, or hit groups which contain the export.
+ * Associations without an explicit export list are default associations, and are returned for an empty string.
+ * The index is built on first call and the returned array is valid until the blob is freed. */
+DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_parsed_blob_get_rdat_export_associations(
+		dxil_spv_parsed_blob blob, const char *export_name, const unsigned **indices, unsigned *count);
+
+typedef struct dxil_spv_cost_estimate
+{
+	unsigned num_functions;
+	unsigned num_blocks;
+	unsigned num_instructions;
+	/* Approximate, may be lower than the real loop nesting depth. */
+	unsigned max_loop_depth;
+	unsigned num_wave_ops;
+	/* TraceRay, CallShader, ReportHit, hit control and ray query traversal. Ray query accessors are not counted. */
+	unsigned num_ray_tracing_ops;
+	/* Weighted sum of the above, only meaningful relative to other estimates. */
+	unsigned long long cost;
+} dxil_spv_cost_estimate;
+
+/* Estimates how expensive an entry point is to convert, without converting it.
+ * Covers the entry point and every function it calls. If entry is NULL, the default entry point is used.
+ * Meant for scheduling many conversions, e.g. passing cost to dxil_spv_batch_submit_with_cost().
+ * For deferred blobs, this decodes the function bodies of the entry point,
+ * which a converter created from the same blob will then reuse. */
+DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_parsed_blob_estimate_cost(dxil_spv_parsed_blob blob, const char *entry,
+                                                                       dxil_spv_cost_estimate *estimate);
+
 DXIL_SPV_PUBLIC_API void dxil_spv_parsed_blob_free(dxil_spv_parsed_blob blob);
 /* Parsing API */
 
-/* Sets per thread global state. */
+/* Sets per thread global state.
+ * While either callback is set on a thread, nothing is written to stderr. Setting one callback replaces the other. */
 DXIL_SPV_PUBLIC_API void dxil_spv_set_thread_log_callback(dxil_spv_log_cb callback, void *userdata);
+DXIL_SPV_PUBLIC_API void dxil_spv_set_thread_log_format_callback(dxil_spv_log_format_cb callback, void *userdata);
+/* Messages below level are dropped before they are formatted. Defaults to DXIL_SPV_LOG_LEVEL_DEBUG. */
+DXIL_SPV_PUBLIC_API void dxil_spv_set_thread_log_level(dxil_spv_log_level level);
+
+/* Forwards trace zones (parsing, conversion, structurization passes, SPIR-V emission) to an external profiler.
+ * name is a string literal and can be used as a stable key. Zones nest properly per thread,
+ * and end_cb is called on the thread which called begin_cb.
+ * Unlike the log callbacks, this is process-wide and should be set before any conversion starts.
+ * Passing NULL callbacks disables tracing again.
+ * Returns DXIL_SPV_ERROR_UNSUPPORTED_FEATURE if the library was built without DXIL_SPIRV_TRACING. */
+typedef void (*dxil_spv_trace_begin_cb)(void *userdata, const char *name);
+typedef void (*dxil_spv_trace_end_cb)(void *userdata, const char *name);
+DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_set_trace_callbacks(dxil_spv_trace_begin_cb begin_cb,
+                                                                dxil_spv_trace_end_cb end_cb, void *userdata);
 
 /* Converter API */
 
+/* Conversion never modifies the parsed blob, so multiple converters created from the same blob
+ * (e.g. for different entry points of a DXR library) may run concurrently on different threads.
+ * The blob must outlive the converters, and if it was created with a thread allocator context active,
+ * that context must not be reset or ended until all converters using the blob are done.
+ * For deferred blobs, function bodies are decoded into the blob by the first converter which needs them.
+ * This is serialized against other converters reading the same blob, so a converter which has to decode
+ * its entry point waits for conversions in flight. To avoid that, materialize every entry point up front,
+ * e.g. with dxil_spv_parsed_blob_estimate_cost(), before sharing the blob between threads.
+ * Other functions which operate on a parsed blob are not thread-safe with respect to each other. */
 typedef struct dxil_spv_converter_s *dxil_spv_converter;
 DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_create_converter(dxil_spv_parsed_blob blob, dxil_spv_converter *converter);
 DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_create_converter_with_reflection(dxil_spv_parsed_blob blob,
@@ -679,6 +1045,15 @@ DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_create_converter_with_reflection(dx
                                                                               dxil_spv_converter *converter);
 DXIL_SPV_PUBLIC_API void dxil_spv_converter_free(dxil_spv_converter converter);
 
+/* Retargets an existing converter to another blob, so a stream of shaders can be converted with one converter.
+ * Options, remappers, root constant and root descriptor counts, local root parameters, the conversion cache,
+ * the cancel token and remap transcript recording are kept. The entry point, any remap transcript replay
+ * and all results of the previous run are cleared. Output buffers keep their capacity.
+ * reflection_blob may be NULL. Same lifetime rules as dxil_spv_create_converter_with_reflection(). */
+DXIL_SPV_PUBLIC_API void dxil_spv_converter_reset(dxil_spv_converter converter,
+                                                  dxil_spv_parsed_blob blob,
+                                                  dxil_spv_parsed_blob reflection_blob);
+
 DXIL_SPV_PUBLIC_API void dxil_spv_converter_set_entry_point(dxil_spv_converter converter, const char *entry_point);
 
 DXIL_SPV_PUBLIC_API void dxil_spv_converter_set_stage_input_remapper(
@@ -754,16 +1129,53 @@ DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_converter_begin_local_root_descript
 DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_converter_end_local_root_descriptor_table(
 	dxil_spv_converter converter);
 
-/* After setting up converter, runs the converted to SPIR-V. */
+/* After setting up converter, runs the converted to SPIR-V.
+ * Returns DXIL_SPV_ERROR_UNSUPPORTED_FEATURE if DXIL_SPV_OPTION_STRUCTURIZER_COMPLEXITY_BUDGET is set
+ * and a function has control flow which is too complex to structurize within the budget. */
 DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_converter_run(dxil_spv_converter converter);
 
+/* Cancellation API */
+
+/* A token which can be cancelled from any thread to stop conversions early.
+ * Conversions poll it between phases: before parsing, after instruction analysis, after every converted function
+ * and between structurization passes. A cancelled conversion returns DXIL_SPV_ERROR_CANCELLED.
+ * A token stays cancelled once cancelled and may be shared by any number of conversions. */
+typedef struct dxil_spv_cancel_token_s *dxil_spv_cancel_token;
+
+DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_cancel_token_create(dxil_spv_cancel_token *token);
+DXIL_SPV_PUBLIC_API void dxil_spv_cancel_token_cancel(dxil_spv_cancel_token token);
+DXIL_SPV_PUBLIC_API dxil_spv_bool dxil_spv_cancel_token_is_cancelled(dxil_spv_cancel_token token);
+/* Must not be freed while a conversion which uses it is in flight. */
+DXIL_SPV_PUBLIC_API void dxil_spv_cancel_token_free(dxil_spv_cancel_token token);
+
+/* The token is polled by subsequent calls to dxil_spv_converter_run(). NULL disables cancellation. */
+DXIL_SPV_PUBLIC_API void dxil_spv_converter_set_cancel_token(dxil_spv_converter converter,
+                                                              dxil_spv_cancel_token token);
+
+/* Cancellation API */
+
 /* Obtain final SPIR-V. */
 DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_converter_get_compiled_spirv(dxil_spv_converter converter,
                                                                           dxil_spv_compiled_spirv *compiled);
 
+/* Copies final SPIR-V into application memory, so the converter can be reused or destroyed right away.
+ * If data is NULL, *size receives the required size in bytes.
+ * Otherwise, *size must hold the size of data, and receives the number of bytes written.
+ * Returns DXIL_SPV_ERROR_INVALID_ARGUMENT if the buffer is too small. */
+DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_converter_copy_compiled_spirv(dxil_spv_converter converter,
+                                                                           void *data, size_t *size);
+
 DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_converter_get_compiled_entry_point(dxil_spv_converter converter,
                                                                                 const char **entry_point);
 
+/* Rewrites the default values of 32-bit OpSpecConstants in a SPIR-V module in place, e.g. to bake
+ * the SBT descriptor sizes into a module converted with dxil_spv_option_sbt_descriptor_size_spec_constants.
+ * Spec IDs which do not occur in the module are ignored. size is in bytes. */
+DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_patch_specialization_constants(void *spirv, size_t size,
+                                                                           const unsigned *spec_ids,
+                                                                           const unsigned *values,
+                                                                           unsigned count);
+
 /* Useful to check if the implementation recognizes a particular option for ABI compatibility. */
 DXIL_SPV_PUBLIC_API dxil_spv_bool dxil_spv_converter_supports_option(dxil_spv_option option);
 /* Adds a generic option to the implementation which allows it to generate more advanced code or change codegen if desired.
@@ -771,6 +1183,24 @@ DXIL_SPV_PUBLIC_API dxil_spv_bool dxil_spv_converter_supports_option(dxil_spv_op
 DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_converter_add_option(dxil_spv_converter converter,
                                                                   const dxil_spv_option_base *option);
 
+/* An immutable, reference counted set of options, translated and validated once.
+ * Fails with DXIL_SPV_ERROR_UNSUPPORTED_FEATURE if any option is not recognized.
+ * Data pointed to by options (e.g. swizzles) must remain valid until the last converter using the set has run.
+ * A set may be attached to any number of converters on any thread. If it is shared between threads,
+ * create it outside a thread allocator context. */
+typedef struct dxil_spv_option_set_s *dxil_spv_option_set;
+DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_create_option_set(const dxil_spv_option_base *const *options,
+                                                               unsigned count,
+                                                               dxil_spv_option_set *option_set);
+/* Stable for a given list of options. Also part of the conversion cache key of converters using the set. */
+DXIL_SPV_PUBLIC_API unsigned long long dxil_spv_option_set_get_hash(dxil_spv_option_set option_set);
+/* Drops the caller's reference. Converters the set is attached to keep their own reference. */
+DXIL_SPV_PUBLIC_API void dxil_spv_option_set_free(dxil_spv_option_set option_set);
+/* Attaches the set to the converter, replacing any previously attached set. NULL detaches.
+ * The set is applied before options added with dxil_spv_converter_add_option(), which take precedence. */
+DXIL_SPV_PUBLIC_API void dxil_spv_converter_set_option_set(dxil_spv_converter converter,
+                                                           dxil_spv_option_set option_set);
+
 /* After compilation. Queries if SubgroupSize builtin was emitted, which requires ALLOW_VARYING_SUBGROUP_SIZE
  * in Vulkan. */
 DXIL_SPV_PUBLIC_API dxil_spv_bool dxil_spv_converter_uses_subgroup_size(dxil_spv_converter converter);
@@ -801,14 +1231,299 @@ DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_converter_get_patch_vertex_count(
 DXIL_SPV_PUBLIC_API dxil_spv_bool dxil_spv_converter_uses_shader_feature(
 	dxil_spv_converter converter, dxil_spv_shader_feature feature);
 
+typedef struct dxil_spv_cbv_promotion_candidate
+{
+	unsigned register_space;
+	unsigned register_index;
+	/* Number of 32-bit words read from the start of the CBV. */
+	unsigned num_words;
+} dxil_spv_cbv_promotion_candidate;
+
+/* After compilation, queries CBVs which are not arrayed and only read at constant offsets.
+ * If num_words fits in the root signature budget, the application may remap the CBV
+ * to root constants on a later compile, e.g. with DXIL_SPV_OPTION_ROOT_CONSTANT_INLINE_UNIFORM_BLOCK,
+ * which avoids a UBO descriptor fetch. */
+DXIL_SPV_PUBLIC_API unsigned dxil_spv_converter_get_num_cbv_promotion_candidates(dxil_spv_converter converter);
+DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_converter_get_cbv_promotion_candidate(
+	dxil_spv_converter converter, unsigned index, dxil_spv_cbv_promotion_candidate *candidate);
+
+typedef enum dxil_spv_resource_usage_flag_bits
+{
+	DXIL_SPV_RESOURCE_USAGE_READ_BIT = 1 << 0,
+	DXIL_SPV_RESOURCE_USAGE_WRITE_BIT = 1 << 1,
+	DXIL_SPV_RESOURCE_USAGE_ATOMIC_BIT = 1 << 2,
+	DXIL_SPV_RESOURCE_USAGE_COUNTER_BIT = 1 << 3,
+	DXIL_SPV_RESOURCE_USAGE_INT_MAX = 0x7fffffff
+} dxil_spv_resource_usage_flag_bits;
+typedef unsigned dxil_spv_resource_usage_flags;
+
+typedef struct dxil_spv_resource_usage
+{
+	dxil_spv_resource_class resource_class;
+	unsigned register_space;
+	unsigned register_index;
+	/* ~0u for unsized arrays. */
+	unsigned range_size;
+	/* UAV only. A UAV with neither WRITE nor ATOMIC set is only read by the shader. */
+	dxil_spv_resource_usage_flags flags;
+	/* CBV only. Number of bytes from the start of the CBV which may be read. */
+	unsigned cbv_used_bytes;
+} dxil_spv_resource_usage;
+
+/* After compilation, queries the declared resource bindings which the entry point creates handles for.
+ * Bindings which are not listed are never accessed, and the application may skip
+ * descriptor updates and barriers for them. Resources accessed directly through
+ * ResourceDescriptorHeap / SamplerDescriptorHeap are not tracked. */
+DXIL_SPV_PUBLIC_API unsigned dxil_spv_converter_get_num_used_resources(dxil_spv_converter converter);
+DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_converter_get_used_resource(
+	dxil_spv_converter converter, unsigned index, dxil_spv_resource_usage *usage);
+
+/* Conversion cache API */
+
+/* Caches the result of dxil_spv_converter_run(). The key is a hash of the input blob(s),
+ * the entry point, all options and local root parameters, and the answers of the remapping callbacks.
+ * Since the callbacks are opaque, every callback made by the cached conversion is replayed against the current
+ * remappers on lookup, and the entry is only used if all answers are identical.
+ * If max_memory_size is 0, entries are not kept in memory.
+ * If disk_path is not NULL, entries are also stored in, and loaded from, that (existing) directory.
+ * On disk, entries are appended to a single pack file with varint coded SPIR-V, and found through a memory mapped
+ * index which is rewritten when the cache is freed. Caches sharing a directory concurrently never read each other's
+ * records incorrectly, but only entries in the index of the cache freed last are found by later caches.
+ * The cache is thread-safe and may be shared by converters on any thread, e.g. in batch setup callbacks.
+ * It must outlive any converter which uses it. */
+typedef struct dxil_spv_conversion_cache_s *dxil_spv_conversion_cache;
+
+DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_conversion_cache_create(size_t max_memory_size, const char *disk_path,
+                                                                     dxil_spv_conversion_cache *cache);
+DXIL_SPV_PUBLIC_API void dxil_spv_conversion_cache_free(dxil_spv_conversion_cache cache);
+
+/* Must be set before dxil_spv_converter_run() to take effect. NULL disables caching. */
+DXIL_SPV_PUBLIC_API void dxil_spv_converter_set_conversion_cache(dxil_spv_converter converter,
+                                                                 dxil_spv_conversion_cache cache);
+
+/* Conversion cache API */
+
+/* Remap transcript API */
+
+/* A remap transcript is a compact record of every remapping callback made during a conversion, including
+ * the inputs and answers. Together with the input blob and options, it fully determines the output,
+ * so it can be hashed and stored alongside a converted shader.
+ * The transcript is a stream of 32-bit words in host byte order. */
+
+/* If enabled, dxil_spv_converter_run() records a transcript,
+ * which can be queried with dxil_spv_converter_get_remap_transcript() afterwards. */
+DXIL_SPV_PUBLIC_API void dxil_spv_converter_set_remap_transcript_recording(dxil_spv_converter converter,
+                                                                           dxil_spv_bool enable);
+/* The transcript is owned by the converter and is valid until the converter is run again or freed. */
+DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_converter_get_remap_transcript(dxil_spv_converter converter,
+                                                                            const void **data, size_t *size);
+
+/* Answers remapping queries from a previously recorded transcript instead of invoking the callbacks.
+ * The data is copied. Queries which are not part of the transcript fall back to the callbacks.
+ * Passing NULL disables replay. */
+DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_converter_set_remap_transcript_replay(dxil_spv_converter converter,
+                                                                                   const void *data, size_t size);
+
+/* Remap transcript API */
+
+/* Statistics API */
+
+typedef enum dxil_spv_statistics_phase
+{
+	/* Parsing the DXBC container. Accumulated over the lifetime of the parsed blob. */
+	DXIL_SPV_STATISTICS_PHASE_CONTAINER_PARSE = 0,
+	/* Parsing the LLVM bitcode, including lazily parsed function bodies.
+	 * Accumulated over the lifetime of the parsed blob. */
+	DXIL_SPV_STATISTICS_PHASE_BITCODE_PARSE = 1,
+	/* The remaining phases only cover the last call to dxil_spv_converter_run(). */
+	DXIL_SPV_STATISTICS_PHASE_ANALYZE_INSTRUCTIONS = 2,
+	DXIL_SPV_STATISTICS_PHASE_EMIT_RESOURCES = 3,
+	DXIL_SPV_STATISTICS_PHASE_CONVERT_FUNCTION = 4,
+	DXIL_SPV_STATISTICS_PHASE_STRUCTURIZE_CFG = 5,
+	DXIL_SPV_STATISTICS_PHASE_EMIT_FUNCTION_BODY = 6,
+	DXIL_SPV_STATISTICS_PHASE_FINALIZE_SPIRV = 7,
+	DXIL_SPV_STATISTICS_PHASE_COUNT,
+	DXIL_SPV_STATISTICS_PHASE_INT_MAX = 0x7fffffff
+} dxil_spv_statistics_phase;
+
+typedef struct dxil_spv_phase_statistics
+{
+	/* Wall time spent in the phase. */
+	unsigned long long time_ns;
+	/* Bytes requested from the allocator while in the phase, whether or not a thread allocator context is active. */
+	unsigned long long allocated_bytes;
+	/* Number of times the phase was entered, e.g. once per converted function. */
+	unsigned invocations;
+} dxil_spv_phase_statistics;
+
+/* Phases are always instrumented. If a conversion is satisfied by a conversion cache,
+ * all per-run phases report zero. */
+DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_converter_get_statistics(dxil_spv_converter converter,
+                                                                      dxil_spv_statistics_phase phase,
+                                                                      dxil_spv_phase_statistics *stats);
+
+/* Statistics API */
+
+/* Batch API */
+
+/* Converts many shaders in parallel on an internal work-stealing worker pool.
+ * Every worker owns a thread allocator context which is reset after each job,
+ * so any output must be copied out in the completion callback.
+ * All callbacks are called from worker threads. dxil_spv_set_thread_log_callback() and
+ * dxil_spv_set_thread_log_level() may be called from the setup callback to configure logging for the worker. */
+typedef struct dxil_spv_batch_s *dxil_spv_batch;
+
+/* Called after the converter is created, but before it runs.
+ * Set remappers and options here. If anything other than DXIL_SPV_SUCCESS is returned,
+ * conversion is skipped and the result is forwarded to the completion callback. */
+typedef dxil_spv_result (*dxil_spv_batch_setup_cb)(void *userdata, dxil_spv_parsed_blob blob,
+                                                   dxil_spv_converter converter);
+
+/* Called when a job has completed. converter is NULL if parsing failed.
+ * The converter and any data queried from it are only valid for the duration of the callback. */
+typedef void (*dxil_spv_batch_complete_cb)(void *userdata, dxil_spv_result result, dxil_spv_converter converter);
+
+typedef struct dxil_spv_batch_job
+{
+	/* Must remain valid until the completion callback has returned, since it is not copied. */
+	const void *data;
+	size_t size;
+	/* If true, data is raw DXIL (LLVM BC) as accepted by dxil_spv_parse_dxil(),
+	 * otherwise a DXBC container as accepted by dxil_spv_parse_dxil_blob_deferred(). */
+	dxil_spv_bool raw_dxil;
+	/* May be NULL. The string is copied. */
+	const char *entry_point;
+	dxil_spv_batch_setup_cb setup;
+	dxil_spv_batch_complete_cb complete;
+	void *userdata;
+} dxil_spv_batch_job;
+
+/* If num_threads is 0, the number of hardware threads is used. */
+DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_batch_create(unsigned num_threads, dxil_spv_batch *batch);
+/* Like dxil_spv_batch_create(), but at most max_jobs_in_flight jobs may be submitted and not yet completed.
+ * dxil_spv_batch_submit() blocks until a job completes once the limit is reached,
+ * so inputs can be produced on the fly while their peak footprint stays bounded by the limit rather than
+ * the size of the batch. A limit of at least the number of threads keeps every worker busy.
+ * With a limit, dxil_spv_batch_submit() must not be called from batch callbacks. 0 means unlimited. */
+DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_batch_create_bounded(unsigned num_threads,
+                                                                  unsigned max_jobs_in_flight,
+                                                                  dxil_spv_batch *batch);
+DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_batch_submit(dxil_spv_batch batch, const dxil_spv_batch_job *job);
+/* Runs the job asynchronously like dxil_spv_batch_submit(), but stops early once token is cancelled.
+ * A job which is cancelled before a worker picks it up is never parsed, and its completion callback
+ * is called with DXIL_SPV_ERROR_CANCELLED and a NULL converter. The token must outlive the job. */
+DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_batch_submit_cancellable(dxil_spv_batch batch,
+                                                                      const dxil_spv_batch_job *job,
+                                                                      dxil_spv_cancel_token token);
+/* Queued jobs with a higher cost are started approximately first, so that one expensive shader is less likely
+ * to end up running alone at the end of a batch. Jobs are ordered per worker queue, and an idle worker steals
+ * the most expensive job of the first other queue which has one, so there is no global ordering.
+ * Jobs submitted without a cost use their input size in bytes as the cost,
+ * so avoid mixing both kinds of submissions in one batch. token may be NULL. */
+DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_batch_submit_with_cost(dxil_spv_batch batch,
+                                                                    const dxil_spv_batch_job *job,
+                                                                    dxil_spv_cancel_token token,
+                                                                    unsigned long long cost);
+/* Parses like dxil_spv_parse_dxil_blob_with_flags(), but function bodies are decoded concurrently
+ * on the workers of batch. Building the IR is still serial. Meant for large DXR libraries.
+ * The calling thread decodes as well, so this may be called while the workers are busy or from batch callbacks.
+ * DXIL_SPV_PARSE_DEFERRED_BIT and DXIL_SPV_PARSE_METADATA_ONLY_BIT are not supported. */
+DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_batch_parse_dxil_blob(dxil_spv_batch batch,
+                                                                   const void *data, size_t size,
+                                                                   dxil_spv_parse_flags flags,
+                                                                   dxil_spv_parsed_blob *blob);
+/* Blocks until all submitted jobs have completed. */
+DXIL_SPV_PUBLIC_API void dxil_spv_batch_wait(dxil_spv_batch batch);
+/* Waits for outstanding jobs before tearing down the worker pool. */
+DXIL_SPV_PUBLIC_API void dxil_spv_batch_free(dxil_spv_batch batch);
+
+/* Batch API */
+
+/* Archive API */
+
+/* Finds shader blobs in archives of many shaders, e.g. shader cache dumps, without extracting them.
+ * Fossilize stream archives (.foz) and plain concatenations of DXBC containers are supported.
+ * For Fossilize archives, only uncompressed entries which hold a DXBC container or raw DXIL are considered.
+ * Blobs are deduplicated by their FNV-1 hash, which matches the shader hash used by vkd3d-proton.
+ * data must remain valid for as long as the archive or any blob queried from it is in use,
+ * as blobs point directly into data. A blob can be passed directly to dxil_spv_batch_submit(). */
+typedef struct dxil_spv_archive_s *dxil_spv_archive;
+
+typedef struct dxil_spv_archive_blob
+{
+	const void *data;
+	size_t size;
+	unsigned long long hash;
+	/* If true, the blob is raw DXIL (LLVM BC), otherwise a DXBC container. */
+	dxil_spv_bool raw_dxil;
+} dxil_spv_archive_blob;
+
+DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_parse_archive(const void *data, size_t size, dxil_spv_archive *archive);
+DXIL_SPV_PUBLIC_API unsigned dxil_spv_archive_get_num_blobs(dxil_spv_archive archive);
+DXIL_SPV_PUBLIC_API dxil_spv_result dxil_spv_archive_get_blob(dxil_spv_archive archive, unsigned index,
+                                                              dxil_spv_archive_blob *blob);
+/* Number of entries which did not hold a shader blob, or could not be read since they were compressed. */
+DXIL_SPV_PUBLIC_API unsigned dxil_spv_archive_get_num_skipped_entries(dxil_spv_archive archive);
+/* Number of blobs which were dropped since an identical blob was seen earlier in the archive. */
+DXIL_SPV_PUBLIC_API unsigned dxil_spv_archive_get_num_duplicate_blobs(dxil_spv_archive archive);
+DXIL_SPV_PUBLIC_API void dxil_spv_archive_free(dxil_spv_archive archive);
+
+/* Archive API */
+
 /* Use an optimized allocation scheme.
  * Call begin before allocating any dxil_spv objects,
  * and end after all dxil_spv created by this thread is destroyed.
  * Reset is an optimized variant of end() -> begin(). Useful if compiling multiple shaders one after another. */
 DXIL_SPV_PUBLIC_API void dxil_spv_begin_thread_allocator_context(void);
+
+typedef enum dxil_spv_thread_allocator_flag_bits
+{
+	/* Never recycle freed memory before a reset. Plain bump allocation is slightly faster for small shaders,
+	 * but memory usage for large shaders can grow far beyond the live data. */
+	DXIL_SPV_THREAD_ALLOCATOR_BUMP_ONLY_BIT = 1 << 0,
+	DXIL_SPV_THREAD_ALLOCATOR_FLAG_BITS_INT_MAX = 0x7fffffff
+} dxil_spv_thread_allocator_flag_bits;
+typedef unsigned dxil_spv_thread_allocator_flags;
+
+/* Same as dxil_spv_begin_thread_allocator_context(), which is equivalent to passing flags = 0. */
+DXIL_SPV_PUBLIC_API void dxil_spv_begin_thread_allocator_context_with_flags(dxil_spv_thread_allocator_flags flags);
+
+/* Same as dxil_spv_begin_thread_allocator_context_with_flags(), but with a soft budget of byte_limit bytes
+ * for everything allocated within the context. 0 means no limit.
+ * Once the budget is exceeded, parsing and conversion on this thread fail with DXIL_SPV_ERROR_OUT_OF_MEMORY
+ * until the context is reset. Allocations already in flight still succeed, so usage can overshoot somewhat. */
+DXIL_SPV_PUBLIC_API void dxil_spv_begin_thread_allocator_context_with_limit(dxil_spv_thread_allocator_flags flags,
+                                                                           size_t byte_limit);
 DXIL_SPV_PUBLIC_API void dxil_spv_end_thread_allocator_context(void);
 DXIL_SPV_PUBLIC_API void dxil_spv_reset_thread_allocator_context(void);
 
+/* Releases memory which the thread allocator context retains for reuse, but is not currently using,
+ * until at most max_bytes are retained. Useful after a reset on long-lived threads.
+ * Reset already trims to a decaying high-water mark of recent usage, so this is only needed for tighter control. */
+DXIL_SPV_PUBLIC_API void dxil_spv_trim_thread_allocator_context(size_t max_bytes);
+
+typedef void *(*dxil_spv_allocate_cb)(void *userdata, size_t size, size_t alignment);
+typedef void (*dxil_spv_free_cb)(void *userdata, void *ptr);
+
+typedef struct dxil_spv_allocation_callbacks
+{
+	void *userdata;
+	/* Must return memory aligned to at least alignment, or NULL on failure. */
+	dxil_spv_allocate_cb allocate;
+	dxil_spv_free_cb free;
+} dxil_spv_allocation_callbacks;
+
+/* Routes the memory backing thread allocator contexts and LLVM bitcode parsing through the callbacks,
+ * including allocations made by those outside a thread allocator context.
+ * Process-wide, and must be called before any other dxil_spv function, since memory is freed with the
+ * callbacks which are installed at the time. Callbacks may be called concurrently from any thread.
+ * Passing NULL restores malloc/free. */
+DXIL_SPV_PUBLIC_API void dxil_spv_set_allocation_callbacks(const dxil_spv_allocation_callbacks *callbacks);
+
+/* Bytes taken from the thread allocator context's arena since it was begun or last reset.
+ * Freed memory is recycled, not returned, so this is also the peak usage. Returns 0 without an active context. */
+DXIL_SPV_PUBLIC_API size_t dxil_spv_get_thread_allocator_usage(void);
+
 /* Converter API */
 
 #ifdef __cplusplus
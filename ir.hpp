@@ -25,6 +25,7 @@
 #pragma once
 
 #include "thread_local_allocator.hpp"
+#include "scratch_pool.hpp"
 #include "spirv.hpp"
 #include <assert.h>
 #include <initializer_list>
@@ -86,46 +87,67 @@ struct LiteralArgument
 	uint32_t lit;
 };
 
+// Arguments live in a ScratchWordPool owned by the module, sized to what the op actually uses.
 struct Operation
 {
 	enum
 	{
-		MaxArguments = 11
+		// Literals are tracked in a 32-bit mask, ID arguments are only limited by the SPIR-V word count.
+		MaxLiteralArguments = 32,
+		MaxArguments = 0xffff
 	};
 
-	Operation() = default;
+	explicit Operation(ScratchWordPool &pool_)
+	    : pool(&pool_)
+	{
+	}
 
-	explicit Operation(spv::Op op_)
+	Operation(ScratchWordPool &pool_, spv::Op op_)
 	    : op(op_)
+	    , pool(&pool_)
 	{
 	}
 
-	Operation(spv::Op op_, spv::Id id_, spv::Id type_id_)
+	Operation(ScratchWordPool &pool_, spv::Op op_, spv::Id id_, spv::Id type_id_)
 	    : op(op_)
 	    , id(id_)
 	    , type_id(type_id_)
+	    , pool(&pool_)
 	{
 	}
 
 	void add_id(spv::Id arg)
 	{
-		assert(num_arguments < MaxArguments);
+		reserve_arguments(num_arguments + 1);
 		arguments[num_arguments++] = arg;
 	}
 
 	void add_ids(const std::initializer_list<spv::Id> &args)
 	{
+		reserve_arguments(num_arguments + unsigned(args.size()));
 		for (auto &arg : args)
 			add_id(arg);
 	}
 
 	void add_literal(uint32_t lit)
 	{
-		assert(num_arguments < MaxArguments);
+		assert(num_arguments < MaxLiteralArguments);
 		literal_mask |= 1u << num_arguments;
+		reserve_arguments(num_arguments + 1);
 		arguments[num_arguments++] = lit;
 	}
 
+	void reserve_arguments(unsigned count)
+	{
+		assert(count <= MaxArguments);
+		if (count > argument_capacity)
+		{
+			uint32_t capacity = argument_capacity;
+			arguments = pool->grow(arguments, num_arguments, count, capacity);
+			argument_capacity = uint16_t(capacity);
+		}
+	}
+
 	const spv::Id *begin() const
 	{
 		return arguments;
@@ -136,18 +158,25 @@ struct Operation
 		return arguments + num_arguments;
 	}
 
-	uint8_t get_literal_mask() const
+	uint32_t get_literal_mask() const
 	{
 		return literal_mask;
 	}
 
+	bool is_literal_argument(unsigned index) const
+	{
+		return index < MaxLiteralArguments && (literal_mask & (1u << index)) != 0;
+	}
+
 	spv::Op op = spv::OpNop;
 	spv::Id id = 0;
 	spv::Id type_id = 0;
+	uint32_t literal_mask = 0;
 
-	spv::Id arguments[MaxArguments];
-	unsigned num_arguments = 0;
-	uint8_t literal_mask = 0;
+	spv::Id *arguments = nullptr;
+	uint16_t num_arguments = 0;
+	uint16_t argument_capacity = 0;
+	ScratchWordPool *pool;
 };
 
 struct Terminator
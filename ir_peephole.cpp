@@ -0,0 +1,318 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "ir_peephole.hpp"
+#include "node.hpp"
+#include "hash.hpp"
+
+namespace dxil_spv
+{
+void IRPeephole::pin_id(spv::Id id)
+{
+	pinned_ids.insert(id);
+}
+
+void IRPeephole::add_invariant_pointer(spv::Id id)
+{
+	invariant_pointers.insert(id);
+}
+
+void IRPeephole::add_speculatable_pointer(spv::Id id)
+{
+	speculatable_pointers.insert(id);
+}
+
+spv::Id IRPeephole::remap(spv::Id id) const
+{
+	auto itr = remapped_ids.find(id);
+	return itr != remapped_ids.end() ? itr->second : id;
+}
+
+void IRPeephole::remap_arguments(Operation &op) const
+{
+	for (unsigned i = 0; i < op.num_arguments; i++)
+		if (!op.is_literal_argument(i))
+			op.arguments[i] = remap(op.arguments[i]);
+}
+
+void IRPeephole::remap_block(CFGNode *node) const
+{
+	auto &ir = node->ir;
+
+	for (auto &phi : ir.phi)
+		for (auto &incoming : phi.incoming)
+			incoming.id = remap(incoming.id);
+
+	for (auto *op : ir.operations)
+		remap_arguments(*op);
+
+	if (ir.terminator.conditional_id)
+		ir.terminator.conditional_id = remap(ir.terminator.conditional_id);
+	if (ir.terminator.return_value)
+		ir.terminator.return_value = remap(ir.terminator.return_value);
+}
+
+spv::Id IRPeephole::get_result_type(spv::Id id) const
+{
+	auto itr = result_types.find(id);
+	return itr != result_types.end() ? itr->second : 0;
+}
+
+static bool operations_are_equal(const Operation &a, const Operation &b)
+{
+	if (a.op != b.op || a.type_id != b.type_id ||
+	    a.num_arguments != b.num_arguments || a.literal_mask != b.literal_mask)
+		return false;
+
+	for (unsigned i = 0; i < a.num_arguments; i++)
+		if (a.arguments[i] != b.arguments[i])
+			return false;
+
+	return true;
+}
+
+spv::Id IRPeephole::find_available(const Operation &op, const CFGNode *block)
+{
+	Hasher h;
+	h.u32(op.op);
+	h.u32(op.type_id);
+	h.u32(op.literal_mask);
+	h.u32(op.num_arguments);
+	h.data(op.arguments, op.num_arguments * sizeof(*op.arguments));
+
+	// Any earlier equal op works as long as its block dominates ours.
+	// Blocks are visited in reverse post-order, so a dominating block is always seen first.
+	auto &candidates = available_ops[h.get()];
+	for (auto &candidate : candidates)
+		if (candidate.block->dominates(block) && operations_are_equal(*candidate.op, op))
+			return candidate.op->id;
+
+	candidates.push_back({ &op, block });
+	return 0;
+}
+
+spv::Id IRPeephole::find_replacement(const Operation &op, const CFGNode *block)
+{
+	switch (op.op)
+	{
+	case spv::OpBitcast:
+	{
+		// Bitcast back to the original type, or a no-op bitcast.
+		spv::Id source = op.arguments[0];
+		if (pinned_ids.count(source) == 0 && get_result_type(source) == op.type_id)
+			return source;
+
+		auto itr = bitcast_sources.find(source);
+		if (itr != bitcast_sources.end() && pinned_ids.count(itr->second) == 0 &&
+		    get_result_type(itr->second) == op.type_id)
+		{
+			return itr->second;
+		}
+		break;
+	}
+
+	case spv::OpLoad:
+		// Only plain loads of values which cannot change.
+		if (op.num_arguments != 1 || invariant_pointers.count(op.arguments[0]) == 0)
+			return 0;
+		break;
+
+	case spv::OpAccessChain:
+	case spv::OpInBoundsAccessChain:
+	case spv::OpCompositeExtract:
+	case spv::OpCompositeConstruct:
+	case spv::OpVectorShuffle:
+	// Integer arithmetic as used for descriptor heap offsets.
+	case spv::OpIAdd:
+	case spv::OpISub:
+	case spv::OpIMul:
+	case spv::OpShiftLeftLogical:
+	case spv::OpShiftRightLogical:
+	case spv::OpBitwiseAnd:
+	case spv::OpBitwiseOr:
+	case spv::OpBitwiseXor:
+	case spv::OpArrayLength:
+		break;
+
+	default:
+		return 0;
+	}
+
+	return find_available(op, block);
+}
+
+void IRPeephole::record_result(const Operation &op)
+{
+	result_types[op.id] = op.type_id;
+
+	if (op.op == spv::OpBitcast)
+	{
+		bitcast_sources[op.id] = op.arguments[0];
+	}
+	else if ((op.op == spv::OpAccessChain || op.op == spv::OpInBoundsAccessChain) &&
+	         invariant_pointers.count(op.arguments[0]))
+	{
+		invariant_pointers.insert(op.id);
+	}
+}
+
+void IRPeephole::run(const Vector<CFGNode *> &post_order)
+{
+	// Reverse post-order, so definitions in dominating blocks are seen before their uses.
+	for (auto itr = post_order.rbegin(); itr != post_order.rend(); ++itr)
+	{
+		auto *block = *itr;
+		auto &ops = block->ir.operations;
+		size_t write_index = 0;
+
+		for (auto *op : ops)
+		{
+			remap_arguments(*op);
+
+			if (op->id && op->type_id && pinned_ids.count(op->id) == 0)
+			{
+				spv::Id replacement = find_replacement(*op, block);
+				if (replacement)
+				{
+					remapped_ids[op->id] = replacement;
+					continue;
+				}
+			}
+
+			if (op->id)
+				record_result(*op);
+			ops[write_index++] = op;
+		}
+
+		ops.resize(write_index);
+	}
+
+	// Phis and back-edges may refer to results which were only removed later.
+	if (!remapped_ids.empty())
+		for (auto *node : post_order)
+			remap_block(node);
+}
+
+bool IRPeephole::op_is_hoistable(const Operation &op) const
+{
+	if (!op.id || !op.type_id || pinned_ids.count(op.id))
+		return false;
+
+	switch (op.op)
+	{
+	case spv::OpLoad:
+		// The load may have been conditional within the loop, so only hoist loads which cannot fault.
+		return op.num_arguments == 1 && speculatable_pointers.count(op.arguments[0]) != 0;
+
+	case spv::OpBitcast:
+	case spv::OpAccessChain:
+	case spv::OpInBoundsAccessChain:
+	case spv::OpCompositeExtract:
+	case spv::OpCompositeConstruct:
+	case spv::OpVectorShuffle:
+	case spv::OpIAdd:
+	case spv::OpISub:
+	case spv::OpIMul:
+	case spv::OpShiftLeftLogical:
+	case spv::OpShiftRightLogical:
+	case spv::OpShiftRightArithmetic:
+	case spv::OpBitwiseAnd:
+	case spv::OpBitwiseOr:
+	case spv::OpBitwiseXor:
+	case spv::OpUConvert:
+	case spv::OpSConvert:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+void IRPeephole::hoist_loop_invariants(CFGNode *header, const Vector<CFGNode *> &post_order)
+{
+	auto *preheader = header->immediate_dominator;
+	// Runs before traverse() fills in merge_info, so use the structurizer's view of the loop.
+	auto *merge = header->loop_merge_block;
+	if (!preheader || preheader == header || !merge)
+		return;
+
+	// Everything the header dominates up until the merge, including the continue construct.
+	Vector<CFGNode *> body;
+	UnorderedSet<spv::Id> defined_in_loop;
+	for (auto itr = post_order.rbegin(); itr != post_order.rend(); ++itr)
+	{
+		auto *node = *itr;
+		if (!header->dominates(node) || merge->dominates(node))
+			continue;
+
+		body.push_back(node);
+		for (auto &phi : node->ir.phi)
+			defined_in_loop.insert(phi.id);
+		for (auto *op : node->ir.operations)
+			if (op->id)
+				defined_in_loop.insert(op->id);
+	}
+
+	for (auto *node : body)
+	{
+		auto &ops = node->ir.operations;
+		size_t write_index = 0;
+
+		for (auto *op : ops)
+		{
+			bool invariant = op_is_hoistable(*op);
+			for (unsigned i = 0; invariant && i < op->num_arguments; i++)
+				if (!op->is_literal_argument(i) && defined_in_loop.count(op->arguments[i]))
+					invariant = false;
+
+			if (invariant)
+			{
+				// Visiting in reverse post-order keeps hoisted definitions before their hoisted uses.
+				defined_in_loop.erase(op->id);
+				preheader->ir.operations.push_back(op);
+				if ((op->op == spv::OpAccessChain || op->op == spv::OpInBoundsAccessChain) &&
+				    speculatable_pointers.count(op->arguments[0]))
+				{
+					speculatable_pointers.insert(op->id);
+				}
+				continue;
+			}
+
+			ops[write_index++] = op;
+		}
+
+		ops.resize(write_index);
+	}
+}
+
+void IRPeephole::hoist_loop_invariants(const Vector<CFGNode *> &post_order)
+{
+	// Inner loops come first in post-order, so code hoisted into an enclosing loop
+	// can be hoisted again when the enclosing loop is processed.
+	for (auto *node : post_order)
+		if (node->merge == MergeType::Loop)
+			hoist_loop_invariants(node, post_order);
+}
+} // namespace dxil_spv
@@ -0,0 +1,82 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include "thread_local_allocator.hpp"
+#include "ir.hpp"
+#include <stdint.h>
+
+namespace dxil_spv
+{
+struct CFGNode;
+
+// Cheap, single pass cleanup of IRBlock::operations before emission.
+// Folds redundant bitcasts and removes pure operations which duplicate an operation in a dominating block,
+// such as repeated access chains, integer offset arithmetic, composite extracts and
+// loads of invariant builtin inputs or descriptors.
+// Removed results are rewritten to their replacement everywhere in the function.
+// Optionally, pure operations which only depend on values from outside a loop are hoisted
+// to the block which immediately dominates the loop header.
+class IRPeephole
+{
+public:
+	// The ID is referenced outside the IR, e.g. by a decoration, so it must neither be removed nor replace another ID.
+	void pin_id(spv::Id id);
+	// Loads through this pointer return the same value everywhere in the invocation.
+	void add_invariant_pointer(spv::Id id);
+	// Invariant pointer which is always safe to load from, even speculatively.
+	void add_speculatable_pointer(spv::Id id);
+
+	// Blocks in post-order, as used by CFGStructurizer::traverse().
+	void run(const Vector<CFGNode *> &post_order);
+	// Must only be used after structurization, when loop merge information is final.
+	void hoist_loop_invariants(const Vector<CFGNode *> &post_order);
+
+private:
+	UnorderedSet<spv::Id> pinned_ids;
+	UnorderedSet<spv::Id> invariant_pointers;
+	UnorderedSet<spv::Id> speculatable_pointers;
+	UnorderedMap<spv::Id, spv::Id> remapped_ids;
+	UnorderedMap<spv::Id, spv::Id> result_types;
+	UnorderedMap<spv::Id, spv::Id> bitcast_sources;
+	struct AvailableOp
+	{
+		const Operation *op;
+		const CFGNode *block;
+	};
+	UnorderedMap<uint64_t, Vector<AvailableOp>> available_ops;
+
+	spv::Id find_replacement(const Operation &op, const CFGNode *block);
+	spv::Id find_available(const Operation &op, const CFGNode *block);
+	void record_result(const Operation &op);
+	spv::Id remap(spv::Id id) const;
+	void remap_arguments(Operation &op) const;
+	void remap_block(CFGNode *node) const;
+	spv::Id get_result_type(spv::Id id) const;
+	bool op_is_hoistable(const Operation &op) const;
+	void hoist_loop_invariants(CFGNode *header, const Vector<CFGNode *> &post_order);
+};
+} // namespace dxil_spv
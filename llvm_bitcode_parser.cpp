@@ -75,6 +75,56 @@ bool LLVMBCParser::parse(const void *data, size_t size)
 	return true;
 }
 
+bool LLVMBCParser::parse_lazy(const void *data, size_t size)
+{
+#ifdef HAVE_LLVMBC
+	impl->module = llvm::parseIRLazy(impl->context, data, size);
+	return impl->module != nullptr;
+#else
+	return parse(data, size);
+#endif
+}
+
+bool LLVMBCParser::parse_metadata_only(const void *data, size_t size)
+{
+#ifdef HAVE_LLVMBC
+	impl->module = llvm::parseIRMetadataOnly(impl->context, data, size);
+	return impl->module != nullptr;
+#else
+	return parse(data, size);
+#endif
+}
+
+bool LLVMBCParser::parse_parallel(const void *data, size_t size, ThreadPool &pool)
+{
+#ifdef HAVE_LLVMBC
+	impl->module = llvm::parseIRParallel(impl->context, data, size, pool);
+	return impl->module != nullptr;
+#else
+	(void)pool;
+	return parse(data, size);
+#endif
+}
+
+bool LLVMBCParser::materialize(llvm::Function *func)
+{
+#ifdef HAVE_LLVMBC
+	return impl->module->materialize(func);
+#else
+	(void)func;
+	return true;
+#endif
+}
+
+bool LLVMBCParser::materialize_all()
+{
+#ifdef HAVE_LLVMBC
+	return impl->module->materialize_all();
+#else
+	return true;
+#endif
+}
+
 llvm::Module &LLVMBCParser::get_module()
 {
 	return *impl->module;
@@ -36,12 +36,30 @@
 
 namespace dxil_spv
 {
+class ThreadPool;
+
 class LLVMBCParser
 {
 public:
 	LLVMBCParser();
 	~LLVMBCParser();
 	bool parse(const void *data, size_t size);
+
+	// Only parses module-level state. Function bodies must be materialized before they are used,
+	// and data must remain valid until then. Equivalent to parse() when not using LLVMBC.
+	bool parse_lazy(const void *data, size_t size);
+
+	// Only parses module-level metadata, globals and function declarations. Function bodies are skipped
+	// and can never be materialized, so the module cannot be converted. Enough for resource scanning and
+	// entry point queries. Equivalent to parse() when not using LLVMBC.
+	bool parse_metadata_only(const void *data, size_t size);
+
+	// Like parse(), but function bodies are decoded concurrently on pool.
+	// Equivalent to parse() when not using LLVMBC.
+	bool parse_parallel(const void *data, size_t size, ThreadPool &pool);
+	bool materialize(llvm::Function *func);
+	bool materialize_all();
+
 	llvm::Module &get_module();
 	const llvm::Module &get_module() const;
 
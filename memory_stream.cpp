@@ -122,4 +122,9 @@ size_t MemoryStream::get_size() const
 	return blob_size;
 }
 
+const void *MemoryStream::get_data() const
+{
+	return blob;
+}
+
 } // namespace dxil_spv
@@ -60,6 +60,7 @@ public:
 
 	size_t get_offset() const;
 	size_t get_size() const;
+	const void *get_data() const;
 	MemoryStream create_substream(size_t offset, size_t size) const;
 	MemoryStream create_substream(size_t offset) const;
 
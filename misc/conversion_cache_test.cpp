@@ -0,0 +1,128 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "conversion_cache.hpp"
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+using namespace dxil_spv;
+
+// Round-trips modules through the on-disk pack, which stores SPIR-V varint coded.
+// The modules cover the paths of the coder, including the escape for modules which do not parse.
+static std::vector<std::vector<uint32_t>> get_test_modules()
+{
+	return {
+		// Empty, and shorter than a header.
+		{},
+		{ 0x07230203, 0x10000 },
+		// Header and instructions with small and large operands.
+		{ 0x07230203, 0x10600, 0, 100, 0,
+		  (2u << 16) | 17, 1,
+		  (4u << 16) | 43, 5, 6, 0xffffffffu,
+		  (4u << 16) | 43, 5, 7, 0x80000000u,
+		  (1u << 16) | 0xffff },
+		// Instruction word count of 0.
+		{ 0x07230203, 0x10600, 0, 100, 0, (2u << 16) | 17, 1, 0, 1, 2, 3 },
+		// Last instruction is truncated.
+		{ 0x07230203, 0x10600, 0, 100, 0, (2u << 16) | 17, 1, (5u << 16) | 43, 5, 6 },
+	};
+}
+
+static void insert_entries(ConversionCache &cache, const std::vector<std::vector<uint32_t>> &modules,
+                           uint64_t first_key)
+{
+	for (size_t i = 0; i < modules.size(); i++)
+	{
+		auto entry = std::make_shared<ConversionCacheEntry>();
+		entry->spirv = modules[i];
+		entry->compiled_entry_point = "main";
+		cache.insert(first_key + i, std::move(entry));
+	}
+}
+
+static bool verify_entries(ConversionCache &cache, const std::vector<std::vector<uint32_t>> &modules,
+                           uint64_t first_key, const char *tag)
+{
+	bool ok = true;
+	for (size_t i = 0; i < modules.size(); i++)
+	{
+		auto entry = cache.find(first_key + i);
+		if (!entry)
+		{
+			fprintf(stderr, "%s: module %zu is missing.\n", tag, i);
+			ok = false;
+		}
+		else if (entry->spirv != modules[i] || entry->compiled_entry_point != "main")
+		{
+			fprintf(stderr, "%s: module %zu does not round-trip.\n", tag, i);
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 2)
+	{
+		fprintf(stderr, "Usage: conversion-cache-test <directory>\n");
+		return EXIT_FAILURE;
+	}
+
+	auto modules = get_test_modules();
+	bool ok;
+
+	{
+		// Nothing is kept in memory, so lookups read back the records which were just appended.
+		ConversionCache cache(0, argv[1]);
+		insert_entries(cache, modules, 1);
+		ok = verify_entries(cache, modules, 1, "pack");
+	}
+
+	{
+		// Lookups go through the index written when the previous cache was destroyed.
+		ConversionCache cache(0, argv[1]);
+		ok = verify_entries(cache, modules, 1, "index") && ok;
+	}
+
+	{
+		// Two writers which both mapped the same index, like two processes sharing the directory.
+		// The index written last must still contain the entries of the other one.
+		auto a = std::unique_ptr<ConversionCache>(new ConversionCache(0, argv[1]));
+		auto b = std::unique_ptr<ConversionCache>(new ConversionCache(0, argv[1]));
+		insert_entries(*a, modules, 1000);
+		insert_entries(*b, modules, 2000);
+		a.reset();
+		b.reset();
+
+		ConversionCache cache(0, argv[1]);
+		ok = verify_entries(cache, modules, 1, "merge") && ok;
+		ok = verify_entries(cache, modules, 1000, "merge") && ok;
+		ok = verify_entries(cache, modules, 2000, "merge") && ok;
+	}
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,121 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "module.hpp"
+#include "context.hpp"
+#include "thread_local_allocator.hpp"
+#include "thread_pool.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+using namespace dxil_spv;
+
+// Every input must be rejected by each of the parsing modes without crashing.
+static bool read_file(const char *path, std::vector<uint8_t> &data)
+{
+	FILE *file = fopen(path, "rb");
+	if (!file)
+		return false;
+
+	fseek(file, 0, SEEK_END);
+	long len = ftell(file);
+	rewind(file);
+	if (len < 0)
+	{
+		fclose(file);
+		return false;
+	}
+
+	data.resize(size_t(len));
+	bool ok = fread(data.data(), 1, data.size(), file) == data.size();
+	fclose(file);
+	return ok;
+}
+
+static bool rejects(const std::vector<uint8_t> &data, ThreadPool &pool)
+{
+	bool ok = true;
+
+	{
+		LLVMBC::LLVMContext context;
+		if (LLVMBC::parseIR(context, data.data(), data.size()))
+		{
+			fprintf(stderr, "parseIR accepted the input.\n");
+			ok = false;
+		}
+	}
+
+	{
+		LLVMBC::LLVMContext context;
+		auto *module = LLVMBC::parseIRLazy(context, data.data(), data.size());
+		if (module && module->materialize_all())
+		{
+			fprintf(stderr, "parseIRLazy accepted the input.\n");
+			ok = false;
+		}
+	}
+
+	{
+		LLVMBC::LLVMContext context;
+		if (LLVMBC::parseIRParallel(context, data.data(), data.size(), pool))
+		{
+			fprintf(stderr, "parseIRParallel accepted the input.\n");
+			ok = false;
+		}
+	}
+
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		fprintf(stderr, "Usage: malformed-bitcode-test <bitcode>...\n");
+		return EXIT_FAILURE;
+	}
+
+	begin_thread_allocator_context();
+	ThreadPool pool(4);
+	bool ok = true;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::vector<uint8_t> data;
+		if (!read_file(argv[i], data))
+		{
+			fprintf(stderr, "Failed to read %s.\n", argv[i]);
+			ok = false;
+		}
+		else if (!rejects(data, pool))
+		{
+			fprintf(stderr, "%s was not rejected.\n", argv[i]);
+			ok = false;
+		}
+	}
+
+	end_thread_allocator_context();
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -23,14 +23,20 @@
  */
 
 #include "cfg_structurizer.hpp"
+#include "cfg_snapshot.hpp"
 #include "node.hpp"
 #include "node_pool.hpp"
 #include "spirv_module.hpp"
 #include "SpvBuilder.h"
+#include <algorithm>
+#include <chrono>
+#include <random>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "logging.hpp"
 #include "spirv-tools/libspirv.hpp"
@@ -142,16 +148,22 @@ cleanup:
 	spvc_context_destroy(context);
 }
 
-static void validate_spirv(const Vector<uint32_t> &code)
+static bool validate_spirv(const Vector<uint32_t> &code)
 {
 	spvtools::SpirvTools tools(SPV_ENV_VULKAN_1_1);
 	tools.SetMessageConsumer([](spv_message_level_t, const char *, const spv_position_t &, const char *message) {
 		LOGE("Message: %s\n", message);
 	});
 	if (!tools.Validate(code.data(), code.size()))
+	{
 		LOGE("Validation error.\n");
+		return false;
+	}
 	else
+	{
 		LOGE("Validated successfully!\n");
+		return true;
+	}
 }
 
 static Vector<String> tokenize(char *line_buffer)
@@ -174,19 +186,15 @@ static Vector<String> tokenize(char *line_buffer)
 	return tokens;
 }
 
-int main(int argc, char **argv)
+struct TestCFG
 {
-	if (argc != 2)
-	{
-		fprintf(stderr, "Usage: structurize-test <input test>\n");
-		return EXIT_FAILURE;
-	}
-
 	std::unordered_map<String, CFGNode *> block_metas;
 	Emitter emitter;
 	CFGNodePool pool;
+	CFGNode *entry = nullptr;
 
-	const auto get = [&](const String &name) -> CFGNode * {
+	CFGNode *get(const String &name)
+	{
 		auto itr = block_metas.find(name);
 		if (itr == block_metas.end())
 		{
@@ -199,17 +207,19 @@ int main(int argc, char **argv)
 		}
 		else
 			return itr->second;
-	};
+	}
 
-	const auto add_branch = [&](const char *from, const char *to) {
+	void add_branch(const char *from, const char *to)
+	{
 		auto *f = get(from);
 		auto *t = get(to);
 		f->add_branch(t);
 		f->ir.terminator.type = Terminator::Type::Branch;
 		f->ir.terminator.direct_block = t;
-	};
+	}
 
-	const auto add_selection = [&](const char *from, const char *to0, const char *to1) {
+	void add_selection(const char *from, const char *to0, const char *to1)
+	{
 		auto *f = get(from);
 		auto *t0 = get(to0);
 		auto *t1 = get(to1);
@@ -220,9 +230,31 @@ int main(int argc, char **argv)
 		f->ir.terminator.false_block = t1;
 		f->ir.terminator.conditional_id = emitter.module.get_builder().makeBoolConstant(true, true);
 		emitter.module.get_builder().addName(f->ir.terminator.conditional_id, (std::string(from) + "_sel").c_str());
-	};
+	}
+
+	// The first target is the default case.
+	void add_switch(const char *from, const Vector<const char *> &targets)
+	{
+		auto *f = get(from);
+		f->ir.terminator.type = Terminator::Type::Switch;
+		f->ir.terminator.conditional_id = emitter.module.get_builder().makeUintConstant(0, true);
+		emitter.module.get_builder().addName(f->ir.terminator.conditional_id, (std::string(from) + "_sel").c_str());
+
+		for (size_t i = 0; i < targets.size(); i++)
+		{
+			auto *t = get(targets[i]);
+			f->add_branch(t);
+
+			Terminator::Case switch_case = {};
+			switch_case.node = t;
+			switch_case.is_default = i == 0;
+			switch_case.value = uint32_t(i);
+			f->ir.terminator.cases.push_back(switch_case);
+		}
+	}
 
-	const auto add_phi = [&](const char *phi, const Vector<const char *> &from_nodes) {
+	void add_phi(const char *phi, const Vector<const char *> &from_nodes)
+	{
 		auto *p = get(phi);
 		p->ir.phi.emplace_back();
 		auto &phi_node = p->ir.phi.back();
@@ -238,9 +270,10 @@ int main(int argc, char **argv)
 			emitter.module.get_builder().addName(value.id, (std::string("incoming_value_") + from).c_str());
 			phi_node.incoming.push_back(value);
 		}
-	};
+	}
 
-	const auto add_sideeffect = [&](const char *block) {
+	void add_sideeffect(const char *block)
+	{
 		auto *b = get(block);
 		auto &builder = emitter.module.get_builder();
 		spv::Id var_id = builder.createVariable(spv::StorageClassFunction, builder.makeUintType(32));
@@ -249,15 +282,16 @@ int main(int argc, char **argv)
 		op->add_id(var_id);
 		op->add_id(builder.makeUintConstant(0));
 		b->ir.operations.push_back(op);
-	};
-
-	emitter.module.emit_entry_point(spv::ExecutionModelVertex, "main", false);
+	}
+};
 
-	FILE *file = fopen(argv[1], "r");
+static bool load_test(TestCFG &cfg, const char *path)
+{
+	FILE *file = fopen(path, "r");
 	if (!file)
 	{
-		fprintf(stderr, "Failed to open input file: %s.\n", argv[1]);
-		return EXIT_FAILURE;
+		fprintf(stderr, "Failed to open input file: %s.\n", path);
+		return false;
 	}
 
 	char line_buffer[1024];
@@ -275,7 +309,7 @@ int main(int argc, char **argv)
 				continue;
 			}
 
-			add_branch(tokens[1].c_str(), tokens[2].c_str());
+			cfg.add_branch(tokens[1].c_str(), tokens[2].c_str());
 		}
 		else if (tokens.front() == "c")
 		{
@@ -285,7 +319,7 @@ int main(int argc, char **argv)
 				continue;
 			}
 
-			add_selection(tokens[1].c_str(), tokens[2].c_str(), tokens[3].c_str());
+			cfg.add_selection(tokens[1].c_str(), tokens[2].c_str(), tokens[3].c_str());
 		}
 		else if (tokens.front() == "phi")
 		{
@@ -298,16 +332,16 @@ int main(int argc, char **argv)
 			Vector<const char *> src_blocks;
 			for (auto itr = tokens.begin() + 2; itr != tokens.end(); ++itr)
 				src_blocks.push_back(itr->c_str());
-			add_phi(tokens[1].c_str(), src_blocks);
+			cfg.add_phi(tokens[1].c_str(), src_blocks);
 		}
 		else if (tokens.front() == "sideeffect")
 		{
 			if (tokens.size() != 2)
 			{
 				LOGE("sideeffects token needs 2 elements.\n");
-				continue;;
+				continue;
 			}
-			add_sideeffect(tokens[1].c_str());
+			cfg.add_sideeffect(tokens[1].c_str());
 		}
 		else
 		{
@@ -315,20 +349,628 @@ int main(int argc, char **argv)
 		}
 	}
 
-	CFGStructurizer traverser(get("entry"), pool, emitter.module);
-	traverser.run();
-	traverser.traverse(emitter);
+	fclose(file);
+	cfg.entry = cfg.get("entry");
+	return true;
+}
+
+// Replays a dump written by CFGStructurizer::log_cfg_graphviz(), e.g. the .input stage of DXIL_SPIRV_GRAPHVIZ_PATH.
+// Solid edges are branches. Dotted and dashed edges only annotate merge information, and are ignored.
+// The first declared node is the entry. Instructions are not part of the dump, so blocks are empty.
+static bool load_graphviz(TestCFG &cfg, const char *path)
+{
+	FILE *file = fopen(path, "r");
+	if (!file)
+	{
+		fprintf(stderr, "Failed to open graphviz file: %s.\n", path);
+		return false;
+	}
+
+	std::unordered_map<uint32_t, String> names;
+	Vector<uint32_t> order;
+	std::unordered_map<uint32_t, Vector<uint32_t>> succs;
+
+	char line_buffer[1024];
+	char label[512];
+	while (fgets(line_buffer, sizeof(line_buffer), file))
+	{
+		uint32_t from, to;
+		if (sscanf(line_buffer, "%u -> %u", &from, &to) == 2)
+		{
+			if (strchr(line_buffer, '['))
+				continue;
+			auto &list = succs[from];
+			if (std::find(list.begin(), list.end(), to) == list.end())
+				list.push_back(to);
+		}
+		else if (sscanf(line_buffer, "%u [label=\"%511[^\"]\"", &from, label) == 2)
+		{
+			// Names are not necessarily unique after duplication, so disambiguate with the ID.
+			names[from] = String(label) + "_" + to_string(from);
+			order.push_back(from);
+		}
+	}
+
+	fclose(file);
+
+	if (order.empty())
+	{
+		LOGE("No nodes in graphviz file: %s.\n", path);
+		return false;
+	}
+
+	for (auto id : order)
+	{
+		auto &name = names[id];
+		cfg.get(name);
+
+		auto itr = succs.find(id);
+		if (itr == succs.end())
+			continue;
+
+		Vector<const char *> targets;
+		for (auto succ : itr->second)
+		{
+			auto name_itr = names.find(succ);
+			if (name_itr == names.end())
+			{
+				LOGE("Edge to undeclared node %u.\n", succ);
+				return false;
+			}
+			targets.push_back(name_itr->second.c_str());
+		}
+
+		if (targets.size() == 1)
+			cfg.add_branch(name.c_str(), targets[0]);
+		else if (targets.size() == 2)
+			cfg.add_selection(name.c_str(), targets[0], targets[1]);
+		else
+			cfg.add_switch(name.c_str(), targets);
+	}
+
+	cfg.entry = cfg.get(names[order.front()]);
+	return true;
+}
+
+// Replays a snapshot written through DXIL_SPIRV_CFG_SNAPSHOT_PATH.
+// Blocks with operations get a single store, since only the operation count is captured.
+static bool load_snapshot(TestCFG &cfg, const char *path)
+{
+	FILE *file = fopen(path, "rb");
+	if (!file)
+	{
+		fprintf(stderr, "Failed to open snapshot file: %s.\n", path);
+		return false;
+	}
+
+	fseek(file, 0, SEEK_END);
+	long len = ftell(file);
+	rewind(file);
+
+	Vector<uint32_t> words(len > 0 ? size_t(len) / sizeof(uint32_t) : 0);
+	bool read_ok = len > 0 && size_t(len) % sizeof(uint32_t) == 0 &&
+	               fread(words.data(), sizeof(uint32_t), words.size(), file) == words.size();
+	fclose(file);
+
+	CFGSnapshot snapshot;
+	if (!read_ok || !decode_cfg_snapshot(words.data(), words.size(), snapshot))
+	{
+		LOGE("Failed to decode CFG snapshot: %s.\n", path);
+		return false;
+	}
+
+	// Names are not necessarily unique, so disambiguate with the block index.
+	Vector<String> names;
+	for (size_t i = 0; i < snapshot.blocks.size(); i++)
+		names.push_back(snapshot.blocks[i].name + "_" + to_string(i));
+
+	for (size_t i = 0; i < snapshot.blocks.size(); i++)
+	{
+		auto &block = snapshot.blocks[i];
+		const char *name = names[i].c_str();
+		auto *node = cfg.get(name);
+
+		switch (block.terminator)
+		{
+		case Terminator::Type::Branch:
+		case Terminator::Type::Condition:
+			if (block.targets.size() >= 2)
+				cfg.add_selection(name, names[block.targets[0]].c_str(), names[block.targets[1]].c_str());
+			else if (block.targets.size() == 1)
+				cfg.add_branch(name, names[block.targets[0]].c_str());
+			else
+				node->ir.terminator.type = Terminator::Type::Unreachable;
+			break;
+
+		case Terminator::Type::Switch:
+		{
+			// Default first, as add_switch() expects.
+			Vector<const char *> targets;
+			for (auto &c : block.cases)
+				if (c.is_default)
+					targets.insert(targets.begin(), names[c.block].c_str());
+				else
+					targets.push_back(names[c.block].c_str());
+			if (!targets.empty())
+				cfg.add_switch(name, targets);
+			else
+				node->ir.terminator.type = Terminator::Type::Unreachable;
+			break;
+		}
+
+		default:
+			node->ir.terminator.type = block.terminator;
+			break;
+		}
+
+		if (block.num_operations)
+			cfg.add_sideeffect(name);
+	}
+
+	for (size_t i = 0; i < snapshot.blocks.size(); i++)
+	{
+		for (auto &phi : snapshot.blocks[i].phi_incoming_blocks)
+		{
+			Vector<const char *> from_nodes;
+			for (auto incoming : phi)
+				from_nodes.push_back(names[incoming].c_str());
+			if (!from_nodes.empty())
+				cfg.add_phi(names[i].c_str(), from_nodes);
+		}
+	}
+
+	cfg.entry = cfg.get(names.front());
+	return true;
+}
+
+struct RandomCFGOptions
+{
+	uint32_t nodes = 64;
+	// Forward branches target one of the next window blocks, and back edges one of the previous.
+	uint32_t window = 8;
+	float selection_ratio = 0.5f;
+	float loop_ratio = 0.1f;
+	float return_ratio = 0.02f;
+	float phi_ratio = 0.3f;
+	float sideeffect_ratio = 0.1f;
+	// Back edges may target blocks which do not dominate the source.
+	bool irreducible = false;
+};
+
+// Blocks are generated in a topological order of the forward CFG, so block i only has forward edges to blocks after it.
+// Every block is reachable since a block without preds is always taken as the first successor of the block before it.
+static void generate_random_cfg(TestCFG &cfg, const RandomCFGOptions &opts, uint32_t seed)
+{
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	uint32_t count = std::max<uint32_t>(opts.nodes, 2);
+	uint32_t window = std::max<uint32_t>(opts.window, 1);
+
+	Vector<Vector<uint32_t>> succs(count);
+	Vector<Vector<uint32_t>> preds(count);
+	// Immediate dominators in the forward CFG. Indices are a reverse post-order, so the usual two-finger walk works.
+	Vector<uint32_t> idom(count, UINT32_MAX);
+	idom[0] = 0;
+
+	const auto intersect = [&](uint32_t a, uint32_t b) {
+		while (a != b)
+		{
+			if (a > b)
+				a = idom[a];
+			else
+				b = idom[b];
+		}
+		return a;
+	};
+
+	const auto add_edge = [&](uint32_t from, uint32_t to) {
+		succs[from].push_back(to);
+		preds[to].push_back(from);
+		if (to > from)
+			idom[to] = idom[to] == UINT32_MAX ? from : intersect(idom[to], from);
+	};
+
+	for (uint32_t i = 0; i + 1 < count; i++)
+	{
+		bool next_has_pred = !preds[i + 1].empty();
+		if (i != 0 && next_has_pred && unit(rng) < opts.return_ratio)
+			continue;
+
+		uint32_t forward_range = std::min(window, count - 1 - i);
+		const auto pick_forward = [&]() { return i + 1 + uint32_t(rng() % forward_range); };
+
+		uint32_t first = next_has_pred ? pick_forward() : i + 1;
+		add_edge(i, first);
+
+		if (i != 0 && unit(rng) < opts.loop_ratio)
+		{
+			uint32_t header;
+			if (opts.irreducible)
+			{
+				header = i - uint32_t(rng() % std::min(window, i));
+			}
+			else
+			{
+				// Any dominator except the entry works as a loop header.
+				Vector<uint32_t> candidates;
+				for (uint32_t n = i; n != 0 && i - n < window; n = idom[n])
+					candidates.push_back(n);
+				header = candidates.empty() ? 0 : candidates[rng() % candidates.size()];
+			}
+
+			if (header != 0)
+			{
+				add_edge(i, header);
+				continue;
+			}
+		}
+
+		if (unit(rng) < opts.selection_ratio)
+		{
+			uint32_t second = pick_forward();
+			if (second != first)
+				add_edge(i, second);
+		}
+	}
+
+	const auto name = [](uint32_t index) { return String("b") + to_string(index); };
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		auto block = name(i);
+		cfg.get(block);
+
+		if (succs[i].size() == 1)
+			cfg.add_branch(block.c_str(), name(succs[i][0]).c_str());
+		else if (succs[i].size() == 2)
+			cfg.add_selection(block.c_str(), name(succs[i][0]).c_str(), name(succs[i][1]).c_str());
+
+		if (unit(rng) < opts.sideeffect_ratio)
+			cfg.add_sideeffect(block.c_str());
+	}
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (preds[i].size() < 2 || unit(rng) >= opts.phi_ratio)
+			continue;
+
+		Vector<String> pred_names;
+		for (auto pred : preds[i])
+			pred_names.push_back(name(pred));
+		Vector<const char *> from_nodes;
+		for (auto &pred_name : pred_names)
+			from_nodes.push_back(pred_name.c_str());
+		cfg.add_phi(name(i).c_str(), from_nodes);
+	}
+
+	cfg.entry = cfg.get(name(0));
+}
+
+struct PassTotals
+{
+	const char *name;
+	uint64_t time_ns;
+	uint64_t allocated_bytes;
+	size_t max_node_count;
+};
 
-	pool.for_each_node([](CFGNode &node) {
+// Outlives the thread allocator context of every iteration, so must not use Vector.
+struct RunStatistics
+{
+	std::vector<PassTotals> passes;
+	uint64_t run_ns = 0;
+	uint64_t input_nodes = 0;
+	uint64_t output_nodes = 0;
+	size_t peak_arena_bytes = 0;
+	unsigned runs = 0;
+	unsigned failed_runs = 0;
+	unsigned failed_validations = 0;
+
+	void add_passes(const Vector<CFGStructurizer::PassStatistics> &stats)
+	{
+		for (auto &pass : stats)
+		{
+			auto itr = std::find_if(passes.begin(), passes.end(),
+			                        [&](const PassTotals &totals) { return strcmp(totals.name, pass.name) == 0; });
+			if (itr == passes.end())
+			{
+				passes.push_back({ pass.name, 0, 0, 0 });
+				itr = passes.end() - 1;
+			}
+
+			itr->time_ns += pass.time_ns;
+			itr->allocated_bytes += pass.allocated_bytes;
+			itr->max_node_count = std::max(itr->max_node_count, pass.node_count);
+		}
+	}
+
+	void print() const
+	{
+		LOGI("=== Structurizer statistics (%u runs, %u failed, %u failed validation) ===\n", runs, failed_runs,
+		     failed_validations);
+		if (!runs)
+			return;
+
+		LOGI("Total run(): %.3f ms, %.3f ms per run.\n", double(run_ns) * 1e-6, double(run_ns) * 1e-6 / runs);
+		LOGI("Nodes: %llu in, %llu out, %.2fx growth.\n", static_cast<unsigned long long>(input_nodes),
+		     static_cast<unsigned long long>(output_nodes),
+		     input_nodes ? double(output_nodes) / double(input_nodes) : 0.0);
+		LOGI("Peak arena: %zu bytes.\n", peak_arena_bytes);
+
+		for (auto &pass : passes)
+		{
+			LOGI("  %-40s %10.3f ms %12llu bytes %8zu max nodes\n", pass.name, double(pass.time_ns) * 1e-6,
+			     static_cast<unsigned long long>(pass.allocated_bytes), pass.max_node_count);
+		}
+	}
+};
+
+enum class InputMode
+{
+	Test,
+	Graphviz,
+	Snapshot,
+	Random
+};
+
+struct Arguments
+{
+	InputMode mode = InputMode::Test;
+	const char *input = nullptr;
+	uint32_t seed = 0;
+	RandomCFGOptions random;
+	unsigned iterations = 1;
+	bool stats = false;
+	bool quiet = false;
+	bool validate = true;
+};
+
+static void print_help()
+{
+	fprintf(stderr, "Usage: structurize-test <input test> [options]\n"
+	                "       structurize-test --graphviz <dump> [options]\n"
+	                "       structurize-test --snapshot <file> [options]\n"
+	                "       structurize-test --random <seed> [options]\n"
+	                "\t--graphviz replays a CFG dumped through DXIL_SPIRV_GRAPHVIZ_PATH, preferably the .input stage.\n"
+	                "\t--snapshot replays a CFG captured through DXIL_SPIRV_CFG_SNAPSHOT_PATH.\n"
+	                "\t--random generates a CFG with these knobs:\n"
+	                "\t\t--nodes N (default 64)\n"
+	                "\t\t--window N: maximum branch distance in blocks (default 8)\n"
+	                "\t\t--selection-ratio F: probability of a conditional branch (default 0.5)\n"
+	                "\t\t--loop-ratio F: probability of a back edge (default 0.1)\n"
+	                "\t\t--return-ratio F: probability of an early return (default 0.02)\n"
+	                "\t\t--phi-ratio F: probability of a PHI in a block with multiple preds (default 0.3)\n"
+	                "\t\t--sideeffect-ratio F: probability of a store in a block (default 0.1)\n"
+	                "\t\t--irreducible: back edges may target blocks which do not dominate the source\n"
+	                "\t--iterations N: structurize N times, random CFGs use seed + i (default 1)\n"
+	                "\t--stats: print per-pass timing, node growth and memory statistics\n"
+	                "\t--quiet: do not print GLSL and SPIR-V assembly\n"
+	                "\t--no-validate: do not validate the SPIR-V output\n");
+}
+
+static const char *next_argument(int &i, int argc, char **argv)
+{
+	if (i + 1 >= argc)
+	{
+		fprintf(stderr, "%s needs an argument.\n", argv[i]);
+		return nullptr;
+	}
+	return argv[++i];
+}
+
+#define NEXT_OR_FAIL(var)                           \
+	const char *var = next_argument(i, argc, argv); \
+	if (!var)                                       \
+		return false
+
+static bool parse_arguments(Arguments &args, int argc, char **argv)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const char *arg = argv[i];
+
+		if (strcmp(arg, "--help") == 0)
+		{
+			print_help();
+			return false;
+		}
+		else if (strcmp(arg, "--graphviz") == 0)
+		{
+			NEXT_OR_FAIL(value);
+			args.mode = InputMode::Graphviz;
+			args.input = value;
+		}
+		else if (strcmp(arg, "--snapshot") == 0)
+		{
+			NEXT_OR_FAIL(value);
+			args.mode = InputMode::Snapshot;
+			args.input = value;
+		}
+		else if (strcmp(arg, "--random") == 0)
+		{
+			NEXT_OR_FAIL(value);
+			args.mode = InputMode::Random;
+			args.seed = uint32_t(strtoul(value, nullptr, 0));
+		}
+		else if (strcmp(arg, "--nodes") == 0)
+		{
+			NEXT_OR_FAIL(value);
+			args.random.nodes = uint32_t(strtoul(value, nullptr, 0));
+		}
+		else if (strcmp(arg, "--window") == 0)
+		{
+			NEXT_OR_FAIL(value);
+			args.random.window = uint32_t(strtoul(value, nullptr, 0));
+		}
+		else if (strcmp(arg, "--selection-ratio") == 0)
+		{
+			NEXT_OR_FAIL(value);
+			args.random.selection_ratio = strtof(value, nullptr);
+		}
+		else if (strcmp(arg, "--loop-ratio") == 0)
+		{
+			NEXT_OR_FAIL(value);
+			args.random.loop_ratio = strtof(value, nullptr);
+		}
+		else if (strcmp(arg, "--return-ratio") == 0)
+		{
+			NEXT_OR_FAIL(value);
+			args.random.return_ratio = strtof(value, nullptr);
+		}
+		else if (strcmp(arg, "--phi-ratio") == 0)
+		{
+			NEXT_OR_FAIL(value);
+			args.random.phi_ratio = strtof(value, nullptr);
+		}
+		else if (strcmp(arg, "--sideeffect-ratio") == 0)
+		{
+			NEXT_OR_FAIL(value);
+			args.random.sideeffect_ratio = strtof(value, nullptr);
+		}
+		else if (strcmp(arg, "--irreducible") == 0)
+			args.random.irreducible = true;
+		else if (strcmp(arg, "--iterations") == 0)
+		{
+			NEXT_OR_FAIL(value);
+			args.iterations = unsigned(strtoul(value, nullptr, 0));
+		}
+		else if (strcmp(arg, "--stats") == 0)
+			args.stats = true;
+		else if (strcmp(arg, "--quiet") == 0)
+			args.quiet = true;
+		else if (strcmp(arg, "--no-validate") == 0)
+			args.validate = false;
+		else if (arg[0] != '-' && !args.input)
+			args.input = arg;
+		else
+		{
+			fprintf(stderr, "Unknown argument %s.\n", arg);
+			return false;
+		}
+	}
+
+	if (args.mode != InputMode::Random && !args.input)
+	{
+		print_help();
+		return false;
+	}
+
+	if (args.iterations == 0)
+	{
+		fprintf(stderr, "Need at least one iteration.\n");
+		return false;
+	}
+
+	return true;
+}
+
+#undef NEXT_OR_FAIL
+
+static bool run_iteration(const Arguments &args, unsigned iteration, RunStatistics &stats)
+{
+	TestCFG cfg;
+	cfg.emitter.module.emit_entry_point(spv::ExecutionModelVertex, "main", false);
+
+	bool loaded = true;
+	switch (args.mode)
+	{
+	case InputMode::Test:
+		loaded = load_test(cfg, args.input);
+		break;
+
+	case InputMode::Graphviz:
+		loaded = load_graphviz(cfg, args.input);
+		break;
+
+	case InputMode::Snapshot:
+		loaded = load_snapshot(cfg, args.input);
+		break;
+
+	case InputMode::Random:
+		generate_random_cfg(cfg, args.random, args.seed + iteration);
+		break;
+	}
+
+	if (!loaded)
+		return false;
+
+	size_t input_nodes = cfg.pool.get_node_count();
+	Vector<CFGStructurizer::PassStatistics> pass_stats;
+
+	CFGStructurizer traverser(cfg.entry, cfg.pool, cfg.emitter.module);
+	if (args.stats)
+		traverser.set_pass_statistics(&pass_stats);
+
+	auto start = std::chrono::steady_clock::now();
+	bool ok = traverser.run();
+	auto end = std::chrono::steady_clock::now();
+
+	stats.runs++;
+	stats.run_ns += uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+	stats.input_nodes += input_nodes;
+	stats.output_nodes += cfg.pool.get_node_count();
+	stats.add_passes(pass_stats);
+
+	if (!ok)
+	{
+		LOGE("Structurizer failed for iteration %u.\n", iteration);
+		stats.failed_runs++;
+		return true;
+	}
+
+	traverser.traverse(cfg.emitter);
+
+	cfg.pool.for_each_node([](CFGNode &node) {
 		node.userdata = nullptr;
 		node.id = 0;
 	});
 
-	emitter.module.emit_entry_point_function_body(traverser);
+	cfg.emitter.module.emit_entry_point_function_body(traverser);
 	Vector<uint32_t> code;
-	emitter.module.finalize_spirv(code);
+	cfg.emitter.module.finalize_spirv(code);
+
+	if (!args.quiet)
+	{
+		print_glsl(code);
+		print_spirv_assembly(code);
+	}
+
+	if (args.validate && !validate_spirv(code))
+	{
+		if (args.mode == InputMode::Random)
+			LOGE("Reproduce with --random %u.\n", args.seed + iteration);
+		stats.failed_validations++;
+	}
+
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	Arguments args;
+	if (!parse_arguments(args, argc, argv))
+		return EXIT_FAILURE;
+
+	RunStatistics stats;
+
+	// Everything which is created per iteration lives in the thread allocator,
+	// so peak arena usage covers the structurizer as well as loading and emission.
+	begin_thread_allocator_context();
+	for (unsigned i = 0; i < args.iterations; i++)
+	{
+		if (!run_iteration(args, i, stats))
+		{
+			end_thread_allocator_context();
+			return EXIT_FAILURE;
+		}
+
+		stats.peak_arena_bytes = std::max(stats.peak_arena_bytes, get_thread_allocator_usage());
+		reset_thread_allocator_context();
+	}
+
+	if (args.stats)
+		stats.print();
+	end_thread_allocator_context();
 
-	print_glsl(code);
-	print_spirv_assembly(code);
-	validate_spirv(code);
+	return stats.failed_runs || stats.failed_validations ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -40,14 +40,20 @@ void CFGNode::add_unique_pred(CFGNode *node)
 {
 	auto itr = std::find(pred.begin(), pred.end(), node);
 	if (itr == pred.end())
+	{
 		pred.push_back(node);
+		pool.mark_cfg_edited();
+	}
 }
 
 void CFGNode::add_unique_fake_pred(CFGNode *node)
 {
 	auto itr = std::find(fake_pred.begin(), fake_pred.end(), node);
 	if (itr == fake_pred.end())
+	{
 		fake_pred.push_back(node);
+		pool.mark_cfg_edited();
+	}
 }
 
 void CFGNode::add_unique_header(CFGNode *node)
@@ -77,14 +83,20 @@ void CFGNode::add_unique_succ(CFGNode *node)
 	assert(std::find(fake_succ.begin(), fake_succ.end(), node) == fake_succ.end());
 	auto itr = std::find(succ.begin(), succ.end(), node);
 	if (itr == succ.end())
+	{
 		succ.push_back(node);
+		pool.mark_cfg_edited();
+	}
 }
 
 void CFGNode::add_unique_fake_succ(CFGNode *node)
 {
 	auto itr = std::find(fake_succ.begin(), fake_succ.end(), node);
 	if (itr == fake_succ.end())
+	{
 		fake_succ.push_back(node);
+		pool.mark_cfg_edited();
+	}
 }
 
 unsigned CFGNode::num_forward_preds() const
@@ -141,15 +153,32 @@ bool CFGNode::can_loop_merge_to(const CFGNode *other) const
 	return true;
 }
 
-bool CFGNode::can_backtrace_to(const CFGNode *parent, UnorderedSet<const CFGNode *> &node_cache) const
+bool CFGNode::can_backtrace_to(const CFGNode *parent, uint32_t epoch) const
 {
-	if (node_cache.count(this))
+	if (query_epoch == epoch)
 		return false;
-	node_cache.insert(this);
+	query_epoch = epoch;
 
-	for (auto *p : pred)
-		if (p == parent || p->can_backtrace_to(parent, node_cache))
-			return true;
+	Vector<const CFGNode *> stack;
+	stack.push_back(this);
+
+	while (!stack.empty())
+	{
+		auto *node = stack.back();
+		stack.pop_back();
+
+		for (auto *p : node->pred)
+		{
+			if (p == parent)
+				return true;
+
+			if (p->query_epoch != epoch)
+			{
+				p->query_epoch = epoch;
+				stack.push_back(p);
+			}
+		}
+	}
 
 	return false;
 }
@@ -160,24 +189,35 @@ bool CFGNode::can_backtrace_to(const CFGNode *parent) const
 	if (parent->forward_post_visit_order < forward_post_visit_order)
 		return false;
 
-	UnorderedSet<const CFGNode *> node_cache;
-	return can_backtrace_to(parent, node_cache);
+	return can_backtrace_to(parent, pool.begin_query());
 }
 
-bool CFGNode::post_dominates_any_work(const CFGNode *parent, UnorderedSet<const CFGNode *> &node_cache) const
+bool CFGNode::post_dominates_any_work(const CFGNode *parent, uint32_t epoch) const
 {
-	// If we reached this node before and didn't terminate, it must have returned false.
-	if (node_cache.count(parent))
-		return false;
-	node_cache.insert(parent);
+	Vector<const CFGNode *> stack;
+	stack.push_back(parent);
 
-	// This is not a dummy block, we have an answer.
-	if (!parent->ir.operations.empty() || !parent->ir.phi.empty())
-		return post_dominates(parent);
+	while (!stack.empty())
+	{
+		auto *node = stack.back();
+		stack.pop_back();
 
-	for (auto *p : parent->pred)
-		if (post_dominates_any_work(p, node_cache))
-			return true;
+		// If we reached this node before and didn't terminate, it must have returned false.
+		if (node->query_epoch == epoch)
+			continue;
+		node->query_epoch = epoch;
+
+		// This is not a dummy block, we have an answer for this path.
+		if (!node->ir.operations.empty() || !node->ir.phi.empty())
+		{
+			if (post_dominates(node))
+				return true;
+			continue;
+		}
+
+		for (auto itr = node->pred.rbegin(); itr != node->pred.rend(); ++itr)
+			stack.push_back(*itr);
+	}
 
 	return false;
 }
@@ -196,9 +236,9 @@ bool CFGNode::post_dominates_any_work() const
 	if (!start_node->ir.operations.empty() || !start_node->ir.phi.empty())
 		return true;
 
-	UnorderedSet<const CFGNode *> node_cache;
+	uint32_t epoch = pool.begin_query();
 	for (auto *p : start_node->pred)
-		if (start_node->post_dominates_any_work(p, node_cache))
+		if (start_node->post_dominates_any_work(p, epoch))
 			return true;
 	return false;
 }
@@ -227,18 +267,34 @@ bool CFGNode::post_dominates_perfect_structured_construct() const
 	return true;
 }
 
-bool CFGNode::dominates_all_reachable_exits(UnorderedSet<const CFGNode *> &completed, const CFGNode &header) const
+bool CFGNode::dominates_all_reachable_exits(uint32_t epoch, const CFGNode &header) const
 {
-	if (!completed.count(this))
+	if (query_epoch == epoch)
+		return true;
+	query_epoch = epoch;
+
+	Vector<const CFGNode *> stack;
+	stack.push_back(this);
+
+	while (!stack.empty())
 	{
-		if (succ_back_edge)
+		auto *node = stack.back();
+		stack.pop_back();
+
+		if (node->succ_back_edge)
 			return false;
 
-		for (auto *node : succ)
-			if (!header.dominates(node) || !node->dominates_all_reachable_exits(completed, header))
+		for (auto *succ_node : node->succ)
+		{
+			if (!header.dominates(succ_node))
 				return false;
 
-		completed.insert(this);
+			if (succ_node->query_epoch != epoch)
+			{
+				succ_node->query_epoch = epoch;
+				stack.push_back(succ_node);
+			}
+		}
 	}
 
 	return true;
@@ -246,8 +302,7 @@ bool CFGNode::dominates_all_reachable_exits(UnorderedSet<const CFGNode *> &compl
 
 bool CFGNode::dominates_all_reachable_exits() const
 {
-	UnorderedSet<const CFGNode *> completed;
-	return dominates_all_reachable_exits(completed, *this);
+	return dominates_all_reachable_exits(pool.begin_query(), *this);
 }
 
 CFGNode *CFGNode::find_common_post_dominator(CFGNode *a, CFGNode *b)
@@ -421,6 +476,7 @@ void CFGNode::retarget_branch_pre_traversal(CFGNode *to_prev, CFGNode *to_next)
 	assert(std::find(to_next->pred.begin(), to_next->pred.end(), this) == to_next->pred.end());
 
 	to_prev->pred.erase(std::find(to_prev->pred.begin(), to_prev->pred.end(), this));
+	pool.mark_cfg_edited();
 
 	// Modify succ in place so we don't invalidate iterator in traverse_dominated_blocks_and_rewrite_branch.
 	*std::find(succ.begin(), succ.end(), to_prev) = to_next;
@@ -475,6 +531,7 @@ void CFGNode::retarget_fake_succ(CFGNode *to_prev, CFGNode *to_next)
 	// Modify fake_succ in place so we don't invalidate iterator in traverse_dominated_blocks_and_rewrite_branch.
 	*std::find(fake_succ.begin(), fake_succ.end(), to_prev) = to_next;
 	to_next->add_unique_fake_pred(this);
+	pool.mark_cfg_edited();
 
 	recompute_immediate_post_dominator();
 }
@@ -595,29 +652,47 @@ bool CFGNode::block_is_jump_thread_ladder() const
 	return ir.terminator.conditional_id == phi.id;
 }
 
-bool CFGNode::reaches_backward_visited_node(UnorderedSet<const dxil_spv::CFGNode *> &completed) const
+bool CFGNode::reaches_backward_visited_node(uint32_t epoch) const
 {
-	if (completed.count(this))
+	if (query_epoch == epoch)
 		return false;
-	completed.insert(this);
+	query_epoch = epoch;
 
-	if (backward_visited)
-		return true;
+	Vector<const CFGNode *> stack;
+	stack.push_back(this);
 
-	for (auto *node : succ)
-		if (node->reaches_backward_visited_node(completed))
-			return true;
+	while (!stack.empty())
+	{
+		auto *node = stack.back();
+		stack.pop_back();
 
-	for (auto *node : fake_succ)
-		if (node->reaches_backward_visited_node(completed))
+		if (node->backward_visited)
 			return true;
 
+		for (auto *next : node->succ)
+		{
+			if (next->query_epoch != epoch)
+			{
+				next->query_epoch = epoch;
+				stack.push_back(next);
+			}
+		}
+
+		for (auto *next : node->fake_succ)
+		{
+			if (next->query_epoch != epoch)
+			{
+				next->query_epoch = epoch;
+				stack.push_back(next);
+			}
+		}
+	}
+
 	return false;
 }
 
 bool CFGNode::reaches_backward_visited_node() const
 {
-	UnorderedSet<const CFGNode *> visit;
-	return reaches_backward_visited_node(visit);
+	return reaches_backward_visited_node(pool.begin_query());
 }
 } // namespace dxil_spv
@@ -26,22 +26,16 @@
 
 #include "thread_local_allocator.hpp"
 #include "ir.hpp"
+#include "node_pool.hpp"
 
 #include <algorithm>
 #include <stdint.h>
 
 namespace dxil_spv
 {
-class CFGNodePool;
-
 struct CFGNode
 {
 public:
-	String name;
-	uint32_t id = 0;
-	void *userdata = nullptr;
-	IRBlock ir;
-
 	void add_branch(CFGNode *to);
 	void add_fake_branch(CFGNode *to);
 
@@ -52,29 +46,28 @@ private:
 	friend class CFGStructurizer;
 	friend struct LoopBacktracer;
 	friend struct LoopMergeTracer;
+	friend class IRPeephole;
 	explicit CFGNode(CFGNodePool &pool);
 
-	CFGNodePool &pool;
+	// Hot data for traversal and dominance analysis comes first, so that passes over all nodes
+	// touch as few cache lines per node as possible. Cold data is kept at the end of the node.
+	Vector<CFGNode *> succ;
+	Vector<CFGNode *> pred;
+	CFGNode *immediate_dominator = nullptr;
+	CFGNode *immediate_post_dominator = nullptr;
+	CFGNode *pred_back_edge = nullptr;
+	CFGNode *succ_back_edge = nullptr;
 	uint32_t forward_post_visit_order = 0;
 	uint32_t backward_post_visit_order = 0;
+	// Visit marks for graph queries, compared against epochs handed out by the pool.
+	mutable uint32_t query_epoch = 0;
+	mutable uint32_t traversal_epoch = 0;
 	bool visited = false;
 	bool backward_visited = false;
 	bool traversing = false;
 	bool freeze_structured_analysis = false;
 	bool is_pseudo_back_edge = false;
 
-	MergeType merge = MergeType::None;
-	CFGNode *loop_merge_block = nullptr;
-	CFGNode *loop_ladder_block = nullptr;
-	CFGNode *selection_merge_block = nullptr;
-	CFGNode *split_merge_block_candidate = nullptr;
-	Vector<CFGNode *> headers;
-
-	CFGNode *immediate_dominator = nullptr;
-	CFGNode *immediate_post_dominator = nullptr;
-	Vector<CFGNode *> succ;
-	Vector<CFGNode *> pred;
-
 	// Fake successors and predecessors which only serve to make the flipped CFG reducible.
 	// This makes post-domination analysis not strictly correct in all cases, but it is
 	// fine for the purposes we need post-domination analysis for.
@@ -83,8 +76,14 @@ private:
 	Vector<CFGNode *> fake_succ;
 	Vector<CFGNode *> fake_pred;
 
-	CFGNode *pred_back_edge = nullptr;
-	CFGNode *succ_back_edge = nullptr;
+	MergeType merge = MergeType::None;
+	CFGNode *loop_merge_block = nullptr;
+	CFGNode *loop_ladder_block = nullptr;
+	CFGNode *selection_merge_block = nullptr;
+	CFGNode *split_merge_block_candidate = nullptr;
+	Vector<CFGNode *> headers;
+
+	CFGNodePool &pool;
 
 	void add_unique_succ(CFGNode *node);
 	void add_unique_pred(CFGNode *node);
@@ -103,9 +102,9 @@ private:
 	static CFGNode *find_common_post_dominator(CFGNode *a, CFGNode *b);
 	CFGNode *get_immediate_dominator_loop_header();
 	bool can_backtrace_to(const CFGNode *parent) const;
-	bool can_backtrace_to(const CFGNode *parent, UnorderedSet<const CFGNode *> &node_cache) const;
+	bool can_backtrace_to(const CFGNode *parent, uint32_t epoch) const;
 	bool post_dominates_any_work() const;
-	bool post_dominates_any_work(const CFGNode *parent, UnorderedSet<const CFGNode *> &node_cache) const;
+	bool post_dominates_any_work(const CFGNode *parent, uint32_t epoch) const;
 	bool reaches_backward_visited_node() const;
 
 	void retarget_branch(CFGNode *to_prev, CFGNode *to_next);
@@ -132,33 +131,71 @@ private:
 
 	bool block_is_jump_thread_ladder() const;
 
+public:
+	String name;
+	uint32_t id = 0;
+	void *userdata = nullptr;
+	IRBlock ir;
+
 private:
-	bool dominates_all_reachable_exits(UnorderedSet<const CFGNode *>& completed, const CFGNode &header) const;
+	bool dominates_all_reachable_exits(uint32_t epoch, const CFGNode &header) const;
 
 	template <typename Op>
 	void traverse_dominated_blocks(UnorderedSet<const CFGNode *> &completed,
 	                                    const CFGNode &header, const Op &op) const;
+	template <typename Op>
+	void traverse_dominated_blocks(uint32_t epoch, const CFGNode &header, const Op &op) const;
 
 	void retarget_fake_succ(CFGNode *from, CFGNode *to);
-	bool reaches_backward_visited_node(UnorderedSet<const CFGNode *> &completed) const;
+	bool reaches_backward_visited_node(uint32_t epoch) const;
+
+	// Traversals keep an explicit stack rather than recursing, since fully unrolled shaders
+	// can have CFGs deep enough to overflow small thread stacks.
+	struct TraversalFrame
+	{
+		const CFGNode *node;
+		size_t index;
+	};
 };
 
 template <typename Op>
 void CFGNode::walk_cfg_from(const Op &op) const
 {
-	if (!op(this))
-		return;
+	Vector<const CFGNode *> stack;
+	stack.push_back(this);
+
+	while (!stack.empty())
+	{
+		auto *node = stack.back();
+		stack.pop_back();
+
+		if (!op(node))
+			continue;
 
-	for (auto *s : succ)
-		s->walk_cfg_from(op);
+		// Push in reverse so that succs are walked in order.
+		for (auto itr = node->succ.rbegin(); itr != node->succ.rend(); ++itr)
+			stack.push_back(*itr);
+	}
 }
 
 template <typename Op>
 void CFGNode::traverse_dominated_blocks(UnorderedSet<const CFGNode *> &completed,
                                         const CFGNode &header, const Op &op) const
 {
-	for (auto *node : succ)
+	Vector<TraversalFrame> stack;
+	stack.push_back({ this, 0 });
+
+	while (!stack.empty())
 	{
+		// The op may retarget branches in place, so index into succ rather than holding iterators.
+		auto &frame = stack.back();
+		if (frame.index >= frame.node->succ.size())
+		{
+			stack.pop_back();
+			continue;
+		}
+
+		auto *node = frame.node->succ[frame.index++];
 		bool can_visit = completed.count(node) == 0;
 		if (can_visit)
 			completed.insert(node);
@@ -166,7 +203,36 @@ void CFGNode::traverse_dominated_blocks(UnorderedSet<const CFGNode *> &completed
 		if (can_visit && header.dominates(node))
 		{
 			if (op(node))
-				node->traverse_dominated_blocks(completed, header, op);
+				stack.push_back({ node, 0 });
+		}
+	}
+}
+
+template <typename Op>
+void CFGNode::traverse_dominated_blocks(uint32_t epoch, const CFGNode &header, const Op &op) const
+{
+	Vector<TraversalFrame> stack;
+	stack.push_back({ this, 0 });
+
+	while (!stack.empty())
+	{
+		// The op may retarget branches in place, so index into succ rather than holding iterators.
+		auto &frame = stack.back();
+		if (frame.index >= frame.node->succ.size())
+		{
+			stack.pop_back();
+			continue;
+		}
+
+		auto *node = frame.node->succ[frame.index++];
+		bool can_visit = node->traversal_epoch != epoch;
+		if (can_visit)
+			node->traversal_epoch = epoch;
+
+		if (can_visit && header.dominates(node))
+		{
+			if (op(node))
+				stack.push_back({ node, 0 });
 		}
 	}
 }
@@ -174,7 +240,17 @@ void CFGNode::traverse_dominated_blocks(UnorderedSet<const CFGNode *> &completed
 template <typename Op>
 void CFGNode::traverse_dominated_blocks(const Op &op) const
 {
-	UnorderedSet<const CFGNode *> completed;
-	traverse_dominated_blocks(completed, *this, op);
+	// The op might start a traversal of its own, which would clobber our visit marks.
+	if (pool.is_in_traversal())
+	{
+		UnorderedSet<const CFGNode *> completed;
+		traverse_dominated_blocks(completed, *this, op);
+	}
+	else
+	{
+		uint32_t epoch = pool.begin_traversal();
+		traverse_dominated_blocks(epoch, *this, op);
+		pool.end_traversal();
+	}
 }
 } // namespace dxil_spv
@@ -24,24 +24,64 @@
 
 #include "node_pool.hpp"
 #include "node.hpp"
+#include <exception>
+#include <new>
 #include <utility>
 
 namespace dxil_spv
 {
 CFGNodePool::CFGNodePool()
+	: in_thread_allocator_context(has_thread_allocator_context())
 {
 }
 
 CFGNodePool::~CFGNodePool()
 {
+	// Everything a node owns comes from the thread allocator.
+	// If the nodes live in an allocator context, the memory is reclaimed on reset anyways,
+	// so there is no point in running thousands of destructors.
+	if (!in_thread_allocator_context || !has_thread_allocator_context())
+		for (size_t i = nodes.size(); i; i--)
+			nodes[i - 1]->~CFGNode();
+
+	for (auto &slab : slabs)
+		free_in_thread(slab.nodes, sizeof(CFGNode) * slab.capacity);
 }
 
 CFGNode *CFGNodePool::create_node()
 {
-	auto node = std::unique_ptr<CFGNode>(new CFGNode(*this));
-	auto *ret = node.get();
-	nodes.push_back(std::move(node));
-	return ret;
+	static_assert(alignof(CFGNode) <= 16, "Thread allocator only guarantees 16 byte alignment.");
+
+	if (slabs.empty() || slabs.back().count == slabs.back().capacity)
+	{
+		Slab slab = {};
+		slab.capacity = next_slab_size;
+		slab.nodes = static_cast<CFGNode *>(allocate_in_thread(sizeof(CFGNode) * slab.capacity));
+		if (!slab.nodes)
+			std::terminate();
+		slabs.push_back(slab);
+		next_slab_size *= 2;
+	}
+
+	auto &slab = slabs.back();
+	auto *node = ::new (&slab.nodes[slab.count++]) CFGNode(*this);
+	nodes.push_back(node);
+	mark_cfg_edited();
+	return node;
+}
+
+void CFGNodePool::reset_query_epochs()
+{
+	for (auto *node : nodes)
+		node->query_epoch = 0;
+	query_epoch = 1;
+}
+
+void CFGNodePool::reset_traversal_epochs()
+{
+	for (auto *node : nodes)
+		node->traversal_epoch = 0;
+	traversal_epoch = 1;
 }
 
 } // namespace dxil_spv
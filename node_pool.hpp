@@ -25,7 +25,6 @@
 #pragma once
 
 #include "thread_local_allocator.hpp"
-#include <memory>
 
 namespace dxil_spv
 {
@@ -44,11 +43,73 @@ public:
 	template <typename Op>
 	void for_each_node(const Op &op)
 	{
-		for (auto &node : nodes)
+		for (auto *node : nodes)
 			op(*node);
 	}
 
+	// Epochs for the visit marks in CFGNode, so graph queries need neither hashing nor allocation.
+	// Queries which do not call back into user code share one epoch per query.
+	uint32_t begin_query()
+	{
+		if (++query_epoch == 0)
+			reset_query_epochs();
+		return query_epoch;
+	}
+
+	// Traversals with callbacks use their own marks, and must not nest.
+	uint32_t begin_traversal()
+	{
+		in_traversal = true;
+		if (++traversal_epoch == 0)
+			reset_traversal_epochs();
+		return traversal_epoch;
+	}
+
+	void end_traversal()
+	{
+		in_traversal = false;
+	}
+
+	bool is_in_traversal() const
+	{
+		return in_traversal;
+	}
+
+	// Bumped whenever nodes are created or edges between nodes are edited.
+	// CFG analysis can be reused as-is if the revision did not change since it was computed.
+	void mark_cfg_edited()
+	{
+		cfg_revision++;
+	}
+
+	uint64_t get_cfg_revision() const
+	{
+		return cfg_revision;
+	}
+
+	size_t get_node_count() const
+	{
+		return nodes.size();
+	}
+
 private:
-	Vector<std::unique_ptr<CFGNode>> nodes;
+	// Nodes are allocated in contiguous slabs, similar to ScratchPool.
+	struct Slab
+	{
+		CFGNode *nodes;
+		size_t count;
+		size_t capacity;
+	};
+	Vector<Slab> slabs;
+	Vector<CFGNode *> nodes;
+	size_t next_slab_size = 64;
+	uint32_t query_epoch = 0;
+	uint32_t traversal_epoch = 0;
+	uint64_t cfg_revision = 0;
+	bool in_traversal = false;
+	bool in_thread_allocator_context;
+
+	void reset_query_epochs();
+	void reset_traversal_epochs();
 };
 } // namespace dxil_spv
@@ -25,12 +25,14 @@
 #pragma once
 
 #include "thread_local_allocator.hpp"
+#include "flat_hash_map.hpp"
 #include "SpvBuilder.h"
 #include "cfg_structurizer.hpp"
 #include "dxil_converter.hpp"
 #include "scratch_pool.hpp"
 #include "descriptor_qa.hpp"
 #include "opcodes.hpp"
+#include "phase_statistics.hpp"
 
 #include "GLSL.std.450.h"
 
@@ -143,19 +145,94 @@ static inline unsigned raw_width_to_bits(RawWidth raw_width)
 	return raw_component_type_to_bits(raw_width_to_component_type(RawType::Integer, raw_width));
 }
 
+// Maps LLVM values to SPIR-V IDs.
+// With LLVMBC, values carry a dense ID, so the common path is a flat array indexed by that ID.
+// Values from a different context (e.g. the reflection module) may alias an ID,
+// so every slot remembers its owner and collisions spill over to a hash map.
+class ValueIdMap
+{
+public:
+	void reserve(uint32_t count)
+	{
+#ifdef HAVE_LLVMBC
+		if (count > dense.size())
+			dense.resize(count);
+#else
+		(void)count;
+#endif
+	}
+
+	spv::Id *find(const llvm::Value *value)
+	{
+#ifdef HAVE_LLVMBC
+		uint32_t id = value->get_value_id();
+		if (id < dense.size() && dense[id].value == value)
+			return &dense[id].id;
+#endif
+		auto itr = fallback.find(value);
+		return itr != fallback.end() ? &itr->second : nullptr;
+	}
+
+	spv::Id &operator[](const llvm::Value *value)
+	{
+		if (auto *id = find(value))
+			return *id;
+
+#ifdef HAVE_LLVMBC
+		uint32_t id = value->get_value_id();
+		if (id >= dense.size())
+			dense.resize(std::max<size_t>(id + 1, dense.size() * 2));
+		auto &slot = dense[id];
+		if (!slot.value)
+		{
+			slot.value = value;
+			slot.id = 0;
+			return slot.id;
+		}
+#endif
+		return fallback[value];
+	}
+
+	void erase(const llvm::Value *value)
+	{
+#ifdef HAVE_LLVMBC
+		uint32_t id = value->get_value_id();
+		if (id < dense.size() && dense[id].value == value)
+		{
+			dense[id] = {};
+			return;
+		}
+#endif
+		auto itr = fallback.find(value);
+		if (itr != fallback.end())
+			fallback.erase(itr);
+	}
+
+private:
+#ifdef HAVE_LLVMBC
+	struct Entry
+	{
+		const llvm::Value *value = nullptr;
+		spv::Id id = 0;
+	};
+	Vector<Entry> dense;
+#endif
+	FlatHashMap<const llvm::Value *, spv::Id> fallback;
+};
+
 struct Converter::Impl
 {
 	DXIL_SPV_OVERRIDE_NEW_DELETE
 
-	Impl(LLVMBCParser &bitcode_parser_, LLVMBCParser *bitcode_reflection_parser_, SPIRVModule &module_)
+	Impl(const LLVMBCParser &bitcode_parser_, const LLVMBCParser *bitcode_reflection_parser_, SPIRVModule &module_)
 	    : bitcode_parser(bitcode_parser_)
 	    , bitcode_reflection_parser(bitcode_reflection_parser_)
 	    , spirv_module(module_)
 	{
 	}
 
-	LLVMBCParser &bitcode_parser;
-	LLVMBCParser *bitcode_reflection_parser;
+	const LLVMBCParser &bitcode_parser;
+	const LLVMBCParser *bitcode_reflection_parser;
 	SPIRVModule &spirv_module;
 
 	struct BlockMeta
@@ -172,11 +249,17 @@ struct Converter::Impl
 	};
 	Vector<std::unique_ptr<BlockMeta>> metas;
 	UnorderedMap<const llvm::BasicBlock *, BlockMeta *> bb_map;
-	UnorderedMap<const llvm::Value *, spv::Id> value_map;
-	UnorderedMap<spv::Id, spv::Id> phi_incoming_rewrite;
+	ValueIdMap value_map;
+	FlatHashMap<spv::Id, spv::Id> phi_incoming_rewrite;
+	// Blocks whose terminator was folded to a single successor while building the CFG.
+	// PHI incoming values along the edges which were folded away must be dropped.
+	UnorderedMap<const llvm::BasicBlock *, const llvm::BasicBlock *> bb_static_succ;
 
 	ConvertedFunction convert_entry_point();
 	CFGNode *convert_function(llvm::Function *func, CFGNodePool &pool);
+	llvm::BasicBlock *get_static_branch_target(const llvm::Instruction *terminator);
+	llvm::BasicBlock *resolve_forwarding_block(llvm::BasicBlock *bb,
+	                                           const UnorderedMap<const llvm::BasicBlock *, unsigned> &pred_counts);
 	CFGNode *build_hull_main(llvm::Function *func, CFGNodePool &pool,
 	                         Vector<ConvertedFunction::LeafFunction> &leaves);
 	CFGNode *build_rov_main(llvm::Function *func, CFGNodePool &pool,
@@ -201,6 +284,7 @@ struct Converter::Impl
 	bool emit_execution_modes_late();
 	void emit_execution_modes_post_code_generation();
 	bool analyze_execution_modes_meta();
+	bool analyze_linked_stage_outputs();
 	bool emit_execution_modes_compute();
 	bool emit_execution_modes_geometry();
 	bool emit_execution_modes_hull();
@@ -215,8 +299,11 @@ struct Converter::Impl
 
 	bool analyze_instructions();
 	bool analyze_instructions(const llvm::Function *function);
+	void coalesce_raw_buffer_loads(const llvm::BasicBlock *bb);
+	void coalesce_mesh_output_stores(const llvm::BasicBlock *bb);
 	void mark_used_values(const llvm::Instruction *instruction);
 	void mark_used_value(const llvm::Value *value);
+	void propagate_used_values(const llvm::Function *function);
 
 	struct RawDeclaration
 	{
@@ -231,16 +318,28 @@ struct Converter::Impl
 		bool has_written = false;
 		bool has_atomic = false;
 		bool has_atomic_64bit = false;
+		// Loads and stores, as opposed to atomics, which also count as both read and written.
+		bool has_non_atomic_read = false;
+		bool has_non_atomic_write = false;
 		bool raw_access_buffer_declarations[unsigned(RawType::Count)][unsigned(RawWidth::Count)][unsigned(RawVecSize::Count)] = {};
+		// CBV only. Number of 16-byte rows covered by loads at constant offsets,
+		// and whether any load has a dynamic offset.
+		uint32_t cbv_static_rows = 0;
+		bool has_dynamic_cbv_offset = false;
 	};
 	UnorderedMap<uint32_t, AccessTracking> cbv_access_tracking;
+	Vector<CBVPromotionCandidate> cbv_promotion_candidates;
+	Vector<ResourceUsage> resource_usage;
+	UnorderedSet<uint32_t> llvm_referenced_resource_indices[4];
+	void record_resource_usage(DXIL::ResourceType type, unsigned index, unsigned bind_space,
+	                           unsigned bind_register, unsigned range_size, unsigned cbv_size);
 	UnorderedMap<uint32_t, AccessTracking> srv_access_tracking;
 	UnorderedMap<uint32_t, AccessTracking> uav_access_tracking;
 	UnorderedMap<const llvm::Value *, uint32_t> llvm_value_to_cbv_resource_index_map;
 	UnorderedMap<const llvm::Value *, uint32_t> llvm_value_to_srv_resource_index_map;
 	UnorderedMap<const llvm::Value *, uint32_t> llvm_value_to_uav_resource_index_map;
 	UnorderedSet<const llvm::Value *> llvm_values_using_update_counter;
-	UnorderedMap<const llvm::Value *, spv::Id> llvm_value_actual_type;
+	FlatHashMap<const llvm::Value *, spv::Id> llvm_value_actual_type;
 	UnorderedSet<uint32_t> llvm_attribute_at_vertex_indices;
 
 	struct
@@ -275,11 +374,44 @@ struct Converter::Impl
 		bool forced_composite = true;
 		// Forces a composite to be treated as a struct instead of vector or scalar.
 		bool forced_struct = false;
+		// If set, this scalar load was folded into a wider load, and its component 0
+		// is read from coalesced_component of coalesced_load instead.
+		const llvm::Value *coalesced_load = nullptr;
+		unsigned coalesced_component = 0;
+		// Number of components a coalesced load must read, or 0 if not widened.
+		unsigned coalesced_width = 0;
 	};
 	UnorderedMap<const llvm::Value *, CompositeMeta> llvm_composite_meta;
 
+	// Runs of StoreVertexOutput / StorePrimitiveOutput which together write every column of one row.
+	// The last store of the run emits a single vector store, the others are skipped.
+	struct MeshOutputStoreGroup
+	{
+		const llvm::CallInst *last_store;
+		const llvm::Value *values[4];
+		unsigned count;
+	};
+	Vector<MeshOutputStoreGroup> mesh_output_store_groups;
+	UnorderedMap<const llvm::CallInst *, uint32_t> mesh_output_store_to_group;
+
 	bool composite_is_accessed(const llvm::Value *composite) const;
 
+	// With sparse feedback forwarding, the { T, T, T, T, i32 } result of a sparse opcode is never built.
+	// Extracts read the unpacked component IDs directly. Unaccessed components are 0.
+	struct SparseFeedbackComponents
+	{
+		spv::Id ids[5];
+	};
+	UnorderedMap<const llvm::Value *, SparseFeedbackComponents> sparse_feedback_components;
+
+	// OpImageSparseTexelsResident results, reused for CheckAccessFullyMapped on the same status in the same block.
+	struct SparseResidencyCheck
+	{
+		const Vector<Operation *> *block;
+		spv::Id id;
+	};
+	UnorderedMap<const llvm::Value *, SparseResidencyCheck> sparse_residency_checks;
+
 	struct ResourceMetaReference
 	{
 		DXIL::ResourceType type;
@@ -404,6 +536,19 @@ struct Converter::Impl
 	spv::Id primitive_index_array_id = 0;
 	spv::Id descriptor_heap_robustness_var_id = 0;
 
+	// For uniformity analysis and descriptor QA deduplication. Heap offsets, including QA and robustness checks,
+	// are only reused within the block they were computed in.
+	UnorderedMap<const llvm::Value *, bool> dynamically_uniform_values;
+	struct UniformHeapOffset
+	{
+		uint32_t push_constant_member;
+		uint32_t base_offset;
+		uint32_t type;
+		spv::Id offset_id;
+	};
+	UnorderedMap<const llvm::Value *, Vector<UniformHeapOffset>> uniform_heap_offsets;
+	const Vector<Operation *> *uniform_heap_offsets_block = nullptr;
+
 	struct PhysicalPointerMeta
 	{
 		bool nonwritable;
@@ -435,7 +580,7 @@ struct Converter::Impl
 		spv::Id index_offset_id;
 	};
 	UnorderedMap<spv::Id, ResourceMeta> handle_to_resource_meta;
-	UnorderedMap<spv::Id, spv::Id> id_to_type;
+	FlatHashMap<spv::Id, spv::Id> id_to_type;
 	UnorderedMap<const llvm::Value *, unsigned> handle_to_root_member_offset;
 	UnorderedMap<const llvm::Value *, spv::StorageClass> handle_to_storage_class;
 	UnorderedSet<const llvm::Value *> needs_temp_storage_copy;
@@ -448,6 +593,21 @@ struct Converter::Impl
 	};
 	Vector<TempPayloadEntry> temp_payloads;
 
+	// Struct members of a temp copied payload which need to be copied around a TraceRay / CallShader.
+	// Calls without an entry copy the whole payload.
+	struct PayloadCopyMasks
+	{
+		uint64_t copy_in;
+		uint64_t copy_out;
+	};
+	UnorderedMap<const llvm::CallInst *, PayloadCopyMasks> payload_copy_masks;
+	void analyze_ray_payload_liveness(const llvm::Function *function);
+
+	// Local arrays which are split into one Function variable per element.
+	// Filled with the element variables when the alloca is emitted.
+	UnorderedMap<const llvm::Value *, Vector<spv::Id>> scalarized_allocas;
+	void analyze_alloca_scalarization(const llvm::Function *function);
+
 	spv::StorageClass get_effective_storage_class(const llvm::Value *value, spv::StorageClass fallback) const;
 	bool get_needs_temp_storage_copy(const llvm::Value *value) const;
 	spv::Id get_temp_payload(spv::Id type, spv::StorageClass storage);
@@ -493,6 +653,8 @@ struct Converter::Impl
 	                           const llvm::Type *target_type);
 	void repack_sparse_feedback(DXIL::ComponentType component_type, unsigned components, const llvm::Value *value,
 	                            const llvm::Type *target_type, spv::Id override_value = 0);
+	void forward_sparse_feedback(DXIL::ComponentType component_type, unsigned components, const llvm::Value *value,
+	                             const llvm::Type *target_type, spv::Id override_value, unsigned access_mask);
 	spv::Id fixup_store_type_io(DXIL::ComponentType component_type, unsigned components, spv::Id value);
 	spv::Id fixup_store_type_atomic(DXIL::ComponentType component_type, unsigned components, spv::Id value);
 	spv::Id fixup_store_type_typed(DXIL::ComponentType component_type, unsigned components, spv::Id value);
@@ -517,10 +679,15 @@ struct Converter::Impl
 	spv::Id cmpxchg_type = 0;
 	spv::Id texture_sample_pos_lut_id = 0;
 	spv::Id rasterizer_sample_count_id = 0;
+	spv::Id sbt_descriptor_size_srv_uav_cbv_id = 0;
+	spv::Id sbt_descriptor_size_sampler_id = 0;
 	spv::Id shader_record_buffer_id = 0;
 	Vector<spv::Id> shader_record_buffer_types;
 
 	ResourceRemappingInterface *resource_mapping_iface = nullptr;
+	ConversionStatistics *statistics = nullptr;
+	const std::atomic_bool *cancel_flag = nullptr;
+	bool is_cancelled() const;
 
 	struct StructTypeEntry
 	{
@@ -529,6 +696,8 @@ struct Converter::Impl
 		Vector<spv::Id> subtypes;
 	};
 	Vector<StructTypeEntry> cached_struct_types;
+	// Hash of name and member types to the first matching entry in cached_struct_types.
+	UnorderedMap<uint64_t, uint32_t> cached_struct_type_index;
 	spv::Id get_struct_type(const Vector<spv::Id> &type_ids, const char *name = nullptr);
 
 	void set_option(const OptionBase &cap);
@@ -550,6 +719,9 @@ struct Converter::Impl
 
 		unsigned sbt_descriptor_size_srv_uav_cbv_log2 = 0;
 		unsigned sbt_descriptor_size_sampler_log2 = 0;
+		bool sbt_descriptor_size_spec_constants = false;
+		unsigned sbt_descriptor_size_srv_uav_cbv_spec_id = 0;
+		unsigned sbt_descriptor_size_sampler_spec_id = 0;
 		unsigned ssbo_alignment = 16;
 		bool typed_uav_read_without_format = false;
 		bool bindless_typed_buffer_offsets = false;
@@ -565,6 +737,7 @@ struct Converter::Impl
 		DescriptorQAInfo descriptor_qa;
 		bool descriptor_qa_enabled = false;
 		bool descriptor_qa_sink_handles = true;
+		bool descriptor_qa_deduplicate = false;
 		bool min_precision_prefer_native_16bit = false;
 		bool shader_i8_dot_enabled = false;
 		bool ray_tracing_primitive_culling_enabled = false;
@@ -583,6 +756,31 @@ struct Converter::Impl
 		bool propagate_precise = false;
 		bool force_precise = false;
 		bool descriptor_heap_robustness = false;
+		bool spirv_optimization = false;
+		bool peephole_optimization = false;
+		bool buffer_load_coalescing = false;
+		bool uniformity_analysis = false;
+		bool ray_payload_liveness = false;
+		bool loop_invariant_code_motion = false;
+		bool sparse_feedback_forwarding = false;
+		bool structured_cfg_fast_path = false;
+		// Root constant word index -> value.
+		UnorderedMap<uint32_t, uint32_t> known_root_constants;
+		// User semantic name and index the next stage reads.
+		Vector<std::pair<String, uint32_t>> consumer_stage_inputs;
+		bool link_stage_outputs = false;
+		bool hull_barrier_elision = false;
+		bool geometry_output_vertex_analysis = false;
+		bool min_precision_narrowing = false;
+		bool wave_aggregated_atomics = false;
+		bool uav_coherence_analysis = false;
+		unsigned physical_address_alignment = 4;
+		bool alloca_scalarization = false;
+		bool sampler_feedback_lod_merging = false;
+		bool spirv_canonicalization = false;
+		bool mesh_output_store_coalescing = false;
+		unsigned structurizer_node_growth_factor = 0;
+		bool constant_folding = false;
 		struct
 		{
 			bool enabled = false;
@@ -722,6 +920,22 @@ struct Converter::Impl
 
 	UnorderedSet<const llvm::Value *> llvm_used_ssa_values;
 
+	// Output elements which the consumer stage never reads. No variable is declared, and stores are dropped.
+	UnorderedSet<uint32_t> stripped_output_elements;
+	bool is_stripped_output_store(const llvm::Instruction &instruction) const;
+
+	// Instructions which were made precise by precise propagation.
+	// The parsed module may be shared by concurrent converters, so this cannot be written back to the IR.
+	UnorderedSet<const llvm::Instruction *> propagated_precise_instructions;
+	bool instruction_is_precise(const llvm::CallInst *instruction) const;
+	bool instruction_is_fast_math(const llvm::BinaryOperator *instruction) const;
+
+	// FP32 arithmetic evaluated in FP16, and the FPTrunc / FPExt instructions which become no-ops because of it.
+	UnorderedSet<const llvm::Value *> fp16_narrowed_values;
+	void analyze_min_precision_narrowing(const llvm::Function *function);
+	bool uav_requires_coherence(const AccessTracking &tracking) const;
+	bool any_uav_requires_coherence() const;
+
 	bool type_can_relax_precision(const llvm::Type *type, bool known_integer_sign) const;
 	void decorate_relaxed_precision(const llvm::Type *type, spv::Id id, bool known_integer_sign);
 
@@ -25,6 +25,7 @@
 #include "dxil_arithmetic.hpp"
 #include "dxil_common.hpp"
 #include "opcodes/converter_impl.hpp"
+#include <math.h>
 
 namespace dxil_spv
 {
@@ -49,7 +50,7 @@ bool emit_fmad_instruction(Converter::Impl &impl, const llvm::CallInst *instruct
 	auto &builder = impl.builder();
 	spv::Id result_id;
 
-	if (instruction->hasMetadata("dx.precise") || impl.options.force_precise)
+	if (impl.instruction_is_precise(instruction))
 	{
 		// DXIL docs says to split the expression explicitly.
 		// HLSL docs says it just has to be invariant.
@@ -273,7 +274,7 @@ bool emit_dot_instruction(unsigned dimensions, Converter::Impl &impl, const llvm
 	impl.add(op);
 	impl.decorate_relaxed_precision(instruction->getType(), op->id, false);
 
-	bool precise = instruction->hasMetadata("dx.precise") || impl.options.force_precise;
+	bool precise = impl.instruction_is_precise(instruction);
 	if (precise)
 		impl.builder().addDecoration(op->id, spv::DecorationNoContraction);
 
@@ -514,7 +515,7 @@ bool emit_dot2_add_half_instruction(Converter::Impl &impl, const llvm::CallInst
 	bs[0] = impl.get_id_for_value(instruction->getOperand(4));
 	bs[1] = impl.get_id_for_value(instruction->getOperand(5));
 
-	bool precise = instruction->hasMetadata("dx.precise") || impl.options.force_precise;
+	bool precise = impl.instruction_is_precise(instruction);
 
 	// V_DOT2C_F32_F16 is emitted on native drivers, and based on some reversing, the behavior is
 	// acc = (float(a.x * b.x) + float(a.y * b.y)) + acc
@@ -760,4 +761,158 @@ bool emit_msad_instruction(Converter::Impl &impl, const llvm::CallInst *instruct
 	return true;
 }
 
+static bool get_constant_u32(const llvm::Value *value, uint32_t *result)
+{
+	auto *c = llvm::dyn_cast<llvm::ConstantInt>(value);
+	if (!c || c->getType()->getIntegerBitWidth() != 32)
+		return false;
+	*result = uint32_t(c->getUniqueInteger().getZExtValue());
+	return true;
+}
+
+static bool get_constant_f32(const llvm::Value *value, float *result)
+{
+	auto *c = llvm::dyn_cast<llvm::ConstantFP>(value);
+	if (!c || c->getType()->getTypeID() != llvm::Type::TypeID::FloatTyID)
+		return false;
+	*result = c->getValueAPF().convertToFloat();
+	return true;
+}
+
+static bool get_constant_u32_operands(const llvm::CallInst *instruction, unsigned count, uint32_t *values)
+{
+	for (unsigned i = 0; i < count; i++)
+		if (!get_constant_u32(instruction->getOperand(1 + i), &values[i]))
+			return false;
+	return true;
+}
+
+static bool get_constant_f32_operands(const llvm::CallInst *instruction, unsigned count, float *values)
+{
+	for (unsigned i = 0; i < count; i++)
+		if (!get_constant_f32(instruction->getOperand(1 + i), &values[i]))
+			return false;
+	return true;
+}
+
+static uint32_t fold_bitfield_width(uint32_t width, uint32_t offset)
+{
+	// Same masking and clamping as clamp_bitfield_width().
+	width &= 31;
+	offset &= 31;
+	return width < 32 - offset ? width : 32 - offset;
+}
+
+bool fold_constant_arithmetic_instruction(DXIL::Op opcode, Converter::Impl &impl, const llvm::CallInst *instruction)
+{
+	auto &builder = impl.builder();
+	auto *type = instruction->getType();
+	bool is_u32 = type->getTypeID() == llvm::Type::TypeID::IntegerTyID && type->getIntegerBitWidth() == 32;
+	bool is_f32 = type->getTypeID() == llvm::Type::TypeID::FloatTyID;
+
+	// Only deal with plain 32-bit scalars. Min-precision and 64-bit types are left to the regular path.
+	if (!is_u32 && !is_f32)
+		return false;
+
+	uint32_t u[4];
+	float f[8];
+	spv::Id result_id = 0;
+
+	switch (opcode)
+	{
+	case DXIL::Op::IMad:
+	case DXIL::Op::UMad:
+		// Wrapping behavior is the same for signed and unsigned.
+		if (is_u32 && get_constant_u32_operands(instruction, 3, u))
+			result_id = builder.makeUintConstant(u[0] * u[1] + u[2]);
+		break;
+
+	case DXIL::Op::FMad:
+		// Non-precise FMad is emitted as GLSL.std.450 Fma, so fold it with a single rounding.
+		if (is_f32 && get_constant_f32_operands(instruction, 3, f))
+			result_id = builder.makeFloatConstant(fmaf(f[0], f[1], f[2]));
+		break;
+
+	case DXIL::Op::Dot2:
+	case DXIL::Op::Dot3:
+	case DXIL::Op::Dot4:
+	{
+		unsigned dimensions = 2 + unsigned(opcode) - unsigned(DXIL::Op::Dot2);
+		if (is_f32 && get_constant_f32_operands(instruction, 2 * dimensions, f))
+		{
+			float sum = f[0] * f[dimensions];
+			for (unsigned i = 1; i < dimensions; i++)
+			{
+				float mul = f[i] * f[i + dimensions];
+				sum += mul;
+			}
+			result_id = builder.makeFloatConstant(sum);
+		}
+		break;
+	}
+
+	case DXIL::Op::Ubfe:
+	case DXIL::Op::Ibfe:
+		if (is_u32 && get_constant_u32_operands(instruction, 3, u))
+		{
+			uint32_t width = fold_bitfield_width(u[0], u[1]);
+			uint32_t offset = u[1] & 31;
+			uint32_t value = 0;
+
+			if (width != 0 && opcode == DXIL::Op::Ubfe)
+				value = (u[2] >> offset) & ((1u << width) - 1u);
+			else if (width != 0)
+				value = uint32_t(int32_t(u[2] << (32 - width - offset)) >> (32 - width));
+
+			result_id = builder.makeUintConstant(value);
+		}
+		break;
+
+	case DXIL::Op::Bfi:
+		if (is_u32 && get_constant_u32_operands(instruction, 4, u))
+		{
+			uint32_t width = fold_bitfield_width(u[0], u[1]);
+			uint32_t offset = u[1] & 31;
+			uint32_t mask = ((1u << width) - 1u) << offset;
+			result_id = builder.makeUintConstant((u[3] & ~mask) | ((u[2] << offset) & mask));
+		}
+		break;
+
+	case DXIL::Op::Countbits:
+		if (is_u32 && get_constant_u32_operands(instruction, 1, u))
+		{
+			uint32_t count = 0;
+			for (uint32_t v = u[0]; v; v &= v - 1)
+				count++;
+			result_id = builder.makeUintConstant(count);
+		}
+		break;
+
+	case DXIL::Op::Bfrev:
+		if (is_u32 && get_constant_u32_operands(instruction, 1, u))
+		{
+			uint32_t reversed = 0;
+			for (unsigned i = 0; i < 32; i++)
+				if (u[0] & (1u << i))
+					reversed |= 1u << (31 - i);
+			result_id = builder.makeUintConstant(reversed);
+		}
+		break;
+
+	case DXIL::Op::LegacyF16ToF32:
+		if (is_f32 && get_constant_u32_operands(instruction, 1, u))
+			result_id = builder.makeFloatConstant(half_to_float(uint16_t(u[0] & 0xffffu)));
+		break;
+
+	default:
+		break;
+	}
+
+	if (!result_id)
+		return false;
+
+	impl.rewrite_value(instruction, result_id);
+	return true;
+}
+
 } // namespace dxil_spv
@@ -53,6 +53,10 @@ bool emit_legacy_f32_to_f16_instruction(Converter::Impl &impl, const llvm::CallI
 
 bool emit_bitcast_instruction(Converter::Impl &impl, const llvm::CallInst *instruction);
 
+// Evaluates arithmetic opcodes with all-constant operands at conversion time.
+// Returns false if the instruction must be emitted normally.
+bool fold_constant_arithmetic_instruction(DXIL::Op opcode, Converter::Impl &impl, const llvm::CallInst *instruction);
+
 template <GLSLstd450 opcode>
 static inline bool emit_find_high_bit_dispatch(Converter::Impl &impl, const llvm::CallInst *instruction)
 {
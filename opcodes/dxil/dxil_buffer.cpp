@@ -24,6 +24,7 @@
 
 #include "dxil_buffer.hpp"
 #include "dxil_common.hpp"
+#include "dxil_resources.hpp"
 #include "dxil_sampling.hpp"
 #include "dxil_ags.hpp"
 #include "logging.hpp"
@@ -421,6 +422,33 @@ static spv::Id build_vectorized_physical_load_store_access(Converter::Impl &impl
 		return 0;
 }
 
+static uint32_t infer_physical_load_store_alignment(Converter::Impl &impl, const llvm::CallInst *instruction,
+                                                    uint32_t alignment)
+{
+	// Anything beyond 16 bytes does not enable wider accesses.
+	uint32_t base_alignment = std::min<uint32_t>(impl.options.physical_address_alignment, 16);
+	base_alignment &= -base_alignment;
+	if (base_alignment <= alignment)
+		return alignment;
+
+	spv::Id ptr_id = impl.get_id_for_value(instruction->getOperand(1));
+	const auto &meta = impl.handle_to_resource_meta[ptr_id];
+
+	// Address is base + index * stride + offset for structured, and base + offset for raw.
+	uint32_t inferred;
+	if (meta.stride)
+	{
+		uint32_t stride_alignment = std::min<uint32_t>(meta.stride & -meta.stride, base_alignment);
+		inferred = std::min<uint32_t>(
+			base_alignment, stride_alignment * get_known_alignment(instruction->getOperand(2), base_alignment));
+		inferred = std::min<uint32_t>(inferred, get_known_alignment(instruction->getOperand(3), base_alignment));
+	}
+	else
+		inferred = get_known_alignment(instruction->getOperand(2), base_alignment);
+
+	return std::max<uint32_t>(alignment, inferred);
+}
+
 static bool emit_physical_buffer_load_instruction(Converter::Impl &impl, const llvm::CallInst *instruction,
                                                   const Converter::Impl::PhysicalPointerMeta &ptr_meta,
                                                   uint32_t mask = 0, uint32_t alignment = 0)
@@ -431,6 +459,7 @@ static bool emit_physical_buffer_load_instruction(Converter::Impl &impl, const l
 		return false;
 	if (alignment == 0 && !get_constant_operand(instruction, 5, &alignment))
 		return false;
+	alignment = infer_physical_load_store_alignment(impl, instruction, alignment);
 
 	unsigned vecsize = 0;
 	if (mask == 1)
@@ -560,9 +589,8 @@ bool emit_buffer_load_instruction(Converter::Impl &impl, const llvm::CallInst *i
 			return false;
 		}
 
-		// We don't know more about alignment in SM 5.1 BufferStore.
-		// We know the type must be 32-bit however ...
-		// Might be possible to do some fancy analysis to deduce a better alignment.
+		// SM 5.1 BufferLoad carries no alignment, but the type must be 32-bit.
+		// Anything better is inferred from the address arithmetic.
 
 		return emit_physical_buffer_load_instruction(impl, instruction, meta.physical_pointer_meta,
 		                                             smeared_access_mask, 4);
@@ -855,6 +883,7 @@ static bool emit_physical_buffer_store_instruction(Converter::Impl &impl, const
 
 	if (alignment == 0 && !get_constant_operand(instruction, 9, &alignment))
 		return false;
+	alignment = infer_physical_load_store_alignment(impl, instruction, alignment);
 
 	unsigned vecsize = 0;
 	if (mask == 1)
@@ -934,9 +963,19 @@ static bool emit_physical_buffer_store_instruction(Converter::Impl &impl, const
 
 bool emit_raw_buffer_load_instruction(Converter::Impl &impl, const llvm::CallInst *instruction)
 {
-	if (!impl.composite_is_accessed(instruction))
+	auto composite_itr = impl.llvm_composite_meta.find(instruction);
+	if (composite_itr == impl.llvm_composite_meta.end())
 		return true;
 
+	// Folded into an earlier, wider load. Consumers extract from that load directly.
+	if (composite_itr->second.coalesced_load)
+		return true;
+
+	// Physical loads take the component count from the mask operand, so widen it explicitly.
+	uint32_t coalesced_mask = 0;
+	if (composite_itr->second.coalesced_width)
+		coalesced_mask = (1u << composite_itr->second.coalesced_width) - 1u;
+
 	spv::Id ptr_id = impl.get_id_for_value(instruction->getOperand(1));
 	const auto &meta = impl.handle_to_resource_meta[ptr_id];
 
@@ -956,7 +995,7 @@ bool emit_raw_buffer_load_instruction(Converter::Impl &impl, const llvm::CallIns
 		return emit_buffer_load_instruction(impl, instruction);
 	}
 	else
-		return emit_physical_buffer_load_instruction(impl, instruction, meta.physical_pointer_meta);
+		return emit_physical_buffer_load_instruction(impl, instruction, meta.physical_pointer_meta, coalesced_mask);
 }
 
 bool emit_buffer_store_instruction(Converter::Impl &impl, const llvm::CallInst *instruction)
@@ -976,9 +1015,8 @@ bool emit_buffer_store_instruction(Converter::Impl &impl, const llvm::CallInst *
 
 	if (meta.storage == spv::StorageClassPhysicalStorageBuffer)
 	{
-		// We don't more about alignment in SM 5.1 BufferStore.
-		// We know the type must be 32-bit however ...
-		// Might be possible to do some fancy analysis to deduce a better alignment.
+		// SM 5.1 BufferStore carries no alignment, but the type must be 32-bit.
+		// Anything better is inferred from the address arithmetic.
 		return emit_physical_buffer_store_instruction(impl, instruction, meta.physical_pointer_meta, 4);
 	}
 
@@ -1221,6 +1259,13 @@ static spv::Id emit_atomic_access_chain(Converter::Impl &impl,
 	return counter_ptr_op->id;
 }
 
+static bool atomic_can_aggregate_in_subgroup(Converter::Impl &impl, const Converter::Impl::ResourceMeta &meta)
+{
+	// Helper lanes do not perform atomics, so an elected helper lane would drop the update for everyone.
+	return impl.options.wave_aggregated_atomics && !meta.non_uniform &&
+	       impl.execution_model != spv::ExecutionModelFragment;
+}
+
 bool emit_atomic_binop_instruction(Converter::Impl &impl, const llvm::CallInst *instruction)
 {
 	auto &builder = impl.builder();
@@ -1263,6 +1308,25 @@ bool emit_atomic_binop_instruction(Converter::Impl &impl, const llvm::CallInst *
 	if (meta.non_uniform)
 		builder.addDecoration(counter_ptr_id, spv::DecorationNonUniformEXT);
 
+	// InterlockedAdd on a uniform address. Only physical pointers can be passed to the helper by value.
+	if (binop == DXIL::AtomicBinOp::IAdd && meta.storage == spv::StorageClassPhysicalStorageBuffer &&
+	    component_type == DXIL::ComponentType::U32 && atomic_can_aggregate_in_subgroup(impl, meta) &&
+	    value_is_dynamically_uniform(impl, instruction->getOperand(3)) &&
+	    value_is_dynamically_uniform(impl, instruction->getOperand(4)) &&
+	    value_is_dynamically_uniform(impl, instruction->getOperand(5)))
+	{
+		spv::Id func_id = impl.spirv_module.get_helper_call_id(HelperCall::AggregatedPhysicalAtomicIAdd);
+		auto *op = impl.allocate(spv::OpFunctionCall, instruction, builder.makeUintType(32));
+		op->add_id(func_id);
+		op->add_id(counter_ptr_id);
+		op->add_id(impl.fixup_store_type_atomic(component_type, 1, impl.get_id_for_value(instruction->getOperand(6))));
+		op->add_id(builder.makeUintConstant(0));
+		impl.add(op, meta.rov);
+
+		impl.fixup_load_type_atomic(component_type, 1, instruction);
+		return true;
+	}
+
 	spv::Op opcode;
 
 	switch (binop)
@@ -1568,7 +1632,20 @@ bool emit_buffer_update_counter_instruction(Converter::Impl &impl, const llvm::C
 	const auto &meta = impl.handle_to_resource_meta[image_id];
 	int direction = llvm::cast<llvm::ConstantInt>(instruction->getOperand(2))->getUniqueInteger().getSExtValue();
 
-	if (meta.counter_is_physical_pointer)
+	if (atomic_can_aggregate_in_subgroup(impl, meta))
+	{
+		// The counter is a single element, so the address is uniform as long as the descriptor is.
+		spv::Id func_id = impl.spirv_module.get_helper_call_id(meta.counter_is_physical_pointer ?
+		                                                       HelperCall::AggregatedRobustAtomicCounter :
+		                                                       HelperCall::AggregatedAtomicCounter);
+		auto *op = impl.allocate(spv::OpFunctionCall, instruction);
+		op->add_id(func_id);
+		op->add_id(meta.counter_var_id);
+		op->add_id(builder.makeUintConstant(direction));
+		op->add_id(builder.makeUintConstant(direction < 0 ? -1u : 0u));
+		impl.add(op, meta.rov);
+	}
+	else if (meta.counter_is_physical_pointer)
 	{
 		spv::Id func_id = impl.spirv_module.get_helper_call_id(HelperCall::RobustAtomicCounter);
 		auto *op = impl.allocate(spv::OpFunctionCall, instruction);
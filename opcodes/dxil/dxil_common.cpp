@@ -26,6 +26,8 @@
 #include "logging.hpp"
 #include "opcodes/converter_impl.hpp"
 #include "spirv_module.hpp"
+#include <algorithm>
+#include <string.h>
 
 namespace dxil_spv
 {
@@ -48,6 +50,33 @@ bool get_constant_operand(const llvm::CallInst *value, unsigned index, uint32_t
 	return true;
 }
 
+bool get_dxil_opcode(const llvm::CallInst *value, uint32_t *opcode)
+{
+#ifdef HAVE_LLVMBC
+	if (value->get_constant_opcode(opcode))
+		return true;
+#endif
+	return get_constant_operand(value, 0, opcode);
+}
+
+bool is_dxil_op_callee(const llvm::Function *func)
+{
+#ifdef HAVE_LLVMBC
+	return func->get_callee_kind() == llvm::Function::CalleeKind::DXILOp;
+#else
+	return strncmp(func->getName().data(), "dx.op", 5) == 0;
+#endif
+}
+
+bool is_llvm_intrinsic_callee(const llvm::Function *func)
+{
+#ifdef HAVE_LLVMBC
+	return func->get_callee_kind() == llvm::Function::CalleeKind::LLVMIntrinsic;
+#else
+	return strncmp(func->getName().data(), "llvm.", 5) == 0;
+#endif
+}
+
 spv::Id emit_u32x2_u32_add(Converter::Impl &impl, spv::Id u32x2_value, spv::Id u32_value)
 {
 	auto &builder = impl.builder();
@@ -146,6 +175,96 @@ bool type_is_64bit(const llvm::Type *data_type)
 	        data_type->getIntegerBitWidth() == 64);
 }
 
+bool float_to_exact_fp16(float value, uint16_t *bits)
+{
+	uint32_t word;
+	memcpy(&word, &value, sizeof(word));
+
+	auto sign = uint16_t((word >> 16) & 0x8000u);
+	uint32_t exponent = (word >> 23) & 0xffu;
+	uint32_t mantissa = word & 0x7fffffu;
+
+	if (exponent == 0 || exponent == 0xff)
+	{
+		// Zero and infinity. FP32 denormals are far below FP16 range, and leave NaN payloads alone.
+		if (mantissa != 0)
+			return false;
+		*bits = uint16_t(sign | (exponent ? 0x7c00u : 0u));
+		return true;
+	}
+
+	int e = int(exponent) - 127;
+	if (e > 15 || e < -24)
+		return false;
+
+	if (e >= -14)
+	{
+		if ((mantissa & 0x1fffu) != 0)
+			return false;
+		*bits = uint16_t(sign | (uint32_t(e + 15) << 10) | (mantissa >> 13));
+		return true;
+	}
+
+	// FP16 denormal, in units of 2^-24.
+	uint32_t significand = mantissa | 0x800000u;
+	unsigned shift = unsigned(-e - 1);
+	if ((significand & ((1u << shift) - 1u)) != 0)
+		return false;
+	*bits = uint16_t(sign | (significand >> shift));
+	return true;
+}
+
+float half_to_float(uint16_t u16_value)
+{
+	// Based on the GLM implementation.
+	int s = (u16_value >> 15) & 0x1;
+	int e = (u16_value >> 10) & 0x1f;
+	int m = (u16_value >> 0) & 0x3ff;
+
+	union {
+		float f32;
+		uint32_t u32;
+	} u;
+
+	if (e == 0)
+	{
+		if (m == 0)
+		{
+			u.u32 = uint32_t(s) << 31;
+			return u.f32;
+		}
+		else
+		{
+			while ((m & 0x400) == 0)
+			{
+				m <<= 1;
+				e--;
+			}
+
+			e++;
+			m &= ~0x400;
+		}
+	}
+	else if (e == 31)
+	{
+		if (m == 0)
+		{
+			u.u32 = (uint32_t(s) << 31) | 0x7f800000u;
+			return u.f32;
+		}
+		else
+		{
+			u.u32 = (uint32_t(s) << 31) | 0x7f800000u | (m << 13);
+			return u.f32;
+		}
+	}
+
+	e += 127 - 15;
+	m <<= 13;
+	u.u32 = (uint32_t(s) << 31) | (e << 23) | m;
+	return u.f32;
+}
+
 void get_physical_load_store_cast_info(Converter::Impl &impl, const llvm::Type *element_type,
                                        spv::Id &physical_type_id, spv::Op &value_cast_op)
 {
@@ -318,6 +437,73 @@ bool extract_raw_buffer_access_split(const llvm::Value *index, unsigned stride,
 		return false;
 }
 
+static uint32_t get_known_trailing_zeros(const llvm::Value *value, uint32_t max_bits, unsigned depth)
+{
+	if (const auto *const_value = llvm::dyn_cast<llvm::ConstantInt>(value))
+	{
+		uint64_t v = const_value->getUniqueInteger().getZExtValue();
+		uint32_t bits = 0;
+		while (bits < max_bits && (v & (1ull << bits)) == 0)
+			bits++;
+		return bits;
+	}
+
+	// Don't chase arbitrarily deep expression trees.
+	if (depth == 0)
+		return 0;
+	depth--;
+
+	if (const auto *select = llvm::dyn_cast<llvm::SelectInst>(value))
+	{
+		return std::min<uint32_t>(get_known_trailing_zeros(select->getOperand(1), max_bits, depth),
+		                          get_known_trailing_zeros(select->getOperand(2), max_bits, depth));
+	}
+
+	const auto *binop = llvm::dyn_cast<llvm::BinaryOperator>(value);
+	if (!binop)
+		return 0;
+
+	auto *lhs = binop->getOperand(0);
+	auto *rhs = binop->getOperand(1);
+
+	switch (binop->getOpcode())
+	{
+	case llvm::BinaryOperator::BinaryOps::Add:
+	case llvm::BinaryOperator::BinaryOps::Sub:
+	case llvm::BinaryOperator::BinaryOps::Or:
+	case llvm::BinaryOperator::BinaryOps::Xor:
+		return std::min<uint32_t>(get_known_trailing_zeros(lhs, max_bits, depth),
+		                          get_known_trailing_zeros(rhs, max_bits, depth));
+
+	case llvm::BinaryOperator::BinaryOps::And:
+		return std::max<uint32_t>(get_known_trailing_zeros(lhs, max_bits, depth),
+		                          get_known_trailing_zeros(rhs, max_bits, depth));
+
+	case llvm::BinaryOperator::BinaryOps::Mul:
+		return std::min<uint32_t>(get_known_trailing_zeros(lhs, max_bits, depth) +
+		                          get_known_trailing_zeros(rhs, max_bits, depth), max_bits);
+
+	case llvm::BinaryOperator::BinaryOps::Shl:
+		if (const auto *shamt = llvm::dyn_cast<llvm::ConstantInt>(rhs))
+		{
+			uint64_t shift = std::min<uint64_t>(shamt->getUniqueInteger().getZExtValue(), max_bits);
+			return std::min<uint32_t>(get_known_trailing_zeros(lhs, max_bits, depth) + uint32_t(shift), max_bits);
+		}
+		return 0;
+
+	default:
+		return 0;
+	}
+}
+
+uint32_t get_known_alignment(const llvm::Value *value, uint32_t max_alignment)
+{
+	uint32_t max_bits = 0;
+	while ((2u << max_bits) <= max_alignment)
+		max_bits++;
+	return 1u << get_known_trailing_zeros(value, max_bits, 8);
+}
+
 spv::Id build_index_divider(Converter::Impl &impl, const llvm::Value *offset,
                             unsigned addr_shift_log2, unsigned vecsize)
 {
@@ -504,12 +690,12 @@ bool value_is_dx_op_instrinsic(const llvm::Value *value, DXIL::Op op)
 		return false;
 
 	auto *func = call->getCalledFunction();
-	if (strncmp(func->getName().data(), "dx.op", 5) != 0)
+	if (!is_dxil_op_callee(func))
 		return false;
 
 	// The opcode is encoded as a constant integer.
 	uint32_t opcode;
-	if (!get_constant_operand(call, 0, &opcode))
+	if (!get_dxil_opcode(call, &opcode))
 		return false;
 
 	return op == DXIL::Op(opcode);
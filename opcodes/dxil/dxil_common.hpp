@@ -30,6 +30,11 @@
 namespace dxil_spv
 {
 bool get_constant_operand(const llvm::CallInst *value, unsigned index, uint32_t *operand);
+// Operand 0 of dx.op intrinsics. Cached at parse time when possible.
+bool get_dxil_opcode(const llvm::CallInst *value, uint32_t *opcode);
+// Callee classification. Cached on the function at parse time when possible.
+bool is_dxil_op_callee(const llvm::Function *func);
+bool is_llvm_intrinsic_callee(const llvm::Function *func);
 spv::Id emit_u32x2_u32_add(Converter::Impl &impl, spv::Id u32x2_value, spv::Id u32_value);
 unsigned get_type_scalar_alignment(Converter::Impl &impl, const llvm::Type *type);
 
@@ -38,6 +43,9 @@ spv::Id get_buffer_alias_handle(Converter::Impl &impl, const Converter::Impl::Re
 
 bool type_is_16bit(const llvm::Type *data_type);
 bool type_is_64bit(const llvm::Type *data_type);
+// Succeeds if value converts to FP16 without rounding.
+bool float_to_exact_fp16(float value, uint16_t *bits);
+float half_to_float(uint16_t u16_value);
 
 void get_physical_load_store_cast_info(Converter::Impl &impl, const llvm::Type *element_type,
                                        spv::Id &physical_type_id, spv::Op &value_cast_op);
@@ -53,6 +61,9 @@ bool extract_raw_buffer_access_split(const llvm::Value *index, unsigned stride,
 									 uint32_t addr_shift_log2, unsigned vecsize,
 									 RawBufferAccessSplit &split);
 
+// Largest power-of-two which provably divides an integer expression, up to max_alignment.
+uint32_t get_known_alignment(const llvm::Value *value, uint32_t max_alignment);
+
 spv::Id build_index_divider(Converter::Impl &impl, const llvm::Value *offset,
                             unsigned addr_shift_log2, unsigned vecsize);
 
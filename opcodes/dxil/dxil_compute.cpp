@@ -63,11 +63,53 @@ bool emit_barrier_instruction(Converter::Impl &impl, const llvm::CallInst *instr
 	return true;
 }
 
+static spv::Id build_constant_multiply(Converter::Impl &impl, spv::Id value_id, uint32_t factor)
+{
+	auto &builder = impl.builder();
+	if (factor == 0)
+		return builder.makeUintConstant(0);
+	if (factor == 1)
+		return value_id;
+
+	bool is_pot = (factor & (factor - 1)) == 0;
+	uint32_t shift = 0;
+	while (is_pot && (1u << shift) != factor)
+		shift++;
+
+	auto *op = impl.allocate(is_pot ? spv::OpShiftLeftLogical : spv::OpIMul, builder.makeUintType(32));
+	op->add_id(value_id);
+	op->add_id(builder.makeUintConstant(is_pot ? shift : factor));
+	impl.add(op);
+	return op->id;
+}
+
+static spv::Id build_add(Converter::Impl &impl, spv::Id a, spv::Id b)
+{
+	auto *op = impl.allocate(spv::OpIAdd, impl.builder().makeUintType(32));
+	op->add_id(a);
+	op->add_id(b);
+	impl.add(op);
+	return op->id;
+}
+
 static bool emit_thread_2d_quad_fixup_instruction(spv::BuiltIn builtin, Converter::Impl &impl,
                                                   const llvm::CallInst *instruction, uint32_t component)
 {
 	// We have to compute everything from scratch. Sigh ... <_>
+	// The workgroup was reshaped from (W, H, D) to (2W, H / 2, D), so every 4 threads along X form a 2x2 quad.
+	// The shape is known here, so only emit what that shape needs.
 	auto &builder = impl.builder();
+	const auto &threads = impl.execution_mode_meta.workgroup_threads;
+
+	// With W = 2, quads are simply stacked along Y, so the flattened index is not affected at all.
+	if (builtin == spv::BuiltInLocalInvocationIndex && threads[0] == 4)
+	{
+		auto *load_op = impl.allocate(spv::OpLoad, instruction);
+		load_op->add_id(impl.spirv_module.get_builtin_shader_input(spv::BuiltInLocalInvocationIndex));
+		impl.add(load_op);
+		return true;
+	}
+
 	spv::Id local_thread_id = impl.spirv_module.get_builtin_shader_input(spv::BuiltInLocalInvocationId);
 
 	{
@@ -81,12 +123,13 @@ static bool emit_thread_2d_quad_fixup_instruction(spv::BuiltIn builtin, Converte
 	const bool require[3] = {
 		true,
 		component >= 1 || builtin == spv::BuiltInLocalInvocationIndex,
-		builtin == spv::BuiltInLocalInvocationIndex
+		builtin == spv::BuiltInLocalInvocationIndex && threads[2] > 1
 	};
 
 	for (unsigned i = 0; i < 3; i++)
 	{
-		if (require[i])
+		// If the reshaped group is one thread high, Y is always 0.
+		if (require[i] && (i != 1 || threads[1] > 1))
 		{
 			auto *extract_op = impl.allocate(spv::OpCompositeExtract, builder.makeUintType(32));
 			extract_op->add_id(local_thread_id);
@@ -105,16 +148,10 @@ static bool emit_thread_2d_quad_fixup_instruction(spv::BuiltIn builtin, Converte
 		x_part->add_id(builder.makeUintConstant(1));
 		impl.add(x_part);
 
-		auto *y_part = impl.allocate(spv::OpIMul, builder.makeUintType(32));
-		y_part->add_id(comp_ids[1]);
-		y_part->add_id(builder.makeUintConstant(2));
-		impl.add(y_part);
-
-		auto *add_part = impl.allocate(spv::OpIAdd, builder.makeUintType(32));
-		add_part->add_id(x_part->id);
-		add_part->add_id(y_part->id);
-		impl.add(add_part);
-		comp_ids[1] = add_part->id;
+		if (comp_ids[1])
+			comp_ids[1] = build_add(impl, x_part->id, build_constant_multiply(impl, comp_ids[1], 2));
+		else
+			comp_ids[1] = x_part->id;
 	}
 
 	{
@@ -124,47 +161,39 @@ static bool emit_thread_2d_quad_fixup_instruction(spv::BuiltIn builtin, Converte
 		and_op->add_id(builder.makeUintConstant(1));
 		impl.add(and_op);
 
-		auto *shift_down = impl.allocate(spv::OpShiftRightLogical, builder.makeUintType(32));
-		shift_down->add_id(comp_ids[0]);
-		shift_down->add_id(builder.makeUintConstant(2));
-		impl.add(shift_down);
-
-		auto *shift_up = impl.allocate(spv::OpShiftLeftLogical, builder.makeUintType(32));
-		shift_up->add_id(shift_down->id);
-		shift_up->add_id(builder.makeUintConstant(1));
-		impl.add(shift_up);
-
-		auto *or_op = impl.allocate(spv::OpBitwiseOr, builder.makeUintType(32));
-		or_op->add_id(and_op->id);
-		or_op->add_id(shift_up->id);
-		impl.add(or_op);
-
-		comp_ids[0] = or_op->id;
+		if (threads[0] == 4)
+		{
+			// There is only one quad along X.
+			comp_ids[0] = and_op->id;
+		}
+		else
+		{
+			auto *shift_down = impl.allocate(spv::OpShiftRightLogical, builder.makeUintType(32));
+			shift_down->add_id(comp_ids[0]);
+			shift_down->add_id(builder.makeUintConstant(2));
+			impl.add(shift_down);
+
+			auto *shift_up = impl.allocate(spv::OpShiftLeftLogical, builder.makeUintType(32));
+			shift_up->add_id(shift_down->id);
+			shift_up->add_id(builder.makeUintConstant(1));
+			impl.add(shift_up);
+
+			auto *or_op = impl.allocate(spv::OpBitwiseOr, builder.makeUintType(32));
+			or_op->add_id(and_op->id);
+			or_op->add_id(shift_up->id);
+			impl.add(or_op);
+
+			comp_ids[0] = or_op->id;
+		}
 	}
 
 	// Reconstruct the flattened index.
 	if (builtin == spv::BuiltInLocalInvocationIndex)
 	{
-		auto *y_base_op = impl.allocate(spv::OpIMul, builder.makeUintType(32));
-		y_base_op->add_id(comp_ids[1]);
-		y_base_op->add_id(builder.makeUintConstant(impl.execution_mode_meta.workgroup_threads[0] / 2));
-		impl.add(y_base_op);
-
-		auto *z_base_op = impl.allocate(spv::OpIMul, builder.makeUintType(32));
-		z_base_op->add_id(comp_ids[2]);
-		z_base_op->add_id(builder.makeUintConstant(
-			impl.execution_mode_meta.workgroup_threads[0] * impl.execution_mode_meta.workgroup_threads[1]));
-		impl.add(z_base_op);
-
-		auto *add_op = impl.allocate(spv::OpIAdd, builder.makeUintType(32));
-		add_op->add_id(y_base_op->id);
-		add_op->add_id(z_base_op->id);
-		impl.add(add_op);
-
-		auto *final_add_op = impl.allocate(spv::OpIAdd, instruction);
-		final_add_op->add_id(add_op->id);
-		final_add_op->add_id(comp_ids[0]);
-		impl.add(final_add_op);
+		spv::Id index_id = build_constant_multiply(impl, comp_ids[1], threads[0] / 2);
+		if (comp_ids[2])
+			index_id = build_add(impl, index_id, build_constant_multiply(impl, comp_ids[2], threads[0] * threads[1]));
+		impl.rewrite_value(instruction, build_add(impl, index_id, comp_ids[0]));
 	}
 	else if (builtin == spv::BuiltInLocalInvocationId)
 	{
@@ -183,20 +212,13 @@ static bool emit_thread_2d_quad_fixup_instruction(spv::BuiltIn builtin, Converte
 		load_wg->add_id(ptr_wg->id);
 		impl.add(load_wg);
 
-		auto *base_thread = impl.allocate(spv::OpIMul, builder.makeUintType(32));
-		base_thread->add_id(load_wg->id);
-
+		spv::Id base_thread_id;
 		if (component == 0)
-			base_thread->add_id(builder.makeUintConstant(impl.execution_mode_meta.workgroup_threads[component] / 2));
+			base_thread_id = build_constant_multiply(impl, load_wg->id, threads[component] / 2);
 		else // if (component == 1)
-			base_thread->add_id(builder.makeUintConstant(impl.execution_mode_meta.workgroup_threads[component] * 2));
-
-		impl.add(base_thread);
+			base_thread_id = build_constant_multiply(impl, load_wg->id, threads[component] * 2);
 
-		auto *final_add = impl.allocate(spv::OpIAdd, instruction);
-		final_add->add_id(base_thread->id);
-		final_add->add_id(comp_ids[component]);
-		impl.add(final_add);
+		impl.rewrite_value(instruction, build_add(impl, base_thread_id, comp_ids[component]));
 	}
 
 	return true;
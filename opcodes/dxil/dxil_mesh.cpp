@@ -82,6 +82,50 @@ bool emit_emit_indices_instruction(Converter::Impl &impl, const llvm::CallInst *
 	return true;
 }
 
+static const Converter::Impl::MeshOutputStoreGroup *get_mesh_output_store_group(Converter::Impl &impl,
+                                                                                 const llvm::CallInst *instruction,
+                                                                                 uint32_t num_cols)
+{
+	auto itr = impl.mesh_output_store_to_group.find(instruction);
+	if (itr == impl.mesh_output_store_to_group.end())
+		return nullptr;
+
+	// Only complete rows can be written with a single store.
+	auto &group = impl.mesh_output_store_groups[itr->second];
+	return group.count == num_cols ? &group : nullptr;
+}
+
+static void emit_mesh_output_row_store(Converter::Impl &impl, const llvm::CallInst *instruction,
+                                       const Converter::Impl::MeshOutputStoreGroup &group,
+                                       spv::Id var_id, spv::Id output_type_id, bool row_index,
+                                       DXIL::ComponentType component_type)
+{
+	// All stores in the group are deferred to the last one, by which point every value is available.
+	if (instruction != group.last_store)
+		return;
+
+	auto &builder = impl.builder();
+
+	spv::Id elements[4];
+	for (unsigned i = 0; i < group.count; i++)
+		elements[i] = impl.get_id_for_value(group.values[i]);
+
+	spv::Id store_value = impl.build_vector(impl.get_type_id(group.values[0]->getType()), elements, group.count);
+	store_value = impl.fixup_store_type_io(component_type, group.count, store_value);
+
+	Operation *op = impl.allocate(spv::OpAccessChain, builder.makePointer(spv::StorageClassOutput, output_type_id));
+	spv::Id ptr_id = op->id;
+	op->add_id(var_id);
+	op->add_id(impl.get_id_for_value(instruction->getOperand(5)));
+	if (row_index)
+		op->add_id(impl.get_id_for_value(instruction->getOperand(2)));
+	impl.add(op);
+
+	op = impl.allocate(spv::OpStore);
+	op->add_ids({ ptr_id, store_value });
+	impl.add(op);
+}
+
 bool emit_store_vertex_output_instruction(Converter::Impl &impl, const llvm::CallInst *instruction)
 {
 	// If we for some reason have max vertices 0 in the execution mode,
@@ -114,6 +158,12 @@ bool emit_store_vertex_output_instruction(Converter::Impl &impl, const llvm::Cal
 	}
 	uint32_t num_cols = builder.getNumTypeComponents(output_type_id);
 
+	if (auto *group = get_mesh_output_store_group(impl, instruction, num_cols))
+	{
+		emit_mesh_output_row_store(impl, instruction, *group, var_id, output_type_id, row_index, meta.component_type);
+		return true;
+	}
+
 	Operation *op = impl.allocate(
 			spv::OpAccessChain, builder.makePointer(spv::StorageClassOutput, builder.getScalarTypeId(output_type_id)));
 	ptr_id = op->id;
@@ -161,6 +211,12 @@ bool emit_store_primitive_output_instruction(Converter::Impl &impl, const llvm::
 	}
 	uint32_t num_cols = builder.getNumTypeComponents(output_type_id);
 
+	if (auto *group = get_mesh_output_store_group(impl, instruction, num_cols))
+	{
+		emit_mesh_output_row_store(impl, instruction, *group, var_id, output_type_id, row_index, meta.component_type);
+		return true;
+	}
+
 	spv::Id store_value = impl.fixup_store_type_io(meta.component_type, 1,
 	                                               impl.get_id_for_value(instruction->getOperand(4)));
 
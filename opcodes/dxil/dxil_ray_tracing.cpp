@@ -30,7 +30,58 @@
 
 namespace dxil_spv
 {
-static spv::Id emit_temp_storage_copy(Converter::Impl &impl, const llvm::Value *value, spv::StorageClass storage)
+static void emit_temp_storage_member_copies(Converter::Impl &impl, const llvm::Type *struct_type, uint64_t members,
+                                            spv::Id dst_id, spv::StorageClass dst_storage,
+                                            spv::Id src_id, spv::StorageClass src_storage)
+{
+	auto &builder = impl.builder();
+
+	for (unsigned i = 0; i < struct_type->getStructNumElements(); i++)
+	{
+		if ((members & (1ull << i)) == 0)
+			continue;
+
+		spv::Id member_type_id = impl.get_type_id(struct_type->getStructElementType(i));
+		spv::Id index_id = builder.makeUintConstant(i);
+
+		auto *src_chain = impl.allocate(spv::OpInBoundsAccessChain, builder.makePointer(src_storage, member_type_id));
+		src_chain->add_id(src_id);
+		src_chain->add_id(index_id);
+		impl.add(src_chain);
+
+		auto *load_op = impl.allocate(spv::OpLoad, member_type_id);
+		load_op->add_id(src_chain->id);
+		impl.add(load_op);
+
+		auto *dst_chain = impl.allocate(spv::OpInBoundsAccessChain, builder.makePointer(dst_storage, member_type_id));
+		dst_chain->add_id(dst_id);
+		dst_chain->add_id(index_id);
+		impl.add(dst_chain);
+
+		auto *store_op = impl.allocate(spv::OpStore);
+		store_op->add_id(dst_chain->id);
+		store_op->add_id(load_op->id);
+		impl.add(store_op);
+	}
+}
+
+static const Converter::Impl::PayloadCopyMasks *get_payload_copy_masks(Converter::Impl &impl,
+                                                                       const llvm::CallInst *inst,
+                                                                       const llvm::Value *value)
+{
+	// Only applies if the alloca is emitted with its plain LLVM type.
+	auto itr = impl.payload_copy_masks.find(inst);
+	if (itr == impl.payload_copy_masks.end() ||
+	    impl.llvm_value_actual_type.find(value) != impl.llvm_value_actual_type.end())
+	{
+		return nullptr;
+	}
+
+	return &itr->second;
+}
+
+static spv::Id emit_temp_storage_copy(Converter::Impl &impl, const llvm::CallInst *inst,
+                                      const llvm::Value *value, spv::StorageClass storage)
 {
 	// Make a new temporary variable for the ray payload/callable data.
 	auto *pointer_type = llvm::cast<llvm::PointerType>(value->getType());
@@ -38,6 +89,14 @@ static spv::Id emit_temp_storage_copy(Converter::Impl &impl, const llvm::Value *
 	spv::Id type_id = impl.get_type_id(pointee_type);
 	spv::Id var_id = impl.get_temp_payload(type_id, storage);
 
+	if (auto *masks = get_payload_copy_masks(impl, inst, value))
+	{
+		// Members which cannot be defined yet hold garbage either way.
+		emit_temp_storage_member_copies(impl, pointee_type, masks->copy_in, var_id, storage,
+		                                impl.get_id_for_value(value), spv::StorageClassFunction);
+		return var_id;
+	}
+
 	// Load the alloca'ed value
 	auto *load_op = impl.allocate(spv::OpLoad, type_id);
 	load_op->add_id(impl.get_id_for_value(value));
@@ -52,12 +111,22 @@ static spv::Id emit_temp_storage_copy(Converter::Impl &impl, const llvm::Value *
 	return var_id;
 }
 
-static void emit_temp_storage_resolve(Converter::Impl &impl, const llvm::Value *real_value, spv::Id temp_storage)
+static void emit_temp_storage_resolve(Converter::Impl &impl, const llvm::CallInst *inst,
+                                      const llvm::Value *real_value, spv::Id temp_storage, spv::StorageClass storage)
 {
 	auto *pointer_type = llvm::cast<llvm::PointerType>(real_value->getType());
 	auto *pointee_type = pointer_type->getPointerElementType();
 	spv::Id type_id = impl.get_type_id(pointee_type);
 
+	if (auto *masks = get_payload_copy_masks(impl, inst, real_value))
+	{
+		// Members which are never read again do not need to be written back.
+		emit_temp_storage_member_copies(impl, pointee_type, masks->copy_out,
+		                                impl.get_id_for_value(real_value), spv::StorageClassFunction,
+		                                temp_storage, storage);
+		return;
+	}
+
 	// Load the result from the temp
 	auto *load_op = impl.allocate(spv::OpLoad, type_id);
 	load_op->add_id(temp_storage);
@@ -99,7 +168,7 @@ bool emit_trace_ray_instruction(Converter::Impl &impl, const llvm::CallInst *ins
 
 	bool needs_temp_copy = impl.get_needs_temp_storage_copy(ray_payload);
 	spv::Id ray_payload_var_id = needs_temp_copy
-		? emit_temp_storage_copy(impl, ray_payload, spv::StorageClassRayPayloadKHR)
+		? emit_temp_storage_copy(impl, inst, ray_payload, spv::StorageClassRayPayloadKHR)
 		: impl.get_id_for_value(ray_payload);
 
 	auto *op = impl.allocate(spv::OpTraceRayKHR);
@@ -120,7 +189,7 @@ bool emit_trace_ray_instruction(Converter::Impl &impl, const llvm::CallInst *ins
 
 	// In this instance, the ray_payload_var_id is our temp.
 	if (needs_temp_copy)
-		emit_temp_storage_resolve(impl, ray_payload, ray_payload_var_id);
+		emit_temp_storage_resolve(impl, inst, ray_payload, ray_payload_var_id, spv::StorageClassRayPayloadKHR);
 
 	return true;
 }
@@ -254,7 +323,7 @@ bool emit_ray_tracing_call_shader(Converter::Impl &impl, const llvm::CallInst *i
 
 	bool needs_temp_copy = impl.get_needs_temp_storage_copy(callable_data);
 	spv::Id callable_data_var_id = impl.get_needs_temp_storage_copy(callable_data)
-		? emit_temp_storage_copy(impl, callable_data, spv::StorageClassCallableDataKHR)
+		? emit_temp_storage_copy(impl, inst, callable_data, spv::StorageClassCallableDataKHR)
 		: impl.get_id_for_value(callable_data);
 
 	auto *op = impl.allocate(spv::OpExecuteCallableKHR);
@@ -264,7 +333,7 @@ bool emit_ray_tracing_call_shader(Converter::Impl &impl, const llvm::CallInst *i
 
 	// In this instance, the callable_data_var_id is our temp.
 	if (needs_temp_copy)
-		emit_temp_storage_resolve(impl, callable_data, callable_data_var_id);
+		emit_temp_storage_resolve(impl, inst, callable_data, callable_data_var_id, spv::StorageClassCallableDataKHR);
 
 	return true;
 }
@@ -351,9 +420,9 @@ static bool ray_query_operand_is_alloca(Converter::Impl &impl, const llvm::Value
 	if (auto *alloca = llvm::dyn_cast<llvm::CallInst>(operand))
 	{
 		uint32_t op = 0;
-		if (!get_constant_operand(alloca, 0, &op))
+		if (!get_dxil_opcode(alloca, &op))
 			return false;
-		if (strncmp(alloca->getCalledFunction()->getName().data(), "dx.op", 5) != 0)
+		if (!is_dxil_op_callee(alloca->getCalledFunction()))
 			return false;
 		if (DXIL::Op(op) != DXIL::Op::AllocateRayQuery)
 			return false;
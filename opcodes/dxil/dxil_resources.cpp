@@ -335,6 +335,10 @@ bool emit_store_output_instruction(Converter::Impl &impl, const llvm::CallInst *
 			return true;
 	}
 
+	// The consumer stage never reads this element.
+	if (impl.stripped_output_elements.count(output_element_index))
+		return true;
+
 	const auto &meta = impl.output_elements_meta[output_element_index];
 
 	uint32_t var_id = meta.id;
@@ -460,6 +464,26 @@ static spv::Id build_bindless_heap_offset(Converter::Impl &impl,
 	return table_index_id;
 }
 
+static spv::Id build_sbt_descriptor_size_log2(Converter::Impl &impl, bool sampler)
+{
+	auto &builder = impl.builder();
+	unsigned shamt = sampler ? impl.options.sbt_descriptor_size_sampler_log2 :
+	                           impl.options.sbt_descriptor_size_srv_uav_cbv_log2;
+
+	if (!impl.options.sbt_descriptor_size_spec_constants)
+		return builder.makeUintConstant(shamt);
+
+	auto &id = sampler ? impl.sbt_descriptor_size_sampler_id : impl.sbt_descriptor_size_srv_uav_cbv_id;
+	if (!id)
+	{
+		id = builder.makeUintConstant(shamt, true);
+		builder.addDecoration(id, spv::DecorationSpecId,
+		                      sampler ? impl.options.sbt_descriptor_size_sampler_spec_id :
+		                                impl.options.sbt_descriptor_size_srv_uav_cbv_spec_id);
+	}
+	return id;
+}
+
 static spv::Id build_bindless_heap_offset_shader_record(Converter::Impl &impl, const Converter::Impl::ResourceReference &reference,
                                                         const llvm::Value *dynamic_offset)
 {
@@ -481,9 +505,7 @@ static spv::Id build_bindless_heap_offset_shader_record(Converter::Impl &impl, c
 	shifted_word->add_id(loaded_word->id);
 
 	// Need to translate fake GPU VA to index.
-	unsigned shamt = reference.resource_kind == DXIL::ResourceKind::Sampler ?
-	    impl.options.sbt_descriptor_size_sampler_log2 : impl.options.sbt_descriptor_size_srv_uav_cbv_log2;
-	shifted_word->add_id(builder.makeUintConstant(shamt));
+	shifted_word->add_id(build_sbt_descriptor_size_log2(impl, reference.resource_kind == DXIL::ResourceKind::Sampler));
 	impl.add(shifted_word);
 	loaded_word = shifted_word;
 
@@ -561,11 +583,65 @@ static spv::Id build_descriptor_heap_robustness(Converter::Impl &impl, spv::Id o
 	return clamp_op->id;
 }
 
+static bool heap_offset_is_uniform(Converter::Impl &impl,
+                                   const Converter::Impl::ResourceReference &reference,
+                                   const llvm::Value *dynamic_offset)
+{
+	// Anything indexed through the SBT is never uniform.
+	if (!impl.options.uniformity_analysis || reference.local_root_signature_entry >= 0)
+		return false;
+	if (dynamic_offset && !value_is_dynamically_uniform(impl, dynamic_offset))
+		return false;
+
+	if (impl.uniform_heap_offsets_block != impl.current_block)
+	{
+		impl.uniform_heap_offsets.clear();
+		impl.uniform_heap_offsets_block = impl.current_block;
+	}
+
+	return true;
+}
+
+static bool heap_offset_is_cacheable(Converter::Impl &impl,
+                                     const Converter::Impl::ResourceReference &reference,
+                                     const llvm::Value *dynamic_offset)
+{
+	// Within a block, the same reference and index always yields the same offset for a given invocation,
+	// uniform or not. With QA deduplication, that means the check is redundant as well.
+	// The cache is not keyed on SBT entries, so leave those alone.
+	if (impl.options.descriptor_qa_enabled && impl.options.descriptor_qa_deduplicate &&
+	    reference.local_root_signature_entry < 0)
+	{
+		if (impl.uniform_heap_offsets_block != impl.current_block)
+		{
+			impl.uniform_heap_offsets.clear();
+			impl.uniform_heap_offsets_block = impl.current_block;
+		}
+		return true;
+	}
+
+	return heap_offset_is_uniform(impl, reference, dynamic_offset);
+}
+
 static spv::Id build_bindless_heap_offset(Converter::Impl &impl,
                                           const Converter::Impl::ResourceReference &reference,
                                           DescriptorQATypeFlags type,
                                           const llvm::Value *dynamic_offset)
 {
+	// The same uniform index within a block only needs to be computed and checked once.
+	bool is_cached = heap_offset_is_cacheable(impl, reference, dynamic_offset);
+	if (is_cached)
+	{
+		for (auto &cached : impl.uniform_heap_offsets[dynamic_offset])
+		{
+			if (cached.push_constant_member == reference.push_constant_member &&
+			    cached.base_offset == reference.base_offset && cached.type == uint32_t(type))
+			{
+				return cached.offset_id;
+			}
+		}
+	}
+
 	spv::Id offset_id;
 	if (reference.local_root_signature_entry >= 0)
 		offset_id = build_bindless_heap_offset_shader_record(impl, reference, dynamic_offset);
@@ -586,6 +662,12 @@ static spv::Id build_bindless_heap_offset(Converter::Impl &impl,
 	else if (type != DESCRIPTOR_QA_TYPE_SAMPLER_BIT && dynamic_offset && impl.descriptor_heap_robustness_var_id)
 		offset_id = build_descriptor_heap_robustness(impl, offset_id);
 
+	if (is_cached && offset_id)
+	{
+		impl.uniform_heap_offsets[dynamic_offset].push_back(
+		    { reference.push_constant_member, reference.base_offset, uint32_t(type), offset_id });
+	}
+
 	return offset_id;
 }
 
@@ -1017,6 +1099,14 @@ static bool emit_create_handle(Converter::Impl &impl, const llvm::CallInst *inst
                                llvm::Value *instruction_offset, bool non_uniform)
 {
 	auto &builder = impl.builder();
+
+	// NonUniformResourceIndex() on an index which is provably uniform anyway.
+	if (non_uniform && instruction_offset && impl.options.uniformity_analysis &&
+	    value_is_dynamically_uniform(impl, instruction_offset))
+	{
+		non_uniform = false;
+	}
+
 	switch (resource_type)
 	{
 	case DXIL::ResourceType::SRV:
@@ -1486,7 +1576,7 @@ bool get_annotate_handle_meta(Converter::Impl &impl, const llvm::CallInst *instr
 		return false;
 
 	uint32_t opcode;
-	if (!get_constant_operand(handle, 0, &opcode))
+	if (!get_dxil_opcode(handle, &opcode))
 		return false;
 
 	meta.resource_op = DXIL::Op(opcode);
@@ -1748,6 +1838,20 @@ static bool emit_cbuffer_load_physical_pointer(Converter::Impl &impl, const llvm
 	return true;
 }
 
+static bool get_known_root_constant_word(const Converter::Impl &impl, unsigned member, uint32_t &value)
+{
+	// Root descriptors are placed before root constants in the push constant block.
+	if (member < impl.root_descriptor_count)
+		return false;
+
+	auto itr = impl.options.known_root_constants.find(member - impl.root_descriptor_count);
+	if (itr == impl.options.known_root_constants.end())
+		return false;
+
+	value = itr->second;
+	return true;
+}
+
 static bool emit_cbuffer_load_from_uints(Converter::Impl &impl, const llvm::CallInst *instruction,
                                          spv::Id base_ptr,
                                          spv::StorageClass storage,
@@ -1811,10 +1915,18 @@ static bool emit_cbuffer_load_from_uints(Converter::Impl &impl, const llvm::Call
 	// Root constants are emitted as uints as they are typically used as indices.
 	bool need_bitcast = result_scalar_type->getTypeID() != llvm::Type::TypeID::IntegerTyID;
 
+	bool has_known_words = storage == spv::StorageClassPushConstant && base_ptr == impl.root_constant_id &&
+	                       !impl.options.known_root_constants.empty();
+
 	spv::Id elements[4];
 	for (unsigned i = 0; i < 4; i++)
 	{
-		if (i < num_words)
+		uint32_t known_value;
+		if (i < num_words && has_known_words && get_known_root_constant_word(impl, member_index + i, known_value))
+		{
+			elements[i] = builder.makeUintConstant(known_value);
+		}
+		else if (i < num_words)
 		{
 			auto *op = impl.allocate(spv::OpAccessChain,
 			                         builder.makePointer(storage == spv::StorageClassPushConstant && impl.options.inline_ubo_enable ?
@@ -2123,6 +2235,87 @@ bool emit_cbuffer_load_legacy_instruction(Converter::Impl &impl, const llvm::Cal
 	return true;
 }
 
+static const Converter::Impl::ResourceReference *get_static_cbv_reference(Converter::Impl &impl,
+                                                                          const llvm::Value *value)
+{
+	auto *instruction = llvm::dyn_cast<llvm::CallInst>(value);
+	if (!instruction)
+		return nullptr;
+
+	uint32_t resource_range = UINT32_MAX;
+	DXIL::ResourceType resource_type = {};
+
+	if (value_is_dx_op_instrinsic(value, DXIL::Op::CreateHandle))
+	{
+		uint32_t resource_type_operand;
+		if (!get_constant_operand(instruction, 1, &resource_type_operand))
+			return nullptr;
+		if (!get_constant_operand(instruction, 2, &resource_range))
+			return nullptr;
+		resource_type = static_cast<DXIL::ResourceType>(resource_type_operand);
+	}
+	else if (value_is_dx_op_instrinsic(value, DXIL::Op::CreateHandleForLib))
+	{
+		auto itr = impl.llvm_global_variable_to_resource_mapping.find(instruction->getOperand(1));
+		if (itr == impl.llvm_global_variable_to_resource_mapping.end())
+			return nullptr;
+		resource_type = itr->second.type;
+		resource_range = itr->second.meta_index;
+	}
+	else if (value_is_dx_op_instrinsic(value, DXIL::Op::AnnotateHandle))
+	{
+		AnnotateHandleMeta annotate_meta = {};
+		if (!get_annotate_handle_meta(impl, instruction, annotate_meta))
+			return nullptr;
+		resource_type = annotate_meta.resource_type;
+		resource_range = annotate_meta.binding_index;
+	}
+
+	// Heap handles can never point to root constants.
+	if (resource_type != DXIL::ResourceType::CBV || resource_range >= impl.cbv_index_to_reference.size())
+		return nullptr;
+
+	return &impl.cbv_index_to_reference[resource_range];
+}
+
+bool get_known_root_constant_value(Converter::Impl &impl, const llvm::CallInst *instruction,
+                                   unsigned component, uint32_t &value)
+{
+	if (impl.options.known_root_constants.empty() || impl.root_constant_id == 0)
+		return false;
+
+	auto *reference = get_static_cbv_reference(impl, instruction->getOperand(1));
+	if (!reference || reference->var_id != impl.root_constant_id || resource_is_physical_pointer(impl, *reference))
+		return false;
+
+	auto *constant_int = llvm::dyn_cast<llvm::ConstantInt>(instruction->getOperand(2));
+	if (!constant_int)
+		return false;
+
+	// Same addressing as emit_cbuffer_load_from_uints().
+	bool scalar_load = instruction->getType()->getTypeID() != llvm::Type::TypeID::StructTyID;
+	auto *result_type = scalar_load ? instruction->getType() : instruction->getType()->getStructElementType(0);
+	// Floats are returned as raw bits.
+	if (get_type_scalar_alignment(impl, result_type) != 4)
+		return false;
+
+	auto member_index = unsigned(constant_int->getUniqueInteger().getZExtValue());
+	if (scalar_load)
+	{
+		if ((member_index % 4) != 0 || component != 0)
+			return false;
+		member_index /= 4;
+	}
+	else
+	{
+		if (component >= 4)
+			return false;
+		member_index = member_index * 4 + component;
+	}
+
+	return get_known_root_constant_word(impl, reference->push_constant_member + member_index, value);
+}
+
 bool resource_handle_is_uniform_readonly_descriptor(Converter::Impl &impl, const llvm::Value *value)
 {
 	spv::Id ptr_id = impl.get_id_for_value(value);
@@ -2197,4 +2390,61 @@ bool resource_handle_is_uniform_readonly_descriptor(Converter::Impl &impl, const
 
 	return true;
 }
+
+static bool compute_value_is_dynamically_uniform(Converter::Impl &impl, const llvm::Value *value)
+{
+	if (llvm::isa<llvm::Constant>(value))
+		return true;
+
+	if (llvm::isa<llvm::BinaryOperator>(value) || llvm::isa<llvm::UnaryOperator>(value) ||
+	    llvm::isa<llvm::CastInst>(value) || llvm::isa<llvm::CmpInst>(value) ||
+	    llvm::isa<llvm::SelectInst>(value) || llvm::isa<llvm::ExtractValueInst>(value))
+	{
+		auto *inst = llvm::cast<llvm::Instruction>(value);
+		for (unsigned i = 0; i < inst->getNumOperands(); i++)
+			if (!value_is_dynamically_uniform(impl, inst->getOperand(i)))
+				return false;
+		return true;
+	}
+
+	// Unlike value_is_statically_wave_uniform(), wave ops do not count.
+	// They are only uniform within the subgroup, and NonUniform is about the whole invocation group.
+	// PHIs are not considered either, since we do not track divergent control flow.
+
+	if (value_is_dx_op_instrinsic(value, DXIL::Op::GroupId))
+	{
+		return impl.execution_model == spv::ExecutionModelGLCompute ||
+		       impl.execution_model == spv::ExecutionModelMeshEXT ||
+		       impl.execution_model == spv::ExecutionModelTaskEXT;
+	}
+
+	if (value_is_dx_op_instrinsic(value, DXIL::Op::CBufferLoadLegacy) ||
+	    value_is_dx_op_instrinsic(value, DXIL::Op::CBufferLoad))
+	{
+		auto *call_op = llvm::cast<llvm::CallInst>(value);
+		return value_is_dynamically_uniform(impl, call_op->getOperand(2)) &&
+		       resource_handle_is_uniform_readonly_descriptor(impl, call_op->getOperand(1));
+	}
+	else if (value_is_dx_op_instrinsic(value, DXIL::Op::BufferLoad) ||
+	         value_is_dx_op_instrinsic(value, DXIL::Op::RawBufferLoad))
+	{
+		auto *call_op = llvm::cast<llvm::CallInst>(value);
+		return value_is_dynamically_uniform(impl, call_op->getOperand(2)) &&
+		       value_is_dynamically_uniform(impl, call_op->getOperand(3)) &&
+		       resource_handle_is_uniform_readonly_descriptor(impl, call_op->getOperand(1));
+	}
+
+	return false;
+}
+
+bool value_is_dynamically_uniform(Converter::Impl &impl, const llvm::Value *value)
+{
+	auto itr = impl.dynamically_uniform_values.find(value);
+	if (itr != impl.dynamically_uniform_values.end())
+		return itr->second;
+
+	bool uniform = compute_value_is_dynamically_uniform(impl, value);
+	impl.dynamically_uniform_values[value] = uniform;
+	return uniform;
+}
 } // namespace dxil_spv
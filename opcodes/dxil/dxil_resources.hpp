@@ -58,4 +58,11 @@ struct AnnotateHandleMeta
 bool get_annotate_handle_meta(Converter::Impl &impl, const llvm::CallInst *instruction, AnnotateHandleMeta &meta);
 
 bool resource_handle_is_uniform_readonly_descriptor(Converter::Impl &impl, const llvm::Value *value);
+// Stronger than wave uniform. The value is the same for every invocation in the draw or workgroup.
+bool value_is_dynamically_uniform(Converter::Impl &impl, const llvm::Value *value);
+
+// For CBufferLoad or CBufferLoadLegacy from root constants, looks up the value of the loaded word
+// in OptionKnownRootConstants. Only relies on LLVM IR and resource mappings, so it also works before emission.
+bool get_known_root_constant_value(Converter::Impl &impl, const llvm::CallInst *instruction,
+                                   unsigned component, uint32_t &value);
 } // namespace dxil_spv
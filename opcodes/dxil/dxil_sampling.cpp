@@ -24,6 +24,7 @@
 
 #include "dxil_sampling.hpp"
 #include "dxil_common.hpp"
+#include "dxil_resources.hpp"
 #include "spirv_module.hpp"
 #include "logging.hpp"
 #include "opcodes/converter_impl.hpp"
@@ -355,44 +356,243 @@ bool emit_sample_instruction(DXIL::Op opcode, Converter::Impl &impl, const llvm:
 	return true;
 }
 
-static bool binary_op_is_multiple_of_derivative(const llvm::Value *grad_value, const llvm::Value *coord_value,
-                                                DXIL::Op candidate_coarse_op, DXIL::Op candidate_fine_op,
-                                                const llvm::Value *&multiple)
+// Gradient scales are tracked as a product of quad-uniform factors with integer exponents.
+struct DerivativeFactor
 {
-	const auto *bin_op = llvm::dyn_cast<llvm::BinaryOperator>(grad_value);
-	if (!bin_op)
-		return false;
+	const llvm::Value *value;
+	int exponent;
+};
+using DerivativeScale = Vector<DerivativeFactor>;
 
-	if (bin_op->getOpcode() != llvm::BinaryOperator::BinaryOps::FMul)
+static constexpr unsigned MaxDerivativeTraceDepth = 8;
+
+static void add_derivative_factor(DerivativeScale &scale, const llvm::Value *value, int exponent)
+{
+	for (auto &factor : scale)
+	{
+		if (factor.value == value)
+		{
+			factor.exponent += exponent;
+			return;
+		}
+	}
+
+	scale.push_back({ value, exponent });
+}
+
+static bool derivative_scale_contains(const DerivativeScale &scale, const DerivativeFactor &factor)
+{
+	for (auto &f : scale)
+		if (f.value == factor.value && f.exponent == factor.exponent)
+			return true;
+	return false;
+}
+
+static bool derivative_scales_equal(const DerivativeScale &a, const DerivativeScale &b)
+{
+	if (a.size() != b.size())
 		return false;
+	for (auto &factor : a)
+		if (!derivative_scale_contains(b, factor))
+			return false;
+	return true;
+}
+
+static bool value_is_quad_uniform(Converter::Impl &impl, const llvm::Value *value)
+{
+	// Dynamically uniform implies uniform within a quad, which is all the derivative math cares about.
+	return llvm::isa<llvm::Constant>(value) || value_is_dynamically_uniform(impl, value);
+}
+
+static bool value_is_fp32_zero(const llvm::Value *value)
+{
+	auto *constant = llvm::dyn_cast<llvm::ConstantFP>(value);
+	return constant && constant->getType()->getTypeID() == llvm::Type::TypeID::FloatTyID &&
+	       constant->getValueAPF().convertToFloat() == 0.0f;
+}
+
+// Peels off quad-uniform scales and offsets, so that value = base * scale^exponent + offset.
+static const llvm::Value *trace_affine_derivative_base(Converter::Impl &impl, const llvm::Value *value,
+                                                       DerivativeScale &scale, int exponent)
+{
+	for (unsigned depth = 0; depth < MaxDerivativeTraceDepth; depth++)
+	{
+		auto *bin_op = llvm::dyn_cast<llvm::BinaryOperator>(value);
+		if (!bin_op || !impl.instruction_is_fast_math(bin_op))
+			break;
+
+		auto *a = bin_op->getOperand(0);
+		auto *b = bin_op->getOperand(1);
+
+		switch (bin_op->getOpcode())
+		{
+		case llvm::BinaryOperator::BinaryOps::FAdd:
+		case llvm::BinaryOperator::BinaryOps::FSub:
+			// Negation does not matter, only the magnitude of the scale is used.
+			if (value_is_quad_uniform(impl, b))
+				value = a;
+			else if (value_is_quad_uniform(impl, a))
+				value = b;
+			else
+				return value;
+			break;
+
+		case llvm::BinaryOperator::BinaryOps::FMul:
+			if (value_is_quad_uniform(impl, b))
+			{
+				add_derivative_factor(scale, b, exponent);
+				value = a;
+			}
+			else if (value_is_quad_uniform(impl, a))
+			{
+				add_derivative_factor(scale, a, exponent);
+				value = b;
+			}
+			else
+				return value;
+			break;
+
+		case llvm::BinaryOperator::BinaryOps::FDiv:
+			if (!value_is_quad_uniform(impl, b))
+				return value;
+			add_derivative_factor(scale, b, -exponent);
+			value = a;
+			break;
+
+		default:
+			return value;
+		}
+	}
+
+	return value;
+}
+
+// Peels off scales, so that value = scale * Deriv(argument).
+// Scales of the gradient itself may vary per lane, since a LOD bias is applied per lane as well.
+static const llvm::CallInst *trace_scaled_derivative(Converter::Impl &impl, const llvm::Value *value,
+                                                     DerivativeScale &scale,
+                                                     DXIL::Op candidate_coarse_op, DXIL::Op candidate_fine_op,
+                                                     unsigned depth = 0)
+{
+	if (value_is_dx_op_instrinsic(value, candidate_coarse_op) ||
+	    value_is_dx_op_instrinsic(value, candidate_fine_op))
+	{
+		return llvm::cast<llvm::CallInst>(value);
+	}
+
+	auto *bin_op = llvm::dyn_cast<llvm::BinaryOperator>(value);
 
 	// Play fast and loose if we can :3
-	if (!bin_op->isFast())
-		return false;
+	if (!bin_op || !impl.instruction_is_fast_math(bin_op) || depth >= MaxDerivativeTraceDepth)
+		return nullptr;
 
 	auto *a = bin_op->getOperand(0);
 	auto *b = bin_op->getOperand(1);
+	DerivativeScale saved_scale = scale;
+	const llvm::CallInst *deriv = nullptr;
 
-	if ((value_is_dx_op_instrinsic(a, candidate_coarse_op) ||
-	     value_is_dx_op_instrinsic(a, candidate_fine_op)))
+	switch (bin_op->getOpcode())
 	{
-		if (llvm::cast<llvm::CallInst>(a)->getOperand(1) == coord_value)
+	case llvm::BinaryOperator::BinaryOps::FMul:
+		if ((deriv = trace_scaled_derivative(impl, a, scale, candidate_coarse_op, candidate_fine_op, depth + 1)))
 		{
-			multiple = b;
-			return true;
+			add_derivative_factor(scale, b, 1);
+			return deriv;
+		}
+
+		scale = saved_scale;
+		if ((deriv = trace_scaled_derivative(impl, b, scale, candidate_coarse_op, candidate_fine_op, depth + 1)))
+		{
+			add_derivative_factor(scale, a, 1);
+			return deriv;
+		}
+		break;
+
+	case llvm::BinaryOperator::BinaryOps::FDiv:
+		if ((deriv = trace_scaled_derivative(impl, a, scale, candidate_coarse_op, candidate_fine_op, depth + 1)))
+		{
+			add_derivative_factor(scale, b, -1);
+			return deriv;
 		}
+		break;
+
+	case llvm::BinaryOperator::BinaryOps::FSub:
+		// Negation. Any other offset would no longer be a multiple of the derivative.
+		if (value_is_fp32_zero(a))
+			return trace_scaled_derivative(impl, b, scale, candidate_coarse_op, candidate_fine_op, depth + 1);
+		break;
+
+	default:
+		break;
 	}
-	else if ((value_is_dx_op_instrinsic(b, candidate_coarse_op) ||
-	          value_is_dx_op_instrinsic(b, candidate_fine_op)))
+
+	scale = saved_scale;
+	return nullptr;
+}
+
+// Checks if grad_value = scale * Deriv(coord_value), where scale is quad-uniform.
+// Derivatives of values which only differ from the coordinate by quad-uniform scales and offsets are accepted too.
+static bool gradient_is_multiple_of_derivative(Converter::Impl &impl,
+                                               const llvm::Value *grad_value, const llvm::Value *coord_value,
+                                               DXIL::Op candidate_coarse_op, DXIL::Op candidate_fine_op,
+                                               DerivativeScale &scale)
+{
+	auto *deriv = trace_scaled_derivative(impl, grad_value, scale, candidate_coarse_op, candidate_fine_op);
+	if (!deriv)
+		return false;
+
+	// Deriv(deriv_base * A + B) = A * Deriv(deriv_base), and Deriv(coord_base) = Deriv(coord) / C.
+	auto *deriv_base = trace_affine_derivative_base(impl, deriv->getOperand(1), scale, 1);
+	auto *coord_base = trace_affine_derivative_base(impl, coord_value, scale, -1);
+	if (deriv_base != coord_base)
+		return false;
+
+	scale.erase(std::remove_if(scale.begin(), scale.end(),
+	                           [](const DerivativeFactor &factor) { return factor.exponent == 0; }),
+	            scale.end());
+	return true;
+}
+
+static spv::Id build_derivative_scale(Converter::Impl &impl, const DerivativeScale &scale)
+{
+	auto &builder = impl.builder();
+	spv::Id fp32_type = builder.makeFloatType(32);
+	spv::Id numerator_id = 0;
+	spv::Id denominator_id = 0;
+
+	for (auto &factor : scale)
 	{
-		if (llvm::cast<llvm::CallInst>(b)->getOperand(1) == coord_value)
+		spv::Id &accum_id = factor.exponent > 0 ? numerator_id : denominator_id;
+		spv::Id factor_id = impl.get_id_for_value(factor.value);
+
+		for (int i = 0; i < std::abs(factor.exponent); i++)
 		{
-			multiple = a;
-			return true;
+			if (accum_id)
+			{
+				Operation *mul_op = impl.allocate(spv::OpFMul, fp32_type);
+				mul_op->add_id(accum_id);
+				mul_op->add_id(factor_id);
+				impl.add(mul_op);
+				accum_id = mul_op->id;
+			}
+			else
+				accum_id = factor_id;
 		}
 	}
 
-	return false;
+	if (!numerator_id)
+		numerator_id = builder.makeFloatConstant(1.0f);
+
+	if (denominator_id)
+	{
+		Operation *div_op = impl.allocate(spv::OpFDiv, fp32_type);
+		div_op->add_id(numerator_id);
+		div_op->add_id(denominator_id);
+		impl.add(div_op);
+		numerator_id = div_op->id;
+	}
+
+	return numerator_id;
 }
 
 static spv::Id sample_grad_is_lod_bias(Converter::Impl &impl, const llvm::CallInst *instruction, unsigned num_coords)
@@ -403,8 +603,8 @@ static spv::Id sample_grad_is_lod_bias(Converter::Impl &impl, const llvm::CallIn
 	if (!impl.options.grad_opt.enabled)
 		return 0;
 
-	const llvm::Value *mult_grad_x[3] = {};
-	const llvm::Value *mult_grad_y[3] = {};
+	DerivativeScale scale_x[3];
+	DerivativeScale scale_y[3];
 
 	for (unsigned i = 0; i < num_coords; i++)
 	{
@@ -437,27 +637,23 @@ static spv::Id sample_grad_is_lod_bias(Converter::Impl &impl, const llvm::CallIn
 		if (grad_x_id || grad_y_id)
 			return 0;
 
-		if (!binary_op_is_multiple_of_derivative(grad_x, coord, DXIL::Op::DerivCoarseX, DXIL::Op::DerivFineX, mult_grad_x[i]) ||
-		    !binary_op_is_multiple_of_derivative(grad_y, coord, DXIL::Op::DerivCoarseY, DXIL::Op::DerivFineY, mult_grad_y[i]))
+		if (!gradient_is_multiple_of_derivative(impl, grad_x, coord, DXIL::Op::DerivCoarseX, DXIL::Op::DerivFineX, scale_x[i]) ||
+		    !gradient_is_multiple_of_derivative(impl, grad_y, coord, DXIL::Op::DerivCoarseY, DXIL::Op::DerivFineY, scale_y[i]))
 			return 0;
 	}
 
-	for (unsigned i = 0; i < num_coords; i++)
+	for (unsigned i = 1; i < num_coords; i++)
 	{
-		if (!mult_grad_x[i] || !mult_grad_y[i])
+		if (!derivative_scales_equal(scale_x[i], scale_x[0]))
+			return 0;
+		if (!derivative_scales_equal(scale_y[i], scale_y[0]))
 			return 0;
-
-		if (i > 0)
-		{
-			if (mult_grad_x[i] != mult_grad_x[0])
-				return 0;
-			if (mult_grad_y[i] != mult_grad_y[0])
-				return 0;
-		}
 	}
 
+	bool uniform_scale = derivative_scales_equal(scale_x[0], scale_y[0]);
+
 	// We can only apply uniform scale with textureBias, unless we have app-opt.
-	if (mult_grad_x[0] != mult_grad_y[0] && !impl.options.grad_opt.assume_uniform_scale)
+	if (!uniform_scale && !impl.options.grad_opt.assume_uniform_scale)
 		return 0;
 
 	auto &builder = impl.builder();
@@ -471,15 +667,15 @@ static spv::Id sample_grad_is_lod_bias(Converter::Impl &impl, const llvm::CallIn
 	Operation *abs_x_op = impl.allocate(spv::OpExtInst, fp32_type);
 	abs_x_op->add_id(impl.glsl_std450_ext);
 	abs_x_op->add_literal(GLSLstd450FAbs);
-	abs_x_op->add_id(impl.get_id_for_value(mult_grad_x[0]));
+	abs_x_op->add_id(build_derivative_scale(impl, scale_x[0]));
 	impl.add(abs_x_op);
 
-	if (mult_grad_x[0] != mult_grad_y[0])
+	if (!uniform_scale)
 	{
 		Operation *abs_y_op = impl.allocate(spv::OpExtInst, fp32_type);
 		abs_y_op->add_id(impl.glsl_std450_ext);
 		abs_y_op->add_literal(GLSLstd450FAbs);
-		abs_y_op->add_id(impl.get_id_for_value(mult_grad_y[0]));
+		abs_y_op->add_id(build_derivative_scale(impl, scale_y[0]));
 		impl.add(abs_y_op);
 
 		Operation *min_op = impl.allocate(spv::OpExtInst, fp32_type);
@@ -1216,9 +1412,25 @@ bool emit_check_access_fully_mapped_instruction(Converter::Impl &impl, const llv
 {
 	auto &builder = impl.builder();
 	builder.addCapability(spv::CapabilitySparseResidency);
+
+	// Status codes are often checked more than once, e.g. once per tap in a virtual texture lookup.
+	const llvm::Value *status = instruction->getOperand(1);
+	if (impl.options.sparse_feedback_forwarding)
+	{
+		auto itr = impl.sparse_residency_checks.find(status);
+		if (itr != impl.sparse_residency_checks.end() && itr->second.block == impl.current_block)
+		{
+			impl.rewrite_value(instruction, itr->second.id);
+			return true;
+		}
+	}
+
 	auto *op = impl.allocate(spv::OpImageSparseTexelsResident, instruction);
-	op->add_id(impl.get_id_for_value(instruction->getOperand(1)));
+	op->add_id(impl.get_id_for_value(status));
 	impl.add(op);
+
+	if (impl.options.sparse_feedback_forwarding)
+		impl.sparse_residency_checks[status] = { impl.current_block, op->id };
 	return true;
 }
 
@@ -1737,6 +1949,30 @@ static spv::Id emit_gradient_extent_normalized(Converter::Impl &impl, spv::Id co
 	return extent;
 }
 
+static void emit_write_feedback_call(Converter::Impl &impl, const Converter::Impl::ResourceMeta &meta, bool arrayed,
+                                     spv::Id coord_id, spv::Id value_id, spv::Id participate_id)
+{
+	// The helper deduplicates texels within the subgroup, so only one lane per unique texel does the atomic.
+	HelperCall helper_call;
+	if (arrayed && meta.non_uniform)
+		helper_call = HelperCall::AtomicImageArrayR64CompactNonUniform;
+	else if (arrayed)
+		helper_call = HelperCall::AtomicImageArrayR64Compact;
+	else if (meta.non_uniform)
+		helper_call = HelperCall::AtomicImageR64CompactNonUniform;
+	else
+		helper_call = HelperCall::AtomicImageR64Compact;
+
+	spv::Id call_id = impl.spirv_module.get_helper_call_id(helper_call);
+	auto *call = impl.allocate(spv::OpFunctionCall, impl.builder().makeVoidType());
+	call->add_id(call_id);
+	call->add_id(meta.var_id);
+	call->add_id(coord_id);
+	call->add_id(value_id);
+	call->add_id(participate_id);
+	impl.add(call);
+}
+
 bool emit_write_sampler_feedback_instruction(DXIL::Op opcode, Converter::Impl &impl, const llvm::CallInst *instruction)
 {
 	auto &builder = impl.builder();
@@ -1813,6 +2049,10 @@ bool emit_write_sampler_feedback_instruction(DXIL::Op opcode, Converter::Impl &i
 	fract_uv_op->add_id(coord_id);
 	impl.add(fract_uv_op);
 
+	spv::Id lod_comp_ids[2] = {};
+	spv::Id lod_value_ids[2] = {};
+	spv::Id lod_participate_ids[2] = {};
+
 	for (unsigned lod_iteration = 0; lod_iteration < 2; lod_iteration++)
 	{
 		spv::Id lod_id = lod_iteration ? lods.coarse_lod_id : lods.fine_lod_id;
@@ -2056,24 +2296,71 @@ bool emit_write_sampler_feedback_instruction(DXIL::Op opcode, Converter::Impl &i
 				participate_id = lods.trilinear_enable_id;
 		}
 
-		HelperCall helper_call;
-		if (num_coords_full == 3 && meta.non_uniform)
-			helper_call = HelperCall::AtomicImageArrayR64CompactNonUniform;
-		else if (num_coords_full == 3)
-			helper_call = HelperCall::AtomicImageArrayR64Compact;
-		else if (meta.non_uniform)
-			helper_call = HelperCall::AtomicImageR64CompactNonUniform;
-		else
-			helper_call = HelperCall::AtomicImageR64Compact;
-
-		spv::Id call_id = impl.spirv_module.get_helper_call_id(helper_call);
-		auto *call = impl.allocate(spv::OpFunctionCall, builder.makeVoidType());
-		call->add_id(call_id);
-		call->add_id(meta.var_id);
-		call->add_id(comp_id);
-		call->add_id(shift_op->id);
-		call->add_id(participate_id);
-		impl.add(call);
+		lod_comp_ids[lod_iteration] = comp_id;
+		lod_value_ids[lod_iteration] = shift_op->id;
+		lod_participate_ids[lod_iteration] = participate_id;
+
+		if (!impl.options.sampler_feedback_lod_merging)
+			emit_write_feedback_call(impl, meta, num_coords_full == 3, comp_id, shift_op->id, participate_id);
+	}
+
+	if (impl.options.sampler_feedback_lod_merging)
+	{
+		// The feedback map is addressed in mip region space, so the fine and coarse LOD of a trilinear
+		// access usually hit the same texel. In that case, fold the coarse bits into the fine write,
+		// which halves the subgroup waterfall iterations and atomics.
+		spv::Id u64_type = builder.makeUintType(64);
+		spv::Id zero_id = builder.makeUint64Constant(0);
+
+		auto *equal = impl.allocate(spv::OpIEqual, builder.makeVectorType(bool_type, num_coords_full));
+		equal->add_id(lod_comp_ids[0]);
+		equal->add_id(lod_comp_ids[1]);
+		impl.add(equal);
+
+		auto *same_texel = impl.allocate(spv::OpAll, bool_type);
+		same_texel->add_id(equal->id);
+		impl.add(same_texel);
+
+		auto *merge_coarse = impl.allocate(spv::OpLogicalAnd, bool_type);
+		merge_coarse->add_id(same_texel->id);
+		merge_coarse->add_id(lod_participate_ids[1]);
+		impl.add(merge_coarse);
+
+		auto *fine_value = impl.allocate(spv::OpSelect, u64_type);
+		fine_value->add_id(lod_participate_ids[0]);
+		fine_value->add_id(lod_value_ids[0]);
+		fine_value->add_id(zero_id);
+		impl.add(fine_value);
+
+		auto *coarse_value = impl.allocate(spv::OpSelect, u64_type);
+		coarse_value->add_id(merge_coarse->id);
+		coarse_value->add_id(lod_value_ids[1]);
+		coarse_value->add_id(zero_id);
+		impl.add(coarse_value);
+
+		auto *merged_value = impl.allocate(spv::OpBitwiseOr, u64_type);
+		merged_value->add_id(fine_value->id);
+		merged_value->add_id(coarse_value->id);
+		impl.add(merged_value);
+
+		auto *merged_participate = impl.allocate(spv::OpLogicalOr, bool_type);
+		merged_participate->add_id(lod_participate_ids[0]);
+		merged_participate->add_id(merge_coarse->id);
+		impl.add(merged_participate);
+
+		auto *split_texel = impl.allocate(spv::OpLogicalNot, bool_type);
+		split_texel->add_id(same_texel->id);
+		impl.add(split_texel);
+
+		auto *coarse_participate = impl.allocate(spv::OpLogicalAnd, bool_type);
+		coarse_participate->add_id(lod_participate_ids[1]);
+		coarse_participate->add_id(split_texel->id);
+		impl.add(coarse_participate);
+
+		emit_write_feedback_call(impl, meta, num_coords_full == 3, lod_comp_ids[0],
+		                         merged_value->id, merged_participate->id);
+		emit_write_feedback_call(impl, meta, num_coords_full == 3, lod_comp_ids[1],
+		                         lod_value_ids[1], coarse_participate->id);
 	}
 
 	return true;
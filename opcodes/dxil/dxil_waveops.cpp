@@ -284,11 +284,11 @@ static bool value_is_wave_lane(const llvm::Value *value)
 	auto *dxil_op = llvm::dyn_cast<llvm::CallInst>(value);
 	if (!dxil_op)
 		return false;
-	if (strncmp(dxil_op->getCalledFunction()->getName().data(), "dx.op", 5) != 0)
+	if (!is_dxil_op_callee(dxil_op->getCalledFunction()))
 		return false;
 
 	uint32_t op;
-	if (!get_constant_operand(dxil_op, 0, &op))
+	if (!get_dxil_opcode(dxil_op, &op))
 		return false;
 
 	return DXIL::Op(op) == DXIL::Op::WaveGetLaneIndex;
@@ -742,25 +742,82 @@ bool emit_wave_prefix_op_instruction(Converter::Impl &impl, const llvm::CallInst
 	return true;
 }
 
+static spv::Id emit_masked_ballot(Converter::Impl &impl, spv::Id value)
+{
+	auto &builder = impl.builder();
+
+	spv::Id uvec4_type = builder.makeVectorType(builder.makeUintType(32), 4);
+	builder.addCapability(spv::CapabilityGroupNonUniformBallot);
+	auto *ballot_op = impl.allocate(spv::OpGroupNonUniformBallot, uvec4_type);
+	ballot_op->add_id(builder.makeUintConstant(spv::ScopeSubgroup));
+	ballot_op->add_id(builder.makeBoolConstant(true));
+	impl.add(ballot_op);
+
+	auto *and_op = impl.allocate(spv::OpBitwiseAnd, uvec4_type);
+	and_op->add_id(value);
+	and_op->add_id(ballot_op->id);
+	impl.add(and_op);
+
+	return and_op->id;
+}
+
 bool emit_wave_multi_prefix_count_bits_instruction(Converter::Impl &impl, const llvm::CallInst *instruction)
 {
 	auto &builder = impl.builder();
 
-	// There is no NV equivalent for this one.
+	spv::Id ballot[4];
+	for (unsigned i = 0; i < 4; i++)
+		ballot[i] = impl.get_id_for_value(instruction->getOperand(2 + i));
+	spv::Id mask_id = impl.build_vector(builder.makeUintType(32), ballot, 4);
+
+	if (impl.options.nv_subgroup_partition_enabled)
+	{
+		// There is no partitioned bit count, but a partitioned prefix sum of 0 or 1 is equivalent.
+		spv::Id uint_type = builder.makeUintType(32);
+		spv::Id bool_type = builder.makeBoolType();
+		spv::Id pred_id = impl.get_id_for_value(instruction->getOperand(1));
+
+		// Helper lanes must not contribute to the count.
+		if (wave_op_needs_helper_lane_masking(impl))
+		{
+			auto *is_helper_lane = impl.allocate(spv::OpIsHelperInvocationEXT, bool_type);
+			impl.add(is_helper_lane);
+			auto *not_helper_lane = impl.allocate(spv::OpLogicalNot, bool_type);
+			not_helper_lane->add_id(is_helper_lane->id);
+			impl.add(not_helper_lane);
+			auto *and_op = impl.allocate(spv::OpLogicalAnd, bool_type);
+			and_op->add_id(pred_id);
+			and_op->add_id(not_helper_lane->id);
+			impl.add(and_op);
+			pred_id = and_op->id;
+		}
+
+		auto *bit_op = impl.allocate(spv::OpSelect, uint_type);
+		bit_op->add_id(pred_id);
+		bit_op->add_id(builder.makeUintConstant(1));
+		bit_op->add_id(builder.makeUintConstant(0));
+		impl.add(bit_op);
+
+		builder.addExtension("SPV_NV_shader_subgroup_partitioned");
+		builder.addCapability(spv::CapabilityGroupNonUniformPartitionedNV);
+		auto *op = impl.allocate(spv::OpGroupNonUniformIAdd, instruction, uint_type);
+		op->add_id(builder.makeUintConstant(spv::ScopeSubgroup));
+		op->add_literal(spv::GroupOperationPartitionedExclusiveScanNV);
+		op->add_id(bit_op->id);
+		// Inactive lanes must be ignored so that lanes in the same partition have equal partition values.
+		op->add_id(emit_masked_ballot(impl, mask_id));
+		impl.add(op);
+		return true;
+	}
 
 	spv::Id call_id = impl.spirv_module.get_helper_call_id(HelperCall::WaveMultiPrefixCountBits);
 	auto *op = impl.allocate(spv::OpFunctionCall, instruction);
 	op->add_id(call_id);
 
 	op->add_id(impl.get_id_for_value(instruction->getOperand(1)));
+	op->add_id(mask_id);
 
-	spv::Id ballot[4];
-	for (unsigned i = 0; i < 4; i++)
-		ballot[i] = impl.get_id_for_value(instruction->getOperand(2 + i));
-	op->add_id(impl.build_vector(builder.makeUintType(32), ballot, 4));
-
-	if (!impl.options.nv_subgroup_partition_enabled &&
-	    wave_op_needs_helper_lane_masking(impl))
+	if (wave_op_needs_helper_lane_masking(impl))
 	{
 		auto *is_helper_lane = impl.allocate(spv::OpIsHelperInvocationEXT, impl.builder().makeBoolType());
 		impl.add(is_helper_lane);
@@ -772,25 +829,6 @@ bool emit_wave_multi_prefix_count_bits_instruction(Converter::Impl &impl, const
 	return true;
 }
 
-static spv::Id emit_masked_ballot(Converter::Impl &impl, spv::Id value)
-{
-	auto &builder = impl.builder();
-
-	spv::Id uvec4_type = builder.makeVectorType(builder.makeUintType(32), 4);
-	builder.addCapability(spv::CapabilityGroupNonUniformBallot);
-	auto *ballot_op = impl.allocate(spv::OpGroupNonUniformBallot, uvec4_type);
-	ballot_op->add_id(builder.makeUintConstant(spv::ScopeSubgroup));
-	ballot_op->add_id(builder.makeBoolConstant(true));
-	impl.add(ballot_op);
-
-	auto *and_op = impl.allocate(spv::OpBitwiseAnd, uvec4_type);
-	and_op->add_id(value);
-	and_op->add_id(ballot_op->id);
-	impl.add(and_op);
-
-	return and_op->id;
-}
-
 bool emit_wave_multi_prefix_op_instruction(Converter::Impl &impl, const llvm::CallInst *instruction)
 {
 	auto &builder = impl.builder();
@@ -368,7 +368,7 @@ bool emit_dxil_instruction(Converter::Impl &impl, const llvm::CallInst *instruct
 {
 	// The opcode is encoded as a constant integer.
 	uint32_t opcode;
-	if (!get_constant_operand(instruction, 0, &opcode))
+	if (!get_dxil_opcode(instruction, &opcode))
 		return false;
 
 	if (opcode >= unsigned(DXIL::Op::Count))
@@ -383,6 +383,12 @@ bool emit_dxil_instruction(Converter::Impl &impl, const llvm::CallInst *instruct
 		return false;
 	}
 
+	// Material graphs tend to leave a surprising amount of constant arithmetic behind.
+	// Host evaluation may round differently than the device, so precise instructions are left alone.
+	if (impl.options.constant_folding && !impl.instruction_is_precise(instruction) &&
+	    fold_constant_arithmetic_instruction(DXIL::Op(opcode), impl, instruction))
+		return true;
+
 	if (!global_dispatcher.builder_lut[opcode](impl, instruction))
 	{
 		LOGE("Failed DXIL opcode %u.\n", opcode);
@@ -394,7 +400,7 @@ bool emit_dxil_instruction(Converter::Impl &impl, const llvm::CallInst *instruct
 bool dxil_instruction_has_side_effects(const llvm::CallInst *instruction)
 {
 	uint32_t opcode;
-	if (!get_constant_operand(instruction, 0, &opcode))
+	if (!get_dxil_opcode(instruction, &opcode))
 		return false;
 
 	if (instruction->getType()->getTypeID() == llvm::Type::TypeID::VoidTyID)
@@ -570,7 +576,22 @@ static void analyze_dxil_cbuffer_load(Converter::Impl &impl, const llvm::CallIns
 
 	if (tracking)
 	{
-		if (instruction->getType()->getTypeID() == llvm::Type::TypeID::StructTyID)
+		bool legacy = instruction->getType()->getTypeID() == llvm::Type::TypeID::StructTyID;
+		if (const auto *offset = llvm::dyn_cast<llvm::ConstantInt>(instruction->getOperand(2)))
+		{
+			// Legacy loads index 16-byte rows, plain CBufferLoad takes a byte offset.
+			uint32_t rows;
+			if (legacy)
+				rows = uint32_t(offset->getUniqueInteger().getZExtValue()) + 1;
+			else
+				rows = (uint32_t(offset->getUniqueInteger().getZExtValue()) +
+				        get_type_scalar_alignment(impl, instruction->getType()) + 15) / 16;
+			tracking->cbv_static_rows = std::max<uint32_t>(tracking->cbv_static_rows, rows);
+		}
+		else
+			tracking->has_dynamic_cbv_offset = true;
+
+		if (legacy)
 		{
 			// Legacy float4 model. However, it seems like DXIL also supports f16x8, f32x4 and f64x2 ... :(
 			switch (get_type_scalar_alignment(impl, instruction->getType()->getStructElementType(0)))
@@ -648,6 +669,7 @@ static void analyze_dxil_buffer_load(Converter::Impl &impl, const llvm::CallInst
 	if (tracking)
 	{
 		tracking->has_read = true;
+		tracking->has_non_atomic_read = true;
 
 		if (opcode != DXIL::Op::TextureLoad)
 		{
@@ -717,6 +739,8 @@ static void analyze_dxil_buffer_store(Converter::Impl &impl, const llvm::CallIns
 			else
 				tracking->has_atomic_64bit = true;
 		}
+		else
+			tracking->has_non_atomic_write = true;
 
 		if (opcode != DXIL::Op::TextureStore && opcode != DXIL::Op::TextureStoreSample)
 		{
@@ -787,11 +811,37 @@ static void analyze_dxil_atomic_op(Converter::Impl &impl, const llvm::CallInst *
 	}
 }
 
+bool dxil_instruction_needs_buffer_access_analysis(const llvm::CallInst *instruction)
+{
+	uint32_t opcode;
+	if (!get_dxil_opcode(instruction, &opcode))
+		return false;
+
+	switch (static_cast<DXIL::Op>(opcode))
+	{
+	case DXIL::Op::BufferLoad:
+	case DXIL::Op::RawBufferLoad:
+	case DXIL::Op::AtomicCompareExchange:
+	case DXIL::Op::AtomicBinOp:
+	case DXIL::Op::WriteSamplerFeedback:
+	case DXIL::Op::WriteSamplerFeedbackBias:
+	case DXIL::Op::WriteSamplerFeedbackGrad:
+	case DXIL::Op::WriteSamplerFeedbackLevel:
+	case DXIL::Op::TextureStore:
+	case DXIL::Op::BufferStore:
+	case DXIL::Op::RawBufferStore:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
 bool analyze_dxil_buffer_access_instruction(Converter::Impl &impl, const llvm::CallInst *instruction)
 {
 	// The opcode is encoded as a constant integer.
 	uint32_t opcode;
-	if (!get_constant_operand(instruction, 0, &opcode))
+	if (!get_dxil_opcode(instruction, &opcode))
 		return false;
 
 	auto op = static_cast<DXIL::Op>(opcode);
@@ -831,7 +881,7 @@ bool analyze_dxil_instruction(Converter::Impl &impl, const llvm::CallInst *instr
 {
 	// The opcode is encoded as a constant integer.
 	uint32_t opcode;
-	if (!get_constant_operand(instruction, 0, &opcode))
+	if (!get_dxil_opcode(instruction, &opcode))
 		return false;
 
 	if (impl.options.descriptor_qa_enabled && impl.options.descriptor_qa_sink_handles)
@@ -855,6 +905,8 @@ bool analyze_dxil_instruction(Converter::Impl &impl, const llvm::CallInst *instr
 			impl.llvm_value_to_srv_resource_index_map[instruction] = resource_range;
 		else if (static_cast<DXIL::ResourceType>(resource_type_operand) == DXIL::ResourceType::CBV)
 			impl.llvm_value_to_cbv_resource_index_map[instruction] = resource_range;
+		if (resource_type_operand <= uint32_t(DXIL::ResourceType::Sampler))
+			impl.llvm_referenced_resource_indices[resource_type_operand].insert(resource_range);
 
 		if (impl.options.descriptor_qa_enabled && impl.options.descriptor_qa_sink_handles)
 			impl.resource_handle_to_block[instruction] = bb;
@@ -873,6 +925,7 @@ bool analyze_dxil_instruction(Converter::Impl &impl, const llvm::CallInst *instr
 			impl.llvm_value_to_srv_resource_index_map[instruction] = itr->second.meta_index;
 		else if (itr->second.type == DXIL::ResourceType::CBV)
 			impl.llvm_value_to_cbv_resource_index_map[instruction] = itr->second.meta_index;
+		impl.llvm_referenced_resource_indices[int(itr->second.type)].insert(itr->second.meta_index);
 
 		impl.llvm_active_global_resource_variables.insert(itr->second.variable);
 
@@ -947,6 +1000,7 @@ bool analyze_dxil_instruction(Converter::Impl &impl, const llvm::CallInst *instr
 				impl.llvm_value_to_srv_resource_index_map[instruction] = meta.binding_index;
 			else if (meta.resource_type == DXIL::ResourceType::CBV)
 				impl.llvm_value_to_cbv_resource_index_map[instruction] = meta.binding_index;
+			impl.llvm_referenced_resource_indices[int(meta.resource_type)].insert(meta.binding_index);
 		}
 
 		if (impl.options.descriptor_qa_enabled && impl.options.descriptor_qa_sink_handles)
@@ -1124,7 +1178,7 @@ bool analyze_dxil_instruction(Converter::Impl &impl, const llvm::CallInst *instr
 
 	case DXIL::Op::LegacyF16ToF32:
 		// Very specific check for HZD invariance. See f32_to_f16 code for details.
-		if (instruction->hasMetadata("dx.precise") || impl.options.force_precise)
+		if (impl.instruction_is_precise(instruction))
 			impl.shader_analysis.precise_f16_to_f32_observed = true;
 		break;
 
@@ -34,4 +34,6 @@ bool dxil_instruction_has_side_effects(const llvm::CallInst *instruction);
 
 bool analyze_dxil_instruction(Converter::Impl &impl, const llvm::CallInst *instruction, const llvm::BasicBlock *bb);
 bool analyze_dxil_buffer_access_instruction(Converter::Impl &impl, const llvm::CallInst *instruction);
+// True if analyze_dxil_buffer_access_instruction() does anything for the instruction.
+bool dxil_instruction_needs_buffer_access_analysis(const llvm::CallInst *instruction);
 } // namespace dxil_spv
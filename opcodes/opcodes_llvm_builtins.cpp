@@ -27,6 +27,7 @@
 #include "logging.hpp"
 #include "spirv_module.hpp"
 #include "dxil/dxil_common.hpp"
+#include "dxil/dxil_resources.hpp"
 
 namespace dxil_spv
 {
@@ -51,7 +52,7 @@ static bool instruction_is_ballot(const llvm::Value *aggregate)
 	if (const auto *call_inst = llvm::dyn_cast<llvm::CallInst>(aggregate))
 	{
 		auto *called_function = call_inst->getCalledFunction();
-		if (strncmp(called_function->getName().data(), "dx.op", 5) == 0)
+		if (is_dxil_op_callee(called_function))
 		{
 			auto *constant = llvm::dyn_cast<llvm::ConstantInt>(call_inst->getOperand(0));
 			if (constant)
@@ -114,7 +115,7 @@ static spv::Id peephole_trivial_arithmetic_identity(Converter::Impl &impl,
                                                     bool is_commutative)
 {
 	// Only peephole fast math.
-	if (!instruction->isFast() || impl.options.force_precise)
+	if (!impl.instruction_is_fast_math(instruction) || impl.options.force_precise)
 		return 0;
 
 	// CP77 can trigger a scenario where we do (a / b) * b in fast math.
@@ -152,12 +153,13 @@ static spv::Id peephole_trivial_arithmetic_identity(Converter::Impl &impl,
 	};
 
 	if (auto *binop = llvm::dyn_cast<llvm::BinaryOperator>(op0))
-		if (binop->isFast() && binop->getOpcode() == inverse_operation && hoist_value(binop, op1))
+		if (impl.instruction_is_fast_math(binop) && binop->getOpcode() == inverse_operation && hoist_value(binop, op1))
 			return impl.get_id_for_value(instruction);
 
 	if (is_commutative)
 		if (auto *binop = llvm::dyn_cast<llvm::BinaryOperator>(op1))
-			if (binop->isFast() && binop->getOpcode() == inverse_operation && hoist_value(binop, op0))
+			if (impl.instruction_is_fast_math(binop) && binop->getOpcode() == inverse_operation &&
+			    hoist_value(binop, op0))
 				return impl.get_id_for_value(instruction);
 
 	return 0;
@@ -170,23 +172,24 @@ static spv::Id resolve_llvm_actual_value_type(Converter::Impl &impl,
 	auto itr = impl.llvm_value_actual_type.find(value);
 	if (itr != impl.llvm_value_actual_type.end())
 	{
+		spv::Id actual_type = itr->second;
 		if (dependent_value)
 		{
 			// Forward the remapped type as required.
-			impl.llvm_value_actual_type[dependent_value] = itr->second;
+			impl.llvm_value_actual_type[dependent_value] = actual_type;
 		}
-		return itr->second;
+		return actual_type;
 	}
 	else
 		return default_value_type;
 }
 
-static bool instruction_is_fast_math(const llvm::BinaryOperator *op)
+static bool instruction_is_fast_math(const Converter::Impl &impl, const llvm::BinaryOperator *op)
 {
-	return op->isFast();
+	return impl.instruction_is_fast_math(op);
 }
 
-static bool instruction_is_fast_math(const llvm::ConstantExpr *)
+static bool instruction_is_fast_math(const Converter::Impl &, const llvm::ConstantExpr *)
 {
 	// Don't want reordering in constant folding anyways.
 	return false;
@@ -212,6 +215,21 @@ static bool instruction_is_undefined_value(const llvm::Value *value)
 		return false;
 }
 
+static spv::Id get_fp16_narrowed_operand(Converter::Impl &impl, const llvm::Value *value)
+{
+	// See analyze_min_precision_narrowing() for which values can show up here.
+	if (auto *constant = llvm::dyn_cast<llvm::ConstantFP>(value))
+	{
+		uint16_t bits = 0;
+		float_to_exact_fp16(constant->getValueAPF().convertToFloat(), &bits);
+		return impl.builder().makeFloat16Constant(bits);
+	}
+	else if (auto *cast_inst = llvm::dyn_cast<llvm::CastInst>(value))
+		return impl.get_id_for_value(cast_inst->getOperand(0));
+	else
+		return impl.get_id_for_value(value);
+}
+
 template <typename InstructionType>
 static spv::Id emit_binary_instruction_impl(Converter::Impl &impl, const InstructionType *instruction)
 {
@@ -365,6 +383,15 @@ static spv::Id emit_binary_instruction_impl(Converter::Impl &impl, const Instruc
 		return false;
 	}
 
+	if (impl.fp16_narrowed_values.count(instruction))
+	{
+		auto *op = impl.allocate(opcode, instruction, impl.builder().makeFloatType(16));
+		op->add_id(get_fp16_narrowed_operand(impl, instruction->getOperand(0)));
+		op->add_id(get_fp16_narrowed_operand(impl, instruction->getOperand(1)));
+		impl.add(op);
+		return op->id;
+	}
+
 	// If we can collapse the expression to undefined (yes, DXIL really emits jank like this!),
 	// just emit the non-undefined part.
 	// We can consider the value to be undefined in a way that it is irrelevant.
@@ -411,7 +438,7 @@ static spv::Id emit_binary_instruction_impl(Converter::Impl &impl, const Instruc
 	op->add_ids({ id0, id1 });
 
 	impl.add(op);
-	if (is_precision_sensitive && (impl.options.force_precise || !instruction_is_fast_math(instruction)))
+	if (is_precision_sensitive && (impl.options.force_precise || !instruction_is_fast_math(impl, instruction)))
 		impl.builder().addDecoration(op->id, spv::DecorationNoContraction);
 
 	// Only bother relaxing FP, since Integers are murky w.r.t. signage in DXIL.
@@ -691,6 +718,15 @@ static spv::Id emit_cast_instruction_impl(Converter::Impl &impl, const Instructi
 		return quant_op->id;
 	}
 
+	// FPTrunc of arithmetic which was already evaluated in FP16, or FPExt which only feeds such arithmetic
+	// and reads the FP16 value directly.
+	if (impl.fp16_narrowed_values.count(instruction))
+	{
+		spv::Id id = impl.get_id_for_value(instruction->getOperand(0));
+		impl.rewrite_value(instruction, id);
+		return id;
+	}
+
 	if (value_cast_is_noop(impl, instruction, can_relax_precision))
 	{
 		spv::Id id;
@@ -1043,6 +1079,31 @@ spv::Id build_constant_expression(Converter::Impl &impl, const llvm::ConstantExp
 	return 0;
 }
 
+static const Vector<spv::Id> *get_scalarized_alloca_elements(Converter::Impl &impl, const llvm::Value *ptr,
+                                                              const llvm::Value **index)
+{
+	auto *gep = llvm::dyn_cast<llvm::GetElementPtrInst>(ptr);
+	if (!gep)
+		return nullptr;
+
+	auto itr = impl.scalarized_allocas.find(gep->getOperand(0));
+	if (itr == impl.scalarized_allocas.end())
+		return nullptr;
+
+	*index = gep->getOperand(2);
+	return &itr->second;
+}
+
+static spv::Id build_scalarized_alloca_index_compare(Converter::Impl &impl, const llvm::Value *index, unsigned element)
+{
+	auto &builder = impl.builder();
+	auto *cmp_op = impl.allocate(spv::OpIEqual, builder.makeBoolType());
+	cmp_op->add_id(impl.get_id_for_value(index));
+	cmp_op->add_id(builder.makeUintConstant(element));
+	impl.add(cmp_op);
+	return cmp_op->id;
+}
+
 bool emit_getelementptr_instruction(Converter::Impl &impl, const llvm::GetElementPtrInst *instruction)
 {
 	// This is actually the same as PtrAccessChain, but we would need to use variable pointers to support that properly.
@@ -1052,6 +1113,19 @@ bool emit_getelementptr_instruction(Converter::Impl &impl, const llvm::GetElemen
 	if (global_itr != impl.llvm_global_variable_to_resource_mapping.end())
 		return true;
 
+	const llvm::Value *scalarized_index = nullptr;
+	if (auto *elements = get_scalarized_alloca_elements(impl, instruction, &scalarized_index))
+	{
+		// Constant indices resolve directly to the element variable.
+		// Dynamic indices are resolved in the load or store itself.
+		if (const auto *const_index = llvm::dyn_cast<llvm::ConstantInt>(scalarized_index))
+		{
+			impl.rewrite_value(instruction, (*elements)[const_index->getUniqueInteger().getZExtValue()]);
+			impl.handle_to_storage_class[instruction] = spv::StorageClassFunction;
+		}
+		return true;
+	}
+
 	auto &builder = impl.builder();
 	spv::Id ptr_id = impl.get_id_for_value(instruction->getOperand(0));
 	spv::Id type_id = impl.get_type_id(instruction->getType()->getPointerElementType());
@@ -1099,6 +1173,42 @@ bool emit_load_instruction(Converter::Impl &impl, const llvm::LoadInst *instruct
 	if (itr != impl.llvm_global_variable_to_resource_mapping.end())
 		return true;
 
+	const llvm::Value *scalarized_index = nullptr;
+	auto *elements = get_scalarized_alloca_elements(impl, instruction->getPointerOperand(), &scalarized_index);
+	if (elements && !llvm::isa<llvm::ConstantInt>(scalarized_index))
+	{
+		// Dynamic index into a scalarized array, select the element.
+		spv::Id type_id = impl.get_type_id(instruction->getType());
+		spv::Id result_id = 0;
+
+		for (unsigned i = 0; i < elements->size(); i++)
+		{
+			Operation *load_op = impl.allocate(spv::OpLoad, type_id);
+			load_op->add_id((*elements)[i]);
+			impl.add(load_op);
+
+			if (i == 0)
+			{
+				result_id = load_op->id;
+				continue;
+			}
+
+			spv::Id cmp_id = build_scalarized_alloca_index_compare(impl, scalarized_index, i);
+			Operation *select_op = i + 1 == elements->size() ?
+			                       impl.allocate(spv::OpSelect, instruction) :
+			                       impl.allocate(spv::OpSelect, type_id);
+			select_op->add_id(cmp_id);
+			select_op->add_id(load_op->id);
+			select_op->add_id(result_id);
+			impl.add(select_op);
+			result_id = select_op->id;
+		}
+
+		if (elements->size() == 1)
+			impl.rewrite_value(instruction, result_id);
+		return true;
+	}
+
 	// We need to get the ID here as the constexpr chain could set our type.
 	spv::Id value_id = impl.get_id_for_value(instruction->getPointerOperand());
 
@@ -1126,6 +1236,35 @@ bool emit_load_instruction(Converter::Impl &impl, const llvm::LoadInst *instruct
 
 bool emit_store_instruction(Converter::Impl &impl, const llvm::StoreInst *instruction)
 {
+	const llvm::Value *scalarized_index = nullptr;
+	auto *elements = get_scalarized_alloca_elements(impl, instruction->getOperand(1), &scalarized_index);
+	if (elements && !llvm::isa<llvm::ConstantInt>(scalarized_index))
+	{
+		// Dynamic index into a scalarized array, conditionally replace every element.
+		spv::Id type_id = impl.get_type_id(instruction->getOperand(0)->getType());
+		spv::Id value_id = impl.get_id_for_value(instruction->getOperand(0));
+
+		for (unsigned i = 0; i < elements->size(); i++)
+		{
+			Operation *load_op = impl.allocate(spv::OpLoad, type_id);
+			load_op->add_id((*elements)[i]);
+			impl.add(load_op);
+
+			Operation *select_op = impl.allocate(spv::OpSelect, type_id);
+			select_op->add_id(build_scalarized_alloca_index_compare(impl, scalarized_index, i));
+			select_op->add_id(value_id);
+			select_op->add_id(load_op->id);
+			impl.add(select_op);
+
+			Operation *store_op = impl.allocate(spv::OpStore);
+			store_op->add_id((*elements)[i]);
+			store_op->add_id(select_op->id);
+			impl.add(store_op);
+		}
+
+		return true;
+	}
+
 	Operation *op = impl.allocate(spv::OpStore);
 
 	// We need to get the ID here as the constexpr chain could set our type.
@@ -1319,10 +1458,39 @@ bool emit_compare_instruction(Converter::Impl &impl, const llvm::CmpInst *instru
 
 bool emit_extract_value_instruction(Converter::Impl &impl, const llvm::ExtractValueInst *instruction)
 {
+	auto sparse_itr = impl.sparse_feedback_components.find(instruction->getAggregateOperand());
+	if (sparse_itr != impl.sparse_feedback_components.end())
+	{
+		spv::Id component_id = sparse_itr->second.ids[instruction->getIndices()[0]];
+		assert(component_id);
+		impl.rewrite_value(instruction, component_id);
+		return true;
+	}
+
 	auto itr = impl.llvm_composite_meta.find(instruction->getAggregateOperand());
 	assert(itr != impl.llvm_composite_meta.end());
 
-	if (itr->second.components == 1 && !itr->second.forced_composite)
+	if (const llvm::Value *coalesced_load = itr->second.coalesced_load)
+	{
+		// The load was never emitted on its own, read the component from the wider load instead.
+		unsigned component = itr->second.coalesced_component + instruction->getIndices()[0];
+		itr = impl.llvm_composite_meta.find(coalesced_load);
+		assert(itr != impl.llvm_composite_meta.end());
+
+		if (itr->second.components == 1 && !itr->second.forced_composite)
+		{
+			impl.rewrite_value(instruction, impl.get_id_for_value(coalesced_load));
+		}
+		else
+		{
+			Operation *op = impl.allocate(spv::OpCompositeExtract, instruction);
+			op->add_id(impl.get_id_for_value(coalesced_load));
+			op->add_literal(component);
+			impl.add(op);
+			impl.decorate_relaxed_precision(instruction->getType(), op->id, false);
+		}
+	}
+	else if (itr->second.components == 1 && !itr->second.forced_composite)
 	{
 		// Forward the ID. The composite was originally emitted as a scalar.
 		spv::Id rewrite_id = impl.get_id_for_value(instruction->getAggregateOperand());
@@ -1352,8 +1520,6 @@ bool emit_alloca_instruction(Converter::Impl &impl, const llvm::AllocaInst *inst
 		return false;
 	}
 
-	spv::Id pointee_type_id = impl.get_type_id(element_type);
-
 	// DXC seems to allocate arrays on stack as 1 element of array type rather than N elements of basic non-array type.
 	// Should be possible to support both schemes if desirable, but this will do.
 	if (!llvm::isa<llvm::ConstantInt>(instruction->getArraySize()))
@@ -1373,6 +1539,26 @@ bool emit_alloca_instruction(Converter::Impl &impl, const llvm::AllocaInst *inst
 		return false;
 
 	auto storage = impl.get_effective_storage_class(instruction, spv::StorageClassFunction);
+
+	auto scalarized_itr = impl.scalarized_allocas.find(instruction);
+	if (scalarized_itr != impl.scalarized_allocas.end())
+	{
+		auto *scalar_type = element_type->getArrayElementType();
+		spv::Id scalar_type_id = impl.get_type_id(scalar_type);
+		unsigned num_elements = unsigned(element_type->getArrayNumElements());
+
+		for (unsigned i = 0; i < num_elements; i++)
+		{
+			spv::Id var_id = impl.create_variable(storage, scalar_type_id);
+			impl.decorate_relaxed_precision(scalar_type, var_id, false);
+			scalarized_itr->second.push_back(var_id);
+		}
+
+		impl.handle_to_storage_class[instruction] = storage;
+		return true;
+	}
+
+	spv::Id pointee_type_id = impl.get_type_id(element_type);
 	spv::Id var_id = impl.create_variable(storage, pointee_type_id);
 	impl.rewrite_value(instruction, var_id);
 	impl.handle_to_storage_class[instruction] = storage;
@@ -1684,9 +1870,243 @@ bool analyze_compare_instruction(Converter::Impl &impl, const llvm::CmpInst *ins
 	return true;
 }
 
+static uint64_t sign_extend_value(uint64_t value, unsigned width)
+{
+	if (width >= 64)
+		return value;
+	uint64_t sign_bit = 1ull << (width - 1);
+	return (value ^ sign_bit) - sign_bit;
+}
+
+static bool evaluate_specialized_integer_value(Converter::Impl &impl, const llvm::Value *value,
+                                               uint64_t &result, bool &specialized, unsigned depth)
+{
+	// DXC tends to flatten these into short expression trees, so deep chains are not worth chasing.
+	if (depth > 32)
+		return false;
+
+	if (const auto *constant = llvm::dyn_cast<llvm::ConstantInt>(value))
+	{
+		result = constant->getUniqueInteger().getZExtValue();
+		return true;
+	}
+
+	// Leaves which are known from pipeline state. Root constants may be floats, which are passed through as raw bits.
+	if (const auto *extract = llvm::dyn_cast<llvm::ExtractValueInst>(value))
+	{
+		if (extract->getNumIndices() != 1 ||
+		    !value_is_dx_op_instrinsic(extract->getAggregateOperand(), DXIL::Op::CBufferLoadLegacy))
+		{
+			return false;
+		}
+
+		uint32_t word;
+		if (!get_known_root_constant_value(impl, llvm::cast<llvm::CallInst>(extract->getAggregateOperand()),
+		                                   extract->getIndices()[0], word))
+		{
+			return false;
+		}
+
+		result = word;
+		specialized = true;
+		return true;
+	}
+	else if (value_is_dx_op_instrinsic(value, DXIL::Op::CBufferLoad))
+	{
+		uint32_t word;
+		if (!get_known_root_constant_value(impl, llvm::cast<llvm::CallInst>(value), 0, word))
+			return false;
+
+		result = word;
+		specialized = true;
+		return true;
+	}
+	else if (value_is_dx_op_instrinsic(value, DXIL::Op::RenderTargetGetSampleCount))
+	{
+		if (impl.options.rasterizer_sample_count_spec_constant)
+			return false;
+
+		result = impl.options.rasterizer_sample_count;
+		specialized = true;
+		return true;
+	}
+
+	if (value->getType()->getTypeID() != llvm::Type::TypeID::IntegerTyID)
+		return false;
+
+	unsigned width = value->getType()->getIntegerBitWidth();
+	if (width == 0 || width > 64)
+		return false;
+	uint64_t mask = width == 64 ? ~0ull : ((1ull << width) - 1);
+
+	if (const auto *cmp = llvm::dyn_cast<llvm::CmpInst>(value))
+	{
+		if (cmp->getPredicate() < llvm::CmpInst::Predicate::ICMP_EQ)
+			return false;
+
+		uint64_t a, b;
+		if (!evaluate_specialized_integer_value(impl, cmp->getOperand(0), a, specialized, depth + 1) ||
+		    !evaluate_specialized_integer_value(impl, cmp->getOperand(1), b, specialized, depth + 1))
+		{
+			return false;
+		}
+
+		unsigned op_width = cmp->getOperand(0)->getType()->getIntegerBitWidth();
+		auto sa = int64_t(sign_extend_value(a, op_width));
+		auto sb = int64_t(sign_extend_value(b, op_width));
+
+		switch (cmp->getPredicate())
+		{
+		case llvm::CmpInst::Predicate::ICMP_EQ:
+			result = a == b;
+			break;
+		case llvm::CmpInst::Predicate::ICMP_NE:
+			result = a != b;
+			break;
+		case llvm::CmpInst::Predicate::ICMP_UGT:
+			result = a > b;
+			break;
+		case llvm::CmpInst::Predicate::ICMP_UGE:
+			result = a >= b;
+			break;
+		case llvm::CmpInst::Predicate::ICMP_ULT:
+			result = a < b;
+			break;
+		case llvm::CmpInst::Predicate::ICMP_ULE:
+			result = a <= b;
+			break;
+		case llvm::CmpInst::Predicate::ICMP_SGT:
+			result = sa > sb;
+			break;
+		case llvm::CmpInst::Predicate::ICMP_SGE:
+			result = sa >= sb;
+			break;
+		case llvm::CmpInst::Predicate::ICMP_SLT:
+			result = sa < sb;
+			break;
+		case llvm::CmpInst::Predicate::ICMP_SLE:
+			result = sa <= sb;
+			break;
+		default:
+			return false;
+		}
+
+		return true;
+	}
+	else if (const auto *binop = llvm::dyn_cast<llvm::BinaryOperator>(value))
+	{
+		uint64_t a, b;
+		if (!evaluate_specialized_integer_value(impl, binop->getOperand(0), a, specialized, depth + 1) ||
+		    !evaluate_specialized_integer_value(impl, binop->getOperand(1), b, specialized, depth + 1))
+		{
+			return false;
+		}
+
+		switch (binop->getOpcode())
+		{
+		case llvm::BinaryOperator::BinaryOps::Add:
+			result = a + b;
+			break;
+		case llvm::BinaryOperator::BinaryOps::Sub:
+			result = a - b;
+			break;
+		case llvm::BinaryOperator::BinaryOps::Mul:
+			result = a * b;
+			break;
+		case llvm::BinaryOperator::BinaryOps::And:
+			result = a & b;
+			break;
+		case llvm::BinaryOperator::BinaryOps::Or:
+			result = a | b;
+			break;
+		case llvm::BinaryOperator::BinaryOps::Xor:
+			result = a ^ b;
+			break;
+
+		case llvm::BinaryOperator::BinaryOps::UDiv:
+		case llvm::BinaryOperator::BinaryOps::URem:
+			if (b == 0)
+				return false;
+			result = binop->getOpcode() == llvm::BinaryOperator::BinaryOps::UDiv ? a / b : a % b;
+			break;
+
+		case llvm::BinaryOperator::BinaryOps::Shl:
+		case llvm::BinaryOperator::BinaryOps::LShr:
+		case llvm::BinaryOperator::BinaryOps::AShr:
+			// Out of range shifts are poison.
+			if (b >= width)
+				return false;
+			if (binop->getOpcode() == llvm::BinaryOperator::BinaryOps::Shl)
+				result = a << b;
+			else if (binop->getOpcode() == llvm::BinaryOperator::BinaryOps::LShr)
+				result = a >> b;
+			else
+				result = uint64_t(int64_t(sign_extend_value(a, width)) >> b);
+			break;
+
+		default:
+			return false;
+		}
+
+		result &= mask;
+		return true;
+	}
+	else if (const auto *cast = llvm::dyn_cast<llvm::CastInst>(value))
+	{
+		uint64_t a;
+		if (!evaluate_specialized_integer_value(impl, cast->getOperand(0), a, specialized, depth + 1))
+			return false;
+
+		switch (cast->getOpcode())
+		{
+		case llvm::Instruction::CastOps::ZExt:
+		case llvm::Instruction::CastOps::Trunc:
+		case llvm::Instruction::CastOps::BitCast:
+			result = a & mask;
+			break;
+
+		case llvm::Instruction::CastOps::SExt:
+			result = sign_extend_value(a, cast->getOperand(0)->getType()->getIntegerBitWidth()) & mask;
+			break;
+
+		default:
+			return false;
+		}
+
+		return true;
+	}
+	else if (const auto *select = llvm::dyn_cast<llvm::SelectInst>(value))
+	{
+		uint64_t cond;
+		if (!evaluate_specialized_integer_value(impl, select->getOperand(0), cond, specialized, depth + 1))
+			return false;
+		return evaluate_specialized_integer_value(impl, select->getOperand(cond ? 1 : 2), result, specialized, depth + 1);
+	}
+
+	return false;
+}
+
+bool evaluate_specialized_integer_value(Converter::Impl &impl, const llvm::Value *value, uint64_t &result)
+{
+	if (impl.options.known_root_constants.empty() && impl.options.rasterizer_sample_count_spec_constant)
+		return false;
+
+	// Plain constant expressions are left to dead code elimination,
+	// only fold values which actually depend on what we specialized on.
+	bool specialized = false;
+	return evaluate_specialized_integer_value(impl, value, result, specialized, 0) && specialized;
+}
+
 bool can_optimize_conditional_branch_to_static(
     Converter::Impl &impl, const llvm::Value *value, bool &static_cond)
 {
+	uint64_t specialized_value;
+	if (evaluate_specialized_integer_value(impl, value, specialized_value))
+	{
+		static_cond = specialized_value != 0;
+		return true;
+	}
+
 	// Can be expanded as needed.
 	// For now, search for common exhaustive loop unrolling patterns that DXC farts out.
 	// Expect pattern of:
@@ -58,4 +58,7 @@ unsigned physical_integer_bit_width(unsigned width);
 spv::Id build_constant_expression(Converter::Impl &impl, const llvm::ConstantExpr *cexpr);
 
 bool can_optimize_conditional_branch_to_static(Converter::Impl &impl, const llvm::Value *value, bool &static_cond_value);
+// Folds integer expressions which depend on root constants in OptionKnownRootConstants
+// or a non-specialization-constant rasterizer sample count.
+bool evaluate_specialized_integer_value(Converter::Impl &impl, const llvm::Value *value, uint64_t &result);
 } // namespace dxil_spv
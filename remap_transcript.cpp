@@ -0,0 +1,668 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "remap_transcript.hpp"
+#include "hash.hpp"
+#include <deque>
+#include <string.h>
+#include <string>
+
+namespace dxil_spv
+{
+namespace
+{
+struct TranscriptWriter
+{
+	std::vector<uint32_t> &words;
+
+	void u32(uint32_t value)
+	{
+		words.push_back(value);
+	}
+
+	void string(const char *str)
+	{
+		size_t len = str ? strlen(str) : 0;
+		u32(uint32_t(len));
+		size_t offset = words.size();
+		words.resize(offset + (len + 3) / 4);
+		if (len)
+			memcpy(words.data() + offset, str, len);
+	}
+};
+
+struct TranscriptReader
+{
+	const uint32_t *words;
+	size_t count;
+	size_t offset;
+	// Backing storage for decoded semantic strings. Deque keeps the pointers stable.
+	std::deque<std::string> strings;
+
+	bool u32(uint32_t &value)
+	{
+		if (offset >= count)
+			return false;
+		value = words[offset++];
+		return true;
+	}
+
+	bool string(const char *&str)
+	{
+		uint32_t len;
+		if (!u32(len))
+			return false;
+
+		size_t num_words = (size_t(len) + 3) / 4;
+		if (count - offset < num_words)
+			return false;
+
+		strings.emplace_back(reinterpret_cast<const char *>(words + offset), len);
+		offset += num_words;
+		str = strings.back().c_str();
+		return true;
+	}
+
+	bool eof() const
+	{
+		return offset == count;
+	}
+};
+
+template <typename T>
+static bool read_enum(TranscriptReader &r, T &value)
+{
+	uint32_t v;
+	if (!r.u32(v))
+		return false;
+	value = T(v);
+	return true;
+}
+
+static bool read_bool(TranscriptReader &r, bool &value)
+{
+	uint32_t v;
+	if (!r.u32(v))
+		return false;
+	value = v != 0;
+	return true;
+}
+
+static void write(TranscriptWriter &w, const D3DBinding &binding)
+{
+	w.u32(uint32_t(binding.stage));
+	w.u32(uint32_t(binding.kind));
+	w.u32(binding.resource_index);
+	w.u32(binding.register_space);
+	w.u32(binding.register_index);
+	w.u32(binding.range_size);
+	w.u32(binding.alignment);
+}
+
+static bool read(TranscriptReader &r, D3DBinding &binding)
+{
+	return read_enum(r, binding.stage) && read_enum(r, binding.kind) &&
+	       r.u32(binding.resource_index) && r.u32(binding.register_space) &&
+	       r.u32(binding.register_index) && r.u32(binding.range_size) && r.u32(binding.alignment);
+}
+
+static void write(TranscriptWriter &w, const D3DUAVBinding &binding)
+{
+	write(w, binding.binding);
+	w.u32(uint32_t(binding.counter));
+}
+
+static bool read(TranscriptReader &r, D3DUAVBinding &binding)
+{
+	return read(r, binding.binding) && read_bool(r, binding.counter);
+}
+
+static void write(TranscriptWriter &w, const VulkanBinding &binding)
+{
+	w.u32(binding.descriptor_set);
+	w.u32(binding.binding);
+	w.u32(binding.root_constant_index);
+	w.u32(binding.bindless.heap_root_offset);
+	w.u32(uint32_t(binding.bindless.use_heap));
+	w.u32(uint32_t(binding.descriptor_type));
+}
+
+static bool read(TranscriptReader &r, VulkanBinding &binding)
+{
+	return r.u32(binding.descriptor_set) && r.u32(binding.binding) && r.u32(binding.root_constant_index) &&
+	       r.u32(binding.bindless.heap_root_offset) && read_bool(r, binding.bindless.use_heap) &&
+	       read_enum(r, binding.descriptor_type);
+}
+
+static void write(TranscriptWriter &w, const VulkanSRVBinding &binding)
+{
+	write(w, binding.buffer_binding);
+	write(w, binding.offset_binding);
+}
+
+static bool read(TranscriptReader &r, VulkanSRVBinding &binding)
+{
+	return read(r, binding.buffer_binding) && read(r, binding.offset_binding);
+}
+
+static void write(TranscriptWriter &w, const VulkanUAVBinding &binding)
+{
+	write(w, binding.buffer_binding);
+	write(w, binding.counter_binding);
+	write(w, binding.offset_binding);
+}
+
+static bool read(TranscriptReader &r, VulkanUAVBinding &binding)
+{
+	return read(r, binding.buffer_binding) && read(r, binding.counter_binding) && read(r, binding.offset_binding);
+}
+
+static void write(TranscriptWriter &w, const VulkanCBVBinding &binding)
+{
+	w.u32(uint32_t(binding.push_constant));
+	if (binding.push_constant)
+		w.u32(binding.push.offset_in_words);
+	else
+		write(w, binding.buffer);
+}
+
+static bool read(TranscriptReader &r, VulkanCBVBinding &binding)
+{
+	if (!read_bool(r, binding.push_constant))
+		return false;
+	if (binding.push_constant)
+		return r.u32(binding.push.offset_in_words);
+	else
+		return read(r, binding.buffer);
+}
+
+static void write(TranscriptWriter &w, const D3DStageIO &io)
+{
+	w.string(io.semantic);
+	w.u32(io.semantic_index);
+	w.u32(io.start_row);
+	w.u32(io.rows);
+}
+
+static bool read(TranscriptReader &r, D3DStageIO &io)
+{
+	return r.string(io.semantic) && r.u32(io.semantic_index) && r.u32(io.start_row) && r.u32(io.rows);
+}
+
+static void write(TranscriptWriter &w, const VulkanStageIO &io)
+{
+	w.u32(io.location);
+	w.u32(io.component);
+	w.u32(io.flags);
+}
+
+static bool read(TranscriptReader &r, VulkanStageIO &io)
+{
+	return r.u32(io.location) && r.u32(io.component) && r.u32(io.flags);
+}
+
+static void write(TranscriptWriter &w, const D3DStreamOutput &output)
+{
+	w.string(output.semantic);
+	w.u32(output.semantic_index);
+}
+
+static bool read(TranscriptReader &r, D3DStreamOutput &output)
+{
+	return r.string(output.semantic) && r.u32(output.semantic_index);
+}
+
+static void write(TranscriptWriter &w, const VulkanStreamOutput &output)
+{
+	w.u32(output.offset);
+	w.u32(output.stride);
+	w.u32(output.buffer_index);
+	w.u32(uint32_t(output.enable));
+}
+
+static bool read(TranscriptReader &r, VulkanStreamOutput &output)
+{
+	return r.u32(output.offset) && r.u32(output.stride) && r.u32(output.buffer_index) &&
+	       read_bool(r, output.enable);
+}
+
+// Compare encoded forms so that padding and inactive union members do not matter.
+template <typename T>
+static bool encoded_equal(const T &a, const T &b)
+{
+	std::vector<uint32_t> a_words, b_words;
+	TranscriptWriter a_writer = { a_words };
+	TranscriptWriter b_writer = { b_words };
+	write(a_writer, a);
+	write(b_writer, b);
+	return a_words == b_words;
+}
+
+template <typename Input, typename Output, typename Func>
+static bool record_query(std::vector<uint32_t> &transcript, RemapQueryType type,
+                         const Input &input, Output &output, const Func &func)
+{
+	TranscriptWriter w = { transcript };
+	w.u32(uint32_t(type));
+	write(w, input);
+	write(w, output);
+	bool ret = func();
+	w.u32(uint32_t(ret));
+	write(w, output);
+	return ret;
+}
+
+template <typename Input, typename Output, typename Func>
+static bool verify_query(TranscriptReader &r, const Func &func)
+{
+	Input input = {};
+	Output output = {};
+	Output expected = {};
+	bool expected_ret;
+
+	if (!read(r, input) || !read(r, output) || !read_bool(r, expected_ret) || !read(r, expected))
+		return false;
+
+	bool ret = func(input, output);
+	return ret == expected_ret && encoded_equal(output, expected);
+}
+
+template <typename Input, typename Output>
+static bool skip_query(TranscriptReader &r, size_t &key_end)
+{
+	Input input = {};
+	Output output = {};
+	bool ret;
+
+	if (!read(r, input) || !read(r, output))
+		return false;
+	key_end = r.offset;
+	return read_bool(r, ret) && read(r, output);
+}
+
+// Finds the end of the query key (type and inputs) and the end of the answer.
+static bool skip_record(TranscriptReader &r, RemapQueryType type, size_t &key_end)
+{
+	uint32_t value;
+
+	switch (type)
+	{
+	case RemapQueryType::SRV:
+		return skip_query<D3DBinding, VulkanSRVBinding>(r, key_end);
+	case RemapQueryType::Sampler:
+		return skip_query<D3DBinding, VulkanBinding>(r, key_end);
+	case RemapQueryType::UAV:
+		return skip_query<D3DUAVBinding, VulkanUAVBinding>(r, key_end);
+	case RemapQueryType::CBV:
+		return skip_query<D3DBinding, VulkanCBVBinding>(r, key_end);
+	case RemapQueryType::VertexInput:
+	case RemapQueryType::StageInput:
+	case RemapQueryType::StageOutput:
+		return skip_query<D3DStageIO, VulkanStageIO>(r, key_end);
+	case RemapQueryType::StreamOutput:
+		return skip_query<D3DStreamOutput, VulkanStreamOutput>(r, key_end);
+
+	case RemapQueryType::RootConstantWordCount:
+	case RemapQueryType::RootDescriptorCount:
+	case RemapQueryType::NontrivialStageInputRemapping:
+		key_end = r.offset;
+		return r.u32(value);
+
+	default:
+		return false;
+	}
+}
+
+static bool read_header(TranscriptReader &r)
+{
+	uint32_t magic, version;
+	return r.u32(magic) && r.u32(version) && magic == RemapTranscriptMagic && version == RemapTranscriptVersion;
+}
+
+static uint64_t hash_key(const uint32_t *words, size_t count)
+{
+	Hasher h;
+	for (size_t i = 0; i < count; i++)
+		h.u32(words[i]);
+	return h.get();
+}
+}
+
+RemapTranscriptRecorder::RemapTranscriptRecorder(ResourceRemappingInterface &iface_, std::vector<uint32_t> &transcript_)
+    : iface(iface_), transcript(transcript_)
+{
+	if (transcript.empty())
+	{
+		transcript.push_back(RemapTranscriptMagic);
+		transcript.push_back(RemapTranscriptVersion);
+	}
+}
+
+bool RemapTranscriptRecorder::remap_srv(const D3DBinding &d3d_binding, VulkanSRVBinding &vulkan_binding)
+{
+	return record_query(transcript, RemapQueryType::SRV, d3d_binding, vulkan_binding,
+	                    [&]() { return iface.remap_srv(d3d_binding, vulkan_binding); });
+}
+
+bool RemapTranscriptRecorder::remap_sampler(const D3DBinding &d3d_binding, VulkanBinding &vulkan_binding)
+{
+	return record_query(transcript, RemapQueryType::Sampler, d3d_binding, vulkan_binding,
+	                    [&]() { return iface.remap_sampler(d3d_binding, vulkan_binding); });
+}
+
+bool RemapTranscriptRecorder::remap_uav(const D3DUAVBinding &d3d_binding, VulkanUAVBinding &vulkan_binding)
+{
+	return record_query(transcript, RemapQueryType::UAV, d3d_binding, vulkan_binding,
+	                    [&]() { return iface.remap_uav(d3d_binding, vulkan_binding); });
+}
+
+bool RemapTranscriptRecorder::remap_cbv(const D3DBinding &d3d_binding, VulkanCBVBinding &vulkan_binding)
+{
+	return record_query(transcript, RemapQueryType::CBV, d3d_binding, vulkan_binding,
+	                    [&]() { return iface.remap_cbv(d3d_binding, vulkan_binding); });
+}
+
+bool RemapTranscriptRecorder::remap_vertex_input(const D3DStageIO &d3d_input, VulkanStageIO &vulkan_location)
+{
+	return record_query(transcript, RemapQueryType::VertexInput, d3d_input, vulkan_location,
+	                    [&]() { return iface.remap_vertex_input(d3d_input, vulkan_location); });
+}
+
+bool RemapTranscriptRecorder::remap_stream_output(const D3DStreamOutput &d3d_output, VulkanStreamOutput &vulkan_output)
+{
+	return record_query(transcript, RemapQueryType::StreamOutput, d3d_output, vulkan_output,
+	                    [&]() { return iface.remap_stream_output(d3d_output, vulkan_output); });
+}
+
+bool RemapTranscriptRecorder::remap_stage_input(const D3DStageIO &d3d_input, VulkanStageIO &vk_input)
+{
+	return record_query(transcript, RemapQueryType::StageInput, d3d_input, vk_input,
+	                    [&]() { return iface.remap_stage_input(d3d_input, vk_input); });
+}
+
+bool RemapTranscriptRecorder::remap_stage_output(const D3DStageIO &d3d_output, VulkanStageIO &vk_output)
+{
+	return record_query(transcript, RemapQueryType::StageOutput, d3d_output, vk_output,
+	                    [&]() { return iface.remap_stage_output(d3d_output, vk_output); });
+}
+
+unsigned RemapTranscriptRecorder::get_root_constant_word_count()
+{
+	unsigned count = iface.get_root_constant_word_count();
+	transcript.push_back(uint32_t(RemapQueryType::RootConstantWordCount));
+	transcript.push_back(count);
+	return count;
+}
+
+unsigned RemapTranscriptRecorder::get_root_descriptor_count()
+{
+	unsigned count = iface.get_root_descriptor_count();
+	transcript.push_back(uint32_t(RemapQueryType::RootDescriptorCount));
+	transcript.push_back(count);
+	return count;
+}
+
+bool RemapTranscriptRecorder::has_nontrivial_stage_input_remapping()
+{
+	bool ret = iface.has_nontrivial_stage_input_remapping();
+	transcript.push_back(uint32_t(RemapQueryType::NontrivialStageInputRemapping));
+	transcript.push_back(uint32_t(ret));
+	return ret;
+}
+
+bool verify_remap_transcript(const uint32_t *words, size_t count, ResourceRemappingInterface &iface)
+{
+	TranscriptReader r = { words, count, 0 };
+	if (!read_header(r))
+		return false;
+
+	while (!r.eof())
+	{
+		RemapQueryType type;
+		if (!read_enum(r, type))
+			return false;
+
+		bool match;
+		uint32_t expected;
+
+		switch (type)
+		{
+		case RemapQueryType::SRV:
+			match = verify_query<D3DBinding, VulkanSRVBinding>(
+			    r, [&](const D3DBinding &in, VulkanSRVBinding &out) { return iface.remap_srv(in, out); });
+			break;
+
+		case RemapQueryType::Sampler:
+			match = verify_query<D3DBinding, VulkanBinding>(
+			    r, [&](const D3DBinding &in, VulkanBinding &out) { return iface.remap_sampler(in, out); });
+			break;
+
+		case RemapQueryType::UAV:
+			match = verify_query<D3DUAVBinding, VulkanUAVBinding>(
+			    r, [&](const D3DUAVBinding &in, VulkanUAVBinding &out) { return iface.remap_uav(in, out); });
+			break;
+
+		case RemapQueryType::CBV:
+			match = verify_query<D3DBinding, VulkanCBVBinding>(
+			    r, [&](const D3DBinding &in, VulkanCBVBinding &out) { return iface.remap_cbv(in, out); });
+			break;
+
+		case RemapQueryType::VertexInput:
+			match = verify_query<D3DStageIO, VulkanStageIO>(
+			    r, [&](const D3DStageIO &in, VulkanStageIO &out) { return iface.remap_vertex_input(in, out); });
+			break;
+
+		case RemapQueryType::StreamOutput:
+			match = verify_query<D3DStreamOutput, VulkanStreamOutput>(
+			    r, [&](const D3DStreamOutput &in, VulkanStreamOutput &out) { return iface.remap_stream_output(in, out); });
+			break;
+
+		case RemapQueryType::StageInput:
+			match = verify_query<D3DStageIO, VulkanStageIO>(
+			    r, [&](const D3DStageIO &in, VulkanStageIO &out) { return iface.remap_stage_input(in, out); });
+			break;
+
+		case RemapQueryType::StageOutput:
+			match = verify_query<D3DStageIO, VulkanStageIO>(
+			    r, [&](const D3DStageIO &in, VulkanStageIO &out) { return iface.remap_stage_output(in, out); });
+			break;
+
+		case RemapQueryType::RootConstantWordCount:
+			match = r.u32(expected) && iface.get_root_constant_word_count() == expected;
+			break;
+
+		case RemapQueryType::RootDescriptorCount:
+			match = r.u32(expected) && iface.get_root_descriptor_count() == expected;
+			break;
+
+		case RemapQueryType::NontrivialStageInputRemapping:
+			match = r.u32(expected) && uint32_t(iface.has_nontrivial_stage_input_remapping()) == expected;
+			break;
+
+		default:
+			match = false;
+			break;
+		}
+
+		if (!match)
+			return false;
+	}
+
+	return true;
+}
+
+RemapTranscriptReplayer::RemapTranscriptReplayer(const uint32_t *words_, size_t count,
+                                                 ResourceRemappingInterface *fallback_)
+    : words(words_, words_ + count), fallback(fallback_)
+{
+	TranscriptReader r = { words.data(), words.size(), 0 };
+	valid = read_header(r);
+
+	while (valid && !r.eof())
+	{
+		size_t key_offset = r.offset;
+		size_t key_end = 0;
+		RemapQueryType type;
+
+		if (!read_enum(r, type) || !skip_record(r, type, key_end))
+		{
+			valid = false;
+			break;
+		}
+
+		Record record = { key_offset, key_end - key_offset, key_end, r.offset - key_end };
+		records.insert({ hash_key(words.data() + key_offset, record.key_count), record });
+	}
+
+	if (!valid)
+		records.clear();
+}
+
+bool RemapTranscriptReplayer::is_valid() const
+{
+	return valid;
+}
+
+unsigned RemapTranscriptReplayer::get_num_misses() const
+{
+	return num_misses;
+}
+
+const RemapTranscriptReplayer::Record *RemapTranscriptReplayer::find_record() const
+{
+	auto range = records.equal_range(hash_key(key.data(), key.size()));
+	for (auto itr = range.first; itr != range.second; ++itr)
+	{
+		auto &record = itr->second;
+		if (record.key_count == key.size() &&
+		    memcmp(words.data() + record.key_offset, key.data(), key.size() * sizeof(uint32_t)) == 0)
+		{
+			return &record;
+		}
+	}
+
+	return nullptr;
+}
+
+template <typename Input, typename Output, typename Func>
+bool RemapTranscriptReplayer::replay(RemapQueryType type, const Input &input, Output &output, const Func &func)
+{
+	key.clear();
+	TranscriptWriter w = { key };
+	w.u32(uint32_t(type));
+	write(w, input);
+	write(w, output);
+
+	if (auto *record = find_record())
+	{
+		TranscriptReader r = { words.data() + record->answer_offset, record->answer_count, 0 };
+		bool ret;
+		if (read_bool(r, ret) && read(r, output))
+			return ret;
+	}
+
+	num_misses++;
+	return fallback && func();
+}
+
+template <typename Func>
+uint32_t RemapTranscriptReplayer::replay_value(RemapQueryType type, const Func &func)
+{
+	key.clear();
+	key.push_back(uint32_t(type));
+
+	if (auto *record = find_record())
+		return words[record->answer_offset];
+
+	num_misses++;
+	return fallback ? func() : 0;
+}
+
+bool RemapTranscriptReplayer::remap_srv(const D3DBinding &d3d_binding, VulkanSRVBinding &vulkan_binding)
+{
+	return replay(RemapQueryType::SRV, d3d_binding, vulkan_binding,
+	              [&]() { return fallback->remap_srv(d3d_binding, vulkan_binding); });
+}
+
+bool RemapTranscriptReplayer::remap_sampler(const D3DBinding &d3d_binding, VulkanBinding &vulkan_binding)
+{
+	return replay(RemapQueryType::Sampler, d3d_binding, vulkan_binding,
+	              [&]() { return fallback->remap_sampler(d3d_binding, vulkan_binding); });
+}
+
+bool RemapTranscriptReplayer::remap_uav(const D3DUAVBinding &d3d_binding, VulkanUAVBinding &vulkan_binding)
+{
+	return replay(RemapQueryType::UAV, d3d_binding, vulkan_binding,
+	              [&]() { return fallback->remap_uav(d3d_binding, vulkan_binding); });
+}
+
+bool RemapTranscriptReplayer::remap_cbv(const D3DBinding &d3d_binding, VulkanCBVBinding &vulkan_binding)
+{
+	return replay(RemapQueryType::CBV, d3d_binding, vulkan_binding,
+	              [&]() { return fallback->remap_cbv(d3d_binding, vulkan_binding); });
+}
+
+bool RemapTranscriptReplayer::remap_vertex_input(const D3DStageIO &d3d_input, VulkanStageIO &vulkan_location)
+{
+	return replay(RemapQueryType::VertexInput, d3d_input, vulkan_location,
+	              [&]() { return fallback->remap_vertex_input(d3d_input, vulkan_location); });
+}
+
+bool RemapTranscriptReplayer::remap_stream_output(const D3DStreamOutput &d3d_output, VulkanStreamOutput &vulkan_output)
+{
+	return replay(RemapQueryType::StreamOutput, d3d_output, vulkan_output,
+	              [&]() { return fallback->remap_stream_output(d3d_output, vulkan_output); });
+}
+
+bool RemapTranscriptReplayer::remap_stage_input(const D3DStageIO &d3d_input, VulkanStageIO &vk_input)
+{
+	return replay(RemapQueryType::StageInput, d3d_input, vk_input,
+	              [&]() { return fallback->remap_stage_input(d3d_input, vk_input); });
+}
+
+bool RemapTranscriptReplayer::remap_stage_output(const D3DStageIO &d3d_output, VulkanStageIO &vk_output)
+{
+	return replay(RemapQueryType::StageOutput, d3d_output, vk_output,
+	              [&]() { return fallback->remap_stage_output(d3d_output, vk_output); });
+}
+
+unsigned RemapTranscriptReplayer::get_root_constant_word_count()
+{
+	return replay_value(RemapQueryType::RootConstantWordCount,
+	                    [&]() { return fallback->get_root_constant_word_count(); });
+}
+
+unsigned RemapTranscriptReplayer::get_root_descriptor_count()
+{
+	return replay_value(RemapQueryType::RootDescriptorCount,
+	                    [&]() { return fallback->get_root_descriptor_count(); });
+}
+
+bool RemapTranscriptReplayer::has_nontrivial_stage_input_remapping()
+{
+	return replay_value(RemapQueryType::NontrivialStageInputRemapping,
+	                    [&]() { return uint32_t(fallback->has_nontrivial_stage_input_remapping()); }) != 0;
+}
+} // namespace dxil_spv
@@ -0,0 +1,139 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include "dxil_converter.hpp"
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+namespace dxil_spv
+{
+// A remap transcript is a flat word stream which records every query made to a ResourceRemappingInterface
+// during conversion. Each query records its inputs (including any value the converter pre-filled into
+// the output argument) followed by the answer, so that a transcript fully describes how the opaque
+// callbacks influenced code generation.
+// Transcripts are stored in caches shared between threads, so the default allocator is used.
+// The stream begins with a two word header (magic, version) and is safe to serialize as is.
+enum
+{
+	RemapTranscriptMagic = 0x54524458, // DXRT
+	RemapTranscriptVersion = 1,
+	RemapTranscriptHeaderWords = 2
+};
+
+enum class RemapQueryType : uint32_t
+{
+	SRV = 0,
+	Sampler = 1,
+	UAV = 2,
+	CBV = 3,
+	VertexInput = 4,
+	StreamOutput = 5,
+	StageInput = 6,
+	StageOutput = 7,
+	RootConstantWordCount = 8,
+	RootDescriptorCount = 9,
+	NontrivialStageInputRemapping = 10
+};
+
+// Forwards every query to an underlying interface and records it.
+// If transcript is empty, the header is written first.
+class RemapTranscriptRecorder : public ResourceRemappingInterface
+{
+public:
+	RemapTranscriptRecorder(ResourceRemappingInterface &iface, std::vector<uint32_t> &transcript);
+
+	bool remap_srv(const D3DBinding &d3d_binding, VulkanSRVBinding &vulkan_binding) override;
+	bool remap_sampler(const D3DBinding &d3d_binding, VulkanBinding &vulkan_binding) override;
+	bool remap_uav(const D3DUAVBinding &d3d_binding, VulkanUAVBinding &vulkan_binding) override;
+	bool remap_cbv(const D3DBinding &d3d_binding, VulkanCBVBinding &vulkan_binding) override;
+	bool remap_vertex_input(const D3DStageIO &d3d_input, VulkanStageIO &vulkan_location) override;
+	bool remap_stream_output(const D3DStreamOutput &d3d_output, VulkanStreamOutput &vulkan_output) override;
+	bool remap_stage_input(const D3DStageIO &d3d_input, VulkanStageIO &vk_input) override;
+	bool remap_stage_output(const D3DStageIO &d3d_output, VulkanStageIO &vk_output) override;
+	unsigned get_root_constant_word_count() override;
+	unsigned get_root_descriptor_count() override;
+	bool has_nontrivial_stage_input_remapping() override;
+
+private:
+	ResourceRemappingInterface &iface;
+	std::vector<uint32_t> &transcript;
+};
+
+// Answers queries from a transcript instead of invoking callbacks.
+// Queries are matched on their full input, so the order of queries does not matter.
+// Queries which are not found in the transcript are forwarded to fallback if set, and fail otherwise.
+class RemapTranscriptReplayer : public ResourceRemappingInterface
+{
+public:
+	RemapTranscriptReplayer(const uint32_t *words, size_t count, ResourceRemappingInterface *fallback);
+
+	// False if the transcript is malformed. An invalid transcript behaves as if it were empty.
+	bool is_valid() const;
+	// Number of queries which were not found in the transcript.
+	unsigned get_num_misses() const;
+
+	bool remap_srv(const D3DBinding &d3d_binding, VulkanSRVBinding &vulkan_binding) override;
+	bool remap_sampler(const D3DBinding &d3d_binding, VulkanBinding &vulkan_binding) override;
+	bool remap_uav(const D3DUAVBinding &d3d_binding, VulkanUAVBinding &vulkan_binding) override;
+	bool remap_cbv(const D3DBinding &d3d_binding, VulkanCBVBinding &vulkan_binding) override;
+	bool remap_vertex_input(const D3DStageIO &d3d_input, VulkanStageIO &vulkan_location) override;
+	bool remap_stream_output(const D3DStreamOutput &d3d_output, VulkanStreamOutput &vulkan_output) override;
+	bool remap_stage_input(const D3DStageIO &d3d_input, VulkanStageIO &vk_input) override;
+	bool remap_stage_output(const D3DStageIO &d3d_output, VulkanStageIO &vk_output) override;
+	unsigned get_root_constant_word_count() override;
+	unsigned get_root_descriptor_count() override;
+	bool has_nontrivial_stage_input_remapping() override;
+
+private:
+	struct Record
+	{
+		size_t key_offset;
+		size_t key_count;
+		size_t answer_offset;
+		size_t answer_count;
+	};
+
+	std::vector<uint32_t> words;
+	std::unordered_multimap<uint64_t, Record> records;
+	ResourceRemappingInterface *fallback;
+	std::vector<uint32_t> key;
+	unsigned num_misses = 0;
+	bool valid = false;
+
+	const Record *find_record() const;
+
+	template <typename Input, typename Output, typename Func>
+	bool replay(RemapQueryType type, const Input &input, Output &output, const Func &func);
+	template <typename Func>
+	uint32_t replay_value(RemapQueryType type, const Func &func);
+};
+
+// Re-issues every recorded query against iface and returns true if every answer matches the recording.
+// If this passes, a conversion which produced the transcript is valid for iface as well.
+bool verify_remap_transcript(const uint32_t *words, size_t count, ResourceRemappingInterface &iface);
+} // namespace dxil_spv
@@ -26,6 +26,10 @@
 #define DXIL_SPV_SCRATCH_POOL_H_
 
 #include "thread_local_allocator.hpp"
+#include <exception>
+#include <memory>
+#include <stdint.h>
+#include <string.h>
 
 namespace dxil_spv
 {
@@ -86,6 +90,87 @@ private:
 	size_t next_allocate_size = 64;
 	Vector<std::unique_ptr<T, MallocDeleter>> blocks;
 };
+
+// Linear allocator for variable-length word arrays.
+// Arrays are typically filled in right after being allocated,
+// so the most recent array grows in place rather than being copied.
+class ScratchWordPool
+{
+public:
+	// Returns storage for at least required_size words, preserving the first size words of data.
+	// capacity is updated to the new capacity.
+	uint32_t *grow(uint32_t *data, uint32_t size, uint32_t required_size, uint32_t &capacity)
+	{
+		if (required_size <= capacity)
+			return data;
+
+		uint32_t extra = required_size - capacity;
+		if (data && data + capacity == current.base + current.offset && current.offset + extra <= current.size)
+		{
+			current.offset += extra;
+			capacity = required_size;
+			return data;
+		}
+
+		uint32_t new_capacity = capacity * 2;
+		if (new_capacity < MinimumCapacity)
+			new_capacity = MinimumCapacity;
+		if (new_capacity < required_size)
+			new_capacity = required_size;
+
+		uint32_t *new_data = allocate(new_capacity);
+		if (size)
+			memcpy(new_data, data, size * sizeof(uint32_t));
+		capacity = new_capacity;
+		return new_data;
+	}
+
+private:
+	enum { MinimumCapacity = 4 };
+
+	uint32_t *allocate(size_t count)
+	{
+		if (current.offset + count > current.size)
+		{
+			while (next_allocate_size < count)
+				next_allocate_size *= 2;
+
+			Block new_block = {};
+			new_block.size = next_allocate_size;
+			new_block.base = static_cast<uint32_t *>(allocate_in_thread(sizeof(uint32_t) * next_allocate_size));
+			if (!new_block.base)
+				std::terminate();
+
+			blocks.emplace_back(new_block.base);
+			if (next_allocate_size < MaxAllocateSize)
+				next_allocate_size *= 2;
+			current = new_block;
+		}
+
+		uint32_t *ret = current.base + current.offset;
+		current.offset += count;
+		return ret;
+	}
+
+	struct MallocDeleter
+	{
+		void operator()(void *ptr) noexcept
+		{
+			free_in_thread(ptr);
+		}
+	};
+
+	struct Block
+	{
+		uint32_t *base;
+		size_t offset;
+		size_t size;
+	};
+	enum { MaxAllocateSize = 64 * 1024 };
+	Block current = {};
+	size_t next_allocate_size = 1024;
+	Vector<std::unique_ptr<uint32_t, MallocDeleter>> blocks;
+};
 } // namespace dxil_spv
 
 #endif
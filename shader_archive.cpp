@@ -0,0 +1,171 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "shader_archive.hpp"
+#include "dxil.hpp"
+#include "hash.hpp"
+#include "logging.hpp"
+#include <string.h>
+
+namespace dxil_spv
+{
+// Fossilize stream archive layout, all integers are little endian:
+// 16 byte magic, with the format version in the last byte.
+// Then for every entry: the name as 40 hex characters (tag and hash), followed by the payload header
+// { payload_size, format, crc, uncompressed_size } and payload_size bytes of payload.
+static const uint8_t FossilizeMagic[12] = { 0x81, 'F', 'O', 'S', 'S', 'I', 'L', 'I', 'Z', 'E', 'D', 'B' };
+static constexpr size_t FossilizeMagicSize = 16;
+static constexpr size_t FossilizeNameSize = 40;
+static constexpr uint32_t FossilizeFormatUncompressed = 1;
+
+struct FossilizePayloadHeader
+{
+	uint32_t payload_size;
+	uint32_t format;
+	uint32_t crc;
+	uint32_t uncompressed_size;
+};
+
+static constexpr uint8_t LLVMBitcodeMagic[4] = { 'B', 'C', 0xc0, 0xde };
+
+static bool is_llvm_bitcode(const MemoryStream &stream)
+{
+	return stream.get_size() >= sizeof(LLVMBitcodeMagic) &&
+	       memcmp(stream.get_data(), LLVMBitcodeMagic, sizeof(LLVMBitcodeMagic)) == 0;
+}
+
+static bool is_dxbc_container(const MemoryStream &stream)
+{
+	uint32_t fourcc;
+	if (stream.get_size() < sizeof(DXIL::ContainerHeader))
+		return false;
+	memcpy(&fourcc, stream.get_data(), sizeof(fourcc));
+	return static_cast<DXIL::FourCC>(fourcc) == DXIL::FourCC::Container;
+}
+
+void ShaderArchiveParser::add_blob(const MemoryStream &stream)
+{
+	uint64_t hash = hash_fnv1(stream.get_data(), stream.get_size());
+	if (!hashes.insert(hash).second)
+	{
+		num_duplicate_blobs++;
+		return;
+	}
+
+	blobs.push_back({ stream, hash, is_llvm_bitcode(stream) });
+}
+
+bool ShaderArchiveParser::parse_fossilize(MemoryStream &stream)
+{
+	if (!stream.seek(FossilizeMagicSize))
+		return false;
+
+	while (stream.get_offset() < stream.get_size())
+	{
+		FossilizePayloadHeader header;
+		if (!stream.skip(FossilizeNameSize) || !stream.read(header))
+		{
+			// Archives which were being written when the process died end with a partial entry.
+			LOGW("Truncated entry at end of Fossilize archive, ignoring.\n");
+			break;
+		}
+
+		size_t offset = stream.get_offset();
+		if (!stream.skip(header.payload_size))
+		{
+			LOGW("Truncated entry at end of Fossilize archive, ignoring.\n");
+			break;
+		}
+
+		auto payload = stream.create_substream(offset, header.payload_size);
+		if (header.format == FossilizeFormatUncompressed &&
+		    (is_dxbc_container(payload) || is_llvm_bitcode(payload)))
+		{
+			add_blob(payload);
+		}
+		else
+			num_skipped_entries++;
+	}
+
+	return true;
+}
+
+bool ShaderArchiveParser::parse_containers(MemoryStream &stream)
+{
+	while (stream.get_offset() < stream.get_size())
+	{
+		size_t offset = stream.get_offset();
+		DXIL::ContainerHeader header;
+		if (!stream.read(header) || static_cast<DXIL::FourCC>(header.header_fourcc) != DXIL::FourCC::Container ||
+		    header.container_size_in_bytes < sizeof(header))
+		{
+			LOGE("Invalid DXBC container at offset %zu.\n", offset);
+			return false;
+		}
+
+		if (!stream.seek(offset + header.container_size_in_bytes))
+		{
+			LOGE("DXBC container at offset %zu is truncated.\n", offset);
+			return false;
+		}
+
+		add_blob(stream.create_substream(offset, header.container_size_in_bytes));
+	}
+
+	return true;
+}
+
+bool ShaderArchiveParser::parse(const void *data, size_t size)
+{
+	blobs.clear();
+	hashes.clear();
+	num_skipped_entries = 0;
+	num_duplicate_blobs = 0;
+
+	MemoryStream stream(data, size);
+	if (size >= FossilizeMagicSize && memcmp(data, FossilizeMagic, sizeof(FossilizeMagic)) == 0)
+		return parse_fossilize(stream);
+	else if (is_dxbc_container(stream))
+		return parse_containers(stream);
+
+	LOGE("Unrecognized shader archive format.\n");
+	return false;
+}
+
+const Vector<ShaderArchiveParser::Blob> &ShaderArchiveParser::get_blobs() const
+{
+	return blobs;
+}
+
+unsigned ShaderArchiveParser::get_num_skipped_entries() const
+{
+	return num_skipped_entries;
+}
+
+unsigned ShaderArchiveParser::get_num_duplicate_blobs() const
+{
+	return num_duplicate_blobs;
+}
+} // namespace dxil_spv
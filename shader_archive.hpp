@@ -0,0 +1,71 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include "thread_local_allocator.hpp"
+#include "memory_stream.hpp"
+#include <stddef.h>
+#include <stdint.h>
+
+namespace dxil_spv
+{
+// Finds shader blobs in an archive of many blobs without copying them out.
+// Supported layouts:
+// - Fossilize stream archives (.foz). Only entries which are stored uncompressed and
+//   hold a DXBC container or raw LLVM bitcode are considered, everything else is skipped.
+// - DXBC containers stored back to back, where each container header gives the size of the container.
+// Blobs are deduplicated by their FNV-1 hash, which is also the hash vkd3d-proton uses for shaders.
+class ShaderArchiveParser
+{
+public:
+	struct Blob
+	{
+		// Points directly into the archive.
+		MemoryStream stream;
+		uint64_t hash;
+		// If false, the blob is a DXBC container.
+		bool raw_llvm;
+	};
+
+	bool parse(const void *data, size_t size);
+
+	const Vector<Blob> &get_blobs() const;
+
+	// Entries which did not hold a shader, or were stored compressed.
+	unsigned get_num_skipped_entries() const;
+	unsigned get_num_duplicate_blobs() const;
+
+private:
+	Vector<Blob> blobs;
+	UnorderedSet<uint64_t> hashes;
+	unsigned num_skipped_entries = 0;
+	unsigned num_duplicate_blobs = 0;
+
+	bool parse_fossilize(MemoryStream &stream);
+	bool parse_containers(MemoryStream &stream);
+	void add_blob(const MemoryStream &stream);
+};
+} // namespace dxil_spv
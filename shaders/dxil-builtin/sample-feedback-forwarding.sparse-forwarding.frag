@@ -0,0 +1,23 @@
+Texture2D<float4> Tex : register(t0);
+Buffer<float4> Buf : register(t1);
+SamplerState Samp : register(s0);
+
+float4 main(float4 UV : TEXCOORD) : SV_Target
+{
+	uint feedback;
+	float4 res = 0.0.xxxx;
+
+	// Only some texel components are read, so the rest are never unpacked.
+	float4 s = Tex.Sample(Samp, UV.xy, int2(0, 0), 0.0, feedback);
+	res.xy += s.xz;
+
+	// Checking the same status value twice should reuse one residency query.
+	res += CheckAccessFullyMapped(feedback) ? 1.0 : 0.0;
+	res += CheckAccessFullyMapped(feedback) ? 2.0 : 0.0;
+
+	float4 b = Buf.Load(int(UV.z), feedback);
+	res.w += b.w;
+	res += CheckAccessFullyMapped(feedback) ? 4.0 : 0.0;
+
+	return res;
+}
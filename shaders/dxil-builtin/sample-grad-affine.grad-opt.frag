@@ -0,0 +1,22 @@
+Texture2D<float4> Tex : register(t0);
+SamplerState Samp : register(s0);
+
+cbuffer Transform : register(b0)
+{
+	float Tiling;
+	float2 Offset;
+};
+
+float4 main(float2 UV : TEXCOORD) : SV_Target
+{
+	float4 res = 0.0.xxxx;
+	float2 coord = UV * Tiling + Offset;
+
+	// The coordinate is an affine function of UV with quad-uniform scale and offset,
+	// so derivatives of either one can be turned into a LOD bias.
+	res += Tex.SampleGrad(Samp, coord, ddx(UV) * Tiling, ddy(UV) * Tiling);
+	res += Tex.SampleGrad(Samp, coord, ddx(coord) * 0.5, ddy(coord) * 0.5);
+	res += Tex.SampleGrad(Samp, UV, ddx(coord), ddy(coord));
+
+	return res;
+}
@@ -0,0 +1,14 @@
+Texture2D<float4> Tex : register(t0);
+SamplerState Samp : register(s0);
+
+cbuffer Scales : register(b0)
+{
+	float ScaleX;
+	float ScaleY;
+};
+
+float4 main(float2 UV : TEXCOORD) : SV_Target
+{
+	// Different scales for X and Y become a bias of log2(min(|ScaleX|, |ScaleY|)) when uniform scaling is assumed.
+	return Tex.SampleGrad(Samp, UV, ddx(UV) * ScaleX, ddy(UV) * ScaleY);
+}
@@ -0,0 +1,25 @@
+Texture2D<float4> Tex : register(t0);
+SamplerState Samp : register(s0);
+
+cbuffer Scales : register(b0)
+{
+	float ScaleX;
+	float ScaleY;
+};
+
+// None of these gradients may be turned into a LOD bias, every sample must remain explicit gradient sampling.
+float4 main(float2 UV : TEXCOORD, float Lane : LANE) : SV_Target
+{
+	float4 res = 0.0.xxxx;
+
+	// Squaring is not affine, Deriv(UV * UV) is not a multiple of Deriv(UV).
+	res += Tex.SampleGrad(Samp, UV * UV, ddx(UV), ddy(UV));
+	// The offset is not a multiple of the derivative.
+	res += Tex.SampleGrad(Samp, UV, ddx(UV) + 0.1, ddy(UV) + 0.1);
+	// A scale which varies per lane does not commute with the derivative.
+	res += Tex.SampleGrad(Samp, UV * Lane, ddx(UV), ddy(UV));
+	// Different scales for X and Y need the uniform scale assumption.
+	res += Tex.SampleGrad(Samp, UV, ddx(UV) * ScaleX, ddy(UV) * ScaleY);
+
+	return res;
+}
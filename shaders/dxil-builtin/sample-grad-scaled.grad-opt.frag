@@ -0,0 +1,21 @@
+Texture2D<float4> Tex : register(t0);
+SamplerState Samp : register(s0);
+
+cbuffer Scales : register(b0)
+{
+	float Scale;
+	float Divisor;
+};
+
+float4 main(float2 UV : TEXCOORD) : SV_Target
+{
+	float4 res = 0.0.xxxx;
+
+	// Gradients which are a quad-uniform multiple of the coordinate derivatives are sampled with a LOD bias.
+	res += Tex.SampleGrad(Samp, UV, ddx(UV) * Scale, ddy(UV) * Scale);
+	res += Tex.SampleGrad(Samp, UV, ddx_fine(UV) / Divisor, ddy_fine(UV) / Divisor);
+	res += Tex.SampleGrad(Samp, UV, -ddx_coarse(UV) * 2.0, -ddy_coarse(UV) * 2.0);
+	res += Tex.SampleGrad(Samp, UV, ddx(UV) * (Scale / Divisor), ddy(UV) * (Scale / Divisor));
+
+	return res;
+}
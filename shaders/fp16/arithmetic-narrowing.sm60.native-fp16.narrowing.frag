@@ -0,0 +1,15 @@
+Texture2D<min16float4> Tex : register(t0);
+SamplerState Samp : register(s0);
+
+min16float4 main(min16float4 a : A, min16float4 b : B, float2 uv : UV) : SV_Target
+{
+	// Mixed min precision math is lowered to FP32 trees between FPExt and FPTrunc,
+	// which can be evaluated directly in FP16.
+	min16float4 t = Tex.Sample(Samp, uv);
+	min16float4 r = a * b + t * 0.5;
+	r = r - a * 2.0;
+
+	// Not exact in FP16, so this tree stays in FP32.
+	r += b * 0.1f;
+	return r;
+}
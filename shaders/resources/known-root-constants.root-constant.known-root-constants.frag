@@ -0,0 +1,38 @@
+cbuffer Cbuf : register(b0)
+{
+	uint mode;
+	uint enable_extra;
+	uint unknown;
+};
+
+Texture2D<float4> Tex : register(t0);
+SamplerState Samp : register(s0);
+
+float4 main(float2 UV : TEXCOORD) : SV_Target
+{
+	// With mode == 2 and enable_extra == 0 known up front, only the mode 2 path is emitted.
+	float4 res;
+	switch (mode)
+	{
+	case 0:
+		res = Tex.Sample(Samp, UV);
+		break;
+	case 2:
+		res = Tex.SampleLevel(Samp, UV, 2.0);
+		break;
+	default:
+		res = 0.0.xxxx;
+		break;
+	}
+
+	[branch]
+	if (enable_extra != 0)
+		res += Tex.Sample(Samp, UV * 2.0);
+
+	// Not specialized, so this is loaded as usual.
+	[branch]
+	if (unknown + mode > 4)
+		res *= 2.0;
+
+	return res;
+}
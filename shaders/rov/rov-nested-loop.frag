@@ -0,0 +1,23 @@
+RasterizerOrderedTexture2D<float4> RW0 : register(u0);
+RWTexture2D<float4> RW2 : register(u2);
+
+[earlydepthstencil]
+void main(float4 pos : SV_Position)
+{
+	uint2 coord = uint2(pos.xy);
+
+	RW2[coord] += float4(1, 2, 3, 4);
+
+	// Begin should land right before the outer loop, and end right after it.
+	[loop]
+	for (uint i = 0; i < uint(pos.z); i++)
+	{
+		RW2[coord] += 1.0.xxxx;
+
+		[loop]
+		for (uint j = 0; j < uint(pos.w); j++)
+			RW0[coord] += float4(i, j, 0, 0);
+	}
+
+	RW2[coord] += 2.0.xxxx;
+}
@@ -0,0 +1,15 @@
+FeedbackTexture2D<SAMPLER_FEEDBACK_MIP_REGION_USED> F0 : register(u0);
+FeedbackTexture2DArray<SAMPLER_FEEDBACK_MIN_MIP> F1 : register(u1);
+
+Texture2D<float4> T : register(t0);
+Texture2DArray<float4> TArray : register(t1);
+SamplerState S : register(s0);
+
+void main(float4 pos : SV_Position, float2 grad_x : GRADX, float2 grad_y : GRADY, float bias : BIAS)
+{
+	// Trilinear footprints write both the fine and the coarse LOD.
+	F0.WriteSamplerFeedback(T, S, pos.xy);
+	F0.WriteSamplerFeedbackBias(T, S, pos.xy, bias);
+	F1.WriteSamplerFeedbackGrad(TArray, S, pos.xyz, grad_x, grad_y);
+	F1.WriteSamplerFeedbackLevel(TArray, S, pos.xyz, bias);
+}
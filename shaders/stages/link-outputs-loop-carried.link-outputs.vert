@@ -0,0 +1,23 @@
+struct VOut
+{
+	float4 pos : SV_Position;
+	float4 kept : TEXCOORD0;
+	float4 stripped : TEXCOORD1;
+};
+
+VOut main(float4 a : A, uint count : COUNT)
+{
+	VOut o;
+	float4 acc = 0.0.xxxx;
+	float4 dead = a;
+	for (uint i = 0; i < count; i++)
+	{
+		// The add is only read by the loop header PHI.
+		acc += a * float(i);
+		dead = dead * dead + 1.0;
+	}
+	o.pos = acc;
+	o.kept = acc.wzyx;
+	o.stripped = dead;
+	return o;
+}
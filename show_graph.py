@@ -1,10 +1,74 @@
 #!/usr/bin/env python3
 
 from graphviz import Source
+import struct
 import sys
 
+CFG_SNAPSHOT_MAGIC = 0x46434458
+CFG_SNAPSHOT_VERSION = 1
+INVALID_BLOCK = 0xffffffff
+
+# Must match Terminator::Type and MergeType in ir.hpp.
+TERMINATOR_SWITCH = 3
+MERGE_LOOP = 1
+MERGE_SELECTION = 2
+
+def read_words(data):
+    return struct.unpack('<{}I'.format(len(data) // 4), data[:len(data) // 4 * 4])
+
+# Converts a CFG snapshot (see cfg_snapshot.hpp) to the same dot layout as CFGStructurizer::log_cfg_graphviz().
+def snapshot_to_dot(data):
+    words = read_words(data)
+    if words[0] != CFG_SNAPSHOT_MAGIC or words[1] != CFG_SNAPSHOT_VERSION:
+        raise ValueError('Not a supported CFG snapshot.')
+
+    offset = 3
+    lines = ['digraph {']
+    for index in range(words[2]):
+        name_len = words[offset]
+        offset += 1
+        name = data[offset * 4:offset * 4 + name_len].decode('utf-8', 'replace')
+        offset += (name_len + 3) // 4
+
+        terminator, merge, merge_block, continue_block, num_ops = words[offset:offset + 5]
+        offset += 5
+
+        shape = { MERGE_LOOP: 'circle', MERGE_SELECTION: 'triangle' }.get(merge, 'box')
+        lines.append('{} [label="{} ({} ops)", shape="{}"];'.format(index, name, num_ops, shape))
+
+        count = words[offset]
+        offset += 1
+        if terminator == TERMINATOR_SWITCH:
+            targets = [words[offset + 3 * i] for i in range(count)]
+            offset += 3 * count
+        else:
+            targets = list(words[offset:offset + count])
+            offset += count
+
+        for target in targets:
+            lines.append('{} -> {};'.format(index, target))
+
+        if merge == MERGE_LOOP and continue_block != INVALID_BLOCK:
+            lines.append('{} -> {} [style="dotted"];'.format(index, continue_block))
+        if merge != 0 and merge_block != INVALID_BLOCK:
+            lines.append('{} -> {} [style="dashed"];'.format(index, merge_block))
+
+        num_phis = words[offset]
+        offset += 1
+        for _ in range(num_phis):
+            offset += 1 + words[offset]
+
+    lines.append('}')
+    return '\n'.join(lines)
+
 def main():
-    s = Source.from_file(sys.argv[1])
+    with open(sys.argv[1], 'rb') as f:
+        data = f.read()
+
+    if len(data) >= 4 and read_words(data[:4])[0] == CFG_SNAPSHOT_MAGIC:
+        s = Source(snapshot_to_dot(data))
+    else:
+        s = Source.from_file(sys.argv[1])
     s.view()
 
 if __name__ == '__main__':
@@ -0,0 +1,750 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "spirv_canonicalize.hpp"
+#include "spirv.hpp"
+#include <algorithm>
+
+namespace dxil_spv
+{
+namespace
+{
+struct OperandLayout
+{
+	bool has_type;
+	bool has_result;
+	// Operands from literals_begin onwards are literals, as well as the operand at literal_index.
+	uint32_t literal_index;
+	uint32_t literals_begin;
+};
+
+struct Instruction
+{
+	uint32_t offset;
+	uint32_t word_count;
+	spv::Op op;
+	// Range in the list of ID offsets.
+	uint32_t ids_begin;
+	uint32_t ids_end;
+};
+
+enum class SortClass
+{
+	None,
+	Capability,
+	Extension,
+	ExtInstImport,
+	ExecutionMode,
+	Name,
+	Decoration
+};
+}
+
+static constexpr uint32_t NoLiteral = ~0u;
+
+// Covers everything the converter emits. Instructions with irregular operands
+// (OpSwitch, OpEntryPoint, OpSource and memory operands) are handled in get_id_operands().
+static bool get_operand_layout(spv::Op op, OperandLayout &layout)
+{
+	layout = { true, true, NoLiteral, NoLiteral };
+
+	switch (op)
+	{
+	case spv::OpTypeVoid:
+	case spv::OpTypeBool:
+	case spv::OpTypeSampler:
+	case spv::OpTypeAccelerationStructureKHR:
+	case spv::OpTypeRayQueryKHR:
+	case spv::OpTypeArray:
+	case spv::OpTypeRuntimeArray:
+	case spv::OpTypeStruct:
+	case spv::OpTypeFunction:
+	case spv::OpTypeSampledImage:
+	case spv::OpLabel:
+		layout.has_type = false;
+		break;
+
+	case spv::OpExtInstImport:
+	case spv::OpString:
+	case spv::OpTypeInt:
+	case spv::OpTypeFloat:
+		layout.has_type = false;
+		layout.literals_begin = 0;
+		break;
+
+	case spv::OpTypeVector:
+	case spv::OpTypeMatrix:
+	case spv::OpTypeImage:
+		layout.has_type = false;
+		layout.literals_begin = 1;
+		break;
+
+	case spv::OpTypePointer:
+		layout.has_type = false;
+		layout.literal_index = 0;
+		break;
+
+	case spv::OpConstant:
+	case spv::OpSpecConstant:
+		layout.literals_begin = 0;
+		break;
+
+	case spv::OpFunction:
+	case spv::OpVariable:
+	case spv::OpSpecConstantOp:
+		layout.literal_index = 0;
+		break;
+
+	case spv::OpCompositeExtract:
+	case spv::OpArrayLength:
+		layout.literals_begin = 1;
+		break;
+
+	case spv::OpVectorShuffle:
+	case spv::OpCompositeInsert:
+		layout.literals_begin = 2;
+		break;
+
+	case spv::OpExtInst:
+	case spv::OpGroupNonUniformBallotBitCount:
+	case spv::OpGroupNonUniformIAdd:
+	case spv::OpGroupNonUniformFAdd:
+	case spv::OpGroupNonUniformIMul:
+	case spv::OpGroupNonUniformFMul:
+	case spv::OpGroupNonUniformSMin:
+	case spv::OpGroupNonUniformUMin:
+	case spv::OpGroupNonUniformFMin:
+	case spv::OpGroupNonUniformSMax:
+	case spv::OpGroupNonUniformUMax:
+	case spv::OpGroupNonUniformFMax:
+	case spv::OpGroupNonUniformBitwiseAnd:
+	case spv::OpGroupNonUniformBitwiseOr:
+	case spv::OpGroupNonUniformBitwiseXor:
+	case spv::OpGroupNonUniformLogicalAnd:
+	case spv::OpGroupNonUniformLogicalOr:
+	case spv::OpGroupNonUniformLogicalXor:
+		// Set or scope, then instruction or GroupOperation.
+		layout.literal_index = 1;
+		break;
+
+	case spv::OpSDotKHR:
+	case spv::OpUDotKHR:
+		// Optional packed vector format.
+		layout.literal_index = 2;
+		break;
+
+	case spv::OpImageSampleImplicitLod:
+	case spv::OpImageSampleExplicitLod:
+	case spv::OpImageSampleProjImplicitLod:
+	case spv::OpImageSampleProjExplicitLod:
+	case spv::OpImageSparseSampleImplicitLod:
+	case spv::OpImageSparseSampleExplicitLod:
+	case spv::OpImageSparseSampleProjImplicitLod:
+	case spv::OpImageSparseSampleProjExplicitLod:
+	case spv::OpImageFetch:
+	case spv::OpImageSparseFetch:
+	case spv::OpImageRead:
+	case spv::OpImageSparseRead:
+		// Image operand arguments are all IDs, only the mask is a literal.
+		layout.literal_index = 2;
+		break;
+
+	case spv::OpImageSampleDrefImplicitLod:
+	case spv::OpImageSampleDrefExplicitLod:
+	case spv::OpImageSampleProjDrefImplicitLod:
+	case spv::OpImageSampleProjDrefExplicitLod:
+	case spv::OpImageSparseSampleDrefImplicitLod:
+	case spv::OpImageSparseSampleDrefExplicitLod:
+	case spv::OpImageSparseSampleProjDrefImplicitLod:
+	case spv::OpImageSparseSampleProjDrefExplicitLod:
+	case spv::OpImageGather:
+	case spv::OpImageDrefGather:
+	case spv::OpImageSparseGather:
+	case spv::OpImageSparseDrefGather:
+		layout.literal_index = 3;
+		break;
+
+	case spv::OpImageWrite:
+		layout.has_type = false;
+		layout.has_result = false;
+		layout.literal_index = 3;
+		break;
+
+	case spv::OpConstantTrue:
+	case spv::OpConstantFalse:
+	case spv::OpConstantNull:
+	case spv::OpConstantComposite:
+	case spv::OpSpecConstantTrue:
+	case spv::OpSpecConstantFalse:
+	case spv::OpSpecConstantComposite:
+	case spv::OpFunctionParameter:
+	case spv::OpFunctionCall:
+	case spv::OpUndef:
+	case spv::OpPhi:
+	case spv::OpSelect:
+	case spv::OpCopyObject:
+	case spv::OpBitcast:
+	case spv::OpConvertFToS:
+	case spv::OpConvertFToU:
+	case spv::OpConvertSToF:
+	case spv::OpConvertUToF:
+	case spv::OpSConvert:
+	case spv::OpUConvert:
+	case spv::OpFConvert:
+	case spv::OpQuantizeToF16:
+	case spv::OpConvertUToAccelerationStructureKHR:
+	case spv::OpSNegate:
+	case spv::OpFNegate:
+	case spv::OpIAdd:
+	case spv::OpFAdd:
+	case spv::OpISub:
+	case spv::OpFSub:
+	case spv::OpIMul:
+	case spv::OpFMul:
+	case spv::OpUDiv:
+	case spv::OpSDiv:
+	case spv::OpFDiv:
+	case spv::OpUMod:
+	case spv::OpSRem:
+	case spv::OpSMod:
+	case spv::OpFRem:
+	case spv::OpFMod:
+	case spv::OpIAddCarry:
+	case spv::OpISubBorrow:
+	case spv::OpUMulExtended:
+	case spv::OpSMulExtended:
+	case spv::OpDot:
+	case spv::OpVectorTimesScalar:
+	case spv::OpVectorExtractDynamic:
+	case spv::OpVectorInsertDynamic:
+	case spv::OpShiftLeftLogical:
+	case spv::OpShiftRightLogical:
+	case spv::OpShiftRightArithmetic:
+	case spv::OpBitwiseAnd:
+	case spv::OpBitwiseOr:
+	case spv::OpBitwiseXor:
+	case spv::OpNot:
+	case spv::OpBitFieldInsert:
+	case spv::OpBitFieldSExtract:
+	case spv::OpBitFieldUExtract:
+	case spv::OpBitReverse:
+	case spv::OpBitCount:
+	case spv::OpIEqual:
+	case spv::OpINotEqual:
+	case spv::OpUGreaterThan:
+	case spv::OpSGreaterThan:
+	case spv::OpUGreaterThanEqual:
+	case spv::OpSGreaterThanEqual:
+	case spv::OpULessThan:
+	case spv::OpSLessThan:
+	case spv::OpULessThanEqual:
+	case spv::OpSLessThanEqual:
+	case spv::OpFOrdEqual:
+	case spv::OpFUnordEqual:
+	case spv::OpFOrdNotEqual:
+	case spv::OpFUnordNotEqual:
+	case spv::OpFOrdLessThan:
+	case spv::OpFUnordLessThan:
+	case spv::OpFOrdGreaterThan:
+	case spv::OpFUnordGreaterThan:
+	case spv::OpFOrdLessThanEqual:
+	case spv::OpFUnordLessThanEqual:
+	case spv::OpFOrdGreaterThanEqual:
+	case spv::OpFUnordGreaterThanEqual:
+	case spv::OpIsNan:
+	case spv::OpIsInf:
+	case spv::OpAll:
+	case spv::OpAny:
+	case spv::OpLogicalAnd:
+	case spv::OpLogicalOr:
+	case spv::OpLogicalNot:
+	case spv::OpLogicalEqual:
+	case spv::OpLogicalNotEqual:
+	case spv::OpCompositeConstruct:
+	case spv::OpAccessChain:
+	case spv::OpInBoundsAccessChain:
+	case spv::OpDPdx:
+	case spv::OpDPdy:
+	case spv::OpFwidth:
+	case spv::OpDPdxFine:
+	case spv::OpDPdyFine:
+	case spv::OpFwidthFine:
+	case spv::OpDPdxCoarse:
+	case spv::OpDPdyCoarse:
+	case spv::OpFwidthCoarse:
+	case spv::OpSampledImage:
+	case spv::OpImageTexelPointer:
+	case spv::OpImageQuerySize:
+	case spv::OpImageQuerySizeLod:
+	case spv::OpImageQueryLevels:
+	case spv::OpImageQueryLod:
+	case spv::OpImageQuerySamples:
+	case spv::OpImageSparseTexelsResident:
+	case spv::OpAtomicLoad:
+	case spv::OpAtomicExchange:
+	case spv::OpAtomicCompareExchange:
+	case spv::OpAtomicIIncrement:
+	case spv::OpAtomicIDecrement:
+	case spv::OpAtomicIAdd:
+	case spv::OpAtomicISub:
+	case spv::OpAtomicSMin:
+	case spv::OpAtomicUMin:
+	case spv::OpAtomicSMax:
+	case spv::OpAtomicUMax:
+	case spv::OpAtomicAnd:
+	case spv::OpAtomicOr:
+	case spv::OpAtomicXor:
+	case spv::OpGroupNonUniformElect:
+	case spv::OpGroupNonUniformAll:
+	case spv::OpGroupNonUniformAny:
+	case spv::OpGroupNonUniformAllEqual:
+	case spv::OpGroupNonUniformBroadcast:
+	case spv::OpGroupNonUniformBroadcastFirst:
+	case spv::OpGroupNonUniformBallot:
+	case spv::OpGroupNonUniformInverseBallot:
+	case spv::OpGroupNonUniformBallotBitExtract:
+	case spv::OpGroupNonUniformBallotFindLSB:
+	case spv::OpGroupNonUniformBallotFindMSB:
+	case spv::OpGroupNonUniformShuffle:
+	case spv::OpGroupNonUniformShuffleXor:
+	case spv::OpGroupNonUniformShuffleUp:
+	case spv::OpGroupNonUniformShuffleDown:
+	case spv::OpGroupNonUniformQuadBroadcast:
+	case spv::OpGroupNonUniformQuadSwap:
+	case spv::OpGroupNonUniformPartitionNV:
+	case spv::OpIsHelperInvocationEXT:
+	case spv::OpReportIntersectionKHR:
+	case spv::OpRayQueryProceedKHR:
+	case spv::OpRayQueryGetIntersectionTypeKHR:
+	case spv::OpRayQueryGetRayTMinKHR:
+	case spv::OpRayQueryGetRayFlagsKHR:
+	case spv::OpRayQueryGetIntersectionTKHR:
+	case spv::OpRayQueryGetIntersectionInstanceCustomIndexKHR:
+	case spv::OpRayQueryGetIntersectionInstanceIdKHR:
+	case spv::OpRayQueryGetIntersectionInstanceShaderBindingTableRecordOffsetKHR:
+	case spv::OpRayQueryGetIntersectionGeometryIndexKHR:
+	case spv::OpRayQueryGetIntersectionPrimitiveIndexKHR:
+	case spv::OpRayQueryGetIntersectionBarycentricsKHR:
+	case spv::OpRayQueryGetIntersectionFrontFaceKHR:
+	case spv::OpRayQueryGetIntersectionCandidateAABBOpaqueKHR:
+	case spv::OpRayQueryGetIntersectionObjectRayDirectionKHR:
+	case spv::OpRayQueryGetIntersectionObjectRayOriginKHR:
+	case spv::OpRayQueryGetWorldRayDirectionKHR:
+	case spv::OpRayQueryGetWorldRayOriginKHR:
+	case spv::OpRayQueryGetIntersectionObjectToWorldKHR:
+	case spv::OpRayQueryGetIntersectionWorldToObjectKHR:
+		break;
+
+	case spv::OpNop:
+	case spv::OpFunctionEnd:
+	case spv::OpReturn:
+	case spv::OpReturnValue:
+	case spv::OpBranch:
+	case spv::OpUnreachable:
+	case spv::OpKill:
+	case spv::OpTerminateInvocation:
+	case spv::OpDemoteToHelperInvocationEXT:
+	case spv::OpBeginInvocationInterlockEXT:
+	case spv::OpEndInvocationInterlockEXT:
+	case spv::OpControlBarrier:
+	case spv::OpMemoryBarrier:
+	case spv::OpAtomicStore:
+	case spv::OpEmitVertex:
+	case spv::OpEndPrimitive:
+	case spv::OpEmitStreamVertex:
+	case spv::OpEndStreamPrimitive:
+	case spv::OpSetMeshOutputsEXT:
+	case spv::OpEmitMeshTasksEXT:
+	case spv::OpTraceRayKHR:
+	case spv::OpExecuteCallableKHR:
+	case spv::OpIgnoreIntersectionKHR:
+	case spv::OpTerminateRayKHR:
+	case spv::OpRayQueryInitializeKHR:
+	case spv::OpRayQueryTerminateKHR:
+	case spv::OpRayQueryGenerateIntersectionKHR:
+	case spv::OpRayQueryConfirmIntersectionKHR:
+		layout.has_type = false;
+		layout.has_result = false;
+		break;
+
+	case spv::OpCapability:
+	case spv::OpExtension:
+	case spv::OpMemoryModel:
+	case spv::OpSourceExtension:
+	case spv::OpSourceContinued:
+	case spv::OpModuleProcessed:
+		layout.has_type = false;
+		layout.has_result = false;
+		layout.literals_begin = 0;
+		break;
+
+	case spv::OpName:
+	case spv::OpMemberName:
+	case spv::OpDecorate:
+	case spv::OpDecorateString:
+	case spv::OpMemberDecorate:
+	case spv::OpExecutionMode:
+	case spv::OpLine:
+	case spv::OpSelectionMerge:
+		layout.has_type = false;
+		layout.has_result = false;
+		layout.literals_begin = 1;
+		break;
+
+	case spv::OpDecorateId:
+	case spv::OpExecutionModeId:
+		layout.has_type = false;
+		layout.has_result = false;
+		layout.literal_index = 1;
+		break;
+
+	case spv::OpLoopMerge:
+		layout.has_type = false;
+		layout.has_result = false;
+		layout.literals_begin = 2;
+		break;
+
+	case spv::OpBranchConditional:
+		layout.has_type = false;
+		layout.has_result = false;
+		layout.literals_begin = 3;
+		break;
+
+	default:
+		return false;
+	}
+
+	return true;
+}
+
+static SortClass get_sort_class(spv::Op op)
+{
+	switch (op)
+	{
+	case spv::OpCapability:
+		return SortClass::Capability;
+	case spv::OpExtension:
+		return SortClass::Extension;
+	case spv::OpExtInstImport:
+		return SortClass::ExtInstImport;
+	case spv::OpExecutionMode:
+	case spv::OpExecutionModeId:
+		return SortClass::ExecutionMode;
+	case spv::OpName:
+	case spv::OpMemberName:
+		return SortClass::Name;
+	case spv::OpDecorate:
+	case spv::OpDecorateId:
+	case spv::OpDecorateString:
+	case spv::OpMemberDecorate:
+		return SortClass::Decoration;
+	default:
+		return SortClass::None;
+	}
+}
+
+// Everything before the first type declaration. IDs are numbered in the order the rest of the module uses them,
+// so that names and decorations cannot affect the numbering.
+static bool opcode_is_preamble(spv::Op op)
+{
+	switch (op)
+	{
+	case spv::OpCapability:
+	case spv::OpExtension:
+	case spv::OpExtInstImport:
+	case spv::OpMemoryModel:
+	case spv::OpEntryPoint:
+	case spv::OpExecutionMode:
+	case spv::OpExecutionModeId:
+	case spv::OpString:
+	case spv::OpSourceExtension:
+	case spv::OpSource:
+	case spv::OpSourceContinued:
+	case spv::OpName:
+	case spv::OpMemberName:
+	case spv::OpModuleProcessed:
+	case spv::OpDecorate:
+	case spv::OpDecorateId:
+	case spv::OpDecorateString:
+	case spv::OpMemberDecorate:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+// Returns the number of words taken by a nul-terminated string starting at offset, or 0 if it is not terminated.
+static uint32_t get_string_word_count(const uint32_t *inst, uint32_t offset, uint32_t word_count)
+{
+	for (uint32_t i = offset; i < word_count; i++)
+		if ((inst[i] >> 24) == 0 || (inst[i] & 0xff0000u) == 0 || (inst[i] & 0xff00u) == 0 || (inst[i] & 0xffu) == 0)
+			return i - offset + 1;
+	return 0;
+}
+
+// Memory operands are a mask followed by an Aligned literal and then scope IDs.
+static bool add_memory_operand_ids(uint32_t mask_offset, uint32_t word_count, const uint32_t *inst,
+                                   Vector<uint32_t> &ids)
+{
+	if (mask_offset >= word_count)
+		return true;
+
+	uint32_t mask = inst[mask_offset];
+	uint32_t offset = mask_offset + 1;
+	if (mask & spv::MemoryAccessAlignedMask)
+		offset++;
+	if (mask & spv::MemoryAccessMakePointerAvailableMask)
+		ids.push_back(offset++);
+	if (mask & spv::MemoryAccessMakePointerVisibleMask)
+		ids.push_back(offset++);
+	return offset == word_count;
+}
+
+// Collects the word offsets within inst of every ID operand.
+static bool get_id_operands(const uint32_t *inst, uint32_t word_count, const Vector<uint32_t> &int_type_words,
+                            const Vector<uint32_t> &value_types, Vector<uint32_t> &ids)
+{
+	auto op = spv::Op(inst[0] & spv::OpCodeMask);
+	ids.clear();
+
+	switch (op)
+	{
+	case spv::OpEntryPoint:
+	{
+		// Execution model, function, name, interface.
+		uint32_t name_words = word_count > 3 ? get_string_word_count(inst, 3, word_count) : 0;
+		if (!name_words)
+			return false;
+		ids.push_back(2);
+		for (uint32_t i = 3 + name_words; i < word_count; i++)
+			ids.push_back(i);
+		return true;
+	}
+
+	case spv::OpSource:
+		// Language, version, optional file, optional source.
+		if (word_count > 3)
+			ids.push_back(3);
+		return word_count >= 3;
+
+	case spv::OpLoad:
+		if (word_count < 4)
+			return false;
+		ids.push_back(1);
+		ids.push_back(2);
+		ids.push_back(3);
+		return add_memory_operand_ids(4, word_count, inst, ids);
+
+	case spv::OpStore:
+		if (word_count < 3)
+			return false;
+		ids.push_back(1);
+		ids.push_back(2);
+		return add_memory_operand_ids(3, word_count, inst, ids);
+
+	case spv::OpSwitch:
+	{
+		// Selector, default, then pairs of literal and label, where the literal is as wide as the selector.
+		if (word_count < 3 || inst[1] >= value_types.size() || value_types[inst[1]] >= int_type_words.size())
+			return false;
+		uint32_t literal_words = int_type_words[value_types[inst[1]]];
+		if (!literal_words || (word_count - 3) % (literal_words + 1) != 0)
+			return false;
+		ids.push_back(1);
+		ids.push_back(2);
+		for (uint32_t i = 3; i < word_count; i += literal_words + 1)
+			ids.push_back(i + literal_words);
+		return true;
+	}
+
+	default:
+		break;
+	}
+
+	OperandLayout layout;
+	if (!get_operand_layout(op, layout))
+		return false;
+
+	uint32_t first_operand = 1 + uint32_t(layout.has_type) + uint32_t(layout.has_result);
+	if (word_count < first_operand)
+		return false;
+
+	// The operands of the wrapped opcode are assumed to be IDs.
+	if (op == spv::OpSpecConstantOp && word_count > 3)
+	{
+		auto inner_op = spv::Op(inst[3]);
+		if (inner_op == spv::OpCompositeExtract || inner_op == spv::OpCompositeInsert ||
+		    inner_op == spv::OpVectorShuffle)
+		{
+			return false;
+		}
+	}
+
+	for (uint32_t i = 1; i < word_count; i++)
+	{
+		uint32_t operand = i - first_operand;
+		if (i < first_operand || (operand != layout.literal_index && operand < layout.literals_begin))
+			ids.push_back(i);
+	}
+	return true;
+}
+
+// Orders by opcode, then by operands. The first word also holds the word count, which is not a useful key.
+static bool compare_instructions(const uint32_t *a, uint32_t a_count, const uint32_t *b, uint32_t b_count,
+                                 uint32_t first_operand)
+{
+	uint32_t a_op = a[0] & spv::OpCodeMask;
+	uint32_t b_op = b[0] & spv::OpCodeMask;
+	if (a_op != b_op)
+		return a_op < b_op;
+	return std::lexicographical_compare(a + first_operand, a + a_count, b + first_operand, b + b_count);
+}
+
+void canonicalize_spirv(Vector<uint32_t> &spirv)
+{
+	if (spirv.size() < 5 || spirv[0] != spv::MagicNumber)
+		return;
+
+	uint32_t bound = spirv[3];
+	Vector<Instruction> instructions;
+	// Offsets into spirv of every word which holds an ID.
+	Vector<uint32_t> id_offsets;
+	Vector<uint32_t> int_type_words(bound);
+	Vector<uint32_t> value_types(bound);
+	Vector<uint32_t> ids;
+
+	for (uint32_t offset = 5; offset < spirv.size();)
+	{
+		const uint32_t *inst = spirv.data() + offset;
+		uint32_t word_count = inst[0] >> spv::WordCountShift;
+		auto op = spv::Op(inst[0] & spv::OpCodeMask);
+		if (word_count == 0 || offset + word_count > spirv.size())
+			return;
+
+		if (!get_id_operands(inst, word_count, int_type_words, value_types, ids))
+			return;
+
+		uint32_t ids_begin = uint32_t(id_offsets.size());
+		for (auto index : ids)
+		{
+			if (inst[index] == 0 || inst[index] >= bound)
+				return;
+			id_offsets.push_back(offset + index);
+		}
+
+		if (op == spv::OpTypeInt && word_count >= 3)
+			int_type_words[inst[1]] = inst[2] > 32 ? 2 : 1;
+
+		OperandLayout layout;
+		if (get_operand_layout(op, layout) && layout.has_type && layout.has_result && word_count >= 3)
+			value_types[inst[2]] = inst[1];
+
+		instructions.push_back({ offset, word_count, op, ids_begin, uint32_t(id_offsets.size()) });
+		offset += word_count;
+	}
+
+	// Extended instruction sets are only referred to by name, so order them by name before numbering.
+	// The result ID is the second word, skip it when comparing.
+	auto import_begin = std::find_if(instructions.begin(), instructions.end(), [](const Instruction &inst) {
+		return inst.op == spv::OpExtInstImport;
+	});
+	auto import_end = std::find_if(import_begin, instructions.end(), [](const Instruction &inst) {
+		return inst.op != spv::OpExtInstImport;
+	});
+
+	Vector<uint32_t> remap(bound);
+	uint32_t next_id = 1;
+
+	Vector<Instruction> imports(import_begin, import_end);
+	std::stable_sort(imports.begin(), imports.end(), [&](const Instruction &a, const Instruction &b) {
+		return compare_instructions(spirv.data() + a.offset, a.word_count, spirv.data() + b.offset, b.word_count, 2);
+	});
+	std::copy(imports.begin(), imports.end(), import_begin);
+
+	for (auto &inst : imports)
+		if (!remap[spirv[inst.offset + 1]])
+			remap[spirv[inst.offset + 1]] = next_id++;
+
+	auto number_ids = [&](bool preamble) {
+		for (auto &inst : instructions)
+		{
+			if (opcode_is_preamble(inst.op) != preamble)
+				continue;
+			for (uint32_t j = inst.ids_begin; j < inst.ids_end; j++)
+			{
+				uint32_t id = spirv[id_offsets[j]];
+				if (!remap[id])
+					remap[id] = next_id++;
+			}
+		}
+	};
+
+	// Types, constants, globals and functions first, then whatever is only referenced by debug instructions.
+	number_ids(false);
+	number_ids(true);
+
+	for (auto offset : id_offsets)
+		spirv[offset] = remap[spirv[offset]];
+	spirv[3] = next_id;
+
+	// The interface of an entry point is a set.
+	for (auto &inst : instructions)
+	{
+		if (inst.op == spv::OpEntryPoint)
+		{
+			uint32_t *words = spirv.data() + inst.offset;
+			uint32_t interface_begin = 3 + get_string_word_count(words, 3, inst.word_count);
+			std::sort(words + interface_begin, words + inst.word_count);
+		}
+	}
+
+	// Sort every run of order-independent instructions by their words after renumbering.
+	for (size_t i = 0; i < instructions.size();)
+	{
+		SortClass sort_class = get_sort_class(instructions[i].op);
+		size_t end = i + 1;
+		while (end < instructions.size() && get_sort_class(instructions[end].op) == sort_class)
+			end++;
+
+		if (sort_class != SortClass::None && sort_class != SortClass::ExtInstImport)
+		{
+			std::stable_sort(instructions.begin() + i, instructions.begin() + end,
+			                 [&](const Instruction &a, const Instruction &b) {
+				                 return compare_instructions(spirv.data() + a.offset, a.word_count,
+				                                             spirv.data() + b.offset, b.word_count, 1);
+			                 });
+		}
+
+		i = end;
+	}
+
+	Vector<uint32_t> canonical;
+	canonical.reserve(spirv.size());
+	canonical.insert(canonical.end(), spirv.begin(), spirv.begin() + 5);
+	for (auto &inst : instructions)
+		canonical.insert(canonical.end(), spirv.begin() + inst.offset, spirv.begin() + inst.offset + inst.word_count);
+	spirv = std::move(canonical);
+}
+} // namespace dxil_spv
@@ -0,0 +1,514 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "spirv_helper_cache.hpp"
+#include <assert.h>
+#include <string.h>
+
+namespace dxil_spv
+{
+namespace
+{
+struct OperandLayout
+{
+	bool has_type;
+	bool has_result;
+	// Operands from literals_begin onwards are literals, as well as the operand at literal_index.
+	uint32_t literal_index;
+	uint32_t literals_begin;
+};
+}
+
+static constexpr uint32_t NoLiteral = ~0u;
+
+// Only covers what the helper functions in SPIRVModule actually emit.
+// Anything else makes the capture fail, and the helper is then built directly in every module.
+static bool get_operand_layout(spv::Op op, OperandLayout &layout)
+{
+	layout = { true, true, NoLiteral, NoLiteral };
+
+	switch (op)
+	{
+	case spv::OpTypeVoid:
+	case spv::OpTypeBool:
+	case spv::OpTypeFunction:
+	case spv::OpLabel:
+		layout.has_type = false;
+		break;
+
+	case spv::OpTypeInt:
+	case spv::OpTypeFloat:
+		layout.has_type = false;
+		layout.literals_begin = 0;
+		break;
+
+	case spv::OpTypeVector:
+	case spv::OpTypeImage:
+		layout.has_type = false;
+		layout.literals_begin = 1;
+		break;
+
+	case spv::OpTypePointer:
+		layout.has_type = false;
+		layout.literal_index = 0;
+		break;
+
+	case spv::OpConstant:
+		layout.literals_begin = 0;
+		break;
+
+	case spv::OpFunction:
+	case spv::OpVariable:
+		layout.literal_index = 0;
+		break;
+
+	case spv::OpLoad:
+	case spv::OpCompositeExtract:
+		layout.literals_begin = 1;
+		break;
+
+	case spv::OpVectorShuffle:
+		layout.literals_begin = 2;
+		break;
+
+	case spv::OpGroupNonUniformBallotBitCount:
+	case spv::OpGroupNonUniformIAdd:
+	case spv::OpGroupNonUniformFAdd:
+	case spv::OpGroupNonUniformIMul:
+	case spv::OpGroupNonUniformFMul:
+	case spv::OpGroupNonUniformBitwiseAnd:
+	case spv::OpGroupNonUniformBitwiseOr:
+	case spv::OpGroupNonUniformBitwiseXor:
+		// Scope, GroupOperation, values.
+		layout.literal_index = 1;
+		break;
+
+	case spv::OpConstantTrue:
+	case spv::OpConstantFalse:
+	case spv::OpConstantNull:
+	case spv::OpConstantComposite:
+	case spv::OpFunctionParameter:
+	case spv::OpUndef:
+	case spv::OpPhi:
+	case spv::OpSelect:
+	case spv::OpBitcast:
+	case spv::OpIAdd:
+	case spv::OpISub:
+	case spv::OpIMul:
+	case spv::OpBitwiseAnd:
+	case spv::OpBitwiseOr:
+	case spv::OpBitwiseXor:
+	case spv::OpIEqual:
+	case spv::OpINotEqual:
+	case spv::OpULessThan:
+	case spv::OpAll:
+	case spv::OpAny:
+	case spv::OpLogicalAnd:
+	case spv::OpLogicalOr:
+	case spv::OpLogicalNot:
+	case spv::OpLogicalEqual:
+	case spv::OpLogicalNotEqual:
+	case spv::OpCompositeConstruct:
+	case spv::OpAccessChain:
+	case spv::OpInBoundsAccessChain:
+	case spv::OpImageTexelPointer:
+	case spv::OpAtomicIAdd:
+	case spv::OpAtomicOr:
+	case spv::OpGroupNonUniformElect:
+	case spv::OpGroupNonUniformAllEqual:
+	case spv::OpGroupNonUniformBallot:
+	case spv::OpGroupNonUniformBallotFindLSB:
+	case spv::OpGroupNonUniformBroadcast:
+	case spv::OpGroupNonUniformBroadcastFirst:
+	case spv::OpGroupNonUniformShuffle:
+	case spv::OpGroupNonUniformQuadBroadcast:
+		break;
+
+	case spv::OpFunctionEnd:
+	case spv::OpReturn:
+	case spv::OpReturnValue:
+	case spv::OpBranch:
+	case spv::OpUnreachable:
+	case spv::OpKill:
+		layout.has_type = false;
+		layout.has_result = false;
+		break;
+
+	case spv::OpName:
+	case spv::OpDecorate:
+	case spv::OpSelectionMerge:
+		layout.has_type = false;
+		layout.has_result = false;
+		layout.literals_begin = 1;
+		break;
+
+	case spv::OpStore:
+	case spv::OpLoopMerge:
+		layout.has_type = false;
+		layout.has_result = false;
+		layout.literals_begin = 2;
+		break;
+
+	case spv::OpBranchConditional:
+		layout.has_type = false;
+		layout.has_result = false;
+		layout.literals_begin = 3;
+		break;
+
+	default:
+		return false;
+	}
+
+	return true;
+}
+
+static bool operand_is_id(const OperandLayout &layout, uint32_t index)
+{
+	return index != layout.literal_index && index < layout.literals_begin;
+}
+
+static uint32_t get_first_operand_offset(const OperandLayout &layout)
+{
+	return 1 + uint32_t(layout.has_type) + uint32_t(layout.has_result);
+}
+
+// Declarations which splice_helper_function_template() knows how to recreate.
+static bool opcode_is_declaration(spv::Op op)
+{
+	switch (op)
+	{
+	case spv::OpTypeVoid:
+	case spv::OpTypeBool:
+	case spv::OpTypeInt:
+	case spv::OpTypeFloat:
+	case spv::OpTypeVector:
+	case spv::OpTypePointer:
+	case spv::OpTypeFunction:
+	case spv::OpTypeImage:
+	case spv::OpConstant:
+	case spv::OpConstantTrue:
+	case spv::OpConstantFalse:
+	case spv::OpConstantNull:
+	case spv::OpConstantComposite:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+template <typename Func>
+static bool for_each_id(const uint32_t *inst, uint32_t word_count, const OperandLayout &layout, const Func &func)
+{
+	uint32_t first_operand = get_first_operand_offset(layout);
+	if (word_count < first_operand)
+		return false;
+
+	if (layout.has_type)
+		func(1u);
+	if (layout.has_result)
+		func(1u + uint32_t(layout.has_type));
+	for (uint32_t i = first_operand; i < word_count; i++)
+		if (operand_is_id(layout, i - first_operand))
+			func(i);
+	return true;
+}
+
+static uint32_t get_result_id(const uint32_t *inst, const OperandLayout &layout)
+{
+	return inst[1 + uint32_t(layout.has_type)];
+}
+
+bool capture_helper_function_template(const uint32_t *words, size_t count, HelperFunctionTemplate &tmpl)
+{
+	tmpl = {};
+	if (count < 5 || words[0] != spv::MagicNumber)
+		return false;
+
+	uint32_t bound = words[3];
+	tmpl.id_declarations.resize(bound, HelperFunctionTemplate::NoDeclaration);
+	std::vector<uint8_t> defined(bound);
+	size_t function_begin = 0;
+	size_t function_end = 0;
+
+	for (size_t offset = 5; offset < count;)
+	{
+		const uint32_t *inst = words + offset;
+		uint32_t word_count = inst[0] >> spv::WordCountShift;
+		auto op = spv::Op(inst[0] & spv::OpCodeMask);
+		if (word_count == 0 || offset + word_count > count)
+			return false;
+
+		if (function_begin && !function_end)
+		{
+			if (op == spv::OpFunctionEnd)
+				function_end = offset + word_count;
+		}
+		else if (op == spv::OpFunction)
+		{
+			// Helpers are self-contained, a second function means it calls something else.
+			if (function_begin)
+				return false;
+			function_begin = offset;
+		}
+		else if (op == spv::OpCapability)
+		{
+			if (word_count != 2)
+				return false;
+			tmpl.capabilities.push_back(spv::Capability(inst[1]));
+		}
+		else if (op == spv::OpExtension)
+		{
+			auto *str = reinterpret_cast<const char *>(inst + 1);
+			tmpl.extensions.emplace_back(str, strnlen(str, (word_count - 1) * sizeof(uint32_t)));
+		}
+		else if (op == spv::OpName || op == spv::OpDecorate)
+		{
+			// The builder can only recreate decorations with at most one literal.
+			if (word_count < 3 || inst[1] >= bound || (op == spv::OpDecorate && word_count > 4))
+				return false;
+			tmpl.annotations.insert(tmpl.annotations.end(), inst, inst + word_count);
+		}
+		else if (opcode_is_declaration(op))
+		{
+			OperandLayout layout;
+			get_operand_layout(op, layout);
+			if (word_count < get_first_operand_offset(layout))
+				return false;
+
+			// Declarations only refer to earlier declarations.
+			bool valid = true;
+			uint32_t id = get_result_id(inst, layout);
+			for_each_id(inst, word_count, layout, [&](uint32_t index) {
+				if (inst[index] >= bound || (inst[index] != id && tmpl.id_declarations[inst[index]] ==
+				                                                      HelperFunctionTemplate::NoDeclaration))
+				{
+					valid = false;
+				}
+			});
+
+			if (!valid || defined[id])
+				return false;
+
+			if (op == spv::OpConstant)
+			{
+				// Only scalar constants which the builder has a maker for.
+				const uint32_t *type = tmpl.declarations.data() + tmpl.id_declarations[inst[1]];
+				auto type_op = spv::Op(type[0] & spv::OpCodeMask);
+				if (!((type_op == spv::OpTypeInt && type[2] == 32 && word_count == 4) ||
+				      (type_op == spv::OpTypeInt && type[2] == 64 && word_count == 5) ||
+				      (type_op == spv::OpTypeFloat && type[2] == 32 && word_count == 4)))
+				{
+					return false;
+				}
+			}
+			else if (op == spv::OpTypeImage && word_count != 9)
+				return false;
+
+			defined[id] = 1;
+			tmpl.id_declarations[id] = uint32_t(tmpl.declarations.size());
+			tmpl.declarations.insert(tmpl.declarations.end(), inst, inst + word_count);
+		}
+		else if (op != spv::OpMemoryModel)
+		{
+			// Anything else at module scope, e.g. variables, is owned by the module and cannot be spliced.
+			return false;
+		}
+
+		offset += word_count;
+	}
+
+	if (!function_end)
+		return false;
+
+	for (size_t offset = function_begin; offset < function_end;)
+	{
+		const uint32_t *inst = words + offset;
+		uint32_t word_count = inst[0] >> spv::WordCountShift;
+		auto op = spv::Op(inst[0] & spv::OpCodeMask);
+		OperandLayout layout;
+		if (!get_operand_layout(op, layout) || opcode_is_declaration(op) ||
+		    word_count < get_first_operand_offset(layout))
+		{
+			return false;
+		}
+
+		if (layout.has_result)
+		{
+			uint32_t id = get_result_id(inst, layout);
+			if (id >= bound || defined[id])
+				return false;
+			defined[id] = 1;
+		}
+
+		size_t base = tmpl.body.size();
+		tmpl.body.insert(tmpl.body.end(), inst, inst + word_count);
+		for_each_id(inst, word_count, layout, [&](uint32_t index) {
+			tmpl.body_id_offsets.push_back(uint32_t(base + index));
+		});
+		offset += word_count;
+	}
+
+	// Everything the function refers to must be defined by the function itself or be a declaration.
+	for (auto offset : tmpl.body_id_offsets)
+		if (tmpl.body[offset] >= bound || !defined[tmpl.body[offset]])
+			return false;
+
+	tmpl.function_id = words[function_begin + 2];
+	return true;
+}
+
+static spv::Id recreate_declaration(spv::Builder &builder, const uint32_t *inst, const Vector<spv::Id> &ids)
+{
+	uint32_t word_count = inst[0] >> spv::WordCountShift;
+	auto op = spv::Op(inst[0] & spv::OpCodeMask);
+
+	switch (op)
+	{
+	case spv::OpTypeVoid:
+		return builder.makeVoidType();
+	case spv::OpTypeBool:
+		return builder.makeBoolType();
+	case spv::OpTypeInt:
+		return builder.makeIntegerType(int(inst[2]), inst[3] != 0);
+	case spv::OpTypeFloat:
+		return builder.makeFloatType(int(inst[2]));
+	case spv::OpTypeVector:
+		return builder.makeVectorType(ids[inst[2]], int(inst[3]));
+	case spv::OpTypePointer:
+		return builder.makePointer(spv::StorageClass(inst[2]), ids[inst[3]]);
+	case spv::OpTypeImage:
+		return builder.makeImageType(ids[inst[2]], spv::Dim(inst[3]), inst[4] != 0, inst[5] != 0, inst[6] != 0,
+		                             inst[7], spv::ImageFormat(inst[8]));
+
+	case spv::OpTypeFunction:
+	{
+		Vector<spv::Id> param_types;
+		for (uint32_t i = 3; i < word_count; i++)
+			param_types.push_back(ids[inst[i]]);
+		return builder.makeFunctionType(ids[inst[2]], param_types);
+	}
+
+	case spv::OpConstantTrue:
+		return builder.makeBoolConstant(true);
+	case spv::OpConstantFalse:
+		return builder.makeBoolConstant(false);
+	case spv::OpConstantNull:
+		return builder.makeNullConstant(ids[inst[1]]);
+
+	case spv::OpConstant:
+	{
+		spv::Id type_id = ids[inst[1]];
+		if (builder.isFloatType(type_id))
+		{
+			float f;
+			memcpy(&f, &inst[3], sizeof(f));
+			return builder.makeFloatConstant(f);
+		}
+
+		bool is_signed = builder.isIntType(type_id);
+		if (word_count == 5)
+		{
+			uint64_t v = inst[3] | (uint64_t(inst[4]) << 32);
+			return is_signed ? builder.makeInt64Constant((long long)v) : builder.makeUint64Constant(v);
+		}
+		else
+			return is_signed ? builder.makeIntConstant(int(inst[3])) : builder.makeUintConstant(inst[3]);
+	}
+
+	case spv::OpConstantComposite:
+	{
+		Vector<spv::Id> constituents;
+		for (uint32_t i = 3; i < word_count; i++)
+			constituents.push_back(ids[inst[i]]);
+		return builder.makeCompositeConstant(ids[inst[1]], constituents);
+	}
+
+	default:
+		assert(0 && "Unexpected declaration in helper function template.");
+		return 0;
+	}
+}
+
+spv::Id splice_helper_function_template(spv::Builder &builder, const HelperFunctionTemplate &tmpl)
+{
+	// Replaying allocations in ID order reproduces the order in which the helper allocated them.
+	// IDs which the scratch module allocated but never used still take up an ID here.
+	Vector<spv::Id> ids(tmpl.id_declarations.size());
+	for (size_t id = 1; id < ids.size(); id++)
+	{
+		uint32_t offset = tmpl.id_declarations[id];
+		if (offset == HelperFunctionTemplate::NoDeclaration)
+			ids[id] = builder.getUniqueId();
+		else
+			ids[id] = recreate_declaration(builder, tmpl.declarations.data() + offset, ids);
+	}
+
+	for (auto cap : tmpl.capabilities)
+		builder.addCapability(cap);
+	for (auto &ext : tmpl.extensions)
+		builder.addExtension(ext.c_str());
+
+	for (size_t offset = 0; offset < tmpl.annotations.size();)
+	{
+		const uint32_t *inst = tmpl.annotations.data() + offset;
+		uint32_t word_count = inst[0] >> spv::WordCountShift;
+		if (spv::Op(inst[0] & spv::OpCodeMask) == spv::OpName)
+			builder.addName(ids[inst[1]], reinterpret_cast<const char *>(inst + 2));
+		else
+			builder.addDecoration(ids[inst[1]], spv::Decoration(inst[2]), word_count > 3 ? int(inst[3]) : -1);
+		offset += word_count;
+	}
+
+	Vector<uint32_t> body(tmpl.body.begin(), tmpl.body.end());
+	for (auto offset : tmpl.body_id_offsets)
+		body[offset] = ids[body[offset]];
+	builder.addEncodedFunction(body.data(), body.size());
+
+	return ids[tmpl.function_id];
+}
+
+HelperFunctionCache &HelperFunctionCache::get()
+{
+	static HelperFunctionCache cache;
+	return cache;
+}
+
+bool HelperFunctionCache::find(uint64_t key, std::shared_ptr<const HelperFunctionTemplate> &tmpl)
+{
+	std::lock_guard<std::mutex> holder{ lock };
+	auto itr = templates.find(key);
+	if (itr == templates.end())
+		return false;
+	tmpl = itr->second;
+	return true;
+}
+
+void HelperFunctionCache::insert(uint64_t key, std::shared_ptr<const HelperFunctionTemplate> tmpl)
+{
+	std::lock_guard<std::mutex> holder{ lock };
+	templates.emplace(key, std::move(tmpl));
+}
+} // namespace dxil_spv
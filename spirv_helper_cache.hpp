@@ -0,0 +1,85 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include "SpvBuilder.h"
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace dxil_spv
+{
+// A helper function which was built once in a fresh scratch module and can be spliced into any other module.
+// Template IDs are the IDs of the scratch module. When splicing, IDs are allocated in the same order as in the
+// scratch module: types and constants are recreated through the builder, so they are shared with the rest of
+// the module, and everything else gets a fresh ID. The result is identical to building the helper directly.
+// Templates are shared between threads, so the default allocator is used.
+struct HelperFunctionTemplate
+{
+	enum { NoDeclaration = ~0u };
+
+	// Types and constants, as SPIR-V instructions in declaration order.
+	std::vector<uint32_t> declarations;
+	// For every ID, the offset of its declaration, or NoDeclaration if it is allocated fresh.
+	std::vector<uint32_t> id_declarations;
+	// OpFunction through OpFunctionEnd.
+	std::vector<uint32_t> body;
+	// Offsets into body of every word which holds an ID.
+	std::vector<uint32_t> body_id_offsets;
+	// OpName and OpDecorate, in the order they were added.
+	std::vector<uint32_t> annotations;
+	std::vector<spv::Capability> capabilities;
+	std::vector<std::string> extensions;
+	uint32_t function_id = 0;
+};
+
+// Captures the only function of a serialized module.
+// Returns false if the function uses anything which cannot be recreated in another module,
+// e.g. global variables, or an opcode whose operands are not known to the capture.
+bool capture_helper_function_template(const uint32_t *words, size_t count, HelperFunctionTemplate &tmpl);
+
+// Recreates the function in builder and returns its ID.
+spv::Id splice_helper_function_template(spv::Builder &builder, const HelperFunctionTemplate &tmpl);
+
+// Process-wide cache of helper function templates. The key is computed by the caller. All methods are thread-safe.
+class HelperFunctionCache
+{
+public:
+	static HelperFunctionCache &get();
+
+	// Returns false if key has never been inserted.
+	// A null template means the helper could not be captured, and must be built directly.
+	bool find(uint64_t key, std::shared_ptr<const HelperFunctionTemplate> &tmpl);
+	void insert(uint64_t key, std::shared_ptr<const HelperFunctionTemplate> tmpl);
+
+private:
+	std::mutex lock;
+	std::unordered_map<uint64_t, std::shared_ptr<const HelperFunctionTemplate>> templates;
+};
+} // namespace dxil_spv
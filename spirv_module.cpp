@@ -23,11 +23,16 @@
  */
 
 #include "spirv_module.hpp"
+#include "spirv_helper_cache.hpp"
+#include "spirv_optimizer.hpp"
+#include "spirv_canonicalize.hpp"
+#include "ir_peephole.hpp"
 #include "descriptor_qa.hpp"
 #include "SpvBuilder.h"
 #include "node.hpp"
 #include "scratch_pool.hpp"
 #include "logging.hpp"
+#include "trace.hpp"
 
 namespace dxil_spv
 {
@@ -50,6 +55,7 @@ struct SPIRVModule::Impl : BlockEmissionInterface
 
 	void register_block(CFGNode *node) override;
 	void emit_basic_block(CFGNode *node) override;
+	void prepare_blocks(const Vector<CFGNode *> &post_order) override;
 	void emit_entry_point_function_body(CFGStructurizer &structurizer);
 	void emit_leaf_function_body(spv::Function *func, CFGStructurizer &structurizer);
 	static spv::Block *get_spv_block(CFGNode *node);
@@ -66,8 +72,12 @@ struct SPIRVModule::Impl : BlockEmissionInterface
 	spv::Id build_wave_read_first_lane_masked(SPIRVModule &module, spv::Id type_id);
 	spv::Id build_wave_multi_prefix_count_bits(SPIRVModule &module);
 	spv::Id build_wave_multi_prefix_op(SPIRVModule &module, spv::Op opcode, spv::Id type_id);
+	spv::Id build_live_ballot_mask(spv::Block *block, spv::Id mask_id);
+	spv::Id build_ballot_mask_matches_first(spv::Block *block, spv::Id mask_id);
+	unsigned get_live_ballot_components() const;
 	spv::Id build_robust_physical_cbv_load(SPIRVModule &module, spv::Id type_id, spv::Id ptr_type_id, unsigned alignment);
 	spv::Id build_robust_atomic_counter_op(SPIRVModule &module);
+	spv::Id build_aggregated_atomic_add_op(SPIRVModule &module, HelperCall call);
 	spv::Id build_quad_all(SPIRVModule &module);
 	spv::Id build_quad_any(SPIRVModule &module);
 	spv::Id build_quad_vote(SPIRVModule &module, HelperCall call);
@@ -82,6 +92,9 @@ struct SPIRVModule::Impl : BlockEmissionInterface
 	spv::Id create_variable_with_initializer(spv::StorageClass storage, spv::Id type,
 	                                         spv::Id initializer, const char *name);
 	void register_active_variable(spv::StorageClass storage, spv::Id id);
+	// Descriptors, root constants and UBOs. Nothing can write these during an invocation.
+	Vector<spv::Id> read_only_variables;
+	Vector<spv::Id> push_constant_variables;
 
 	struct
 	{
@@ -103,6 +116,7 @@ struct SPIRVModule::Impl : BlockEmissionInterface
 
 	spv::Id get_type_for_builtin(spv::BuiltIn builtin, bool &requires_flat_decoration);
 	ScratchPool<Operation> operation_pool;
+	ScratchWordPool operation_argument_pool;
 
 	bool spirv_requires_14() const;
 	bool builtin_requires_volatile(spv::BuiltIn builtin) const;
@@ -110,9 +124,14 @@ struct SPIRVModule::Impl : BlockEmissionInterface
 	bool mark_error = false;
 
 	spv::Id get_helper_call_id(SPIRVModule &module, HelperCall call, spv::Id type_id);
+	spv::Id build_helper_call(SPIRVModule &module, HelperCall call, spv::Id type_id);
+	spv::Id splice_cached_helper_call(HelperCall call, spv::Id type_id);
+	bool get_helper_type_key(spv::Id type_id, uint32_t &key) const;
+	spv::Id make_helper_type(uint32_t key);
 	spv::Id descriptor_qa_helper_call_id = 0;
 	spv::Id wave_multi_prefix_count_bits_id = 0;
 	spv::Id robust_atomic_counter_call_id = 0;
+	spv::Id aggregated_atomic_add_call_ids[3] = {};
 	spv::Id quad_all_call_id = 0;
 	spv::Id quad_any_call_id = 0;
 	spv::Id wave_is_first_lane_masked_id = 0;
@@ -141,10 +160,25 @@ struct SPIRVModule::Impl : BlockEmissionInterface
 	};
 	Vector<CBVOp> physical_cbv_call_ids;
 
+	struct SplicedHelperCall
+	{
+		HelperCall call;
+		spv::Id type_id;
+		spv::Id func_id;
+	};
+	Vector<SplicedHelperCall> spliced_helper_call_ids;
+
 	DescriptorQAInfo descriptor_qa_info;
 
 	uint32_t override_spirv_version = 0;
+	bool spirv_optimization = false;
+	bool spirv_canonicalization = false;
+	bool peephole_optimization = false;
+	bool loop_invariant_code_motion = false;
+	bool structured_cfg_fast_path = false;
+	unsigned structurizer_node_growth_factor = 0;
 	bool helper_lanes_participate_in_wave_ops = true;
+	uint32_t maximum_subgroup_size = 128;
 };
 
 spv::Id SPIRVModule::Impl::get_type_for_builtin(spv::BuiltIn builtin, bool &requires_flat)
@@ -471,6 +505,76 @@ static const char *opcode_to_multi_prefix_name(spv::Op opcode)
 	}
 }
 
+unsigned SPIRVModule::Impl::get_live_ballot_components() const
+{
+	// Ballot bits at or above the subgroup size are always zero.
+	return std::max<unsigned>(1u, std::min<unsigned>(4u, (maximum_subgroup_size + 31) / 32));
+}
+
+spv::Id SPIRVModule::Impl::build_live_ballot_mask(spv::Block *block, spv::Id mask_id)
+{
+	// With a known small subgroup size, only the live part of the ballot needs to be compared,
+	// which keeps the loop below on scalar (or two-component) broadcasts.
+	unsigned components = get_live_ballot_components();
+	if (components == 4)
+		return mask_id;
+
+	spv::Id uint_type = builder.makeUintType(32);
+	std::unique_ptr<spv::Instruction> narrow;
+
+	if (components == 1)
+	{
+		narrow = std::make_unique<spv::Instruction>(builder.getUniqueId(), uint_type, spv::OpCompositeExtract);
+		narrow->addIdOperand(mask_id);
+		narrow->addImmediateOperand(0);
+	}
+	else
+	{
+		narrow = std::make_unique<spv::Instruction>(builder.getUniqueId(),
+		                                            builder.makeVectorType(uint_type, components),
+		                                            spv::OpVectorShuffle);
+		narrow->addIdOperand(mask_id);
+		narrow->addIdOperand(mask_id);
+		for (unsigned i = 0; i < components; i++)
+			narrow->addImmediateOperand(i);
+	}
+
+	mask_id = narrow->getResultId();
+	block->addInstruction(std::move(narrow));
+	return mask_id;
+}
+
+spv::Id SPIRVModule::Impl::build_ballot_mask_matches_first(spv::Block *block, spv::Id mask_id)
+{
+	unsigned components = get_live_ballot_components();
+	spv::Id uint_type = builder.makeUintType(32);
+	spv::Id bool_type = builder.makeBoolType();
+	spv::Id mask_type = components == 1 ? uint_type : builder.makeVectorType(uint_type, components);
+	spv::Id compare_type = components == 1 ? bool_type : builder.makeVectorType(bool_type, components);
+
+	auto broadcast_first = std::make_unique<spv::Instruction>(builder.getUniqueId(), mask_type, spv::OpGroupNonUniformBroadcastFirst);
+	broadcast_first->addIdOperand(builder.makeUintConstant(spv::ScopeSubgroup));
+	broadcast_first->addIdOperand(mask_id);
+
+	auto compare = std::make_unique<spv::Instruction>(builder.getUniqueId(), compare_type, spv::OpIEqual);
+	compare->addIdOperand(mask_id);
+	compare->addIdOperand(broadcast_first->getResultId());
+	spv::Id result_id = compare->getResultId();
+
+	block->addInstruction(std::move(broadcast_first));
+	block->addInstruction(std::move(compare));
+
+	if (components != 1)
+	{
+		auto compare_reduce = std::make_unique<spv::Instruction>(builder.getUniqueId(), bool_type, spv::OpAll);
+		compare_reduce->addIdOperand(result_id);
+		result_id = compare_reduce->getResultId();
+		block->addInstruction(std::move(compare_reduce));
+	}
+
+	return result_id;
+}
+
 spv::Id SPIRVModule::Impl::build_wave_multi_prefix_op(SPIRVModule &module, spv::Op opcode, spv::Id type_id)
 {
 	for (auto &call : wave_multi_prefix_call_ids)
@@ -482,7 +586,6 @@ spv::Id SPIRVModule::Impl::build_wave_multi_prefix_op(SPIRVModule &module, spv::
 	spv::Id uint_type = builder.makeUintType(32);
 	spv::Id uvec4_type = builder.makeVectorType(uint_type, 4);
 	spv::Id bool_type = builder.makeBoolType();
-	spv::Id bvec4_type = builder.makeVectorType(bool_type, 4);
 
 	Vector<spv::Id> types = { type_id, uvec4_type };
 	if (!helper_lanes_participate_in_wave_ops)
@@ -526,6 +629,7 @@ spv::Id SPIRVModule::Impl::build_wave_multi_prefix_op(SPIRVModule &module, spv::
 		mask_id = mask_op->getResultId();
 		entry->addInstruction(std::move(ballot_op));
 		entry->addInstruction(std::move(mask_op));
+		mask_id = build_live_ballot_mask(entry, mask_id);
 		builder.createBranch(header_block);
 	}
 
@@ -538,21 +642,7 @@ spv::Id SPIRVModule::Impl::build_wave_multi_prefix_op(SPIRVModule &module, spv::
 	builder.setBuildPoint(body_block);
 	spv::Id compare_reduce_id;
 	{
-		auto broadcast_first = std::make_unique<spv::Instruction>(builder.getUniqueId(), uvec4_type, spv::OpGroupNonUniformBroadcastFirst);
-		broadcast_first->addIdOperand(builder.makeUintConstant(spv::ScopeSubgroup));
-		broadcast_first->addIdOperand(mask_id);
-
-		auto compare = std::make_unique<spv::Instruction>(builder.getUniqueId(), bvec4_type, spv::OpIEqual);
-		compare->addIdOperand(mask_id);
-		compare->addIdOperand(broadcast_first->getResultId());
-
-		auto compare_reduce = std::make_unique<spv::Instruction>(builder.getUniqueId(), bool_type, spv::OpAll);
-		compare_reduce->addIdOperand(compare->getResultId());
-		compare_reduce_id = compare_reduce->getResultId();
-
-		body_block->addInstruction(std::move(broadcast_first));
-		body_block->addInstruction(std::move(compare));
-		body_block->addInstruction(std::move(compare_reduce));
+		compare_reduce_id = build_ballot_mask_matches_first(body_block, mask_id);
 		builder.createSelectionMerge(continue_block, 0);
 		builder.createConditionalBranch(compare_reduce_id, prefix_block, continue_block);
 	}
@@ -615,7 +705,6 @@ spv::Id SPIRVModule::Impl::build_wave_multi_prefix_count_bits(SPIRVModule &modul
 	spv::Id uint_type = builder.makeUintType(32);
 	spv::Id uvec4_type = builder.makeVectorType(uint_type, 4);
 	spv::Id bool_type = builder.makeBoolType();
-	spv::Id bvec4_type = builder.makeVectorType(bool_type, 4);
 
 	spv::Block *entry = nullptr;
 	Vector<spv::Id> types = { bool_type, uvec4_type };
@@ -657,6 +746,7 @@ spv::Id SPIRVModule::Impl::build_wave_multi_prefix_count_bits(SPIRVModule &modul
 		mask_id = mask_op->getResultId();
 		entry->addInstruction(std::move(ballot_op));
 		entry->addInstruction(std::move(mask_op));
+		mask_id = build_live_ballot_mask(entry, mask_id);
 		builder.createBranch(header_block);
 	}
 
@@ -669,18 +759,7 @@ spv::Id SPIRVModule::Impl::build_wave_multi_prefix_count_bits(SPIRVModule &modul
 	spv::Id result_id;
 	builder.setBuildPoint(body_block);
 	{
-		auto broadcast_first =
-		    std::make_unique<spv::Instruction>(builder.getUniqueId(), uvec4_type, spv::OpGroupNonUniformBroadcastFirst);
-		broadcast_first->addIdOperand(builder.makeUintConstant(spv::ScopeSubgroup));
-		broadcast_first->addIdOperand(mask_id);
-
-		auto compare = std::make_unique<spv::Instruction>(builder.getUniqueId(), bvec4_type, spv::OpIEqual);
-		compare->addIdOperand(mask_id);
-		compare->addIdOperand(broadcast_first->getResultId());
-
-		auto compare_reduce = std::make_unique<spv::Instruction>(builder.getUniqueId(), bool_type, spv::OpAll);
-		compare_reduce->addIdOperand(compare->getResultId());
-		spv::Id compare_reduce_id = compare_reduce->getResultId();
+		spv::Id compare_reduce_id = build_ballot_mask_matches_first(body_block, mask_id);
 
 		auto prefix_input = std::make_unique<spv::Instruction>(builder.getUniqueId(), bool_type, spv::OpLogicalAnd);
 		prefix_input->addIdOperand(compare_reduce_id);
@@ -697,9 +776,6 @@ spv::Id SPIRVModule::Impl::build_wave_multi_prefix_count_bits(SPIRVModule &modul
 		count->addIdOperand(modified_ballot->getResultId());
 		result_id = count->getResultId();
 
-		body_block->addInstruction(std::move(broadcast_first));
-		body_block->addInstruction(std::move(compare));
-		body_block->addInstruction(std::move(compare_reduce));
 		body_block->addInstruction(std::move(prefix_input));
 		body_block->addInstruction(std::move(modified_ballot));
 		body_block->addInstruction(std::move(count));
@@ -1294,6 +1370,178 @@ spv::Id SPIRVModule::Impl::build_robust_atomic_counter_op(SPIRVModule &module)
 	return func->getId();
 }
 
+spv::Id SPIRVModule::Impl::build_aggregated_atomic_add_op(SPIRVModule &module, HelperCall call)
+{
+	unsigned variant = unsigned(call) - unsigned(HelperCall::AggregatedAtomicCounter);
+	if (aggregated_atomic_add_call_ids[variant])
+		return aggregated_atomic_add_call_ids[variant];
+
+	builder.addCapability(spv::CapabilityGroupNonUniform);
+	builder.addCapability(spv::CapabilityGroupNonUniformBallot);
+	builder.addCapability(spv::CapabilityGroupNonUniformArithmetic);
+	auto *current_build_point = builder.getBuildPoint();
+
+	spv::Id uint_type = builder.makeUintType(32);
+	spv::Id bool_type = builder.makeBoolType();
+	spv::Id bda_type = builder.makeVectorType(uint_type, 2);
+	spv::Id image_type = builder.makeImageType(uint_type, spv::DimBuffer, false, false, false, 2,
+	                                           spv::ImageFormatR32ui);
+	spv::Id physical_ptr_type = builder.makePointer(spv::StorageClassPhysicalStorageBuffer, uint_type);
+
+	spv::Id address_type;
+	const char *name;
+	switch (call)
+	{
+	case HelperCall::AggregatedAtomicCounter:
+		address_type = builder.makePointer(spv::StorageClassUniformConstant, image_type);
+		name = "AggregatedAtomicCounter";
+		break;
+
+	case HelperCall::AggregatedRobustAtomicCounter:
+		address_type = bda_type;
+		name = "AggregatedRobustPhysicalAtomicCounter";
+		break;
+
+	default:
+		address_type = physical_ptr_type;
+		name = "AggregatedPhysicalAtomicIAdd";
+		break;
+	}
+
+	// The address is uniform, so a single atomic covers the subgroup.
+	// Each lane gets the value it would have observed with one atomic per lane in lane order.
+	spv::Block *entry = nullptr;
+	auto *func = builder.makeFunctionEntry(spv::NoPrecision, uint_type, name,
+	                                       { address_type, uint_type, uint_type }, {}, &entry);
+
+	spv::Id address_id = func->getParamId(0);
+	spv::Id value_id = func->getParamId(1);
+	spv::Id bias_id = func->getParamId(2);
+	builder.addName(address_id, "addr");
+	builder.addName(value_id, "value");
+	builder.addName(bias_id, "bias");
+
+	auto *body_block = new spv::Block(builder.getUniqueId(), *func);
+	auto *merge_block = new spv::Block(builder.getUniqueId(), *func);
+
+	auto total = std::make_unique<spv::Instruction>(builder.getUniqueId(), uint_type, spv::OpGroupNonUniformIAdd);
+	total->addIdOperand(builder.makeUintConstant(spv::ScopeSubgroup));
+	total->addImmediateOperand(spv::GroupOperationReduce);
+	total->addIdOperand(value_id);
+	auto prefix = std::make_unique<spv::Instruction>(builder.getUniqueId(), uint_type, spv::OpGroupNonUniformIAdd);
+	prefix->addIdOperand(builder.makeUintConstant(spv::ScopeSubgroup));
+	prefix->addImmediateOperand(spv::GroupOperationExclusiveScan);
+	prefix->addIdOperand(value_id);
+	auto elect = std::make_unique<spv::Instruction>(builder.getUniqueId(), bool_type, spv::OpGroupNonUniformElect);
+	elect->addIdOperand(builder.makeUintConstant(spv::ScopeSubgroup));
+
+	spv::Id total_id = total->getResultId();
+	spv::Id prefix_id = prefix->getResultId();
+	spv::Id cond_id = elect->getResultId();
+	spv::Id valid_id = 0;
+	entry->addInstruction(std::move(total));
+	entry->addInstruction(std::move(prefix));
+	entry->addInstruction(std::move(elect));
+
+	if (call == HelperCall::AggregatedRobustAtomicCounter)
+	{
+		spv::Id bvec2_type = builder.makeVectorType(bool_type, 2);
+		auto compare = std::make_unique<spv::Instruction>(builder.getUniqueId(), bvec2_type, spv::OpINotEqual);
+		compare->addIdOperand(address_id);
+		compare->addIdOperand(builder.makeNullConstant(bda_type));
+		auto not_zero = std::make_unique<spv::Instruction>(builder.getUniqueId(), bool_type, spv::OpAny);
+		not_zero->addIdOperand(compare->getResultId());
+		auto and_op = std::make_unique<spv::Instruction>(builder.getUniqueId(), bool_type, spv::OpLogicalAnd);
+		and_op->addIdOperand(cond_id);
+		and_op->addIdOperand(not_zero->getResultId());
+		valid_id = not_zero->getResultId();
+		cond_id = and_op->getResultId();
+		entry->addInstruction(std::move(compare));
+		entry->addInstruction(std::move(not_zero));
+		entry->addInstruction(std::move(and_op));
+	}
+
+	builder.setBuildPoint(entry);
+	builder.createSelectionMerge(merge_block, 0);
+	builder.createConditionalBranch(cond_id, body_block, merge_block);
+
+	spv::Id atomic_id;
+	{
+		builder.setBuildPoint(body_block);
+		spv::Id ptr_id = address_id;
+
+		if (call == HelperCall::AggregatedAtomicCounter)
+		{
+			auto texel = std::make_unique<spv::Instruction>(
+			    builder.getUniqueId(), builder.makePointer(spv::StorageClassImage, uint_type), spv::OpImageTexelPointer);
+			texel->addIdOperand(address_id);
+			texel->addIdOperand(builder.makeUintConstant(0));
+			texel->addIdOperand(builder.makeUintConstant(0));
+			ptr_id = texel->getResultId();
+			body_block->addInstruction(std::move(texel));
+		}
+		else if (call == HelperCall::AggregatedRobustAtomicCounter)
+		{
+			auto bitcast_op =
+			    std::make_unique<spv::Instruction>(builder.getUniqueId(), physical_ptr_type, spv::OpBitcast);
+			bitcast_op->addIdOperand(address_id);
+			ptr_id = bitcast_op->getResultId();
+			body_block->addInstruction(std::move(bitcast_op));
+		}
+
+		auto atomic_op = std::make_unique<spv::Instruction>(builder.getUniqueId(), uint_type, spv::OpAtomicIAdd);
+		atomic_op->addIdOperand(ptr_id);
+		atomic_op->addIdOperand(builder.makeUintConstant(spv::ScopeDevice));
+		atomic_op->addIdOperand(builder.makeUintConstant(0));
+		atomic_op->addIdOperand(total_id);
+		atomic_id = atomic_op->getResultId();
+		body_block->addInstruction(std::move(atomic_op));
+		builder.createBranch(merge_block);
+	}
+
+	builder.setBuildPoint(merge_block);
+	auto phi_op = std::make_unique<spv::Instruction>(builder.getUniqueId(), uint_type, spv::OpPhi);
+	phi_op->addIdOperand(builder.makeUintConstant(0));
+	phi_op->addIdOperand(entry->getId());
+	phi_op->addIdOperand(atomic_id);
+	phi_op->addIdOperand(body_block->getId());
+
+	// The elected lane is the first active lane.
+	auto broadcast = std::make_unique<spv::Instruction>(builder.getUniqueId(), uint_type,
+	                                                    spv::OpGroupNonUniformBroadcastFirst);
+	broadcast->addIdOperand(builder.makeUintConstant(spv::ScopeSubgroup));
+	broadcast->addIdOperand(phi_op->getResultId());
+	auto add_prefix = std::make_unique<spv::Instruction>(builder.getUniqueId(), uint_type, spv::OpIAdd);
+	add_prefix->addIdOperand(broadcast->getResultId());
+	add_prefix->addIdOperand(prefix_id);
+	auto add_bias = std::make_unique<spv::Instruction>(builder.getUniqueId(), uint_type, spv::OpIAdd);
+	add_bias->addIdOperand(add_prefix->getResultId());
+	add_bias->addIdOperand(bias_id);
+	spv::Id return_value = add_bias->getResultId();
+
+	merge_block->addInstruction(std::move(phi_op));
+	merge_block->addInstruction(std::move(broadcast));
+	merge_block->addInstruction(std::move(add_prefix));
+	merge_block->addInstruction(std::move(add_bias));
+
+	if (valid_id)
+	{
+		// Matches RobustPhysicalAtomicCounter, which returns 0 for a null counter.
+		auto select_op = std::make_unique<spv::Instruction>(builder.getUniqueId(), uint_type, spv::OpSelect);
+		select_op->addIdOperand(valid_id);
+		select_op->addIdOperand(return_value);
+		select_op->addIdOperand(builder.makeUintConstant(0));
+		return_value = select_op->getResultId();
+		merge_block->addInstruction(std::move(select_op));
+	}
+
+	builder.makeReturn(false, return_value);
+
+	builder.setBuildPoint(current_build_point);
+	aggregated_atomic_add_call_ids[variant] = func->getId();
+	return func->getId();
+}
+
 spv::Id SPIRVModule::Impl::build_robust_physical_cbv_load(SPIRVModule &module, spv::Id type_id, spv::Id ptr_type_id,
                                                           unsigned alignment)
 {
@@ -1366,7 +1614,150 @@ spv::Id SPIRVModule::Impl::build_robust_physical_cbv_load(SPIRVModule &module, s
 	return func->getId();
 }
 
+static bool helper_call_uses_type(HelperCall call)
+{
+	switch (call)
+	{
+	case HelperCall::WaveMatch:
+	case HelperCall::WaveMultiPrefixFAdd:
+	case HelperCall::WaveMultiPrefixIAdd:
+	case HelperCall::WaveMultiPrefixFMul:
+	case HelperCall::WaveMultiPrefixIMul:
+	case HelperCall::WaveMultiPrefixBitAnd:
+	case HelperCall::WaveMultiPrefixBitOr:
+	case HelperCall::WaveMultiPrefixBitXor:
+	case HelperCall::WaveActiveAllEqualMasked:
+	case HelperCall::WaveReadFirstLaneMasked:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+// Type keys are [class:4][width:8][components:4], so that an equivalent type can be made in a scratch module.
+enum
+{
+	HelperTypeBool = 1,
+	HelperTypeUint = 2,
+	HelperTypeInt = 3,
+	HelperTypeFloat = 4
+};
+
+bool SPIRVModule::Impl::get_helper_type_key(spv::Id type_id, uint32_t &key) const
+{
+	uint32_t components = 1;
+	if (builder.isVectorType(type_id))
+	{
+		components = builder.getNumTypeComponents(type_id);
+		type_id = builder.getContainedTypeId(type_id);
+	}
+
+	uint32_t type_class;
+	uint32_t width = 0;
+	if (builder.isBoolType(type_id))
+		type_class = HelperTypeBool;
+	else if (builder.isUintType(type_id))
+		type_class = HelperTypeUint;
+	else if (builder.isIntType(type_id))
+		type_class = HelperTypeInt;
+	else if (builder.isFloatType(type_id))
+		type_class = HelperTypeFloat;
+	else
+		return false;
+
+	if (type_class != HelperTypeBool)
+		width = builder.getScalarTypeWidth(type_id);
+
+	key = type_class | (width << 4) | (components << 12);
+	return true;
+}
+
+spv::Id SPIRVModule::Impl::make_helper_type(uint32_t key)
+{
+	uint32_t width = (key >> 4) & 0xff;
+	uint32_t components = (key >> 12) & 0xf;
+	spv::Id type_id;
+
+	switch (key & 0xf)
+	{
+	case HelperTypeBool:
+		type_id = builder.makeBoolType();
+		break;
+	case HelperTypeUint:
+		type_id = builder.makeUintType(width);
+		break;
+	case HelperTypeInt:
+		type_id = builder.makeIntType(width);
+		break;
+	default:
+		type_id = builder.makeFloatType(width);
+		break;
+	}
+
+	if (components > 1)
+		type_id = builder.makeVectorType(type_id, components);
+	return type_id;
+}
+
+// Helpers only depend on the call, the type and whether helper lanes participate,
+// so they are built once per process in a scratch module and spliced into every module which needs them.
+spv::Id SPIRVModule::Impl::splice_cached_helper_call(HelperCall call, spv::Id type_id)
+{
+	// The descriptor QA check refers to the module's own descriptor QA buffers.
+	if (call == HelperCall::DescriptorQACheck)
+		return 0;
+
+	uint32_t type_key = 0;
+	if (!helper_call_uses_type(call))
+		type_id = 0;
+	else if (!get_helper_type_key(type_id, type_key))
+		return 0;
+
+	for (auto &spliced : spliced_helper_call_ids)
+		if (spliced.call == call && spliced.type_id == type_id)
+			return spliced.func_id;
+
+	uint64_t key = uint64_t(call) | (uint64_t(helper_lanes_participate_in_wave_ops) << 8) |
+	               (uint64_t(get_live_ballot_components()) << 9) | (uint64_t(type_key) << 32);
+	auto &cache = HelperFunctionCache::get();
+	std::shared_ptr<const HelperFunctionTemplate> tmpl;
+	if (!cache.find(key, tmpl))
+	{
+		SPIRVModule scratch;
+		auto &scratch_impl = *scratch.impl;
+		scratch_impl.helper_lanes_participate_in_wave_ops = helper_lanes_participate_in_wave_ops;
+		scratch_impl.maximum_subgroup_size = maximum_subgroup_size;
+		spv::Id scratch_type_id = type_id ? scratch_impl.make_helper_type(type_key) : 0;
+
+		Vector<uint32_t> words;
+		auto captured = std::make_shared<HelperFunctionTemplate>();
+		if (scratch_impl.build_helper_call(scratch, call, scratch_type_id) && scratch_impl.finalize_spirv(words) &&
+		    capture_helper_function_template(words.data(), words.size(), *captured))
+		{
+			tmpl = std::move(captured);
+		}
+
+		cache.insert(key, tmpl);
+	}
+
+	if (!tmpl)
+		return 0;
+
+	spv::Id func_id = splice_helper_function_template(builder, *tmpl);
+	spliced_helper_call_ids.push_back({ call, type_id, func_id });
+	return func_id;
+}
+
 spv::Id SPIRVModule::Impl::get_helper_call_id(SPIRVModule &module, HelperCall call, spv::Id type_id)
+{
+	spv::Id func_id = splice_cached_helper_call(call, type_id);
+	if (!func_id)
+		func_id = build_helper_call(module, call, type_id);
+	return func_id;
+}
+
+spv::Id SPIRVModule::Impl::build_helper_call(SPIRVModule &module, HelperCall call, spv::Id type_id)
 {
 	switch (call)
 	{
@@ -1401,6 +1792,10 @@ spv::Id SPIRVModule::Impl::get_helper_call_id(SPIRVModule &module, HelperCall ca
 		return build_wave_read_first_lane_masked(module, type_id);
 	case HelperCall::RobustAtomicCounter:
 		return build_robust_atomic_counter_op(module);
+	case HelperCall::AggregatedAtomicCounter:
+	case HelperCall::AggregatedRobustAtomicCounter:
+	case HelperCall::AggregatedPhysicalAtomicIAdd:
+		return build_aggregated_atomic_add_op(module, call);
 	case HelperCall::QuadAll:
 		return build_quad_all(module);
 	case HelperCall::QuadAny:
@@ -1464,10 +1859,16 @@ bool SPIRVModule::Impl::spirv_requires_14() const
 
 bool SPIRVModule::Impl::finalize_spirv(Vector<uint32_t> &spirv)
 {
+	DXIL_SPV_TRACE_ZONE("SPIRVModule::finalize_spirv");
 	spirv.clear();
 
+	// Size the output up front so dumping never has to reallocate.
+	size_t word_count = builder.getDumpWordCount();
+	spirv.reserve(word_count);
+
 	mark_error = false;
 	builder.dump(spirv);
+	assert(spirv.size() == word_count);
 	if (spirv.size() >= 2)
 	{
 		if (override_spirv_version)
@@ -1481,7 +1882,18 @@ bool SPIRVModule::Impl::finalize_spirv(Vector<uint32_t> &spirv)
 			spirv[1] = spirv_requires_14() ? Version_1_4 : Version_1_3;
 		}
 	}
-	return !mark_error;
+
+	if (mark_error)
+		return false;
+
+	if (spirv_optimization && !optimize_spirv(spirv))
+		return false;
+
+	// Last, so the optimizer cannot reintroduce allocation order into the output.
+	if (spirv_canonicalization)
+		canonicalize_spirv(spirv);
+
+	return true;
 }
 
 void SPIRVModule::Impl::register_block(CFGNode *node)
@@ -1499,6 +1911,38 @@ void SPIRVModule::Impl::register_block(CFGNode *node)
 	}
 }
 
+void SPIRVModule::Impl::prepare_blocks(const Vector<CFGNode *> &post_order)
+{
+	if (!peephole_optimization && !loop_invariant_code_motion)
+		return;
+
+	IRPeephole peephole;
+	builder.forEachAnnotatedId([&](spv::Id id) { peephole.pin_id(id); });
+
+	for (auto &builtin : builtins_input)
+	{
+		// Helper invocation state changes with demote.
+		if (builtin.first != spv::BuiltInHelperInvocation && !builtin_requires_volatile(builtin.first))
+		{
+			peephole.add_invariant_pointer(builtin.second);
+			peephole.add_speculatable_pointer(builtin.second);
+		}
+	}
+
+	// Lets repeated bindless heap lookups reuse the descriptor loaded in a dominating block.
+	for (spv::Id id : read_only_variables)
+		peephole.add_invariant_pointer(id);
+
+	// Root constants can always be read, so their loads may be moved out of conditional code.
+	for (spv::Id id : push_constant_variables)
+		peephole.add_speculatable_pointer(id);
+
+	if (peephole_optimization)
+		peephole.run(post_order);
+	if (loop_invariant_code_motion)
+		peephole.hoist_loop_invariants(post_order);
+}
+
 void SPIRVModule::Impl::emit_basic_block(CFGNode *node)
 {
 	auto *bb = get_spv_block(node);
@@ -1517,31 +1961,40 @@ void SPIRVModule::Impl::emit_basic_block(CFGNode *node)
 		fake_loop_block = new spv::Block(builder.getUniqueId(), *active_function);
 	}
 
+	// Phis and plain operations are encoded straight into the block's word stream.
+	// Reserve for the worst case so the common path never reallocates.
+	size_t estimated_words = 0;
+	for (auto &phi : ir.phi)
+		estimated_words += 3 + 2 * (phi.incoming.size() + 1);
+	for (auto *op : ir.operations)
+		estimated_words += 3 + op->num_arguments;
+	bb->reserveEncodedWords(estimated_words);
+
 	// Emit phi nodes.
 	for (auto &phi : ir.phi)
 	{
 		if (!phi.id)
 			continue;
 
-		auto phi_op = std::make_unique<spv::Instruction>(phi.id, phi.type_id, spv::OpPhi);
+		size_t phi_offset = bb->beginEncodedInstruction(spv::OpPhi, phi.type_id, phi.id);
 		for (auto &incoming : phi.incoming)
 		{
-			phi_op->addIdOperand(incoming.id);
-			phi_op->addIdOperand(incoming.block->id);
+			bb->addEncodedOperand(incoming.id);
+			bb->addEncodedOperand(incoming.block->id);
 		}
 
 		if (fake_loop_block && !node->ir.merge_info.continue_block)
 		{
 			builder.setBuildPoint(fake_loop_block);
-			phi_op->addIdOperand(builder.createUndefined(phi.type_id));
+			bb->addEncodedOperand(builder.createUndefined(phi.type_id));
 			builder.setBuildPoint(bb);
-			phi_op->addIdOperand(fake_loop_block->getId());
+			bb->addEncodedOperand(fake_loop_block->getId());
 		}
 
+		bb->endEncodedInstruction(phi_offset);
+
 		if (phi.relaxed)
 			builder.addDecoration(phi.id, spv::DecorationRelaxedPrecision);
-
-		bb->addInstruction(std::move(phi_op));
 	}
 
 	bool implicit_terminator = false;
@@ -1558,27 +2011,18 @@ void SPIRVModule::Impl::emit_basic_block(CFGNode *node)
 
 			if (discard_state_var_id)
 			{
-				auto is_helper = std::make_unique<spv::Instruction>(builder.getUniqueId(), builder.makeBoolType(), spv::OpLoad);
-				is_helper->addIdOperand(helper_var_id);
-				spv::Id is_helper_id = is_helper->getResultId();
-				bb->addInstruction(std::move(is_helper));
-
-				auto loaded_var = std::make_unique<spv::Instruction>(builder.getUniqueId(), builder.makeBoolType(), spv::OpLoad);
-				loaded_var->addIdOperand(discard_state_var_id);
-				spv::Id is_discard_id = loaded_var->getResultId();
-				bb->addInstruction(std::move(loaded_var));
-
-				auto or_inst = std::make_unique<spv::Instruction>(op->id, op->type_id, spv::OpLogicalOr);
-				or_inst->addIdOperand(is_helper_id);
-				or_inst->addIdOperand(is_discard_id);
-				bb->addInstruction(std::move(or_inst));
+				spv::Id bool_type = builder.makeBoolType();
+				spv::Id is_helper_id = builder.getUniqueId();
+				bb->addEncodedInstruction(spv::OpLoad, bool_type, is_helper_id, &helper_var_id, 1);
+
+				spv::Id is_discard_id = builder.getUniqueId();
+				bb->addEncodedInstruction(spv::OpLoad, bool_type, is_discard_id, &discard_state_var_id, 1);
+
+				const spv::Id or_args[] = { is_helper_id, is_discard_id };
+				bb->addEncodedInstruction(spv::OpLogicalOr, op->type_id, op->id, or_args, 2);
 			}
 			else
-			{
-				auto is_helper = std::make_unique<spv::Instruction>(op->id, op->type_id, spv::OpLoad);
-				is_helper->addIdOperand(helper_var_id);
-				bb->addInstruction(std::move(is_helper));
-			}
+				bb->addEncodedInstruction(spv::OpLoad, op->type_id, op->id, &helper_var_id, 1);
 		}
 		else if (op->op == spv::OpDemoteToHelperInvocationEXT && !caps.supports_demote)
 		{
@@ -1609,26 +2053,18 @@ void SPIRVModule::Impl::emit_basic_block(CFGNode *node)
 				implicit_terminator = true;
 			}
 
-			std::unique_ptr<spv::Instruction> inst;
-			if (op->id != 0)
-				inst = std::make_unique<spv::Instruction>(op->id, op->type_id, op->op);
-			else
-				inst = std::make_unique<spv::Instruction>(op->op);
-
+#ifndef NDEBUG
 			unsigned literal_mask = op->get_literal_mask();
-
 			for (auto &arg : *op)
 			{
-				if (literal_mask & 1u)
-					inst->addImmediateOperand(arg);
-				else
-				{
-					assert(arg);
-					inst->addIdOperand(arg);
-				}
+				assert((literal_mask & 1u) || arg);
 				literal_mask >>= 1u;
 			}
-			bb->addInstruction(std::move(inst));
+#endif
+
+			// Type ID is only meaningful for ops which produce a result.
+			bb->addEncodedInstruction(op->op, op->id ? op->type_id : 0, op->id,
+			                          op->arguments, op->num_arguments);
 		}
 	}
 
@@ -1841,6 +2277,15 @@ void SPIRVModule::Impl::register_active_variable(spv::StorageClass storage, spv:
 
 	if (register_entry_point)
 		entry_point->addIdOperand(id);
+
+	if (storage == spv::StorageClassUniformConstant || storage == spv::StorageClassUniform ||
+	    storage == spv::StorageClassPushConstant || storage == spv::StorageClassShaderRecordBufferKHR)
+	{
+		read_only_variables.push_back(id);
+	}
+
+	if (storage == spv::StorageClassPushConstant)
+		push_constant_variables.push_back(id);
 }
 
 spv::Id SPIRVModule::Impl::create_variable(spv::StorageClass storage, spv::Id type, const char *name)
@@ -1940,17 +2385,17 @@ bool SPIRVModule::query_builtin_shader_output(spv::Id id, spv::BuiltIn *builtin)
 
 Operation *SPIRVModule::allocate_op()
 {
-	return impl->operation_pool.allocate();
+	return impl->operation_pool.allocate(impl->operation_argument_pool);
 }
 
 Operation *SPIRVModule::allocate_op(spv::Op op)
 {
-	return impl->operation_pool.allocate(op);
+	return impl->operation_pool.allocate(impl->operation_argument_pool, op);
 }
 
 Operation *SPIRVModule::allocate_op(spv::Op op, spv::Id id, spv::Id type_id)
 {
-	return impl->operation_pool.allocate(op, id, type_id);
+	return impl->operation_pool.allocate(impl->operation_argument_pool, op, id, type_id);
 }
 
 spv::Id SPIRVModule::create_variable(spv::StorageClass storage, spv::Id type, const char *name)
@@ -1994,6 +2439,51 @@ void SPIRVModule::set_helper_lanes_participate_in_wave_ops(bool enable)
 	impl->helper_lanes_participate_in_wave_ops = enable;
 }
 
+void SPIRVModule::set_maximum_subgroup_size(uint32_t size)
+{
+	impl->maximum_subgroup_size = size;
+}
+
+void SPIRVModule::set_spirv_optimization(bool enable)
+{
+	impl->spirv_optimization = enable;
+}
+
+void SPIRVModule::set_spirv_canonicalization(bool enable)
+{
+	impl->spirv_canonicalization = enable;
+}
+
+void SPIRVModule::set_peephole_optimization(bool enable)
+{
+	impl->peephole_optimization = enable;
+}
+
+void SPIRVModule::set_loop_invariant_code_motion(bool enable)
+{
+	impl->loop_invariant_code_motion = enable;
+}
+
+void SPIRVModule::set_structured_cfg_fast_path(bool enable)
+{
+	impl->structured_cfg_fast_path = enable;
+}
+
+bool SPIRVModule::get_structured_cfg_fast_path() const
+{
+	return impl->structured_cfg_fast_path;
+}
+
+void SPIRVModule::set_structurizer_node_growth_factor(unsigned factor)
+{
+	impl->structurizer_node_growth_factor = factor;
+}
+
+unsigned SPIRVModule::get_structurizer_node_growth_factor() const
+{
+	return impl->structurizer_node_growth_factor;
+}
+
 bool SPIRVModule::opcode_is_control_dependent(spv::Op opcode)
 {
 	// An opcode is considered control dependent if it is affected by other invocations in the subgroup.
@@ -55,6 +55,9 @@ enum class HelperCall
 	WaveMultiPrefixBitXor,
 	WaveMultiPrefixCountBits,
 	RobustAtomicCounter,
+	AggregatedAtomicCounter,
+	AggregatedRobustAtomicCounter,
+	AggregatedPhysicalAtomicIAdd,
 	QuadAll,
 	QuadAny,
 	WaveIsFirstLaneMasked,
@@ -112,6 +115,17 @@ public:
 
 	void set_override_spirv_version(uint32_t version);
 	void set_helper_lanes_participate_in_wave_ops(bool enable);
+	// Upper bound on the subgroup size. Wave helpers may assume ballot bits beyond this are zero.
+	void set_maximum_subgroup_size(uint32_t size);
+	void set_spirv_optimization(bool enable);
+	void set_spirv_canonicalization(bool enable);
+	void set_peephole_optimization(bool enable);
+	void set_loop_invariant_code_motion(bool enable);
+	void set_structured_cfg_fast_path(bool enable);
+	bool get_structured_cfg_fast_path() const;
+	// 0 disables the structurizer complexity budget.
+	void set_structurizer_node_growth_factor(unsigned factor);
+	unsigned get_structurizer_node_growth_factor() const;
 
 	DXIL_SPV_OVERRIDE_NEW_DELETE
 
@@ -0,0 +1,95 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "spirv_optimizer.hpp"
+#include "logging.hpp"
+
+#ifdef HAVE_SPIRV_OPTIMIZER
+#include "spirv-tools/optimizer.hpp"
+#include <memory>
+#include <vector>
+#else
+#include <mutex>
+#endif
+
+namespace dxil_spv
+{
+#ifdef HAVE_SPIRV_OPTIMIZER
+static std::unique_ptr<spvtools::Optimizer> create_optimizer()
+{
+	// Vulkan 1.3 environment accepts any SPIR-V version we emit.
+	std::unique_ptr<spvtools::Optimizer> optimizer(new spvtools::Optimizer(SPV_ENV_VULKAN_1_3));
+	optimizer->SetMessageConsumer([](spv_message_level_t level, const char *, const spv_position_t &position,
+	                                 const char *message) {
+		if (level <= SPV_MSG_ERROR)
+			LOGE("SPIRV-Tools optimizer: %s (word %zu).\n", message, position.index);
+	});
+
+	// Only cheap, local passes which clean up what the converter tends to leave behind.
+	// Anything which needs full loop or CFG analysis is left to the driver.
+	optimizer->RegisterPass(spvtools::CreateEliminateDeadFunctionsPass())
+	    .RegisterPass(spvtools::CreateLocalSingleBlockLoadStoreElimPass())
+	    .RegisterPass(spvtools::CreateLocalSingleStoreElimPass())
+	    .RegisterPass(spvtools::CreateSimplificationPass())
+	    .RegisterPass(spvtools::CreateRedundancyEliminationPass())
+	    .RegisterPass(spvtools::CreateAggressiveDCEPass(true));
+
+	return optimizer;
+}
+
+bool optimize_spirv(Vector<uint32_t> &spirv)
+{
+	static thread_local std::unique_ptr<spvtools::Optimizer> optimizer;
+	if (!optimizer)
+		optimizer = create_optimizer();
+
+	// The converter output is trusted, and validation would cost more than the passes themselves.
+	// Bindings and spec constants are part of the interface the application sees, so keep them.
+	spvtools::OptimizerOptions options;
+	options.set_run_validator(false);
+	options.set_preserve_bindings(true);
+	options.set_preserve_spec_constants(true);
+
+	std::vector<uint32_t> optimized;
+	if (!optimizer->Run(spirv.data(), spirv.size(), &optimized, options))
+	{
+		LOGE("Failed to optimize SPIR-V module.\n");
+		return false;
+	}
+
+	spirv.assign(optimized.begin(), optimized.end());
+	return true;
+}
+#else
+bool optimize_spirv(Vector<uint32_t> &)
+{
+	static std::once_flag warned;
+	std::call_once(warned, []() {
+		LOGW("SPIR-V optimization was requested, but dxil-spirv was built without optimizer support.\n");
+	});
+	return true;
+}
+#endif
+} // namespace dxil_spv
@@ -116,6 +116,13 @@ def cross_compile_dxil(shader, args, paths, is_asm):
     else:
         dxil_path = shader
 
+    if args.dump_dxil:
+        dump_path = os.path.join(args.dump_dxil, os.path.relpath(shader, args.folder))
+        if not is_asm:
+            dump_path += '.dxil'
+        os.makedirs(os.path.dirname(dump_path), exist_ok = True)
+        shutil.copyfile(dxil_path, dump_path)
+
     hlsl_cmd = [paths.dxil_spirv, '--output', glsl_path, dxil_path, '--vertex-input', 'ATTR', '0']
     if '.noglsl' not in shader:
         hlsl_cmd += ['--asm', '--glsl']
@@ -232,6 +239,64 @@ def cross_compile_dxil(shader, args, paths, is_asm):
         hlsl_cmd += ['--invariant-position']
     if '.partitioned.' in shader:
         hlsl_cmd += ['--subgroup-partitioned-nv']
+    if '.parallel-parse.' in shader:
+        hlsl_cmd += ['--parse-threads', '4']
+    if '.gs-vertex-analysis.' in shader:
+        hlsl_cmd += ['--geometry-output-vertex-analysis']
+    if '.link-outputs.' in shader:
+        hlsl_cmd += ['--consumer-input', 'TEXCOORD', '0']
+    if '.mesh-store-coalescing.' in shader:
+        hlsl_cmd += ['--mesh-output-store-coalescing']
+    if '.licm.' in shader:
+        hlsl_cmd += ['--loop-invariant-code-motion']
+    if '.spirv-optimize.' in shader:
+        hlsl_cmd += ['--spirv-optimize']
+    if '.peephole.' in shader:
+        hlsl_cmd += ['--peephole-optimize']
+    if '.coalesce-loads.' in shader:
+        hlsl_cmd += ['--coalesce-buffer-loads']
+    if '.uniformity.' in shader:
+        hlsl_cmd += ['--uniformity-analysis']
+    if '.payload-liveness.' in shader:
+        hlsl_cmd += ['--ray-payload-liveness']
+    if '.sparse-forwarding.' in shader:
+        hlsl_cmd += ['--sparse-feedback-forwarding']
+    if '.cfg-fast-path.' in shader:
+        hlsl_cmd += ['--structured-cfg-fast-path']
+    if '.dce.' in shader:
+        hlsl_cmd += ['--dead-code-eliminate']
+    if '.known-root-constants.' in shader:
+        hlsl_cmd += ['--known-root-constant', '4', '2', '--known-root-constant', '5', '0']
+    if '.sbt-spec-ids.' in shader:
+        hlsl_cmd += ['--sbt-descriptor-size-spec-ids', '100', '101']
+    if '.hull-barrier-elision.' in shader:
+        hlsl_cmd += ['--hull-barrier-elision']
+    if '.narrowing.' in shader:
+        hlsl_cmd += ['--min-precision-narrowing']
+    if '.qa-dedup.' in shader:
+        hlsl_cmd += ['--descriptor-qa-deduplicate']
+    if '.qa-kill-switch.' in shader:
+        hlsl_cmd += ['--descriptor-qa-kill-switch', '200']
+    if '.wave-atomics.' in shader:
+        hlsl_cmd += ['--wave-aggregated-atomics']
+    if '.uav-coherence.' in shader:
+        hlsl_cmd += ['--uav-coherence-analysis']
+    if '.phys-align.' in shader:
+        hlsl_cmd += ['--physical-address-alignment', '16']
+    if '.scalarize-alloca.' in shader:
+        hlsl_cmd += ['--alloca-scalarization']
+    if '.lod-merging.' in shader:
+        hlsl_cmd += ['--sampler-feedback-lod-merging']
+    if '.canonical.' in shader:
+        hlsl_cmd += ['--canonicalize-spirv']
+    if '.structurizer-budget.' in shader:
+        hlsl_cmd += ['--structurizer-complexity-budget', '32']
+    if '.constant-folding.' in shader:
+        hlsl_cmd += ['--constant-folding']
+    if '.grad-opt.' in shader:
+        hlsl_cmd += ['--sample-grad-optimization']
+    if '.grad-uniform-scale.' in shader:
+        hlsl_cmd += ['--sample-grad-assume-uniform-scale']
 
     subprocess.check_call(hlsl_cmd)
     if is_asm:
@@ -376,6 +441,8 @@ def main():
             help = 'Explicit path to dxil-spirv')
     parser.add_argument('--subfolder',
             help = 'Only test specific subfolder')
+    parser.add_argument('--dump-dxil',
+            help = 'Also copy the compiled DXIL of every shader to this folder, e.g. as input for dxil-spirv-bench.')
 
     args = parser.parse_args()
     if not args.folder:
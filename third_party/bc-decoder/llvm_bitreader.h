@@ -25,6 +25,7 @@
 #pragma once
 
 #include <assert.h>
+#include <stdint.h>
 #include <string.h>
 
 namespace LLVMBC
@@ -43,6 +44,7 @@ public:
   size_t ByteLength() const { return m_End - m_Start; }
   size_t BitLength() const { return (m_End - m_Start) * 8; }
   bool AtEndOfStream() const { return m_Bits >= m_End; }
+  size_t BitsRemaining() const { return AtEndOfStream() ? 0 : BitLength() - BitOffset(); }
   void SeekByte(size_t byteOffset)
   {
     m_Bits = m_Start + byteOffset;
@@ -55,11 +57,7 @@ public:
   }
   char c6()
   {
-    byte scratch[8];
-    scratch[0] = 0;
-    byte &c = scratch[0];
-
-    ReadBits(6, &c);
+    byte c = fixed<byte>(6);
 
     if(c <= 25)
       return char('a' + c);
@@ -78,9 +76,21 @@ public:
   template <typename T>
   T fixed(const size_t bitWidth)
   {
-    byte scratch[8] = {};
+    // malformed input can ask for any width, treat it like reading off the end of the stream.
+    if(bitWidth > 64)
+    {
+      Invalidate();
+      return T(0);
+    }
+
+    uint64_t word;
+    if(bitWidth <= MinPeekBits && Peek64(word))
+    {
+      Skip(bitWidth);
+      return T(word & ((uint64_t(1) << bitWidth) - 1));
+    }
 
-    assert(bitWidth <= 64);
+    byte scratch[8] = {};
 
     ReadBits(bitWidth, scratch);
 
@@ -94,34 +104,59 @@ public:
   {
     uint64_t ret = 0;
 
-    assert(groupBitSize > 1 && "chunk size must be greater than 1");
-    assert(groupBitSize <= 8 && "Only chunk sizes up to 8 supported");
+    // chunks need a continuation bit and at least one value bit. LLVM caps them at 32 bits.
+    if(groupBitSize < 2 || groupBitSize > 32)
+    {
+      Invalidate();
+      return T(0);
+    }
 
-    // Avoid false positive warning.
-    byte scratch[8] = {};
+    const uint64_t hibit = uint64_t(1) << (groupBitSize - 1);
+    const uint64_t lobits = hibit - 1;
 
-    const byte hibit = 1 << (groupBitSize - 1);
-    const byte lobits = hibit - 1;
+    // Fast path: decode every chunk out of one 64-bit window. If the value does not fit in the
+    // window, nothing has been consumed yet, so just restart on the slow path.
+    uint64_t word;
+    if(Peek64(word))
+    {
+      const size_t avail = 64 - m_Offset;
+      size_t consumed = 0;
+      uint64_t shift = 0;
+
+      while(consumed + groupBitSize <= avail && shift <= 63)
+      {
+        const uint64_t chunk = word & ((uint64_t(1) << groupBitSize) - 1);
+        word >>= groupBitSize;
+        consumed += groupBitSize;
+
+        ret += (chunk & lobits) << shift;
+        shift += uint64_t(groupBitSize - 1);
+
+        if((chunk & hibit) == 0)
+        {
+          Skip(consumed);
+          return CheckVBR<T>(ret);
+        }
+      }
+
+      ret = 0;
+    }
 
     uint64_t shift = 0;
+    uint64_t chunk;
     do
     {
-      ReadBits(groupBitSize, scratch);
+      // reads zeros once the stream runs out, which terminates the loop.
+      chunk = fixed<uint64_t>(groupBitSize);
 
-      assert(shift <= 63);
-
-      ret += (uint64_t(scratch[0] & lobits) << shift);
+      // excess chunks in malformed input would overflow the shift, drop them.
+      if(shift <= 63)
+        ret += (chunk & lobits) << shift;
 
       shift += uint64_t(groupBitSize - 1);
-    } while(scratch[0] & hibit);
-
-#ifndef NDEBUG
-    // check for overflow of the return type
-    const uint64_t mask = ((1ULL << (sizeof(T) * 8 - 1)) - 1) << 1 | 1;
-    assert((ret & mask) == ret);
-#endif
+    } while(chunk & hibit);
 
-    return T(ret);
+    return CheckVBR<T>(ret);
   }
 
   template <typename T>
@@ -145,6 +180,9 @@ public:
   template <typename T>
   T Read()
   {
+    if(sizeof(T) * 8 <= MinPeekBits)
+      return fixed<T>(sizeof(T) * 8);
+
     byte scratch[sizeof(T)] = {};
 
     ReadBits(sizeof(T) * 8, scratch);
@@ -187,6 +225,50 @@ private:
   const byte *m_Bits, *m_Start, *m_End;
   size_t m_Offset;
 
+  // A 64-bit load shifted down by at most 7 bits always has this many valid bits.
+  enum
+  {
+    MinPeekBits = 56
+  };
+
+  // Loads the next 64 bits of the stream starting at the current bit, or fails if the load would
+  // run off the end of the stream. Assumes a little-endian host like the rest of the reader.
+  bool Peek64(uint64_t &word) const
+  {
+    // blobs can move the cursor past the end, so check that before computing the distance.
+    if(m_Bits >= m_End || size_t(m_End - m_Bits) < sizeof(uint64_t))
+      return false;
+
+    memcpy(&word, m_Bits, sizeof(word));
+    word >>= m_Offset;
+    return true;
+  }
+
+  void Invalidate()
+  {
+    m_Bits = m_End;
+    m_Offset = 0;
+  }
+
+  void Skip(size_t bits)
+  {
+    bits += m_Offset;
+    m_Bits += bits / 8;
+    m_Offset = bits % 8;
+  }
+
+  template <typename T>
+  static T CheckVBR(uint64_t ret)
+  {
+#ifndef NDEBUG
+    // check for overflow of the return type
+    const uint64_t mask = ((1ULL << (sizeof(T) * 8 - 1)) - 1) << 1 | 1;
+    assert((ret & mask) == ret);
+#endif
+
+    return T(ret);
+  }
+
   void Advance(size_t N)
   {
     m_Offset += N;
@@ -48,8 +48,83 @@ struct AbbrevParam
 struct AbbrevDesc
 {
   dxil_spv::Vector<AbbrevParam> params;
+
+  // pre-resolved layout, filled in by CompileAbbrev() once the abbreviation is defined so that
+  // decoding a record doesn't need to re-validate the parameter list every time.
+  AbbrevParam code;
+  // scalar operands between the code and the optional array/blob tail.
+  dxil_spv::Vector<AbbrevParam> scalars;
+  // encoding of the tail, Literal if there is none.
+  AbbrevEncoding tail = AbbrevEncoding::Literal;
+  AbbrevParam arrayElement;
 };
 
+static bool ValidateAbbrevWidth(AbbrevParam &param)
+{
+  if(param.encoding != AbbrevEncoding::Fixed && param.encoding != AbbrevEncoding::VBR)
+    return true;
+
+  // like LLVM, a zero width operand always reads as 0.
+  if(param.value == 0)
+  {
+    param.encoding = AbbrevEncoding::Literal;
+    return true;
+  }
+
+  if(param.encoding == AbbrevEncoding::Fixed)
+    return param.value <= 64;
+  else
+    return param.value >= 2 && param.value <= 32;
+}
+
+static bool CompileAbbrev(AbbrevDesc &a)
+{
+  // should have at least one param for the code itself, and it can't be an aggregate.
+  if(a.params.empty() || a.params[0].encoding == AbbrevEncoding::Array ||
+     a.params[0].encoding == AbbrevEncoding::Blob)
+    return false;
+
+  // the operand widths come straight from the stream, validate them once here so decoding can trust them.
+  for(auto &param : a.params)
+    if(!ValidateAbbrevWidth(param))
+      return false;
+
+  a.code = a.params[0];
+  a.scalars.reserve(a.params.size() - 1);
+
+  for(size_t i = 1; i < a.params.size(); i++)
+  {
+    const AbbrevParam &param = a.params[i];
+
+    if(param.encoding == AbbrevEncoding::Array)
+    {
+      // must be another param to specify the value type, and it must be the last
+      if(i + 2 != a.params.size())
+        return false;
+      a.tail = AbbrevEncoding::Array;
+      a.arrayElement = a.params[i + 1];
+      if(a.arrayElement.encoding == AbbrevEncoding::Array ||
+         a.arrayElement.encoding == AbbrevEncoding::Blob)
+        return false;
+      break;
+    }
+    else if(param.encoding == AbbrevEncoding::Blob)
+    {
+      // blob must be the last value
+      if(i + 1 != a.params.size())
+        return false;
+      a.tail = AbbrevEncoding::Blob;
+      break;
+    }
+    else
+    {
+      a.scalars.push_back(param);
+    }
+  }
+
+  return true;
+}
+
 // the temporary context while pushing/popping blocks
 struct BlockContext
 {
@@ -83,20 +158,26 @@ enum class BlockInfoRecord
   SETRECORDNAME = 3,
 };
 
-BitcodeReader::BitcodeReader(const byte *bitcode, size_t length) : b(bitcode, length)
+BitcodeReader::BitcodeReader(const byte *bitcode, size_t length)
+    : b(bitcode, length), blockInfoOwner(this)
 {
   uint32_t magic = b.Read<uint32_t>();
   (void)magic;
   assert(magic == uint32_t(MAKE_FOURCC('B', 'C', 0xC0, 0xDE)));
 }
 
+BitcodeReader::BitcodeReader(const BitcodeReader &parent)
+    : b(parent.b), blockInfoOwner(parent.blockInfoOwner)
+{
+}
+
 BitcodeReader::~BitcodeReader()
 {
   for(auto it = blockInfo.begin(); it != blockInfo.end(); ++it)
     delete it->second;
 }
 
-BlockOrRecord BitcodeReader::ReadToplevelBlock()
+bool BitcodeReader::ReadToplevelBlock(BitcodeVisitor &visitor)
 {
   BlockOrRecord ret;
 
@@ -105,9 +186,7 @@ BlockOrRecord BitcodeReader::ReadToplevelBlock()
   (void)abbrevID;
   assert(abbrevID == ENTER_SUBBLOCK);
 
-  ReadBlockContents(ret);
-
-  return ret;
+  return ReadBlockContents(ret, visitor);
 }
 
 bool BitcodeReader::AtEndOfStream()
@@ -115,7 +194,122 @@ bool BitcodeReader::AtEndOfStream()
   return b.AtEndOfStream();
 }
 
-void BitcodeReader::ReadBlockContents(BlockOrRecord &block)
+void BitcodeReader::SetDeferredBlockId(uint32_t blockId)
+{
+  deferredBlockId = blockId;
+}
+
+bool BitcodeReader::ReadDeferredBlock(const BlockOrRecord &block, BitcodeVisitor &visitor)
+{
+  BlockOrRecord ret;
+
+  // deferred blocks are always read back from the top-level, so we never have a block stack here.
+  assert(block.IsDeferred());
+  assert(blockStack.empty());
+
+  b.SeekBit(block.deferredBitOffset);
+  return ReadBlockContents(ret, visitor);
+}
+
+namespace
+{
+struct DecodedBlockRecorder : BitcodeVisitor
+{
+  explicit DecodedBlockRecorder(DecodedBlock &decoded_) : decoded(decoded_) {}
+
+  bool EnterBlock(const BlockOrRecord &block) override
+  {
+    Push(DecodedBlock::EventType::EnterBlock, block);
+    return true;
+  }
+
+  bool LeaveBlock(const BlockOrRecord &block) override
+  {
+    Push(DecodedBlock::EventType::LeaveBlock, block);
+    return true;
+  }
+
+  bool VisitRecord(const BlockOrRecord &record) override
+  {
+    Push(DecodedBlock::EventType::Record, record);
+    decoded.ops.insert(decoded.ops.end(), record.ops.begin(), record.ops.end());
+    return true;
+  }
+
+  bool VisitDeferredBlock(const BlockOrRecord &) override
+  {
+    // nested readers never defer anything.
+    return false;
+  }
+
+  void Push(DecodedBlock::EventType type, const BlockOrRecord &entry)
+  {
+    DecodedBlock::Event e;
+    e.type = type;
+    e.id = entry.id;
+    e.blockDwordLength = entry.blockDwordLength;
+    e.firstOp = decoded.ops.size();
+    e.numOps = entry.ops.size();
+    e.blob = entry.blob;
+    e.blobLength = entry.blobLength;
+    decoded.events.push_back(e);
+  }
+
+  DecodedBlock &decoded;
+};
+}    // namespace
+
+bool BitcodeReader::DecodeDeferredBlock(const BlockOrRecord &block, DecodedBlock &decoded) const
+{
+  BitcodeReader reader(*this);
+  DecodedBlockRecorder recorder(decoded);
+  return reader.ReadDeferredBlock(block, recorder);
+}
+
+bool DecodedBlock::Replay(BitcodeVisitor &visitor) const
+{
+  BlockOrRecord entry;
+
+  for(const Event &e : events)
+  {
+    entry.id = e.id;
+    entry.blockDwordLength = e.blockDwordLength;
+
+    bool ok;
+    switch(e.type)
+    {
+      case EventType::EnterBlock: ok = visitor.EnterBlock(entry); break;
+      case EventType::LeaveBlock: ok = visitor.LeaveBlock(entry); break;
+      default:
+        entry.ops.assign(ops.begin() + e.firstOp, ops.begin() + e.firstOp + e.numOps);
+        entry.blob = e.blob;
+        entry.blobLength = e.blobLength;
+        ok = visitor.VisitRecord(entry);
+        break;
+    }
+
+    if(!ok)
+      return false;
+  }
+
+  return true;
+}
+
+void BitcodeReader::SkipBlockContents(BlockOrRecord &block, size_t blockStart)
+{
+  b.vbr<size_t>(4);
+  b.align32bits();
+  block.blockDwordLength = b.Read<uint32_t>();
+  block.deferredBitOffset = blockStart;
+
+  // the length covers everything up to and including the aligned END_BLOCK.
+  size_t blockEnd = b.BitOffset() + size_t(block.blockDwordLength) * 32;
+  if(blockEnd > b.BitLength())
+    blockEnd = b.BitLength();
+  b.SeekBit(blockEnd);
+}
+
+bool BitcodeReader::ReadBlockContents(BlockOrRecord &block, BitcodeVisitor &visitor)
 {
   block.id = b.vbr<uint32_t>(8);
 
@@ -124,25 +318,47 @@ void BitcodeReader::ReadBlockContents(BlockOrRecord &block)
   b.align32bits();
   block.blockDwordLength = b.Read<uint32_t>();
 
+  // if the visitor bails out we stop decoding, but still pop the block context below.
+  bool ok = visitor.EnterBlock(block);
+
   // used for blockinfo only
   BlockInfo *curBlockInfo = NULL;
 
   uint32_t abbrevID = ~0U;
-  do
+  while(ok)
   {
     abbrevID = b.fixed<uint32_t>(abbrevSize());
 
     if(abbrevID == END_BLOCK)
     {
       b.align32bits();
+      ok = visitor.LeaveBlock(block);
+      break;
     }
     else if(abbrevID == ENTER_SUBBLOCK)
     {
       BlockOrRecord sub;
 
-      ReadBlockContents(sub);
+      if(blockStack.size() == 1 && deferredBlockId != ~0U)
+      {
+        size_t blockStart = b.BitOffset();
+        sub.id = b.vbr<uint32_t>(8);
 
-      block.children.push_back(sub);
+        if(sub.id == deferredBlockId)
+        {
+          SkipBlockContents(sub, blockStart);
+          ok = visitor.VisitDeferredBlock(sub);
+        }
+        else
+        {
+          b.SeekBit(blockStart);
+          ok = ReadBlockContents(sub, visitor);
+        }
+      }
+      else
+      {
+        ok = ReadBlockContents(sub, visitor);
+      }
     }
     else if(abbrevID == DEFINE_ABBREV)
     {
@@ -150,6 +366,13 @@ void BitcodeReader::ReadBlockContents(BlockOrRecord &block)
 
       uint32_t numops = b.vbr<uint32_t>(5);
 
+      // every operand takes at least one bit, don't let a corrupt count allocate unbounded memory.
+      if(numops > b.BitsRemaining())
+      {
+        ok = false;
+        break;
+      }
+
       a.params.resize(numops);
 
       for(uint32_t i = 0; i < numops; i++)
@@ -174,6 +397,12 @@ void BitcodeReader::ReadBlockContents(BlockOrRecord &block)
         }
       }
 
+      if(!CompileAbbrev(a))
+      {
+        ok = false;
+        break;
+      }
+
       if(curBlockInfo)
         curBlockInfo->abbrevs.push_back(a);
       else
@@ -181,15 +410,29 @@ void BitcodeReader::ReadBlockContents(BlockOrRecord &block)
     }
     else if(abbrevID == UNABBREV_RECORD)
     {
-      BlockOrRecord r;
+      BlockOrRecord &r = record;
+      r.blob = NULL;
+      r.blobLength = 0;
       r.id = b.vbr<uint32_t>(6);
       uint32_t numops = b.vbr<uint32_t>(6);
+      if(numops > b.BitsRemaining())
+      {
+        ok = false;
+        break;
+      }
       r.ops.resize(numops);
       for(uint32_t i = 0; i < numops; i++)
         r.ops[i] = b.vbr<uint64_t>(6);
 
       if(block.id == 0)    // BLOCKINFO is block 0
       {
+        // BLOCKINFO is owned by the reader which decodes the module, it can't be redefined later.
+        if(blockInfoOwner != this)
+        {
+          ok = false;
+          break;
+        }
+
         switch(BlockInfoRecord(r.id))
         {
           case BlockInfoRecord::SETBID:
@@ -224,60 +467,55 @@ void BitcodeReader::ReadBlockContents(BlockOrRecord &block)
         }
       }
 
-      block.children.push_back(r);
+      ok = visitor.VisitRecord(r);
     }
     else
     {
-      const AbbrevDesc &a = getAbbrev(block.id, abbrevID);
-
-      BlockOrRecord r;
-
-      // should have at least one param for the code itself
-      assert(!a.params.empty());
-
-      r.id = (uint32_t)decodeAbbrevParam(a.params[0]);
-
-      // process the rest of the operands - since some might be arrays we don't know until we
-      // process it how many ops the record will end up with but it will be at least one per
-      // parameter.
-      r.ops.reserve(a.params.size() - 1);
-      for(size_t i = 1; i < a.params.size(); i++)
+      const AbbrevDesc *abbrev = getAbbrev(block.id, abbrevID);
+      if(!abbrev)
       {
-        const AbbrevParam &param = a.params[i];
+        ok = false;
+        break;
+      }
 
-        if(param.encoding == AbbrevEncoding::Array)
-        {
-          // must be another param to specify the value type, and it must be the last
-          assert(i + 1 == a.params.size() - 1);
-          const AbbrevParam &elType = a.params[i + 1];
+      const AbbrevDesc &a = *abbrev;
 
-          size_t arrayLen = b.vbr<size_t>(6);
+      BlockOrRecord &r = record;
+      r.ops.clear();
+      r.blob = NULL;
+      r.blobLength = 0;
 
-          for(size_t el = 0; el < arrayLen; el++)
-            r.ops.push_back(decodeAbbrevParam(elType));
+      r.id = (uint32_t)decodeAbbrevParam(a.code);
 
-          break;
-        }
-        else if(param.encoding == AbbrevEncoding::Blob)
-        {
-          // blob must be the last value
-          assert(i == a.params.size() - 1);
-          b.ReadBlob(r.blob, r.blobLength);
+      const size_t numScalars = a.scalars.size();
+      r.ops.resize(numScalars);
+      for(size_t i = 0; i < numScalars; i++)
+        r.ops[i] = decodeAbbrevParam(a.scalars[i]);
 
-          break;
-        }
-        else
+      if(a.tail == AbbrevEncoding::Array)
+      {
+        size_t arrayLen = b.vbr<size_t>(6);
+        // literal elements take no bits, so this can't be exact, but it bounds the allocation by the input size.
+        if(arrayLen > b.BitsRemaining())
         {
-          r.ops.push_back(decodeAbbrevParam(param));
+          ok = false;
+          break;
         }
+        r.ops.resize(numScalars + arrayLen);
+        decodeAbbrevArray(a.arrayElement, r.ops.data() + numScalars, arrayLen);
+      }
+      else if(a.tail == AbbrevEncoding::Blob)
+      {
+        b.ReadBlob(r.blob, r.blobLength);
       }
 
-      block.children.push_back(r);
+      ok = visitor.VisitRecord(r);
     }
-  } while(abbrevID != END_BLOCK);
+  }
 
   delete blockStack.back();
   blockStack.erase(blockStack.begin() + (blockStack.size() - 1));
+  return ok;
 }
 
 uint64_t BitcodeReader::decodeAbbrevParam(const AbbrevParam &param)
@@ -299,6 +537,46 @@ uint64_t BitcodeReader::decodeAbbrevParam(const AbbrevParam &param)
   return 0;
 }
 
+void BitcodeReader::decodeAbbrevArray(const AbbrevParam &elType, uint64_t *ops, size_t count)
+{
+  // arrays make up most of the operands in practice (strings, call arguments, metadata nodes), so
+  // resolve the element encoding once rather than for every element.
+  switch(elType.encoding)
+  {
+    case AbbrevEncoding::Fixed:
+    {
+      const size_t width = (size_t)elType.value;
+      for(size_t i = 0; i < count; i++)
+        ops[i] = b.fixed<uint64_t>(width);
+      break;
+    }
+
+    case AbbrevEncoding::VBR:
+    {
+      const size_t width = (size_t)elType.value;
+      for(size_t i = 0; i < count; i++)
+        ops[i] = b.vbr<uint64_t>(width);
+      break;
+    }
+
+    case AbbrevEncoding::Char6:
+      for(size_t i = 0; i < count; i++)
+        ops[i] = b.c6();
+      break;
+
+    case AbbrevEncoding::Literal:
+      for(size_t i = 0; i < count; i++)
+        ops[i] = elType.value;
+      break;
+
+    case AbbrevEncoding::Array:
+    case AbbrevEncoding::Blob:
+      for(size_t i = 0; i < count; i++)
+        ops[i] = 0;
+      break;
+  }
+}
+
 size_t BitcodeReader::abbrevSize() const
 {
   if(blockStack.empty())
@@ -306,9 +584,10 @@ size_t BitcodeReader::abbrevSize() const
   return blockStack.back()->abbrevSize;
 }
 
-const AbbrevDesc &BitcodeReader::getAbbrev(uint32_t blockId, uint32_t abbrevID)
+const AbbrevDesc *BitcodeReader::getAbbrev(uint32_t blockId, uint32_t abbrevID)
 {
-  const BlockInfo *info = blockInfo[blockId];
+  auto it = blockInfoOwner->blockInfo.find(blockId);
+  const BlockInfo *info = it != blockInfoOwner->blockInfo.end() ? it->second : NULL;
 
   // IDs start at the first application specified ID. Rebase to that to get 0-base indices
   assert(abbrevID >= APPLICATION_ABBREV);
@@ -318,16 +597,17 @@ const AbbrevDesc &BitcodeReader::getAbbrev(uint32_t blockId, uint32_t abbrevID)
   {
     // IDs are first assigned to those permanently from BLOCKINFO
     if(abbrevID < info->abbrevs.size())
-      return info->abbrevs[abbrevID];
+      return &info->abbrevs[abbrevID];
 
     // block-local IDs start after the BLOCKINFO ones
     abbrevID -= (uint32_t)info->abbrevs.size();
   }
 
-  assert(!blockStack.empty());
-  assert(abbrevID < blockStack.back()->abbrevs.size());
+  // The ID comes straight from the stream, so a malformed block can reference an abbreviation it never defined.
+  if(blockStack.empty() || abbrevID >= blockStack.back()->abbrevs.size())
+    return NULL;
 
-  return blockStack.back()->abbrevs[abbrevID];
+  return &blockStack.back()->abbrevs[abbrevID];
 }
 
 dxil_spv::String BlockOrRecord::getString(size_t startOffset) const
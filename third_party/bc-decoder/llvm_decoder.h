@@ -27,9 +27,12 @@
 #include "thread_local_allocator.hpp"
 #include "llvm_bitreader.h"
 #include <stdint.h>
+#include <vector>
 
 namespace LLVMBC
 {
+// Blocks and records are streamed to a BitcodeVisitor as they are decoded, the reader never builds
+// a tree. A block only carries its header, records are only valid for the duration of the callback.
 struct BlockOrRecord
 {
   uint32_t id;
@@ -37,8 +40,6 @@ struct BlockOrRecord
 
   bool IsBlock() const { return blockDwordLength > 0; }
   bool IsRecord() const { return blockDwordLength == 0; }
-  // if a block, the child blocks/records
-  dxil_spv::Vector<BlockOrRecord> children;
 
   dxil_spv::String getString(size_t startOffset = 0) const;
 
@@ -48,6 +49,51 @@ struct BlockOrRecord
   // this points into the overall byte storage, so the lifetime is limited.
   const byte *blob = NULL;
   size_t blobLength = 0;
+
+  // if a block was skipped by the reader, the bit offset of its header. See ReadDeferredBlock
+  size_t deferredBitOffset = 0;
+  bool IsDeferred() const { return deferredBitOffset != 0; }
+};
+
+// Any callback can return false to stop decoding, which makes the Read call fail.
+class BitcodeVisitor
+{
+public:
+  virtual ~BitcodeVisitor() = default;
+  virtual bool EnterBlock(const BlockOrRecord &block) = 0;
+  virtual bool LeaveBlock(const BlockOrRecord &block) = 0;
+  // The record, including its ops, is reused for the next record once this returns.
+  virtual bool VisitRecord(const BlockOrRecord &record) = 0;
+  // Called instead of EnterBlock/LeaveBlock for blocks skipped due to SetDeferredBlockId.
+  virtual bool VisitDeferredBlock(const BlockOrRecord &block) = 0;
+};
+
+// A block decoded up front into a flat list of events, so that decoding can happen on another thread
+// and the visitor be driven later. Uses the default allocator since it is handed between threads.
+struct DecodedBlock
+{
+  enum class EventType : uint8_t
+  {
+    EnterBlock,
+    LeaveBlock,
+    Record
+  };
+
+  struct Event
+  {
+    EventType type;
+    uint32_t id;
+    uint32_t blockDwordLength;
+    size_t firstOp;
+    size_t numOps;
+    const byte *blob;
+    size_t blobLength;
+  };
+
+  std::vector<Event> events;
+  std::vector<uint64_t> ops;
+
+  bool Replay(BitcodeVisitor &visitor) const;
 };
 
 struct AbbrevParam;
@@ -60,19 +106,38 @@ class BitcodeReader
 public:
   BitcodeReader(const byte *bitcode, size_t length);
   ~BitcodeReader();
-  BlockOrRecord ReadToplevelBlock();
+  bool ReadToplevelBlock(BitcodeVisitor &visitor);
   bool AtEndOfStream();
 
+  // blocks with this ID directly inside the top-level block are skipped rather than decoded.
+  // Their contents can be read later with ReadDeferredBlock, as long as the bitcode is still alive.
+  void SetDeferredBlockId(uint32_t blockId);
+  bool ReadDeferredBlock(const BlockOrRecord &block, BitcodeVisitor &visitor);
+
+  // Like ReadDeferredBlock, but leaves this reader untouched, so multiple threads can decode deferred
+  // blocks concurrently as long as nothing else is reading from this reader at the same time.
+  bool DecodeDeferredBlock(const BlockOrRecord &block, DecodedBlock &decoded) const;
+
 private:
+  // Shares the BLOCKINFO abbreviations of parent, which must outlive this reader.
+  explicit BitcodeReader(const BitcodeReader &parent);
+
   BitReader b;
+  const BitcodeReader *blockInfoOwner;
+
+  // reused for every record so decoding does not allocate per record.
+  BlockOrRecord record;
 
-  void ReadBlockContents(BlockOrRecord &block);
-  const AbbrevDesc &getAbbrev(uint32_t blockId, uint32_t abbrevID);
+  bool ReadBlockContents(BlockOrRecord &block, BitcodeVisitor &visitor);
+  void SkipBlockContents(BlockOrRecord &block, size_t blockStart);
+  const AbbrevDesc *getAbbrev(uint32_t blockId, uint32_t abbrevID);
   size_t abbrevSize() const;
   uint64_t decodeAbbrevParam(const AbbrevParam &param);
+  void decodeAbbrevArray(const AbbrevParam &elType, uint64_t *ops, size_t count);
 
   dxil_spv::Vector<BlockContext *> blockStack;
   dxil_spv::UnorderedMap<uint32_t, BlockInfo *> blockInfo;
+  uint32_t deferredBlockId = ~0U;
 };
 
 };    // namespace LLVMBC
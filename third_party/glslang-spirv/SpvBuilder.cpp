@@ -40,10 +40,12 @@
 
 #include <cassert>
 #include <cstdlib>
+#include <cstring>
 
 #include <algorithm>
 
 #include "SpvBuilder.h"
+#include "hash.hpp"
 
 #ifndef _WIN32
     #include <cstdio>
@@ -178,8 +180,14 @@ Id Builder::makeRayQueryType()
 Id Builder::makePointer(StorageClass storageClass, Id pointee)
 {
     // try to find it
+    const unsigned operands[] = { (unsigned)storageClass, pointee };
+    bool collision = false;
+    Id existing = findUnique(OpTypePointer, NoType, operands, 2, collision);
+    if (existing)
+        return existing;
+
     Instruction* type;
-    for (int t = 0; t < (int)groupedTypes[OpTypePointer].size(); ++t) {
+    for (int t = 0; collision && t < (int)groupedTypes[OpTypePointer].size(); ++t) {
         type = groupedTypes[OpTypePointer][t];
         if (type->getImmediateOperand(0) == (unsigned)storageClass &&
             type->getIdOperand(1) == pointee)
@@ -191,6 +199,7 @@ Id Builder::makePointer(StorageClass storageClass, Id pointee)
     type->addImmediateOperand(storageClass);
     type->addIdOperand(pointee);
     groupedTypes[OpTypePointer].push_back(type);
+    addUnique(type);
     constantsTypesGlobals.push_back(std::unique_ptr<Instruction>(type));
     module.mapInstruction(type);
 
@@ -311,8 +320,14 @@ Id Builder::makeStructResultType(Id type0, Id type1)
 Id Builder::makeVectorType(Id component, int size)
 {
     // try to find it
+    const unsigned operands[] = { component, (unsigned)size };
+    bool collision = false;
+    Id existing = findUnique(OpTypeVector, NoType, operands, 2, collision);
+    if (existing)
+        return existing;
+
     Instruction* type;
-    for (int t = 0; t < (int)groupedTypes[OpTypeVector].size(); ++t) {
+    for (int t = 0; collision && t < (int)groupedTypes[OpTypeVector].size(); ++t) {
         type = groupedTypes[OpTypeVector][t];
         if (type->getIdOperand(0) == component &&
             type->getImmediateOperand(1) == (unsigned)size)
@@ -324,6 +339,7 @@ Id Builder::makeVectorType(Id component, int size)
     type->addIdOperand(component);
     type->addImmediateOperand(size);
     groupedTypes[OpTypeVector].push_back(type);
+    addUnique(type);
     constantsTypesGlobals.push_back(std::unique_ptr<Instruction>(type));
     module.mapInstruction(type);
 
@@ -648,6 +664,11 @@ Id Builder::getContainedTypeId(Id typeId) const
 // can be reused rather than duplicated.  (Required by the specification).
 Id Builder::findScalarConstant(Op typeClass, Op opcode, Id typeId, unsigned value) const
 {
+    bool collision = false;
+    Id existing = findUnique(opcode, typeId, &value, 1, collision);
+    if (existing || !collision)
+        return existing;
+
     Instruction* constant;
     for (int i = 0; i < (int)groupedConstants[typeClass].size(); ++i) {
         constant = groupedConstants[typeClass][i];
@@ -663,6 +684,12 @@ Id Builder::findScalarConstant(Op typeClass, Op opcode, Id typeId, unsigned valu
 // Version of findScalarConstant (see above) for scalars that take two operands (e.g. a 'double' or 'int64').
 Id Builder::findScalarConstant(Op typeClass, Op opcode, Id typeId, unsigned v1, unsigned v2) const
 {
+    const unsigned values[] = { v1, v2 };
+    bool collision = false;
+    Id existing = findUnique(opcode, typeId, values, 2, collision);
+    if (existing || !collision)
+        return existing;
+
     Instruction* constant;
     for (int i = 0; i < (int)groupedConstants[typeClass].size(); ++i) {
         constant = groupedConstants[typeClass][i];
@@ -676,6 +703,45 @@ Id Builder::findScalarConstant(Op typeClass, Op opcode, Id typeId, unsigned v1,
     return 0;
 }
 
+// Look up a type or constant in the hash index.
+// If something else with the same hash was indexed first, collision is set and the caller has to search the groups.
+Id Builder::findUnique(Op opcode, Id typeId, const unsigned* operands, int count, bool& collision) const
+{
+    dxil_spv::Hasher h;
+    h.u32(opcode);
+    h.u32(typeId);
+    h.u32(count);
+    for (int op = 0; op < count; ++op)
+        h.u32(operands[op]);
+
+    auto itr = uniqueInstructions.find(h.get());
+    if (itr == uniqueInstructions.end())
+        return NoResult;
+
+    Instruction* inst = itr->second;
+    bool match = inst->getOpCode() == opcode && inst->getTypeId() == typeId && inst->getNumOperands() == count;
+    for (int op = 0; match && op < count; ++op)
+        match = inst->getImmediateOperand(op) == operands[op];
+
+    if (match)
+        return inst->getResultId();
+
+    collision = true;
+    return NoResult;
+}
+
+void Builder::addUnique(Instruction* inst)
+{
+    dxil_spv::Hasher h;
+    h.u32(inst->getOpCode());
+    h.u32(inst->getTypeId());
+    h.u32(inst->getNumOperands());
+    for (int op = 0; op < inst->getNumOperands(); ++op)
+        h.u32(inst->getImmediateOperand(op));
+
+    uniqueInstructions.insert({ h.get(), inst });
+}
+
 // Return true if consuming 'opcode' means consuming a constant.
 // "constant" here means after final transform to executable code,
 // the value consumed will be a constant, so includes specialization.
@@ -769,6 +835,8 @@ Id Builder::makeIntConstant(Id typeId, unsigned value, bool specConstant)
     c->addImmediateOperand(value);
     constantsTypesGlobals.push_back(std::unique_ptr<Instruction>(c));
     groupedConstants[OpTypeInt].push_back(c);
+    if (! specConstant)
+        addUnique(c);
     module.mapInstruction(c);
 
     return c->getResultId();
@@ -794,6 +862,8 @@ Id Builder::makeInt64Constant(Id typeId, unsigned long long value, bool specCons
     c->addImmediateOperand(op2);
     constantsTypesGlobals.push_back(std::unique_ptr<Instruction>(c));
     groupedConstants[OpTypeInt].push_back(c);
+    if (! specConstant)
+        addUnique(c);
     module.mapInstruction(c);
 
     return c->getResultId();
@@ -819,6 +889,8 @@ Id Builder::makeFloatConstant(float f, bool specConstant)
     c->addImmediateOperand(value);
     constantsTypesGlobals.push_back(std::unique_ptr<Instruction>(c));
     groupedConstants[OpTypeFloat].push_back(c);
+    if (! specConstant)
+        addUnique(c);
     module.mapInstruction(c);
 
     return c->getResultId();
@@ -847,6 +919,8 @@ Id Builder::makeDoubleConstant(double d, bool specConstant)
     c->addImmediateOperand(op2);
     constantsTypesGlobals.push_back(std::unique_ptr<Instruction>(c));
     groupedConstants[OpTypeFloat].push_back(c);
+    if (! specConstant)
+        addUnique(c);
     module.mapInstruction(c);
 
     return c->getResultId();
@@ -872,21 +946,29 @@ Id Builder::makeFloat16Constant(uint16_t f16, bool specConstant)
     c->addImmediateOperand(value);
     constantsTypesGlobals.push_back(std::unique_ptr<Instruction>(c));
     groupedConstants[OpTypeFloat].push_back(c);
+    if (! specConstant)
+        addUnique(c);
     module.mapInstruction(c);
 
     return c->getResultId();
 }
 #endif
 
-Id Builder::findCompositeConstant(Op typeClass, const dxil_spv::Vector<Id>& comps) const
+Id Builder::findCompositeConstant(Op typeClass, Id typeId, const dxil_spv::Vector<Id>& comps) const
 {
+    bool collision = false;
+    Id existing = findUnique(OpConstantComposite, typeId, comps.data(), (int)comps.size(), collision);
+    if (existing || !collision)
+        return existing;
+
     Instruction* constant = 0;
     bool found = false;
     for (int i = 0; i < (int)groupedConstants[typeClass].size(); ++i) {
         constant = groupedConstants[typeClass][i];
 
         // same shape?
-        if (constant->getNumOperands() != (int)comps.size())
+        if (constant->getOpCode() != OpConstantComposite || constant->getTypeId() != typeId ||
+            constant->getNumOperands() != (int)comps.size())
             continue;
 
         // same contents?
@@ -925,7 +1007,7 @@ Id Builder::makeCompositeConstant(Id typeId, const dxil_spv::Vector<Id>& members
     }
 
     if (! specConstant) {
-        Id existing = findCompositeConstant(typeClass, members);
+        Id existing = findCompositeConstant(typeClass, typeId, members);
         if (existing)
             return existing;
     }
@@ -935,6 +1017,8 @@ Id Builder::makeCompositeConstant(Id typeId, const dxil_spv::Vector<Id>& members
         c->addIdOperand(members[op]);
     constantsTypesGlobals.push_back(std::unique_ptr<Instruction>(c));
     groupedConstants[typeClass].push_back(c);
+    if (! specConstant)
+        addUnique(c);
     module.mapInstruction(c);
 
     return c->getResultId();
@@ -2443,6 +2527,55 @@ void Builder::eliminateDeadDecorations() {
         decorations.end());
 }
 
+// Matches Instruction::addStringOperand, which always writes a nul terminator.
+static size_t getStringWordCount(const char* str)
+{
+    return strlen(str) / 4 + 1;
+}
+
+static size_t getInstructionsWordCount(const dxil_spv::Vector<std::unique_ptr<Instruction> >& instructions)
+{
+    size_t wordCount = 0;
+    for (int i = 0; i < (int)instructions.size(); ++i)
+        wordCount += instructions[i]->getWordCount();
+    return wordCount;
+}
+
+size_t Builder::getDumpWordCount() const
+{
+    // Header
+    size_t wordCount = 5;
+
+    // OpCapability
+    wordCount += 2 * capabilities.size();
+    for (auto it = extensions.cbegin(); it != extensions.cend(); ++it)
+        wordCount += 1 + getStringWordCount(it->c_str());
+
+    wordCount += getInstructionsWordCount(imports);
+    // OpMemoryModel
+    wordCount += 3;
+
+    wordCount += getInstructionsWordCount(entryPoints);
+    wordCount += getInstructionsWordCount(executionModes);
+
+    wordCount += getInstructionsWordCount(strings);
+    for (int i = 0; i < (int)moduleProcesses.size(); ++i)
+        wordCount += 1 + getStringWordCount(moduleProcesses[i]);
+    wordCount += getSourceInstructionsWordCount();
+    for (int e = 0; e < (int)sourceExtensions.size(); ++e)
+        wordCount += 1 + getStringWordCount(sourceExtensions[e]);
+    wordCount += getInstructionsWordCount(names);
+    wordCount += getInstructionsWordCount(lines);
+
+    wordCount += getInstructionsWordCount(decorations);
+
+    wordCount += getInstructionsWordCount(constantsTypesGlobals);
+    wordCount += getInstructionsWordCount(externals);
+
+    wordCount += module.getWordCount();
+    return wordCount;
+}
+
 void Builder::dump(dxil_spv::Vector<unsigned int>& out) const
 {
     // Header, before first instructions:
@@ -2691,6 +2824,33 @@ void Builder::dumpInstructions(dxil_spv::Vector<unsigned int>& out, const dxil_s
     }
 }
 
+// Mirrors the splitting done by dumpSourceInstructions.
+size_t Builder::getSourceInstructionsWordCount() const
+{
+    const int maxWordCount = 0xFFFF;
+    const int opSourceWordCount = 4;
+    const int nonNullBytesPerInstruction = 4 * (maxWordCount - opSourceWordCount) - 1;
+
+    if (source == SourceLanguageUnknown)
+        return 0;
+
+    // OpSource Language Version
+    size_t wordCount = 3;
+    if (sourceFileStringId != NoResult) {
+        ++wordCount;
+        int nextByte = 0;
+        while ((int)sourceText.size() - nextByte > 0) {
+            size_t length = std::min<size_t>(sourceText.size() - nextByte, nonNullBytesPerInstruction);
+            // OpSourceContinued needs its own opcode word.
+            if (nextByte != 0)
+                ++wordCount;
+            wordCount += length / 4 + 1;
+            nextByte += nonNullBytesPerInstruction;
+        }
+    }
+    return wordCount;
+}
+
 void Builder::dumpModuleProcesses(dxil_spv::Vector<unsigned int>& out) const
 {
     for (int i = 0; i < (int)moduleProcesses.size(); ++i) {
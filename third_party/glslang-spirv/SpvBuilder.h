@@ -261,6 +261,16 @@ public:
     void addDecoration(Id, Decoration, int num = -1);
     void addMemberDecoration(Id, unsigned int member, Decoration, int num = -1);
 
+    // Calls func with the target of every name and decoration added so far.
+    template <typename Func>
+    void forEachAnnotatedId(const Func& func) const
+    {
+        for (auto& name : names)
+            func(name->getIdOperand(0));
+        for (auto& dec : decorations)
+            func(dec->getIdOperand(0));
+    }
+
     // At the end of what block do the next create*() instructions go?
     void setBuildPoint(Block* bp) { buildPoint = bp; }
     Block* getBuildPoint() const { return buildPoint; }
@@ -275,6 +285,9 @@ public:
     Function* makeFunctionEntry(Decoration precision, Id returnType, const char* name, const dxil_spv::Vector<Id>& paramTypes,
                                 const dxil_spv::Vector<dxil_spv::Vector<Decoration>>& precisions, Block **entry = 0);
 
+    // Add a function which is already encoded as words. Its IDs must have been allocated from this builder.
+    void addEncodedFunction(const unsigned int* words, size_t count) { module.addEncodedFunction(words, count); }
+
     // Create a return. An 'implicit' return is one not appearing in the source
     // code.  In the case of an implicit return, no post-return block is inserted.
     void makeReturn(bool implicit, Id retVal = 0);
@@ -587,6 +600,8 @@ public:
     // blocks.
     void eliminateDeadDecorations();
     void dump(dxil_spv::Vector<unsigned int>&) const;
+    // Exact number of words dump() will write, so the output can be allocated once.
+    size_t getDumpWordCount() const;
 
     void createBranch(Block* block);
     void createConditionalBranch(Id condition, Block* thenBlock, Block* elseBlock);
@@ -607,7 +622,9 @@ protected:
     Id makeInt64Constant(Id typeId, unsigned long long value, bool specConstant);
     Id findScalarConstant(Op typeClass, Op opcode, Id typeId, unsigned value) const;
     Id findScalarConstant(Op typeClass, Op opcode, Id typeId, unsigned v1, unsigned v2) const;
-    Id findCompositeConstant(Op typeClass, const dxil_spv::Vector<Id>& comps) const;
+    Id findCompositeConstant(Op typeClass, Id typeId, const dxil_spv::Vector<Id>& comps) const;
+    Id findUnique(Op opcode, Id typeId, const unsigned* operands, int count, bool& collision) const;
+    void addUnique(Instruction*);
     Id collapseAccessChain();
     void transferAccessChainSwizzle(bool dynamic);
     void simplifyAccessChainSwizzle();
@@ -615,6 +632,7 @@ protected:
     void dumpSourceInstructions(dxil_spv::Vector<unsigned int>&) const;
     void dumpInstructions(dxil_spv::Vector<unsigned int>&, const dxil_spv::Vector<std::unique_ptr<Instruction> >&) const;
     void dumpModuleProcesses(dxil_spv::Vector<unsigned int>&) const;
+    size_t getSourceInstructionsWordCount() const;
 
     SourceLanguage source;
     int sourceVersion;
@@ -651,6 +669,9 @@ protected:
     // not output, internally used for quick & dirty canonical (unique) creation
     dxil_spv::Vector<Instruction*> groupedConstants[OpConstant];  // all types appear before OpConstant
     dxil_spv::Vector<Instruction*> groupedTypes[OpConstant];
+    // Hashed index over the constants and simple types above, keyed on opcode, type and operands.
+    // Only the first instruction with a given hash is kept, so a collision falls back to scanning the groups.
+    dxil_spv::UnorderedMap<uint64_t, Instruction*> uniqueInstructions;
     Instruction *acceleration_structure_type = nullptr;
     Instruction *ray_query_type = nullptr;
 
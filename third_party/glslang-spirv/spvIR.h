@@ -129,16 +129,21 @@ public:
     Id getIdOperand(int op) const { return operands[op]; }
     unsigned int getImmediateOperand(int op) const { return operands[op]; }
 
-    // Write out the binary form.
-    void dump(dxil_spv::Vector<unsigned int>& out) const
+    unsigned int getWordCount() const
     {
-        // Compute the wordCount
         unsigned int wordCount = 1;
         if (typeId)
             ++wordCount;
         if (resultId)
             ++wordCount;
         wordCount += (unsigned int)operands.size();
+        return wordCount;
+    }
+
+    // Write out the binary form.
+    void dump(dxil_spv::Vector<unsigned int>& out) const
+    {
+        unsigned int wordCount = getWordCount();
 
         // Write out the beginning of the instruction
         out.push_back(((wordCount) << WordCountShift) | opCode);
@@ -201,9 +206,41 @@ public:
         return nullptr;
     }
 
+    // Appends an instruction as raw words, without allocating an Instruction object.
+    // Encoded words are interleaved with regular instructions in the order they were added.
+    // The result ID is not mapped in the module, so it must not be looked up through the builder.
+    void addEncodedInstruction(Op opCode, Id typeId, Id resultId, const unsigned int* operands, unsigned int numOperands)
+    {
+        size_t offset = beginEncodedInstruction(opCode, typeId, resultId);
+        encodedWords.insert(encodedWords.end(), operands, operands + numOperands);
+        endEncodedInstruction(offset);
+    }
+
+    // For instructions with a variable number of operands.
+    // Operands are added with addEncodedOperand, and endEncodedInstruction patches the word count.
+    size_t beginEncodedInstruction(Op opCode, Id typeId, Id resultId)
+    {
+        size_t offset = encodedWords.size();
+        encodedWords.push_back(opCode);
+        if (typeId)
+            encodedWords.push_back(typeId);
+        if (resultId)
+            encodedWords.push_back(resultId);
+        lastEncodedOp = opCode;
+        return offset;
+    }
+    void addEncodedOperand(unsigned int word) { encodedWords.push_back(word); }
+    void endEncodedInstruction(size_t offset)
+    {
+        encodedWords[offset] |= (unsigned int)(encodedWords.size() - offset) << WordCountShift;
+    }
+    void reserveEncodedWords(size_t count) { encodedWords.reserve(encodedWords.size() + count); }
+
     bool isTerminated() const
     {
-        switch (instructions.back()->getOpCode()) {
+        // If encoded instructions were added last, they decide whether the block is terminated.
+        Op lastOp = encodedWords.size() > encodedOffsets.back() ? lastEncodedOp : instructions.back()->getOpCode();
+        switch (lastOp) {
         case OpBranch:
         case OpBranchConditional:
         case OpSwitch:
@@ -217,13 +254,29 @@ public:
         }
     }
 
+    // Number of words dump() will write.
+    size_t getWordCount() const
+    {
+        size_t wordCount = encodedWords.size();
+        for (auto& inst : instructions)
+            wordCount += inst->getWordCount();
+        for (auto& inst : localVariables)
+            wordCount += inst->getWordCount();
+        return wordCount;
+    }
+
     void dump(dxil_spv::Vector<unsigned int>& out) const
     {
         instructions[0]->dump(out);
         for (int i = 0; i < (int)localVariables.size(); ++i)
             localVariables[i]->dump(out);
-        for (int i = 1; i < (int)instructions.size(); ++i)
+        size_t encodedOffset = 0;
+        for (int i = 1; i < (int)instructions.size(); ++i) {
+            dumpEncodedWords(out, encodedOffset, encodedOffsets[i]);
+            encodedOffset = encodedOffsets[i];
             instructions[i]->dump(out);
+        }
+        dumpEncodedWords(out, encodedOffset, encodedWords.size());
     }
 
     DXIL_SPV_OVERRIDE_NEW_DELETE
@@ -235,7 +288,17 @@ protected:
     // To enforce keeping parent and ownership in sync:
     friend Function;
 
+    void dumpEncodedWords(dxil_spv::Vector<unsigned int>& out, size_t begin, size_t end) const
+    {
+        if (end > begin)
+            out.insert(out.end(), encodedWords.begin() + begin, encodedWords.begin() + end);
+    }
+
     dxil_spv::Vector<std::unique_ptr<Instruction> > instructions;
+    // encodedOffsets[i] is the number of encoded words which precede instructions[i].
+    dxil_spv::Vector<size_t> encodedOffsets;
+    dxil_spv::Vector<unsigned int> encodedWords;
+    Op lastEncodedOp;
     dxil_spv::Vector<Block*> predecessors, successors;
     dxil_spv::Vector<std::unique_ptr<Instruction> > localVariables;
     Function& parent;
@@ -290,6 +353,17 @@ public:
     void setImplicitThis() { implicitThis = true; }
     bool hasImplicitThis() const { return implicitThis; }
 
+    // Number of words dump() will write. Like dump(), only counts reachable blocks.
+    size_t getWordCount() const
+    {
+        // OpFunction and OpFunctionEnd
+        size_t wordCount = functionInstruction.getWordCount() + 1;
+        for (int p = 0; p < (int)parameterInstructions.size(); ++p)
+            wordCount += parameterInstructions[p]->getWordCount();
+        inReadableOrder(blocks[0], [&wordCount](const Block* b) { wordCount += b->getWordCount(); });
+        return wordCount;
+    }
+
     void dump(dxil_spv::Vector<unsigned int>& out) const
     {
         // OpFunction
@@ -332,6 +406,15 @@ public:
 
     void addFunction(Function *fun) { functions.push_back(fun); }
 
+    // Adds a function which is already encoded as words, OpFunction through OpFunctionEnd.
+    // It is written out in the same position as a regular function added at this point.
+    // Like encoded block instructions, its result IDs are not mapped in the module.
+    void addEncodedFunction(const unsigned int* words, size_t count)
+    {
+        encodedFunctions.push_back({ functions.size(), encodedFunctionWords.size(), count });
+        encodedFunctionWords.insert(encodedFunctionWords.end(), words, words + count);
+    }
+
     void mapInstruction(Instruction *instruction)
     {
         spv::Id resultId = instruction->getResultId();
@@ -350,10 +433,26 @@ public:
         return (StorageClass)idToInstruction[typeId]->getImmediateOperand(0);
     }
 
-    void dump(dxil_spv::Vector<unsigned int>& out) const
+    size_t getWordCount() const
     {
+        size_t wordCount = 0;
         for (int f = 0; f < (int)functions.size(); ++f)
-            functions[f]->dump(out);
+            wordCount += functions[f]->getWordCount();
+        wordCount += encodedFunctionWords.size();
+        return wordCount;
+    }
+
+    void dump(dxil_spv::Vector<unsigned int>& out) const
+    {
+        size_t e = 0;
+        for (int f = 0; f <= (int)functions.size(); ++f) {
+            for (; e < encodedFunctions.size() && encodedFunctions[e].functionIndex == (size_t)f; ++e) {
+                auto begin = encodedFunctionWords.begin() + encodedFunctions[e].offset;
+                out.insert(out.end(), begin, begin + encodedFunctions[e].count);
+            }
+            if (f < (int)functions.size())
+                functions[f]->dump(out);
+        }
     }
 
     DXIL_SPV_OVERRIDE_NEW_DELETE
@@ -361,6 +460,15 @@ public:
 protected:
     Module(const Module&);
     dxil_spv::Vector<Function*> functions;
+    struct EncodedFunction
+    {
+        // Number of regular functions which precede it.
+        size_t functionIndex;
+        size_t offset;
+        size_t count;
+    };
+    dxil_spv::Vector<EncodedFunction> encodedFunctions;
+    dxil_spv::Vector<unsigned int> encodedFunctionWords;
 
     // map from result id to instruction having that result id
     dxil_spv::Vector<Instruction*> idToInstruction;
@@ -407,8 +515,9 @@ __inline void Function::addLocalVariable(std::unique_ptr<Instruction> inst)
     parent.mapInstruction(raw_instruction);
 }
 
-__inline Block::Block(Id id, Function& parent) : parent(parent), unreachable(false)
+__inline Block::Block(Id id, Function& parent) : lastEncodedOp(OpNop), parent(parent), unreachable(false)
 {
+    encodedOffsets.push_back(0);
     instructions.push_back(std::unique_ptr<Instruction>(new Instruction(id, NoType, OpLabel)));
     instructions.back()->setBlock(this);
     parent.getParent().mapInstruction(instructions.back().get());
@@ -417,6 +526,7 @@ __inline Block::Block(Id id, Function& parent) : parent(parent), unreachable(fal
 __inline void Block::addInstruction(std::unique_ptr<Instruction> inst)
 {
     Instruction* raw_instruction = inst.get();
+    encodedOffsets.push_back(encodedWords.size());
     instructions.push_back(std::move(inst));
     raw_instruction->setBlock(this);
     if (raw_instruction->getResultId())
@@ -0,0 +1,265 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include "thread_local_allocator.hpp"
+#include <functional>
+#include <utility>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace dxil_spv
+{
+// Open-addressing hash map with linear probing, intended for small keys and values such as
+// pointers and IDs which are looked up in hot paths.
+// Unlike UnorderedMap, any insertion invalidates iterators and references to values.
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+class FlatHashMap
+{
+public:
+	struct Entry
+	{
+		Key first;
+		Value second;
+	};
+
+	template <typename MapType, typename EntryType>
+	class Iterator
+	{
+	public:
+		Iterator(MapType *map_, size_t index_)
+			: map(map_), index(index_)
+		{
+			skip_empty();
+		}
+
+		EntryType &operator*() const
+		{
+			return map->entries[index];
+		}
+
+		EntryType *operator->() const
+		{
+			return &map->entries[index];
+		}
+
+		Iterator &operator++()
+		{
+			index++;
+			skip_empty();
+			return *this;
+		}
+
+		bool operator==(const Iterator &other) const
+		{
+			return index == other.index;
+		}
+
+		bool operator!=(const Iterator &other) const
+		{
+			return index != other.index;
+		}
+
+	private:
+		friend class FlatHashMap;
+		MapType *map;
+		size_t index;
+
+		void skip_empty()
+		{
+			while (index < map->states.size() && map->states[index] != State::Occupied)
+				index++;
+		}
+	};
+
+	using iterator = Iterator<FlatHashMap, Entry>;
+	using const_iterator = Iterator<const FlatHashMap, const Entry>;
+
+	iterator begin()
+	{
+		return iterator(this, 0);
+	}
+
+	iterator end()
+	{
+		return iterator(this, states.size());
+	}
+
+	const_iterator begin() const
+	{
+		return const_iterator(this, 0);
+	}
+
+	const_iterator end() const
+	{
+		return const_iterator(this, states.size());
+	}
+
+	iterator find(const Key &key)
+	{
+		return iterator(this, find_index(key));
+	}
+
+	const_iterator find(const Key &key) const
+	{
+		return const_iterator(this, find_index(key));
+	}
+
+	size_t count(const Key &key) const
+	{
+		return find_index(key) != states.size() ? 1 : 0;
+	}
+
+	Value &operator[](const Key &key)
+	{
+		size_t index = find_index(key);
+		if (index != states.size())
+			return entries[index].second;
+
+		if ((num_occupied + num_deleted + 1) * 4 > states.size() * 3)
+			rehash(num_occupied + 1);
+
+		index = find_insert_index(key);
+		if (states[index] == State::Deleted)
+			num_deleted--;
+		states[index] = State::Occupied;
+		entries[index].first = key;
+		entries[index].second = Value();
+		num_occupied++;
+		return entries[index].second;
+	}
+
+	void erase(iterator itr)
+	{
+		states[itr.index] = State::Deleted;
+		entries[itr.index].second = Value();
+		num_occupied--;
+		num_deleted++;
+	}
+
+	size_t erase(const Key &key)
+	{
+		size_t index = find_index(key);
+		if (index == states.size())
+			return 0;
+		erase(iterator(this, index));
+		return 1;
+	}
+
+	void clear()
+	{
+		entries.clear();
+		states.clear();
+		num_occupied = 0;
+		num_deleted = 0;
+	}
+
+	size_t size() const
+	{
+		return num_occupied;
+	}
+
+	bool empty() const
+	{
+		return num_occupied == 0;
+	}
+
+private:
+	enum class State : uint8_t
+	{
+		Empty,
+		Occupied,
+		Deleted
+	};
+
+	Vector<Entry> entries;
+	Vector<State> states;
+	size_t num_occupied = 0;
+	size_t num_deleted = 0;
+
+	size_t hash_index(const Key &key) const
+	{
+		// std::hash is the identity for pointers and integers on common implementations,
+		// so mix the bits before masking.
+		uint64_t h = uint64_t(Hash()(key));
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdull;
+		h ^= h >> 33;
+		return size_t(h) & (states.size() - 1);
+	}
+
+	size_t find_index(const Key &key) const
+	{
+		if (states.empty())
+			return 0;
+
+		size_t mask = states.size() - 1;
+		for (size_t index = hash_index(key);; index = (index + 1) & mask)
+		{
+			if (states[index] == State::Empty)
+				return states.size();
+			if (states[index] == State::Occupied && entries[index].first == key)
+				return index;
+		}
+	}
+
+	size_t find_insert_index(const Key &key) const
+	{
+		size_t mask = states.size() - 1;
+		for (size_t index = hash_index(key);; index = (index + 1) & mask)
+			if (states[index] != State::Occupied)
+				return index;
+	}
+
+	void rehash(size_t min_count)
+	{
+		size_t new_size = 16;
+		while (new_size * 3 < min_count * 4 * 2)
+			new_size *= 2;
+
+		Vector<Entry> old_entries;
+		Vector<State> old_states;
+		std::swap(old_entries, entries);
+		std::swap(old_states, states);
+
+		entries.resize(new_size);
+		states.resize(new_size);
+		num_occupied = 0;
+		num_deleted = 0;
+
+		for (size_t i = 0; i < old_states.size(); i++)
+		{
+			if (old_states[i] == State::Occupied)
+			{
+				size_t index = find_insert_index(old_entries[i].first);
+				states[index] = State::Occupied;
+				entries[index] = std::move(old_entries[i]);
+				num_occupied++;
+			}
+		}
+	}
+};
+} // namespace dxil_spv
@@ -0,0 +1,248 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "hash.hpp"
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DXIL_SPV_HASH_SSE2
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define DXIL_SPV_HASH_NEON
+#endif
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+namespace dxil_spv
+{
+static constexpr uint64_t Prime32_1 = 0x9e3779b1ull;
+static constexpr uint64_t Prime64_1 = 0x9e3779b185ebca87ull;
+static constexpr uint64_t Prime64_2 = 0xc2b2ae3d27d4eb4full;
+static constexpr uint64_t Prime64_3 = 0x165667b19e3779f9ull;
+
+// Stripes are 64 bytes, and the accumulators are scrambled once per block of stripes.
+static constexpr size_t StripeSize = 64;
+static constexpr size_t StripesPerBlock = 16;
+
+alignas(16) static const uint64_t Secret[8] = {
+	0xbe4ba423396cfeb8ull, 0x1cad21f72c81017cull, 0xdb979083e96dd4deull, 0x1f67b3b7a4a44072ull,
+	0x78e5c0cc4ee679cbull, 0x2172ffcc7dd05a82ull, 0x8e2443f7744608b8ull, 0x4c263a81e69035e0ull,
+};
+
+static inline uint64_t read64(const uint8_t *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint32_t read32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+// Full 64x64 -> 128-bit product, with the halves folded together.
+static inline uint64_t mul128_fold64(uint64_t a, uint64_t b)
+{
+#if defined(__SIZEOF_INT128__)
+	unsigned __int128 product = (unsigned __int128)a * b;
+	return uint64_t(product) ^ uint64_t(product >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+	uint64_t hi;
+	uint64_t lo = _umul128(a, b, &hi);
+	return lo ^ hi;
+#else
+	uint64_t lo_lo = (a & 0xffffffffu) * (b & 0xffffffffu);
+	uint64_t hi_lo = (a >> 32) * (b & 0xffffffffu);
+	uint64_t lo_hi = (a & 0xffffffffu) * (b >> 32);
+	uint64_t hi_hi = (a >> 32) * (b >> 32);
+	uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xffffffffu) + lo_hi;
+	uint64_t hi = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+	uint64_t lo = (cross << 32) | (lo_lo & 0xffffffffu);
+	return lo ^ hi;
+#endif
+}
+
+static inline uint64_t avalanche(uint64_t h)
+{
+	h ^= h >> 37;
+	h *= Prime64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+static inline uint64_t mix16(const uint8_t *p, uint32_t secret_index, uint64_t seed)
+{
+	uint64_t lo = read64(p) ^ (Secret[secret_index & 7] + seed);
+	uint64_t hi = read64(p + 8) ^ (Secret[(secret_index + 1) & 7] - seed);
+	return mul128_fold64(lo, hi);
+}
+
+static uint64_t hash_short(const uint8_t *p, size_t size, uint64_t seed)
+{
+	uint64_t h;
+	if (size > 8)
+	{
+		uint64_t lo = read64(p) ^ (Secret[0] + seed);
+		uint64_t hi = read64(p + size - 8) ^ (Secret[1] - seed);
+		h = size + lo + hi + mul128_fold64(lo, hi);
+	}
+	else if (size >= 4)
+	{
+		uint64_t v = read32(p) | (uint64_t(read32(p + size - 4)) << 32);
+		h = mul128_fold64(v ^ (Secret[2] + seed), Prime64_1 + size);
+	}
+	else if (size)
+	{
+		uint64_t v = uint64_t(p[0]) << 16 | uint64_t(p[size >> 1]) << 24 | p[size - 1] | uint64_t(size) << 8;
+		h = (v ^ (Secret[3] + seed)) * Prime64_1;
+	}
+	else
+		h = seed ^ Secret[4];
+
+	return avalanche(h);
+}
+
+static uint64_t hash_medium(const uint8_t *p, size_t size, uint64_t seed)
+{
+	// 17 to 128 bytes. The last chunk overlaps the previous one unless size is a multiple of 16.
+	uint64_t h = size * Prime64_1;
+	uint32_t chunks = uint32_t((size - 1) / 16);
+	for (uint32_t i = 0; i < chunks; i++)
+		h += mix16(p + 16 * i, 2 * i, seed);
+	h += mix16(p + size - 16, 2 * chunks + 1, seed);
+	return avalanche(h);
+}
+
+// For every 64-bit lane: acc[i ^ 1] += data[i], acc[i] += lo32(data[i] ^ secret[i]) * hi32(data[i] ^ secret[i]).
+// The SIMD paths compute exactly the same as the scalar one.
+static void accumulate(uint64_t *acc, const uint8_t *p, size_t stripes)
+{
+#if defined(DXIL_SPV_HASH_SSE2)
+	__m128i a[4];
+	for (int i = 0; i < 4; i++)
+		a[i] = _mm_load_si128(reinterpret_cast<const __m128i *>(acc) + i);
+
+	for (size_t s = 0; s < stripes; s++, p += StripeSize)
+	{
+		for (int i = 0; i < 4; i++)
+		{
+			__m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p) + i);
+			__m128i key = _mm_xor_si128(data, _mm_load_si128(reinterpret_cast<const __m128i *>(Secret) + i));
+			__m128i key_hi = _mm_shuffle_epi32(key, _MM_SHUFFLE(3, 3, 1, 1));
+			__m128i product = _mm_mul_epu32(key, key_hi);
+			__m128i swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+			a[i] = _mm_add_epi64(a[i], _mm_add_epi64(product, swapped));
+		}
+	}
+
+	for (int i = 0; i < 4; i++)
+		_mm_store_si128(reinterpret_cast<__m128i *>(acc) + i, a[i]);
+#elif defined(DXIL_SPV_HASH_NEON)
+	uint64x2_t a[4];
+	for (int i = 0; i < 4; i++)
+		a[i] = vld1q_u64(acc + 2 * i);
+
+	for (size_t s = 0; s < stripes; s++, p += StripeSize)
+	{
+		for (int i = 0; i < 4; i++)
+		{
+			uint64x2_t data = vreinterpretq_u64_u8(vld1q_u8(p + 16 * i));
+			uint64x2_t key = veorq_u64(data, vld1q_u64(Secret + 2 * i));
+			uint64x2_t product = vmull_u32(vmovn_u64(key), vshrn_n_u64(key, 32));
+			uint64x2_t swapped = vextq_u64(data, data, 1);
+			a[i] = vaddq_u64(a[i], vaddq_u64(product, swapped));
+		}
+	}
+
+	for (int i = 0; i < 4; i++)
+		vst1q_u64(acc + 2 * i, a[i]);
+#else
+	for (size_t s = 0; s < stripes; s++, p += StripeSize)
+	{
+		for (int i = 0; i < 8; i++)
+		{
+			uint64_t data = read64(p + 8 * i);
+			uint64_t key = data ^ Secret[i];
+			acc[i ^ 1] += data;
+			acc[i] += (key & 0xffffffffu) * (key >> 32);
+		}
+	}
+#endif
+}
+
+static void scramble(uint64_t *acc)
+{
+	for (int i = 0; i < 8; i++)
+	{
+		uint64_t v = acc[i];
+		v ^= v >> 47;
+		v ^= Secret[7 - i];
+		acc[i] = v * Prime32_1;
+	}
+}
+
+static uint64_t hash_long(const uint8_t *p, size_t size, uint64_t seed)
+{
+	alignas(16) uint64_t acc[8] = {
+		Prime32_1 + seed, Prime64_1, Prime64_2, Prime64_3 - seed,
+		Prime64_2 ^ seed, Prime32_1, Prime64_1 + seed, Prime64_3,
+	};
+
+	size_t stripes = (size - 1) / StripeSize;
+	const uint8_t *end = p + stripes * StripeSize;
+	while (p < end)
+	{
+		size_t count = std::min<size_t>(StripesPerBlock, size_t(end - p) / StripeSize);
+		accumulate(acc, p, count);
+		p += count * StripeSize;
+		if (count == StripesPerBlock)
+			scramble(acc);
+	}
+
+	// The last stripe overlaps the previous one unless size is a multiple of the stripe size.
+	accumulate(acc, end + (size - stripes * StripeSize) - StripeSize, 1);
+
+	uint64_t h = size * Prime64_1;
+	for (int i = 0; i < 4; i++)
+		h += mul128_fold64(acc[2 * i] ^ Secret[2 * i + 1], acc[2 * i + 1] ^ Secret[(2 * i + 4) & 7]);
+	return avalanche(h);
+}
+
+uint64_t hash_fast(const void *data, size_t size, uint64_t seed)
+{
+	auto *p = static_cast<const uint8_t *>(data);
+	if (size <= 16)
+		return hash_short(p, size, seed);
+	else if (size <= 128)
+		return hash_medium(p, size, seed);
+	else
+		return hash_long(p, size, seed);
+}
+} // namespace dxil_spv
@@ -0,0 +1,93 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace dxil_spv
+{
+// Fast 64-bit hash of a buffer, processed in 64-byte stripes with SSE2 or NEON where available.
+// The result is the same on every path. Use this rather than FNV-1 unless the hash must match vkd3d-proton.
+uint64_t hash_fast(const void *data, size_t size, uint64_t seed = 0);
+
+// FNV-1, as used for DXBC shader hashes in vkd3d-proton (see DescriptorQAInfo::shader_hash).
+class Hasher
+{
+public:
+	Hasher() = default;
+
+	explicit Hasher(uint64_t h_)
+	    : h(h_)
+	{
+	}
+
+	void data(const void *data_, size_t size)
+	{
+		auto *bytes = static_cast<const uint8_t *>(data_);
+		for (size_t i = 0; i < size; i++)
+			h = (h * 0x100000001b3ull) ^ bytes[i];
+	}
+
+	void u32(uint32_t value)
+	{
+		h = (h * 0x100000001b3ull) ^ value;
+	}
+
+	void u64(uint64_t value)
+	{
+		u32(uint32_t(value));
+		u32(uint32_t(value >> 32));
+	}
+
+	void string(const char *str)
+	{
+		if (str)
+		{
+			size_t len = strlen(str);
+			u32(uint32_t(len));
+			data(str, len);
+		}
+		else
+			u32(0xffffffffu);
+	}
+
+	uint64_t get() const
+	{
+		return h;
+	}
+
+private:
+	uint64_t h = 0xcbf29ce484222325ull;
+};
+
+static inline uint64_t hash_fnv1(const void *data, size_t size)
+{
+	Hasher h;
+	h.data(data, size);
+	return h.get();
+}
+} // namespace dxil_spv
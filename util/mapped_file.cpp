@@ -0,0 +1,155 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "mapped_file.hpp"
+#include <stdio.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace dxil_spv
+{
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+void MappedFile::close()
+{
+	if (mapped)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(data);
+#else
+		munmap(const_cast<uint8_t *>(data), size);
+#endif
+	}
+
+	data = nullptr;
+	size = 0;
+	mapped = false;
+	fallback.clear();
+	fallback.shrink_to_fit();
+}
+
+bool MappedFile::read_fallback(const char *path)
+{
+	FILE *file = fopen(path, "rb");
+	if (!file)
+		return false;
+
+	// Size is not necessarily known up front, so just read until EOF.
+	uint8_t buffer[64 * 1024];
+	size_t count;
+	while ((count = fread(buffer, 1, sizeof(buffer), file)) != 0)
+		fallback.insert(fallback.end(), buffer, buffer + count);
+
+	bool ret = ferror(file) == 0;
+	fclose(file);
+	if (!ret)
+	{
+		fallback.clear();
+		return false;
+	}
+
+	data = fallback.data();
+	size = fallback.size();
+	return true;
+}
+
+bool MappedFile::open(const char *path)
+{
+	close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+	                          FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart <= 0 ||
+	    uint64_t(file_size.QuadPart) > uint64_t(SIZE_MAX))
+	{
+		CloseHandle(file);
+		return read_fallback(path);
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (!mapping)
+		return read_fallback(path);
+
+	// The view keeps the mapping alive on its own.
+	void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (!view)
+		return read_fallback(path);
+
+	data = static_cast<const uint8_t *>(view);
+	size = size_t(file_size.QuadPart);
+#else
+	int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	struct stat s;
+	if (fstat(fd, &s) != 0 || !S_ISREG(s.st_mode) || s.st_size <= 0 || uint64_t(s.st_size) > uint64_t(SIZE_MAX))
+	{
+		::close(fd);
+		return read_fallback(path);
+	}
+
+	// The mapping stays valid after the descriptor is closed.
+	void *view = mmap(nullptr, size_t(s.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (view == MAP_FAILED)
+		return read_fallback(path);
+
+	data = static_cast<const uint8_t *>(view);
+	size = size_t(s.st_size);
+#endif
+
+	mapped = true;
+	return true;
+}
+
+const uint8_t *MappedFile::get_data() const
+{
+	return data;
+}
+
+size_t MappedFile::get_size() const
+{
+	return size;
+}
+} // namespace dxil_spv
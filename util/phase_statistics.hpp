@@ -0,0 +1,113 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include "thread_local_allocator.hpp"
+#include <chrono>
+#include <stdint.h>
+
+namespace dxil_spv
+{
+enum class StatisticsPhase
+{
+	ContainerParse = 0,
+	BitcodeParse,
+	AnalyzeInstructions,
+	EmitResources,
+	ConvertFunction,
+	StructurizeCFG,
+	EmitFunctionBody,
+	FinalizeSPIRV,
+	Count
+};
+
+struct PhaseStatistics
+{
+	uint64_t time_ns = 0;
+	// Bytes requested from the thread allocator while in the phase.
+	uint64_t allocated_bytes = 0;
+	uint32_t invocations = 0;
+};
+
+struct ConversionStatistics
+{
+	PhaseStatistics phases[int(StatisticsPhase::Count)];
+
+	void reset()
+	{
+		for (auto &phase : phases)
+			phase = {};
+	}
+
+	PhaseStatistics &get(StatisticsPhase phase)
+	{
+		return phases[int(phase)];
+	}
+
+	const PhaseStatistics &get(StatisticsPhase phase) const
+	{
+		return phases[int(phase)];
+	}
+};
+
+// Accumulates elapsed time and allocations into a phase for the lifetime of the scope.
+// Phases may nest, in which case the outer phase includes the inner one. stats may be nullptr.
+class ScopedPhaseTimer
+{
+public:
+	ScopedPhaseTimer(ConversionStatistics *stats_, StatisticsPhase phase_)
+	    : stats(stats_)
+	    , phase(phase_)
+	{
+		if (stats)
+		{
+			start_allocated = get_thread_allocated_bytes();
+			start = std::chrono::steady_clock::now();
+		}
+	}
+
+	~ScopedPhaseTimer()
+	{
+		if (!stats)
+			return;
+
+		auto end = std::chrono::steady_clock::now();
+		auto &phase_stats = stats->get(phase);
+		phase_stats.time_ns += uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+		phase_stats.allocated_bytes += get_thread_allocated_bytes() - start_allocated;
+		phase_stats.invocations++;
+	}
+
+	ScopedPhaseTimer(const ScopedPhaseTimer &) = delete;
+	void operator=(const ScopedPhaseTimer &) = delete;
+
+private:
+	ConversionStatistics *stats;
+	StatisticsPhase phase;
+	std::chrono::steady_clock::time_point start;
+	uint64_t start_allocated = 0;
+};
+} // namespace dxil_spv
@@ -23,26 +23,143 @@
  */
 
 #include "thread_local_allocator.hpp"
+#include <algorithm>
 #include <assert.h>
 #include <stdint.h>
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
 
 namespace dxil_spv
 {
 static constexpr size_t BLOCK_SIZE = 64 * 1024;
+static constexpr size_t RAW_ALIGNMENT = 16;
+
+static AllocationCallbacks raw_callbacks;
+
+static void *raw_allocate(size_t size)
+{
+	if (raw_callbacks.allocate)
+		return raw_callbacks.allocate(raw_callbacks.userdata, size, RAW_ALIGNMENT);
+	else
+		return malloc(size);
+}
+
+static void raw_free(void *ptr)
+{
+	if (raw_callbacks.free)
+		raw_callbacks.free(raw_callbacks.userdata, ptr);
+	else
+		free(ptr);
+}
+
+// Arena blocks are aligned to BLOCK_SIZE, so the block which owns a small allocation can be found from its address.
+static void *raw_allocate_block(size_t size)
+{
+	if (raw_callbacks.allocate)
+		return raw_callbacks.allocate(raw_callbacks.userdata, size, BLOCK_SIZE);
+#ifdef _WIN32
+	return _aligned_malloc(size, BLOCK_SIZE);
+#else
+	void *ptr = nullptr;
+	if (posix_memalign(&ptr, BLOCK_SIZE, size) != 0)
+		return nullptr;
+	return ptr;
+#endif
+}
+
+static void raw_free_block(void *ptr)
+{
+	if (raw_callbacks.free)
+		raw_callbacks.free(raw_callbacks.userdata, ptr);
+	else
+	{
+#ifdef _WIN32
+		_aligned_free(ptr);
+#else
+		free(ptr);
+#endif
+	}
+}
+
+void set_allocation_callbacks(const AllocationCallbacks *callbacks)
+{
+	if (callbacks && callbacks->allocate && callbacks->free)
+		raw_callbacks = *callbacks;
+	else
+		raw_callbacks = {};
+}
+
+// Sizes up to 256 bytes are binned in 16 byte steps, larger sizes up to BLOCK_SIZE in powers of two.
+static constexpr size_t SMALL_SIZE_CLASS_LIMIT = 256;
+static constexpr unsigned NUM_SMALL_SIZE_CLASSES = SMALL_SIZE_CLASS_LIMIT / 16;
+static constexpr unsigned NUM_SIZE_CLASSES = NUM_SMALL_SIZE_CLASSES + 8;
+static_assert((SMALL_SIZE_CLASS_LIMIT << (NUM_SIZE_CLASSES - NUM_SMALL_SIZE_CLASSES)) == BLOCK_SIZE,
+              "Size classes must cover BLOCK_SIZE.");
+
+static unsigned get_size_class(size_t size)
+{
+	if (size <= SMALL_SIZE_CLASS_LIMIT)
+		return size ? unsigned((size - 1) / 16) : 0;
+
+	unsigned size_class = NUM_SMALL_SIZE_CLASSES;
+	size_t class_size = SMALL_SIZE_CLASS_LIMIT * 2;
+	while (class_size < size)
+	{
+		class_size *= 2;
+		size_class++;
+	}
+	return size_class;
+}
+
+static size_t get_size_class_size(unsigned size_class)
+{
+	if (size_class < NUM_SMALL_SIZE_CLASSES)
+		return (size_class + 1) * 16;
+	else
+		return SMALL_SIZE_CLASS_LIMIT << (size_class - NUM_SMALL_SIZE_CLASSES + 1);
+}
+
+class ChainAllocator;
+
+// Maps arena blocks to the allocator which owns them.
+// Only consulted when memory is freed on a different thread than the one which allocated it.
+struct BlockRegistry
+{
+	std::mutex lock;
+	std::unordered_map<uintptr_t, ChainAllocator *> owners;
+};
+
+static BlockRegistry &get_block_registry()
+{
+	static BlockRegistry registry;
+	return registry;
+}
 
 class ChainAllocator
 {
 public:
+	ChainAllocator(ThreadAllocatorMode mode, size_t byte_limit);
+	~ChainAllocator();
 	void reset();
 	void *allocate(size_t size);
+	void deallocate(void *ptr, size_t size);
+	void trim(size_t max_bytes);
+	size_t get_usage() const;
+	bool limit_exceeded() const;
 
 private:
 	struct MallocDeleter
 	{
 		void operator()(void *ptr)
 		{
-			free(ptr);
+			raw_free_block(ptr);
 		}
 	};
 
@@ -55,16 +172,63 @@ private:
 		size_t offset = 0;
 		size_t block_size = 0;
 	};
+	struct FreeNode
+	{
+		FreeNode *next;
+	};
+	// Memory freed by another thread. Recycled by the owning thread next time it runs out of free memory.
+	struct RemoteFreeNode
+	{
+		RemoteFreeNode *next;
+		size_t size;
+	};
+
 	std::vector<Block> blocks;
 	std::vector<Block> huge_blocks;
+	// Huge blocks which are not in use, kept around for later huge allocations of similar size.
+	std::vector<Block> cached_huge_blocks;
+	FreeNode *free_lists[NUM_SIZE_CLASSES] = {};
+	std::atomic<RemoteFreeNode *> remote_frees;
+	// Base addresses of blocks and huge blocks, so we can tell our own memory apart from memory of other arenas.
+	std::unordered_set<uintptr_t> owned_blocks;
 	unsigned block_index = 0;
+	size_t usage = 0;
+	size_t peak_usage = 0;
+	size_t retain_bytes = 0;
+	size_t byte_limit;
+	bool exceeded_limit = false;
+	bool recycle;
+
+	void add_usage(size_t size);
+	size_t get_retained_bytes() const;
 
 	bool ensure_block();
 	void *allocate_huge(size_t size);
+	void *allocate_bump(size_t size);
+
+	void register_block(const Block &block);
+	void unregister_block(const Block &block);
+	bool owns(void *ptr, size_t size) const;
+	void deallocate_local(void *ptr, size_t size);
+	static void deallocate_remote(void *ptr, size_t size);
+	void recycle_remote_frees();
 };
 
+ChainAllocator::ChainAllocator(ThreadAllocatorMode mode, size_t byte_limit_)
+	: remote_frees(nullptr), byte_limit(byte_limit_), recycle(mode == ThreadAllocatorMode::Recycle)
+{
+}
+
+ChainAllocator::~ChainAllocator()
+{
+	auto &registry = get_block_registry();
+	std::lock_guard<std::mutex> holder{ registry.lock };
+	for (uintptr_t base : owned_blocks)
+		registry.owners.erase(base);
+}
+
 ChainAllocator::Block::Block(size_t size)
-	: block(static_cast<uint8_t *>(malloc(size))), block_size(size)
+	: block(static_cast<uint8_t *>(raw_allocate_block(size))), block_size(size)
 {
 }
 
@@ -82,24 +246,151 @@ void *ChainAllocator::Block::allocate(size_t size)
 }
 
 static thread_local ChainAllocator *allocator;
+static thread_local uint64_t allocated_bytes;
+
+void ChainAllocator::register_block(const Block &block)
+{
+	auto base = reinterpret_cast<uintptr_t>(block.block.get());
+	owned_blocks.insert(base);
+	auto &registry = get_block_registry();
+	std::lock_guard<std::mutex> holder{ registry.lock };
+	registry.owners[base] = this;
+}
+
+void ChainAllocator::unregister_block(const Block &block)
+{
+	auto base = reinterpret_cast<uintptr_t>(block.block.get());
+	owned_blocks.erase(base);
+	auto &registry = get_block_registry();
+	std::lock_guard<std::mutex> holder{ registry.lock };
+	registry.owners.erase(base);
+}
 
 void ChainAllocator::reset()
 {
 	for (auto &block : blocks)
 		block.offset = 0;
 	block_index = 0;
+	for (auto &block : huge_blocks)
+		cached_huge_blocks.push_back(std::move(block));
 	huge_blocks.clear();
+	for (auto &list : free_lists)
+		list = nullptr;
+	// Anything other threads freed is part of the memory we just reset.
+	remote_frees.store(nullptr, std::memory_order_relaxed);
+
+	// Retain what recent conversions needed, but decay the high-water mark
+	// so that a single huge shader does not pin its footprint forever.
+	retain_bytes = std::max(peak_usage, retain_bytes - retain_bytes / 4);
+	trim(retain_bytes);
+
+	usage = 0;
+	peak_usage = 0;
+	exceeded_limit = false;
+}
+
+size_t ChainAllocator::get_retained_bytes() const
+{
+	size_t retained = blocks.size() * BLOCK_SIZE;
+	for (auto &block : huge_blocks)
+		retained += block.block_size;
+	for (auto &block : cached_huge_blocks)
+		retained += block.block_size;
+	return retained;
+}
+
+void ChainAllocator::trim(size_t max_bytes)
+{
+	// Only memory which is not in use can be released,
+	// i.e. cached huge blocks and the blocks after the current one.
+	size_t retained = get_retained_bytes();
+
+	// Release the largest huge blocks first, they are the least likely to be needed again.
+	std::sort(cached_huge_blocks.begin(), cached_huge_blocks.end(),
+	          [](const Block &a, const Block &b) { return a.block_size < b.block_size; });
+	while (retained > max_bytes && !cached_huge_blocks.empty())
+	{
+		retained -= cached_huge_blocks.back().block_size;
+		unregister_block(cached_huge_blocks.back());
+		cached_huge_blocks.pop_back();
+	}
+
+	while (retained > max_bytes && blocks.size() > block_index + 1)
+	{
+		retained -= BLOCK_SIZE;
+		unregister_block(blocks.back());
+		blocks.pop_back();
+	}
+}
+
+size_t ChainAllocator::get_usage() const
+{
+	return usage;
+}
+
+bool ChainAllocator::limit_exceeded() const
+{
+	return exceeded_limit;
+}
+
+void ChainAllocator::add_usage(size_t size)
+{
+	usage += size;
+	peak_usage = std::max(peak_usage, usage);
+	// We cannot fail allocations gracefully without exceptions, so only flag it.
+	// Parsing and conversion poll this and bail out.
+	if (byte_limit && usage > byte_limit)
+		exceeded_limit = true;
 }
 
 bool ChainAllocator::ensure_block()
 {
 	blocks.emplace_back(BLOCK_SIZE);
-	return bool(blocks.back().block);
+	if (!blocks.back().block)
+	{
+		blocks.pop_back();
+		return false;
+	}
+
+	register_block(blocks.back());
+	return true;
 }
 
 void *ChainAllocator::allocate_huge(size_t size)
 {
-	huge_blocks.emplace_back(size);
+	if (recycle && remote_frees.load(std::memory_order_relaxed))
+		recycle_remote_frees();
+
+	// Reuse the smallest cached block which fits, unless it would waste more than half of it.
+	size_t best_index = cached_huge_blocks.size();
+	for (size_t i = 0; i < cached_huge_blocks.size(); i++)
+	{
+		size_t block_size = cached_huge_blocks[i].block_size;
+		if (block_size >= size && block_size / 2 <= size &&
+		    (best_index == cached_huge_blocks.size() || block_size < cached_huge_blocks[best_index].block_size))
+		{
+			best_index = i;
+		}
+	}
+
+	if (best_index != cached_huge_blocks.size())
+	{
+		huge_blocks.push_back(std::move(cached_huge_blocks[best_index]));
+		std::swap(cached_huge_blocks[best_index], cached_huge_blocks.back());
+		cached_huge_blocks.pop_back();
+	}
+	else
+	{
+		huge_blocks.emplace_back(size);
+		if (!huge_blocks.back().block)
+		{
+			huge_blocks.pop_back();
+			return nullptr;
+		}
+		register_block(huge_blocks.back());
+	}
+
+	add_usage(huge_blocks.back().block_size);
 	return huge_blocks.back().block.get();
 }
 
@@ -108,6 +399,120 @@ void *ChainAllocator::allocate(size_t size)
 	if (size > BLOCK_SIZE)
 		return allocate_huge(size);
 
+	if (!recycle)
+	{
+		add_usage(size);
+		return allocate_bump(size);
+	}
+
+	// Round up to the size class so that the block can be recycled for any allocation in the same class.
+	unsigned size_class = get_size_class(size);
+	if (!free_lists[size_class] && remote_frees.load(std::memory_order_relaxed))
+		recycle_remote_frees();
+
+	if (auto *node = free_lists[size_class])
+	{
+		free_lists[size_class] = node->next;
+		return node;
+	}
+
+	size = get_size_class_size(size_class);
+	add_usage(size);
+	return allocate_bump(size);
+}
+
+bool ChainAllocator::owns(void *ptr, size_t size) const
+{
+	// Huge allocations are the start of their block.
+	auto base = reinterpret_cast<uintptr_t>(ptr);
+	if (size <= BLOCK_SIZE)
+		base &= ~uintptr_t(BLOCK_SIZE - 1);
+	return owned_blocks.count(base) != 0;
+}
+
+void ChainAllocator::deallocate(void *ptr, size_t size)
+{
+	if (!recycle || !ptr)
+		return;
+
+	if (owns(ptr, size))
+		deallocate_local(ptr, size);
+	else
+		deallocate_remote(ptr, size);
+}
+
+void ChainAllocator::deallocate_local(void *ptr, size_t size)
+{
+	if (size > BLOCK_SIZE)
+	{
+		// Huge blocks are normally freed in reverse order, e.g. when a Vector regrows.
+		for (size_t i = huge_blocks.size(); i; i--)
+		{
+			if (huge_blocks[i - 1].block.get() == ptr)
+			{
+				usage -= huge_blocks[i - 1].block_size;
+				std::swap(huge_blocks[i - 1], huge_blocks.back());
+				cached_huge_blocks.push_back(std::move(huge_blocks.back()));
+				huge_blocks.pop_back();
+				break;
+			}
+		}
+		return;
+	}
+
+	// All allocations are at least 16 bytes, so there is always room for the free list link.
+	unsigned size_class = get_size_class(size);
+	auto *node = static_cast<FreeNode *>(ptr);
+	node->next = free_lists[size_class];
+	free_lists[size_class] = node;
+}
+
+void ChainAllocator::deallocate_remote(void *ptr, size_t size)
+{
+	// Memory from another arena goes back to that arena rather than into our free lists.
+	// Otherwise it would be handed out again by this thread after its owner has reset or ended its context.
+	// The registry lock is held while pushing, so the owner cannot be destroyed underneath us.
+	auto base = reinterpret_cast<uintptr_t>(ptr);
+	if (size <= BLOCK_SIZE)
+		base &= ~uintptr_t(BLOCK_SIZE - 1);
+
+	auto &registry = get_block_registry();
+	std::lock_guard<std::mutex> holder{ registry.lock };
+	auto itr = registry.owners.find(base);
+	if (itr == registry.owners.end())
+	{
+		// Not arena memory, it was allocated outside of any thread allocator context.
+		raw_free(ptr);
+		return;
+	}
+
+	auto *owner = itr->second;
+	if (!owner->recycle)
+		return;
+
+	// Recycling arenas round every allocation up to at least 16 bytes, which fits the node.
+	auto *node = static_cast<RemoteFreeNode *>(ptr);
+	node->size = size;
+	node->next = owner->remote_frees.load(std::memory_order_relaxed);
+	while (!owner->remote_frees.compare_exchange_weak(node->next, node, std::memory_order_release,
+	                                                  std::memory_order_relaxed))
+	{
+	}
+}
+
+void ChainAllocator::recycle_remote_frees()
+{
+	auto *node = remote_frees.exchange(nullptr, std::memory_order_acquire);
+	while (node)
+	{
+		auto *next = node->next;
+		deallocate_local(node, node->size);
+		node = next;
+	}
+}
+
+void *ChainAllocator::allocate_bump(size_t size)
+{
 	if (block_index >= blocks.size() && !ensure_block())
 		return nullptr;
 
@@ -124,8 +529,10 @@ void *ChainAllocator::allocate(size_t size)
 
 void *allocate_in_thread(size_t size)
 {
+	allocated_bytes += size;
+
 	if (!allocator)
-		return malloc(size);
+		return raw_allocate(size);
 
 	return allocator->allocate(size);
 }
@@ -134,17 +541,43 @@ void free_in_thread(void *ptr)
 {
 	if (!allocator)
 	{
-		free(ptr);
+		raw_free(ptr);
+		return;
+	}
+
+	// Don't bother freeing. Without a size there is no size class to recycle into.
+}
+
+void free_in_thread(void *ptr, size_t size)
+{
+	if (!allocator)
+	{
+		raw_free(ptr);
 		return;
 	}
 
-	// Don't bother freeing ...
+	allocator->deallocate(ptr, size);
+}
+
+bool has_thread_allocator_context()
+{
+	return allocator != nullptr;
 }
 
 void begin_thread_allocator_context()
+{
+	begin_thread_allocator_context(ThreadAllocatorMode::Recycle);
+}
+
+void begin_thread_allocator_context(ThreadAllocatorMode mode)
+{
+	begin_thread_allocator_context(mode, 0);
+}
+
+void begin_thread_allocator_context(ThreadAllocatorMode mode, size_t byte_limit)
 {
 	assert(!allocator);
-	allocator = new ChainAllocator;
+	allocator = new ChainAllocator(mode, byte_limit);
 }
 
 void end_thread_allocator_context()
@@ -159,4 +592,25 @@ void reset_thread_allocator_context()
 	assert(allocator);
 	allocator->reset();
 }
+
+void trim_thread_allocator_context(size_t max_bytes)
+{
+	assert(allocator);
+	allocator->trim(max_bytes);
+}
+
+uint64_t get_thread_allocated_bytes()
+{
+	return allocated_bytes;
+}
+
+size_t get_thread_allocator_usage()
+{
+	return allocator ? allocator->get_usage() : 0;
+}
+
+bool thread_allocator_limit_exceeded()
+{
+	return allocator && allocator->limit_exceeded();
+}
 }
@@ -24,6 +24,7 @@
 
 #pragma once
 
+#include "hash.hpp"
 #include <vector>
 #include <unordered_set>
 #include <unordered_map>
@@ -38,8 +39,27 @@
 
 namespace dxil_spv
 {
+// Where all memory of the thread allocator, and any allocation made outside a thread allocator context, comes from.
+// allocate must return memory aligned to at least alignment.
+struct AllocationCallbacks
+{
+	void *userdata;
+	void *(*allocate)(void *userdata, size_t size, size_t alignment);
+	void (*free)(void *userdata, void *ptr);
+};
+
+// Process-wide. Must be set before anything is allocated, as memory must be freed with the callbacks it was allocated with.
+// nullptr restores malloc/free.
+void set_allocation_callbacks(const AllocationCallbacks *callbacks);
+
 void *allocate_in_thread(std::size_t size);
+// Without a size, memory is only reclaimed when the thread allocator context is reset.
 void free_in_thread(void *ptr);
+// Sized free. The memory can be recycled by later allocations in the same thread allocator context.
+// size must match the size passed to allocate_in_thread().
+// Memory may be freed on a different thread than the one which allocated it. It is then handed back to the
+// context which allocated it, so it must be freed before that context is reset or ended.
+void free_in_thread(void *ptr, std::size_t size);
 
 template <typename T>
 class ThreadLocalAllocator
@@ -56,9 +76,9 @@ public:
 		return static_cast<value_type *>(allocate_in_thread(sizeof(T) * n));
 	}
 
-	void deallocate(value_type *p, std::size_t)
+	void deallocate(value_type *p, std::size_t n)
 	{
-		free_in_thread(p);
+		free_in_thread(p, sizeof(T) * n);
 	}
 
 	using is_always_equal = std::true_type;
@@ -91,9 +111,39 @@ using StringStream = std::basic_ostringstream<char, std::char_traits<char>, Thre
 template <typename Key, typename Value, typename Hash = std::hash<Key>>
 using UnorderedMap = std::unordered_map<Key, Value, Hash, std::equal_to<Key>, ThreadLocalAllocator<std::pair<const Key, Value>>>;
 
+enum class ThreadAllocatorMode
+{
+	// Sized frees are recycled through per size-class free lists.
+	Recycle,
+	// Plain bump allocation, nothing is reclaimed until reset. Slightly faster for small shaders.
+	BumpOnly
+};
+
+// True if allocations on this thread currently go to a thread allocator context.
+bool has_thread_allocator_context();
+
 void begin_thread_allocator_context();
+void begin_thread_allocator_context(ThreadAllocatorMode mode);
+// byte_limit is a soft budget for the arena, 0 means unlimited. See thread_allocator_limit_exceeded().
+void begin_thread_allocator_context(ThreadAllocatorMode mode, size_t byte_limit);
 void end_thread_allocator_context();
 void reset_thread_allocator_context();
+// Releases memory the active context holds on to but is not using, until at most max_bytes are retained.
+// Memory which is in use is never released, so call this right after a reset to bound the footprint.
+// Reset also trims on its own, to a slowly decaying high-water mark of recent usage.
+void trim_thread_allocator_context(size_t max_bytes);
+
+// Running total of bytes requested through allocate_in_thread() on this thread.
+// Never reset, so only differences are meaningful.
+uint64_t get_thread_allocated_bytes();
+
+// Bytes taken from the arena of the active thread allocator context since it was last begun or reset.
+// Recycled blocks are not counted twice, so this is the peak footprint. 0 if there is no active context.
+size_t get_thread_allocator_usage();
+
+// True once the active context has used more than its byte limit since it was begun or reset.
+// Allocations keep succeeding regardless, so anything which can allocate without bound must poll this and fail.
+bool thread_allocator_limit_exceeded();
 
 template <typename T>
 static inline String to_string(T&& t)
@@ -111,16 +161,13 @@ struct hash<dxil_spv::String>
 {
 	size_t operator()(const dxil_spv::String &str) const
 	{
-		uint64_t h = 0xcbf29ce484222325ull;
-		for (auto c : str)
-			h = (h * 0x100000001b3ull) ^ uint8_t(c);
-		return size_t(h);
+		return size_t(dxil_spv::hash_fast(str.data(), str.size()));
 	}
 };
 }
 
 #define DXIL_SPV_OVERRIDE_NEW_DELETE \
 	void *operator new(size_t size) { return ::dxil_spv::allocate_in_thread(size); } \
-	void operator delete(void *ptr) { ::dxil_spv::free_in_thread(ptr); } \
+	void operator delete(void *ptr, size_t size) { ::dxil_spv::free_in_thread(ptr, size); } \
 	void *operator new[](size_t size) { return ::dxil_spv::allocate_in_thread(size); } \
-	void operator delete[](void *ptr) { ::dxil_spv::free_in_thread(ptr); }
+	void operator delete[](void *ptr, size_t size) { ::dxil_spv::free_in_thread(ptr, size); }
@@ -0,0 +1,166 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "thread_pool.hpp"
+#include "thread_local_allocator.hpp"
+#include <iterator>
+
+namespace dxil_spv
+{
+ThreadPool::ThreadPool(unsigned num_threads)
+{
+	if (num_threads == 0)
+		num_threads = std::thread::hardware_concurrency();
+	if (num_threads == 0)
+		num_threads = 1;
+
+	workers.reserve(num_threads);
+	for (unsigned i = 0; i < num_threads; i++)
+		workers.emplace_back(new Worker);
+
+	threads.reserve(num_threads);
+	for (unsigned i = 0; i < num_threads; i++)
+		threads.emplace_back(&ThreadPool::worker_main, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+	wait_idle();
+
+	{
+		std::lock_guard<std::mutex> holder{ wake_lock };
+		shutting_down = true;
+	}
+	wake_cond.notify_all();
+
+	for (auto &thread : threads)
+		thread.join();
+}
+
+unsigned ThreadPool::get_num_threads() const
+{
+	return unsigned(threads.size());
+}
+
+void ThreadPool::submit(Task task, uint64_t priority)
+{
+	unsigned index;
+	{
+		std::lock_guard<std::mutex> holder{ wake_lock };
+		index = submit_index;
+		submit_index = (submit_index + 1) % unsigned(workers.size());
+		outstanding_tasks++;
+		// Count the task before it becomes visible. Otherwise a worker could pop it and decrement first,
+		// and queued_tasks would wrap around. A worker woken early just retries until the push lands.
+		queued_tasks++;
+	}
+
+	{
+		auto &worker = *workers[index];
+		std::lock_guard<std::mutex> holder{ worker.lock };
+		// Scan from the back, so the common case of equal priorities is just an append.
+		auto itr = worker.queue.end();
+		while (itr != worker.queue.begin() && std::prev(itr)->priority < priority)
+			--itr;
+		worker.queue.insert(itr, { std::move(task), priority });
+	}
+
+	wake_cond.notify_one();
+}
+
+void ThreadPool::wait_idle()
+{
+	std::unique_lock<std::mutex> holder{ wake_lock };
+	idle_cond.wait(holder, [this]() { return outstanding_tasks == 0; });
+}
+
+bool ThreadPool::pop_task(unsigned index, Task &task)
+{
+	auto &worker = *workers[index];
+	std::lock_guard<std::mutex> holder{ worker.lock };
+	if (worker.queue.empty())
+		return false;
+
+	task = std::move(worker.queue.front().task);
+	worker.queue.pop_front();
+	return true;
+}
+
+bool ThreadPool::steal_task(unsigned index, Task &task)
+{
+	auto count = unsigned(workers.size());
+	for (unsigned i = 1; i < count; i++)
+	{
+		auto &victim = *workers[(index + i) % count];
+		std::lock_guard<std::mutex> holder{ victim.lock };
+		if (!victim.queue.empty())
+		{
+			// Steal the highest priority task too, so expensive tasks are not left to last.
+			task = std::move(victim.queue.front().task);
+			victim.queue.pop_front();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void ThreadPool::worker_main(unsigned index)
+{
+	begin_thread_allocator_context();
+
+	for (;;)
+	{
+		Task task;
+		if (pop_task(index, task) || steal_task(index, task))
+		{
+			{
+				std::lock_guard<std::mutex> holder{ wake_lock };
+				queued_tasks--;
+			}
+
+			task();
+			task = {};
+			reset_thread_allocator_context();
+
+			bool idle;
+			{
+				std::lock_guard<std::mutex> holder{ wake_lock };
+				idle = --outstanding_tasks == 0;
+			}
+
+			if (idle)
+				idle_cond.notify_all();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> holder{ wake_lock };
+		wake_cond.wait(holder, [this]() { return shutting_down || queued_tasks != 0; });
+		if (shutting_down && queued_tasks == 0)
+			break;
+	}
+
+	end_thread_allocator_context();
+}
+} // namespace dxil_spv
@@ -0,0 +1,91 @@
+/* Copyright (c) 2019-2022 Hans-Kristian Arntzen for Valve Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+namespace dxil_spv
+{
+// A small work-stealing pool.
+// Every worker owns a thread allocator context for its entire lifetime and resets it after every task,
+// so tasks must not leak any object allocated with the thread allocator out of the task itself.
+// Internal state deliberately uses the default allocator since it is shared between threads.
+class ThreadPool
+{
+public:
+	using Task = std::function<void ()>;
+
+	// If num_threads is 0, uses the number of hardware threads.
+	explicit ThreadPool(unsigned num_threads);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool &) = delete;
+	void operator=(const ThreadPool &) = delete;
+
+	// Queued tasks with a higher priority are started first. Tasks with equal priority start in submission order.
+	void submit(Task task, uint64_t priority = 0);
+
+	// Blocks until every submitted task has completed.
+	void wait_idle();
+
+	unsigned get_num_threads() const;
+
+private:
+	struct QueuedTask
+	{
+		Task task;
+		uint64_t priority;
+	};
+
+	struct Worker
+	{
+		std::mutex lock;
+		// Sorted by descending priority.
+		std::deque<QueuedTask> queue;
+	};
+
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::vector<std::thread> threads;
+
+	std::mutex wake_lock;
+	std::condition_variable wake_cond;
+	std::condition_variable idle_cond;
+	size_t queued_tasks = 0;
+	size_t outstanding_tasks = 0;
+	unsigned submit_index = 0;
+	bool shutting_down = false;
+
+	void worker_main(unsigned index);
+	bool pop_task(unsigned index, Task &task);
+	bool steal_task(unsigned index, Task &task);
+};
+} // namespace dxil_spv